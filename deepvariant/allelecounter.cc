@@ -34,9 +34,15 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <limits>
+#include <unordered_map>
+#include <utility>
 
+#include "deepvariant/core/cigar.h"
 #include "deepvariant/core/genomics/cigar.pb.h"
 #include "deepvariant/core/genomics/position.pb.h"
+#include "deepvariant/core/read_view.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/core/utils.h"
 #include "deepvariant/utils.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
@@ -47,14 +53,9 @@ namespace learning {
 namespace genomics {
 namespace deepvariant {
 
-// Separator string that will appear between the fragment name and read number
-// the string key constructed from a Read with ReadKey().
-static constexpr char kFragmentNameReadNumberSeparator[] = "/";
-
 using learning::genomics::v1::Range;
 using learning::genomics::v1::Read;
 using learning::genomics::v1::CigarUnit;
-using learning::genomics::v1::LinearAlignment;
 using core::GenomeReference;
 using tensorflow::strings::StrCat;
 using tensorflow::StringPiece;
@@ -69,13 +70,12 @@ namespace {
 // the point where we create a base Allele from a read, we instead set the type
 // to UNSPECIFIED and use this function to determine if the base is REFERENCE
 // or a SUBSTITUTION.
-AlleleType ResolveAlleleType(const AlleleCount& allele_count,
-                             const string& bases, const AlleleType& type) {
+AlleleType ResolveAlleleType(const char ref_base, const StringPiece bases,
+                             const AlleleType& type) {
   if (type == AlleleType::UNSPECIFIED) {
-    DCHECK(bases.size() == 1) << "Expected single base event for UNSPECIFIED at"
-                              << allele_count.position().ShortDebugString();
-    return allele_count.ref_base() == bases ? AlleleType::REFERENCE
-                                            : AlleleType::SUBSTITUTION;
+    DCHECK(bases.size() == 1) << "Expected single base event for UNSPECIFIED";
+    return bases[0] == ref_base ? AlleleType::REFERENCE
+                                : AlleleType::SUBSTITUTION;
   } else {
     return type;
   }
@@ -114,43 +114,62 @@ int TotalAlleleCounts(const AlleleCount& allele_count) {
          allele_count.ref_supporting_read_count();
 }
 
-// Returns true if all the bases in read from offset to offset + len pass
-// the quality threshold to be used for generating alleles for our counts.
-// offset + len must be less than or equal to the length of the aligned
-// sequence of read or a CHECK will fail.
-bool CanBasesBeUsed(const learning::genomics::v1::Read& read, int offset,
-                    int len, const AlleleCounterOptions& options) {
-  CHECK_LE(offset + len, read.aligned_quality_size());
-
-  const int min_base_quality = options.read_requirements().min_base_quality();
-  for (int i = 0; i < len; i++) {
-    if (!core::IsCanonicalBase(read.aligned_sequence()[offset + i])) {
-      return false;
-    }
-    if (read.aligned_quality(offset + i) < min_base_quality) {
-      return false;
-    }
+void AlleleCounter::ComputeUsableBases(const Read& read) {
+  const int n_bases = std::min<int>(core::ReadNumQualities(read),
+                                    read.aligned_sequence().size());
+  usable_bases_.Compute(StringPiece(read.aligned_sequence().data(), n_bases),
+                        read.aligned_quality().data(),
+                        options_.read_requirements().min_base_quality(),
+                        /*allow_n=*/false);
+}
+
+void AlleleCounter::ComputeUsableBases(const core::ReadView& read) {
+  // The bases of a ReadView are packed, so we unpack them first.
+  const int n_bases = core::ReadNumQualities(read);
+  bases_buffer_.resize(n_bases);
+  for (int i = 0; i < n_bases; ++i) {
+    bases_buffer_[i] = read.BaseAt(i);
   }
-  return true;
+  usable_bases_.Compute(bases_buffer_, read.Qualities(),
+                        options_.read_requirements().min_base_quality(),
+                        /*allow_n=*/false);
+}
+
+bool AlleleCounter::CanBasesBeUsed(const int offset, const int len) const {
+  CHECK_LE(offset + len, usable_bases_.size());
+  return usable_bases_.AllSet(offset, offset + len);
 }
 
 AlleleCounter::AlleleCounter(const GenomeReference* const ref,
                              const Range& range,
                              const AlleleCounterOptions& options)
     : ref_(ref), interval_(range), options_(options) {
-  // Initialize our counts vector of AlleleCounts with proper position and
-  // reference base information. Initially the alleles repeated field is empty.
-  const string bases = ref_->GetBases(range).ValueOrDie();
-  const int64 len = IntervalLength();
-  counts_.reserve(len);
-  for (int i = 0; i < len; ++i) {
-    AlleleCount allele_count;
-    const int64 pos = range.start() + i;
-    *(allele_count.mutable_position()) =
-        core::MakePosition(range.reference_name(), pos);
-    allele_count.set_ref_base(bases.substr(i, 1));
-    counts_.push_back(allele_count);
-  }
+  // Our per-base state is just the reference base and a counter of reference
+  // supporting reads; the non-reference alleles are stored sparsely in
+  // read_alleles_ as reads are added.
+  ref_bases_ = ref_->GetBases(range).ValueOrDie();
+  ref_supporting_read_counts_.assign(IntervalLength(), 0);
+  read_allele_starts_.assign(IntervalLength() + 1, 0);
+  AccountMemory();
+}
+
+void AlleleCounter::AccountMemory() const {
+  if (!core::StageMemoryTrackingEnabled()) return;
+  // Each entry of allele_ids_ is a tree node holding the key and id, and
+  // three pointers and a color.
+  constexpr int64 kAlleleIdNodeBytes =
+      sizeof(std::pair<const std::pair<string, AlleleType>, int>) +
+      4 * sizeof(void*);
+  memory_.Set(ref_bases_.capacity() +
+              ref_supporting_read_counts_.capacity() * sizeof(int) +
+              read_alleles_.capacity() * sizeof(ReadAlleleRecord) +
+              read_allele_starts_.capacity() * sizeof(int) +
+              read_ids_.MemoryUsage() + bases_buffer_.capacity() +
+              read_alleles_to_add_.capacity() * sizeof(ReadAllele) +
+              allele_bases_.capacity() +
+              alleles_.capacity() * sizeof(alleles_[0]) +
+              allele_ids_.size() * kAlleleIdNodeBytes +
+              counts_.capacity() * sizeof(AlleleCount) + counts_bytes_);
 }
 
 string AlleleCounter::RefBases(const int64 rel_start, const int64 len) {
@@ -168,44 +187,58 @@ string AlleleCounter::RefBases(const int64 rel_start, const int64 len) {
   }
 }
 
-string AlleleCounter::GetPrevBase(const Read& read, const int read_offset,
-                                  const int interval_offset) {
+bool AlleleCounter::AppendRefBases(const int64 rel_start, const int64 len) {
+  CHECK_GT(len, 0) << "Length must be >= 1";
+  if (rel_start >= 0 && rel_start + len <= IntervalLength()) {
+    allele_bases_.append(ref_bases_, rel_start, len);
+    return true;
+  }
+  const string bases = RefBases(rel_start, len);
+  allele_bases_.append(bases);
+  return !bases.empty();
+}
+
+template <typename ReadT>
+bool AlleleCounter::AppendPrevBase(const ReadT& read, const int read_offset,
+                                   const int interval_offset) {
   CHECK_GE(read_offset, 0) << "read_offset should be 0 or greater";
   if (read_offset == 0) {
     // The read_offset case is here to handle the case where the insertion/
     // deletion/soft_clip is the first cigar element of the read, and there's no
     // previous base in the read, and so we take our previous base from the
     // reference genome instead.
-    return RefBases(interval_offset - 1, 1);
+    return AppendRefBases(interval_offset - 1, 1);
   } else {
     // In all other cases we actually take our previous base from the read
     // itself.
-    return read.aligned_sequence().substr(read_offset - 1, 1);
+    allele_bases_.push_back(core::ReadBaseAt(read, read_offset - 1));
+    return true;
   }
 }
 
-ReadAllele AlleleCounter::MakeIndelReadAllele(const Read& read,
+template <typename ReadT>
+ReadAllele AlleleCounter::MakeIndelReadAllele(const ReadT& read,
                                               const int interval_offset,
                                               const int read_offset,
-                                              const CigarUnit& cigar) {
-  const int op_len = cigar.operation_length();
-  const string prev_base = GetPrevBase(read, read_offset, interval_offset);
-
-  if (prev_base.empty() || !core::AreCanonicalBases(prev_base) ||
-      (cigar.operation() != CigarUnit::DELETE &&
-       !CanBasesBeUsed(read, read_offset, op_len, options_))) {
+                                              const CigarUnit::Operation op,
+                                              const int op_len) {
+  // Alleles we don't add leave allele_bases_ as they found it.
+  const int bases_start = allele_bases_.size();
+  if (!AppendPrevBase(read, read_offset, interval_offset) ||
+      !core::IsCanonicalBase(allele_bases_.back()) ||
+      (op != CigarUnit::DELETE &&
+       !CanBasesBeUsed(read_offset, op_len))) {
     // There is no prev_base (we are at the start of the contig), or the bases
     // are unusable, so don't actually add the indel allele.
+    allele_bases_.resize(bases_start);
     return ReadAllele();
   }
 
   AlleleType type;
-  string bases;
-  switch (cigar.operation()) {
+  switch (op) {
     case CigarUnit::DELETE:
       type = AlleleType::DELETION;
-      bases = RefBases(interval_offset, op_len);
-      if (bases.empty()) {
+      if (!AppendRefBases(interval_offset, op_len)) {
         // We couldn't get the ref bases for the deletion (which can happen if
         // the deletion spans off the end of the contig), so abort now without
         // considering this read any longer. It's rare but such things happen in
@@ -217,35 +250,56 @@ ReadAllele AlleleCounter::MakeIndelReadAllele(const Read& read,
         // know that, and the read's cigar reflect true differences of the read
         // to the alignment at the start of the contig.  Nasty, I know.
         LOG(WARNING) << "Deletion spans off the chromosome for read: "
-                     << read.ShortDebugString();
+                     << deepvariant::ReadKey(read);
+        allele_bases_.resize(bases_start);
         return ReadAllele();
       }
 
-      if (!core::AreCanonicalBases(bases)) {
+      if (!core::AreCanonicalBases(
+              StringPiece(allele_bases_).substr(bases_start + 1))) {
         // The reference genome has non-canonical bases that are being deleted.
         // We don't add deletions with non-canonical bases so we return an empty
         // ReadAllele().
+        allele_bases_.resize(bases_start);
         return ReadAllele();
       }
 
       break;
     case CigarUnit::INSERT:
-      type = AlleleType::INSERTION;
-      bases = read.aligned_sequence().substr(read_offset, op_len);
-      break;
     case CigarUnit::CLIP_SOFT:
-      type = AlleleType::SOFT_CLIP;
-      bases = read.aligned_sequence().substr(read_offset, op_len);
+      type = op == CigarUnit::INSERT ? AlleleType::INSERTION
+                                     : AlleleType::SOFT_CLIP;
+      for (int i = 0; i < op_len; ++i) {
+        allele_bases_.push_back(core::ReadBaseAt(read, read_offset + i));
+      }
       break;
     default:
-      LOG(FATAL) << "Unexpected cigar operation: " << cigar.DebugString();
+      LOG(FATAL) << "Unexpected cigar operation: "
+                 << CigarUnit::Operation_Name(op);
   }
 
-  return ReadAllele(interval_offset - 1, StrCat(prev_base, bases), type);
+  return ReadAllele(interval_offset - 1, bases_start,
+                    allele_bases_.size() - bases_start, type);
 }
 
-void AlleleCounter::AddReadAlleles(const Read& read,
+int AlleleCounter::InternAllele(const StringPiece bases,
+                                const AlleleType type) {
+  allele_key_.first.assign(bases.data(), bases.size());
+  allele_key_.second = type;
+  const auto found = allele_ids_.find(allele_key_);
+  if (found != allele_ids_.end()) return found->second;
+  const int allele_id = alleles_.size();
+  allele_ids_.emplace(allele_key_, allele_id);
+  alleles_.push_back(allele_key_);
+  return allele_id;
+}
+
+template <typename ReadT>
+void AlleleCounter::AddReadAlleles(const ReadT& read,
                                    const std::vector<ReadAllele>& to_add) {
+  // The read is only interned if it carries a non-reference allele, as most
+  // reads in a typical interval only support the reference.
+  int read_id = -1;
   for (size_t i = 0; i < to_add.size(); ++i) {
     const ReadAllele& to_add_i = to_add[i];
 
@@ -268,99 +322,185 @@ void AlleleCounter::AddReadAlleles(const Read& read,
       continue;
     }
 
-    AlleleCount& allele_count = counts_[to_add_i.position()];
+    const int offset = to_add_i.position();
+    const StringPiece bases(allele_bases_.data() + to_add_i.bases_start(),
+                            to_add_i.bases_length());
     const AlleleType type =
-        ResolveAlleleType(allele_count, to_add_i.bases(), to_add_i.type());
+        ResolveAlleleType(ref_bases_[offset], bases, to_add_i.type());
 
     if (type == AlleleType::REFERENCE) {
-      const int prev_count = allele_count.ref_supporting_read_count();
-      allele_count.set_ref_supporting_read_count(prev_count + 1);
+      ++ref_supporting_read_counts_[offset];
     } else {
-      auto* read_alleles = allele_count.mutable_read_alleles();
-      const string key = ReadKey(read);
-      const Allele allele = MakeAllele(to_add_i.bases(), type, 1);
-
-      // Naively, there should never be multiple counts for the same read key.
-      // We detect such a situation here but only write out a warning. It would
-      // be better to have a stronger response (FATAL), but unfortunately we see
-      // data in the wild that we need to process that has duplicates.
-      if (read_alleles->count(key)) {
+      if (read_id < 0) {
+        bool seen_before = false;
+        read_id = read_ids_.Intern(read, &seen_before);
+        has_duplicate_reads_ |= seen_before;
+      }
+      read_alleles_.push_back(
+          {offset, read_id, InternAllele(bases, type)});
+      read_alleles_indexed_ = false;
+    }
+  }
+  if (read_id >= 0) AccountMemory();
+}
+
+void AlleleCounter::IndexReadAlleles() const {
+  if (read_alleles_indexed_) return;
+
+  // Reads are added in roughly coordinate order so the records are nearly
+  // sorted already. The sort must be stable so that records at each offset
+  // stay in the order they were added.
+  std::stable_sort(read_alleles_.begin(), read_alleles_.end(),
+                   [](const ReadAlleleRecord& a, const ReadAlleleRecord& b) {
+                     return a.offset < b.offset;
+                   });
+
+  // Naively, there should never be multiple records for the same read at an
+  // offset. We detect such a situation here but only write out a warning. It
+  // would be better to have a stronger response (FATAL), but unfortunately we
+  // see data in the wild that we need to process that has duplicates. As with
+  // a map keyed by read, the last record added for a read wins.
+  if (has_duplicate_reads_) {
+    std::vector<ReadAlleleRecord> unique;
+    unique.reserve(read_alleles_.size());
+    std::unordered_map<int, size_t> read_to_record;
+    for (size_t i = 0; i < read_alleles_.size(); ++i) {
+      const ReadAlleleRecord& record = read_alleles_[i];
+      if (i == 0 || record.offset != read_alleles_[i - 1].offset) {
+        read_to_record.clear();
+      }
+      const auto found = read_to_record.find(record.read_id);
+      if (found == read_to_record.end()) {
+        read_to_record[record.read_id] = unique.size();
+        unique.push_back(record);
+      } else {
         // Not thread safe.
         static int counter = 0;
         if (counter++ < 1) {
-          LOG(WARNING) << "Found duplicate read: " << key << " at "
-                       << allele_count.position().ShortDebugString();
+          LOG(WARNING) << "Found duplicate read: " << ReadKeyOf(record.read_id)
+                       << " at " << interval_.reference_name() << ":"
+                       << interval_.start() + record.offset;
         }
+        unique[found->second] = record;
       }
+    }
+    read_alleles_.swap(unique);
+  }
 
-      (*read_alleles)[key] = allele;
+  std::fill(read_allele_starts_.begin(), read_allele_starts_.end(), 0);
+  for (const ReadAlleleRecord& record : read_alleles_) {
+    ++read_allele_starts_[record.offset + 1];
+  }
+  for (size_t i = 1; i < read_allele_starts_.size(); ++i) {
+    read_allele_starts_[i] += read_allele_starts_[i - 1];
+  }
+  read_alleles_indexed_ = true;
+}
+
+template <typename ReadT>
+bool AlleleCounter::AddReferenceRead(const ReadT& read) {
+  // Only reads aligned by a single alignment operation can be pure reference.
+  int n_ops = 0;
+  bool is_match = false;
+  int length = 0;
+  core::WalkCigar(read, [&](const CigarUnit::Operation op, const int op_len,
+                            const int64, const int) {
+    is_match = op == CigarUnit::ALIGNMENT_MATCH ||
+               op == CigarUnit::SEQUENCE_MATCH ||
+               op == CigarUnit::SEQUENCE_MISMATCH;
+    length = op_len;
+    return ++n_ops == 1;
+  });
+  if (n_ops != 1 || !is_match) return false;
+
+  // Only the bases within our interval matter.
+  const int64 read_offset = core::ReadStart(read) - interval_.start();
+  const int64 begin = std::max<int64>(read_offset, 0);
+  const int64 end = std::min<int64>(read_offset + length, IntervalLength());
+
+  // Every usable base must match the reference, as any other would be a
+  // SUBSTITUTION allele. Unusable bases aren't counted either way.
+  for (int64 i = begin; i < end; ++i) {
+    if (core::ReadBaseAt(read, i - read_offset) != ref_bases_[i] &&
+        CanBasesBeUsed(i - read_offset, 1)) {
+      return false;
     }
   }
+  for (int64 i = begin; i < end; ++i) {
+    if (CanBasesBeUsed(i - read_offset, 1)) {
+      ++ref_supporting_read_counts_[i];
+    }
+  }
+  return true;
 }
 
-void AlleleCounter::Add(const Read& read) {
+template <typename ReadT>
+void AlleleCounter::AddRead(const ReadT& read) {
+  core::ScopedStageTimer timer(core::ALLELE_COUNTING);
   // redacted
 
-  const LinearAlignment& aln = read.alignment();
-  std::vector<ReadAllele> to_add;
-  to_add.reserve(read.aligned_quality_size());
-  int read_offset = 0;
-  int interval_offset = aln.position().position() - Interval().start();
+  // Checks the bases and qualities of the whole read once, up front, so that
+  // every check below is a lookup.
+  ComputeUsableBases(read);
+
+  // Most reads just match the reference, and so only bump the counts of
+  // reference supporting reads, which we can do without building any
+  // ReadAlleles.
+  if (AddReferenceRead(read)) {
+    ++n_reads_counted_;
+    counts_materialized_ = false;
+    return;
+  }
+
+  std::vector<ReadAllele>& to_add = read_alleles_to_add_;
+  to_add.clear();
+  allele_bases_.clear();
+  const int64 interval_start = Interval().start();
 
-  for (const auto& cigar_elt : aln.cigar()) {
-    const int op_len = cigar_elt.operation_length();
-    switch (cigar_elt.operation()) {
+  core::WalkCigar(read, [&](const CigarUnit::Operation op, const int op_len,
+                            const int64 ref_pos, const int read_offset) {
+    const int interval_offset = ref_pos - interval_start;
+    switch (op) {
       case CigarUnit::ALIGNMENT_MATCH:
       case CigarUnit::SEQUENCE_MATCH:
       case CigarUnit::SEQUENCE_MISMATCH:
         for (int i = 0; i < op_len; ++i) {
           const int base_offset = read_offset + i;
-          if (CanBasesBeUsed(read, base_offset, 1, options_)) {
-            const string bases = read.aligned_sequence().substr(base_offset, 1);
-            to_add.push_back(ReadAllele(interval_offset + i, bases,
-                                        AlleleType::UNSPECIFIED));
+          if (CanBasesBeUsed(base_offset, 1)) {
+            to_add.emplace_back(interval_offset + i, allele_bases_.size(), 1,
+                                AlleleType::UNSPECIFIED);
+            allele_bases_.push_back(core::ReadBaseAt(read, base_offset));
           }
         }
-        read_offset += op_len;
-        interval_offset += op_len;
         break;
       case CigarUnit::CLIP_SOFT:
       case CigarUnit::INSERT:
-        // Note, by convention VCF insertion/deletion are at the preceding base.
-        to_add.push_back(
-            MakeIndelReadAllele(read, interval_offset, read_offset, cigar_elt));
-        read_offset += op_len;
-        // No interval offset change, since an insertion doesn't move us on ref.
-        break;
       case CigarUnit::DELETE:
-        // By convention VCF insertion/deletion are at the preceding base.
-        to_add.push_back(
-            MakeIndelReadAllele(read, interval_offset, read_offset, cigar_elt));
-        // No read offset change, since a deletion doesn't consume read bases.
-        interval_offset += op_len;
-        break;
-      case CigarUnit::PAD:
-      case CigarUnit::SKIP:
-        // No read offset change, since a pad/skip don't consume read bases.
-        interval_offset += op_len;
-        break;
-      case CigarUnit::CLIP_HARD:
+        // Note, by convention VCF insertion/deletion are at the preceding base.
+        to_add.push_back(MakeIndelReadAllele(read, interval_offset,
+                                             read_offset, op, op_len));
         break;
       default:
-        // Lots of misc. enumerated values from proto that aren't useful such as
+        // Pads, skips and hard clips don't produce alleles. There are also
+        // lots of misc. enumerated values from proto that aren't useful such as
         // enumeration values INT_MIN_SENTINEL_DO_NOT_USE_ and
         // OPERATION_UNSPECIFIED.
         break;
     }
-  }
+    return true;
+  });
 
   AddReadAlleles(read, to_add);
   ++n_reads_counted_;
+  counts_materialized_ = false;
 }
 
-string AlleleCounter::ReadKey(const Read& read) {
-  return StrCat(read.fragment_name(), kFragmentNameReadNumberSeparator,
-                read.read_number());
+void AlleleCounter::Add(const Read& read) { AddRead(read); }
+
+void AlleleCounter::Add(const core::ReadView& read) { AddRead(read); }
+
+string AlleleCounter::ReadKey(const Read& read) const {
+  return deepvariant::ReadKey(read);
 }
 
 void AlleleCounter::Add(const std::vector<Read>& reads) {
@@ -368,24 +508,161 @@ void AlleleCounter::Add(const std::vector<Read>& reads) {
            [this](const Read& read) { this->Add(read); });
 }
 
+void AlleleCounter::AddOverlapping(const core::RegionReads& reads) {
+  for (const int i : reads.Query(interval_)) {
+    Add(reads.reads()[i]);
+  }
+}
+
+int AlleleCounter::NReadAlleles(const int64 offset) const {
+  IndexReadAlleles();
+  return read_allele_starts_[offset + 1] - read_allele_starts_[offset];
+}
+
+void AlleleCounter::ReadAllelesAt(const int64 offset,
+                                  const ReadAlleleRecord** begin,
+                                  const ReadAlleleRecord** end) const {
+  IndexReadAlleles();
+  *begin = read_alleles_.data() + read_allele_starts_[offset];
+  *end = read_alleles_.data() + read_allele_starts_[offset + 1];
+}
+
+AlleleCount AlleleCounter::CountAt(const int64 offset) const {
+  CHECK(offset >= 0 && offset < IntervalLength())
+      << "offset " << offset << " is outside of our interval";
+  AlleleCount allele_count;
+  *(allele_count.mutable_position()) = core::MakePosition(
+      interval_.reference_name(), interval_.start() + offset);
+  allele_count.set_ref_base(ref_bases_.substr(offset, 1));
+  allele_count.set_ref_supporting_read_count(
+      ref_supporting_read_counts_[offset]);
+
+  const ReadAlleleRecord* begin;
+  const ReadAlleleRecord* end;
+  ReadAllelesAt(offset, &begin, &end);
+  // Fills in each Allele in its map entry rather than copying it there.
+  auto* read_alleles = allele_count.mutable_read_alleles();
+  for (const ReadAlleleRecord* record = begin; record != end; ++record) {
+    Allele& allele = (*read_alleles)[ReadKeyOf(record->read_id)];
+    allele.set_bases(AlleleBases(record->allele_id));
+    allele.set_type(AlleleTypeOf(record->allele_id));
+    allele.set_count(1);
+  }
+  return allele_count;
+}
+
+const std::vector<AlleleCount>& AlleleCounter::Counts() const {
+  if (!counts_materialized_) {
+    counts_.clear();
+    counts_.reserve(IntervalLength());
+    counts_bytes_ = 0;
+    for (int64 i = 0; i < IntervalLength(); ++i) {
+      counts_.push_back(CountAt(i));
+      if (core::StageMemoryTrackingEnabled()) {
+        counts_bytes_ += counts_.back().SpaceUsedLong() - sizeof(AlleleCount);
+      }
+    }
+    counts_materialized_ = true;
+    AccountMemory();
+  }
+  return counts_;
+}
+
 std::vector<AlleleCountSummary> AlleleCounter::SummaryCounts() const {
   std::vector<AlleleCountSummary> summaries;
-  summaries.reserve(counts_.size());
-  for (const AlleleCount& allele_count : counts_) {
+  summaries.reserve(IntervalLength());
+  for (int64 i = 0; i < IntervalLength(); ++i) {
     AlleleCountSummary summary;
-    summary.set_reference_name(allele_count.position().reference_name());
-    summary.set_position(allele_count.position().position());
-    summary.set_ref_base(allele_count.ref_base());
-    summary.set_ref_supporting_read_count(
-        allele_count.ref_supporting_read_count());
-    summary.set_total_read_count(TotalAlleleCounts(allele_count));
-    summary.set_ref_nonconfident_read_count(
-        allele_count.ref_nonconfident_read_count());
+    summary.set_reference_name(interval_.reference_name());
+    summary.set_position(interval_.start() + i);
+    summary.set_ref_base(ref_bases_.substr(i, 1));
+    summary.set_ref_supporting_read_count(RefSupportingReadCount(i));
+    summary.set_total_read_count(TotalReadCount(i));
+    // We don't currently track non-confident reference reads.
+    summary.set_ref_nonconfident_read_count(0);
     summaries.push_back(summary);
   }
   return summaries;
 }
 
+// Returns the end (exclusive) of the alignment of read, a Read proto or a
+// ReadView, on the genome, as core::ReadEnd() does for Read protos.
+template <typename ReadT>
+int64 AlignmentEnd(const ReadT& read) {
+  int64 end = core::ReadStart(read);
+  core::WalkCigar(read, [&end](const CigarUnit::Operation op, const int op_len,
+                               const int64 ref_pos, const int) {
+    if (core::ConsumesReference(op)) end = ref_pos + op_len;
+    return true;
+  });
+  return end;
+}
+
+StreamingAlleleCounter::StreamingAlleleCounter(
+    const GenomeReference* const ref, const Range& range,
+    const AlleleCounterOptions& options, const int window_size, EmitFn emit)
+    : ref_(ref),
+      interval_(range),
+      options_(options),
+      window_size_(window_size),
+      emit_(std::move(emit)),
+      next_window_start_(range.start()),
+      last_read_start_(std::numeric_limits<int64>::min()) {
+  CHECK_GT(window_size_, 0) << "window_size must be > 0";
+}
+
+void StreamingAlleleCounter::PushWindow() {
+  const int64 end =
+      std::min<int64>(next_window_start_ + window_size_, interval_.end());
+  const Range window =
+      core::MakeRange(interval_.reference_name(), next_window_start_, end);
+  windows_.emplace_back(new AlleleCounter(ref_, window, options_));
+  next_window_start_ = end;
+}
+
+void StreamingAlleleCounter::EmitWindowsEndingBy(const int64 position) {
+  while (!windows_.empty() || next_window_start_ < interval_.end()) {
+    if (windows_.empty()) PushWindow();
+    if (windows_.front()->Interval().end() > position) break;
+    emit_(*windows_.front());
+    windows_.pop_front();
+  }
+}
+
+template <typename ReadT>
+void StreamingAlleleCounter::AddRead(const ReadT& read) {
+  core::ScopedStageTimer timer(core::ALLELE_COUNTING);
+  CHECK(!finished_) << "Cannot add reads after Finish()";
+  const int64 start = core::ReadStart(read);
+  CHECK_GE(start, last_read_start_) << "Reads must be coordinate-sorted: "
+                                    << deepvariant::ReadKey(read);
+  last_read_start_ = start;
+
+  // Indels and soft clips at the start of a read are counted at the base
+  // before the read starts, so a read can contribute to any position at or
+  // after start - 1. As later reads start at or after this one, every window
+  // ending before start - 1 is finished.
+  const int64 first = start - 1;
+  EmitWindowsEndingBy(first);
+
+  const int64 end = std::min<int64>(AlignmentEnd(read), interval_.end());
+  while (next_window_start_ < end) PushWindow();
+  for (const auto& window : windows_) {
+    if (window->Interval().start() >= end) break;
+    if (window->Interval().end() > first) window->Add(read);
+  }
+  ++n_reads_counted_;
+}
+
+void StreamingAlleleCounter::Add(const Read& read) { AddRead(read); }
+
+void StreamingAlleleCounter::Add(const core::ReadView& read) { AddRead(read); }
+
+void StreamingAlleleCounter::Finish() {
+  EmitWindowsEndingBy(interval_.end());
+  finished_ = true;
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
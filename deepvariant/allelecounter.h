@@ -35,16 +35,26 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_ALLELECOUNTER_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_ALLELECOUNTER_H_
 
+#include <deque>
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "deepvariant/core/base_mask.h"
 #include "deepvariant/core/genomics/cigar.pb.h"
 #include "deepvariant/core/genomics/position.pb.h"
 #include "deepvariant/core/genomics/range.pb.h"
 #include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/read_view.h"
 #include "deepvariant/core/reference.h"
+#include "deepvariant/core/region_reads.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/utils.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace learning {
@@ -75,13 +85,23 @@ int TotalAlleleCounts(const AlleleCount& allele_count);
 // The position of the ReadAllele can be < 0 and beyond the length of the
 // interval, indicating that some read that overlaps our interval carries an
 // Allele but it shouldn't be added to our AlleleCounts.
+//
+// A ReadAllele doesn't own its bases. They are the bases_length() characters
+// at bases_start() in the bases buffer of the AlleleCounter that made it, which
+// is reused from read to read, so the bases are only copied into a string of
+// their own if the allele is stored in the counter.
 class ReadAllele {
  public:
   ReadAllele() = default;
 
-  // Creates a ReadAllele with position, bases, and type.
-  ReadAllele(int position, const string& bases, const AlleleType& type)
-      : position_(position), bases_(bases), type_(type) {}
+  // Creates a ReadAllele with position and type, whose bases are the
+  // bases_length characters at bases_start in its counter's bases buffer.
+  ReadAllele(int position, int bases_start, int bases_length,
+             const AlleleType& type)
+      : position_(position),
+        bases_start_(bases_start),
+        bases_length_(bases_length),
+        type_(type) {}
 
   // Gets the position of this ReadAllele. Can be < 0 or >= IntervalLength(),
   // indicating that the ReadAllele refers to a position outside of the
@@ -91,8 +111,10 @@ class ReadAllele {
   // Returns true if this ReadAllele should be skipped.
   bool skip() const { return position_ == kInvalidPosition; }
 
-  // Gets the bases of the allele observed at this position.
-  const string& bases() const { return bases_; }
+  // Gets the span of the counter's bases buffer holding the bases of the
+  // allele observed at this position.
+  int bases_start() const { return bases_start_; }
+  int bases_length() const { return bases_length_; }
 
   // Gets the type of the allele observed at this position.
   const AlleleType& type() const { return type_; }
@@ -100,9 +122,25 @@ class ReadAllele {
  private:
   static constexpr int kInvalidPosition = -1;
 
-  const int position_ = kInvalidPosition;
-  const string bases_ = "";
-  const AlleleType type_ = AlleleType::UNSPECIFIED;
+  // These aren't const so that ReadAlleles can be moved, such as when a
+  // vector of them grows.
+  int position_ = kInvalidPosition;
+  int bases_start_ = 0;
+  int bases_length_ = 0;
+  AlleleType type_ = AlleleType::UNSPECIFIED;
+};
+
+// A compact record of the non-reference allele carried by a single read at a
+// single position of an AlleleCounter's interval. The read and allele are
+// referred to by their indices in the counter's read key and allele tables, so
+// a record is just a few integers regardless of the read name or allele length.
+struct ReadAlleleRecord {
+  // The offset, relative to the start of the interval, of this record.
+  int offset;
+  // The id of the read in AlleleCounter::ReadIds().
+  int read_id;
+  // The index of the allele in AlleleCounter::AlleleBases/AlleleTypeOf().
+  int allele_id;
 };
 
 // Workhorse class to compute AlleleCounts over an interval on the genome.
@@ -212,9 +250,19 @@ class AlleleCounter {
   // Adds the alleles from read to our AlleleCounts.
   void Add(const ::learning::genomics::v1::Read& read);
 
+  // Adds the alleles from the read viewed by read to our AlleleCounts, exactly
+  // as Add() does for the Read proto of the same record. This avoids building
+  // the proto for reads coming straight from a SamReader::QueryViews().
+  void Add(const core::ReadView& read);
+
   // Adds the alleles from each read in reads to our AlleleCounts.
   void Add(const std::vector<::learning::genomics::v1::Read>& reads);
 
+  // Adds the alleles from each of the reads of reads whose alignment overlaps
+  // our interval to our AlleleCounts, in their order in reads, as Python code
+  // does with the reads of an InMemorySamReader.query().
+  void AddOverlapping(const core::RegionReads& reads);
+
   // Gets the options in use by this AlleleCounter
   const AlleleCounterOptions& Options() const { return options_; }
 
@@ -230,23 +278,66 @@ class AlleleCounter {
   // basepair in our interval, filled in according to the reads that have been
   // added via calls to Add*() routines.
   //
-  // Calling this routine finalizes the AlleleCounts(), so that subsequent calls
-  // to Add*() will fail.
-  const std::vector<AlleleCount>& Counts() const { return counts_; }
+  // Internally the counter doesn't track AlleleCount protos at all, so the
+  // first call to this function materializes them from our compact
+  // representation. The result is cached until the next call to Add*(), which
+  // invalidates any previously returned reference.
+  const std::vector<AlleleCount>& Counts() const;
+
+  // Materializes the AlleleCount proto for the base at offset in our interval.
+  // offset must be >= 0 and < IntervalLength(). Prefer this function (or the
+  // native accessors below) to Counts() when only a few positions are needed.
+  AlleleCount CountAt(int64 offset) const;
 
   // Similar to Counts() function but returns a lighter-weight summary proto.
   //
   // This function has all of the behavior of calling Counts() but instead of
   // returning the heavy-weight AlleleCount proto this returns a simpler proto.
   // See the proto description for more information about the proto fields.
+  // This function never materializes AlleleCount protos.
   std::vector<AlleleCountSummary> SummaryCounts() const;
 
+  // Native accessors to the counts at offset in our interval, which must be
+  // >= 0 and < IntervalLength(). These read directly from our internal
+  // representation and so are much cheaper than CountAt() or Counts().
+  //
+  // The reference base at offset.
+  char RefBaseAt(int64 offset) const { return ref_bases_[offset]; }
+  // The number of reads supporting the reference base at offset.
+  int RefSupportingReadCount(int64 offset) const {
+    return ref_supporting_read_counts_[offset];
+  }
+  // The number of reads that carry a non-reference allele at offset.
+  int NReadAlleles(int64 offset) const;
+  // The total number of reads counted at offset, as in TotalAlleleCounts().
+  int TotalReadCount(int64 offset) const {
+    return RefSupportingReadCount(offset) + NReadAlleles(offset);
+  }
+  // Gets the range [*begin, *end) of ReadAlleleRecords at offset, which are in
+  // the order their reads were added to this counter.
+  void ReadAllelesAt(int64 offset, const ReadAlleleRecord** begin,
+                     const ReadAlleleRecord** end) const;
+  // The key of the read with read_id, as returned by ReadKey().
+  const string& ReadKeyOf(int read_id) const { return read_ids_.Key(read_id); }
+  // The bases of the allele with allele_id.
+  const string& AlleleBases(int allele_id) const {
+    return alleles_[allele_id].first;
+  }
+  // The type of the allele with allele_id.
+  AlleleType AlleleTypeOf(int allele_id) const {
+    return alleles_[allele_id].second;
+  }
+
   // How many reads have been added to this counter?
   int NCountedReads() const { return n_reads_counted_; }
 
   // Constructs a unique string key for this read. The key is the concatenation
-  // of fragment_name, "/", and read_number.
-  string ReadKey(const ::learning::genomics::v1::Read& read);
+  // of fragment_name, "/", and read_number. See ReadKey() in utils.h.
+  string ReadKey(const ::learning::genomics::v1::Read& read) const;
+
+  // Gets the ids assigned to the reads carrying non-reference alleles in this
+  // counter, as used in the read_id of ReadAlleleRecords.
+  const ReadIdInterner& ReadIds() const { return read_ids_; }
 
  private:
   // Helper function to get the reference bases between offsets rel_start
@@ -258,26 +349,74 @@ class AlleleCounter {
   // genomic coordinates implied by the offsets aren't all on the chromosome.
   string RefBases(int64 rel_start, int64 rel_end);
 
-  // Gets the base before read_offset in read, or if that would be before the
-  // start of the read (i.e., read_offset == 0) then return the previous base on
-  // the reference genome (at interval_offset - 1).
-  string GetPrevBase(const ::learning::genomics::v1::Read& read,
-                     int read_offset, int interval_offset);
-
-  // Creates a ReadAllele for an indel (type based on cigar) from read starting
-  // at read_offset position in the read to the AlleleCount at interval_offset.
+  // Appends the reference bases between offsets rel_start and rel_start + len,
+  // relative to our interval as in RefBases(), to allele_bases_. Bases within
+  // our interval are copied from ref_bases_ rather than fetched again. Returns
+  // false, appending nothing, if the bases aren't all on the chromosome.
+  bool AppendRefBases(int64 rel_start, int64 len);
+
+  // Appends the base before read_offset in read to allele_bases_, or if that
+  // would be before the start of the read (i.e., read_offset == 0) then the
+  // previous base on the reference genome (at interval_offset - 1). Returns
+  // false, appending nothing, if there is no such reference base.
+  template <typename ReadT>
+  bool AppendPrevBase(const ReadT& read, int read_offset, int interval_offset);
+
+  // Creates a ReadAllele for an indel (type based on the cigar operation op of
+  // length op_len) from read starting at read_offset position in the read to
+  // the AlleleCount at interval_offset, appending its bases to allele_bases_.
   // Does all of the necessary quality checks to ensure we only add good bases
   // to the our AlleleCounts, as well as manages the complexity of determining
   // the correct allele to add. May return a ReadAllele marked as skip() if the
   // implied allele isn't valid for some reason (e.g., bases are too low
   // quality).
+  template <typename ReadT>
   ReadAllele MakeIndelReadAllele(
-      const ::learning::genomics::v1::Read& read, int interval_offset,
-      int read_offset, const ::learning::genomics::v1::CigarUnit& cigar);
-
-  // Adds the ReadAlleles in to_add to our AlleleCounts.
-  void AddReadAlleles(const ::learning::genomics::v1::Read& read,
-                      const std::vector<ReadAllele>& to_add);
+      const ReadT& read, int interval_offset, int read_offset,
+      ::learning::genomics::v1::CigarUnit::Operation op, int op_len);
+
+  // Adds the alleles from read, a Read proto or a ReadView, to our
+  // AlleleCounts. This is the implementation of both Add() methods.
+  template <typename ReadT>
+  void AddRead(const ReadT& read);
+
+  // Sets usable_bases_ to the bases of read, a Read proto or a ReadView, that
+  // are canonical and of at least our min_base_quality.
+  void ComputeUsableBases(const ::learning::genomics::v1::Read& read);
+  void ComputeUsableBases(const core::ReadView& read);
+
+  // Returns true if all the bases of the read in usable_bases_ from offset to
+  // offset + len pass the quality threshold to be used for generating alleles
+  // for our counts. offset + len must be less than or equal to the number of
+  // base qualities of the read or a CHECK will fail.
+  bool CanBasesBeUsed(int offset, int len) const;
+
+  // If read is aligned by a single alignment operation, and all of its usable
+  // bases within our interval match the reference, bumps the counts of
+  // reference supporting reads over its bases in bulk, exactly as AddRead()
+  // would, and returns true. Returns false, without changing any counts,
+  // otherwise.
+  template <typename ReadT>
+  bool AddReferenceRead(const ReadT& read);
+
+  // Adds the ReadAlleles in to_add, whose bases are in allele_bases_, to our
+  // AlleleCounts.
+  template <typename ReadT>
+  void AddReadAlleles(const ReadT& read, const std::vector<ReadAllele>& to_add);
+
+  // Returns the index of the allele (bases, type) in alleles_, adding it if
+  // needed. The bases are only copied into a new string if they are added.
+  int InternAllele(tensorflow::StringPiece bases, AlleleType type);
+
+  // Groups read_alleles_ by offset, removing the records superseded by a later
+  // record for the same read at the same offset, and fills in
+  // read_allele_starts_. Does nothing if no reads were added since the last
+  // call.
+  void IndexReadAlleles() const;
+
+  // Updates memory_ with the bytes held by our buffers, if stage memory is
+  // tracked.
+  void AccountMemory() const;
 
   // Our GenomeReference, which we use to get information about the reference
   // bases in our interval.
@@ -294,8 +433,146 @@ class AlleleCounter {
   // The number of reads we've added to this interval.
   int n_reads_counted_ = 0;
 
-  // Our AlleleCount objects, one for each base in our interval, in order.
-  std::vector<AlleleCount> counts_;
+  // The reference bases of our interval, one for each base, in order.
+  string ref_bases_;
+
+  // The number of reference supporting reads at each base of our interval.
+  std::vector<int> ref_supporting_read_counts_;
+
+  // The non-reference alleles observed in our reads. Records are appended in
+  // the order they are added and grouped by offset on demand by
+  // IndexReadAlleles(), after which the records for offset i are found in
+  // [read_allele_starts_[i], read_allele_starts_[i + 1]).
+  mutable std::vector<ReadAlleleRecord> read_alleles_;
+  mutable std::vector<int> read_allele_starts_;
+  mutable bool read_alleles_indexed_ = true;
+
+  // True if any read key has been interned more than once, which means that
+  // read_alleles_ may carry multiple records for the same read at an offset.
+  bool has_duplicate_reads_ = false;
+
+  // The ids of the reads carrying non-reference alleles.
+  ReadIdInterner read_ids_;
+
+  // The usable bases of the read being added, and the unpacked bases of that
+  // read if it is a ReadView, both reused from read to read.
+  core::BaseMask usable_bases_;
+  string bases_buffer_;
+
+  // The ReadAlleles of the read being added and the buffer holding their
+  // bases, both reused from read to read.
+  std::vector<ReadAllele> read_alleles_to_add_;
+  string allele_bases_;
+
+  // The distinct (bases, type) alleles we've observed, indexed by allele_id.
+  std::vector<std::pair<string, AlleleType>> alleles_;
+  std::map<std::pair<string, AlleleType>, int> allele_ids_;
+  // The key InternAllele() looks alleles up by, whose string is reused so
+  // that lookups of alleles we already have don't allocate.
+  std::pair<string, AlleleType> allele_key_;
+
+  // Cache of materialized AlleleCounts returned by Counts().
+  mutable std::vector<AlleleCount> counts_;
+  mutable bool counts_materialized_ = false;
+  mutable tensorflow::int64 counts_bytes_ = 0;
+
+  // The memory held by our counts and read alleles, updated by AccountMemory()
+  // as they grow.
+  mutable core::ScopedStageMemory memory_{core::ALLELE_COUNTING};
+};
+
+// Computes AlleleCounts over a large interval, typically a whole contig, from
+// a coordinate-sorted stream of reads.
+//
+// Rather than holding counts for every base of its interval, the streaming
+// counter tiles the interval into windows of window_size basepairs and only
+// keeps an AlleleCounter for the windows that reads added so far overlap. As
+// soon as no future read can contribute to a window (reads are sorted, so no
+// later read starts before the current one) that window is passed to emit and
+// dropped. The memory used is therefore proportional to the read length times
+// the depth rather than to the size of the interval, and reads spanning window
+// boundaries are simply added to each window they overlap instead of being
+// fetched again for each region. emit is typically used to run the
+// VariantCaller incrementally, as in:
+//
+// StreamingAlleleCounter counter(ref, contig, options, 1000,
+//     [&](const AlleleCounter& window) {
+//       for (const auto& call : caller.CallsFromAlleleCounter(window)) ...
+//     });
+// for ( read : sorted_reads_on_contig ) counter.Add(read);
+// counter.Finish();
+//
+// Every window of the interval is emitted exactly once and in order, including
+// windows no read overlaps, so the emitted windows together cover the whole
+// interval. The windows emitted for a given set of reads have the same counts
+// as a single AlleleCounter over the window would have had for those reads.
+class StreamingAlleleCounter {
+ public:
+  // Called with each finished window.
+  using EmitFn = std::function<void(const AlleleCounter&)>;
+
+  // Creates a StreamingAlleleCounter over range, counting with options and
+  // passing each finished window of window_size basepairs (the last one may be
+  // shorter) to emit. window_size must be > 0.
+  //
+  // The GenomeReference must be available throughout the lifetime of this
+  // object.
+  StreamingAlleleCounter(const core::GenomeReference* const ref,
+                         const ::learning::genomics::v1::Range& range,
+                         const AlleleCounterOptions& options, int window_size,
+                         EmitFn emit);
+
+  // Adds the alleles from read to our AlleleCounts, emitting all of the
+  // windows that end before read starts. read must be aligned to the contig of
+  // our interval and must not start before any previously added read, but may
+  // start before the interval itself.
+  void Add(const ::learning::genomics::v1::Read& read);
+
+  // Same as Add() above but for the read viewed by read.
+  void Add(const core::ReadView& read);
+
+  // Emits all of the windows not yet emitted. No reads can be added after
+  // calling Finish().
+  void Finish();
+
+  // Gets the interval we are counting alleles over.
+  const ::learning::genomics::v1::Range& Interval() const { return interval_; }
+
+  // The number of windows currently held in memory.
+  int NActiveWindows() const { return windows_.size(); }
+
+  // How many reads have been added to this counter?
+  int NCountedReads() const { return n_reads_counted_; }
+
+ private:
+  // Implementation of both Add() methods.
+  template <typename ReadT>
+  void AddRead(const ReadT& read);
+
+  // Appends the next window of our interval to windows_.
+  void PushWindow();
+
+  // Emits and drops all of the windows ending at or before position.
+  void EmitWindowsEndingBy(int64 position);
+
+  const core::GenomeReference* const ref_;
+  const ::learning::genomics::v1::Range interval_;
+  const AlleleCounterOptions options_;
+  const int window_size_;
+  const EmitFn emit_;
+
+  // The windows that reads may still contribute to, in order. windows_ ends
+  // right before next_window_start_ and starts at the first window not yet
+  // emitted.
+  std::deque<std::unique_ptr<AlleleCounter>> windows_;
+  int64 next_window_start_;
+
+  // The start of the last read we added, used to check that reads are sorted.
+  // Reads overlapping the interval may start before it, so this starts out
+  // below any position.
+  int64 last_read_start_;
+  int n_reads_counted_ = 0;
+  bool finished_ = false;
 };
 
 }  // namespace deepvariant
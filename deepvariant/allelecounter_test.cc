@@ -32,9 +32,14 @@
 // UnitTests for allelecounter.{h,cc}.
 #include "deepvariant/allelecounter.h"
 
+#include <algorithm>
+
 #include "deepvariant/core/genomics/position.pb.h"
 #include "deepvariant/core/reference_fai.h"
+#include "deepvariant/core/read_view.h"
 #include "deepvariant/core/reference_test.h"
+#include "deepvariant/core/region_reads.h"
+#include "deepvariant/core/sam_reader.h"
 #include "deepvariant/core/test_utils.h"
 #include "deepvariant/core/utils.h"
 #include "deepvariant/utils.h"
@@ -62,6 +67,7 @@ using tensorflow::strings::StrCat;
 using ::testing::UnorderedPointwise;
 using ::testing::Eq;
 using ::testing::IsEmpty;
+using ::testing::Pointwise;
 using ::testing::Contains;
 using learning::genomics::testing::EqualsProto;
 using ::testing::SizeIs;
@@ -496,6 +502,26 @@ TEST_F(AlleleCounterTest, TestMultipleReads) {
       });
 }
 
+TEST_F(AlleleCounterTest, TestMixedAllelesInSuccessiveReads) {
+  // The bases of the alleles of each read are kept in a buffer reused from
+  // read to read, so mix alleles of different lengths within and across reads.
+  AddAndCheckReads(
+      {
+          MakeRead(chr_, start_, "TCAAAGGT", {"2M", "3I", "3M"}),
+          MakeRead(chr_, start_, "TCAT", {"1M", "1D", "1M", "1I", "1M"}),
+      },
+      {
+          {MakeAllele("T", AlleleType::REFERENCE, 1),
+           MakeAllele("TC", AlleleType::DELETION, 1)},
+          {MakeAllele("CAAA", AlleleType::INSERTION, 1)},
+          {MakeAllele("G", AlleleType::SUBSTITUTION, 1),
+           MakeAllele("CA", AlleleType::INSERTION, 1)},
+          {MakeAllele("G", AlleleType::REFERENCE, 1),
+           MakeAllele("T", AlleleType::SUBSTITUTION, 1)},
+          {MakeAllele("T", AlleleType::REFERENCE, 1)},
+      });
+}
+
 TEST_F(AlleleCounterTest, TestSoftClips1) {
   AddAndCheckReads(MakeRead(chr_, start_ + 2, "AACGT", {"2S", "3M"}),
                    {
@@ -620,6 +646,32 @@ TEST_F(AlleleCounterTest, TestMinBaseQualSNP) {
   }
 }
 
+TEST_F(AlleleCounterTest, TestReferenceReads) {
+  std::unique_ptr<AlleleCounter> allele_counter = MakeCounter();
+  // The mismatching A at the third base of bad_snp is too low quality to be
+  // counted, so both reads only support the reference.
+  auto bad_snp = MakeRead(chr_, start_ - 1, "ATACGTA", {"7M"});
+  bad_snp.set_aligned_quality(2, min_base_quality() - 1);
+  AddAndCheckReads({MakeRead(chr_, start_ - 2, "AATCCGTAA", {"9M"}), bad_snp},
+                   {
+                       {MakeAllele("T", AlleleType::REFERENCE, 2)},
+                       {MakeAllele("C", AlleleType::REFERENCE, 1)},
+                       {MakeAllele("C", AlleleType::REFERENCE, 2)},
+                       {MakeAllele("G", AlleleType::REFERENCE, 2)},
+                       {MakeAllele("T", AlleleType::REFERENCE, 2)},
+                   },
+                   allele_counter.get());
+  // Reads only supporting the reference are never interned.
+  EXPECT_THAT(allele_counter->ReadIds().size(), Eq(0));
+
+  // But a good mismatching base is still counted as a substitution.
+  allele_counter->Add(MakeRead(chr_, start_, "TACGT", {"5M"}));
+  EXPECT_THAT(allele_counter->NReadAlleles(1), Eq(1));
+  EXPECT_THAT(allele_counter->RefSupportingReadCount(1), Eq(1));
+  EXPECT_THAT(allele_counter->RefSupportingReadCount(2), Eq(3));
+  EXPECT_THAT(allele_counter->ReadIds().size(), Eq(1));
+}
+
 TEST_F(AlleleCounterTest, TestMinBaseQualInsertion) {
   // A bad base in the insertion stops us from adding that allele but it
   // preserves our good base before the insertion.
@@ -826,6 +878,203 @@ TEST_F(AlleleCounterTest, TestCountSummaries) {
   EXPECT_EQ(summaries[2].total_read_count(), 11);
 }
 
+TEST_F(AlleleCounterTest, TestNativeAccessorsMatchCounts) {
+  auto allele_counter = MakeCounter();
+  allele_counter->Add({
+      MakeRead(chr_, start_, "TCCGT", {"5M"}),
+      MakeRead(chr_, start_, "TCGT", {"2M", "1D", "2M"}),
+      MakeRead(chr_, start_, "TACGT", {"5M"}),
+      MakeRead(chr_, start_, "TCCAGT", {"3M", "1I", "2M"}),
+  });
+
+  for (int i = 0; i < allele_counter->IntervalLength(); ++i) {
+    const AlleleCount count = allele_counter->CountAt(i);
+    EXPECT_THAT(count, EqualsProto(allele_counter->Counts()[i]));
+    EXPECT_EQ(count.ref_base(), string(1, allele_counter->RefBaseAt(i)));
+    EXPECT_EQ(count.ref_supporting_read_count(),
+              allele_counter->RefSupportingReadCount(i));
+    EXPECT_EQ(count.read_alleles_size(), allele_counter->NReadAlleles(i));
+    EXPECT_EQ(TotalAlleleCounts(count), allele_counter->TotalReadCount(i));
+
+    const ReadAlleleRecord* begin;
+    const ReadAlleleRecord* end;
+    allele_counter->ReadAllelesAt(i, &begin, &end);
+    for (const ReadAlleleRecord* record = begin; record != end; ++record) {
+      EXPECT_EQ(record->offset, i);
+      const auto& key = allele_counter->ReadKeyOf(record->read_id);
+      ASSERT_EQ(count.read_alleles().count(key), 1);
+      const Allele& allele = count.read_alleles().at(key);
+      EXPECT_EQ(allele.bases(), allele_counter->AlleleBases(record->allele_id));
+      EXPECT_EQ(allele.type(), allele_counter->AlleleTypeOf(record->allele_id));
+    }
+  }
+}
+
+TEST_F(AlleleCounterTest, TestCountsUpdatedAfterAdd) {
+  auto allele_counter = MakeCounter();
+  allele_counter->Add(MakeRead(chr_, start_, "TACGT", {"5M"}));
+  EXPECT_EQ(allele_counter->Counts()[1].read_alleles_size(), 1);
+
+  // Adding more reads after Counts() invalidates the materialized counts.
+  allele_counter->Add(MakeRead(chr_, start_, "TACGT", {"5M"}));
+  EXPECT_EQ(allele_counter->Counts()[1].read_alleles_size(), 2);
+  EXPECT_THAT(SumAlleleCounts(allele_counter->Counts()[1]),
+              UnorderedPointwise(EqualsProto(),
+                                 std::vector<Allele>{MakeAllele(
+                                     "A", AlleleType::SUBSTITUTION, 2)}));
+}
+
+TEST_F(AlleleCounterTest, TestAddOverlappingRegionReads) {
+  // Only the reads overlapping the interval are counted, exactly as if they
+  // had been added one at a time.
+  const std::vector<Read> reads = {
+      MakeRead(chr_, start_, "TCCGT", {"5M"}),
+      MakeRead(chr_, end_ + 10, "ACGT", {"4M"}),
+      MakeRead(chr_, start_ + 2, "CAT", {"1M", "1I", "1M"}),
+  };
+  auto expected = MakeCounter();
+  expected->Add(reads[0]);
+  expected->Add(reads[2]);
+
+  auto allele_counter = MakeCounter();
+  allele_counter->AddOverlapping(core::RegionReads(reads));
+  EXPECT_EQ(2, allele_counter->NCountedReads());
+  EXPECT_THAT(allele_counter->Counts(),
+              Pointwise(EqualsProto(), expected->Counts()));
+}
+
+TEST_F(AlleleCounterTest, TestStreamingReadsStartingBeforeInterval) {
+  // Sorted reads overlapping the interval, as a region query returns them: the
+  // first two start before the interval does.
+  const std::vector<Read> reads = {
+      MakeRead(chr_, start_ - 2, "AATCCGTAA", {"9M"}),
+      MakeRead(chr_, start_ - 1, "ATCAG", {"5M"}),
+      MakeRead(chr_, start_ - 1, "AGGTC", {"1M", "2I", "2M"}),
+      MakeRead(chr_, start_ + 1, "CCGT", {"4M"}),
+  };
+  auto whole = MakeCounter();
+  whole->Add(reads);
+
+  std::vector<AlleleCount> streamed;
+  StreamingAlleleCounter streaming(
+      ref_.get(), MakeRange(chr_, start_, end_), options_, 2,
+      [&streamed](const AlleleCounter& window) {
+        streamed.insert(streamed.end(), window.Counts().begin(),
+                        window.Counts().end());
+      });
+  for (const Read& read : reads) {
+    streaming.Add(read);
+  }
+  streaming.Finish();
+  EXPECT_EQ(streaming.NCountedReads(), reads.size());
+  EXPECT_THAT(streamed, Pointwise(EqualsProto(), whole->Counts()));
+}
+
+TEST_F(AlleleCounterTest, TestDuplicateReadsKeepLastAllele) {
+  // Two reads with the same key carrying different alleles only count once,
+  // with the allele of the read added last.
+  Read read1 = MakeRead(chr_, start_, "TACGT", {"5M"});
+  Read read2 = MakeRead(chr_, start_, "TGCGT", {"5M"});
+  read2.set_fragment_name(read1.fragment_name());
+  read2.set_read_number(read1.read_number());
+
+  auto allele_counter = MakeCounter();
+  allele_counter->Add({read1, read2});
+  EXPECT_EQ(allele_counter->NReadAlleles(1), 1);
+  EXPECT_THAT(SumAlleleCounts(allele_counter->Counts()[1]),
+              UnorderedPointwise(EqualsProto(),
+                                 std::vector<Allele>{MakeAllele(
+                                     "G", AlleleType::SUBSTITUTION, 1)}));
+}
+
+TEST(AlleleCounterReadViewTest, AddingViewsMatchesAddingProtos) {
+  constexpr char kTestDataDir[] = "deepvariant/testdata";
+  const string fasta =
+      core::GetTestData("ucsc.hg19.chr20.unittest.fasta.gz", kTestDataDir);
+  std::unique_ptr<const GenomeReference> ref =
+      std::move(core::GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"))
+                    .ValueOrDie());
+  core::SamReaderOptions reader_options;
+  reader_options.set_index_mode(
+      core::IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+  std::unique_ptr<core::SamReader> reader = std::move(
+      core::SamReader::FromFile(
+          core::GetTestData("NA12878_S1.chr20.10_10p1mb.bam", kTestDataDir),
+          reader_options)
+          .ValueOrDie());
+
+  const auto range = MakeRange("chr20", 10000000, 10000100);
+  AlleleCounterOptions options;
+  options.mutable_read_requirements()->set_min_base_quality(21);
+  AlleleCounter from_protos(ref.get(), range, options);
+  AlleleCounter from_views(ref.get(), range, options);
+  from_protos.Add(core::as_vector(reader->Query(range)));
+  std::shared_ptr<core::SamViewIterable> views =
+      reader->QueryViews(range).ValueOrDie();
+  core::ReadView view;
+  while (views->Next(&view).ValueOrDie()) {
+    from_views.Add(view);
+  }
+
+  EXPECT_GT(from_protos.NCountedReads(), 0);
+  EXPECT_EQ(from_views.NCountedReads(), from_protos.NCountedReads());
+  EXPECT_THAT(from_views.Counts(),
+              Pointwise(EqualsProto(), from_protos.Counts()));
+}
+
+TEST(StreamingAlleleCounterTest, StreamingMatchesWholeIntervalCounts) {
+  constexpr char kTestDataDir[] = "deepvariant/testdata";
+  const string fasta =
+      core::GetTestData("ucsc.hg19.chr20.unittest.fasta.gz", kTestDataDir);
+  std::unique_ptr<const GenomeReference> ref =
+      std::move(core::GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"))
+                    .ValueOrDie());
+  core::SamReaderOptions reader_options;
+  reader_options.set_index_mode(
+      core::IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+  std::unique_ptr<core::SamReader> reader = std::move(
+      core::SamReader::FromFile(
+          core::GetTestData("NA12878_S1.chr20.10_10p1mb.bam", kTestDataDir),
+          reader_options)
+          .ValueOrDie());
+
+  const auto range = MakeRange("chr20", 10000000, 10001000);
+  AlleleCounterOptions options;
+  options.mutable_read_requirements()->set_min_base_quality(21);
+  AlleleCounter whole(ref.get(), range, options);
+  const std::vector<Read> reads = core::as_vector(reader->Query(range));
+  whole.Add(reads);
+
+  std::vector<AlleleCount> streamed;
+  std::vector<int64> window_starts;
+  int max_active_windows = 0;
+  StreamingAlleleCounter streaming(
+      ref.get(), range, options, 64, [&](const AlleleCounter& window) {
+        window_starts.push_back(window.Interval().start());
+        EXPECT_LE(window.IntervalLength(), 64);
+        streamed.insert(streamed.end(), window.Counts().begin(),
+                        window.Counts().end());
+      });
+  for (const Read& read : reads) {
+    streaming.Add(read);
+    max_active_windows =
+        std::max(max_active_windows, streaming.NActiveWindows());
+  }
+  EXPECT_EQ(streaming.NCountedReads(), reads.size());
+  streaming.Finish();
+  EXPECT_EQ(streaming.NActiveWindows(), 0);
+
+  // The windows tile the interval in order and, once the reads no longer
+  // overlap them, are emitted with the counts of the whole interval counter.
+  ASSERT_EQ(window_starts.size(), 16);
+  for (size_t i = 0; i < window_starts.size(); ++i) {
+    EXPECT_EQ(window_starts[i], range.start() + 64 * i);
+  }
+  EXPECT_THAT(streamed, Pointwise(EqualsProto(), whole.Counts()));
+  // Only the windows spanned by reads around the current one are held.
+  EXPECT_LT(max_active_windows, 8);
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
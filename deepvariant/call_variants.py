@@ -41,6 +41,8 @@ import tensorflow as tf
 
 from absl import logging
 
+from deepvariant import example_socket
+from deepvariant import example_stream
 from deepvariant import logging_level
 from deepvariant import modeling
 from deepvariant import tf_utils
@@ -51,6 +53,7 @@ from deepvariant.core import proto_utils
 from deepvariant.core import variantutils
 from deepvariant.core.genomics import variants_pb2
 from deepvariant.protos import deepvariant_pb2
+from deepvariant.python import call_variants_output
 
 _ALLOW_EXECUTION_HARDWARE = [
     'auto',  # Default, no validation.
@@ -62,12 +65,18 @@ _ALLOW_EXECUTION_HARDWARE = [
 # rounded to, for numerical stability.
 _GL_PRECISION = 10
 
+# The names of the input images and output predictions of a frozen model.
+_FROZEN_MODEL_INPUT = 'images'
+_FROZEN_MODEL_OUTPUT = 'predictions'
+
 FLAGS = tf.flags.FLAGS
 
 tf.flags.DEFINE_string(
     'examples', None,
     'Required. tf.Example protos containing DeepVariant candidate variants in '
-    'TFRecord format, as emitted by make_examples.')
+    'TFRecord format, as emitted by make_examples. Also accepts example '
+    'streams (.dvex), or unix:<socket path>[@<shards>] to call the examples '
+    'of a concurrently running make_examples given the same value.')
 tf.flags.DEFINE_string(
     'outfile', None,
     'Required. Destination path where we will write output candidate variants '
@@ -85,10 +94,41 @@ tf.flags.DEFINE_integer('max_batches', None,
                         'Max. batches to evaluate. Defaults to all.')
 tf.flags.DEFINE_integer('num_readers', 8,
                         'Number of parallel readers to create for examples.')
+tf.flags.DEFINE_integer(
+    'prefetch_batches', 10,
+    'Number of batches of preprocessed examples to buffer ahead of inference, '
+    'so the model is not kept waiting on reading and preprocessing.')
 tf.flags.DEFINE_string('model_name', 'inception_v3',
                        'The name of the model architecture of --checkpoint.')
 tf.flags.DEFINE_boolean('include_debug_info', False,
                         'If true, include extra debug info in the output.')
+tf.flags.DEFINE_string(
+    'frozen_model', '',
+    'Optional. Path to a frozen model written by --export_frozen_model, to '
+    'use instead of building the model of --model_name and restoring '
+    '--checkpoint into it.')
+tf.flags.DEFINE_string(
+    'export_frozen_model', '',
+    'If set, write the model of --model_name with the weights of --checkpoint '
+    'to this path as a frozen graph for the images of --examples, for use with '
+    '--frozen_model, and exit without calling any variants.')
+tf.flags.DEFINE_integer(
+    'intra_op_threads', 0,
+    'The number of threads used within an op, e.g. a convolution. If 0, '
+    'TensorFlow picks a number for the machine.')
+tf.flags.DEFINE_integer(
+    'inter_op_threads', 0,
+    'The number of threads used to run independent ops concurrently. If 0, '
+    'TensorFlow picks a number for the machine.')
+tf.flags.DEFINE_boolean(
+    'xla_jit', False,
+    'If true, the model is compiled with the XLA just-in-time compiler.')
+tf.flags.DEFINE_boolean(
+    'warmup', False,
+    'If true, a batch of --batch_size blank images is run through the model '
+    'before the examples are read, so that one-time setup, like memory '
+    'allocation and compilation for the batch shape, is done before the first '
+    'batch of examples is ready.')
 tf.flags.DEFINE_string(
     'execution_hardware', 'auto',
     'When in cpu mode, call_variants will not place any ops on the GPU, even '
@@ -103,7 +143,45 @@ class ExecutionHardwareError(Exception):
   pass
 
 
-def prepare_inputs(source_path, model, batch_size, num_readers=None):
+def _records_dataset(records_fn, tensor_shape):
+  """Returns a dataset of the features of already decoded examples.
+
+  This is used for example streams, whose images are sliced straight out of
+  the memory-mapped stream files, and for example sockets; unlike TFRecord
+  inputs there is nothing to decompress or parse for either.
+
+  Args:
+    records_fn: A function returning an iterable of (image,
+      encoded_variant, encoded_alt_allele_indices) tuples, where image is a
+      uint8 array of tensor_shape.
+    tensor_shape: The [height, width, channels] of the images, or None if
+      there are no examples.
+
+  Returns:
+    A tf.data.Dataset of dictionaries with the same keys as the parsed
+    tf.Examples, where 'image/encoded' is a uint8 image tensor.
+  """
+
+  def _features(image, encoded_variant, encoded_alt_allele_indices):
+    return {
+        'image/encoded': image,
+        'variant/encoded': encoded_variant,
+        'alt_allele_indices/encoded': encoded_alt_allele_indices,
+    }
+
+  dataset = tf.data.Dataset.from_generator(
+      records_fn,
+      output_types=(tf.uint8, tf.string, tf.string),
+      output_shapes=(tf.TensorShape(tensor_shape), tf.TensorShape([]),
+                     tf.TensorShape([])))
+  return dataset.map(_features)
+
+
+def prepare_inputs(source_path,
+                   model,
+                   batch_size,
+                   num_readers=None,
+                   prefetch_batches=None):
   """Prepares image and encoded_variant ops.
 
   Reads image / encoded_variant tuples from source_path, extracting the image
@@ -113,12 +191,15 @@ def prepare_inputs(source_path, model, batch_size, num_readers=None):
 
   Args:
     source_path: Path to a TFRecord file containing deepvariant tf.Example
-      protos.
+      protos, to example stream (.dvex) files, or a 'unix:' example socket
+      to receive examples from a running make_examples.
     model: A DeepVariantModel whose preprocess_image function will be used on
       image.
     batch_size: int > 0. Size of batches to use during inference.
     num_readers: int > 0 or None. Number of parallel readers to use to read
       examples from source_path. If None, uses FLAGS.num_readers instead.
+    prefetch_batches: int > 0 or None. Number of batches to prepare ahead of
+      their use. If None, uses FLAGS.prefetch_batches instead.
 
   Returns:
     A tuple of (image, encoded_variant, encoded_alt_allele_indices) TF ops.
@@ -131,8 +212,15 @@ def prepare_inputs(source_path, model, batch_size, num_readers=None):
   """
   if not num_readers:
     num_readers = FLAGS.num_readers
+  if not prefetch_batches:
+    prefetch_batches = FLAGS.prefetch_batches
 
-  tensor_shape = tf_utils.get_shape_from_examples_path(source_path)
+  if example_socket.is_example_socket(source_path):
+    socket_reader = example_socket.ExampleSocketReader(source_path)
+    # This blocks until make_examples sends its first example.
+    tensor_shape = socket_reader.shape()
+  else:
+    tensor_shape = tf_utils.get_shape_from_examples_path(source_path)
 
   def _parse_single_example(serialized_example):
     """Parses serialized example into a dictionary of de-serialized features."""
@@ -154,25 +242,35 @@ def prepare_inputs(source_path, model, batch_size, num_readers=None):
       # Bypassing the reshaping and preprocessing if there is no tensor_shape.
       # Currently that could happen when the input file is empty.
       if tensor_shape:
-        image = tf.reshape(tf.decode_raw(image, tf.uint8), tensor_shape)
+        # Images from example streams are already decoded uint8 tensors.
+        if image.dtype == tf.string:
+          image = tf.reshape(tf.decode_raw(image, tf.uint8), tensor_shape)
         image = model.preprocess_image(image)
       features['image/encoded'] = image
       return features
 
-    files = tf.gfile.Glob(io_utils.NormalizeToShardedFilePattern(source_path))
-    reader_options = io_utils.make_tfrecord_options(files)
-    if reader_options.compression_type == (
-        tf.python_io.TFRecordCompressionType.GZIP):
-      compression_type = 'GZIP'
+    if example_socket.is_example_socket(source_path):
+      dataset = _records_dataset(lambda: iter(socket_reader), tensor_shape)
+    elif example_stream.is_example_stream(source_path):
+      dataset = _records_dataset(
+          lambda: example_stream.iterate(source_path), tensor_shape)
     else:
-      compression_type = None
-    dataset = tf.data.TFRecordDataset(files, compression_type=compression_type)
-    dataset = dataset.map(
-        _parse_single_example, num_parallel_calls=FLAGS.num_readers)
+      files = tf.gfile.Glob(
+          io_utils.NormalizeToShardedFilePattern(source_path))
+      reader_options = io_utils.make_tfrecord_options(files)
+      if reader_options.compression_type == (
+          tf.python_io.TFRecordCompressionType.GZIP):
+        compression_type = 'GZIP'
+      else:
+        compression_type = None
+      dataset = tf.data.TFRecordDataset(
+          files, compression_type=compression_type)
+      dataset = dataset.map(
+          _parse_single_example, num_parallel_calls=FLAGS.num_readers)
     dataset = dataset.map(
         _preprocess_image, num_parallel_calls=FLAGS.num_readers)
-    dataset = dataset.prefetch(10 * batch_size)
     dataset = dataset.batch(batch_size)
+    dataset = dataset.prefetch(prefetch_batches)
     iterator = dataset.make_one_shot_iterator()
     features = iterator.get_next()
     return (features['image/encoded'], features['variant/encoded'],
@@ -215,8 +313,12 @@ def round_gls(gls, precision=None):
   return rounded_gls
 
 
-def call_batch(sess, writer, encoded_variants, encoded_alt_allele_indices,
-               predictions):
+def call_batch(sess,
+               writer,
+               encoded_variants,
+               encoded_alt_allele_indices,
+               predictions,
+               batched_writer=False):
   """Calls variants by computing the genotype likelihoods predictions.
 
   This function runs TF to get the values for the predictions for each
@@ -241,6 +343,9 @@ def call_batch(sess, writer, encoded_variants, encoded_alt_allele_indices,
     predictions: A [batch_size, 3] tensor of floats. These are the predicted
       genotype likelihoods (p00, p0x, pxx) for some alt allele x, in the same
       order as encoded_variants.
+    batched_writer: bool. If True, writer is one made by
+      make_batch_async_writer and is given the whole batch in one write()
+      call, instead of one call per variant with its rounded likelihoods.
 
   Returns:
     The number of variants called and written out.
@@ -250,6 +355,10 @@ def call_batch(sess, writer, encoded_variants, encoded_alt_allele_indices,
   encoded_variants, encoded_alt_allele_indices, predictions = sess.run(
       [encoded_variants, encoded_alt_allele_indices, predictions])
 
+  if batched_writer:
+    writer.write(encoded_variants, encoded_alt_allele_indices, predictions)
+    return len(encoded_variants)
+
   # Walk over the variants / prediction pairs, creating our calls.
   for encoded_variant, one_encoded_alt_allele_indices, gls in zip(
       encoded_variants, encoded_alt_allele_indices, predictions):
@@ -307,16 +416,143 @@ def make_async_writer(write_fn):
   return io_utils.AsyncWriter(write_output)
 
 
+def make_batch_async_writer(writer):
+  """Creates an AsyncWriter writing whole batches of CallVariantsOutputs.
+
+  The created AsyncWriter has a write() function accepting the
+  encoded_variants, encoded_alt_allele_indices and predictions arrays of a
+  batch. Its writer thread hands the whole batch to writer, which rounds the
+  predictions and builds and writes the serialized CallVariantsOutput protos
+  of the batch in C++, with the same contents as make_async_writer without
+  debug info.
+
+  Args:
+    writer: A CallVariantsOutputWriter.
+
+  Returns:
+    An AsyncWriter.
+  """
+
+  def write_batch(encoded_variants, encoded_alt_allele_indices, predictions):
+    """Writes out the CallVariantsOutput protos of a batch."""
+    writer.write_batch(
+        list(encoded_variants), list(encoded_alt_allele_indices),
+        predictions.ravel().tolist(), predictions.shape[1], _GL_PRECISION)
+
+  return io_utils.AsyncWriter(write_batch)
+
+
+def session_config(execution_hardware='auto',
+                   intra_op_threads=0,
+                   inter_op_threads=0,
+                   xla_jit=False):
+  """Returns the tf.ConfigProto of the session running the model.
+
+  Args:
+    execution_hardware: One of _ALLOW_EXECUTION_HARDWARE. If 'cpu', no ops are
+      placed on accelerators.
+    intra_op_threads: int >= 0. The threads used within an op, or 0 to let
+      TensorFlow choose.
+    inter_op_threads: int >= 0. The threads used to run ops concurrently, or 0
+      to let TensorFlow choose.
+    xla_jit: bool. If True, the graph is compiled by XLA.
+
+  Returns:
+    A tf.ConfigProto.
+  """
+  device_count = {'GPU': 0, 'TPU': 0} if execution_hardware == 'cpu' else {}
+  config = tf.ConfigProto(
+      device_count=device_count,
+      intra_op_parallelism_threads=intra_op_threads,
+      inter_op_parallelism_threads=inter_op_threads)
+  if xla_jit:
+    config.graph_options.optimizer_options.global_jit_level = (
+        tf.OptimizerOptions.ON_1)
+  return config
+
+
+def export_frozen_model(examples_filename, checkpoint_path, model,
+                        output_path):
+  """Writes model with the weights of checkpoint_path as a frozen GraphDef.
+
+  The frozen graph maps a batch of preprocessed images, fed to
+  _FROZEN_MODEL_INPUT, to their genotype likelihoods, _FROZEN_MODEL_OUTPUT.
+  Its variables are replaced by constants holding their values, and the nodes
+  only needed for training are removed, so call_variants can import it in one
+  step instead of building the model and restoring a checkpoint.
+
+  Args:
+    examples_filename: Path to examples made by make_examples, whose image
+      shape the frozen model takes.
+    checkpoint_path: Path to the checkpoint of model.
+    model: A DeepVariantModel.
+    output_path: Path where the serialized GraphDef is written.
+  """
+  tensor_shape = tf_utils.get_shape_from_examples_path(examples_filename)
+  if not tensor_shape:
+    raise ValueError(
+        'Cannot find the image shape of {}'.format(examples_filename))
+  with tf.Graph().as_default():
+    # The images are preprocessed by the input pipeline, so the frozen model
+    # takes images of the shape and type preprocess_image returns.
+    image = model.preprocess_image(tf.placeholder(tf.uint8, tensor_shape))
+    images = tf.placeholder(
+        image.dtype, [None] + image.shape.as_list(), name=_FROZEN_MODEL_INPUT)
+    predictions = tf.identity(
+        model.create(images, 3, is_training=False)['Predictions'],
+        name=_FROZEN_MODEL_OUTPUT)
+    with tf.Session() as sess:
+      sess.run(tf.group(tf.global_variables_initializer(),
+                        tf.local_variables_initializer()))
+      logging.info('Initializing model from %s', checkpoint_path)
+      model.initialize_from_checkpoint(checkpoint_path, 3, False)(sess)
+      graph_def = tf.graph_util.convert_variables_to_constants(
+          sess, sess.graph.as_graph_def(), [predictions.op.name])
+  graph_def = tf.graph_util.remove_training_nodes(graph_def)
+  logging.info('Writing frozen model to %s', output_path)
+  with tf.gfile.GFile(output_path, 'wb') as f:
+    f.write(graph_def.SerializeToString())
+
+
+def import_frozen_model(frozen_model_path, images):
+  """Returns the predictions of the frozen model at path for images."""
+  graph_def = tf.GraphDef()
+  with tf.gfile.GFile(frozen_model_path, 'rb') as f:
+    graph_def.ParseFromString(f.read())
+  predictions, = tf.import_graph_def(
+      graph_def,
+      input_map={_FROZEN_MODEL_INPUT: images},
+      return_elements=[_FROZEN_MODEL_OUTPUT + ':0'],
+      name='frozen_model')
+  return predictions
+
+
 def call_variants(examples_filename,
                   checkpoint_path,
                   model,
                   output_file,
                   execution_hardware='auto',
                   batch_size=16,
-                  max_batches=None):
-  """Main driver of call_variants."""
+                  max_batches=None,
+                  frozen_model_path=None,
+                  intra_op_threads=0,
+                  inter_op_threads=0,
+                  xla_jit=False,
+                  warmup=False):
+  """Main driver of call_variants.
+
+  If frozen_model_path is set, the predictions are made by the frozen model
+  there, as written by export_frozen_model, and checkpoint_path is not used.
+  The remaining arguments configure the session, as in session_config. If
+  warmup, a batch of batch_size blank images is run through the model first.
+  """
   # Read a single TFExample to make sure we're not loading an older version.
-  example_format = tf_utils.get_format_from_examples_path(examples_filename)
+  # Examples sent over a socket are always raw, and reading one here would
+  # consume it.
+  if example_socket.is_example_socket(examples_filename):
+    example_format = 'raw'
+  else:
+    example_format = tf_utils.get_format_from_examples_path(examples_filename)
   if example_format != 'raw':
     raise ValueError('The TF examples in {} has image/format \'{}\' '
                      '(expected \'raw\') which means you might need to rerun '
@@ -332,21 +568,35 @@ def call_variants(examples_filename,
     images, encoded_variants, encoded_alt_allele_indices = prepare_inputs(
         examples_filename, model, batch_size, FLAGS.num_readers)
 
-    # Create our model and extract the predictions from the model endpoints.
-    predictions = model.create(images, 3, is_training=False)['Predictions']
+    if frozen_model_path:
+      logging.info('Loading frozen model from %s', frozen_model_path)
+      predictions = import_frozen_model(frozen_model_path, images)
+    else:
+      # Create our model and extract the predictions from the model endpoints.
+      predictions = model.create(images, 3, is_training=False)['Predictions']
 
     # The op for initializing the variables.
     init_op = tf.group(tf.global_variables_initializer(),
                        tf.local_variables_initializer())
 
-    device_count = {'GPU': 0, 'TPU': 0} if execution_hardware == 'cpu' else {}
-    config = tf.ConfigProto(device_count=device_count)
+    config = session_config(execution_hardware, intra_op_threads,
+                            inter_op_threads, xla_jit)
     with tf.Session(config=config) as sess:
       sess.run(init_op)
 
-      # Initial the model from the provided checkpoint using our session.
-      logging.info('Initializing model from %s', checkpoint_path)
-      model.initialize_from_checkpoint(checkpoint_path, 3, False)(sess)
+      if not frozen_model_path:
+        # Initial the model from the provided checkpoint using our session.
+        logging.info('Initializing model from %s', checkpoint_path)
+        model.initialize_from_checkpoint(checkpoint_path, 3, False)(sess)
+
+      if warmup and images.shape[1:].is_fully_defined():
+        # Feeding the images bypasses the input pipeline.
+        blank_images = np.zeros([batch_size] + images.shape[1:].as_list(),
+                                dtype=images.dtype.as_numpy_dtype)
+        warmup_start_time = time.time()
+        sess.run(predictions, feed_dict={images: blank_images})
+        logging.info('Warmed up the model in %.2f sec',
+                     time.time() - warmup_start_time)
 
       if execution_hardware == 'accelerator':
         if not any(dev.device_type != 'CPU' for dev in sess.list_devices()):
@@ -355,15 +605,25 @@ def call_variants(examples_filename,
               'was found')
 
       logging.info('Writing calls to %s', output_file)
-      sync_writer, write_fn = io_utils.make_proto_writer(output_file)
-      with sync_writer, make_async_writer(write_fn) as writer:
+      sync_writer = (
+          call_variants_output.CallVariantsOutputWriter.to_file(output_file))
+      # The debug info needs the decoded variants, so it is only filled in by
+      # the per-variant Python writer.
+      batched_writer = not FLAGS.include_debug_info
+      if batched_writer:
+        async_writer = make_batch_async_writer(sync_writer)
+      else:
+        async_writer = make_async_writer(
+            lambda proto: sync_writer.write(proto.SerializeToString()))
+      with sync_writer, async_writer as writer:
         start_time = time.time()
         try:
           n_batches = 0
           n_examples = 0
           while max_batches is None or n_batches < max_batches:
             n_called = call_batch(sess, writer, encoded_variants,
-                                  encoded_alt_allele_indices, predictions)
+                                  encoded_alt_allele_indices, predictions,
+                                  batched_writer)
 
             duration = time.time() - start_time
             n_batches += 1
@@ -391,6 +651,22 @@ def main(argv=()):
     htslib_gcp_oauth.init()
 
     model = modeling.get_model(FLAGS.model_name)
+    if FLAGS.export_frozen_model:
+      if not FLAGS.checkpoint:
+        errors.log_and_raise('checkpoint is required to export_frozen_model.',
+                             errors.CommandLineError)
+      export_frozen_model(
+          examples_filename=FLAGS.examples,
+          checkpoint_path=FLAGS.checkpoint,
+          model=model,
+          output_path=FLAGS.export_frozen_model)
+      return
+
+    if not FLAGS.outfile:
+      errors.log_and_raise('outfile is required.', errors.CommandLineError)
+    if not FLAGS.checkpoint and not FLAGS.frozen_model:
+      errors.log_and_raise('Either checkpoint or frozen_model is required.',
+                           errors.CommandLineError)
     call_variants(
         examples_filename=FLAGS.examples,
         checkpoint_path=FLAGS.checkpoint,
@@ -398,13 +674,16 @@ def main(argv=()):
         execution_hardware=FLAGS.execution_hardware,
         output_file=FLAGS.outfile,
         max_batches=FLAGS.max_batches,
-        batch_size=FLAGS.batch_size)
+        batch_size=FLAGS.batch_size,
+        frozen_model_path=FLAGS.frozen_model,
+        intra_op_threads=FLAGS.intra_op_threads,
+        inter_op_threads=FLAGS.inter_op_threads,
+        xla_jit=FLAGS.xla_jit,
+        warmup=FLAGS.warmup)
 
 
 if __name__ == '__main__':
   tf.flags.mark_flags_as_required([
       'examples',
-      'outfile',
-      'checkpoint',
   ])
   tf.app.run()
@@ -0,0 +1,290 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/call_variants_output.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/utils.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "google/protobuf/wire_format_lite.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/compression.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using google::protobuf::internal::WireFormatLite;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::io::StringOutputStream;
+using learning::genomics::v1::Variant;
+using tensorflow::uint32;
+using tensorflow::uint64;
+using tensorflow::uint8;
+
+namespace {
+
+// The largest precision we round to with printf; beyond this doubles have no
+// digits left to round.
+constexpr int kMaxPrecision = 30;
+
+// Reads the key fields of the serialized Variant within input's limit,
+// skipping all the others.
+bool ScanVariant(CodedInputStream* input, CallVariantsOutputKey* key) {
+  constexpr uint32 kReferenceNameTag = WireFormatLite::MakeTag(
+      Variant::kReferenceNameFieldNumber,
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  constexpr uint32 kStartTag = WireFormatLite::MakeTag(
+      Variant::kStartFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+  constexpr uint32 kEndTag = WireFormatLite::MakeTag(
+      Variant::kEndFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+  constexpr uint32 kCallsTag = WireFormatLite::MakeTag(
+      Variant::kCallsFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  for (uint32 tag = input->ReadTag(); tag != 0; tag = input->ReadTag()) {
+    uint64 value;
+    switch (tag) {
+      case kReferenceNameTag:
+        if (!WireFormatLite::ReadString(input, &key->reference_name)) {
+          return false;
+        }
+        break;
+      case kStartTag:
+        if (!input->ReadVarint64(&value)) return false;
+        key->start = static_cast<int64>(value);
+        break;
+      case kEndTag:
+        if (!input->ReadVarint64(&value)) return false;
+        key->end = static_cast<int64>(value);
+        break;
+      case kCallsTag:
+        ++key->num_calls;
+        if (!WireFormatLite::SkipField(input, tag)) return false;
+        break;
+      default:
+        if (!WireFormatLite::SkipField(input, tag)) return false;
+    }
+  }
+  return input->ConsumedEntireMessage();
+}
+
+}  // namespace
+
+bool ScanVariantKey(StringPiece encoded_variant, CallVariantsOutputKey* key) {
+  CodedInputStream input(reinterpret_cast<const uint8*>(encoded_variant.data()),
+                         encoded_variant.size());
+  return ScanVariant(&input, key);
+}
+
+bool ScanCallVariantsOutputKey(StringPiece data, CallVariantsOutputKey* key) {
+  constexpr uint32 kVariantTag = WireFormatLite::MakeTag(
+      CallVariantsOutput::kVariantFieldNumber,
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  CodedInputStream input(reinterpret_cast<const uint8*>(data.data()),
+                         data.size());
+  for (uint32 tag = input.ReadTag(); tag != 0; tag = input.ReadTag()) {
+    if (tag == kVariantTag) {
+      uint32 length;
+      if (!input.ReadVarint32(&length)) return false;
+      const CodedInputStream::Limit limit = input.PushLimit(length);
+      if (!ScanVariant(&input, key)) return false;
+      input.PopLimit(limit);
+    } else if (!WireFormatLite::SkipField(&input, tag)) {
+      return false;
+    }
+  }
+  return input.ConsumedEntireMessage();
+}
+
+double RoundToPrecision(double value, int precision) {
+  if (!std::isfinite(value) || precision > kMaxPrecision) {
+    return value;
+  }
+  // value lies exactly halfway between two multiples of 10^-precision iff
+  // value * 2 * 10^precision is an odd integer, which for a binary fraction
+  // means value * 2^(precision + 1) is.  printf rounds those ties to even, but
+  // Python 2 rounds them away from zero, and the product below is exact.
+  const double halves = std::ldexp(value, precision + 1);
+  if (precision >= 0 && std::floor(halves) == halves &&
+      std::fabs(std::fmod(halves, 2.0)) == 1.0) {
+    const double scale = std::pow(10.0, precision);
+    return std::round(value * scale) / scale;
+  }
+  // printf rounds the exact binary value correctly, and strtod returns the
+  // double nearest the rounded decimal, as Python does.
+  char buffer[64];
+  std::snprintf(buffer, sizeof(buffer), "%.*f", precision < 0 ? 0 : precision,
+                value);
+  return std::strtod(buffer, nullptr);
+}
+
+StatusOr<std::vector<double>> RoundGenotypeProbabilities(
+    const std::vector<float>& probabilities, int precision) {
+  // Summed in single precision like the float32 predictions are in Python.
+  float total = 0;
+  for (float p : probabilities) total += p;
+  if (std::fabs(total - 1) > 1e-6) {
+    return tensorflow::errors::InvalidArgument(
+        "Invalid genotype likelihoods do not sum to one: sum = ", total);
+  }
+
+  std::vector<double> rounded(probabilities.size());
+  size_t min_index = 0;
+  for (size_t i = 0; i < probabilities.size(); ++i) {
+    rounded[i] = RoundToPrecision(probabilities[i], precision);
+    if (probabilities[i] < probabilities[min_index]) min_index = i;
+  }
+  double others = 0;
+  for (size_t i = 0; i < rounded.size(); ++i) {
+    if (i != min_index) others += rounded[i];
+  }
+  if (!rounded.empty()) {
+    rounded[min_index] =
+        std::max(0.0, RoundToPrecision(1 - others, precision));
+  }
+  return rounded;
+}
+
+StatusOr<std::vector<string>> EncodeCallVariantsOutputs(
+    const std::vector<string>& encoded_variants,
+    const std::vector<string>& encoded_alt_allele_indices,
+    const std::vector<float>& probabilities, int probabilities_per_example,
+    int precision) {
+  const size_t n = encoded_variants.size();
+  if (encoded_alt_allele_indices.size() != n ||
+      probabilities_per_example <= 0 ||
+      probabilities.size() != n * probabilities_per_example) {
+    return tensorflow::errors::InvalidArgument(
+        "Got ", n, " variants, ", encoded_alt_allele_indices.size(),
+        " alt allele indices and ", probabilities.size(),
+        " probabilities for ", probabilities_per_example,
+        " probabilities per example");
+  }
+
+  constexpr uint32 kProbabilitiesTag = WireFormatLite::MakeTag(
+      CallVariantsOutput::kGenotypeProbabilitiesFieldNumber,
+      WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  std::vector<string> outputs(n);
+  std::vector<float> example_probabilities(probabilities_per_example);
+  for (size_t i = 0; i < n; ++i) {
+    example_probabilities.assign(
+        probabilities.begin() + i * probabilities_per_example,
+        probabilities.begin() + (i + 1) * probabilities_per_example);
+    StatusOr<std::vector<double>> rounded =
+        RoundGenotypeProbabilities(example_probabilities, precision);
+    if (!rounded.ok()) return rounded.status();
+
+    // The fields in field number order, as protobuf serializes them.
+    StringOutputStream stream(&outputs[i]);
+    CodedOutputStream output(&stream);
+    WireFormatLite::WriteBytes(CallVariantsOutput::kVariantFieldNumber,
+                               encoded_variants[i], &output);
+    WireFormatLite::WriteBytes(
+        CallVariantsOutput::kAltAlleleIndicesFieldNumber,
+        encoded_alt_allele_indices[i], &output);
+    output.WriteTag(kProbabilitiesTag);
+    output.WriteVarint32(rounded.ValueOrDie().size() *
+                         WireFormatLite::kDoubleSize);
+    for (double p : rounded.ValueOrDie()) {
+      WireFormatLite::WriteDoubleNoTag(p, &output);
+    }
+  }
+  return outputs;
+}
+
+StatusOr<std::unique_ptr<CallVariantsOutputWriter>>
+CallVariantsOutputWriter::ToFile(const string& path) {
+  std::unique_ptr<tensorflow::WritableFile> file;
+  TF_RETURN_IF_ERROR(tensorflow::Env::Default()->NewWritableFile(path, &file));
+  return std::unique_ptr<CallVariantsOutputWriter>(
+      new CallVariantsOutputWriter(path, std::move(file)));
+}
+
+CallVariantsOutputWriter::CallVariantsOutputWriter(
+    const string& path, std::unique_ptr<tensorflow::WritableFile> file)
+    : file_(std::move(file)) {
+  const char* const option = core::EndsWith(path, ".gz")
+                                 ? tensorflow::io::compression::kGzip
+                                 : tensorflow::io::compression::kNone;
+  writer_.reset(new tensorflow::io::RecordWriter(
+      file_.get(),
+      tensorflow::io::RecordWriterOptions::CreateRecordWriterOptions(option)));
+}
+
+CallVariantsOutputWriter::~CallVariantsOutputWriter() {
+  if (writer_ != nullptr) {
+    TF_CHECK_OK(Close());
+  }
+}
+
+tensorflow::Status CallVariantsOutputWriter::Write(const string& data) {
+  if (writer_ == nullptr) {
+    return tensorflow::errors::FailedPrecondition("Writer is closed");
+  }
+  return writer_->WriteRecord(data);
+}
+
+tensorflow::Status CallVariantsOutputWriter::WriteBatch(
+    const std::vector<string>& encoded_variants,
+    const std::vector<string>& encoded_alt_allele_indices,
+    const std::vector<float>& probabilities, int probabilities_per_example,
+    int precision) {
+  StatusOr<std::vector<string>> records = EncodeCallVariantsOutputs(
+      encoded_variants, encoded_alt_allele_indices, probabilities,
+      probabilities_per_example, precision);
+  TF_RETURN_IF_ERROR(records.status());
+  for (const string& record : records.ValueOrDie()) {
+    TF_RETURN_IF_ERROR(Write(record));
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status CallVariantsOutputWriter::Close() {
+  if (writer_ == nullptr) {
+    return tensorflow::errors::FailedPrecondition("Writer already closed");
+  }
+  const tensorflow::Status flush_status = writer_->Flush();
+  writer_.reset();
+  const tensorflow::Status close_status = file_->Close();
+  file_.reset();
+  TF_RETURN_IF_ERROR(flush_status);
+  return close_status;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
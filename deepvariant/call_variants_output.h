@@ -0,0 +1,154 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Builds and writes the serialized CallVariantsOutput records of
+// call_variants in native code.
+//
+// call_variants used to round the genotype probabilities of each example and
+// build its CallVariantsOutput proto in Python, parsing the example's Variant
+// and AltAlleleIndices only to serialize them again. EncodeCallVariantsOutputs
+// takes the encoded fields and the raw probabilities of a batch and writes
+// the records straight in the proto wire format, copying the encoded Variant
+// and AltAlleleIndices through as they are.
+//
+// CallVariantsOutputWriter writes those records to a TFRecord file.
+// ScanCallVariantsOutputKey reads back the fields postprocess_variants sorts
+// them by.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CALL_VARIANTS_OUTPUT_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CALL_VARIANTS_OUTPUT_H_
+
+#include <memory>
+#include <vector>
+
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using tensorflow::int64;
+using tensorflow::string;
+using tensorflow::StringPiece;
+
+// The fields of the variant of a serialized CallVariantsOutput that calls
+// are sorted by.
+struct CallVariantsOutputKey {
+  string reference_name;
+  int64 start = 0;
+  int64 end = 0;
+  // The number of VariantCalls of the variant.
+  int num_calls = 0;
+};
+
+// Reads the key fields of the serialized Variant `encoded_variant` straight
+// from its wire format, without parsing the rest of it. Returns false if it
+// isn't a valid Variant.
+bool ScanVariantKey(StringPiece encoded_variant, CallVariantsOutputKey* key);
+
+// Reads the key fields of the variant of the serialized CallVariantsOutput
+// `data` like ScanVariantKey does.  Like parsing, later occurrences of the
+// variant are merged into earlier ones.
+bool ScanCallVariantsOutputKey(StringPiece data, CallVariantsOutputKey* key);
+
+// Rounds value to `precision` decimal places the way Python 2's round()
+// does: to the double nearest the correctly rounded decimal, with exact ties
+// rounded away from zero.  This is exact for the magnitudes of probabilities;
+// ties are only special-cased correctly for |value| below about 1e5.
+double RoundToPrecision(double value, int precision);
+
+// Returns the genotype probabilities in `probabilities` rounded to
+// `precision` decimal places, exactly as call_variants.round_gls does: every
+// probability is rounded and the smallest one is then replaced by one minus
+// the sum of the others, so the rounded probabilities still sum to one.
+// Returns an InvalidArgument error if the probabilities don't sum to one.
+StatusOr<std::vector<double>> RoundGenotypeProbabilities(
+    const std::vector<float>& probabilities, int precision);
+
+// Returns the serialized CallVariantsOutput of each of a batch of examples.
+// The i-th output holds encoded_variants[i], encoded_alt_allele_indices[i]
+// and the i-th probabilities_per_example values of `probabilities`, the
+// row-major [batch size, probabilities_per_example] predictions, rounded with
+// RoundGenotypeProbabilities. The records have no debug_info.
+StatusOr<std::vector<string>> EncodeCallVariantsOutputs(
+    const std::vector<string>& encoded_variants,
+    const std::vector<string>& encoded_alt_allele_indices,
+    const std::vector<float>& probabilities, int probabilities_per_example,
+    int precision);
+
+// Writes serialized CallVariantsOutput records to a TFRecord file, compressed
+// if its path ends in .gz.
+class CallVariantsOutputWriter {
+ public:
+  // Creates a CallVariantsOutputWriter writing to a new file at path.
+  static StatusOr<std::unique_ptr<CallVariantsOutputWriter>> ToFile(
+      const string& path);
+  ~CallVariantsOutputWriter();
+
+  CallVariantsOutputWriter(const CallVariantsOutputWriter&) = delete;
+  CallVariantsOutputWriter& operator=(const CallVariantsOutputWriter&) =
+      delete;
+
+  // Writes the serialized CallVariantsOutput `data`.
+  tensorflow::Status Write(const string& data);
+
+  // Writes the records EncodeCallVariantsOutputs makes of a batch.
+  tensorflow::Status WriteBatch(
+      const std::vector<string>& encoded_variants,
+      const std::vector<string>& encoded_alt_allele_indices,
+      const std::vector<float>& probabilities, int probabilities_per_example,
+      int precision);
+
+  // Flushes and closes the output.
+  tensorflow::Status Close();
+
+  // This no-op function is needed only for Python context manager support.  Do
+  // not use it!
+  void PythonEnter() const {}
+
+ private:
+  CallVariantsOutputWriter(const string& path,
+                           std::unique_ptr<tensorflow::WritableFile> file);
+
+  std::unique_ptr<tensorflow::WritableFile> file_;
+  std::unique_ptr<tensorflow::io::RecordWriter> writer_;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CALL_VARIANTS_OUTPUT_H_
@@ -0,0 +1,213 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/call_variants_output.h"
+
+#include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+#include "deepvariant/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Variant;
+using tensorflow::int64;
+using ::testing::ElementsAre;
+
+TEST(RoundToPrecisionTest, RoundsLikePython) {
+  EXPECT_EQ(RoundToPrecision(0.123456, 2), 0.12);
+  EXPECT_EQ(RoundToPrecision(0.987654, 3), 0.988);
+  // 2.675 is really 2.67499999..., so it rounds down.
+  EXPECT_EQ(RoundToPrecision(2.675, 2), 2.67);
+  // Exact ties round away from zero.
+  EXPECT_EQ(RoundToPrecision(0.125, 2), 0.13);
+  EXPECT_EQ(RoundToPrecision(-0.125, 2), -0.13);
+  EXPECT_EQ(RoundToPrecision(0.5, 0), 1.0);
+  EXPECT_EQ(RoundToPrecision(2.5, 0), 3.0);
+  EXPECT_EQ(RoundToPrecision(1.0 / 2048, 10), 0.0004882813);
+  EXPECT_EQ(RoundToPrecision(0.3, 10), 0.3);
+}
+
+TEST(RoundGenotypeProbabilitiesTest, MatchesRoundGls) {
+  StatusOr<std::vector<double>> rounded =
+      RoundGenotypeProbabilities({0.25, 0.7, 0.05}, 1);
+  ASSERT_THAT(rounded.status(), IsOK());
+  // 0.05 is the smallest, so it becomes 1 - (0.3 + 0.7).
+  EXPECT_THAT(rounded.ValueOrDie(), ElementsAre(0.3, 0.7, 0.0));
+
+  rounded = RoundGenotypeProbabilities({0.0000359f, 0.999926f, 0.0000379f}, 2);
+  ASSERT_THAT(rounded.status(), IsOK());
+  EXPECT_THAT(rounded.ValueOrDie(), ElementsAre(0.0, 1.0, 0.0));
+}
+
+TEST(RoundGenotypeProbabilitiesTest, RejectsProbabilitiesNotSummingToOne) {
+  EXPECT_FALSE(RoundGenotypeProbabilities({0.5, 0.4, 0.05}, 3).ok());
+}
+
+TEST(EncodeCallVariantsOutputsTest, EncodesEachExample) {
+  Variant variant1;
+  variant1.set_reference_name("20");
+  variant1.set_start(10);
+  variant1.set_end(11);
+  variant1.add_alternate_bases("C");
+  Variant variant2 = variant1;
+  variant2.set_start(20);
+  variant2.add_alternate_bases("G");
+  CallVariantsOutput::AltAlleleIndices alts1;
+  alts1.add_indices(0);
+  CallVariantsOutput::AltAlleleIndices alts2;
+  alts2.add_indices(0);
+  alts2.add_indices(1);
+
+  StatusOr<std::vector<string>> encoded = EncodeCallVariantsOutputs(
+      {variant1.SerializeAsString(), variant2.SerializeAsString()},
+      {alts1.SerializeAsString(), alts2.SerializeAsString()},
+      {0.25, 0.5, 0.25, 0.0, 0.125, 0.875}, 3, 2);
+  ASSERT_THAT(encoded.status(), IsOK());
+  ASSERT_EQ(encoded.ValueOrDie().size(), 2);
+
+  CallVariantsOutput expected1;
+  *expected1.mutable_variant() = variant1;
+  *expected1.mutable_alt_allele_indices() = alts1;
+  for (double p : {0.25, 0.5, 0.25}) expected1.add_genotype_probabilities(p);
+  CallVariantsOutput expected2;
+  *expected2.mutable_variant() = variant2;
+  *expected2.mutable_alt_allele_indices() = alts2;
+  for (double p : {0.0, 0.13, 0.88}) expected2.add_genotype_probabilities(p);
+
+  CallVariantsOutput actual;
+  ASSERT_TRUE(actual.ParseFromString(encoded.ValueOrDie()[0]));
+  EXPECT_THAT(actual, EqualsProto(expected1));
+  // The fields are written in the same order as protobuf serializes them.
+  EXPECT_EQ(encoded.ValueOrDie()[0], expected1.SerializeAsString());
+  ASSERT_TRUE(actual.ParseFromString(encoded.ValueOrDie()[1]));
+  EXPECT_THAT(actual, EqualsProto(expected2));
+}
+
+TEST(EncodeCallVariantsOutputsTest, RejectsMismatchedInputs) {
+  EXPECT_FALSE(
+      EncodeCallVariantsOutputs({"a", "b"}, {"x", "y"}, {1, 0, 0}, 3, 2).ok());
+  EXPECT_FALSE(EncodeCallVariantsOutputs({"a"}, {}, {1, 0, 0}, 3, 2).ok());
+}
+
+Variant MakeKeyVariant(const string& reference_name, int64 start, int64 end) {
+  Variant variant;
+  variant.set_reference_name(reference_name);
+  variant.set_start(start);
+  variant.set_end(end);
+  variant.add_calls();
+  return variant;
+}
+
+TEST(ScanCallVariantsOutputKeyTest, ReadsTheVariantKey) {
+  CallVariantsOutput output;
+  *output.mutable_variant() = MakeKeyVariant("chr2", 100, 103);
+  output.mutable_variant()->add_alternate_bases("T");
+  output.add_genotype_probabilities(1);
+  CallVariantsOutputKey key;
+  ASSERT_TRUE(ScanCallVariantsOutputKey(output.SerializeAsString(), &key));
+  EXPECT_EQ(key.reference_name, "chr2");
+  EXPECT_EQ(key.start, 100);
+  EXPECT_EQ(key.end, 103);
+  EXPECT_EQ(key.num_calls, 1);
+
+  CallVariantsOutputKey variant_key;
+  ASSERT_TRUE(
+      ScanVariantKey(output.variant().SerializeAsString(), &variant_key));
+  EXPECT_EQ(variant_key.reference_name, "chr2");
+  EXPECT_EQ(variant_key.start, 100);
+  EXPECT_FALSE(ScanCallVariantsOutputKey("\xff\xff", &key));
+}
+
+TEST(CallVariantsOutputWriterTest, WritesRecordsInOrder) {
+  const string path = core::MakeTempFile("writes_records.tfrecord");
+  StatusOr<std::unique_ptr<CallVariantsOutputWriter>> writer_or =
+      CallVariantsOutputWriter::ToFile(path);
+  ASSERT_THAT(writer_or.status(), IsOK());
+  std::unique_ptr<CallVariantsOutputWriter> writer =
+      std::move(writer_or.ValueOrDie());
+
+  const std::vector<Variant> variants = {
+      MakeKeyVariant("chr20", 10, 11), MakeKeyVariant("chr20", 20, 25),
+      MakeKeyVariant("chr20", 20, 21), MakeKeyVariant("chr20", 30, 31),
+      MakeKeyVariant("chr21", 5, 6)};
+  std::vector<string> encoded_variants;
+  std::vector<string> encoded_alt_allele_indices;
+  std::vector<float> probabilities;
+  for (const Variant& variant : variants) {
+    encoded_variants.push_back(variant.SerializeAsString());
+    encoded_alt_allele_indices.push_back("");
+    probabilities.insert(probabilities.end(), {0.5, 0.25, 0.25});
+  }
+  ASSERT_THAT(writer->WriteBatch(encoded_variants, encoded_alt_allele_indices,
+                                 probabilities, 3, 10),
+              IsOK());
+  CallVariantsOutput last;
+  *last.mutable_variant() = MakeKeyVariant("chr21", 7, 8);
+  ASSERT_THAT(writer->Write(last.SerializeAsString()), IsOK());
+  ASSERT_THAT(writer->Close(), IsOK());
+
+  std::vector<string> records;
+  std::unique_ptr<tensorflow::RandomAccessFile> file;
+  TF_CHECK_OK(tensorflow::Env::Default()->NewRandomAccessFile(path, &file));
+  tensorflow::io::RecordReader reader(file.get());
+  tensorflow::uint64 offset = 0;
+  string record;
+  while (reader.ReadRecord(&offset, &record).ok()) {
+    records.push_back(record);
+  }
+  ASSERT_EQ(records.size(), 6);
+  CallVariantsOutput output;
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_TRUE(output.ParseFromString(records[i]));
+    EXPECT_THAT(output.variant(), EqualsProto(variants[i]));
+  }
+  EXPECT_EQ(records[5], last.SerializeAsString());
+  // A closed writer takes no more records.
+  EXPECT_FALSE(writer->Write(records[0]).ok());
+
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
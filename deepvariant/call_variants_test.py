@@ -46,12 +46,14 @@ import tensorflow as tf
 
 from absl import logging
 from deepvariant import call_variants
+from deepvariant import example_stream
 from deepvariant import modeling
 from deepvariant import test_utils
 from deepvariant import tf_utils
 from deepvariant.core import io_utils
 from deepvariant.core import variantutils
 from deepvariant.protos import deepvariant_pb2
+from deepvariant.python import call_variants_output
 from deepvariant.testing import flagsaver
 
 FLAGS = tf.flags.FLAGS
@@ -201,6 +203,46 @@ class CallVariantsEndToEndTests(
       self.assertTrue(
           0 <= gp <= 1 for gp in call_variants_output.genotype_probabilities)
 
+  @parameterized.parameters((model, warmup)
+                            for model in modeling.production_models()
+                            for warmup in [False, True])
+  def test_call_variants_with_frozen_model(self, model, warmup):
+    frozen_model_path = test_utils.test_tmpfile(
+        'frozen_{}.pb'.format(model.name))
+    call_variants.export_frozen_model(
+        examples_filename=test_utils.GOLDEN_CALLING_EXAMPLES,
+        checkpoint_path=modeling.SKIP_MODEL_INITIALIZATION_IN_TEST,
+        model=model,
+        output_path=frozen_model_path)
+    graph_def = tf.GraphDef.FromString(
+        tf.gfile.GFile(frozen_model_path, 'rb').read())
+    # The weights are constants in the frozen graph.
+    self.assertNotIn('VariableV2', {node.op for node in graph_def.node})
+
+    outfile = test_utils.test_tmpfile('call_variants_frozen.tfrecord')
+    batch_size = 4
+    max_batches = None if model.name == 'random_guess' else 1
+    call_variants.call_variants(
+        examples_filename=test_utils.GOLDEN_CALLING_EXAMPLES,
+        checkpoint_path=None,
+        model=model,
+        output_file=outfile,
+        batch_size=batch_size,
+        max_batches=max_batches,
+        frozen_model_path=frozen_model_path,
+        intra_op_threads=2,
+        inter_op_threads=2,
+        warmup=warmup)
+
+    examples = list(io_utils.read_tfrecords(test_utils.GOLDEN_CALLING_EXAMPLES))
+    call_variants_outputs = list(
+        io_utils.read_tfrecords(outfile, deepvariant_pb2.CallVariantsOutput))
+    self.assertEqual(
+        len(call_variants_outputs), batch_size * max_batches
+        if max_batches else len(examples))
+    for cvo in call_variants_outputs:
+      self.assertEqual(len(cvo.genotype_probabilities), 3)
+
   @parameterized.parameters((model, bad_format)
                             for model in modeling.production_models()
                             for bad_format in ['', 'png'])
@@ -282,6 +324,65 @@ class CallVariantsUnitTests(
       self.assertItemsEqual(self.variants,
                             variantutils.decode_variants(seen_variants))
 
+  @flagsaver.FlagSaver
+  def test_batch_writer_matches_per_variant_writer(self):
+    FLAGS.include_debug_info = False
+    rng = np.random.RandomState(3)
+    predictions = rng.dirichlet([1, 1, 1], len(self.examples)).astype(
+        np.float32)
+    # Dirichlet samples don't always sum to one within float32 precision.
+    predictions[:, 2] = 1 - predictions[:, 0] - predictions[:, 1]
+    encoded_variants = [v.SerializeToString() for v in self.variants]
+    encoded_alt_allele_indices = [
+        ex.features.feature['alt_allele_indices/encoded'].bytes_list.value[0]
+        for ex in self.examples
+    ]
+
+    expected = []
+    with call_variants.make_async_writer(expected.append) as writer:
+      for variant, alts, gls in zip(encoded_variants,
+                                    encoded_alt_allele_indices, predictions):
+        writer.write(variant, call_variants.round_gls(gls, precision=10), alts)
+    path = test_utils.test_tmpfile('batch_writer.tfrecord')
+    sync_writer = call_variants_output.CallVariantsOutputWriter.to_file(path)
+    with sync_writer, call_variants.make_batch_async_writer(
+        sync_writer) as writer:
+      writer.write(
+          np.array(encoded_variants, dtype=object),
+          np.array(encoded_alt_allele_indices, dtype=object), predictions)
+
+    self.assertEqual(
+        list(io_utils.read_tfrecords(path, deepvariant_pb2.CallVariantsOutput)),
+        expected)
+
+  def _read_all_inputs(self, source_path):
+    with tf.Graph().as_default():
+      inputs = call_variants.prepare_inputs(
+          source_path, self.model, batch_size=4)
+      with tf.Session() as sess:
+        sess.run(tf.local_variables_initializer())
+        seen = []
+        try:
+          while True:
+            seen.append(sess.run(inputs))
+        except tf.errors.OutOfRangeError:
+          pass
+    return [np.concatenate(parts) for parts in zip(*seen)]
+
+  def test_prepare_inputs_from_example_stream(self):
+    tfrecord_path = test_utils.test_tmpfile('stream_baseline.tfrecord')
+    io_utils.write_tfrecords(self.examples, tfrecord_path)
+    stream_path = test_utils.test_tmpfile('examples.dvex')
+    with example_stream.ExampleStreamWriter(stream_path) as writer:
+      for example in self.examples:
+        writer.write(example)
+
+    expected = self._read_all_inputs(tfrecord_path)
+    actual = self._read_all_inputs(stream_path)
+    self.assertLen(actual, len(expected))
+    for actual_part, expected_part in zip(actual, expected):
+      np.testing.assert_array_equal(actual_part, expected_part)
+
   @parameterized.parameters(
       (None, [3.592555731302127e-5, 0.99992620944976807, 3.78809563699178e-5]),
       (2, [0.0, 1.0, 0.0]),
@@ -358,6 +459,18 @@ class CallVariantsUnitTests(
       else:
         _run()
 
+  def test_session_config(self):
+    config = call_variants.session_config(
+        execution_hardware='cpu',
+        intra_op_threads=4,
+        inter_op_threads=2,
+        xla_jit=True)
+    self.assertEqual(0, config.device_count['GPU'])
+    self.assertEqual(4, config.intra_op_parallelism_threads)
+    self.assertEqual(2, config.inter_op_parallelism_threads)
+    self.assertEqual(tf.OptimizerOptions.ON_1,
+                     config.graph_options.optimizer_options.global_jit_level)
+
   def test_catches_bad_argv(self):
     with mock.patch.object(logging, 'error') as mock_logging,\
         mock.patch.object(sys, 'exit') as mock_exit:
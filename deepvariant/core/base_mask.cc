@@ -0,0 +1,200 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of base_mask.h.
+#include "deepvariant/core/base_mask.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "deepvariant/core/base_mask_kernels.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using internal::BaseScan;
+
+namespace {
+
+// Returns the kernel to use for kernel on this CPU.
+BaseMaskKernel ResolveBaseMaskKernel(BaseMaskKernel kernel) {
+  if (kernel != BaseMaskKernel::kAuto && CpuSupportsBaseMaskKernel(kernel)) {
+    return kernel;
+  }
+  for (const BaseMaskKernel widest :
+       {BaseMaskKernel::kAvx2, BaseMaskKernel::kSse42}) {
+    if (CpuSupportsBaseMaskKernel(widest)) {
+      return widest;
+    }
+  }
+  return BaseMaskKernel::kScalar;
+}
+
+// Returns true if position i of scan is usable.
+bool IsUsable(const BaseScan& scan, int i) {
+  const char base = scan.bases[i];
+  if (!(base == 'A' || base == 'C' || base == 'G' || base == 'T' ||
+        (scan.allow_n && base == 'N'))) {
+    return false;
+  }
+  if (scan.quals8 != nullptr) return scan.quals8[i] >= scan.min_quality;
+  if (scan.quals32 != nullptr) return scan.quals32[i] >= scan.min_quality;
+  return true;
+}
+
+// Fills in the words of scan.mask from word first on, one position at a time.
+void ScanBasesScalar(const BaseScan& scan, int first) {
+  for (int w = first; w * 64 < scan.length; ++w) {
+    uint64_t word = 0;
+    const int end = std::min(scan.length, w * 64 + 64);
+    for (int i = w * 64; i < end; ++i) {
+      word |= static_cast<uint64_t>(IsUsable(scan, i)) << (i & 63);
+    }
+    scan.mask[w] = word;
+  }
+}
+
+// Returns a scan of bases that doesn't check qualities.
+BaseScan MakeScan(tensorflow::StringPiece bases, const bool allow_n) {
+  BaseScan scan;
+  scan.bases = bases.data();
+  scan.length = bases.size();
+  scan.allow_n = allow_n;
+  scan.quals8 = nullptr;
+  scan.quals32 = nullptr;
+  scan.min_quality = 0;
+  scan.mask = nullptr;
+  return scan;
+}
+
+}  // namespace
+
+bool CpuSupportsBaseMaskKernel(BaseMaskKernel kernel) {
+  switch (kernel) {
+    case BaseMaskKernel::kSse42:
+      return __builtin_cpu_supports("sse4.2");
+    case BaseMaskKernel::kAvx2:
+      return __builtin_cpu_supports("avx2");
+    case BaseMaskKernel::kScalar:
+      return true;
+    case BaseMaskKernel::kAuto:
+      return true;
+  }
+  return false;
+}
+
+BaseMask::BaseMask(BaseMaskKernel kernel)
+    : kernel_(ResolveBaseMaskKernel(kernel)) {}
+
+void BaseMask::Scan(BaseScan* scan) {
+  size_ = scan->length;
+  words_.assign((size_ + 63) / 64, 0);
+  scan->mask = words_.data();
+  switch (kernel_) {
+    case BaseMaskKernel::kAvx2:
+      internal::ScanBasesAvx2(*scan);
+      break;
+    case BaseMaskKernel::kSse42:
+      internal::ScanBasesSse42(*scan);
+      break;
+    default:
+      ScanBasesScalar(*scan, 0);
+      return;
+  }
+  // The kernels leave the last partial word to us.
+  ScanBasesScalar(*scan, size_ / 64);
+}
+
+void BaseMask::Compute(tensorflow::StringPiece bases, const bool allow_n) {
+  BaseScan scan = MakeScan(bases, allow_n);
+  Scan(&scan);
+}
+
+void BaseMask::Compute(tensorflow::StringPiece bases, const uint8_t* quals,
+                       const int min_quality, const bool allow_n) {
+  BaseScan scan = MakeScan(bases, allow_n);
+  if (min_quality > UINT8_MAX) {
+    // No quality is good enough.
+    size_ = scan.length;
+    words_.assign((size_ + 63) / 64, 0);
+    return;
+  }
+  // Every quality passes a min_quality <= 0, so we only check the bases then.
+  if (min_quality > 0) {
+    scan.quals8 = quals;
+    scan.min_quality = min_quality;
+  }
+  Scan(&scan);
+}
+
+void BaseMask::Compute(tensorflow::StringPiece bases, const int32_t* quals,
+                       const int min_quality, const bool allow_n) {
+  BaseScan scan = MakeScan(bases, allow_n);
+  // Every quality passes INT_MIN, so we only check the bases then.
+  if (min_quality > INT_MIN) {
+    scan.quals32 = quals;
+    scan.min_quality = min_quality;
+  }
+  Scan(&scan);
+}
+
+bool BaseMask::AllSet(const int begin, const int end) const {
+  DCHECK(begin >= 0 && end <= size_);
+  if (begin >= end) return true;
+  const int first = begin >> 6;
+  const int last = (end - 1) >> 6;
+  for (int w = first; w <= last; ++w) {
+    uint64_t want = ~uint64_t{0};
+    if (w == first) want &= ~uint64_t{0} << (begin & 63);
+    if (w == last) want &= ~uint64_t{0} >> (63 - ((end - 1) & 63));
+    if ((words_[w] & want) != want) return false;
+  }
+  return true;
+}
+
+int BaseMask::FindUnset(const int begin) const {
+  DCHECK(begin >= 0 && begin <= size_);
+  int w = begin >> 6;
+  if (w >= static_cast<int>(words_.size())) return size_;
+  // The unset positions of each word, ignoring those before begin.
+  uint64_t unset = ~words_[w] & (~uint64_t{0} << (begin & 63));
+  while (unset == 0) {
+    if (++w == static_cast<int>(words_.size())) return size_;
+    unset = ~words_[w];
+  }
+  return std::min(size_, w * 64 + __builtin_ctzll(unset));
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
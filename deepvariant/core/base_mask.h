@@ -0,0 +1,119 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Bitmasks of the usable positions of a sequence of bases.
+//
+// Code working on the bases of a read keeps asking whether a base, or a run of
+// bases, is canonical and of good enough quality to be used. A BaseMask
+// answers all of these from one scan over the bases and qualities of the read,
+// done with SIMD instructions where the CPU has them, instead of rescanning
+// the bases of each run.
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_BASE_MASK_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_BASE_MASK_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "tensorflow/core/lib/core/stringpiece.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace internal {
+struct BaseScan;
+}  // namespace internal
+
+// The implementations of the scan computing a BaseMask.
+enum class BaseMaskKernel {
+  kScalar,
+  kSse42,
+  kAvx2,
+  // The widest of our kernels this CPU supports.
+  kAuto,
+};
+
+// Returns whether this CPU can run kernel.
+bool CpuSupportsBaseMaskKernel(BaseMaskKernel kernel);
+
+// A bitmask over the positions of a sequence of bases, with the positions
+// whose base is canonical (one of A, C, G and T, and optionally N) and whose
+// quality, if given, is at least a minimum set.
+//
+// A BaseMask can be reused for many sequences, keeping its storage.
+class BaseMask {
+ public:
+  // Creates an empty mask computed with kernel, or the widest kernel this CPU
+  // supports if it can't run kernel.
+  explicit BaseMask(BaseMaskKernel kernel = BaseMaskKernel::kAuto);
+
+  // Sets this mask to the positions of bases that are canonical, with N
+  // counting as canonical if allow_n.
+  void Compute(tensorflow::StringPiece bases, bool allow_n);
+
+  // Same as above, but only sets position i if quals[i] >= min_quality as
+  // well. quals must have bases.size() values.
+  void Compute(tensorflow::StringPiece bases, const uint8_t* quals,
+               int min_quality, bool allow_n);
+  void Compute(tensorflow::StringPiece bases, const int32_t* quals,
+               int min_quality, bool allow_n);
+
+  // The number of positions of the mask.
+  int size() const { return size_; }
+
+  // Returns true if position i, which must be >= 0 and < size(), is set.
+  bool IsSet(int i) const { return (words_[i >> 6] >> (i & 63)) & 1; }
+
+  // Returns true if all of the positions in [begin, end) are set, where
+  // 0 <= begin <= end <= size().
+  bool AllSet(int begin, int end) const;
+
+  // Returns the first position >= begin that isn't set, or size() if there is
+  // none.
+  int FindUnset(int begin) const;
+
+ private:
+  // Fills in words_ for scan, whose mask is set by this function.
+  void Scan(internal::BaseScan* scan);
+
+  BaseMaskKernel kernel_;
+  int size_ = 0;
+  // Bit i % 64 of words_[i / 64] is position i. The bits past size_ are clear.
+  std::vector<uint64_t> words_;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_BASE_MASK_H_
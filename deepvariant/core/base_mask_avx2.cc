@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The AVX2 BaseMask kernel. This file must be compiled with -mavx2.
+
+#include <immintrin.h>
+
+#include "deepvariant/core/base_mask_kernels.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+namespace internal {
+
+void ScanBasesAvx2(const BaseScan& scan) {
+  const __m256i a = _mm256_set1_epi8('A');
+  const __m256i c = _mm256_set1_epi8('C');
+  const __m256i g = _mm256_set1_epi8('G');
+  const __m256i t = _mm256_set1_epi8('T');
+  // Compares against T again unless N is allowed.
+  const __m256i n = _mm256_set1_epi8(scan.allow_n ? 'N' : 'T');
+  const __m256i min_quality8 = _mm256_set1_epi8(
+      static_cast<char>(scan.quals8 != nullptr ? scan.min_quality : 0));
+  const __m256i below_quality32 = _mm256_set1_epi32(scan.min_quality - 1);
+
+  const int n_words = scan.length / 64;
+  for (int w = 0; w < n_words; ++w) {
+    uint64_t word = 0;
+    for (int block = 0; block < 2; ++block) {
+      const int start = w * 64 + block * 32;
+      const __m256i bases = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(scan.bases + start));
+      const __m256i is_canonical = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi8(bases, a),
+                          _mm256_cmpeq_epi8(bases, c)),
+          _mm256_or_si256(
+              _mm256_or_si256(_mm256_cmpeq_epi8(bases, g),
+                              _mm256_cmpeq_epi8(bases, t)),
+              _mm256_cmpeq_epi8(bases, n)));
+      uint32_t bits = _mm256_movemask_epi8(is_canonical);
+      if (scan.quals8 != nullptr) {
+        const __m256i quals = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(scan.quals8 + start));
+        bits &= _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_max_epu8(quals, min_quality8), quals));
+      } else if (scan.quals32 != nullptr) {
+        uint32_t good = 0;
+        for (int i = 0; i < 4; ++i) {
+          const __m256i quals = _mm256_loadu_si256(
+              reinterpret_cast<const __m256i*>(scan.quals32 + start + 8 * i));
+          good |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(
+                      _mm256_cmpgt_epi32(quals, below_quality32))))
+                  << (8 * i);
+        }
+        bits &= good;
+      }
+      word |= static_cast<uint64_t>(bits) << (block * 32);
+    }
+    scan.mask[w] = word;
+  }
+}
+
+}  // namespace internal
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
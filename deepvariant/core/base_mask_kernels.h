@@ -0,0 +1,80 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The SIMD kernels computing BaseMasks.
+//
+// Each base_mask_<isa>.cc implements its kernel with the intrinsics of its
+// instruction set, and is compiled with the flags enabling it, so this header
+// must only be included by those files and by base_mask.cc, which dispatches
+// to them at runtime.
+//
+// N.B.: nothing here may instantiate templates from the standard library or
+// define inline functions: the copies of them emitted in a file compiled for
+// AVX2 could be picked by the linker for code running on any CPU.
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_BASE_MASK_KERNELS_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_BASE_MASK_KERNELS_H_
+
+#include <stdint.h>
+
+namespace learning {
+namespace genomics {
+namespace core {
+namespace internal {
+
+// The inputs and output of a scan of length bases.
+struct BaseScan {
+  const char* bases;
+  int length;
+  // If true, N is a canonical base.
+  bool allow_n;
+  // The qualities of the bases, of which at most one is set. If neither is,
+  // only the bases are checked.
+  const uint8_t* quals8;
+  const int32_t* quals32;
+  // The smallest usable quality. Is within [1, 255] if quals8 is set, and
+  // above INT32_MIN if quals32 is.
+  int min_quality;
+  // Bit i % 64 of mask[i / 64] is set iff position i is usable.
+  uint64_t* mask;
+};
+
+// Fill in the length / 64 words of scan.mask covered entirely by the bases,
+// leaving the last partial word, if any, to the caller.
+void ScanBasesSse42(const BaseScan& scan);
+void ScanBasesAvx2(const BaseScan& scan);
+
+}  // namespace internal
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_BASE_MASK_KERNELS_H_
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The SSE4.2 BaseMask kernel, which finds the canonical bases with the string
+// comparison instructions of SSE4.2. This file must be compiled with
+// -msse4.2.
+
+#include <nmmintrin.h>
+
+#include "deepvariant/core/base_mask_kernels.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+namespace internal {
+
+void ScanBasesSse42(const BaseScan& scan) {
+  const __m128i canonical = _mm_setr_epi8('A', 'C', 'G', 'T', 'N', 0, 0, 0, 0,
+                                          0, 0, 0, 0, 0, 0, 0);
+  const int n_canonical = scan.allow_n ? 5 : 4;
+  const __m128i min_quality8 = _mm_set1_epi8(
+      static_cast<char>(scan.quals8 != nullptr ? scan.min_quality : 0));
+  const __m128i below_quality32 = _mm_set1_epi32(scan.min_quality - 1);
+
+  const int n_words = scan.length / 64;
+  for (int w = 0; w < n_words; ++w) {
+    uint64_t word = 0;
+    for (int block = 0; block < 4; ++block) {
+      const int start = w * 64 + block * 16;
+      const __m128i bases =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(scan.bases + start));
+      uint32_t bits = _mm_cvtsi128_si32(_mm_cmpestrm(
+          canonical, n_canonical, bases, 16,
+          _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK));
+      if (scan.quals8 != nullptr) {
+        const __m128i quals = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(scan.quals8 + start));
+        bits &= _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_max_epu8(quals, min_quality8), quals));
+      } else if (scan.quals32 != nullptr) {
+        uint32_t good = 0;
+        for (int i = 0; i < 4; ++i) {
+          const __m128i quals = _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(scan.quals32 + start + 4 * i));
+          good |= _mm_movemask_ps(_mm_castsi128_ps(
+                      _mm_cmpgt_epi32(quals, below_quality32)))
+                  << (4 * i);
+        }
+        bits &= good;
+      }
+      word |= static_cast<uint64_t>(bits & 0xffff) << (block * 16);
+    }
+    scan.mask[w] = word;
+  }
+}
+
+}  // namespace internal
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/base_mask.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+namespace {
+
+// The usable positions of bases, computed one position at a time.
+template <typename Qual>
+std::vector<bool> ExpectedMask(const std::string& bases,
+                               const std::vector<Qual>& quals,
+                               const int min_quality, const bool allow_n) {
+  std::vector<bool> expected;
+  for (size_t i = 0; i < bases.size(); ++i) {
+    const char base = bases[i];
+    expected.push_back((base == 'A' || base == 'C' || base == 'G' ||
+                        base == 'T' || (allow_n && base == 'N')) &&
+                       (quals.empty() || quals[i] >= min_quality));
+  }
+  return expected;
+}
+
+std::vector<bool> MaskBits(const BaseMask& mask) {
+  std::vector<bool> bits;
+  for (int i = 0; i < mask.size(); ++i) {
+    bits.push_back(mask.IsSet(i));
+  }
+  return bits;
+}
+
+class BaseMaskTest : public ::testing::TestWithParam<BaseMaskKernel> {};
+
+// Every kernel must agree with a scan of one position at a time, for lengths
+// with and without partial words and for qualities of both widths.
+TEST_P(BaseMaskTest, MatchesScalarScan) {
+  std::mt19937 random(42);
+  const std::string alphabet = "ACGTNacgtnX-";
+  BaseMask mask(GetParam());
+  for (int length = 0; length < 300; length += 7) {
+    std::string bases;
+    std::vector<uint8_t> quals8;
+    std::vector<int32_t> quals32;
+    for (int i = 0; i < length; ++i) {
+      // Mostly canonical bases, as in real reads.
+      bases.push_back(random() % 4 ? alphabet[random() % 4]
+                                   : alphabet[random() % alphabet.size()]);
+      quals8.push_back(random() % 60);
+      quals32.push_back(quals8.back());
+    }
+    for (const bool allow_n : {false, true}) {
+      mask.Compute(bases, allow_n);
+      EXPECT_EQ(ExpectedMask(bases, std::vector<int32_t>(), 0, allow_n),
+                MaskBits(mask));
+      for (const int min_quality : {0, 1, 20, 59, 300}) {
+        mask.Compute(bases, quals8.data(), min_quality, allow_n);
+        EXPECT_EQ(ExpectedMask(bases, quals8, min_quality, allow_n),
+                  MaskBits(mask));
+        mask.Compute(bases, quals32.data(), min_quality, allow_n);
+        EXPECT_EQ(ExpectedMask(bases, quals32, min_quality, allow_n),
+                  MaskBits(mask));
+      }
+    }
+  }
+}
+
+TEST_P(BaseMaskTest, FindsUnsetPositions) {
+  // Positions 3, 64 and 129 are the only unusable ones.
+  std::string bases(130, 'A');
+  bases[3] = 'N';
+  bases[64] = 'x';
+  bases[129] = 'N';
+  BaseMask mask(GetParam());
+  mask.Compute(bases, false);
+  EXPECT_EQ(130, mask.size());
+  EXPECT_EQ(3, mask.FindUnset(0));
+  EXPECT_EQ(3, mask.FindUnset(3));
+  EXPECT_EQ(64, mask.FindUnset(4));
+  EXPECT_EQ(129, mask.FindUnset(65));
+  EXPECT_EQ(130, mask.FindUnset(130));
+  EXPECT_TRUE(mask.AllSet(4, 64));
+  EXPECT_FALSE(mask.AllSet(4, 65));
+  EXPECT_TRUE(mask.AllSet(65, 129));
+  EXPECT_TRUE(mask.AllSet(129, 129));
+
+  mask.Compute(bases, true);
+  EXPECT_EQ(64, mask.FindUnset(0));
+  EXPECT_EQ(130, mask.FindUnset(65));
+  EXPECT_TRUE(mask.AllSet(65, 130));
+}
+
+INSTANTIATE_TEST_CASE_P(Kernels, BaseMaskTest,
+                        ::testing::Values(BaseMaskKernel::kScalar,
+                                          BaseMaskKernel::kSse42,
+                                          BaseMaskKernel::kAvx2,
+                                          BaseMaskKernel::kAuto));
+
+}  // namespace
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
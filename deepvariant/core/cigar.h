@@ -0,0 +1,121 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Inlined walking over the CIGAR elements of a Read.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_CIGAR_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_CIGAR_H_
+
+#include "deepvariant/core/genomics/cigar.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using tensorflow::int64;
+
+// Returns true if op consumes bases of the reference genome, as defined by the
+// SAM spec: M, =, X, D and N.
+inline bool ConsumesReference(
+    const learning::genomics::v1::CigarUnit::Operation op) {
+  using learning::genomics::v1::CigarUnit;
+  switch (op) {
+    case CigarUnit::ALIGNMENT_MATCH:
+    case CigarUnit::SEQUENCE_MATCH:
+    case CigarUnit::SEQUENCE_MISMATCH:
+    case CigarUnit::DELETE:
+    case CigarUnit::SKIP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true if op consumes bases of the read, as defined by the SAM spec:
+// M, =, X, I and S.
+inline bool ConsumesRead(
+    const learning::genomics::v1::CigarUnit::Operation op) {
+  using learning::genomics::v1::CigarUnit;
+  switch (op) {
+    case CigarUnit::ALIGNMENT_MATCH:
+    case CigarUnit::SEQUENCE_MATCH:
+    case CigarUnit::SEQUENCE_MISMATCH:
+    case CigarUnit::INSERT:
+    case CigarUnit::CLIP_SOFT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Walks over the CIGAR elements of read in order, calling
+//
+//   bool visitor(CigarUnit::Operation op, int op_len, int64 ref_pos,
+//                int read_offset)
+//
+// for each, where op and op_len are the operation and length of the element,
+// ref_pos is the position on the genome and read_offset is the offset into the
+// bases of read at which the element starts. Returns false as soon as visitor
+// returns false, and true if all of the elements were visited.
+//
+// This is a template so visitor, typically a lambda, is inlined into the loop
+// instead of being called indirectly through a std::function for every element
+// or base. Use it for any per-base work over the alignment of a read:
+//
+//   WalkCigar(read, [&](CigarUnit::Operation op, int op_len, int64 ref_pos,
+//                       int offset) {
+//     if (op == CigarUnit::ALIGNMENT_MATCH) { ... }
+//     return true;
+//   });
+//
+// The visitor doesn't see the CigarUnit itself so the same visitor can also
+// walk a ReadView; see read_view.h.
+template <typename Visitor>
+inline bool WalkCigar(const learning::genomics::v1::Read& read,
+                      Visitor&& visitor) {
+  int64 ref_pos = read.alignment().position().position();
+  int read_offset = 0;
+  for (const auto& unit : read.alignment().cigar()) {
+    const auto op = unit.operation();
+    const int op_len = unit.operation_length();
+    if (!visitor(op, op_len, ref_pos, read_offset)) return false;
+    if (ConsumesReference(op)) ref_pos += op_len;
+    if (ConsumesRead(op)) read_offset += op_len;
+  }
+  return true;
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_CIGAR_H_
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/cigar.h"
+
+#include <tuple>
+#include <vector>
+
+#include "deepvariant/core/genomics/cigar.pb.h"
+#include "deepvariant/core/test_utils.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::v1::CigarUnit;
+using learning::genomics::v1::Read;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+// (operation, ref_pos, read_offset) of each element visited by WalkCigar.
+using Visit = std::tuple<CigarUnit::Operation, int64, int>;
+
+std::vector<Visit> VisitAll(const Read& read) {
+  std::vector<Visit> visits;
+  EXPECT_TRUE(WalkCigar(
+      read, [&visits](CigarUnit::Operation op, int, int64 ref_pos,
+                      int offset) {
+        visits.emplace_back(op, ref_pos, offset);
+        return true;
+      }));
+  return visits;
+}
+
+TEST(CigarTest, ConsumesReferenceAndRead) {
+  EXPECT_TRUE(ConsumesReference(CigarUnit::ALIGNMENT_MATCH));
+  EXPECT_TRUE(ConsumesRead(CigarUnit::ALIGNMENT_MATCH));
+  EXPECT_TRUE(ConsumesReference(CigarUnit::SEQUENCE_MISMATCH));
+  EXPECT_TRUE(ConsumesRead(CigarUnit::SEQUENCE_MISMATCH));
+  EXPECT_FALSE(ConsumesReference(CigarUnit::INSERT));
+  EXPECT_TRUE(ConsumesRead(CigarUnit::INSERT));
+  EXPECT_FALSE(ConsumesReference(CigarUnit::CLIP_SOFT));
+  EXPECT_TRUE(ConsumesRead(CigarUnit::CLIP_SOFT));
+  EXPECT_TRUE(ConsumesReference(CigarUnit::DELETE));
+  EXPECT_FALSE(ConsumesRead(CigarUnit::DELETE));
+  EXPECT_TRUE(ConsumesReference(CigarUnit::SKIP));
+  EXPECT_FALSE(ConsumesRead(CigarUnit::SKIP));
+  EXPECT_FALSE(ConsumesReference(CigarUnit::CLIP_HARD));
+  EXPECT_FALSE(ConsumesRead(CigarUnit::CLIP_HARD));
+  EXPECT_FALSE(ConsumesReference(CigarUnit::PAD));
+  EXPECT_FALSE(ConsumesRead(CigarUnit::PAD));
+}
+
+TEST(CigarTest, WalkCigarVisitsEachElement) {
+  const Read read = MakeRead("chr1", 10, "ACGTACGTAC",
+                             {"1H", "2S", "3M", "2I", "4D", "2N", "3M", "1H"});
+  EXPECT_THAT(VisitAll(read),
+              ElementsAre(Visit(CigarUnit::CLIP_HARD, 10, 0),
+                          Visit(CigarUnit::CLIP_SOFT, 10, 0),
+                          Visit(CigarUnit::ALIGNMENT_MATCH, 10, 2),
+                          Visit(CigarUnit::INSERT, 13, 5),
+                          Visit(CigarUnit::DELETE, 13, 7),
+                          Visit(CigarUnit::SKIP, 17, 7),
+                          Visit(CigarUnit::ALIGNMENT_MATCH, 19, 7),
+                          Visit(CigarUnit::CLIP_HARD, 22, 10)));
+}
+
+TEST(CigarTest, WalkCigarHandlesEmptyCigar) {
+  EXPECT_THAT(VisitAll(MakeRead("chr1", 10, "", {})), IsEmpty());
+}
+
+TEST(CigarTest, WalkCigarStopsWhenVisitorReturnsFalse) {
+  const Read read = MakeRead("chr1", 10, "ACGTA", {"2M", "1I", "2M"});
+  int n_visited = 0;
+  EXPECT_FALSE(WalkCigar(read, [&n_visited](CigarUnit::Operation op, int,
+                                            int64, int) {
+    ++n_visited;
+    return op != CigarUnit::INSERT;
+  }));
+  EXPECT_EQ(n_visited, 2);
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
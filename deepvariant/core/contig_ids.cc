@@ -0,0 +1,124 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of contig_ids.h.
+#include "deepvariant/core/contig_ids.h"
+
+#include <deque>
+#include <unordered_map>
+
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace tf = tensorflow;
+
+using tensorflow::StringPiece;
+using tensorflow::string;
+
+namespace {
+
+// The interned contigs. The names are kept in a deque, which never moves
+// them, so the ids map can key on StringPieces of them and ContigName() can
+// return references to them.
+struct ContigTable {
+  tf::mutex mutex;
+  std::deque<string> names;
+  std::unordered_map<StringPiece, int, tf::StringPieceHasher> ids;
+};
+
+ContigTable* Table() {
+  // Intentionally leaked, as the names it returns must outlive every caller.
+  static ContigTable* table = new ContigTable;
+  return table;
+}
+
+}  // namespace
+
+int InternContig(StringPiece name) {
+  ContigTable* table = Table();
+  tf::mutex_lock lock(table->mutex);
+  const auto found = table->ids.find(name);
+  if (found != table->ids.end()) return found->second;
+  const int id = table->names.size();
+  table->names.emplace_back(name.data(), name.size());
+  table->ids.emplace(table->names.back(), id);
+  return id;
+}
+
+int FindContigId(StringPiece name) {
+  ContigTable* table = Table();
+  tf::mutex_lock lock(table->mutex);
+  const auto found = table->ids.find(name);
+  return found == table->ids.end() ? -1 : found->second;
+}
+
+const string& ContigName(const int id) {
+  ContigTable* table = Table();
+  tf::mutex_lock lock(table->mutex);
+  CHECK(id >= 0 && id < static_cast<int>(table->names.size()))
+      << "Unknown contig id " << id;
+  return table->names[id];
+}
+
+int NumInternedContigs() {
+  ContigTable* table = Table();
+  tf::mutex_lock lock(table->mutex);
+  return table->names.size();
+}
+
+std::vector<int> MapContigIdToPosInFasta(
+    const std::vector<core::ContigInfo>& contigs) {
+  std::vector<int> contig_id_to_pos_in_fasta;
+  for (const core::ContigInfo& contig : contigs) {
+    const int id = InternContig(contig.name());
+    if (id >= static_cast<int>(contig_id_to_pos_in_fasta.size())) {
+      contig_id_to_pos_in_fasta.resize(id + 1, -1);
+    }
+    contig_id_to_pos_in_fasta[id] = contig.pos_in_fasta();
+  }
+  contig_id_to_pos_in_fasta.resize(NumInternedContigs(), -1);
+  return contig_id_to_pos_in_fasta;
+}
+
+ContigIdMap::ContigIdMap(const std::vector<core::ContigInfo>& contigs) {
+  for (const core::ContigInfo& contig : contigs) {
+    const int id = InternContig(contig.name());
+    ids_.emplace(ContigName(id), id);
+  }
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
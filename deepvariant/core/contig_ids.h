@@ -0,0 +1,99 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A process-wide table of contig names, interned as small integer ids.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_CONTIG_IDS_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_CONTIG_IDS_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include "deepvariant/core/protos/core.pb.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// Returns the id of the contig name, adding it to the process-wide table of
+// contigs if it isn't there yet. Ids are dense, 0 for the first contig
+// interned, 1 for the next and so on, and a name keeps its id until the
+// process exits. Safe to call from any thread.
+//
+// Code that sorts or compares many positions can intern their contigs once,
+// then work with ids that never hash or compare strings, getting the names
+// back with ContigName() only to build protos.
+int InternContig(tensorflow::StringPiece name);
+
+// Returns the id of the contig name, or -1 if it was never interned.
+int FindContigId(tensorflow::StringPiece name);
+
+// Returns the name of the contig with id, which must have been returned by
+// InternContig(). The reference stays valid until the process exits.
+const tensorflow::string& ContigName(int id);
+
+// Returns the number of contigs interned so far, which bounds their ids.
+int NumInternedContigs();
+
+// Interns the names of contigs, and returns the pos_in_fasta of each interned
+// contig by its id, or -1 for the contigs interned that aren't in contigs.
+// Ordering contig ids by this order them like MapContigNameToPosInFasta
+// orders names.
+std::vector<int> MapContigIdToPosInFasta(
+    const std::vector<core::ContigInfo>& contigs);
+
+// A read-only map from the names of a fixed set of contigs to their ids.
+// Unlike FindContigId() it takes no lock, so the threads of a run can share
+// one built up front to look up the contigs of many records.
+class ContigIdMap {
+ public:
+  // Interns the names of contigs, which the map then finds.
+  explicit ContigIdMap(const std::vector<core::ContigInfo>& contigs);
+
+  // Returns the id of the contig name, or -1 if it isn't one of the contigs.
+  int Find(tensorflow::StringPiece name) const {
+    const auto found = ids_.find(name);
+    return found == ids_.end() ? -1 : found->second;
+  }
+
+ private:
+  // Keyed on the interned names, which outlive the map.
+  std::unordered_map<tensorflow::StringPiece, int,
+                     tensorflow::StringPieceHasher>
+      ids_;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_CONTIG_IDS_H_
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/contig_ids.h"
+
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/test_utils.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+TEST(ContigIdsTest, InterningGivesStableIds) {
+  const int chr1 = InternContig("test_chr1");
+  const int chr2 = InternContig("test_chr2");
+  EXPECT_NE(chr1, chr2);
+  EXPECT_EQ(chr1, InternContig("test_chr1"));
+  EXPECT_EQ(chr2, InternContig(string("test_chr2")));
+  EXPECT_EQ(chr1, FindContigId("test_chr1"));
+  EXPECT_EQ("test_chr1", ContigName(chr1));
+  EXPECT_EQ("test_chr2", ContigName(chr2));
+  EXPECT_LT(chr1, NumInternedContigs());
+  EXPECT_LT(chr2, NumInternedContigs());
+}
+
+TEST(ContigIdsTest, UnknownContigsAreNotFound) {
+  EXPECT_EQ(-1, FindContigId("never_interned"));
+}
+
+TEST(ContigIdsTest, NamesOutliveMoreInterning) {
+  const string& name = ContigName(InternContig("test_kept"));
+  for (int i = 0; i < 1000; ++i) {
+    InternContig(tensorflow::strings::StrCat("test_many", i));
+  }
+  EXPECT_EQ("test_kept", name);
+}
+
+TEST(ContigIdsTest, ConcurrentInterningAgrees) {
+  std::vector<std::vector<int>> ids(4);
+  std::vector<std::thread> threads;
+  for (auto& thread_ids : ids) {
+    threads.emplace_back([&thread_ids]() {
+      for (int i = 0; i < 100; ++i) {
+        thread_ids.push_back(
+            InternContig(tensorflow::strings::StrCat("test_concurrent", i)));
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  for (const auto& thread_ids : ids) {
+    EXPECT_EQ(ids[0], thread_ids);
+  }
+}
+
+TEST(ContigIdsTest, MapContigIdToPosInFasta) {
+  const std::vector<ContigInfo> contigs =
+      CreateContigInfos({"test_fasta1", "test_fasta10"}, {1, 1000});
+  const std::vector<int> pos_in_fasta = MapContigIdToPosInFasta(contigs);
+  EXPECT_EQ(NumInternedContigs(), static_cast<int>(pos_in_fasta.size()));
+  EXPECT_EQ(1, pos_in_fasta[FindContigId("test_fasta1")]);
+  EXPECT_EQ(1000, pos_in_fasta[FindContigId("test_fasta10")]);
+  EXPECT_EQ(-1, pos_in_fasta[InternContig("test_chr1")]);
+}
+
+TEST(ContigIdsTest, ContigIdMapFindsItsContigs) {
+  const std::vector<ContigInfo> contigs =
+      CreateContigInfos({"test_map1", "test_map2"}, {0, 1});
+  const ContigIdMap ids(contigs);
+  EXPECT_EQ(FindContigId("test_map1"), ids.Find("test_map1"));
+  EXPECT_EQ(FindContigId("test_map2"), ids.Find(string("test_map2")));
+  EXPECT_NE(ids.Find("test_map1"), ids.Find("test_map2"));
+  InternContig("test_not_in_map");
+  EXPECT_EQ(-1, ids.Find("test_not_in_map"));
+  EXPECT_EQ(-1, ids.Find("never_interned"));
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
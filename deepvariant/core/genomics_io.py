@@ -38,19 +38,38 @@ import re
 
 from deepvariant.core import io_utils
 from deepvariant.core.protos import core_pb2
+from deepvariant.core.python import range_index
+from deepvariant.core.python import reference_2bit
 from deepvariant.core.python import reference_fai
 from deepvariant.core.python import sam_reader as sam_reader_
+from deepvariant.core.python import variant_index
 from deepvariant.core.python import vcf_reader as vcf_reader_
 from deepvariant.core.python import vcf_writer
 
 SHARD_SPEC_PATTERN = re.compile(R'((.*)\@(\d*[1-9]\d*)(?:\.(.+))?)')
 
-VCF_EXTENSIONS = frozenset(['.vcf', '.vcf.gz'])
+VCF_EXTENSIONS = frozenset(['.vcf', '.vcf.gz', '.bcf'])
 SAM_EXTENSIONS = frozenset(['.sam', '.bam'])
 
 
 def make_ref_reader(reference_filename):
-  """Creates an indexed GenomeReference for reference_filename."""
+  """Creates an indexed GenomeReference for reference_filename.
+
+  Args:
+    reference_filename: string. The path to an indexed FASTA file, optionally
+      block-gzipped, or to a local file in the UCSC 2bit format, ending in
+      .2bit. 2bit files are memory-mapped, so they are opened instantly and
+      shared by all of the processes reading them on a machine. One can be
+      created from a FASTA with UCSC's faToTwoBit or with
+      reference_2bit.GenomeReference2Bit.write_file(make_ref_reader(fasta),
+      path).
+
+  Returns:
+    A GenomeReference object.
+  """
+  if reference_filename.endswith('.2bit'):
+    return reference_2bit.GenomeReference2Bit.from_file(
+        reference_filename.encode('utf8'))
   return reference_fai.GenomeReferenceFai.from_file(
       reference_filename.encode('utf8'),
       reference_filename.encode('utf8') + '.fai')
@@ -62,7 +81,11 @@ def make_sam_reader(reads_source,
                     parse_aux_fields=False,
                     hts_block_size=None,
                     downsample_fraction=None,
-                    random_seed=None):
+                    random_seed=None,
+                    num_decompression_threads=None,
+                    ref_path=None,
+                    desired_read_fields=None,
+                    max_depth=None):
   """Creates a SamReader for reads_source.
 
   This function creates a SAM/BAM reader from reads_source, configured by the
@@ -70,8 +93,8 @@ def make_sam_reader(reads_source,
   the iterate() and query(range) APIs.
 
   Args:
-    reads_source: string. A path to a resource containing SAM/BAM records.
-      Currently supports SAM text format and BAM binary format.
+    reads_source: string. A path to a resource containing SAM/BAM/CRAM
+      records. Currently supports SAM text format, BAM binary format and CRAM.
     read_requirements: optional ReadRequirement proto. If not None, this proto
       is used to control which reads are filtered out by the reader before they
       are passed to the client.
@@ -94,6 +117,19 @@ def make_sam_reader(reads_source,
       downsample_fraction, randomly.
     random_seed: None or int. The random seed to use with this sam reader, if
       needed. If None, a fixed random value will be assigned.
+    num_decompression_threads: None or int. If > 0, BGZF blocks of
+      reads_source are decompressed on the process-wide htslib thread pool,
+      which has this many threads if it's created by this reader.
+    ref_path: None or string. The path to the indexed FASTA of the reference
+      the reads are aligned to. A CRAM reads_source needs it to decode its
+      bases; other formats ignore it. If None, htslib looks for the reference
+      named by the header of a CRAM file, possibly downloading it.
+    desired_read_fields: None or OptionalReadFieldsToParse proto. If not None,
+      the fields it excludes are left empty in each read, so the reader
+      doesn't spend any time parsing them. The reads kept are the same.
+    max_depth: None or int. If > 0, queries keep at most this many reads
+      overlapping any position, dropping the others at random before they are
+      parsed. Repeating a query gives the same reads.
 
   Returns:
     A sam_reader object. The exact class implementing this API is not specified.
@@ -139,33 +175,232 @@ def make_sam_reader(reads_source,
           aux_field_handling=aux_field_handling,
           hts_block_size=(hts_block_size or 0),
           downsample_fraction=downsample_fraction,
-          random_seed=random_seed))
+          random_seed=random_seed,
+          num_decompression_threads=(num_decompression_threads or 0),
+          reference_filename=(ref_path or ''),
+          desired_read_fields=desired_read_fields,
+          max_depth=(max_depth or 0)))
+
+
+def prefetch_region_reads(sam_reader, regions, max_prefetched_regions=2):
+  """Yields the list of reads in each of regions from sam_reader, in order.
+
+  For a native SamReader, the reads of the next max_prefetched_regions regions
+  are decoded on a background thread while the caller processes the reads of
+  the current region, using a single sam_reader.query_multiple(regions) so
+  adjacent regions share the work of decoding the records they overlap. The
+  regions must be sorted by start within each contig. Without downsampling,
+  the reads of each region are exactly list(sam_reader.query(region)), which is
+  how the reads of other readers are fetched.
+
+  Args:
+    sam_reader: A sam_reader object created by make_sam_reader. It must not be
+      closed until this generator is exhausted or discarded.
+    regions: An iterable of Range protos.
+    max_prefetched_regions: int >= 1. The maximum number of regions whose reads
+      are held in memory waiting to be yielded.
+
+  Yields:
+    A list of Read protos for each region in regions.
+  """
+  regions = list(regions)
+  if not isinstance(sam_reader, sam_reader_.SamReader):
+    for region in regions:
+      yield list(sam_reader.query(region))
+    return
+
+  prefetcher = sam_reader_.ReadPrefetcher(sam_reader, regions,
+                                          max_prefetched_regions)
+  while True:
+    not_done, reads = prefetcher.next()
+    if not not_done:
+      return
+    yield reads
+
+
+def make_read_block_prefetcher(reads_path,
+                               regions,
+                               cache_path,
+                               num_threads=8,
+                               max_request_bytes=64 * 1024 * 1024):
+  """Starts fetching the blocks of regions of a BAM file into a local cache.
+
+  The BGZF blocks that querying each of regions from the indexed BAM file
+  reads_path would read, along with its header, are fetched on num_threads
+  threads, in requests of up to max_request_bytes, into the same offsets of
+  the local file cache_path. The index of reads_path is written next to it. A
+  reader made with make_sam_reader(cache_path, num_decompression_threads=0)
+  then queries each region like reads_path does, once
+  prefetcher.wait_for_region(i) has returned for the region regions[i]. This
+  turns the many small reads of querying a remote BAM into a few large ones
+  made ahead of time.
+
+  Args:
+    reads_path: string. The path of a BAM file with a BAI index.
+    regions: An iterable of Range protos, sorted, which are the only regions
+      queried from the cache.
+    cache_path: string. The local path of the cache file, which the caller
+      deletes when done.
+    num_threads: int >= 1. The number of requests fetched at once.
+    max_request_bytes: int > 0. The largest number of bytes fetched in a
+      request that merges the blocks of several regions.
+
+  Returns:
+    A ReadBlockPrefetcher.
+  """
+  return sam_reader_.ReadBlockPrefetcher.create(
+      reads_path, list(regions), cache_path, num_threads, max_request_bytes)
+
+
+def estimate_region_read_bytes(reads_path, regions):
+  """Estimates the compressed bytes of the reads of regions of a BAM file.
+
+  The estimates come from the BAI index of reads_path alone, which locates the
+  reads of each region to within BGZF blocks, so no reads are read. They are
+  meant for balancing work across regions, not as exact sizes.
+
+  Args:
+    reads_path: string. The path of a BAM file with a BAI index.
+    regions: An iterable of Range protos.
+
+  Returns:
+    A list with the estimated number of bytes of each of regions, in order.
+  """
+  return sam_reader_.estimate_region_read_bytes(reads_path, list(regions))
+
+
+def iterate_reads_in_parallel(sam_reader,
+                              num_threads,
+                              reads_per_chunk=100000,
+                              ordered=True):
+  """Yields all of the reads of sam_reader, decoded on num_threads threads.
 
+  The reads of a native SamReader with an index are split into chunks of about
+  reads_per_chunk reads, which are read on num_threads threads at once. If
+  ordered, the reads come in the order of sam_reader.iterate(); otherwise the
+  reads of each chunk come as soon as it has been read, so all of the reads
+  are yielded but in no particular order. Other readers are read with
+  sam_reader.iterate().
 
-def make_vcf_reader(variants_source, use_index=True, include_likelihoods=False):
-  """Creates an indexed VcfReader for variants_source."""
+  Args:
+    sam_reader: A sam_reader object created by make_sam_reader with
+      use_index=True. It must not be closed until this generator is exhausted
+      or discarded.
+    num_threads: int >= 1. The number of threads decoding reads.
+    reads_per_chunk: int > 0. The approximate number of reads in each chunk.
+    ordered: bool. Should the reads come in the order of the file?
+
+  Yields:
+    Read protos.
+  """
+  if not isinstance(sam_reader, sam_reader_.SamReader):
+    for read in sam_reader.iterate():
+      yield read
+    return
+
+  iterator = sam_reader_.ParallelReadIterator(
+      sam_reader, sam_reader.chunks(reads_per_chunk), num_threads, ordered)
+  while True:
+    not_done, reads = iterator.next()
+    if not not_done:
+      return
+    for read in reads:
+      yield read
+
+
+def _vcf_reader_options(use_index, include_likelihoods,
+                        num_decompression_threads, genotypes_only):
+  """Returns the VcfReaderOptions described by make_vcf_reader's arguments."""
   if use_index:
     index_mode = core_pb2.INDEX_BASED_ON_FILENAME
   else:
     index_mode = core_pb2.DONT_USE_INDEX
 
-  if include_likelihoods:
+  if genotypes_only:
+    desired_vcf_fields = core_pb2.OptionalVariantFieldsToParse(
+        exclude_genotype_quality=True,
+        exclude_genotype_likelihood=True,
+        exclude_allele_depth=True,
+        exclude_read_depth=True,
+        exclude_phaseset=True)
+  elif include_likelihoods:
     desired_vcf_fields = core_pb2.OptionalVariantFieldsToParse()
   else:
     desired_vcf_fields = core_pb2.OptionalVariantFieldsToParse(
         exclude_genotype_quality=True, exclude_genotype_likelihood=True)
 
+  return core_pb2.VcfReaderOptions(
+      index_mode=index_mode,
+      desired_format_entries=desired_vcf_fields,
+      num_decompression_threads=(num_decompression_threads or 0))
+
+
+def make_vcf_reader(variants_source,
+                    use_index=True,
+                    include_likelihoods=False,
+                    num_decompression_threads=None,
+                    genotypes_only=False):
+  """Creates an indexed VcfReader for variants_source.
+
+  If num_decompression_threads is > 0, BGZF blocks of variants_source are
+  decompressed on the process-wide htslib thread pool, as in make_sam_reader.
+
+  If genotypes_only is True, GT is the only FORMAT field decoded for each call,
+  whatever include_likelihoods says, which is all that labeling candidates
+  against truth variants needs.
+  """
   return vcf_reader_.VcfReader.from_file(
       variants_source.encode('utf8'),
-      core_pb2.VcfReaderOptions(
-          index_mode=index_mode, desired_format_entries=desired_vcf_fields))
+      _vcf_reader_options(use_index, include_likelihoods,
+                          num_decompression_threads, genotypes_only))
+
 
+def make_variant_index(variants_source,
+                       regions=(),
+                       num_decompression_threads=None,
+                       genotypes_only=False):
+  """Loads the variants of variants_source overlapping regions into memory.
+
+  The returned VariantIndex has the query() method of a VcfReader, returning a
+  list of the variants overlapping a region, but answers from memory. It is
+  safe to share across threads.
+
+  Args:
+    variants_source: str. The path to a VCF file, which must be indexed unless
+      regions is empty.
+    regions: iterable of learning.genomics.v1.Range protos. Only the variants
+      overlapping these are loaded. If empty, all of the variants are loaded.
+    num_decompression_threads: as in make_vcf_reader.
+    genotypes_only: as in make_vcf_reader.
 
-def make_vcf_writer(outfile, contigs, samples, filters):
+  Returns:
+    A VariantIndex.
+  """
+  regions = list(regions)
+  return variant_index.VariantIndex.from_file(
+      variants_source.encode('utf8'),
+      _vcf_reader_options(
+          bool(regions),
+          include_likelihoods=False,
+          num_decompression_threads=num_decompression_threads,
+          genotypes_only=genotypes_only), regions)
+
+
+def make_range_index(bed_source):
+  """Creates a RangeIndex of the intervals in the BED file bed_source.
+
+  A RangeIndex answers the overlaps(chrom, pos) queries of a ranges.RangeSet
+  natively, without building the RangeSet in Python first.
+  """
+  return range_index.RangeIndex.from_bed(bed_source.encode('utf8'))
+
+
+def make_vcf_writer(outfile, contigs, samples, filters, write_index=False):
   """Creates a VcfWriter.
 
   Args:
-    outfile: str. A path where we'll write our VCF file.
+    outfile: str. A path where we'll write our VCF file. Paths ending in .gz are
+      bgzipped, and paths ending in .bcf are written as BCF.
     contigs: Iterable of learning.genomics.deepvariant.core.ContigInfo protobufs
       used to populate the contigs info in the VCF header.
     samples: Iterable of str. The name of the samples we will be writing to this
@@ -176,12 +411,22 @@ def make_vcf_writer(outfile, contigs, samples, filters):
       written to this writer. Filters can include filter descriptions that never
       occur in any Variant proto, but all filter field values among all of the
       written Variant protos must be provided here.
+    write_index: bool. If True, outfile must be a .gz or .bcf path, and a tabix
+      or CSI index of it is written alongside as the variants, which must then
+      be sorted, are written.
 
   Returns:
     vcf_writer.VcfWriter.
   """
+  if write_index:
+    index_mode = core_pb2.INDEX_BASED_ON_FILENAME
+  else:
+    index_mode = core_pb2.DONT_USE_INDEX
   writer_options = core_pb2.VcfWriterOptions(
-      contigs=contigs, sample_names=samples, filters=filters)
+      contigs=contigs,
+      sample_names=samples,
+      filters=filters,
+      index_mode=index_mode)
   return vcf_writer.VcfWriter.to_file(outfile, writer_options)
 
 
@@ -95,6 +95,62 @@ class SamReaderTests(parameterized.TestCase):
         with reader.query(interval) as iterable:
           self.assertEqual(test_utils.iterable_len(iterable), n_expected)
 
+  def test_sam_query_with_decompression_threads(self):
+    reader = genomics_io.make_sam_reader(
+        test_utils.genomics_core_testdata('test.bam'),
+        num_decompression_threads=2)
+    with reader:
+      with reader.query(
+          ranges.parse_literal('chr20:10,000,000-10,000,100')) as iterable:
+        self.assertEqual(test_utils.iterable_len(iterable), 106)
+
+  @parameterized.parameters(1, 2, 10)
+  def test_prefetch_region_reads(self, max_prefetched_regions):
+    reader = genomics_io.make_sam_reader(
+        test_utils.genomics_core_testdata('test.bam'))
+    regions = [
+        ranges.parse_literal(literal) for literal in [
+            'chr20:10,000,000-10,000,010', 'chr20:10,000,011-10,000,050',
+            'chr20:10,000,051-10,000,100', 'chr20:20,000,000-20,000,100'
+        ]
+    ]
+    with reader:
+      expected = [list(reader.query(region)) for region in regions]
+      actual = list(
+          genomics_io.prefetch_region_reads(reader, regions,
+                                            max_prefetched_regions))
+      self.assertEqual(actual, expected)
+      self.assertNotEmpty(actual[0])
+      self.assertEqual(actual[-1], [])
+
+  @parameterized.parameters((1, True), (4, True), (4, False))
+  def test_iterate_reads_in_parallel(self, num_threads, ordered):
+    reader = genomics_io.make_sam_reader(
+        test_utils.genomics_core_testdata('test.bam'))
+    with reader:
+      expected = list(reader.iterate())
+      actual = list(
+          genomics_io.iterate_reads_in_parallel(
+              reader, num_threads, reads_per_chunk=10, ordered=ordered))
+      if ordered:
+        self.assertEqual(actual, expected)
+      else:
+        self.assertCountEqual(actual, expected)
+
+  def test_read_block_prefetcher(self):
+    path = test_utils.genomics_core_testdata('test.bam')
+    regions = [
+        ranges.make_range('chr20', 9999999, 10000050),
+        ranges.make_range('chr20', 10000060, 10000100)
+    ]
+    prefetcher = genomics_io.make_read_block_prefetcher(
+        path, regions, test_utils.test_tmpfile('cached.bam'), num_threads=2)
+    with genomics_io.make_sam_reader(path) as reader, \
+        genomics_io.make_sam_reader(prefetcher.cache_path) as cached:
+      for i, region in enumerate(regions):
+        prefetcher.wait_for_region(i)
+        self.assertEqual(list(cached.query(region)), list(reader.query(region)))
+
   @parameterized.parameters(
       ('\t'.join(x[0]
                  for x in items),
@@ -216,12 +272,12 @@ class SamReaderTests(parameterized.TestCase):
       # seed in each test.
       # There are 106 total reads if we iterate.
       ('iterate', None, 1.0, 106),
-      ('iterate', None, 0.5, 52),
-      ('iterate', None, 0.25, 25),
+      ('iterate', None, 0.5, 53),
+      ('iterate', None, 0.25, 33),
       # There are 45 total reads if we don't downsample.
       ('query', 'chr20:10,000,000-10,000,000', 1.0, 45),
-      ('query', 'chr20:10,000,000-10,000,000', 0.5, 20),
-      ('query', 'chr20:10,000,000-10,000,000', 0.25, 11),
+      ('query', 'chr20:10,000,000-10,000,000', 0.5, 22),
+      ('query', 'chr20:10,000,000-10,000,000', 0.25, 10),
   )
   def test_downsampling(self, method, maybe_range, fraction, expected_n_reads):
     reader = genomics_io.make_sam_reader(
@@ -256,6 +312,35 @@ class VcfReaderTests(absltest.TestCase):
     self.assertEqual(
         test_utils.iterable_len(self.samples_reader.query(range1)), 4)
 
+  def test_vcf_genotypes_only(self):
+    reader = genomics_io.make_vcf_reader(
+        test_utils.genomics_core_testdata('test_allele_depth.vcf'),
+        use_index=False,
+        genotypes_only=True)
+    variant = next(iter(reader.iterate()))
+    self.assertEqual([call.genotype for call in variant.calls],
+                     [[0, 1], [0, 1]])
+    self.assertEqual([dict(call.info) for call in variant.calls], [{}, {}])
+
+  def test_variant_index_matches_query(self):
+    region = ranges.parse_literal('chr3:100,000-500,000')
+    index = genomics_io.make_variant_index(
+        test_utils.genomics_core_testdata('test_samples.vcf.gz'), [region])
+    self.assertEqual(index.size(), 4)
+    self.assertEqual(index.query(region),
+                     list(self.samples_reader.query(region)))
+
+  def test_variant_index_without_regions(self):
+    index = genomics_io.make_variant_index(
+        test_utils.genomics_core_testdata('test_sites.vcf'))
+    self.assertEqual(index.size(), 5)
+
+  def test_range_index(self):
+    index = genomics_io.make_range_index(
+        test_utils.genomics_core_testdata('test.bed'))
+    self.assertTrue(index.overlaps('chr2', 40))
+    self.assertFalse(index.overlaps('chr2', 30))
+
 
 def _format_test_variant(alleles, call_infos):
   variant = test_utils.make_variant(chrom='20', start=0, alleles=alleles)
@@ -32,6 +32,7 @@
 #include "deepvariant/core/hts_path.h"
 #include <string>
 #include "htslib/faidx.h"
+#include "htslib/hfile.h"
 #include "htslib/hts.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 
@@ -68,6 +69,11 @@ faidx_t *fai_load3_x(const char *fa, const char *fai, const char *gzi,
                    gzi ? ngzi.c_str() : nullptr, flags);
 }
 
+hFILE *hopen_x(const char *path, const char *mode) {
+  string new_path = fix_path(path);
+  return hopen(new_path.c_str(), mode);
+}
+
 }  // namespace core
 }  // namespace genomics
 }  // namespace learning
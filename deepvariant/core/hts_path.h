@@ -33,6 +33,7 @@
 #define LEARNING_GENOMICS_DEEPVARIANT_CORE_HTS_PATH_H_
 
 #include "htslib/faidx.h"
+#include "htslib/hfile.h"
 #include "htslib/hts.h"
 
 // This is a wrapper for hts_open that lets us select a default
@@ -45,6 +46,7 @@ namespace core {
 htsFile *hts_open_x(const char *fn, const char *mode);
 faidx_t *fai_load3_x(const char *fa_path, const char *fai_path,
                      const char *gzi_path, int flags);
+hFILE *hopen_x(const char *fn, const char *mode);
 
 }  // namespace core
 }  // namespace genomics
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of hts_thread_pool.h.
+#include "deepvariant/core/hts_thread_pool.h"
+
+#include "htslib/thread_pool.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace tf = tensorflow;
+
+htsThreadPool* SharedHtsThreadPool(const int num_threads) {
+  CHECK_GT(num_threads, 0) << "The thread pool needs at least one thread";
+  // Intentionally leaked, as files may use the pool until the process exits.
+  static tf::mutex* mutex = new tf::mutex;
+  static htsThreadPool* pool = nullptr;
+  static int pool_threads = 0;
+
+  tf::mutex_lock lock(*mutex);
+  if (pool == nullptr) {
+    hts_tpool* threads = hts_tpool_init(num_threads);
+    if (threads == nullptr) return nullptr;
+    pool = new htsThreadPool{threads, 0};
+    pool_threads = num_threads;
+    VLOG(1) << "Created htslib thread pool with " << num_threads << " threads";
+  } else if (num_threads != pool_threads) {
+    VLOG(1) << "Asked for " << num_threads << " htslib threads but using the "
+            << "existing pool of " << pool_threads;
+  }
+  return pool;
+}
+
+tf::Status UseSharedHtsThreadPool(htsFile* fp, const int num_threads) {
+  CHECK(fp != nullptr) << "fp cannot be null";
+  if (num_threads <= 0) return tf::Status::OK();
+  htsThreadPool* pool = SharedHtsThreadPool(num_threads);
+  if (pool == nullptr) {
+    return tf::errors::Unknown("Failed to create the htslib thread pool");
+  }
+  if (hts_set_thread_pool(fp, pool) != 0) {
+    return tf::errors::Unknown("Failed to attach the htslib thread pool");
+  }
+  return tf::Status::OK();
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A process-wide htslib thread pool for BGZF (de)compression.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_HTS_THREAD_POOL_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_HTS_THREAD_POOL_H_
+
+#include "htslib/hts.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// Gets the process-wide htslib thread pool, creating it with num_threads
+// threads if it doesn't exist yet. num_threads must be > 0.
+//
+// Every reader and writer shares this one pool rather than each spinning up
+// its own threads, so a process with many open files (e.g., one BAM handle per
+// concurrent query) doesn't oversubscribe the machine. The size of the pool is
+// set by the first call; later calls asking for a different number of threads
+// get the existing pool. The pool lives until the process exits, so it always
+// outlives the files using it.
+htsThreadPool* SharedHtsThreadPool(int num_threads);
+
+// Makes fp (de)compress its BGZF blocks on SharedHtsThreadPool(num_threads),
+// or does nothing if num_threads <= 0. Returns a non-OK status if htslib
+// couldn't create the pool or attach it to fp.
+tensorflow::Status UseSharedHtsThreadPool(htsFile* fp, int num_threads);
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_HTS_THREAD_POOL_H_
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/hts_thread_pool.h"
+
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/vendor/status_matchers.h"
+#include "htslib/hts.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+TEST(HtsThreadPoolTest, PoolIsShared) {
+  htsThreadPool* pool = SharedHtsThreadPool(2);
+  ASSERT_NE(pool, nullptr);
+  EXPECT_NE(pool->pool, nullptr);
+  EXPECT_EQ(SharedHtsThreadPool(2), pool);
+  // Asking for a different size still gets the one pool.
+  EXPECT_EQ(SharedHtsThreadPool(4), pool);
+}
+
+TEST(HtsThreadPoolTest, AttachesToFiles) {
+  htsFile* bam = hts_open(GetTestData("test.bam").c_str(), "r");
+  htsFile* vcf = hts_open(GetTestData("test_samples.vcf.gz").c_str(), "r");
+  ASSERT_NE(bam, nullptr);
+  ASSERT_NE(vcf, nullptr);
+  EXPECT_THAT(UseSharedHtsThreadPool(bam, 2), IsOK());
+  EXPECT_THAT(UseSharedHtsThreadPool(vcf, 2), IsOK());
+  EXPECT_EQ(hts_close(bam), 0);
+  EXPECT_EQ(hts_close(vcf), 0);
+}
+
+TEST(HtsThreadPoolTest, NoThreadsIsANoOp) {
+  htsFile* bam = hts_open(GetTestData("test.bam").c_str(), "r");
+  ASSERT_NE(bam, nullptr);
+  EXPECT_THAT(UseSharedHtsThreadPool(bam, 0), IsOK());
+  EXPECT_EQ(hts_close(bam), 0);
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -162,7 +162,7 @@ def IsShardedFileSpec(spec):  # pylint:disable=invalid-name
   return m is not None
 
 
-VCF_EXTENSIONS = frozenset(['.vcf', '.vcf.gz'])
+VCF_EXTENSIONS = frozenset(['.vcf', '.vcf.gz', '.bcf'])
 
 
 # redacted
@@ -270,21 +270,37 @@ def maybe_generate_sharded_filenames(filespec):
 class OutputsWriter(object):
   """Manages all of the outputs of make_examples in a single place."""
 
-  def __init__(self, options):
+  def __init__(self, options, examples_writer=None):
+    """Creates the writers for all of the outputs requested in options.
+
+    Args:
+      options: A DeepVariantOptions proto.
+      examples_writer: An optional writer with a write(proto) method to use
+        for the examples instead of a TFRecord writer on
+        options.examples_filename.
+    """
     self._writers = {}
     if options.candidates_filename:
       logging.info('Writing candidates to %s', options.candidates_filename)
-      self._add_writer('candidates',
-                       make_tfrecord_writer(options.candidates_filename))
-    if options.examples_filename:
+      self._add_tfrecord_writer('candidates', options.candidates_filename)
+    if examples_writer is not None:
+      self._add_writer('examples', examples_writer)
+    elif options.examples_filename:
       logging.info('Writing examples to %s', options.examples_filename)
-      self._add_writer('examples',
-                       make_tfrecord_writer(options.examples_filename))
+      self._add_tfrecord_writer('examples', options.examples_filename)
     if options.gvcf_filename:
       logging.info('Writing a gvcf to %s', options.gvcf_filename)
       # redacted
       # we can write out a VCF or a TFRecords as requested.
-      self._add_writer('gvcfs', make_tfrecord_writer(options.gvcf_filename))
+      self._add_tfrecord_writer('gvcfs', options.gvcf_filename)
+    if options.runtime_metrics_filename:
+      logging.info('Writing runtime metrics to %s',
+                   options.runtime_metrics_filename)
+      self._add_tfrecord_writer('runtime_metrics',
+                                options.runtime_metrics_filename)
+
+  def _add_tfrecord_writer(self, name, path):
+    self._add_writer(name, RawProtoWriterAdaptor(make_tfrecord_writer(path)))
 
   def _add_writer(self, name, writer):
     self._writers[name] = writer
@@ -303,7 +319,14 @@ class OutputsWriter(object):
     writer = self._writers.get(writer_name, None)
     if writer:
       for proto in protos:
-        writer.write(proto.SerializeToString())
+        writer.write(proto)
+
+  def write_serialized(self, writer_name, *records):
+    """Writes already serialized records to a TFRecord writer."""
+    writer = self._writers.get(writer_name, None)
+    if writer:
+      for record in records:
+        writer.raw_writer.write(record)
 
 
 class AsyncWriter(object):
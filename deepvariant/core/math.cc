@@ -98,6 +98,39 @@ std::vector<double> ZeroShiftLikelihoods(
   return normalized;
 }
 
+// Note that the k = 0 and k = n cases are handled separately so that p = 0 and
+// p = 1 don't evaluate 0 * log(0).
+double Log10Binomial(const int k, const int n, const double p) {
+  CHECK_GE(k, 0);
+  CHECK_LE(k, n);
+  CHECK_GE(p, 0.0);
+  CHECK_LE(p, 1.0);
+  double log_density =
+      std::lgamma(n + 1.0) - std::lgamma(k + 1.0) - std::lgamma(n - k + 1.0);
+  if (k > 0) log_density += k * std::log(p);
+  if (n > k) log_density += (n - k) * std::log1p(-p);
+  return log_density / std::log(10.0);
+}
+
+std::vector<double> Log10Normalize(const std::vector<double>& log10_probs) {
+  // Computes log10(sum(10^log10_probs)) in natural log space relative to the
+  // largest value, so none of the terms overflows or all of them underflow.
+  const double max =
+      *std::max_element(log10_probs.cbegin(), log10_probs.cend());
+  CHECK_LE(max, 0.0) << "log10_probs must all be <= 0";
+  const double ln10 = std::log(10.0);
+  double sum = 0.0;
+  for (const double log10_prob : log10_probs) {
+    sum += std::exp(log10_prob * ln10 - max * ln10);
+  }
+  const double log10_sum = std::log10(M_E) * (std::log(sum) + max * ln10);
+  std::vector<double> normalized(log10_probs.size());
+  std::transform(
+      log10_probs.cbegin(), log10_probs.cend(), normalized.begin(),
+      [log10_sum](double x) { return std::min(x - log10_sum, 0.0); });
+  return normalized;
+}
+
 }  // namespace core
 }  // namespace genomics
 }  // namespace learning
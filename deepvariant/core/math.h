@@ -120,6 +120,16 @@ double Log10ToReal(double log10_probability);
 std::vector<double> ZeroShiftLikelihoods(
     const std::vector<double>& likelihoods);
 
+// Returns the log10 of the binomial density of k successes in n trials, each
+// succeeding with probability p. k must be >= 0 and <= n, and p in [0, 1].
+// This is the log10 equivalent of the R function dbinom(k, n, p).
+double Log10Binomial(int k, int n, double p);
+
+// Normalizes the log10 probabilities log10_probs, so that the sum of their real
+// space values is ~1 while their ratios are unchanged. All of log10_probs must
+// be <= 0. Results are capped at 0 to absorb rounding errors.
+std::vector<double> Log10Normalize(const std::vector<double>& log10_probs);
+
 }  // namespace core
 }  // namespace genomics
 }  // namespace learning
@@ -31,6 +31,8 @@
 
 #include "deepvariant/core/math.h"
 
+#include <cmath>
+
 #include <gmock/gmock-generated-matchers.h>
 #include <gmock/gmock-matchers.h>
 #include <gmock/gmock-more-matchers.h>
@@ -163,6 +165,30 @@ TEST(ZeroShiftLikelihoods, HandlesValidInputs) {
               ElementsAreArray({0.0, -97.7, -85.0}));
 }
 
+TEST(Log10Binomial, HandlesValidInputs) {
+  EXPECT_THAT(Log10Binomial(0, 0, 0.5), DoubleEq(0.0));
+  EXPECT_THAT(Log10Binomial(1, 2, 0.5), DoubleNear(std::log10(0.5), 1e-12));
+  EXPECT_THAT(Log10Binomial(2, 3, 0.1),
+              DoubleNear(std::log10(3 * 0.1 * 0.1 * 0.9), 1e-12));
+  // dbinom(5, 100, 0.01, log=TRUE) / log(10) in R.
+  EXPECT_THAT(Log10Binomial(5, 100, 0.01), DoubleNear(-2.537934, 1e-6));
+}
+
+TEST(Log10Binomial, HandlesExtremeProbabilities) {
+  EXPECT_THAT(Log10Binomial(0, 10, 0.0), DoubleEq(0.0));
+  EXPECT_THAT(Log10Binomial(10, 10, 1.0), DoubleEq(0.0));
+}
+
+TEST(Log10Normalize, HandlesValidInputs) {
+  const double third = -std::log10(3.0);
+  EXPECT_THAT(Log10Normalize({-1.0, -1.0, -1.0}),
+              ElementsAreArray({DoubleNear(third, 1e-12),
+                                DoubleNear(third, 1e-12),
+                                DoubleNear(third, 1e-12)}));
+  EXPECT_THAT(Log10Normalize({0.0, -1000.0}),
+              ElementsAreArray({DoubleEq(0.0), DoubleEq(-1000.0)}));
+}
+
 }  // namespace core
 }  // namespace genomics
 }  // namespace learning
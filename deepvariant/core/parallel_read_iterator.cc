@@ -0,0 +1,154 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of parallel_read_iterator.h.
+#include "deepvariant/core/parallel_read_iterator.h"
+
+#include <memory>
+#include <utility>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace tf = tensorflow;
+
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+
+ParallelReadIterator::ParallelReadIterator(const SamReader* reader,
+                                           const std::vector<Range>& chunks,
+                                           const int num_threads,
+                                           const bool ordered)
+    : reader_(reader),
+      chunks_(chunks),
+      ordered_(ordered),
+      max_pending_chunks_(2 * num_threads) {
+  CHECK(reader != nullptr) << "reader cannot be null";
+  CHECK_GE(num_threads, 1) << "We must read with at least one thread";
+  // Started last, once all of our state is initialized.
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&ParallelReadIterator::ReadChunks, this);
+  }
+}
+
+ParallelReadIterator::~ParallelReadIterator() {
+  {
+    tf::mutex_lock lock(mutex_);
+    cancelled_ = true;
+  }
+  cond_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ParallelReadIterator::ReadChunks() {
+  while (true) {
+    int chunk_index;
+    {
+      // Wait until the caller is close enough to the next chunk before
+      // reading it, so we never hold more than max_pending_chunks_ chunks of
+      // reads.
+      tf::mutex_lock lock(mutex_);
+      while (!cancelled_ && next_chunk_ < static_cast<int>(chunks_.size()) &&
+             next_chunk_ >= n_returned_ + max_pending_chunks_) {
+        cond_.wait(lock);
+      }
+      if (cancelled_ || next_chunk_ == static_cast<int>(chunks_.size())) {
+        return;
+      }
+      chunk_index = next_chunk_++;
+    }
+
+    Batch batch;
+    ReadChunk(chunks_[chunk_index], &batch);
+    const bool ok = batch.status.ok();
+    {
+      tf::mutex_lock lock(mutex_);
+      batches_[chunk_index] = std::move(batch);
+      // Without an ordered merge, the caller stops at the first error, so we
+      // don't read any more chunks after one.
+      if (!ok && !ordered_) cancelled_ = true;
+    }
+    cond_.notify_all();
+  }
+}
+
+void ParallelReadIterator::ReadChunk(const Range& chunk, Batch* batch) {
+  StatusOr<std::shared_ptr<SamIterable>> iterable =
+      reader_->IterateChunk(chunk);
+  if (!iterable.ok()) {
+    batch->status = iterable.status();
+    return;
+  }
+  while (true) {
+    Read read;
+    StatusOr<bool> more = iterable.ValueOrDie()->Next(&read);
+    if (!more.ok()) {
+      batch->status = more.status();
+      return;
+    }
+    if (!more.ValueOrDie()) return;
+    batch->reads.push_back(std::move(read));
+  }
+}
+
+StatusOr<bool> ParallelReadIterator::Next(std::vector<Read>* reads) {
+  CHECK(reads != nullptr) << "reads cannot be null";
+  Batch batch;
+  {
+    tf::mutex_lock lock(mutex_);
+    TF_RETURN_IF_ERROR(error_);
+    if (n_returned_ == static_cast<int>(chunks_.size())) return false;
+    auto next = batches_.end();
+    while (true) {
+      next = ordered_ ? batches_.find(n_returned_) : batches_.begin();
+      if (next != batches_.end()) break;
+      cond_.wait(lock);
+    }
+    batch = std::move(next->second);
+    batches_.erase(next);
+    ++n_returned_;
+    error_ = batch.status;
+  }
+  cond_.notify_all();
+  TF_RETURN_IF_ERROR(batch.status);
+  *reads = std::move(batch.reads);
+  return true;
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
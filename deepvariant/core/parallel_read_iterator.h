@@ -0,0 +1,138 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Reading the reads of a whole SAM/BAM file on several threads.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_PARALLEL_READ_ITERATOR_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_PARALLEL_READ_ITERATOR_H_
+
+#include <map>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/sam_reader.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// A ParallelReadIterator reads each of the chunks of a SamReader, given by
+// SamReader::Chunks(), on a pool of threads, each of which decodes its own
+// chunk with SamReader::IterateChunk(). This makes whole-file passes over an
+// indexed BAM, like computing statistics or making training data, use as many
+// cores as we give it, while SamReader::Iterate() decodes every record on a
+// single thread.
+//
+// If ordered, Next() gives the reads of the chunks in order, so all of the
+// reads come in the order of Iterate(). Otherwise the reads of each chunk are
+// given as soon as it has been read, which keeps every thread busy even when
+// some chunks are slower than others. Either way the threads stay at most
+// 2 * num_threads chunks ahead of the caller, which bounds the memory used to
+// that many chunks of reads.
+//
+// Usage:
+//
+//   ParallelReadIterator iterator(
+//       reader.get(), reader->Chunks(100000).ValueOrDie(), 4, true);
+//   std::vector<Read> reads;
+//   while (iterator.Next(&reads).ValueOrDie()) {
+//     ... process the reads of the next chunk ...
+//   }
+//
+// The reader must outlive the iterator.
+class ParallelReadIterator {
+ public:
+  // Starts reading the reads of each of chunks from reader on num_threads
+  // threads. num_threads must be >= 1.
+  ParallelReadIterator(const SamReader* reader,
+                       const std::vector<learning::genomics::v1::Range>& chunks,
+                       int num_threads, bool ordered);
+
+  // Stops reading, waiting for each thread to finish the chunk it is reading.
+  ~ParallelReadIterator();
+
+  // Disable assignment/copy operations.
+  ParallelReadIterator(const ParallelReadIterator& other) = delete;
+  ParallelReadIterator& operator=(const ParallelReadIterator&) = delete;
+
+  // Gets the reads of the next chunk into reads, waiting for them to be read
+  // if needed. Returns false once the reads of all of the chunks have been
+  // returned, or a non-OK status if reading a chunk failed, after which no
+  // more chunks are returned.
+  StatusOr<bool> Next(std::vector<learning::genomics::v1::Read>* reads);
+
+ private:
+  // The reads of a chunk, or the error from reading them.
+  struct Batch {
+    tensorflow::Status status;
+    std::vector<learning::genomics::v1::Read> reads;
+  };
+
+  // The body of each of our threads, reading chunks until none are left.
+  void ReadChunks();
+
+  // Reads the reads of chunk into batch.
+  void ReadChunk(const learning::genomics::v1::Range& chunk, Batch* batch);
+
+  const SamReader* const reader_;
+  const std::vector<learning::genomics::v1::Range> chunks_;
+  const bool ordered_;
+  const int max_pending_chunks_;
+
+  // Guards all of our mutable state below.
+  tensorflow::mutex mutex_;
+  // Notified whenever a batch is added to or taken from batches_, or we are
+  // cancelled.
+  tensorflow::condition_variable cond_;
+  // The index of the next chunk to be read by one of our threads.
+  int next_chunk_ = 0;
+  // The batches read that haven't been returned by Next() yet, by the index of
+  // their chunk.
+  std::map<int, Batch> batches_;
+  // The number of chunks returned by Next().
+  int n_returned_ = 0;
+  // The first error returned by Next(), returned again by every later call.
+  tensorflow::Status error_;
+  // Set on destruction to stop our threads.
+  bool cancelled_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_PARALLEL_READ_ITERATOR_H_
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/parallel_read_iterator.h"
+
+#include <memory>
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/sam_reader.h"
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+#include "deepvariant/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+using ::testing::IsEmpty;
+using ::testing::Pointwise;
+using ::testing::UnorderedPointwise;
+
+constexpr char kBamTestFilename[] = "test.bam";
+
+class ParallelReadIteratorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    SamReaderOptions options;
+    options.set_index_mode(IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+    reader_ = std::move(
+        SamReader::FromFile(GetTestData(kBamTestFilename), options)
+            .ValueOrDie());
+    // The reads of test.bam span chr20:10000000-10000100, so these chunks
+    // split them into several.
+    chunks_ = {
+        MakeRange("chr20", 0, 10000020),
+        MakeRange("chr20", 10000020, 10000040),
+        MakeRange("chr20", 10000040, 10000060),
+        MakeRange("chr20", 10000060, 10000080),
+        MakeRange("chr20", 10000080, 20000000),
+    };
+    expected_ = as_vector(reader_->Query(MakeRange("chr20", 0, 20000000)));
+  }
+
+  // Returns all of the reads of iterator.
+  std::vector<Read> AllReads(ParallelReadIterator* iterator) {
+    std::vector<Read> all_reads;
+    std::vector<Read> reads;
+    while (iterator->Next(&reads).ValueOrDie()) {
+      all_reads.insert(all_reads.end(), reads.begin(), reads.end());
+    }
+    EXPECT_FALSE(iterator->Next(&reads).ValueOrDie());
+    return all_reads;
+  }
+
+  std::unique_ptr<SamReader> reader_;
+  std::vector<Range> chunks_;
+  std::vector<Read> expected_;
+};
+
+TEST_F(ParallelReadIteratorTest, OrderedReadsMatchIterate) {
+  for (const int num_threads : {1, 2, 8}) {
+    ParallelReadIterator iterator(reader_.get(),
+                                  reader_->Chunks(1).ValueOrDie(), num_threads,
+                                  true);
+    EXPECT_THAT(AllReads(&iterator),
+                Pointwise(EqualsProto(), as_vector(reader_->Iterate())));
+  }
+}
+
+TEST_F(ParallelReadIteratorTest, OrderedChunksKeepTheirOrder) {
+  for (const int num_threads : {1, 2, 8}) {
+    ParallelReadIterator iterator(reader_.get(), chunks_, num_threads, true);
+    EXPECT_THAT(AllReads(&iterator), Pointwise(EqualsProto(), expected_));
+  }
+}
+
+TEST_F(ParallelReadIteratorTest, UnorderedChunksHaveTheSameReads) {
+  for (const int num_threads : {1, 2, 8}) {
+    ParallelReadIterator iterator(reader_.get(), chunks_, num_threads, false);
+    EXPECT_THAT(AllReads(&iterator),
+                UnorderedPointwise(EqualsProto(), expected_));
+  }
+}
+
+TEST_F(ParallelReadIteratorTest, NoChunks) {
+  ParallelReadIterator iterator(reader_.get(), {}, 2, true);
+  std::vector<Read> reads;
+  EXPECT_FALSE(iterator.Next(&reads).ValueOrDie());
+  EXPECT_THAT(reads, IsEmpty());
+}
+
+TEST_F(ParallelReadIteratorTest, StoppingEarlyDoesNotBlock) {
+  // Destroying the iterator while its threads are waiting for the caller must
+  // not deadlock, whether or not we ever called Next.
+  {
+    ParallelReadIterator iterator(reader_.get(), chunks_, 1, true);
+  }
+  {
+    ParallelReadIterator iterator(reader_.get(), chunks_, 1, false);
+    std::vector<Read> reads;
+    ASSERT_TRUE(iterator.Next(&reads).ValueOrDie());
+  }
+}
+
+TEST_F(ParallelReadIteratorTest, BadChunksAreAnError) {
+  for (const bool ordered : {true, false}) {
+    ParallelReadIterator iterator(
+        reader_.get(), {chunks_[1], MakeRange("unknown", 0, 100), chunks_[2]},
+        2, ordered);
+    std::vector<Read> reads;
+    StatusOr<bool> more = iterator.Next(&reads);
+    while (more.ok() && more.ValueOrDie()) {
+      more = iterator.Next(&reads);
+    }
+    EXPECT_FALSE(more.ok());
+    // The error is sticky, so we don't silently skip over the bad chunk.
+    EXPECT_FALSE(iterator.Next(&reads).ok());
+  }
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,68 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Tests for range_index CLIF python wrappers."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+
+
+from absl.testing import absltest
+
+from deepvariant.core import ranges
+from deepvariant.core import test_utils
+from deepvariant.core.python import range_index
+
+
+class WrapRangeIndexTests(absltest.TestCase):
+
+  def test_from_bed(self):
+    index = range_index.RangeIndex.from_bed(
+        test_utils.genomics_core_testdata('test.bed'))
+    self.assertEqual(index.size(), 49)
+    self.assertTrue(index.overlaps('chr2', 40))
+    self.assertFalse(index.overlaps('chr2', 30))
+    self.assertTrue(index.contains(ranges.make_range('chr3', 80, 90)))
+    self.assertFalse(index.contains(ranges.make_range('chr3', 80, 91)))
+
+  def test_from_ranges(self):
+    index = range_index.RangeIndex(
+        [ranges.make_range('chr1', 1, 10),
+         ranges.make_range('chr1', 5, 20)])
+    self.assertEqual(index.size(), 19)
+    self.assertTrue(index.contains(ranges.make_range('chr1', 1, 20)))
+
+  def test_from_bed_raises_with_missing_source(self):
+    with self.assertRaisesRegexp(ValueError, 'Not found'):
+      range_index.RangeIndex.from_bed('missing.bed')
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -39,7 +39,9 @@ from absl.testing import parameterized
 
 from deepvariant.core import ranges
 from deepvariant.core import test_utils
+from deepvariant.core.python import reference_2bit
 from deepvariant.core.python import reference_fai
+from deepvariant.core.python import region_reference
 
 
 class WrapReferenceTest(parameterized.TestCase):
@@ -70,6 +72,43 @@ class WrapReferenceTest(parameterized.TestCase):
         self.assertTrue(ref.has_contig(contig.name))
         self.assertFalse(ref.has_contig(contig.name + '.unknown'))
 
+  def test_wrap_2bit(self):
+    fasta = test_utils.genomics_core_testdata('test.fasta')
+    path = test_utils.test_tmpfile('test.2bit')
+    with reference_fai.GenomeReferenceFai.from_file(fasta,
+                                                    fasta + '.fai') as fai:
+      reference_2bit.GenomeReference2Bit.write_file(fai, path)
+      with reference_2bit.GenomeReference2Bit.from_file(path) as ref:
+        self.assertEqual(ref.fasta_path, path)
+        self.assertIn('2bit', str(ref))
+        self.assertEqual(ref.contigs, fai.contigs)
+        for contig in fai.contigs:
+          region = ranges.make_range(contig.name, 0, contig.n_bases)
+          self.assertEqual(ref.bases(region), fai.bases(region))
+
+  def test_wrap_region_reference(self):
+    fasta = test_utils.genomics_core_testdata('test.fasta')
+    with reference_fai.GenomeReferenceFai.from_file(fasta,
+                                                    fasta + '.fai') as fai:
+      ref = region_reference.RegionReference(fai, 5)
+      self.assertEqual(ref.contigs, fai.contigs)
+      ref.set_region(ranges.make_range('chr1', 2, 20))
+      self.assertEqual(ref.cached_range, ranges.make_range('chr1', 0, 25))
+      self.assertTrue(ref.contains(ranges.make_range('chr1', 10, 15)))
+      self.assertFalse(ref.contains(ranges.make_range('chr2', 10, 15)))
+      for region in [
+          ranges.make_range('chr1', 10, 15),
+          ranges.make_range('chr1', 20, 30),
+          ranges.make_range('chr2', 10, 15)
+      ]:
+        self.assertEqual(ref.bases(region), fai.bases(region))
+      with self.assertRaisesRegexp(ValueError, 'Invalid interval'):
+        ref.set_region(ranges.make_range('chr1', 70, 80))
+
+  def test_2bit_from_file_raises_with_missing_file(self):
+    with self.assertRaisesRegexp(ValueError, 'Not found: Could not open'):
+      reference_2bit.GenomeReference2Bit.from_file('missing.2bit')
+
   @parameterized.parameters(
       # The fasta and the FAI are both missing.
       ('missing.fasta', 'missing.fasta.fai'),
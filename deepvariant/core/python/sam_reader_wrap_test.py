@@ -68,6 +68,24 @@ class SamReaderTest(absltest.TestCase):
           self.assertIsInstance(iterable, clif_postproc.WrappedCppIterable)
           self.assertEqual(test_utils.iterable_len(iterable), n_expected)
 
+  def test_bam_query_multiple(self):
+    reader = sam_reader.SamReader.from_file(self.bam, self.indexed_options)
+    regions = [
+        ranges.parse_literal('chr20:10,000,000-10,000,000'),
+        ranges.parse_literal('chr20:10,000,001-10,000,100'),
+        ranges.parse_literal('chr20:20,000,000-20,000,100'),
+    ]
+    with reader:
+      with reader.query_multiple(regions) as iterable:
+        self.assertIsInstance(iterable, clif_postproc.WrappedCppIterable)
+        reads_per_region = list(iterable)
+      self.assertEqual(len(reads_per_region), len(regions))
+      for region, reads in zip(regions, reads_per_region):
+        with reader.query(region) as query_iterable:
+          self.assertEqual(reads, list(query_iterable))
+      self.assertLen(reads_per_region[0], 45)
+      self.assertEqual(reads_per_region[2], [])
+
   def test_bam_samples(self):
     reader = sam_reader.SamReader.from_file(self.bam, self.options)
     with reader:
@@ -151,6 +169,15 @@ class SamReaderTest(absltest.TestCase):
       with self.assertRaisesRegexp(ValueError, 'unknown reference interval'):
         reader.query(ranges.parse_literal('chr20:10-5'))
 
+  def test_query_multiple_raises_with_unsorted_ranges(self):
+    with sam_reader.SamReader.from_file(self.bam,
+                                        self.indexed_options) as reader:
+      with self.assertRaisesRegexp(ValueError, 'must be sorted'):
+        reader.query_multiple([
+            ranges.parse_literal('chr20:10,000,050-10,000,100'),
+            ranges.parse_literal('chr20:10,000,000-10,000,049'),
+        ])
+
   def test_sam_iterate_raises_on_malformed_record(self):
     malformed = test_utils.genomics_core_testdata('malformed.sam')
     reader = sam_reader.SamReader.from_file(malformed, self.options)
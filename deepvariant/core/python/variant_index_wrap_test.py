@@ -0,0 +1,68 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Tests for variant_index CLIF python wrappers."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+
+
+from absl.testing import absltest
+
+from deepvariant.core import ranges
+from deepvariant.core import test_utils
+from deepvariant.core.protos import core_pb2
+from deepvariant.core.python import variant_index
+from deepvariant.core.python import vcf_reader
+
+
+class WrapVariantIndexTests(absltest.TestCase):
+
+  def setUp(self):
+    self.options = core_pb2.VcfReaderOptions(
+        index_mode=core_pb2.INDEX_BASED_ON_FILENAME)
+    self.samples_vcf = test_utils.genomics_core_testdata('test_samples.vcf.gz')
+
+  def test_query_matches_reader(self):
+    region = ranges.parse_literal('chr3:100,000-500,000')
+    index = variant_index.VariantIndex.from_file(self.samples_vcf,
+                                                 self.options, [region])
+    reader = vcf_reader.VcfReader.from_file(self.samples_vcf, self.options)
+    self.assertEqual(index.size(), 4)
+    self.assertEqual(index.query(region), list(reader.query(region)))
+
+  def test_from_file_raises_with_missing_source(self):
+    with self.assertRaisesRegexp(ValueError,
+                                 'Not found: Could not open missing.vcf'):
+      variant_index.VariantIndex.from_file('missing.vcf', self.options, [])
+
+
+if __name__ == '__main__':
+  absltest.main()
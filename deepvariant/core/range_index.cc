@@ -0,0 +1,140 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of range_index.h
+#include "deepvariant/core/range_index.h"
+
+#include <algorithm>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/inputbuffer.h"
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace tf = tensorflow;
+
+using learning::genomics::v1::Range;
+using tensorflow::int64;
+using tensorflow::string;
+using tensorflow::strings::StrCat;
+
+namespace {
+
+// The size of the buffer used to read BED files.
+constexpr size_t kBedBufferSize = 1 << 20;
+
+}  // namespace
+
+RangeIndex::RangeIndex(const std::vector<Range>& ranges) {
+  for (const Range& range : ranges) {
+    intervals_[range.reference_name()].push_back({range.start(), range.end()});
+  }
+  // Merge overlapping and adjacent intervals of each contig.
+  for (auto& contig_intervals : intervals_) {
+    std::vector<Interval>& intervals = contig_intervals.second;
+    std::sort(intervals.begin(), intervals.end(),
+              [](const Interval& a, const Interval& b) {
+                return a.start < b.start;
+              });
+    size_t n_merged = 0;
+    for (const Interval& interval : intervals) {
+      if (n_merged > 0 && interval.start <= intervals[n_merged - 1].end) {
+        intervals[n_merged - 1].end =
+            std::max(intervals[n_merged - 1].end, interval.end);
+      } else {
+        intervals[n_merged++] = interval;
+      }
+    }
+    intervals.resize(n_merged);
+    intervals.shrink_to_fit();
+    size_ += n_merged;
+  }
+}
+
+StatusOr<std::unique_ptr<RangeIndex>> RangeIndex::FromBed(
+    const string& bed_path) {
+  std::unique_ptr<tf::RandomAccessFile> file;
+  TF_RETURN_IF_ERROR(tf::Env::Default()->NewRandomAccessFile(bed_path, &file));
+  tf::io::InputBuffer input(file.get(), kBedBufferSize);
+  std::vector<Range> ranges;
+  string line;
+  while (true) {
+    const tf::Status status = input.ReadLine(&line);
+    if (tf::errors::IsOutOfRange(status)) break;
+    TF_RETURN_IF_ERROR(status);
+    const std::vector<string> parts = tf::str_util::Split(line, '\t');
+    int64 start, end;
+    if (parts.size() < 3 || !tf::strings::safe_strto64(parts[1], &start) ||
+        !tf::strings::safe_strto64(parts[2], &end))
+      return tf::errors::DataLoss(
+          StrCat("Malformed BED line in ", bed_path, ": ", line));
+    Range range;
+    range.set_reference_name(parts[0]);
+    range.set_start(start);
+    range.set_end(end);
+    ranges.push_back(std::move(range));
+  }
+  return std::unique_ptr<RangeIndex>(new RangeIndex(ranges));
+}
+
+const RangeIndex::Interval* RangeIndex::Find(const string& chrom,
+                                             int64 pos) const {
+  const auto found = intervals_.find(chrom);
+  if (found == intervals_.end()) return nullptr;
+  const std::vector<Interval>& intervals = found->second;
+  // The first interval starting after pos follows the only one that could
+  // contain it.
+  auto after = std::upper_bound(
+      intervals.begin(), intervals.end(), pos,
+      [](int64 pos, const Interval& interval) { return pos < interval.start; });
+  if (after == intervals.begin()) return nullptr;
+  const Interval& interval = *(after - 1);
+  return pos < interval.end ? &interval : nullptr;
+}
+
+bool RangeIndex::Overlaps(const string& chrom, int64 pos) const {
+  return Find(chrom, pos) != nullptr;
+}
+
+bool RangeIndex::Contains(const Range& range) const {
+  const Interval* interval = Find(range.reference_name(), range.start());
+  return interval != nullptr && range.end() <= interval->end;
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// In-memory sets of genomic ranges, for fast point and range queries.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_RANGE_INDEX_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_RANGE_INDEX_H_
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// An immutable set of ranges on the genome, such as the confident regions of
+// a truth set.
+//
+// The ranges are merged into sorted, disjoint intervals on each contig, so
+// Overlaps() and Contains() take O(log n) time for n intervals on the contig.
+// A RangeIndex is safe to query from many threads at once.
+class RangeIndex {
+ public:
+  // Creates a RangeIndex of ranges, which may overlap and be in any order.
+  explicit RangeIndex(
+      const std::vector<learning::genomics::v1::Range>& ranges);
+
+  // Creates a RangeIndex of the intervals in the BED file at bed_path, read as
+  // ranges.bed_parser() reads them: the first three tab-separated columns of
+  // each line are the chromosome, start and end of an interval.
+  static StatusOr<std::unique_ptr<RangeIndex>> FromBed(
+      const tensorflow::string& bed_path);
+
+  // Returns true if position pos (0-based) of chrom is in one of our ranges.
+  bool Overlaps(const tensorflow::string& chrom, tensorflow::int64 pos) const;
+
+  // Returns true if all of range is within one of our ranges.
+  bool Contains(const learning::genomics::v1::Range& range) const;
+
+  // Returns the number of disjoint intervals our ranges were merged into.
+  tensorflow::int64 size() const { return size_; }
+
+ private:
+  struct Interval {
+    tensorflow::int64 start;
+    tensorflow::int64 end;
+  };
+
+  // Returns the interval of chrom containing pos, or nullptr if there isn't
+  // one.
+  const Interval* Find(const tensorflow::string& chrom,
+                       tensorflow::int64 pos) const;
+
+  // The merged intervals of each contig, sorted by start.
+  std::unordered_map<tensorflow::string, std::vector<Interval>> intervals_;
+  tensorflow::int64 size_ = 0;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_RANGE_INDEX_H_
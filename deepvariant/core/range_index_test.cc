@@ -0,0 +1,92 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/range_index.h"
+
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+TEST(RangeIndexTest, MergesOverlappingRanges) {
+  RangeIndex index({MakeRange("chr1", 20, 30), MakeRange("chr1", 1, 10),
+                    MakeRange("chr1", 5, 12), MakeRange("chr1", 12, 15),
+                    MakeRange("chr2", 1, 10)});
+  // chr1:1-15, chr1:20-30 and chr2:1-10.
+  EXPECT_EQ(14 + 10 + 9, index.size());
+
+  EXPECT_FALSE(index.Overlaps("chr1", 0));
+  EXPECT_TRUE(index.Overlaps("chr1", 1));
+  EXPECT_TRUE(index.Overlaps("chr1", 14));
+  EXPECT_FALSE(index.Overlaps("chr1", 15));
+  EXPECT_TRUE(index.Overlaps("chr1", 29));
+  EXPECT_FALSE(index.Overlaps("chr1", 30));
+  EXPECT_FALSE(index.Overlaps("chr3", 5));
+
+  EXPECT_TRUE(index.Contains(MakeRange("chr1", 2, 15)));
+  EXPECT_FALSE(index.Contains(MakeRange("chr1", 2, 16)));
+  EXPECT_FALSE(index.Contains(MakeRange("chr1", 10, 25)));
+  EXPECT_TRUE(index.Contains(MakeRange("chr2", 1, 10)));
+  EXPECT_FALSE(index.Contains(MakeRange("chr3", 1, 2)));
+}
+
+TEST(RangeIndexTest, EmptyIndexOverlapsNothing) {
+  const std::vector<learning::genomics::v1::Range> no_ranges;
+  RangeIndex index(no_ranges);
+  EXPECT_EQ(0, index.size());
+  EXPECT_FALSE(index.Overlaps("chr1", 0));
+  EXPECT_FALSE(index.Contains(MakeRange("chr1", 0, 1)));
+}
+
+TEST(RangeIndexTest, ReadsBed) {
+  auto index = std::move(
+      RangeIndex::FromBed(GetTestData("test.bed")).ValueOrDie());
+  EXPECT_EQ(9 + 10 + 20 + 10, index->size());
+  EXPECT_TRUE(index->Overlaps("chr1", 1));
+  EXPECT_FALSE(index->Overlaps("chr1", 10));
+  EXPECT_TRUE(index->Overlaps("chr2", 59));
+  EXPECT_FALSE(index->Overlaps("chr2", 30));
+  EXPECT_TRUE(index->Contains(MakeRange("chr3", 80, 90)));
+}
+
+TEST(RangeIndexTest, RejectsMalformedBed) {
+  EXPECT_FALSE(RangeIndex::FromBed(GetTestData("malformed.vcf")).ok());
+  EXPECT_FALSE(RangeIndex::FromBed(GetTestData("missing.bed")).ok());
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
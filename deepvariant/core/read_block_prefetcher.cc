@@ -0,0 +1,378 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of read_block_prefetcher.h.
+#include "deepvariant/core/read_block_prefetcher.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "deepvariant/core/hts_path.h"
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "htslib/hts.h"
+#include "htslib/sam.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace tf = tensorflow;
+
+using learning::genomics::v1::Range;
+using tensorflow::int64;
+using tensorflow::strings::StrCat;
+
+namespace {
+
+// The largest size of a BGZF block, compressed. A virtual offset only gives
+// the start of its block, so we fetch this many bytes from it to be sure to
+// get the whole block.
+constexpr int64 kMaxBgzfBlockSize = 1 << 16;
+
+// A range [begin, end) of bytes of the BAM file holding blocks of a region.
+struct Piece {
+  int64 begin;
+  int64 end;
+  int region_index;
+};
+
+// The typical ratio of the uncompressed to the compressed size of BAM
+// records, used to estimate the compressed size of part of a block.
+constexpr int64 kBamCompressionRatio = 4;
+
+// Sets *chunks to the pairs of virtual offsets that querying region by the
+// index idx of a BAM file with header reads. Each pair spans blocks that the
+// query decompresses, from the block holding the first to the block holding
+// the second.
+tf::Status RegionChunks(bam_hdr_t* header, const hts_idx_t* idx,
+                        const Range& region,
+                        std::vector<hts_pair64_t>* chunks) {
+  const int tid = bam_name2id(header, region.reference_name().c_str());
+  if (tid < 0) {
+    return tf::errors::NotFound(
+        StrCat("Unknown reference_name ", region.ShortDebugString()));
+  }
+  hts_itr_t* iter = sam_itr_queryi(idx, tid, region.start(), region.end());
+  if (iter == nullptr) {
+    return tf::errors::NotFound(
+        StrCat("region '", region.ShortDebugString(),
+               "' specifies an unknown reference interval"));
+  }
+  chunks->assign(iter->off, iter->off + iter->n_off);
+  hts_itr_destroy(iter);
+  return tf::Status::OK();
+}
+
+// Adds to pieces the byte ranges of the header of fp and of the blocks of each
+// of regions, by the index idx of fp.
+tf::Status PiecesOfRegions(htsFile* fp, bam_hdr_t* header,
+                           const hts_idx_t* idx,
+                           const std::vector<Range>& regions,
+                           std::vector<Piece>* pieces) {
+  // The header ends in the block holding the first record, where fp now is.
+  // Every region needs it, to open the cache.
+  pieces->push_back({0, (bgzf_tell(fp->fp.bgzf) >> 16) + kMaxBgzfBlockSize,
+                     -1});
+  std::vector<hts_pair64_t> chunks;
+  for (int i = 0; i < static_cast<int>(regions.size()); ++i) {
+    TF_RETURN_IF_ERROR(RegionChunks(header, idx, regions[i], &chunks));
+    for (const hts_pair64_t& chunk : chunks) {
+      pieces->push_back({static_cast<int64>(chunk.u >> 16),
+                         static_cast<int64>(chunk.v >> 16) + kMaxBgzfBlockSize,
+                         i});
+    }
+  }
+  return tf::Status::OK();
+}
+
+// Writes the size bytes of data to fd at offset.
+tf::Status WriteAt(int fd, const char* data, int64 size, int64 offset) {
+  while (size > 0) {
+    const ssize_t n = pwrite(fd, data, size, offset);
+    if (n < 0) return tf::errors::Unknown("Failed to write to the cache");
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return tf::Status::OK();
+}
+
+}  // namespace
+
+StatusOr<std::vector<int64>> EstimateRegionReadBytes(
+    const string& reads_path, const std::vector<Range>& regions) {
+  htsFile* fp = hts_open_x(reads_path.c_str(), "r");
+  if (fp == nullptr) {
+    return tf::errors::NotFound(StrCat("Could not open ", reads_path));
+  }
+  if (fp->format.format != bam) {
+    hts_close(fp);
+    return tf::errors::InvalidArgument(
+        StrCat("Only the reads of BAM files can be estimated, but ",
+               reads_path, " isn't one"));
+  }
+  bam_hdr_t* header = sam_hdr_read(fp);
+  if (header == nullptr) {
+    hts_close(fp);
+    return tf::errors::Unknown(StrCat("Couldn't parse header for ", fp->fn));
+  }
+  hts_idx_t* idx = sam_index_load(fp, reads_path.c_str());
+  std::vector<int64> region_bytes;
+  tf::Status status;
+  if (idx == nullptr) {
+    status = tf::errors::NotFound(StrCat("No index found for ", reads_path));
+  } else {
+    std::vector<hts_pair64_t> chunks;
+    for (const Range& region : regions) {
+      status = RegionChunks(header, idx, region, &chunks);
+      if (!status.ok()) break;
+      // The block offsets of a chunk give its compressed size in whole
+      // blocks, which we refine by the compressed size of the uncompressed
+      // offsets within the first and last blocks.
+      int64 bytes = 0;
+      for (const hts_pair64_t& chunk : chunks) {
+        const int64 block_bytes = static_cast<int64>(chunk.v >> 16) -
+                                  static_cast<int64>(chunk.u >> 16);
+        const int64 within_block_bytes =
+            static_cast<int64>(chunk.v & 0xffff) -
+            static_cast<int64>(chunk.u & 0xffff);
+        bytes += std::max<int64>(
+            0, block_bytes + within_block_bytes / kBamCompressionRatio);
+      }
+      region_bytes.push_back(bytes);
+    }
+    hts_idx_destroy(idx);
+  }
+  bam_hdr_destroy(header);
+  hts_close(fp);
+  TF_RETURN_IF_ERROR(status);
+  return region_bytes;
+}
+
+StatusOr<std::unique_ptr<ReadBlockPrefetcher>> ReadBlockPrefetcher::Create(
+    const string& reads_path, const std::vector<Range>& regions,
+    const string& cache_path, const int num_threads,
+    const int64 max_request_bytes) {
+  CHECK_GE(num_threads, 1) << "We must fetch with at least one thread";
+  if (max_request_bytes <= 0) {
+    return tf::errors::InvalidArgument(
+        StrCat("max_request_bytes must be > 0 but got ", max_request_bytes));
+  }
+
+  htsFile* fp = hts_open_x(reads_path.c_str(), "r");
+  if (fp == nullptr) {
+    return tf::errors::NotFound(StrCat("Could not open ", reads_path));
+  }
+  if (fp->format.format != bam) {
+    hts_close(fp);
+    return tf::errors::InvalidArgument(
+        StrCat("Only the blocks of BAM files can be prefetched, but ",
+               reads_path, " isn't one"));
+  }
+  bam_hdr_t* header = sam_hdr_read(fp);
+  if (header == nullptr) {
+    hts_close(fp);
+    return tf::errors::Unknown(StrCat("Couldn't parse header for ", fp->fn));
+  }
+  hts_idx_t* idx = sam_index_load(fp, reads_path.c_str());
+  std::vector<Piece> pieces;
+  tf::Status status;
+  if (idx == nullptr) {
+    status = tf::errors::NotFound(StrCat("No index found for ", reads_path));
+  } else if (hts_idx_save(idx, cache_path.c_str(), HTS_FMT_BAI) < 0) {
+    status = tf::errors::Unknown(
+        StrCat("Couldn't write the index of ", reads_path, " to ", cache_path));
+  } else {
+    status = PiecesOfRegions(fp, header, idx, regions, &pieces);
+  }
+  if (idx != nullptr) hts_idx_destroy(idx);
+  bam_hdr_destroy(header);
+  hts_close(fp);
+  TF_RETURN_IF_ERROR(status);
+
+  // Merge the pieces into requests in the order of the file. Pieces less than
+  // a block apart share a request, as the bytes between them cost less to
+  // fetch than another round trip.
+  std::sort(pieces.begin(), pieces.end(),
+            [](const Piece& a, const Piece& b) { return a.begin < b.begin; });
+  std::vector<ByteRange> requests;
+  std::vector<std::vector<int>> region_requests(regions.size());
+  for (const Piece& piece : pieces) {
+    if (!requests.empty() &&
+        piece.begin <= requests.back().end + kMaxBgzfBlockSize &&
+        std::max(requests.back().end, piece.end) - requests.back().begin <=
+            max_request_bytes) {
+      requests.back().end = std::max(requests.back().end, piece.end);
+    } else {
+      requests.push_back({piece.begin, piece.end});
+    }
+    const int request_index = requests.size() - 1;
+    if (piece.region_index < 0) {
+      for (std::vector<int>& region_request : region_requests) {
+        region_request.push_back(request_index);
+      }
+    } else {
+      std::vector<int>& region_request = region_requests[piece.region_index];
+      if (region_request.empty() || region_request.back() != request_index) {
+        region_request.push_back(request_index);
+      }
+    }
+  }
+
+  const int cache_fd =
+      open(cache_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (cache_fd < 0) {
+    return tf::errors::Unknown(StrCat("Could not create ", cache_path));
+  }
+  VLOG(1) << "Prefetching the blocks of " << regions.size() << " regions of "
+          << reads_path << " in " << requests.size() << " requests";
+  return std::unique_ptr<ReadBlockPrefetcher>(new ReadBlockPrefetcher(
+      reads_path, cache_path, cache_fd, std::move(requests),
+      std::move(region_requests), num_threads));
+}
+
+ReadBlockPrefetcher::ReadBlockPrefetcher(
+    const string& reads_path, const string& cache_path, const int cache_fd,
+    std::vector<ByteRange> requests,
+    std::vector<std::vector<int>> region_requests, const int num_threads)
+    : reads_path_(reads_path),
+      cache_path_(cache_path),
+      cache_fd_(cache_fd),
+      requests_(std::move(requests)),
+      region_requests_(std::move(region_requests)),
+      fetched_(requests_.size(), false) {
+  // Started last, once all of our state is initialized.
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&ReadBlockPrefetcher::FetchRequests, this);
+  }
+}
+
+ReadBlockPrefetcher::~ReadBlockPrefetcher() {
+  {
+    tf::mutex_lock lock(mutex_);
+    cancelled_ = true;
+  }
+  cond_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+  close(cache_fd_);
+}
+
+void ReadBlockPrefetcher::FetchRequests() {
+  // Each thread reads the BAM file with its own handle, opened on its first
+  // request.
+  hFILE* file = nullptr;
+  std::vector<char> buffer;
+  while (true) {
+    int request_index;
+    {
+      tf::mutex_lock lock(mutex_);
+      if (cancelled_ || !error_.ok() ||
+          next_request_ == static_cast<int>(requests_.size())) {
+        break;
+      }
+      request_index = next_request_++;
+    }
+
+    const ByteRange& request = requests_[request_index];
+    tf::Status status;
+    if (file == nullptr) file = hopen_x(reads_path_.c_str(), "r");
+    if (file == nullptr) {
+      status = tf::errors::NotFound(StrCat("Could not open ", reads_path_));
+    } else if (hseek(file, request.begin, SEEK_SET) < 0) {
+      status = tf::errors::DataLoss(
+          StrCat("Could not seek to ", request.begin, " in ", reads_path_));
+    } else {
+      // The last request may run past the end of the file, where we stop.
+      buffer.resize(request.end - request.begin);
+      int64 size = 0;
+      while (size < static_cast<int64>(buffer.size())) {
+        const ssize_t n =
+            hread(file, buffer.data() + size, buffer.size() - size);
+        if (n < 0) {
+          status = tf::errors::DataLoss(
+              StrCat("Failed to read ", reads_path_, " at ", request.begin));
+          break;
+        }
+        if (n == 0) break;
+        size += n;
+      }
+      if (status.ok()) {
+        status = WriteAt(cache_fd_, buffer.data(), size, request.begin);
+      }
+    }
+
+    {
+      tf::mutex_lock lock(mutex_);
+      if (status.ok()) {
+        fetched_[request_index] = true;
+      } else if (error_.ok()) {
+        error_ = status;
+      }
+    }
+    cond_.notify_all();
+  }
+  if (file != nullptr) hclose(file);
+}
+
+tf::Status ReadBlockPrefetcher::WaitForRegion(const int region_index) {
+  CHECK_GE(region_index, 0) << "region_index must be >= 0";
+  CHECK_LT(region_index, static_cast<int>(region_requests_.size()))
+      << "region_index must be < the number of regions";
+  tf::mutex_lock lock(mutex_);
+  for (const int request_index : region_requests_[region_index]) {
+    while (error_.ok() && !fetched_[request_index]) {
+      cond_.wait(lock);
+    }
+    TF_RETURN_IF_ERROR(error_);
+  }
+  return tf::Status::OK();
+}
+
+int64 ReadBlockPrefetcher::NumBytesToFetch() const {
+  int64 n_bytes = 0;
+  for (const ByteRange& request : requests_) {
+    n_bytes += request.end - request.begin;
+  }
+  return n_bytes;
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
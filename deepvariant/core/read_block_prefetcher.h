@@ -0,0 +1,169 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Fetching the BGZF blocks of the regions of a BAM file into a local cache.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_BLOCK_PREFETCHER_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_BLOCK_PREFETCHER_H_
+
+#include <memory>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using tensorflow::string;
+
+// A ReadBlockPrefetcher copies the parts of a BAM file that the queries of a
+// series of regions will read into a local cache file, fetching them in a few
+// large requests on several threads. Querying a remote BAM, on GCS say, issues
+// small reads of the BGZF blocks of each region in turn, so the latency of
+// each request dominates the time spent reading.
+//
+// The index of the BAM gives, for each region, the byte ranges of the BGZF
+// blocks that Query(region) decompresses. Nearby ranges are merged into
+// requests of up to max_request_bytes, which num_threads threads fetch in
+// order into the same offsets of the cache file, along with the header. The
+// index is saved next to the cache, so the cache is a BAM file with holes in
+// it that SamReader opens and queries like any other local BAM, as long as it
+// only queries the regions given here, and only once they have been fetched.
+// The cache is read without decompression threads, which would read ahead
+// into its holes.
+//
+// Usage:
+//
+//   auto prefetcher = ReadBlockPrefetcher::Create(
+//       "gs://bucket/reads.bam", regions, "/tmp/reads.bam", 8, 64 << 20)
+//       .ValueOrDie();
+//   auto reader = SamReader::FromFile(prefetcher->cache_path(), options)
+//       .ValueOrDie();
+//   for (int i = 0; i < regions.size(); ++i) {
+//     TF_CHECK_OK(prefetcher->WaitForRegion(i));
+//     ... query regions[i] from reader ...
+//   }
+//
+// The cache file is left in place for the caller to delete.
+class ReadBlockPrefetcher {
+ public:
+  // Starts fetching the blocks of each of regions in the BAM file reads_path
+  // into cache_path, on num_threads threads, with requests of up to
+  // max_request_bytes. reads_path must have a BAI index, which is written to
+  // cache_path + ".bai". num_threads must be >= 1.
+  static StatusOr<std::unique_ptr<ReadBlockPrefetcher>> Create(
+      const string& reads_path,
+      const std::vector<learning::genomics::v1::Range>& regions,
+      const string& cache_path, int num_threads,
+      tensorflow::int64 max_request_bytes);
+
+  // Stops fetching, waiting for each thread to finish the request it is
+  // fetching.
+  ~ReadBlockPrefetcher();
+
+  // Disable assignment/copy operations.
+  ReadBlockPrefetcher(const ReadBlockPrefetcher& other) = delete;
+  ReadBlockPrefetcher& operator=(const ReadBlockPrefetcher&) = delete;
+
+  // Waits until the blocks of the region with index region_index are in the
+  // cache. Returns a non-OK status if fetching any request failed, after which
+  // nothing more is fetched.
+  tensorflow::Status WaitForRegion(int region_index);
+
+  // The path of our cache file.
+  const string& cache_path() const { return cache_path_; }
+
+  // The number of requests we make to fetch all of the regions.
+  int NumRequests() const { return requests_.size(); }
+
+  // The number of bytes we fetch, over all of our requests.
+  tensorflow::int64 NumBytesToFetch() const;
+
+ private:
+  // A range [begin, end) of bytes of the BAM file.
+  struct ByteRange {
+    tensorflow::int64 begin;
+    tensorflow::int64 end;
+  };
+
+  ReadBlockPrefetcher(const string& reads_path, const string& cache_path,
+                      int cache_fd, std::vector<ByteRange> requests,
+                      std::vector<std::vector<int>> region_requests,
+                      int num_threads);
+
+  // The body of each of our threads, fetching requests until none are left.
+  void FetchRequests();
+
+  const string reads_path_;
+  const string cache_path_;
+  // The file descriptor of our cache file, written by all of our threads.
+  const int cache_fd_;
+  // The byte ranges we fetch, in the order of the file.
+  const std::vector<ByteRange> requests_;
+  // The indices in requests_ of the requests holding the blocks of each
+  // region.
+  const std::vector<std::vector<int>> region_requests_;
+
+  // Guards all of our mutable state below.
+  tensorflow::mutex mutex_;
+  // Notified whenever a request is fetched, fails, or we are cancelled.
+  tensorflow::condition_variable cond_;
+  // The index of the next request to be fetched by one of our threads.
+  int next_request_ = 0;
+  // Whether each of requests_ is in the cache.
+  std::vector<bool> fetched_;
+  // The first error from fetching a request.
+  tensorflow::Status error_;
+  // Set on destruction to stop our threads.
+  bool cancelled_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+// Estimates, from the BAI index of the BAM file reads_path alone, the number of
+// bytes of compressed reads that querying each of regions reads. The index
+// only locates reads to within BGZF blocks, so this is approximate, but it
+// costs no more than an index lookup per region and tracks the depth of the
+// reads, which is what most of the cost of processing a region depends on.
+StatusOr<std::vector<tensorflow::int64>> EstimateRegionReadBytes(
+    const string& reads_path,
+    const std::vector<learning::genomics::v1::Range>& regions);
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_BLOCK_PREFETCHER_H_
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/read_block_prefetcher.h"
+
+#include <memory>
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/sam_reader.h"
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+#include "deepvariant/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Range;
+using ::testing::Pointwise;
+using ::testing::SizeIs;
+
+constexpr char kBamTestFilename[] = "test.bam";
+
+class ReadBlockPrefetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    reader_ = std::move(SamReader::FromFile(GetTestData(kBamTestFilename),
+                                            IndexedOptions())
+                            .ValueOrDie());
+    // The reads of test.bam span chr20:10000000-10000100, so these sorted
+    // regions cover some and none of them, with reads overlapping several.
+    regions_ = {
+        MakeRange("chr20", 9999999, 10000010),
+        MakeRange("chr20", 10000010, 10000050),
+        MakeRange("chr20", 10000060, 10000100),
+        MakeRange("chr20", 20000000, 20000100),
+    };
+  }
+
+  static SamReaderOptions IndexedOptions() {
+    SamReaderOptions options;
+    options.set_index_mode(IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+    return options;
+  }
+
+  // Checks that querying each of regions_ from the cache filled with
+  // max_request_bytes requests gives the reads of querying the BAM file.
+  void CheckCachedReadsMatchQueries(int num_threads,
+                                    tensorflow::int64 max_request_bytes) {
+    std::unique_ptr<ReadBlockPrefetcher> prefetcher = std::move(
+        ReadBlockPrefetcher::Create(
+            GetTestData(kBamTestFilename), regions_,
+            MakeTempFile("cached.bam"), num_threads, max_request_bytes)
+            .ValueOrDie());
+    EXPECT_GE(prefetcher->NumRequests(), 1);
+    EXPECT_GT(prefetcher->NumBytesToFetch(), 0);
+    for (int i = 0; i < static_cast<int>(regions_.size()); ++i) {
+      ASSERT_THAT(prefetcher->WaitForRegion(i), IsOK());
+    }
+
+    std::unique_ptr<SamReader> cached = std::move(
+        SamReader::FromFile(prefetcher->cache_path(), IndexedOptions())
+            .ValueOrDie());
+    for (const Range& region : regions_) {
+      EXPECT_THAT(as_vector(cached->Query(region)),
+                  Pointwise(EqualsProto(), as_vector(reader_->Query(region))))
+          << "region " << region.ShortDebugString();
+    }
+  }
+
+  std::unique_ptr<SamReader> reader_;
+  std::vector<Range> regions_;
+};
+
+TEST_F(ReadBlockPrefetcherTest, CachedReadsMatchQueries) {
+  CheckCachedReadsMatchQueries(2, 64 << 20);
+}
+
+TEST_F(ReadBlockPrefetcherTest, CachedReadsMatchQueriesWithSmallRequests) {
+  // Requests are never split, so each piece gets its own request.
+  CheckCachedReadsMatchQueries(3, 1);
+}
+
+TEST_F(ReadBlockPrefetcherTest, CachedReadsMatchQueriesOnOneThread) {
+  CheckCachedReadsMatchQueries(1, 1);
+}
+
+TEST_F(ReadBlockPrefetcherTest, NoRegionsFetchesTheHeader) {
+  std::unique_ptr<ReadBlockPrefetcher> prefetcher = std::move(
+      ReadBlockPrefetcher::Create(GetTestData(kBamTestFilename), {},
+                                  MakeTempFile("header.bam"), 2, 64 << 20)
+          .ValueOrDie());
+  EXPECT_EQ(1, prefetcher->NumRequests());
+}
+
+TEST_F(ReadBlockPrefetcherTest, StoppingEarlyDoesNotBlock) {
+  ReadBlockPrefetcher::Create(GetTestData(kBamTestFilename), regions_,
+                              MakeTempFile("stopped.bam"), 2, 1)
+      .ValueOrDie()
+      .reset();
+}
+
+TEST_F(ReadBlockPrefetcherTest, RejectsBadInputs) {
+  EXPECT_FALSE(ReadBlockPrefetcher::Create(GetTestData(kBamTestFilename),
+                                           {MakeRange("unknown", 0, 100)},
+                                           MakeTempFile("unknown.bam"), 1,
+                                           64 << 20)
+                   .ok());
+  EXPECT_FALSE(ReadBlockPrefetcher::Create(GetTestData("unindexed.bam"),
+                                           regions_,
+                                           MakeTempFile("unindexed.bam"), 1,
+                                           64 << 20)
+                   .ok());
+  EXPECT_FALSE(ReadBlockPrefetcher::Create(GetTestData("test.sam"), regions_,
+                                           MakeTempFile("test.sam"), 1,
+                                           64 << 20)
+                   .ok());
+  EXPECT_FALSE(ReadBlockPrefetcher::Create(GetTestData(kBamTestFilename),
+                                           regions_, MakeTempFile("zero.bam"),
+                                           1, 0)
+                   .ok());
+}
+
+TEST_F(ReadBlockPrefetcherTest, EstimatesTheReadBytesOfRegions) {
+  const StatusOr<std::vector<tensorflow::int64>> estimates =
+      EstimateRegionReadBytes(GetTestData(kBamTestFilename), regions_);
+  ASSERT_THAT(estimates.status(), IsOK());
+  const std::vector<tensorflow::int64>& bytes = estimates.ValueOrDie();
+  ASSERT_THAT(bytes, SizeIs(regions_.size()));
+  // Only the last region has no reads.
+  EXPECT_GT(bytes[0], 0);
+  EXPECT_GT(bytes[1], 0);
+  EXPECT_GT(bytes[2], 0);
+  EXPECT_EQ(bytes[3], 0);
+
+  EXPECT_FALSE(EstimateRegionReadBytes(GetTestData(kBamTestFilename),
+                                       {MakeRange("unknown", 0, 100)})
+                   .ok());
+  EXPECT_FALSE(
+      EstimateRegionReadBytes(GetTestData("unindexed.bam"), regions_).ok());
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
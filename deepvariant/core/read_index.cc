@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/read_index.h"
+
+#include <algorithm>
+
+#include "deepvariant/core/utils.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+using tensorflow::int64;
+
+ReadIndex::ReadIndex(const std::vector<Read>& reads) : size_(reads.size()) {
+  for (int i = 0; i < size_; ++i) {
+    const Read& read = reads[i];
+    Contig& contig = contigs_[AlignedContig(read)];
+    const int64 start = ReadStart(read);
+    const int64 end = ReadEnd(read);
+    contig.entries.push_back({start, end, i});
+    contig.max_span = std::max(contig.max_span, end - start);
+  }
+  for (auto& name_and_contig : contigs_) {
+    std::vector<Entry>& entries = name_and_contig.second.entries;
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry& a, const Entry& b) {
+                       return a.start < b.start;
+                     });
+  }
+}
+
+std::vector<int> ReadIndex::Query(const Range& range) const {
+  std::vector<int> hits;
+  const auto it = contigs_.find(range.reference_name());
+  if (it == contigs_.end()) return hits;
+  const Contig& contig = it->second;
+
+  // A read overlaps range iff it starts before range.end() and ends after
+  // range.start(). As no read is longer than max_span, the reads ending after
+  // range.start() start after range.start() - max_span.
+  const int64 min_start = range.start() - contig.max_span + 1;
+  auto entry = std::lower_bound(
+      contig.entries.begin(), contig.entries.end(), min_start,
+      [](const Entry& e, int64 start) { return e.start < start; });
+  for (; entry != contig.entries.end() && entry->start < range.end();
+       ++entry) {
+    if (entry->end > range.start()) hits.push_back(entry->index);
+  }
+  std::sort(hits.begin(), hits.end());
+  return hits;
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
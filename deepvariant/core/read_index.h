@@ -0,0 +1,92 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// An index of the alignment spans of a set of reads, for fast overlap queries.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_INDEX_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_INDEX_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// An immutable index of where each of a list of reads, such as those of a
+// region, is aligned.
+//
+// The alignment end of each read is computed once from its cigar, and the
+// reads of each contig are sorted by alignment start. Since no read on a
+// contig spans more than the longest one, the reads overlapping a range start
+// in a window which is found by binary search, so Query() takes O(log n + k)
+// time for n reads on the contig, plus the reads starting in that window. The
+// index doesn't refer to the reads after construction. A ReadIndex is safe to
+// query from many threads at once.
+class ReadIndex {
+ public:
+  // Creates an index of the alignments of reads, which may be in any order.
+  explicit ReadIndex(const std::vector<learning::genomics::v1::Read>& reads);
+
+  // Returns the indices into reads of the reads whose alignment overlaps
+  // range, in increasing order. A read spans [ReadStart(read), ReadEnd(read))
+  // on its aligned contig, as in utils.read_range() in Python.
+  std::vector<int> Query(const learning::genomics::v1::Range& range) const;
+
+  // Returns the number of reads in this index.
+  int size() const { return size_; }
+
+ private:
+  struct Entry {
+    tensorflow::int64 start;
+    tensorflow::int64 end;
+    int index;
+  };
+
+  struct Contig {
+    // Sorted by start.
+    std::vector<Entry> entries;
+    // The longest alignment span of entries.
+    tensorflow::int64 max_span = 0;
+  };
+
+  std::unordered_map<tensorflow::string, Contig> contigs_;
+  int size_ = 0;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_INDEX_H_
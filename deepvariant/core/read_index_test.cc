@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/read_index.h"
+
+#include <vector>
+
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using tensorflow::strings::StrCat;
+
+TEST(ReadIndexTest, FindsOverlappingReadsInInputOrder) {
+  const std::vector<Read> reads = {
+      // chr1:20-24.
+      MakeRead("chr1", 20, "ACGT", {"4M"}),
+      // chr1:1-19.
+      MakeRead("chr1", 1, "ACGTACGT", {"2M", "10D", "6M"}),
+      // chr2:5-7.
+      MakeRead("chr2", 5, "AC", {"2M"}),
+      // chr1:10-11.
+      MakeRead("chr1", 10, "ACG", {"1M", "2I"}),
+      // chr1:18-20.
+      MakeRead("chr1", 18, "ACGT", {"2S", "2M"}),
+  };
+  const ReadIndex index(reads);
+  EXPECT_EQ(5, index.size());
+
+  EXPECT_THAT(index.Query(MakeRange("chr1", 0, 1)), IsEmpty());
+  EXPECT_THAT(index.Query(MakeRange("chr1", 0, 2)), ElementsAre(1));
+  EXPECT_THAT(index.Query(MakeRange("chr1", 10, 11)), ElementsAre(1, 3));
+  EXPECT_THAT(index.Query(MakeRange("chr1", 18, 21)), ElementsAre(0, 1, 4));
+  EXPECT_THAT(index.Query(MakeRange("chr1", 19, 20)), ElementsAre(4));
+  EXPECT_THAT(index.Query(MakeRange("chr1", 24, 30)), IsEmpty());
+  EXPECT_THAT(index.Query(MakeRange("chr2", 0, 100)), ElementsAre(2));
+  EXPECT_THAT(index.Query(MakeRange("chr3", 0, 100)), IsEmpty());
+}
+
+TEST(ReadIndexTest, MatchesLinearScan) {
+  // Reads of varying lengths, so the max span bound matters.
+  std::vector<Read> reads;
+  for (int i = 0; i < 50; ++i) {
+    const int length = 1 + (i * 7) % 23;
+    reads.push_back(MakeRead("chr1", (i * 13) % 97, string(length, 'A'),
+                             {StrCat(length, "M")}));
+  }
+  const ReadIndex index(reads);
+  for (int start = 0; start < 130; start += 3) {
+    for (int length : {1, 5, 40}) {
+      const Range range = MakeRange("chr1", start, start + length);
+      std::vector<int> expected;
+      for (size_t i = 0; i < reads.size(); ++i) {
+        if (ReadStart(reads[i]) < range.end() &&
+            ReadEnd(reads[i]) > range.start()) {
+          expected.push_back(i);
+        }
+      }
+      EXPECT_EQ(expected, index.Query(range));
+    }
+  }
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
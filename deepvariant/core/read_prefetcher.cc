@@ -0,0 +1,139 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of read_prefetcher.h.
+#include "deepvariant/core/read_prefetcher.h"
+
+#include <memory>
+#include <utility>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace tf = tensorflow;
+
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+
+ReadPrefetcher::ReadPrefetcher(const SamReader* reader,
+                               const std::vector<Range>& regions,
+                               const int max_prefetched_regions)
+    : reader_(reader),
+      regions_(regions),
+      max_prefetched_regions_(max_prefetched_regions) {
+  CHECK(reader != nullptr) << "reader cannot be null";
+  CHECK_GE(max_prefetched_regions, 1)
+      << "We must be able to prefetch at least one region";
+  // Started last, once all of our state is initialized.
+  thread_ = std::thread(&ReadPrefetcher::PrefetchRegions, this);
+}
+
+ReadPrefetcher::~ReadPrefetcher() {
+  {
+    tf::mutex_lock lock(mutex_);
+    cancelled_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+}
+
+void ReadPrefetcher::PrefetchRegions() {
+  // A single multi-region query decodes the records shared by adjacent regions
+  // once.
+  StatusOr<std::shared_ptr<SamRegionsIterable>> iterable =
+      reader_->QueryMultiple(regions_);
+  for (size_t i = 0; i < regions_.size(); ++i) {
+    {
+      // Wait for space in our buffer before decoding anything, so we never
+      // hold more than max_prefetched_regions_ regions of reads.
+      tf::mutex_lock lock(mutex_);
+      while (!cancelled_ &&
+             static_cast<int>(batches_.size()) >= max_prefetched_regions_) {
+        cond_.wait(lock);
+      }
+      if (cancelled_) return;
+    }
+
+    Batch batch;
+    if (!iterable.ok()) {
+      batch.status = iterable.status();
+    } else {
+      StatusOr<bool> more = iterable.ValueOrDie()->Next(&batch.reads);
+      if (!more.ok()) {
+        batch.status = more.status();
+      } else if (!more.ValueOrDie()) {
+        batch.status = tf::errors::Internal(
+            "QueryMultiple returned fewer regions than requested");
+      }
+    }
+    const bool ok = batch.status.ok();
+    {
+      tf::mutex_lock lock(mutex_);
+      batches_.push_back(std::move(batch));
+    }
+    cond_.notify_all();
+    if (!ok) return;
+  }
+}
+
+StatusOr<bool> ReadPrefetcher::Next(std::vector<Read>* reads) {
+  CHECK(reads != nullptr) << "reads cannot be null";
+  Batch batch;
+  {
+    tf::mutex_lock lock(mutex_);
+    TF_RETURN_IF_ERROR(error_);
+    if (n_returned_ == static_cast<int>(regions_.size())) return false;
+    while (batches_.empty()) {
+      cond_.wait(lock);
+    }
+    batch = std::move(batches_.front());
+    batches_.pop_front();
+    ++n_returned_;
+    error_ = batch.status;
+  }
+  cond_.notify_all();
+  TF_RETURN_IF_ERROR(batch.status);
+  *reads = std::move(batch.reads);
+  return true;
+}
+
+int ReadPrefetcher::NumRegionsReturned() const {
+  tf::mutex_lock lock(mutex_);
+  return n_returned_;
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
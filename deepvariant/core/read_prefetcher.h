@@ -0,0 +1,132 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Prefetching the reads of a series of regions on a background thread.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_PREFETCHER_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_PREFETCHER_H_
+
+#include <deque>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/sam_reader.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// A ReadPrefetcher queries a SamReader for the reads of each of a series of
+// regions, in order, on a background thread, so the reads of the next regions
+// are decoded, decompressed and filtered while the caller is busy processing
+// the current one. The reads of each region are exactly those returned for it
+// by SamReader::QueryMultiple(regions), so the regions must be sorted in the
+// same way, and without downsampling they are the reads of Query(region).
+//
+// The prefetched reads are kept in a bounded buffer: the background thread
+// stays at most max_prefetched_regions regions ahead of the caller, which
+// bounds the memory used to that many regions worth of reads.
+//
+// Usage:
+//
+//   ReadPrefetcher prefetcher(reader.get(), regions, 2);
+//   std::vector<Read> reads;
+//   while (prefetcher.Next(&reads).ValueOrDie()) {
+//     ... process the reads of the next region ...
+//   }
+//
+// The reader must outlive the prefetcher. Because the prefetcher uses a query
+// iterable of the reader, other threads can keep querying the same reader.
+class ReadPrefetcher {
+ public:
+  // Starts prefetching the reads of each of regions, in order, from reader.
+  // max_prefetched_regions must be >= 1.
+  ReadPrefetcher(const SamReader* reader,
+                 const std::vector<learning::genomics::v1::Range>& regions,
+                 int max_prefetched_regions);
+
+  // Stops prefetching, waiting for the background thread to finish the region
+  // it is querying.
+  ~ReadPrefetcher();
+
+  // Disable assignment/copy operations.
+  ReadPrefetcher(const ReadPrefetcher& other) = delete;
+  ReadPrefetcher& operator=(const ReadPrefetcher&) = delete;
+
+  // Gets the reads of the next region into reads, waiting for them to be
+  // fetched if needed. Returns false once the reads of all of the regions have
+  // been returned, or a non-OK status if querying the reads of the region
+  // failed, after which no more regions are fetched.
+  StatusOr<bool> Next(std::vector<learning::genomics::v1::Read>* reads);
+
+  // Returns the number of regions whose reads have been returned by Next().
+  int NumRegionsReturned() const;
+
+ private:
+  // The reads of a region, or the error from querying them.
+  struct Batch {
+    tensorflow::Status status;
+    std::vector<learning::genomics::v1::Read> reads;
+  };
+
+  // The body of our background thread, fetching each of our regions in turn.
+  void PrefetchRegions();
+
+  const SamReader* const reader_;
+  const std::vector<learning::genomics::v1::Range> regions_;
+  const int max_prefetched_regions_;
+
+  // Guards all of our mutable state below.
+  mutable tensorflow::mutex mutex_;
+  // Notified whenever a batch is added to or taken from batches_, or we are
+  // cancelled.
+  tensorflow::condition_variable cond_;
+  // The fetched batches that haven't been returned by Next() yet, in order.
+  std::deque<Batch> batches_;
+  // The number of regions returned by Next().
+  int n_returned_ = 0;
+  // The first error returned by Next(), returned again by every later call.
+  tensorflow::Status error_;
+  // Set on destruction to stop the background thread.
+  bool cancelled_ = false;
+
+  std::thread thread_;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_PREFETCHER_H_
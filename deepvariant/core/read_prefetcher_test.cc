@@ -0,0 +1,158 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/read_prefetcher.h"
+
+#include <memory>
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/sam_reader.h"
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+#include "deepvariant/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+using ::testing::IsEmpty;
+using ::testing::Pointwise;
+using ::testing::SizeIs;
+
+constexpr char kBamTestFilename[] = "test.bam";
+
+class ReadPrefetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    SamReaderOptions options;
+    options.set_index_mode(IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+    reader_ = std::move(
+        SamReader::FromFile(GetTestData(kBamTestFilename), options)
+            .ValueOrDie());
+    // The reads of test.bam span chr20:10000000-10000100, so these sorted
+    // regions cover some and none of them, with reads overlapping several.
+    regions_ = {
+        MakeRange("chr20", 9999999, 10000010),
+        MakeRange("chr20", 10000010, 10000050),
+        MakeRange("chr20", 10000040, 10000060),
+        MakeRange("chr20", 10000060, 10000100),
+        MakeRange("chr20", 20000000, 20000100),
+    };
+  }
+
+  // Checks that prefetching the reads of regions_ gives exactly the reads of
+  // querying each of them in turn.
+  void CheckPrefetchedReadsMatchQueries(int max_prefetched_regions) {
+    ReadPrefetcher prefetcher(reader_.get(), regions_, max_prefetched_regions);
+    std::vector<Read> reads;
+    for (const Range& region : regions_) {
+      ASSERT_TRUE(prefetcher.Next(&reads).ValueOrDie());
+      EXPECT_THAT(reads, Pointwise(EqualsProto(),
+                                   as_vector(reader_->Query(region))));
+    }
+    EXPECT_FALSE(prefetcher.Next(&reads).ValueOrDie());
+    EXPECT_FALSE(prefetcher.Next(&reads).ValueOrDie());
+    EXPECT_EQ(static_cast<int>(regions_.size()),
+              prefetcher.NumRegionsReturned());
+  }
+
+  std::unique_ptr<SamReader> reader_;
+  std::vector<Range> regions_;
+};
+
+TEST_F(ReadPrefetcherTest, PrefetchedReadsMatchQueries) {
+  CheckPrefetchedReadsMatchQueries(2);
+}
+
+TEST_F(ReadPrefetcherTest, PrefetchingOneRegionAhead) {
+  CheckPrefetchedReadsMatchQueries(1);
+}
+
+TEST_F(ReadPrefetcherTest, PrefetchingMoreRegionsThanWeHave) {
+  CheckPrefetchedReadsMatchQueries(100);
+}
+
+TEST_F(ReadPrefetcherTest, WholeRegionHasAllReads) {
+  ReadPrefetcher prefetcher(reader_.get(),
+                            {MakeRange("chr20", 9999999, 10000100)}, 1);
+  std::vector<Read> reads;
+  ASSERT_TRUE(prefetcher.Next(&reads).ValueOrDie());
+  EXPECT_THAT(reads, SizeIs(106));
+}
+
+TEST_F(ReadPrefetcherTest, NoRegions) {
+  ReadPrefetcher prefetcher(reader_.get(), {}, 2);
+  std::vector<Read> reads;
+  EXPECT_FALSE(prefetcher.Next(&reads).ValueOrDie());
+  EXPECT_THAT(reads, IsEmpty());
+}
+
+TEST_F(ReadPrefetcherTest, StoppingEarlyDoesNotBlock) {
+  // Destroying the prefetcher while its background thread is waiting for
+  // space in its buffer must not deadlock, whether or not we ever called Next.
+  {
+    ReadPrefetcher prefetcher(reader_.get(), regions_, 1);
+  }
+  {
+    ReadPrefetcher prefetcher(reader_.get(), regions_, 1);
+    std::vector<Read> reads;
+    ASSERT_TRUE(prefetcher.Next(&reads).ValueOrDie());
+  }
+}
+
+TEST_F(ReadPrefetcherTest, BadRegionsAreAnError) {
+  ReadPrefetcher prefetcher(
+      reader_.get(), {regions_[1], MakeRange("chr1", 0, 100), regions_[2]}, 2);
+  std::vector<Read> reads;
+  EXPECT_FALSE(prefetcher.Next(&reads).ok());
+  // The error is sticky, so we don't silently skip over the bad region.
+  EXPECT_FALSE(prefetcher.Next(&reads).ok());
+  EXPECT_EQ(1, prefetcher.NumRegionsReturned());
+
+  ReadPrefetcher unsorted(reader_.get(), {regions_[1], regions_[0]}, 2);
+  EXPECT_FALSE(unsorted.Next(&reads).ok());
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
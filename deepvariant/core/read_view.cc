@@ -0,0 +1,101 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of read_view.h.
+#include "deepvariant/core/read_view.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::v1::CigarUnit;
+using learning::genomics::v1::CigarUnit_Operation;
+
+// Array mapping htslib BAM constants (in comment) to proto CigarUnit enum
+// values.
+const CigarUnit_Operation kHtslibCigarToProto[] = {
+// #define BAM_CMATCH      0
+  CigarUnit::ALIGNMENT_MATCH,
+// #define BAM_CINS        1
+  CigarUnit::INSERT,
+// #define BAM_CDEL        2
+  CigarUnit::DELETE,
+// #define BAM_CREF_SKIP   3
+  CigarUnit::SKIP,
+// #define BAM_CSOFT_CLIP  4
+  CigarUnit::CLIP_SOFT,
+// #define BAM_CHARD_CLIP  5
+  CigarUnit::CLIP_HARD,
+// #define BAM_CPAD        6
+  CigarUnit::ALIGNMENT_MATCH,
+// #define BAM_CEQUAL      7
+  CigarUnit::SEQUENCE_MATCH,
+// #define BAM_CDIFF       8
+  CigarUnit::SEQUENCE_MISMATCH,
+// #define BAM_CBACK       9
+  CigarUnit::OPERATION_UNSPECIFIED,
+};
+
+string ReadView::Bases(const int offset, const int len) const {
+  CHECK_LE(offset + len, Length()) << "Bases must be within the read";
+  string bases;
+  bases.reserve(len);
+  const uint8_t* seq = PackedSequence();
+  for (int i = offset; i < offset + len; ++i) {
+    bases.push_back(seq_nt16_str[bam_seqi(seq, i)]);
+  }
+  return bases;
+}
+
+bool ReadSatisfiesRequirements(const ReadView& read,
+                               const ReadRequirements& requirements) {
+  // A read is properly placed, per IsReadProperlyPlaced(), if it is unpaired,
+  // has the proper pair flag, has an unmapped mate, is unaligned or has its
+  // mate on the same contig.
+  const bool properly_placed = !read.IsPaired() || read.IsProperPlacement() ||
+                               !read.IsMateMapped() || !read.IsAligned() ||
+                               read.IsMateOnSameContig();
+  return (requirements.keep_duplicates() || !read.IsDuplicateFragment()) &&
+         (requirements.keep_failed_vendor_quality_checks() ||
+          !read.IsFailedVendorQualityChecks()) &&
+         (requirements.keep_secondary_alignments() ||
+          !read.IsSecondaryAlignment()) &&
+         (requirements.keep_supplementary_alignments() ||
+          !read.IsSupplementaryAlignment()) &&
+         (requirements.keep_unaligned() || read.IsAligned()) &&
+         (requirements.keep_improperly_placed() || properly_placed) &&
+         (!read.IsAligned() ||
+          read.MappingQuality() >= requirements.min_mapping_quality());
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
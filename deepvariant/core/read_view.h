@@ -0,0 +1,259 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A lightweight, read-only view of a SAM/BAM record.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_VIEW_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_VIEW_H_
+
+#include "deepvariant/core/cigar.h"
+#include "deepvariant/core/genomics/cigar.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/protos/core.pb.h"
+#include "htslib/sam.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using tensorflow::int64;
+using tensorflow::string;
+
+// Maps the htslib BAM_C* operation constants to proto CigarUnit operations.
+extern const learning::genomics::v1::CigarUnit_Operation kHtslibCigarToProto[];
+
+// A ReadView gives access to the fields of a bam1_t record that our pileup
+// code needs (bases, qualities, CIGAR, flags and alignment) directly from
+// htslib's packed representation, without converting the record into a Read
+// proto. Building a Read copies every base, quality, CIGAR element and aux
+// field into freshly allocated protobuf storage, which dominates the cost of
+// processing a read when all we want to do is look at each of its bases once.
+//
+// The accessors mirror what would be found in the Read proto converted from
+// the same record by SamReader. In particular, unaligned reads have no CIGAR,
+// position or mapping quality, and reads with missing qualities (a '*' in SAM)
+// report NumQualities() == 0 just as their proto has no aligned_quality.
+//
+// A ReadView doesn't own anything: it is only valid as long as the record and
+// header it views, so for example a view returned by a SamReader::QueryViews()
+// iterable is invalidated by the next call to Next() on that iterable. Convert
+// the reads that need to be kept to Read protos.
+class ReadView {
+ public:
+  // Creates an empty view, which must be assigned before it is used.
+  ReadView() = default;
+
+  // Creates a view of record, whose contig names are defined by header. Both
+  // must outlive this view.
+  ReadView(const bam_hdr_t* header, const bam1_t* record)
+      : header_(header), record_(record) {
+    CHECK(header != nullptr) << "BAM header cannot be null";
+    CHECK(record != nullptr) << "BAM record cannot be null";
+  }
+
+  // The underlying htslib record.
+  const bam1_t* record() const { return record_; }
+
+  // The name of the fragment this read belongs to.
+  tensorflow::StringPiece FragmentName() const {
+    return bam_get_qname(record_);
+  }
+
+  // The read number within its fragment, as in Read.read_number: 0 for the
+  // first read of a pair or for unpaired reads, and 1 otherwise.
+  int ReadNumber() const {
+    return (Flag() & BAM_FREAD1) || !IsPaired() ? 0 : 1;
+  }
+
+  // The raw SAM flag of the record, for anything not covered below.
+  int Flag() const { return record_->core.flag; }
+  bool IsPaired() const { return Flag() & BAM_FPAIRED; }
+  bool IsProperPlacement() const { return Flag() & BAM_FPROPER_PAIR; }
+  bool IsDuplicateFragment() const { return Flag() & BAM_FDUP; }
+  bool IsFailedVendorQualityChecks() const { return Flag() & BAM_FQCFAIL; }
+  bool IsSecondaryAlignment() const { return Flag() & BAM_FSECONDARY; }
+  bool IsSupplementaryAlignment() const { return Flag() & BAM_FSUPPLEMENTARY; }
+
+  // Returns true if the read is aligned, i.e., its Read proto has an
+  // alignment.
+  bool IsAligned() const { return !(Flag() & BAM_FUNMAP); }
+
+  // Returns true if the read has a position on the genome.
+  bool HasPosition() const { return IsAligned() && record_->core.tid >= 0; }
+
+  // The name of the contig the read is aligned to, or "" if it has no
+  // position.
+  tensorflow::StringPiece ReferenceName() const {
+    return HasPosition() ? header_->target_name[record_->core.tid] : "";
+  }
+
+  // The 0-based start of the alignment of the read, or 0 if it has no
+  // position.
+  int64 Position() const { return HasPosition() ? record_->core.pos : 0; }
+
+  // Is the read aligned to the reverse strand?
+  bool IsReverseStrand() const { return HasPosition() && bam_is_rev(record_); }
+
+  // The mapping quality of the read, or 0 if it is unaligned.
+  int MappingQuality() const { return IsAligned() ? record_->core.qual : 0; }
+
+  // Returns true if the read's mate is aligned to the same contig as the read,
+  // which is how IsReadProperlyPlaced() treats reads without the proper pair
+  // flag.
+  bool IsMateOnSameContig() const {
+    return HasPosition() && record_->core.mtid == record_->core.tid;
+  }
+
+  // Returns true if the read's mate is mapped, and so has a position.
+  bool IsMateMapped() const { return IsPaired() && !(Flag() & BAM_FMUNMAP); }
+
+  // The number of bases of the read.
+  int Length() const { return record_->core.l_qseq; }
+
+  // The base at offset in the read, which must be >= 0 and < Length(), using
+  // the same upper case characters as Read.aligned_sequence.
+  char BaseAt(int offset) const {
+    return seq_nt16_str[bam_seqi(PackedSequence(), offset)];
+  }
+
+  // Gets len bases of the read starting at offset as a string.
+  string Bases(int offset, int len) const;
+
+  // The 4-bit packed bases of the read, two per byte, as stored by htslib.
+  const uint8_t* PackedSequence() const { return bam_get_seq(record_); }
+
+  // The number of base qualities of the read, which is either Length() or 0
+  // if the qualities are missing.
+  int NumQualities() const {
+    return Length() > 0 && Qualities()[0] != 0xff ? Length() : 0;
+  }
+
+  // The base quality at offset, which must be >= 0 and < NumQualities().
+  int QualityAt(int offset) const { return Qualities()[offset]; }
+
+  // The raw base qualities of the read, one per base.
+  const uint8_t* Qualities() const { return bam_get_qual(record_); }
+
+  // The number of CIGAR elements, which is 0 if the read isn't aligned.
+  int NumCigarOps() const { return IsAligned() ? record_->core.n_cigar : 0; }
+
+  // The operation and length of the CIGAR element i, which must be >= 0 and
+  // < NumCigarOps().
+  learning::genomics::v1::CigarUnit::Operation CigarOpAt(int i) const {
+    return kHtslibCigarToProto[bam_cigar_op(bam_get_cigar(record_)[i])];
+  }
+  int CigarOpLenAt(int i) const {
+    return bam_cigar_oplen(bam_get_cigar(record_)[i]);
+  }
+
+ private:
+  const bam_hdr_t* header_ = nullptr;
+  const bam1_t* record_ = nullptr;
+};
+
+// Walks over the CIGAR elements of read in order, exactly like the WalkCigar()
+// for Read protos in cigar.h.
+template <typename Visitor>
+inline bool WalkCigar(const ReadView& read, Visitor&& visitor) {
+  int64 ref_pos = read.Position();
+  int read_offset = 0;
+  const int n_ops = read.NumCigarOps();
+  for (int i = 0; i < n_ops; ++i) {
+    const auto op = read.CigarOpAt(i);
+    const int op_len = read.CigarOpLenAt(i);
+    if (!visitor(op, op_len, ref_pos, read_offset)) return false;
+    if (ConsumesReference(op)) ref_pos += op_len;
+    if (ConsumesRead(op)) read_offset += op_len;
+  }
+  return true;
+}
+
+// Returns true if read satisfies requirements, as ReadSatisfiesRequirements()
+// in utils.h does for the Read proto of the same record.
+bool ReadSatisfiesRequirements(const ReadView& read,
+                               const ReadRequirements& requirements);
+
+// Accessors giving Read protos and ReadViews the same interface, so code
+// working on the bases of a read can be written once as a template over the
+// type of the read.
+inline int64 ReadStart(const ReadView& read) { return read.Position(); }
+
+inline char ReadBaseAt(const learning::genomics::v1::Read& read, int offset) {
+  return read.aligned_sequence()[offset];
+}
+inline char ReadBaseAt(const ReadView& read, int offset) {
+  return read.BaseAt(offset);
+}
+
+inline string ReadBases(const learning::genomics::v1::Read& read, int offset,
+                        int len) {
+  return read.aligned_sequence().substr(offset, len);
+}
+inline string ReadBases(const ReadView& read, int offset, int len) {
+  return read.Bases(offset, len);
+}
+
+inline int ReadNumQualities(const learning::genomics::v1::Read& read) {
+  return read.aligned_quality_size();
+}
+inline int ReadNumQualities(const ReadView& read) {
+  return read.NumQualities();
+}
+
+inline int ReadQualityAt(const learning::genomics::v1::Read& read,
+                         int offset) {
+  return read.aligned_quality(offset);
+}
+inline int ReadQualityAt(const ReadView& read, int offset) {
+  return read.QualityAt(offset);
+}
+
+inline int ReadMappingQuality(const learning::genomics::v1::Read& read) {
+  return read.alignment().mapping_quality();
+}
+inline int ReadMappingQuality(const ReadView& read) {
+  return read.MappingQuality();
+}
+
+inline bool ReadIsReverseStrand(const learning::genomics::v1::Read& read) {
+  return read.alignment().position().reverse_strand();
+}
+inline bool ReadIsReverseStrand(const ReadView& read) {
+  return read.IsReverseStrand();
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_READ_VIEW_H_
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/read_view.h"
+
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "deepvariant/core/genomics/cigar.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/sam_reader.h"
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::v1::CigarUnit;
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+using ::testing::SizeIs;
+
+constexpr char kBamTestFilename[] = "test.bam";
+
+class ReadViewTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    options_.set_index_mode(IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+    range_ = MakeRange("chr20", 9999999, 10000100);
+  }
+
+  std::unique_ptr<SamReader> MakeReader() {
+    return std::move(
+        SamReader::FromFile(GetTestData(kBamTestFilename), options_)
+            .ValueOrDie());
+  }
+
+  // Checks that each view returned by QueryViews(range_) matches the Read
+  // proto returned by Query(range_), returning the number of reads compared.
+  int CheckViewsMatchProtos() {
+    std::unique_ptr<SamReader> reader = MakeReader();
+    std::shared_ptr<SamIterable> reads = reader->Query(range_).ValueOrDie();
+    std::shared_ptr<SamViewIterable> views =
+        reader->QueryViews(range_).ValueOrDie();
+    Read read;
+    ReadView view;
+    int n_reads = 0;
+    while (reads->Next(&read).ValueOrDie()) {
+      EXPECT_TRUE(views->Next(&view).ValueOrDie());
+      ExpectViewMatchesProto(view, read);
+      ++n_reads;
+    }
+    EXPECT_FALSE(views->Next(&view).ValueOrDie());
+    return n_reads;
+  }
+
+  void ExpectViewMatchesProto(const ReadView& view, const Read& read) {
+    EXPECT_EQ(view.FragmentName(), read.fragment_name());
+    EXPECT_EQ(view.ReadNumber(), read.read_number());
+    EXPECT_EQ(view.IsDuplicateFragment(), read.duplicate_fragment());
+    EXPECT_EQ(view.IsSecondaryAlignment(), read.secondary_alignment());
+    EXPECT_EQ(view.IsSupplementaryAlignment(),
+              read.supplementary_alignment());
+    EXPECT_EQ(view.IsAligned(), read.has_alignment());
+    EXPECT_EQ(view.ReferenceName(), AlignedContig(read));
+    EXPECT_EQ(ReadStart(view), ReadStart(read));
+    EXPECT_EQ(ReadMappingQuality(view), ReadMappingQuality(read));
+    EXPECT_EQ(ReadIsReverseStrand(view), ReadIsReverseStrand(read));
+    EXPECT_EQ(view.Length(), static_cast<int>(read.aligned_sequence().size()));
+    EXPECT_EQ(ReadBases(view, 0, view.Length()), read.aligned_sequence());
+    ASSERT_EQ(ReadNumQualities(view), ReadNumQualities(read));
+    for (int i = 0; i < ReadNumQualities(view); ++i) {
+      EXPECT_EQ(ReadBaseAt(view, i), ReadBaseAt(read, i));
+      EXPECT_EQ(ReadQualityAt(view, i), ReadQualityAt(read, i));
+    }
+    ASSERT_EQ(view.NumCigarOps(), read.alignment().cigar_size());
+    for (int i = 0; i < view.NumCigarOps(); ++i) {
+      const CigarUnit& unit = read.alignment().cigar(i);
+      EXPECT_EQ(view.CigarOpAt(i), unit.operation());
+      EXPECT_EQ(view.CigarOpLenAt(i), unit.operation_length());
+    }
+    EXPECT_EQ(ReadSatisfiesRequirements(view, options_.read_requirements()),
+              ReadSatisfiesRequirements(read, options_.read_requirements()));
+  }
+
+  SamReaderOptions options_;
+  Range range_;
+};
+
+TEST_F(ReadViewTest, ViewsMatchReadProtos) {
+  EXPECT_EQ(CheckViewsMatchProtos(), 106);
+}
+
+TEST_F(ReadViewTest, ViewsRespectReadRequirements) {
+  options_.mutable_read_requirements()->set_min_mapping_quality(60);
+  std::unique_ptr<SamReader> reader = MakeReader();
+  // Two of the reads in range_ have mapping quality below 60.
+  EXPECT_THAT(as_vector(reader->Query(range_)), SizeIs(104));
+  EXPECT_EQ(CheckViewsMatchProtos(), 104);
+}
+
+TEST_F(ReadViewTest, WalkCigarMatchesReadProto) {
+  std::unique_ptr<SamReader> reader = MakeReader();
+  std::shared_ptr<SamIterable> reads = reader->Query(range_).ValueOrDie();
+  std::shared_ptr<SamViewIterable> views =
+      reader->QueryViews(range_).ValueOrDie();
+  using Visit = std::tuple<CigarUnit::Operation, int, int64, int>;
+  Read read;
+  ReadView view;
+  while (reads->Next(&read).ValueOrDie()) {
+    ASSERT_TRUE(views->Next(&view).ValueOrDie());
+    std::vector<Visit> read_visits, view_visits;
+    WalkCigar(read, [&read_visits](CigarUnit::Operation op, int op_len,
+                                   int64 ref_pos, int read_offset) {
+      read_visits.emplace_back(op, op_len, ref_pos, read_offset);
+      return true;
+    });
+    WalkCigar(view, [&view_visits](CigarUnit::Operation op, int op_len,
+                                   int64 ref_pos, int read_offset) {
+      view_visits.emplace_back(op, op_len, ref_pos, read_offset);
+      return true;
+    });
+    EXPECT_EQ(view_visits, read_visits);
+    EXPECT_THAT(view_visits, SizeIs(read.alignment().cigar_size()));
+  }
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
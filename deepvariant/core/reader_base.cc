@@ -44,6 +44,9 @@ Reader::~Reader() {
   if (live_iterable_ != nullptr) {
     live_iterable_->reader_ = nullptr;
   }
+  for (IterableBase* iterable : live_concurrent_iterables_) {
+    iterable->reader_ = nullptr;
+  }
 }
 
 
@@ -62,11 +65,18 @@ IterableBase::~IterableBase() {
 tensorflow::Status IterableBase::Release() {
   if (IsAlive()) {
     tensorflow::mutex_lock lock(reader_->mutex_);
-    if (reader_->live_iterable_ == nullptr) {
-      return tensorflow::errors::FailedPrecondition(
-          "reader_->live_iterable_ is null");
+    if (concurrent_) {
+      if (reader_->live_concurrent_iterables_.erase(this) == 0) {
+        return tensorflow::errors::FailedPrecondition(
+            "iterable is not in reader_->live_concurrent_iterables_");
+      }
+    } else {
+      if (reader_->live_iterable_ == nullptr) {
+        return tensorflow::errors::FailedPrecondition(
+            "reader_->live_iterable_ is null");
+      }
+      reader_->live_iterable_ = nullptr;
     }
-    reader_->live_iterable_ = nullptr;
     reader_ = nullptr;
   }
   return tensorflow::Status::OK();
@@ -34,6 +34,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <set>
 
 #include "deepvariant/vendor/statusor.h"
 #include "tensorflow/core/platform/logging.h"
@@ -45,16 +46,17 @@ namespace core {
 
 // The classes declared in this file support the functionality of a
 // "reader" class that allows iteration over records by a single
-// iterator at once.
+// iterator at once. Readers whose iterables don't share any mutable state
+// can also allow any number of concurrent iterables.
 
 // IterableBase and Reader are two base classes that are entwined as follows:
 //  - IterableBase has a reference to a reader, so that we can notify
 //    the reader when the iterable is destructed, enabling another
 //    iteration to happen.
-//  - Reader has a reference to the single live iterable, enabling it
-//    send a notification if the Reader is destructed before the
-//    iterable is.  This is important for use from Python, where we don't
-//    control the lifetimes of objects.
+//  - Reader has a reference to the single live iterable, and to each live
+//    concurrent iterable, enabling it send a notification if the Reader is
+//    destructed before the iterable is.  This is important for use from
+//    Python, where we don't control the lifetimes of objects.
 
 class IterableBase;  // Forward declaration.
 
@@ -62,7 +64,9 @@ class Reader {
  private:
   // Weak reference to live extant iterable, or null
   mutable IterableBase* live_iterable_ = nullptr;
-  // Mutex protecting live_iterable_count.
+  // Weak references to the live extant concurrent iterables.
+  mutable std::set<IterableBase*> live_concurrent_iterables_;
+  // Mutex protecting live_iterable_ and live_concurrent_iterables_.
   mutable tensorflow::mutex mutex_;
 
  protected:
@@ -80,6 +84,21 @@ class Reader {
     return std::shared_ptr<Iterable>(it);
   }
 
+  // Construct a new Iterable object that may be live at the same time as any
+  // number of other iterables of this Reader, including one created by
+  // MakeIterable. Subclasses may only use this for Iterables that don't share
+  // any mutable state (e.g., an htsFile) with other iterables, so that each
+  // can be used from a different thread.
+  template<class Iterable, typename... Args>
+  std::shared_ptr<Iterable> MakeConcurrentIterable(Args&&... args) const {
+    Iterable* it = new Iterable(std::forward<Args>(args)...);
+    IterableBase* base = it;
+    tensorflow::mutex_lock lock(mutex_);
+    base->concurrent_ = true;
+    live_concurrent_iterables_.insert(base);
+    return std::shared_ptr<Iterable>(it);
+  }
+
  public:
   virtual ~Reader();
 
@@ -90,6 +109,8 @@ class Reader {
 class IterableBase {
  protected:
   const Reader* reader_;
+  // Was this iterable created by Reader::MakeConcurrentIterable?
+  bool concurrent_ = false;
 
   explicit IterableBase(const Reader* reader);
 
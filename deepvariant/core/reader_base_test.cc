@@ -63,6 +63,10 @@ class ToyReader : public Reader {
       return MakeIterable<ToyIterable>(this, toys_, startingPos);
     }
   }
+
+  std::shared_ptr<ToyIterable> IterateConcurrentlyFrom(int startingPos = 0) {
+    return MakeConcurrentIterable<ToyIterable>(this, toys_, startingPos);
+  }
 };
 
 class ToyIterable : public Iterable<string>  {
@@ -159,6 +163,46 @@ TEST(ReaderIterableTest, TestProtectionAgainstMultipleIteration) {
   EXPECT_EQ(i, 4);
 }
 
+TEST(ReaderIterableTest, TestConcurrentIteration) {
+  ToyReader tr({"ball", "doll", "house", "legos"});
+  auto it1 = tr.IterateConcurrentlyFrom(0);
+  auto it2 = tr.IterateConcurrentlyFrom(2);
+  // A concurrent iterable doesn't block the exclusive one, or vice versa.
+  auto it3 = tr.IterateFrom(1);
+  auto it4 = tr.IterateConcurrentlyFrom(3);
+  ASSERT_NE(it1, nullptr);
+  ASSERT_NE(it2, nullptr);
+  ASSERT_NE(it3, nullptr);
+  ASSERT_NE(it4, nullptr);
+
+  string s1, s2, s3, s4;
+  ASSERT_TRUE(it1->Next(&s1).ValueOrDie());
+  ASSERT_TRUE(it2->Next(&s2).ValueOrDie());
+  ASSERT_TRUE(it3->Next(&s3).ValueOrDie());
+  ASSERT_TRUE(it4->Next(&s4).ValueOrDie());
+  EXPECT_EQ("ball", s1);
+  EXPECT_EQ("house", s2);
+  EXPECT_EQ("doll", s3);
+  EXPECT_EQ("legos", s4);
+
+  ASSERT_THAT(it1->Release(), IsOK());
+  EXPECT_THAT(it1->Next(&s1), IsNotOKWithMessage("Reader is not alive"));
+  EXPECT_TRUE(it2->Next(&s2).ValueOrDie());
+  EXPECT_EQ("legos", s2);
+}
+
+TEST(ReaderIterableTest, TestReaderDiesBeforeConcurrentIterables) {
+  std::shared_ptr<ToyIterable> it1, it2;
+  {
+    ToyReader tr({"ball", "doll", "house", "legos"});
+    it1 = tr.IterateConcurrentlyFrom(0);
+    it2 = tr.IterateConcurrentlyFrom(0);
+  }
+  string s;
+  EXPECT_THAT(it1->Next(&s), IsNotOKWithMessage("Reader is not alive"));
+  EXPECT_THAT(it2->Next(&s), IsNotOKWithMessage("Reader is not alive"));
+}
+
 TEST(ReaderIterableTest, TestExplicitRelease) {
   ToyReader tr({"ball", "doll", "house", "legos"});
   std::shared_ptr<ToyIterable> it1 = tr.IterateFrom(0);
@@ -32,6 +32,7 @@
 #include "deepvariant/core/reference.h"
 
 #include <algorithm>
+#include <utility>
 
 #include "deepvariant/core/protos/core.pb.h"
 #include "tensorflow/core/lib/strings/strcat.h"
@@ -89,6 +90,14 @@ bool GenomeReference::IsValidInterval(const Range& range) const {
          range.end() <= n_bases;
 }
 
+tensorflow::Status GenomeReference::GetBasesInto(const Range& range,
+                                              string* bases) const {
+  StatusOr<string> result = GetBases(range);
+  TF_RETURN_IF_ERROR(result.status());
+  *bases = std::move(result.ValueOrDie());
+  return tensorflow::Status::OK();
+}
+
 int64 GenomeReference::NTotalBasepairs() const {
   const auto& contigs = Contigs();
   return std::accumulate(contigs.cbegin(), contigs.cend(),
@@ -119,6 +119,14 @@ class GenomeReference {
   virtual StatusOr<string> GetBases(
       const learning::genomics::v1::Range& range) const = 0;
 
+  // Gets the basepairs from Range range into bases, exactly like GetBases(),
+  // replacing its contents. Callers fetching many small intervals can reuse a
+  // single string across calls, which implementations that decode bases
+  // directly into it use to avoid allocating a new string each time. The
+  // default implementation copies the result of GetBases().
+  virtual tensorflow::Status GetBasesInto(
+      const learning::genomics::v1::Range& range, string* bases) const;
+
   // Returns true iff the Range chr:start-end is a valid interval on chr and chr
   // is a known contig in this reference.
   bool IsValidInterval(const learning::genomics::v1::Range& range) const;
@@ -0,0 +1,470 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/reference_2bit.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::v1::Range;
+using tensorflow::uint32;
+using tensorflow::uint64;
+using tensorflow::uint8;
+using tensorflow::strings::StrCat;
+
+namespace {
+
+// The first word of a 2bit file, which also tells us its byte order.
+constexpr uint32 kTwoBitSignature = 0x1A412743;
+constexpr uint32 kTwoBitVersion = 0;
+
+// The bases in the order of their 2bit codes.
+constexpr char kTwoBitBases[] = "TCAG";
+
+// The number of bases we fetch at a time when writing a 2bit file. Must be a
+// multiple of 4, so each fetch packs into whole bytes.
+constexpr int64 kWriteChunkSize = 1 << 20;
+
+// Returns the 2bit code of base, which must be one of A, C, G, or T.
+uint8 TwoBitCode(char base) {
+  switch (base) {
+    case 'C': return 1;
+    case 'A': return 2;
+    case 'G': return 3;
+    default: return 0;
+  }
+}
+
+bool IsACGT(char base) {
+  return base == 'A' || base == 'C' || base == 'G' || base == 'T';
+}
+
+// A table of the four bases packed into each possible byte, so we can decode
+// a byte at a time.
+struct DecodingTable {
+  char bases[256][4];
+
+  DecodingTable() {
+    for (int byte = 0; byte < 256; ++byte) {
+      for (int i = 0; i < 4; ++i) {
+        bases[byte][i] = kTwoBitBases[(byte >> (6 - 2 * i)) & 3];
+      }
+    }
+  }
+};
+
+const DecodingTable& GetDecodingTable() {
+  static const DecodingTable* const table = new DecodingTable();
+  return *table;
+}
+
+uint32 ByteSwap(uint32 value) {
+  return ((value & 0xff) << 24) | ((value & 0xff00) << 8) |
+         ((value >> 8) & 0xff00) | (value >> 24);
+}
+
+// Reads the words of a mapped 2bit file, in its byte order, checking that we
+// stay within the file.
+class TwoBitParser {
+ public:
+  TwoBitParser(const char* data, size_t size) : data_(data), size_(size) {}
+
+  // Reads the word at offset into value, returning false if it's past the end
+  // of the file.
+  bool ReadWord(uint64 offset, uint32* value) const {
+    if (offset + sizeof(uint32) > size_) return false;
+    std::memcpy(value, data_ + offset, sizeof(uint32));
+    if (swap_) *value = ByteSwap(*value);
+    return true;
+  }
+
+  void set_swap(bool swap) { swap_ = swap; }
+
+ private:
+  const char* data_;
+  const size_t size_;
+  bool swap_ = false;
+};
+
+// Writes value to file in our native byte order, which our signature records.
+bool WriteWord(uint32 value, FILE* file) {
+  return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+}  // namespace
+
+StatusOr<std::unique_ptr<GenomeReference2Bit>> GenomeReference2Bit::FromFile(
+    const string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return tensorflow::errors::NotFound(StrCat("Could not open ", path));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return tensorflow::errors::Unknown(StrCat("Could not stat ", path));
+  }
+  const size_t size = file_stat.st_size;
+  void* mapped = size == 0 ? MAP_FAILED
+                           : mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid after we close our descriptor.
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return tensorflow::errors::Unknown(StrCat("Could not mmap ", path));
+  }
+  const char* data = static_cast<const char*>(mapped);
+  const auto corrupt = [&path, mapped, size](const string& what) {
+    munmap(mapped, size);
+    return tensorflow::errors::DataLoss(
+        StrCat("Malformed 2bit file ", path, ": ", what));
+  };
+
+  TwoBitParser parser(data, size);
+  uint32 signature, version, n_contigs;
+  if (!parser.ReadWord(0, &signature)) return corrupt("truncated header");
+  if (signature != kTwoBitSignature) {
+    if (ByteSwap(signature) != kTwoBitSignature) {
+      return corrupt("bad signature");
+    }
+    parser.set_swap(true);
+  }
+  if (!parser.ReadWord(4, &version) || !parser.ReadWord(8, &n_contigs)) {
+    return corrupt("truncated header");
+  }
+  if (version != kTwoBitVersion) {
+    return corrupt(StrCat("unsupported version ", version));
+  }
+
+  // The index of contigs follows our 16 byte header, and has at least a
+  // length byte and an offset word for each contig, so a count that can't
+  // fit in the file is rejected before we allocate for it.
+  uint64 index_offset = 16;
+  if (index_offset + 5 * static_cast<uint64>(n_contigs) > size) {
+    return corrupt("truncated index");
+  }
+  std::vector<ContigInfo> contigs(n_contigs);
+  std::vector<PackedContig> packed_contigs(n_contigs);
+  for (uint32 i = 0; i < n_contigs; ++i) {
+    if (index_offset >= size) return corrupt("truncated index");
+    const uint8 name_length = data[index_offset];
+    uint32 offset;
+    if (!parser.ReadWord(index_offset + 1 + name_length, &offset)) {
+      return corrupt("truncated index");
+    }
+    ContigInfo& contig = contigs[i];
+    contig.set_name(string(data + index_offset + 1, name_length));
+    contig.set_description("");
+    contig.set_pos_in_fasta(i);
+    index_offset += 1 + name_length + sizeof(uint32);
+
+    // Each contig's record is its number of bases, its blocks of Ns, its
+    // blocks of soft-masked bases, a reserved word, and then its packed bases.
+    uint32 n_bases, n_block_count, mask_block_count;
+    if (!parser.ReadWord(offset, &n_bases) ||
+        !parser.ReadWord(offset + 4, &n_block_count)) {
+      return corrupt(StrCat("truncated record for ", contig.name()));
+    }
+    contig.set_n_bases(n_bases);
+    const uint64 n_starts = offset + 8;
+    const uint64 n_sizes = n_starts + 4 * static_cast<uint64>(n_block_count);
+    const uint64 mask_offset = n_sizes + 4 * static_cast<uint64>(n_block_count);
+    // Check that the N blocks are all in the file before reserving room for
+    // them, so a corrupt count can't make us allocate gigabytes.
+    if (mask_offset > size) {
+      return corrupt(StrCat("truncated N blocks for ", contig.name()));
+    }
+    PackedContig& packed = packed_contigs[i];
+    packed.n_blocks.reserve(n_block_count);
+    for (uint32 j = 0; j < n_block_count; ++j) {
+      uint32 start, length;
+      if (!parser.ReadWord(n_starts + 4 * j, &start) ||
+          !parser.ReadWord(n_sizes + 4 * j, &length)) {
+        return corrupt(StrCat("truncated N blocks for ", contig.name()));
+      }
+      packed.n_blocks.emplace_back(start, static_cast<int64>(start) + length);
+    }
+    if (!parser.ReadWord(mask_offset, &mask_block_count)) {
+      return corrupt(StrCat("truncated mask blocks for ", contig.name()));
+    }
+    // Skip the mask block starts and sizes and the reserved word.
+    const uint64 bases_offset =
+        mask_offset + 4 + 8 * static_cast<uint64>(mask_block_count) + 4;
+    if (bases_offset + (n_bases + 3) / 4 > size) {
+      return corrupt(StrCat("truncated bases for ", contig.name()));
+    }
+    packed.packed_bases = reinterpret_cast<const uint8*>(data + bases_offset);
+    // GetBasesInto() depends on our N blocks being sorted, as faToTwoBit
+    // writes them.
+    std::sort(packed.n_blocks.begin(), packed.n_blocks.end());
+  }
+
+  return std::unique_ptr<GenomeReference2Bit>(
+      new GenomeReference2Bit(path, data, size, std::move(contigs),
+                              std::move(packed_contigs)));
+}
+
+tensorflow::Status GenomeReference2Bit::WriteFile(
+    const GenomeReference& reference, const string& path) {
+  const std::vector<ContigInfo>& contigs = reference.Contigs();
+
+  // Find the blocks of Ns in each contig first, as the size of each record in
+  // the file depends on them.
+  std::vector<std::vector<std::pair<uint32, uint32>>> n_blocks(contigs.size());
+  for (size_t i = 0; i < contigs.size(); ++i) {
+    const ContigInfo& contig = contigs[i];
+    if (contig.name().size() > 255) {
+      return tensorflow::errors::InvalidArgument(
+          StrCat("2bit contig names are limited to 255 characters: ",
+                 contig.name()));
+    }
+    if (contig.n_bases() > std::numeric_limits<uint32>::max()) {
+      return tensorflow::errors::InvalidArgument(
+          StrCat("Contig ", contig.name(), " is too long for a 2bit file"));
+    }
+    for (int64 start = 0; start < contig.n_bases(); start += kWriteChunkSize) {
+      const int64 end = std::min(start + kWriteChunkSize, contig.n_bases());
+      StatusOr<string> bases =
+          reference.GetBases(MakeRange(contig.name(), start, end));
+      TF_RETURN_IF_ERROR(bases.status());
+      const string& chunk = bases.ValueOrDie();
+      for (int64 j = 0; j < end - start; ++j) {
+        if (IsACGT(chunk[j])) continue;
+        const uint32 pos = start + j;
+        std::vector<std::pair<uint32, uint32>>& blocks = n_blocks[i];
+        if (!blocks.empty() &&
+            blocks.back().first + blocks.back().second == pos) {
+          ++blocks.back().second;
+        } else {
+          blocks.emplace_back(pos, 1);
+        }
+      }
+    }
+  }
+
+  // Lay out our header, the index, and then the record of each contig.
+  uint64 offset = 16;
+  for (const ContigInfo& contig : contigs) {
+    offset += 1 + contig.name().size() + 4;
+  }
+  std::vector<uint32> record_offsets;
+  for (size_t i = 0; i < contigs.size(); ++i) {
+    if (offset > std::numeric_limits<uint32>::max()) {
+      return tensorflow::errors::InvalidArgument(
+          StrCat("Reference is too large for a 2bit file: ",
+                 reference.FastaPath()));
+    }
+    record_offsets.push_back(offset);
+    offset += 16 + 8 * n_blocks[i].size() + (contigs[i].n_bases() + 3) / 4;
+  }
+
+  // We write to a temporary file that we then rename to path, as other
+  // processes may still have an older file at path mapped into memory, and
+  // would crash if we truncated it under them.
+  const string tmp_path = StrCat(path, ".tmp");
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    return tensorflow::errors::Unknown(StrCat("Could not open ", tmp_path));
+  }
+  const auto write_failed = [&tmp_path, file]() {
+    fclose(file);
+    remove(tmp_path.c_str());
+    return tensorflow::errors::DataLoss(StrCat("Failed to write ", tmp_path));
+  };
+  if (!WriteWord(kTwoBitSignature, file) || !WriteWord(kTwoBitVersion, file) ||
+      !WriteWord(contigs.size(), file) || !WriteWord(0, file)) {
+    return write_failed();
+  }
+  for (size_t i = 0; i < contigs.size(); ++i) {
+    const string& name = contigs[i].name();
+    if (fputc(name.size(), file) == EOF ||
+        fwrite(name.data(), 1, name.size(), file) != name.size() ||
+        !WriteWord(record_offsets[i], file)) {
+      return write_failed();
+    }
+  }
+
+  std::vector<uint8> packed(kWriteChunkSize / 4);
+  for (size_t i = 0; i < contigs.size(); ++i) {
+    const ContigInfo& contig = contigs[i];
+    if (!WriteWord(contig.n_bases(), file) ||
+        !WriteWord(n_blocks[i].size(), file)) {
+      return write_failed();
+    }
+    for (const auto& block : n_blocks[i]) {
+      if (!WriteWord(block.first, file)) return write_failed();
+    }
+    for (const auto& block : n_blocks[i]) {
+      if (!WriteWord(block.second, file)) return write_failed();
+    }
+    // No soft-masked blocks, and the reserved word.
+    if (!WriteWord(0, file) || !WriteWord(0, file)) return write_failed();
+
+    for (int64 start = 0; start < contig.n_bases(); start += kWriteChunkSize) {
+      const int64 end = std::min(start + kWriteChunkSize, contig.n_bases());
+      StatusOr<string> bases =
+          reference.GetBases(MakeRange(contig.name(), start, end));
+      if (!bases.ok()) {
+        fclose(file);
+        remove(tmp_path.c_str());
+        return bases.status();
+      }
+      const string& chunk = bases.ValueOrDie();
+      const int64 n_bytes = (end - start + 3) / 4;
+      std::fill(packed.begin(), packed.begin() + n_bytes, 0);
+      for (int64 j = 0; j < end - start; ++j) {
+        packed[j / 4] |= TwoBitCode(chunk[j]) << (6 - 2 * (j % 4));
+      }
+      if (fwrite(packed.data(), 1, n_bytes, file) !=
+          static_cast<size_t>(n_bytes)) {
+        return write_failed();
+      }
+    }
+  }
+  if (fclose(file) != 0) {
+    remove(tmp_path.c_str());
+    return tensorflow::errors::DataLoss(StrCat("Failed to close ", tmp_path));
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+    return tensorflow::errors::Unknown(StrCat("Could not create ", path));
+  }
+  return tensorflow::Status::OK();
+}
+
+GenomeReference2Bit::GenomeReference2Bit(
+    const string& path, const char* data, size_t size,
+    std::vector<ContigInfo> contigs, std::vector<PackedContig> packed_contigs)
+    : path_(path),
+      data_(data),
+      size_(size),
+      contigs_(std::move(contigs)),
+      packed_contigs_(std::move(packed_contigs)) {}
+
+GenomeReference2Bit::~GenomeReference2Bit() {
+  if (data_) {
+    TF_CHECK_OK(Close());
+  }
+}
+
+StatusOr<string> GenomeReference2Bit::GetBases(const Range& range) const {
+  string bases;
+  TF_RETURN_IF_ERROR(GetBasesInto(range, &bases));
+  return bases;
+}
+
+tensorflow::Status GenomeReference2Bit::GetBasesInto(const Range& range,
+                                                     string* bases) const {
+  if (data_ == nullptr) {
+    return tensorflow::errors::FailedPrecondition(
+        "can't read from closed GenomeReference2Bit object.");
+  }
+  if (!IsValidInterval(range))
+    return tensorflow::errors::InvalidArgument(
+      StrCat("Invalid interval: ", range.ShortDebugString()));
+
+  const PackedContig& contig =
+      packed_contigs_[Contig(range.reference_name()).ValueOrDie()
+                          ->pos_in_fasta()];
+  const uint8* packed = contig.packed_bases;
+  const int64 start = range.start();
+  const int64 end = range.end();
+  bases->resize(end - start);
+  char* out = &(*bases)[0];
+
+  // Decode any bases before the first whole byte one at a time, then whole
+  // bytes with our table, then any remaining bases.
+  int64 pos = start;
+  for (; pos < end && pos % 4 != 0; ++pos) {
+    *out++ = kTwoBitBases[(packed[pos / 4] >> (6 - 2 * (pos % 4))) & 3];
+  }
+  const DecodingTable& table = GetDecodingTable();
+  for (; pos + 4 <= end; pos += 4) {
+    std::memcpy(out, table.bases[packed[pos / 4]], 4);
+    out += 4;
+  }
+  for (; pos < end; ++pos) {
+    *out++ = kTwoBitBases[(packed[pos / 4] >> (6 - 2 * (pos % 4))) & 3];
+  }
+
+  // Mask the bases in any N blocks overlapping range, starting with the first
+  // that ends after start.
+  auto block = std::upper_bound(
+      contig.n_blocks.begin(), contig.n_blocks.end(), start,
+      [](int64 pos, const std::pair<int64, int64>& block) {
+        return pos < block.second;
+      });
+  for (; block != contig.n_blocks.end() && block->first < end; ++block) {
+    const int64 n_start = std::max(block->first, start);
+    const int64 n_end = std::min(block->second, end);
+    std::fill(bases->begin() + (n_start - start),
+              bases->begin() + (n_end - start), 'N');
+  }
+  return tensorflow::Status::OK();
+}
+
+string GenomeReference2Bit::Info() const {
+  return "GenomeReference backed by a memory-mapped 2bit file";
+}
+
+tensorflow::Status GenomeReference2Bit::Close() {
+  if (data_ == nullptr) {
+    return tensorflow::errors::FailedPrecondition(
+        "GenomeReference2Bit already closed");
+  }
+  const int retval = munmap(const_cast<char*>(data_), size_);
+  data_ = nullptr;
+  if (retval != 0) {
+    return tensorflow::errors::Internal(StrCat("munmap() failed for ", path_));
+  }
+  return tensorflow::Status::OK();
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of GenomeReference class reading a memory-mapped 2bit file.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_REFERENCE_2BIT_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_REFERENCE_2BIT_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "deepvariant/core/reference.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using tensorflow::string;
+
+// A reference genome reader backed by a memory-mapped file in the UCSC 2bit
+// format:
+//
+// https://genome.ucsc.edu/FAQ/FAQformat.html#format7
+//
+// A 2bit file stores each base of each contig in two bits, with a list of the
+// blocks of N bases in each contig, so a human genome takes up about 800MB
+// rather than the 3GB of its FASTA. We map the whole file read-only into
+// memory, so opening one costs almost nothing, as there is no FASTA or index
+// to parse, and all of the processes reading the same file on a machine share
+// one copy of it in the page cache. GetBases() decodes bases directly from the
+// mapped file, without any reads through htslib or any cache to maintain, so
+// this reader is also safe to use from multiple threads at once.
+//
+// 2bit files can be created with UCSC's faToTwoBit, or from any other
+// GenomeReference with WriteFile() below. The format only encodes the bases
+// A, C, G, T, and N: like faToTwoBit, WriteFile() stores any other IUPAC code
+// in the FASTA as an N. The soft-masking blocks of a 2bit file are ignored, as
+// our bases are always upper-cased.
+class GenomeReference2Bit : public GenomeReference {
+ public:
+  // Creates a new GenomeReference reading the 2bit file at path, which must be
+  // on a local filesystem that supports mmap().
+  static StatusOr<std::unique_ptr<GenomeReference2Bit>> FromFile(
+      const string& path);
+
+  // Writes the bases of all of the contigs of reference, in order, to a new
+  // 2bit file at path.
+  static tensorflow::Status WriteFile(const GenomeReference& reference,
+                                      const string& path);
+
+  ~GenomeReference2Bit();
+
+  // Disable copy and assignment operations
+  GenomeReference2Bit(const GenomeReference2Bit& other) = delete;
+  GenomeReference2Bit& operator=(const GenomeReference2Bit&) = delete;
+
+  // Gets the path to the 2bit file used by this GenomeReference.
+  const string& FastaPath() const override { return path_; }
+
+  // Gets a human-readable string describing this GenomeReference.
+  string Info() const override;
+
+  const std::vector<ContigInfo>& Contigs() const override { return contigs_; }
+
+  StatusOr<string> GetBases(
+      const learning::genomics::v1::Range& range) const override;
+
+  tensorflow::Status GetBasesInto(const learning::genomics::v1::Range& range,
+                                  string* bases) const override;
+
+  // Unmaps our file.
+  tensorflow::Status Close() override;
+
+ private:
+  // The location of the bases of a contig in our mapped file.
+  struct PackedContig {
+    // The packed bases of the contig, four to a byte.
+    const tensorflow::uint8* packed_bases;
+    // The sorted, non-overlapping [start, end) intervals of N bases.
+    std::vector<std::pair<int64, int64>> n_blocks;
+  };
+
+  // Must use the static factory method.
+  GenomeReference2Bit(const string& path, const char* data, size_t size,
+                      std::vector<ContigInfo> contigs,
+                      std::vector<PackedContig> packed_contigs);
+
+  // Path to our 2bit file.
+  const string path_;
+
+  // Our memory-mapped file, or null once closed.
+  const char* data_;
+  size_t size_;
+
+  // A list of ContigInfo, each of which contains the information about the
+  // contigs in our file, with the location of their bases in packed_contigs_.
+  const std::vector<ContigInfo> contigs_;
+  const std::vector<PackedContig> packed_contigs_;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_REFERENCE_2BIT_H_
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/reference_2bit.h"
+
+#include <cstdio>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "deepvariant/core/reference_fai.h"
+#include "deepvariant/core/reference_test.h"
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/vendor/status_matchers.h"
+
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+using std::make_pair;
+using tensorflow::strings::StrCat;
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// Converts the FASTA at fasta into a 2bit file, returning its path.
+static string WriteTwoBit(const string& fasta) {
+  StatusOr<std::unique_ptr<GenomeReferenceFai>> fai =
+      GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"));
+  TF_CHECK_OK(fai.status());
+  const string path = MakeTempFile("test.2bit");
+  TF_CHECK_OK(GenomeReference2Bit::WriteFile(*fai.ValueOrDie(), path));
+  return path;
+}
+
+// The 2bit reader doesn't have a cache, so cache_size is ignored.
+static std::unique_ptr<GenomeReference> JustLoadTwoBit(const string& fasta,
+                                                       int cache_size) {
+  StatusOr<std::unique_ptr<GenomeReference2Bit>> two_bit =
+      GenomeReference2Bit::FromFile(WriteTwoBit(fasta));
+  TF_CHECK_OK(two_bit.status());
+  return std::move(two_bit.ValueOrDie());
+}
+
+INSTANTIATE_TEST_CASE_P(GRT1, GenomeReferenceTest,
+                        ::testing::Values(make_pair(&JustLoadTwoBit, 0)));
+
+INSTANTIATE_TEST_CASE_P(GRT2, GenomeReferenceDeathTest,
+                        ::testing::Values(make_pair(&JustLoadTwoBit, 0)));
+
+TEST(ReferenceTwoBitTest, MatchesFaiOnAllIntervals) {
+  const string fasta = TestFastaPath();
+  std::unique_ptr<GenomeReferenceFai> fai = std::move(
+      GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"), 0)
+          .ValueOrDie());
+  std::unique_ptr<GenomeReference2Bit> two_bit = std::move(
+      GenomeReference2Bit::FromFile(WriteTwoBit(fasta)).ValueOrDie());
+  ASSERT_EQ(fai->Contigs().size(), two_bit->Contigs().size());
+
+  // Every interval, so we cover every alignment of start and end within the
+  // packed bytes, along with the N in chr2 and the lower-case bases in chrM.
+  string bases;
+  for (const ContigInfo& contig : fai->Contigs()) {
+    for (int64 start = 0; start < contig.n_bases(); ++start) {
+      for (int64 end = start + 1; end <= contig.n_bases(); ++end) {
+        const Range range = MakeRange(contig.name(), start, end);
+        const string expected = fai->GetBases(range).ValueOrDie();
+        EXPECT_EQ(expected, two_bit->GetBases(range).ValueOrDie());
+        ASSERT_THAT(two_bit->GetBasesInto(range, &bases), IsOK());
+        EXPECT_EQ(expected, bases);
+      }
+    }
+  }
+}
+
+TEST(ReferenceTwoBitTest, ReturnsBadStatusIfFileIsMissing) {
+  EXPECT_THAT(GenomeReference2Bit::FromFile(GetTestData("missing.2bit")),
+              IsNotOKWithCodeAndMessage(tensorflow::error::NOT_FOUND,
+                                        "Could not open"));
+}
+
+TEST(ReferenceTwoBitTest, ReturnsBadStatusIfFileIsMalformed) {
+  // A FASTA isn't a 2bit file.
+  EXPECT_THAT(GenomeReference2Bit::FromFile(TestFastaPath()),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "bad signature"));
+
+  // Nor is a truncated one.
+  const string two_bit = WriteTwoBit(TestFastaPath());
+  const string truncated = MakeTempFile("truncated.2bit");
+  {
+    FILE* in = fopen(two_bit.c_str(), "rb");
+    FILE* out = fopen(truncated.c_str(), "wb");
+    ASSERT_NE(in, nullptr);
+    ASSERT_NE(out, nullptr);
+    char buffer[48];
+    ASSERT_EQ(sizeof(buffer), fread(buffer, 1, sizeof(buffer), in));
+    ASSERT_EQ(sizeof(buffer), fwrite(buffer, 1, sizeof(buffer), out));
+    fclose(in);
+    fclose(out);
+  }
+  EXPECT_THAT(GenomeReference2Bit::FromFile(truncated),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "Malformed 2bit file"));
+}
+
+// Writes a 2bit file of words, in our native byte order, to path.
+static void WriteWords(const string& path,
+                       const std::vector<tensorflow::uint32>& words) {
+  FILE* out = fopen(path.c_str(), "wb");
+  CHECK(out != nullptr);
+  CHECK_EQ(words.size(),
+           fwrite(words.data(), sizeof(words[0]), words.size(), out));
+  fclose(out);
+}
+
+TEST(ReferenceTwoBitTest, RejectsCountsLargerThanTheFile) {
+  // The signature, version, far more contigs than the file holds, and the
+  // reserved word.
+  const string many_contigs = MakeTempFile("many_contigs.2bit");
+  WriteWords(many_contigs, {0x1A412743, 0, 0xFFFFFFFF, 0});
+  EXPECT_THAT(GenomeReference2Bit::FromFile(many_contigs),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "truncated index"));
+
+  // One contig, named "chr" by the little-endian bytes 3, c, h, r, whose
+  // record at offset 24 claims far more blocks of Ns than the file holds.
+  const string many_n_blocks = MakeTempFile("many_n_blocks.2bit");
+  WriteWords(many_n_blocks, {0x1A412743, 0, 1, 0, 0x72686303, 24, 4,
+                             0xFFFFFFFF});
+  EXPECT_THAT(GenomeReference2Bit::FromFile(many_n_blocks),
+              IsNotOKWithCodeAndMessage(tensorflow::error::DATA_LOSS,
+                                        "truncated N blocks for chr"));
+}
+
+TEST(ReferenceTwoBitTest, ReadAfterCloseIsntOK) {
+  auto reader = JustLoadTwoBit(TestFastaPath(), 0);
+  ASSERT_THAT(reader->Close(), IsOK());
+  EXPECT_THAT(reader->GetBases(MakeRange("chrM", 0, 100)),
+              IsNotOKWithCodeAndMessage(
+                  tensorflow::error::FAILED_PRECONDITION,
+                  "can't read from closed GenomeReference2Bit object"));
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -32,12 +32,12 @@
 #include "deepvariant/core/reference_fai.h"
 
 #include <algorithm>
+#include <utility>
 
 #include "deepvariant/core/hts_path.h"
 #include "deepvariant/core/protos/core.pb.h"
 #include "deepvariant/core/utils.h"
 #include "htslib/tbx.h"
-#include "tensorflow/core/lib/gtl/optional.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/lib/strings/str_util.h"
 #include "tensorflow/core/platform/logging.h"
@@ -69,7 +69,8 @@ std::vector<ContigInfo> ExtractContigsFromFai(const faidx_t* faidx) {
 }  // namespace
 
 StatusOr<std::unique_ptr<GenomeReferenceFai>> GenomeReferenceFai::FromFile(
-    const string& fasta_path, const string& fai_path, int cache_size_bases) {
+    const string& fasta_path, const string& fai_path, int cache_size_bases,
+    int num_cache_blocks) {
   const string gzi = fasta_path + ".gzi";
   faidx_t* faidx =
       fai_load3_x(fasta_path.c_str(), fai_path.c_str(), gzi.c_str(), 0);
@@ -77,18 +78,18 @@ StatusOr<std::unique_ptr<GenomeReferenceFai>> GenomeReferenceFai::FromFile(
     return tensorflow::errors::NotFound(
         StrCat("could not load fasta and/or fai for fasta ", fasta_path));
   }
-  return std::unique_ptr<GenomeReferenceFai>(
-      new GenomeReferenceFai(fasta_path, faidx, cache_size_bases));
+  return std::unique_ptr<GenomeReferenceFai>(new GenomeReferenceFai(
+      fasta_path, faidx, cache_size_bases, num_cache_blocks));
 }
 
-GenomeReferenceFai::GenomeReferenceFai(
-    const string& fasta_path, faidx_t* faidx, int cache_size_bases)
+GenomeReferenceFai::GenomeReferenceFai(const string& fasta_path,
+                                       faidx_t* faidx, int cache_size_bases,
+                                       int num_cache_blocks)
     : fasta_path_(fasta_path),
       faidx_(faidx),
       contigs_(ExtractContigsFromFai(faidx)),
       cache_size_bases_(cache_size_bases),
-      small_read_cache_(),
-      cached_range_() {}
+      num_cache_blocks_(num_cache_blocks) {}
 
 GenomeReferenceFai::~GenomeReferenceFai() {
   if (faidx_) {
@@ -96,40 +97,7 @@ GenomeReferenceFai::~GenomeReferenceFai() {
   }
 }
 
-StatusOr<string> GenomeReferenceFai::GetBases(const Range& range) const {
-  if (faidx_ == nullptr) {
-    return tensorflow::errors::FailedPrecondition(
-        "can't read from closed GenomeReferenceFai object.");
-  }
-  if (!IsValidInterval(range))
-    return tensorflow::errors::InvalidArgument(
-      StrCat("Invalid interval: ", range.ShortDebugString()));
-
-  bool use_cache = (cache_size_bases_ > 0) &&
-      (range.end() - range.start() <= cache_size_bases_);
-  Range range_to_fetch;
-
-  if (use_cache) {
-      if (cached_range_ && RangeContains(*cached_range_, range)) {
-        // Get from cache!
-        string result = small_read_cache_.substr(
-            range.start() - cached_range_->start(),
-            range.end() - range.start());
-        return result;
-      } else {
-        // Prepare to fetch a sizeable chunk from the FASTA.
-        int64 contig_n_bases =
-            Contig(range.reference_name()).ValueOrDie()->n_bases();
-        range_to_fetch = MakeRange(
-            range.reference_name(), range.start(),
-            std::min(static_cast<int64>(range.start() + cache_size_bases_),
-                     contig_n_bases));
-        CHECK(IsValidInterval(range_to_fetch));
-      }
-  } else {
-    range_to_fetch = range;
-  }
-
+StatusOr<string> GenomeReferenceFai::FetchBases(const Range& range) const {
   // According to htslib docs, faidx_fetch_seq c_name is the contig name,
   // start is the first base (zero-based) to include and end is the last base
   // (zero-based) to include. Len is an output variable returning the length
@@ -138,29 +106,88 @@ StatusOr<string> GenomeReferenceFai::GetBases(const Range& range) const {
   // since end is exclusive in GenomeReference but faidx has an inclusive one.
   int len;
   char* bases = faidx_fetch_seq(
-      faidx_, range_to_fetch.reference_name().c_str(),
-      range_to_fetch.start(), range_to_fetch.end() - 1, &len);
+      faidx_, range.reference_name().c_str(),
+      range.start(), range.end() - 1, &len);
   if (len <= 0)
     return tensorflow::errors::InvalidArgument(
         StrCat("Couldn't fetch bases for ", range.ShortDebugString()));
   string result = tensorflow::str_util::Uppercase(bases);
   free(bases);
+  return result;
+}
 
-  if (use_cache) {
-    // Update cache.
-    small_read_cache_ = result;
-    cached_range_ = range_to_fetch;
-    // Return the requested substring.
-    result = small_read_cache_.substr(0, range.end() - range.start());
+StatusOr<const string*> GenomeReferenceFai::GetBlock(
+    const ContigInfo& contig, const int64 block_index) const {
+  const BlockKey key(contig.pos_in_fasta(), block_index);
+  const auto found = block_index_.find(key);
+  if (found != block_index_.end()) {
+    ++cache_hits_;
+    // Move the block to the front, as our most recently used.
+    cached_blocks_.splice(cached_blocks_.begin(), cached_blocks_,
+                          found->second);
+    return &found->second->second;
+  }
+
+  ++cache_misses_;
+  const int64 start = block_index * cache_size_bases_;
+  StatusOr<string> bases = FetchBases(MakeRange(
+      contig.name(), start,
+      std::min<int64>(start + cache_size_bases_, contig.n_bases())));
+  TF_RETURN_IF_ERROR(bases.status());
+  const int max_blocks = std::max(num_cache_blocks_, 1);
+  if (static_cast<int>(cached_blocks_.size()) >= max_blocks) {
+    // Evict our least recently used block.
+    block_index_.erase(cached_blocks_.back().first);
+    cached_blocks_.pop_back();
+  }
+  cached_blocks_.emplace_front(key, std::move(bases.ValueOrDie()));
+  block_index_[key] = cached_blocks_.begin();
+  return &cached_blocks_.front().second;
+}
+
+StatusOr<string> GenomeReferenceFai::GetBases(const Range& range) const {
+  tensorflow::mutex_lock lock(mutex_);
+  if (faidx_ == nullptr) {
+    return tensorflow::errors::FailedPrecondition(
+        "can't read from closed GenomeReferenceFai object.");
+  }
+  if (!IsValidInterval(range))
+    return tensorflow::errors::InvalidArgument(
+      StrCat("Invalid interval: ", range.ShortDebugString()));
+
+  const bool use_cache = (cache_size_bases_ > 0) &&
+      (range.end() - range.start() <= cache_size_bases_);
+  if (!use_cache) return FetchBases(range);
+
+  // Our range spans at most two blocks, since it is no longer than a block.
+  const ContigInfo& contig = *Contig(range.reference_name()).ValueOrDie();
+  string result;
+  result.reserve(range.end() - range.start());
+  for (int64 block_index = range.start() / cache_size_bases_;
+       block_index * cache_size_bases_ < range.end(); ++block_index) {
+    StatusOr<const string*> block = GetBlock(contig, block_index);
+    TF_RETURN_IF_ERROR(block.status());
+    const int64 block_start = block_index * cache_size_bases_;
+    const int64 start =
+        std::max<int64>(range.start(), block_start) - block_start;
+    const int64 end =
+        std::min<int64>(range.end() - block_start, cache_size_bases_);
+    result.append(*block.ValueOrDie(), start, end - start);
   }
   return result;
 }
 
 string GenomeReferenceFai::Info() const {
-  return "GenomeReference backed by htslib FAI index";
+  tensorflow::mutex_lock lock(mutex_);
+  return StrCat("GenomeReference backed by htslib FAI index, with a cache of ",
+                num_cache_blocks_, " blocks of ", cache_size_bases_,
+                " bases: ", cache_hits_, " hits, ", cache_misses_, " misses");
 }
 
 tensorflow::Status GenomeReferenceFai::Close() {
+  tensorflow::mutex_lock lock(mutex_);
+  cached_blocks_.clear();
+  block_index_.clear();
   if (faidx_ == nullptr) {
     return tensorflow::errors::FailedPrecondition(
         "GenomeReferenceFai already closed");
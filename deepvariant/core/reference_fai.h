@@ -33,12 +33,15 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_REFERENCE_FAI_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_CORE_REFERENCE_FAI_H_
 
+#include <list>
+#include <map>
+#include <utility>
 #include <vector>
 
 #include "deepvariant/core/reference.h"
 #include "deepvariant/vendor/statusor.h"
 #include "htslib/faidx.h"
-#include "tensorflow/core/lib/gtl/optional.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace learning {
@@ -46,6 +49,7 @@ namespace genomics {
 namespace core {
 
 constexpr int REFERENCE_FAI_DEFAULT_CACHE_SIZE = 64 * 1024;
+constexpr int REFERENCE_FAI_DEFAULT_CACHE_BLOCKS = 16;
 
 using tensorflow::string;
 
@@ -85,14 +89,23 @@ class GenomeReferenceFai : public GenomeReference {
   // htslib currently assumes that the FAI file is named fasta_path + '.fai',
   // so that file must exist and be readable by htslib.
   //
-  // We maintain a single entry cache of the bases from the last FASTA fetch, to
-  // reduce the number of file reads, which can be quite costly for remote
-  // filesystems.  64K is the default block size for htslib faidx fetches, so
-  // there is no penalty to rounding up all small access sizes to 64K.  The
-  // cache can be disabled using `cache_size=0`.
+  // We maintain an LRU cache of up to num_cache_blocks blocks of bases from
+  // the FASTA, to reduce the number of file reads, which can be quite costly
+  // for remote filesystems and for block-gzipped FASTAs, which must reinflate
+  // the BGZF blocks of each read. Each cache block holds the cache_size_bases
+  // bases of a contig starting at a multiple of cache_size_bases, so the
+  // overlapping windows fetched by different clients, such as the realigner
+  // and the pileup image encoder, share blocks. 64K is the default block size
+  // for htslib faidx fetches, so there is no penalty to rounding up all small
+  // access sizes to 64K. Queries for more than cache_size_bases bases bypass
+  // the cache. The cache can be disabled using `cache_size_bases=0`.
+  //
+  // The cache is guarded by a mutex, so a GenomeReferenceFai can be used from
+  // multiple threads at once.
   static StatusOr<std::unique_ptr<GenomeReferenceFai>> FromFile(
       const string& fasta_path, const string& fai_path,
-      int cache_size_bases = REFERENCE_FAI_DEFAULT_CACHE_SIZE);
+      int cache_size_bases = REFERENCE_FAI_DEFAULT_CACHE_SIZE,
+      int num_cache_blocks = REFERENCE_FAI_DEFAULT_CACHE_BLOCKS);
 
   ~GenomeReferenceFai();
 
@@ -103,7 +116,8 @@ class GenomeReferenceFai : public GenomeReference {
   // Gets the path to the fasta file used by this GenomeReference.
   const string& FastaPath() const override { return fasta_path_; }
 
-  // Gets a human-readable string describing this GenomeReference.
+  // Gets a human-readable string describing this GenomeReference, including
+  // the hits and misses of our cache.
   string Info() const override;
 
   const std::vector<ContigInfo>& Contigs() const override { return contigs_; }
@@ -115,9 +129,23 @@ class GenomeReferenceFai : public GenomeReference {
   tensorflow::Status Close() override;
 
  private:
+  // A cached block of bases, keyed by its contig's index and its block index.
+  typedef std::pair<int, int64> BlockKey;
+  typedef std::list<std::pair<BlockKey, string>> BlockList;
+
   // Must use one of the static factory methods.
-  GenomeReferenceFai(
-      const string& fasta_path, faidx_t* faidx, int cache_size_bases);
+  GenomeReferenceFai(const string& fasta_path, faidx_t* faidx,
+                     int cache_size_bases, int num_cache_blocks);
+
+  // Fetches the bases of range from our FASTA, upper-cased. Callers must hold
+  // mutex_, as htslib's faidx_t isn't thread-safe.
+  StatusOr<string> FetchBases(
+      const learning::genomics::v1::Range& range) const;
+
+  // Gets the cached block block_index of contig, fetching it into our cache if
+  // needed. Callers must hold mutex_.
+  StatusOr<const string*> GetBlock(const ContigInfo& contig,
+                                   int64 block_index) const;
 
   // Path to the FASTA file containing our genomic bases.
   const string fasta_path_;
@@ -131,16 +159,25 @@ class GenomeReferenceFai : public GenomeReference {
   // contigs used by this BAM file.
   const std::vector<ContigInfo> contigs_;
 
-  // Size, in bases, of the read cache.
+  // Size, in bases, of each block of our cache.
   const int cache_size_bases_;
 
-  // Cache of the last "small" read from the FASTA (<= kFastaCacheSize).
-  mutable std::string small_read_cache_;
+  // The maximum number of blocks in our cache.
+  const int num_cache_blocks_;
+
+  // Guards our use of faidx_ and all of our cache state below.
+  mutable tensorflow::mutex mutex_;
+
+  // Our cached blocks, from the most to the least recently used.
+  mutable BlockList cached_blocks_;
+
+  // The position of each cached block in cached_blocks_.
+  mutable std::map<BlockKey, BlockList::iterator> block_index_;
 
-  // The range that is held in the cache, or "empty" if there is no range cached
-  // yet.  Range must be <= kFastaCacheSize in length.
-  mutable tensorflow::gtl::optional<
-      learning::genomics::v1::Range> cached_range_;
+  // The number of block lookups that found the block in our cache, and that
+  // had to fetch it from the FASTA.
+  mutable int64 cache_hits_ = 0;
+  mutable int64 cache_misses_ = 0;
 };
 
 }  // namespace core
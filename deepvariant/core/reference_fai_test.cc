@@ -32,6 +32,7 @@
 #include "deepvariant/core/reference_fai.h"
 
 #include <memory>
+#include <thread>  // NOLINT
 #include <utility>
 #include <vector>
 
@@ -53,6 +54,7 @@
 using std::make_pair;
 using tensorflow::strings::StrCat;
 using testing::Eq;
+using testing::HasSubstr;
 using testing::StartsWith;
 
 namespace learning {
@@ -81,6 +83,71 @@ INSTANTIATE_TEST_CASE_P(GRT3, GenomeReferenceTest,
 INSTANTIATE_TEST_CASE_P(GRT4, GenomeReferenceDeathTest,
                         ::testing::Values(make_pair(&JustLoadFai, 64 * 1024)));
 
+// Tests with a cache of many small blocks, so queries often span two of them.
+INSTANTIATE_TEST_CASE_P(GRT5, GenomeReferenceTest,
+                        ::testing::Values(make_pair(&JustLoadFai, 5)));
+
+// A cache of a single small block, so we are constantly evicting it.
+static std::unique_ptr<GenomeReference> JustLoadFaiWithOneBlock(
+    const string& fasta, int cache_size) {
+  StatusOr<std::unique_ptr<GenomeReferenceFai>> fai_status =
+      GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"), cache_size,
+                                   1);
+  TF_CHECK_OK(fai_status.status());
+  return std::move(fai_status.ValueOrDie());
+}
+
+INSTANTIATE_TEST_CASE_P(
+    GRT6, GenomeReferenceTest,
+    ::testing::Values(make_pair(&JustLoadFaiWithOneBlock, 5)));
+
+TEST(ReferenceFaiTest, CacheHitsAndMissesAreCounted) {
+  std::unique_ptr<GenomeReferenceFai> reader = std::move(
+      GenomeReferenceFai::FromFile(TestFastaPath(),
+                                   StrCat(TestFastaPath(), ".fai"), 10, 2)
+          .ValueOrDie());
+  EXPECT_THAT(reader->Info(), HasSubstr("0 hits, 0 misses"));
+  // chrM:0-10 is block 0 of chrM, so this fetches it.
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 0, 10)), IsOK());
+  EXPECT_THAT(reader->Info(), HasSubstr("0 hits, 1 misses"));
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 2, 5)), IsOK());
+  EXPECT_THAT(reader->Info(), HasSubstr("1 hits, 1 misses"));
+  // Spans blocks 0 and 1, fetching 1.
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 5, 15)), IsOK());
+  EXPECT_THAT(reader->Info(), HasSubstr("2 hits, 2 misses"));
+  // Fetching block 0 of chr1 evicts block 0 of chrM, our least recently used.
+  ASSERT_THAT(reader->GetBases(MakeRange("chr1", 0, 10)), IsOK());
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 10, 20)), IsOK());
+  EXPECT_THAT(reader->Info(), HasSubstr("3 hits, 3 misses"));
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 0, 10)), IsOK());
+  EXPECT_THAT(reader->Info(), HasSubstr("3 hits, 4 misses"));
+  // Queries longer than a block bypass the cache.
+  ASSERT_THAT(reader->GetBases(MakeRange("chrM", 0, 100)), IsOK());
+  EXPECT_THAT(reader->Info(), HasSubstr("3 hits, 4 misses"));
+}
+
+TEST(ReferenceFaiTest, ConcurrentQueriesWork) {
+  std::unique_ptr<GenomeReferenceFai> reader = std::move(
+      GenomeReferenceFai::FromFile(TestFastaPath(),
+                                   StrCat(TestFastaPath(), ".fai"), 8, 3)
+          .ValueOrDie());
+  const string expected = reader->GetBases(MakeRange("chr2", 0, 121))
+                              .ValueOrDie();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&reader, &expected, i]() {
+      for (int start = i; start + 8 <= 121; ++start) {
+        EXPECT_EQ(expected.substr(start, 8),
+                  reader->GetBases(MakeRange("chr2", start, start + 8))
+                      .ValueOrDie());
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
 TEST(StatusOrLoadFromFile, ReturnsBadStatusIfFaiIsMissing) {
   StatusOr<std::unique_ptr<GenomeReferenceFai>> result =
       GenomeReferenceFai::FromFile(GetTestData("unindexed.fasta"),
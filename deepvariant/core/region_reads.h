@@ -0,0 +1,86 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The reads of a region, held natively so that the stages processing the
+// region can share them without converting them to and from Python.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_REGION_READS_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_REGION_READS_H_
+
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/read_index.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// An immutable set of reads, such as the reads of a region after
+// realignment, with a ReadIndex of where they are aligned.
+//
+// Python code processing a region hands its reads to a RegionReads once and
+// then passes the RegionReads, an opaque handle, to each native stage, such
+// as AlleleCounter and PileupExamplesCreatorNative, rather than a list of
+// reads that is converted again on every call. A RegionReads is safe to use
+// from many threads at once.
+class RegionReads {
+ public:
+  // Creates a RegionReads holding reads, which may be in any order.
+  explicit RegionReads(std::vector<learning::genomics::v1::Read> reads);
+
+  // Gets all of our reads, in their input order.
+  const std::vector<learning::genomics::v1::Read>& reads() const {
+    return reads_;
+  }
+
+  // Returns the indices into reads() of the reads whose alignment overlaps
+  // range, in increasing order, as ReadIndex::Query().
+  std::vector<int> Query(const learning::genomics::v1::Range& range) const {
+    return index_.Query(range);
+  }
+
+  // Gets the index of where our reads are aligned.
+  const ReadIndex& index() const { return index_; }
+
+  // Returns the number of our reads.
+  int size() const { return reads_.size(); }
+
+ private:
+  const std::vector<learning::genomics::v1::Read> reads_;
+  const ReadIndex index_;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_REGION_READS_H_
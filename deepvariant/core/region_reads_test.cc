@@ -0,0 +1,75 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/region_reads.h"
+
+#include <utility>
+#include <vector>
+
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Read;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Pointwise;
+
+TEST(RegionReadsTest, KeepsReadsInInputOrderAndQueriesThem) {
+  std::vector<Read> reads = {
+      MakeRead("chr1", 20, "ACGT", {"4M"}),
+      MakeRead("chr1", 1, "ACGT", {"4M"}),
+      MakeRead("chr2", 5, "AC", {"2M"}),
+  };
+  const std::vector<Read> expected = reads;
+  const RegionReads region_reads(std::move(reads));
+
+  EXPECT_EQ(3, region_reads.size());
+  EXPECT_THAT(region_reads.reads(), Pointwise(EqualsProto(), expected));
+  EXPECT_THAT(region_reads.Query(MakeRange("chr1", 0, 30)), ElementsAre(0, 1));
+  EXPECT_THAT(region_reads.Query(MakeRange("chr1", 5, 20)), IsEmpty());
+  EXPECT_THAT(region_reads.Query(MakeRange("chr2", 0, 6)), ElementsAre(2));
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/region_reference.h"
+
+#include <algorithm>
+
+#include "deepvariant/core/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::v1::Range;
+using tensorflow::strings::StrCat;
+
+RegionReference::RegionReference(const GenomeReference* const ref,
+                                 const int64 padding)
+    : ref_(ref), padding_(padding) {
+  CHECK(ref_ != nullptr);
+  CHECK_GE(padding_, 0) << "padding must be non-negative";
+}
+
+string RegionReference::Info() const {
+  return StrCat("RegionReference(padding=", padding_, ", cached=",
+                cached_range_.reference_name(), ":", cached_range_.start(),
+                "-", cached_range_.end(), ") over ", ref_->Info());
+}
+
+tensorflow::Status RegionReference::SetRegion(const Range& region) {
+  cached_range_.Clear();
+  cached_bases_.clear();
+  if (!ref_->IsValidInterval(region)) {
+    return tensorflow::errors::InvalidArgument(
+        "Invalid interval: ", region.ShortDebugString());
+  }
+  const int64 n_bases =
+      ref_->Contig(region.reference_name()).ValueOrDie()->n_bases();
+  const Range padded = MakeRange(region.reference_name(),
+                                 std::max<int64>(0, region.start() - padding_),
+                                 std::min(n_bases, region.end() + padding_));
+  TF_RETURN_IF_ERROR(ref_->GetBasesInto(padded, &cached_bases_));
+  cached_range_ = padded;
+  return tensorflow::Status::OK();
+}
+
+bool RegionReference::Contains(const Range& range) const {
+  return !cached_bases_.empty() &&
+         range.reference_name() == cached_range_.reference_name() &&
+         range.start() >= cached_range_.start() &&
+         range.end() <= cached_range_.end() && range.start() <= range.end();
+}
+
+tensorflow::StringPiece RegionReference::Slice(const Range& range) const {
+  CHECK(Contains(range)) << "Range " << range.ShortDebugString()
+                         << " is outside of the cached interval "
+                         << cached_range_.ShortDebugString();
+  return tensorflow::StringPiece(cached_bases_)
+      .substr(range.start() - cached_range_.start(),
+              range.end() - range.start());
+}
+
+StatusOr<string> RegionReference::GetBases(const Range& range) const {
+  if (Contains(range)) return Slice(range).ToString();
+  tensorflow::mutex_lock lock(forward_mu_);
+  return ref_->GetBases(range);
+}
+
+tensorflow::Status RegionReference::GetBasesInto(const Range& range,
+                                                 string* bases) const {
+  if (!Contains(range)) {
+    tensorflow::mutex_lock lock(forward_mu_);
+    return ref_->GetBasesInto(range, bases);
+  }
+  const tensorflow::StringPiece slice = Slice(range);
+  bases->assign(slice.data(), slice.size());
+  return tensorflow::Status::OK();
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A GenomeReference that serves the bases of one padded region from memory.
+//
+// Processing a region of the genome looks up its reference bases many times:
+// the AlleleCounter fetches the region itself and then the bases spanned by
+// each indel, the realigner fetches each of its windows, and the pileup image
+// creator fetches the window around each candidate. A RegionReference wraps
+// another GenomeReference, fetches the bases of the current region plus some
+// padding once in SetRegion(), and answers every query inside that interval
+// by slicing the cached bases. Queries outside of it are forwarded to the
+// wrapped reference, so a RegionReference can be passed anywhere a
+// GenomeReference is accepted without changing the results.
+//
+// Queries may be made concurrently, e.g. by the threads processing the same
+// region for different samples, as the queries forwarded to the wrapped
+// reference are serialized. SetRegion() must not be called concurrently with
+// anything else.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_REGION_REFERENCE_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_REGION_REFERENCE_H_
+
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/reference.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+class RegionReference : public GenomeReference {
+ public:
+  // Creates a RegionReference over ref, which must outlive it, caching padding
+  // bases on either side of each region given to SetRegion().
+  RegionReference(const GenomeReference* ref, int64 padding);
+
+  const string& FastaPath() const override { return ref_->FastaPath(); }
+  string Info() const override;
+  const std::vector<ContigInfo>& Contigs() const override {
+    return ref_->Contigs();
+  }
+
+  StatusOr<string> GetBases(
+      const learning::genomics::v1::Range& range) const override;
+  tensorflow::Status GetBasesInto(const learning::genomics::v1::Range& range,
+                                  string* bases) const override;
+
+  // Fetches the bases of region, extended by our padding on either side and
+  // clipped to the bounds of its contig, replacing any previously cached
+  // bases. Returns a non-ok status, leaving nothing cached, if region isn't a
+  // valid interval of the wrapped reference.
+  tensorflow::Status SetRegion(const learning::genomics::v1::Range& region);
+
+  // Returns true iff range lies within the currently cached interval.
+  bool Contains(const learning::genomics::v1::Range& range) const;
+
+  // Returns a view of the cached bases of range, which must satisfy
+  // Contains(). The view is only valid until the next call to SetRegion().
+  tensorflow::StringPiece Slice(
+      const learning::genomics::v1::Range& range) const;
+
+  // The currently cached interval, which is empty before the first successful
+  // SetRegion().
+  const learning::genomics::v1::Range& CachedRange() const {
+    return cached_range_;
+  }
+
+ private:
+  const GenomeReference* const ref_;
+  const int64 padding_;
+  // Guards the queries forwarded to ref_, which need not be thread-safe.
+  mutable tensorflow::mutex forward_mu_;
+
+  // The bases of cached_range_.
+  learning::genomics::v1::Range cached_range_;
+  string cached_bases_;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_REGION_REFERENCE_H_
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/region_reference.h"
+
+#include <memory>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "deepvariant/core/reference_fai.h"
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+#include "deepvariant/vendor/status_matchers.h"
+
+#include "tensorflow/core/lib/strings/strcat.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Range;
+using tensorflow::strings::StrCat;
+
+class RegionReferenceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const string fasta = GetTestData("test.fasta");
+    auto fai_status =
+        GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"));
+    TF_CHECK_OK(fai_status.status());
+    fai_ = std::move(fai_status.ValueOrDie());
+  }
+
+  std::unique_ptr<GenomeReference> fai_;
+};
+
+TEST_F(RegionReferenceTest, CachesPaddedRegionClippedToContig) {
+  RegionReference ref(fai_.get(), 5);
+  EXPECT_TRUE(ref.CachedRange().reference_name().empty());
+  EXPECT_FALSE(ref.Contains(MakeRange("chr1", 10, 15)));
+
+  ASSERT_THAT(ref.SetRegion(MakeRange("chr1", 2, 20)), IsOK());
+  EXPECT_THAT(ref.CachedRange(), EqualsProto(MakeRange("chr1", 0, 25)));
+  EXPECT_TRUE(ref.Contains(MakeRange("chr1", 0, 25)));
+  EXPECT_FALSE(ref.Contains(MakeRange("chr1", 20, 26)));
+  EXPECT_FALSE(ref.Contains(MakeRange("chr2", 10, 15)));
+  EXPECT_EQ("TCCGT", ref.Slice(MakeRange("chr1", 10, 15)));
+
+  // chr1 has 76 bases, so the padding is clipped at its end too.
+  ASSERT_THAT(ref.SetRegion(MakeRange("chr1", 60, 74)), IsOK());
+  EXPECT_THAT(ref.CachedRange(), EqualsProto(MakeRange("chr1", 55, 76)));
+}
+
+TEST_F(RegionReferenceTest, MatchesWrappedReference) {
+  RegionReference ref(fai_.get(), 10);
+  ASSERT_THAT(ref.SetRegion(MakeRange("chr1", 20, 40)), IsOK());
+  EXPECT_EQ(fai_->Contigs().size(), ref.Contigs().size());
+  EXPECT_EQ(fai_->FastaPath(), ref.FastaPath());
+
+  // Ranges inside, straddling and outside of the cached interval, which is
+  // chr1:10-50.
+  for (const Range& range :
+       {MakeRange("chr1", 10, 50), MakeRange("chr1", 25, 26),
+        MakeRange("chr1", 5, 20), MakeRange("chr1", 45, 60),
+        MakeRange("chr2", 0, 20)}) {
+    const string expected = fai_->GetBases(range).ValueOrDie();
+    EXPECT_EQ(expected, ref.GetBases(range).ValueOrDie());
+    string bases = "leftover";
+    ASSERT_THAT(ref.GetBasesInto(range, &bases), IsOK());
+    EXPECT_EQ(expected, bases);
+  }
+  EXPECT_FALSE(ref.GetBases(MakeRange("chr1", 70, 80)).ok());
+}
+
+TEST_F(RegionReferenceTest, ConcurrentQueriesMatchWrappedReference) {
+  RegionReference ref(fai_.get(), 10);
+  ASSERT_THAT(ref.SetRegion(MakeRange("chr1", 20, 40)), IsOK());
+  const string expected = fai_->GetBases(MakeRange("chr1", 0, 76)).ValueOrDie();
+
+  // Each thread queries windows both inside and outside of the cached
+  // interval, so some are answered from the cache and some are forwarded.
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&ref, &expected, i]() {
+      for (int start = i; start + 8 <= 76; ++start) {
+        EXPECT_EQ(expected.substr(start, 8),
+                  ref.GetBases(MakeRange("chr1", start, start + 8))
+                      .ValueOrDie());
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+TEST_F(RegionReferenceTest, RejectsInvalidRegions) {
+  RegionReference ref(fai_.get(), 10);
+  ASSERT_THAT(ref.SetRegion(MakeRange("chr1", 20, 40)), IsOK());
+  EXPECT_FALSE(ref.SetRegion(MakeRange("chr1", 70, 80)).ok());
+  EXPECT_FALSE(ref.SetRegion(MakeRange("missing", 0, 10)).ok());
+  // A failed SetRegion() leaves nothing cached.
+  EXPECT_FALSE(ref.Contains(MakeRange("chr1", 20, 40)));
+  EXPECT_EQ("TCCGT", ref.GetBases(MakeRange("chr1", 10, 15)).ValueOrDie());
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
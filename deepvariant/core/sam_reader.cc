@@ -32,19 +32,31 @@
 // Implementation of sam_reader.h
 #include "deepvariant/core/sam_reader.h"
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <vector>
+
 #include "deepvariant/core/genomics/cigar.pb.h"
 #include "deepvariant/core/genomics/position.pb.h"
 #include "deepvariant/core/genomics/range.pb.h"
 #include "deepvariant/core/genomics/reads.pb.h"
 #include "deepvariant/core/hts_path.h"
+#include "deepvariant/core/hts_thread_pool.h"
 #include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/core/utils.h"
 #include "google/protobuf/repeated_field.h"
+#include "htslib/cram.h"
 #include "htslib/hts.h"
 #include "htslib/hts_endian.h"
 #include "htslib/sam.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/lib/random/philox_random.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/lib/strings/str_util.h"
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/types.h"
@@ -74,31 +86,6 @@ using tensorflow::strings::StrCat;
 //
 // -----------------------------------------------------------------------------
 
-// Array mapping htslib BAM constants (in comment) to proto CigarUnit enum
-// values.
-const CigarUnit_Operation kHtslibCigarToProto[] = {
-// #define BAM_CMATCH      0
-  CigarUnit::ALIGNMENT_MATCH,
-// #define BAM_CINS        1
-  CigarUnit::INSERT,
-// #define BAM_CDEL        2
-  CigarUnit::DELETE,
-// #define BAM_CREF_SKIP   3
-  CigarUnit::SKIP,
-// #define BAM_CSOFT_CLIP  4
-  CigarUnit::CLIP_SOFT,
-// #define BAM_CHARD_CLIP  5
-  CigarUnit::CLIP_HARD,
-// #define BAM_CPAD        6
-  CigarUnit::ALIGNMENT_MATCH,
-// #define BAM_CEQUAL      7
-  CigarUnit::SEQUENCE_MATCH,
-// #define BAM_CDIFF       8
-  CigarUnit::SEQUENCE_MISMATCH,
-// #define BAM_CBACK       9
-  CigarUnit::OPERATION_UNSPECIFIED,
-};
-
 // Gets the size in bytes for a SAM/BAM aux tag based on their declared type.
 //
 // Based on code from htslib/sam.c which isn't exported from htslib. Returns
@@ -245,11 +232,16 @@ tf::Status ConvertToPb(const bam_hdr_t* h, const bam1_t* b,
   read_message->Clear();
 
   const bam1_core_t *c = &b->core;
+  const OptionalReadFieldsToParse& fields = options.desired_read_fields();
 
   // Grab a bunch of basic information from the bam1_t record and put it into
   // our protobuf.
-  read_message->set_fragment_name(bam_get_qname(b));
-  read_message->set_fragment_length(c->isize);
+  if (!fields.exclude_fragment_name()) {
+    read_message->set_fragment_name(bam_get_qname(b));
+  }
+  if (!fields.exclude_fragment_length()) {
+    read_message->set_fragment_length(c->isize);
+  }
   read_message->set_proper_placement(c->flag & BAM_FPROPER_PAIR);
   read_message->set_duplicate_fragment(c->flag & BAM_FDUP);
   read_message->set_failed_vendor_quality_checks(c->flag & BAM_FQCFAIL);
@@ -263,8 +255,8 @@ tf::Status ConvertToPb(const bam_hdr_t* h, const bam1_t* b,
   read_message->set_read_number(c->flag & BAM_FREAD1 || !paired ? 0 : 1);
   read_message->set_number_reads(paired ? 2 : 1);
 
-  if (c->l_qseq) {
-    // Convert the seq and qual fields if they are present.
+  if (c->l_qseq && !fields.exclude_aligned_sequence()) {
+    // Convert the seq field if it is present.
     string* read_seq = read_message->mutable_aligned_sequence();
     read_seq->reserve(c->l_qseq);
     uint8_t* seq = bam_get_seq(b);  // seq is stored as 8-bit offsets.
@@ -273,8 +265,10 @@ tf::Status ConvertToPb(const bam_hdr_t* h, const bam1_t* b,
       // the constant seq_nt16_str from htslib.
       read_seq->push_back(seq_nt16_str[bam_seqi(seq, i)]);
     }
+  }
 
-    // Convert the qual field.
+  if (c->l_qseq && !fields.exclude_aligned_quality()) {
+    // Convert the qual field if it is present.
     uint8_t* quals = bam_get_qual(b);
     if (quals[0] != 0xff) {  // Not missing
       // redacted
@@ -291,7 +285,7 @@ tf::Status ConvertToPb(const bam_hdr_t* h, const bam1_t* b,
     auto* linear_alignment = read_message->mutable_alignment();
     linear_alignment->set_mapping_quality(c->qual);
 
-    if (c->n_cigar) {  // Convert our Cigar.
+    if (c->n_cigar && !fields.exclude_cigar()) {  // Convert our Cigar.
       uint32_t* cigar = bam_get_cigar(b);
       for (uint32_t i = 0; i < c->n_cigar; ++i) {
         CigarUnit* cigar_unit = linear_alignment->add_cigar();
@@ -310,7 +304,8 @@ tf::Status ConvertToPb(const bam_hdr_t* h, const bam1_t* b,
   }
 
   // Set the mates map position if the mate is not unmapped.
-  if (paired && !(c->flag & BAM_FMUNMAP)) {
+  if (paired && !(c->flag & BAM_FMUNMAP) &&
+      !fields.exclude_next_mate_position()) {
     Position* mate_position = read_message->mutable_next_mate_position();
     if (c->mtid < 0)
       return tf::errors::DataLoss(
@@ -335,6 +330,154 @@ tf::Status ConvertToPb(const bam_hdr_t* h, const bam1_t* b,
   return tf::Status::OK();
 }
 
+// Reads the records of a query for our query iterables, keeping those that
+// pass the read requirements and downsampling of a SamReader. If its options
+// have a positive max_depth, the depth of the records kept is also capped at
+// max_depth.
+//
+// htslib gives the records of a query sorted by start. To cap their depth we
+// read all the records starting at the same position into a batch and keep a
+// random sample of them, chosen by reservoir sampling. The sample is as large
+// as it can be without more than max_depth kept records overlapping that
+// position. Every record overlaps its own start, so this caps the depth of
+// the kept records at every position. We only drop records after viewing
+// them, so none of the excess reads is ever converted to a Read.
+class QueryRecordReader {
+ public:
+  QueryRecordReader(const SamReader* reader, htsFile* fp, bam_hdr_t* header);
+  ~QueryRecordReader();
+
+  // Starts reading the records of iter, a query starting at start on the
+  // contig with htslib target id tid. The sample of records kept is drawn
+  // with a seed made from options.random_seed, tid and start, so it is the
+  // same every time the same region is queried.
+  void Start(hts_itr_t* iter, int tid, tf::int64 start);
+
+  // Sets *record to the next record we keep, returning false when there are
+  // no more. *record remains valid until the next call.
+  StatusOr<bool> Next(const bam1_t** record);
+
+ private:
+  // Reads the next record of our query that passes the filters of our reader
+  // into b, returning false if there are no more.
+  StatusOr<bool> ReadKeptRecord(bam1_t* b);
+
+  // Reads the next batch of records starting at the same position and picks
+  // the ones we keep. Returns false if there are no more records.
+  StatusOr<bool> ReadBatch();
+
+  const SamReader* reader_;
+  htsFile* fp_;
+  bam_hdr_t* header_;
+  hts_itr_t* iter_ = nullptr;
+  const int max_depth_;
+  // The next record, read ahead of the batch it starts, if have_next_.
+  bam1_t* next_;
+  bool have_next_ = false;
+  // The records of the current batch are batch_[0, batch_size_), and we
+  // return those indexed by kept_ in turn, in the order they were read.
+  std::vector<bam1_t*> batch_;
+  size_t batch_size_ = 0;
+  std::vector<size_t> kept_;
+  size_t next_kept_ = 0;
+  // The ends of the kept records that may overlap later records.
+  std::priority_queue<tf::int64, std::vector<tf::int64>,
+                      std::greater<tf::int64>>
+      kept_ends_;
+  tf::random::PhiloxRandom philox_;
+};
+
+QueryRecordReader::QueryRecordReader(const SamReader* reader, htsFile* fp,
+                                     bam_hdr_t* header)
+    : reader_(reader),
+      fp_(fp),
+      header_(header),
+      max_depth_(reader->options().max_depth()),
+      next_(bam_init1()),
+      philox_(reader->options().random_seed()) {}
+
+QueryRecordReader::~QueryRecordReader() {
+  bam_destroy1(next_);
+  for (bam1_t* b : batch_) bam_destroy1(b);
+}
+
+void QueryRecordReader::Start(hts_itr_t* iter, int tid, tf::int64 start) {
+  iter_ = iter;
+  have_next_ = false;
+  batch_size_ = 0;
+  kept_.clear();
+  next_kept_ = 0;
+  kept_ends_ = decltype(kept_ends_)();
+  philox_ = tf::random::PhiloxRandom(
+      reader_->options().random_seed(),
+      (static_cast<tf::uint64>(tid) << 32) | static_cast<tf::uint32>(start));
+}
+
+StatusOr<bool> QueryRecordReader::ReadKeptRecord(bam1_t* b) {
+  while (true) {
+    // Get next in query window; return false if no more records.
+    const int code = sam_itr_next(fp_, iter_, b);
+    if (code == -1) {
+      return false;
+    } else if (code < -1) {
+      return tf::errors::DataLoss("Failed to parse SAM record");
+    }
+    if (reader_->KeepRead(ReadView(header_, b))) return true;
+  }
+}
+
+StatusOr<bool> QueryRecordReader::Next(const bam1_t** record) {
+  if (max_depth_ <= 0) {
+    StatusOr<bool> more = ReadKeptRecord(next_);
+    if (more.ok() && more.ValueOrDie()) *record = next_;
+    return more;
+  }
+  while (next_kept_ == kept_.size()) {
+    StatusOr<bool> more = ReadBatch();
+    if (!more.ok() || !more.ValueOrDie()) return more;
+  }
+  *record = batch_[kept_[next_kept_++]];
+  return true;
+}
+
+StatusOr<bool> QueryRecordReader::ReadBatch() {
+  if (!have_next_) {
+    StatusOr<bool> more = ReadKeptRecord(next_);
+    TF_RETURN_IF_ERROR(more.status());
+    if (!more.ValueOrDie()) return false;
+  }
+  const tf::int64 start = next_->core.pos;
+  batch_size_ = 0;
+  do {
+    if (batch_size_ == batch_.size()) batch_.push_back(bam_init1());
+    std::swap(batch_[batch_size_++], next_);
+    StatusOr<bool> more = ReadKeptRecord(next_);
+    TF_RETURN_IF_ERROR(more.status());
+    have_next_ = more.ValueOrDie();
+  } while (have_next_ && next_->core.pos == start);
+
+  // Kept records ending at or before start don't overlap this batch, or any
+  // later one.
+  while (!kept_ends_.empty() && kept_ends_.top() <= start) kept_ends_.pop();
+  const size_t depth = kept_ends_.size();
+  const size_t room = depth < static_cast<size_t>(max_depth_)
+                          ? max_depth_ - depth
+                          : 0;
+  kept_.clear();
+  next_kept_ = 0;
+  for (size_t i = 0; i < std::min(room, batch_size_); ++i) kept_.push_back(i);
+  if (room > 0 && batch_size_ > room) {
+    tf::random::SimplePhilox rng(&philox_);
+    for (size_t i = room; i < batch_size_; ++i) {
+      const size_t j = rng.Uniform(i + 1);
+      if (j < room) kept_[j] = i;
+    }
+    std::sort(kept_.begin(), kept_.end());
+  }
+  for (const size_t i : kept_) kept_ends_.push(bam_endpos(batch_[i]));
+  return true;
+}
+
 // Iterable class for traversing all BAM records in the file.
 class SamFullFileIterable : public SamIterable {
  public:
@@ -352,17 +495,22 @@ class SamFullFileIterable : public SamIterable {
 };
 
 
-// Iterable class for traversing BAM records returned in a query window.
-class SamQueryIterable : public SamIterable {
+// Iterable class for traversing BAM records returned in a query window, as
+// either Read protos or ReadViews.
+template <class Record>
+class SamQueryIterable : public Iterable<Record> {
  public:
   // Advance to the next record.
-  StatusOr<bool> Next(learning::genomics::v1::Read* out) override;
+  StatusOr<bool> Next(Record* out) override;
 
-  // Constructor will be invoked via SamReader::Query.
+  // Constructor will be invoked via SamReader::Query. iter is a query
+  // starting at start on the contig with htslib target id tid.
   SamQueryIterable(const SamReader* reader,
                    htsFile* fp,
                    bam_hdr_t* header,
-                   hts_itr_t* iter);
+                   hts_itr_t* iter,
+                   int tid,
+                   tf::int64 start);
 
   ~SamQueryIterable() override;
 
@@ -370,17 +518,200 @@ class SamQueryIterable : public SamIterable {
   htsFile* fp_;
   bam_hdr_t* header_;
   hts_itr_t* iter_;
+  QueryRecordReader records_;
+};
+
+// Iterable class giving the reads of one chunk of the file, for
+// SamReader::IterateChunk.
+class SamChunkIterable : public SamIterable {
+ public:
+  // Advance to the next record.
+  StatusOr<bool> Next(learning::genomics::v1::Read* out) override;
+
+  // Constructor will be invoked via SamReader::IterateChunk. iter queries the
+  // reads of the chunk, and we skip those starting before start.
+  SamChunkIterable(const SamReader* reader, htsFile* fp, bam_hdr_t* header,
+                   hts_itr_t* iter, tf::int64 start);
+
+  ~SamChunkIterable() override;
+
+ private:
+  htsFile* fp_;
+  bam_hdr_t* header_;
+  hts_itr_t* iter_;
+  const tf::int64 start_;
   bam1_t* bam1_;
 };
 
+// Iterable class giving the reads overlapping each of a series of regions, for
+// SamReader::QueryMultiple.
+//
+// Consecutive regions on the same contig that are adjacent or overlap form a
+// run, which we read with a single htslib iterator over its span. The kept
+// reads that may still overlap the current or a later region of the run are
+// held in buffer_, in the order they were read, and the reads of each region
+// are taken from there.
+class SamMultiQueryIterable : public SamRegionsIterable {
+ public:
+  // Advance to the reads of the next region.
+  StatusOr<bool> Next(std::vector<learning::genomics::v1::Read>* out) override;
+
+  // Constructor will be invoked via SamReader::QueryMultiple. tids[i] is the
+  // htslib target id of regions[i].
+  SamMultiQueryIterable(
+      const SamReader* reader, htsFile* fp, bam_hdr_t* header, hts_idx_t* idx,
+      const std::vector<learning::genomics::v1::Range>& regions,
+      const std::vector<int>& tids);
+
+  ~SamMultiQueryIterable() override;
+
+ private:
+  // A kept read, with the interval it spans on its contig.
+  struct BufferedRead {
+    learning::genomics::v1::Read read;
+    tf::int64 start;
+    tf::int64 end;
+  };
+
+  // Starts reading the run of regions beginning at next_region_.
+  tf::Status StartRun();
+
+  htsFile* fp_;
+  bam_hdr_t* header_;
+  hts_idx_t* idx_;
+  const std::vector<learning::genomics::v1::Range> regions_;
+  const std::vector<int> tids_;
+  // The index of the next region whose reads are returned by Next().
+  size_t next_region_ = 0;
+  // One past the index of the last region of the current run.
+  size_t run_end_ = 0;
+  // The iterator over the span of the current run, or null before the first.
+  hts_itr_t* iter_ = nullptr;
+  // True once iter_ has returned all of its records.
+  bool iter_done_ = false;
+  // The start of the last record read from iter_.
+  tf::int64 last_start_ = -1;
+  std::vector<BufferedRead> buffer_;
+  QueryRecordReader records_;
+};
+
+namespace {
+
+// The reference_name of the chunk of unmapped reads without a position, as in
+// the RNAME column of their SAM records.
+constexpr char kUnplacedReadsChunk[] = "*";
+
+// Fills in out from the record b, for our query iterables.
+tf::Status ParseRecord(const bam_hdr_t* h, const bam1_t* b,
+                       const SamReaderOptions& options, Read* out) {
+  return ConvertToPb(h, b, options, out);
+}
+
+tf::Status ParseRecord(const bam_hdr_t* h, const bam1_t* b,
+                       const SamReaderOptions& options, ReadView* out) {
+  *out = ReadView(h, b);
+  return tf::Status::OK();
+}
+
+// Opens reads_path for reading, applying the htslib settings in options.
+StatusOr<htsFile*> OpenHtsFile(const string& reads_path,
+                               const SamReaderOptions& options) {
+  htsFile* fp = hts_open_x(reads_path.c_str(), "r");
+  if (!fp) {
+    return tf::errors::NotFound(StrCat("Could not open ", reads_path));
+  }
+
+  if (options.hts_block_size() > 0) {
+    VLOG(1) << "Setting HTS_OPT_BLOCK_SIZE to " << options.hts_block_size();
+    if (hts_set_opt(fp, HTS_OPT_BLOCK_SIZE, options.hts_block_size()) != 0) {
+      hts_close(fp);
+      return tf::errors::Unknown(StrCat("Failed to set HTS_OPT_BLOCK_SIZE"));
+    }
+  }
+
+  // All of our handles share the process-wide pool, so acquiring more handles
+  // for concurrent queries doesn't add any threads.
+  const tf::Status status =
+      UseSharedHtsThreadPool(fp, options.num_decompression_threads());
+  if (!status.ok()) {
+    hts_close(fp);
+    return status;
+  }
+  return fp;
+}
+
+// Returns the SAM fields that ConvertToPb parses with options, for
+// CRAM_OPT_REQUIRED_FIELDS. These always include the fields our read
+// requirements and queries look at, which are needed by every read.
+int CramRequiredFields(const SamReaderOptions& options) {
+  const OptionalReadFieldsToParse& desired = options.desired_read_fields();
+  int fields = SAM_FLAG | SAM_RNAME | SAM_POS | SAM_MAPQ | SAM_CIGAR |
+               SAM_RNEXT;
+  if (!desired.exclude_fragment_name()) fields |= SAM_QNAME;
+  if (!desired.exclude_fragment_length()) fields |= SAM_TLEN;
+  if (!desired.exclude_aligned_sequence()) fields |= SAM_SEQ;
+  if (!desired.exclude_aligned_quality()) fields |= SAM_QUAL;
+  if (!desired.exclude_next_mate_position()) fields |= SAM_PNEXT;
+  if (options.aux_field_handling() == SamReaderOptions::PARSE_ALL_AUX_FIELDS) {
+    fields |= SAM_AUX;
+  }
+  return fields;
+}
+
+// Sets up fp, a handle on a CRAM file, for reading by a SamReader.
+//
+// CRAM stores the bases of each read as differences from the reference, so
+// htslib needs the reference to decode them. If shared_refs is null we point
+// htslib at options.reference_filename, if given; otherwise fp decodes bases
+// against shared_refs, the reference cache of another handle on the same file,
+// so a reference sequence is only loaded once however many handles read it.
+//
+// htslib only decodes the fields of each record that we use, which is much
+// cheaper than decoding whole records. In particular the MD and NM tags, which
+// CRAM recomputes from the reference, are only generated when we parse aux
+// fields.
+tf::Status SetUpCramHandle(htsFile* fp, const SamReaderOptions& options,
+                           refs_t* shared_refs) {
+  if (shared_refs != nullptr) {
+    if (hts_set_opt(fp, CRAM_OPT_SHARED_REF, shared_refs) != 0) {
+      return tf::errors::Unknown(
+          StrCat("Failed to set CRAM_OPT_SHARED_REF for ", fp->fn));
+    }
+  } else if (!options.reference_filename().empty()) {
+    if (hts_set_fai_filename(fp, options.reference_filename().c_str()) != 0) {
+      return tf::errors::NotFound(StrCat("Could not load reference ",
+                                         options.reference_filename(),
+                                         " for ", fp->fn));
+    }
+  }
+
+  const int fields = CramRequiredFields(options);
+  if (hts_set_opt(fp, CRAM_OPT_REQUIRED_FIELDS, fields) != 0) {
+    return tf::errors::Unknown(
+        StrCat("Failed to set CRAM_OPT_REQUIRED_FIELDS for ", fp->fn));
+  }
+  if (!(fields & SAM_AUX) && hts_set_opt(fp, CRAM_OPT_DECODE_MD, 0) != 0) {
+    return tf::errors::Unknown(
+        StrCat("Failed to set CRAM_OPT_DECODE_MD for ", fp->fn));
+  }
+  return tf::Status::OK();
+}
+
+// Returns true if fp is a handle on a CRAM file.
+bool IsCram(const htsFile* fp) { return fp->format.format == cram; }
+
+}  // namespace
+
 SamReader::SamReader(const string& reads_path, const SamReaderOptions& options,
                      htsFile* fp, bam_hdr_t* header, hts_idx_t* idx)
-    : options_(options),
+    : reads_path_(reads_path),
+      options_(options),
       fp_(fp),
       header_(header),
-      idx_(idx),
-      sampler_(options.downsample_fraction(), options.random_seed()) {
+      idx_(idx) {
   CHECK(fp != nullptr) << "pointer to SAM/BAM cannot be null";
+  CHECK_GE(options.downsample_fraction(), 0.0) << "Must be between 0.0 and 1.0";
+  CHECK_LE(options.downsample_fraction(), 1.0) << "Must be between 0.0 and 1.0";
   CHECK(header_ != nullptr) << "pointer to header cannot be null";
 
   // Fill in the contig info for each contig in the sam header. Directly
@@ -412,15 +743,22 @@ StatusOr<std::unique_ptr<SamReader>> SamReader::FromFile(
                options.ShortDebugString()));
   }
 
-  htsFile* fp = hts_open_x(reads_path.c_str(), "r");
-  if (!fp) {
-    return tf::errors::NotFound(StrCat("Could not open ", reads_path));
-  }
-
   if (options.hts_block_size() > 0) {
     LOG(INFO) << "Setting HTS_OPT_BLOCK_SIZE to " << options.hts_block_size();
-    if (hts_set_opt(fp, HTS_OPT_BLOCK_SIZE, options.hts_block_size()) != 0)
-      return tf::errors::Unknown(StrCat("Failed to set HTS_OPT_BLOCK_SIZE"));
+  }
+  if (options.num_decompression_threads() > 0) {
+    LOG(INFO) << "Decompressing " << reads_path << " with "
+              << options.num_decompression_threads() << " threads";
+  }
+  StatusOr<htsFile*> fp_or = OpenHtsFile(reads_path, options);
+  TF_RETURN_IF_ERROR(fp_or.status());
+  htsFile* fp = fp_or.ValueOrDie();
+  if (IsCram(fp)) {
+    const tf::Status status = SetUpCramHandle(fp, options, nullptr);
+    if (!status.ok()) {
+      hts_close(fp);
+      return status;
+    }
   }
 
   bam_hdr_t* header = sam_hdr_read(fp);
@@ -474,15 +812,93 @@ void SamReader::ParseSamplesFromHeader() {
 
 // Returns true if read should be returned to the client, or false otherwise.
 bool SamReader::KeepRead(const learning::genomics::v1::Read& read) const {
-  return (!options_.has_read_requirements() ||
-          ReadSatisfiesRequirements(read, options_.read_requirements())) &&
-         // Downsample if the downsampling fraction is set.
-         // Note that this can in be moved into the lower-level reader loops for
-         // a slight efficiency gain (don't have to convert from bam_t to Read
-         // proto but the logic to do so is much more complex than just eating
-         // that cost and putting the sampling code here where it naturally fits
-         // and is shared across all iteration methods.
-         (options_.downsample_fraction() == 0.0 || sampler_.Keep());
+  if (options_.has_read_requirements() &&
+      !ReadSatisfiesRequirements(read, options_.read_requirements())) {
+    return false;
+  }
+  return KeepAfterDownsampling(
+      read.fragment_name(), read.read_number(), read.secondary_alignment(),
+      read.supplementary_alignment(), read.alignment().position().position());
+}
+
+bool SamReader::KeepRead(const ReadView& read) const {
+  if (options_.has_read_requirements() &&
+      !ReadSatisfiesRequirements(read, options_.read_requirements())) {
+    return false;
+  }
+  return KeepAfterDownsampling(read.FragmentName(), read.ReadNumber(),
+                               read.IsSecondaryAlignment(),
+                               read.IsSupplementaryAlignment(),
+                               read.Position());
+}
+
+bool SamReader::KeepAfterDownsampling(const tf::StringPiece fragment_name,
+                                      const int read_number,
+                                      const bool secondary_alignment,
+                                      const bool supplementary_alignment,
+                                      const tf::int64 position) const {
+  // Downsample if the downsampling fraction is set.
+  // Note that this can in be moved into the lower-level reader loops for
+  // a slight efficiency gain (don't have to convert from bam_t to Read
+  // proto but the logic to do so is much more complex than just eating
+  // that cost and putting the sampling code here where it naturally fits
+  // and is shared across all iteration methods.
+  if (options_.downsample_fraction() == 0.0) {
+    return true;
+  }
+  // Each read is kept or not depending only on the read and our seed, not on
+  // the reads before it, so concurrent queries, queries of overlapping regions
+  // and iteration all keep the same reads.
+  tf::uint64 hash = tf::Hash64(fragment_name.data(), fragment_name.size(),
+                               options_.random_seed());
+  hash = tf::Hash64Combine(hash, position);
+  hash = tf::Hash64Combine(hash, read_number | secondary_alignment << 1 |
+                                     supplementary_alignment << 2);
+  // The top 53 bits of the hash make a uniform double in [0, 1).
+  return std::ldexp(static_cast<double>(hash >> 11), -53) <
+         options_.downsample_fraction();
+}
+
+StatusOr<htsFile*> SamReader::AcquireHandle() const {
+  {
+    tf::mutex_lock lock(handles_mutex_);
+    if (!free_handles_.empty()) {
+      htsFile* fp = free_handles_.back();
+      free_handles_.pop_back();
+      return fp;
+    }
+  }
+  // Our header and index are shared, so opening a new handle doesn't parse or
+  // load anything.
+  StatusOr<htsFile*> fp_or = OpenHtsFile(reads_path_, options_);
+  TF_RETURN_IF_ERROR(fp_or.status());
+  htsFile* fp = fp_or.ValueOrDie();
+  if (IsCram(fp)) {
+    // The reference cache of fp_ is freed when the last handle sharing it is
+    // closed, so it only has to outlive this call.
+    tf::Status status;
+    {
+      tf::mutex_lock lock(handles_mutex_);
+      status = fp_ == nullptr
+                   ? tf::errors::FailedPrecondition("SamReader is closed.")
+                   : SetUpCramHandle(fp, options_, cram_get_refs(fp_));
+    }
+    if (!status.ok()) {
+      hts_close(fp);
+      return status;
+    }
+  }
+  return fp;
+}
+
+void SamReader::ReleaseHandle(htsFile* fp) const {
+  tf::mutex_lock lock(handles_mutex_);
+  if (fp_ == nullptr) {
+    // We've been closed, so we'll never use this handle again.
+    hts_close(fp);
+  } else {
+    free_handles_.push_back(fp);
+  }
 }
 
 StatusOr<std::shared_ptr<SamIterable>> SamReader::Iterate() const {
@@ -492,7 +908,8 @@ StatusOr<std::shared_ptr<SamIterable>> SamReader::Iterate() const {
       MakeIterable<SamFullFileIterable>(this, fp_, header_));
 }
 
-StatusOr<std::shared_ptr<SamIterable>> SamReader::Query(
+template <class Record>
+StatusOr<std::shared_ptr<Iterable<Record>>> SamReader::QueryRecords(
     const Range& region) const {
   if (fp_ == nullptr)
     return tf::errors::FailedPrecondition("Cannot Query a closed SamReader.");
@@ -516,10 +933,136 @@ StatusOr<std::shared_ptr<SamIterable>> SamReader::Query(
                "' specifies an unknown reference interval"));
   }
 
-  return StatusOr<std::shared_ptr<SamIterable>>(
-      MakeIterable<SamQueryIterable>(this, fp_, header_, iter));
+  StatusOr<htsFile*> fp = AcquireHandle();
+  if (!fp.ok()) {
+    hts_itr_destroy(iter);
+    return fp.status();
+  }
+  return StatusOr<std::shared_ptr<Iterable<Record>>>(
+      MakeConcurrentIterable<SamQueryIterable<Record>>(
+          this, fp.ValueOrDie(), header_, iter, tid, region.start()));
+}
+
+StatusOr<std::shared_ptr<SamIterable>> SamReader::Query(
+    const Range& region) const {
+  return QueryRecords<Read>(region);
+}
+
+StatusOr<std::shared_ptr<SamViewIterable>> SamReader::QueryViews(
+    const Range& region) const {
+  return QueryRecords<ReadView>(region);
 }
 
+StatusOr<std::shared_ptr<SamRegionsIterable>> SamReader::QueryMultiple(
+    const std::vector<Range>& regions) const {
+  if (fp_ == nullptr)
+    return tf::errors::FailedPrecondition("Cannot Query a closed SamReader.");
+  if (!HasIndex()) {
+    return tf::errors::FailedPrecondition("Cannot query without an index");
+  }
+
+  std::vector<int> tids;
+  tids.reserve(regions.size());
+  for (size_t i = 0; i < regions.size(); ++i) {
+    const Range& region = regions[i];
+    const int tid = bam_name2id(header_, region.reference_name().c_str());
+    if (tid < 0) {
+      return tf::errors::NotFound(
+          StrCat("Unknown reference_name ", region.ShortDebugString()));
+    }
+    if (i > 0 && tid == tids.back() &&
+        region.start() < regions[i - 1].start()) {
+      return tf::errors::InvalidArgument(
+          StrCat("regions must be sorted by start within each contig but got ",
+                 region.ShortDebugString(), " after ",
+                 regions[i - 1].ShortDebugString()));
+    }
+    tids.push_back(tid);
+  }
+
+  StatusOr<htsFile*> fp = AcquireHandle();
+  TF_RETURN_IF_ERROR(fp.status());
+  return StatusOr<std::shared_ptr<SamRegionsIterable>>(
+      MakeConcurrentIterable<SamMultiQueryIterable>(
+          this, fp.ValueOrDie(), header_, idx_, regions, tids));
+}
+
+StatusOr<std::vector<Range>> SamReader::Chunks(
+    const tf::int64 reads_per_chunk) const {
+  if (fp_ == nullptr)
+    return tf::errors::FailedPrecondition("Cannot chunk a closed SamReader.");
+  if (!HasIndex()) {
+    return tf::errors::FailedPrecondition("Cannot chunk without an index");
+  }
+  if (reads_per_chunk <= 0) {
+    return tf::errors::InvalidArgument(
+        StrCat("reads_per_chunk must be > 0 but got ", reads_per_chunk));
+  }
+
+  std::vector<Range> chunks;
+  for (int tid = 0; tid < header_->n_targets; ++tid) {
+    const tf::int64 length = header_->target_len[tid];
+    uint64_t mapped = 0, unmapped = 0;
+    tf::int64 n_chunks = 1;
+    if (hts_idx_get_stat(idx_, tid, &mapped, &unmapped) == 0) {
+      if (mapped + unmapped == 0) continue;
+      n_chunks = (mapped + unmapped + reads_per_chunk - 1) / reads_per_chunk;
+    }
+    n_chunks = std::max<tf::int64>(1, std::min(n_chunks, length));
+    const tf::int64 width = (length + n_chunks - 1) / n_chunks;
+    for (tf::int64 start = 0; start < length; start += width) {
+      Range chunk;
+      chunk.set_reference_name(header_->target_name[tid]);
+      chunk.set_start(start);
+      chunk.set_end(std::min(start + width, length));
+      chunks.push_back(chunk);
+    }
+  }
+  if (hts_idx_get_n_no_coor(idx_) > 0) {
+    Range chunk;
+    chunk.set_reference_name(kUnplacedReadsChunk);
+    chunks.push_back(chunk);
+  }
+  return chunks;
+}
+
+StatusOr<std::shared_ptr<SamIterable>> SamReader::IterateChunk(
+    const Range& chunk) const {
+  if (fp_ == nullptr)
+    return tf::errors::FailedPrecondition("Cannot Query a closed SamReader.");
+  if (!HasIndex()) {
+    return tf::errors::FailedPrecondition("Cannot query without an index");
+  }
+
+  hts_itr_t* iter = nullptr;
+  // Unplaced reads have no start, so we keep all of them.
+  tf::int64 start = -1;
+  if (chunk.reference_name() == kUnplacedReadsChunk) {
+    iter = sam_itr_queryi(idx_, HTS_IDX_NOCOOR, 0, 0);
+  } else {
+    const int tid = bam_name2id(header_, chunk.reference_name().c_str());
+    if (tid < 0) {
+      return tf::errors::NotFound(
+          StrCat("Unknown reference_name ", chunk.ShortDebugString()));
+    }
+    iter = sam_itr_queryi(idx_, tid, chunk.start(), chunk.end());
+    start = chunk.start();
+  }
+  if (iter == nullptr) {
+    return tf::errors::NotFound(
+        StrCat("chunk '", chunk.ShortDebugString(),
+               "' specifies an unknown reference interval"));
+  }
+
+  StatusOr<htsFile*> fp = AcquireHandle();
+  if (!fp.ok()) {
+    hts_itr_destroy(iter);
+    return fp.status();
+  }
+  return StatusOr<std::shared_ptr<SamIterable>>(
+      MakeConcurrentIterable<SamChunkIterable>(this, fp.ValueOrDie(), header_,
+                                               iter, start));
+}
 
 tf::Status SamReader::Close() {
   if (HasIndex()) {
@@ -528,6 +1071,11 @@ tf::Status SamReader::Close() {
   }
   bam_hdr_destroy(header_);
   header_ = nullptr;
+  tf::mutex_lock lock(handles_mutex_);
+  for (htsFile* fp : free_handles_) {
+    hts_close(fp);
+  }
+  free_handles_.clear();
   int retval = hts_close(fp_);
   fp_ = nullptr;
   if (retval < 0) {
@@ -541,6 +1089,7 @@ tf::Status SamReader::Close() {
 // Iterable class definitions.
 
 StatusOr<bool> SamFullFileIterable::Next(Read* out) {
+  ScopedStageTimer timer(READ_DECODE);
   TF_RETURN_IF_ERROR(CheckIsAlive());
   // Keep reading until "reader_->KeepRead(.)"
   const SamReader* sam_reader = static_cast<const SamReader*>(reader_);
@@ -554,9 +1103,10 @@ StatusOr<bool> SamFullFileIterable::Next(Read* out) {
     } else if (code < -1) {
       return tf::errors::DataLoss("Failed to parse SAM record");
     }
-    // Convert to proto.
-    TF_RETURN_IF_ERROR(ConvertToPb(header_, bam1_, sam_reader->options(), out));
-  } while (!sam_reader->KeepRead(*out));
+  } while (!sam_reader->KeepRead(ReadView(header_, bam1_)));
+  // Our filters look at a view of each record, so we only convert the reads we
+  // keep, and apply to all fields of the record whichever of them we parse.
+  TF_RETURN_IF_ERROR(ConvertToPb(header_, bam1_, sam_reader->options(), out));
   return true;
 }
 
@@ -575,40 +1125,183 @@ SamFullFileIterable::SamFullFileIterable(const SamReader* reader,
 
 // redacted
 // class that only differs in sam_itr_next vs sam_read1 calls.
-StatusOr<bool> SamQueryIterable::Next(Read* out) {
+template <class Record>
+StatusOr<bool> SamQueryIterable<Record>::Next(Record* out) {
+  ScopedStageTimer timer(READ_DECODE);
+  TF_RETURN_IF_ERROR(this->CheckIsAlive());
+  const SamReader* sam_reader = static_cast<const SamReader*>(this->reader_);
+  const bam1_t* record;
+  StatusOr<bool> more = records_.Next(&record);
+  if (!more.ok() || !more.ValueOrDie()) return more;
+  // Convert the kept record to proto, or just view it.
+  TF_RETURN_IF_ERROR(ParseRecord(header_, record, sam_reader->options(), out));
+  return true;
+}
+
+template <class Record>
+SamQueryIterable<Record>::~SamQueryIterable() {
+  hts_itr_destroy(iter_);
+  // Give our handle back to the reader for later queries, unless the reader is
+  // gone or we were released, in which case nobody else can use it.
+  if (this->IsAlive()) {
+    static_cast<const SamReader*>(this->reader_)->ReleaseHandle(fp_);
+  } else {
+    hts_close(fp_);
+  }
+}
+
+template <class Record>
+SamQueryIterable<Record>::SamQueryIterable(const SamReader* reader,
+                                           htsFile* fp,
+                                           bam_hdr_t* header,
+                                           hts_itr_t* iter,
+                                           int tid,
+                                           tf::int64 start)
+    : Iterable<Record>(reader),
+      fp_(fp),
+      header_(header),
+      iter_(iter),
+      records_(reader, fp, header) {
+  records_.Start(iter, tid, start);
+}
+
+StatusOr<bool> SamChunkIterable::Next(Read* out) {
+  ScopedStageTimer timer(READ_DECODE);
   TF_RETURN_IF_ERROR(CheckIsAlive());
   // Keep reading until "reader_->KeepRead(.)"
   const SamReader* sam_reader = static_cast<const SamReader*>(reader_);
   do {
-    // Get next in query window; return false if no more records.
+    // Get next in the chunk; return false if no more records.
     int code = sam_itr_next(fp_, iter_, bam1_);
     if (code == -1) {
       return false;
     } else if (code < -1) {
       return tf::errors::DataLoss("Failed to parse SAM record");
     }
-    // Convert to proto.
-    TF_RETURN_IF_ERROR(ConvertToPb(header_, bam1_, sam_reader->options(), out));
-  } while (!sam_reader->KeepRead(*out));
+    // Records starting before our chunk are read with the previous chunk, so
+    // we skip them before applying our filters.
+  } while (bam1_->core.pos < start_ ||
+           !sam_reader->KeepRead(ReadView(header_, bam1_)));
+  TF_RETURN_IF_ERROR(ConvertToPb(header_, bam1_, sam_reader->options(), out));
   return true;
 }
 
-SamQueryIterable::~SamQueryIterable() {
+SamChunkIterable::~SamChunkIterable() {
   bam_destroy1(bam1_);
   hts_itr_destroy(iter_);
+  if (IsAlive()) {
+    static_cast<const SamReader*>(reader_)->ReleaseHandle(fp_);
+  } else {
+    hts_close(fp_);
+  }
 }
 
-SamQueryIterable::SamQueryIterable(const SamReader* reader,
-                                   htsFile* fp,
-                                   bam_hdr_t* header,
-                                   hts_itr_t* iter)
+SamChunkIterable::SamChunkIterable(const SamReader* reader, htsFile* fp,
+                                   bam_hdr_t* header, hts_itr_t* iter,
+                                   tf::int64 start)
     : Iterable(reader),
       fp_(fp),
       header_(header),
       iter_(iter),
+      start_(start),
       bam1_(bam_init1())
 {}
 
+SamMultiQueryIterable::SamMultiQueryIterable(
+    const SamReader* reader, htsFile* fp, bam_hdr_t* header, hts_idx_t* idx,
+    const std::vector<Range>& regions, const std::vector<int>& tids)
+    : Iterable(reader),
+      fp_(fp),
+      header_(header),
+      idx_(idx),
+      regions_(regions),
+      tids_(tids),
+      records_(reader, fp, header)
+{}
+
+SamMultiQueryIterable::~SamMultiQueryIterable() {
+  if (iter_ != nullptr) hts_itr_destroy(iter_);
+  if (IsAlive()) {
+    static_cast<const SamReader*>(reader_)->ReleaseHandle(fp_);
+  } else {
+    hts_close(fp_);
+  }
+}
+
+tf::Status SamMultiQueryIterable::StartRun() {
+  const int tid = tids_[next_region_];
+  const tf::int64 start = regions_[next_region_].start();
+  tf::int64 end = regions_[next_region_].end();
+  run_end_ = next_region_ + 1;
+  while (run_end_ < regions_.size() && tids_[run_end_] == tid &&
+         regions_[run_end_].start() <= end) {
+    end = std::max<tf::int64>(end, regions_[run_end_].end());
+    ++run_end_;
+  }
+
+  if (iter_ != nullptr) hts_itr_destroy(iter_);
+  buffer_.clear();
+  iter_done_ = false;
+  last_start_ = -1;
+  iter_ = sam_itr_queryi(idx_, tid, start, end);
+  if (iter_ == nullptr) {
+    return tf::errors::NotFound(
+        StrCat("region '", regions_[next_region_].ShortDebugString(),
+               "' specifies an unknown reference interval"));
+  }
+  records_.Start(iter_, tid, start);
+  return tf::Status::OK();
+}
+
+StatusOr<bool> SamMultiQueryIterable::Next(std::vector<Read>* out) {
+  ScopedStageTimer timer(READ_DECODE);
+  TF_RETURN_IF_ERROR(CheckIsAlive());
+  if (next_region_ == regions_.size()) return false;
+  if (next_region_ == run_end_) TF_RETURN_IF_ERROR(StartRun());
+  const Range& region = regions_[next_region_++];
+
+  // Later regions of the run start no earlier than this one, so reads ending
+  // before it starts can't overlap any of them.
+  buffer_.erase(std::remove_if(buffer_.begin(), buffer_.end(),
+                               [&region](const BufferedRead& buffered) {
+                                 return buffered.end <= region.start();
+                               }),
+                buffer_.end());
+
+  // Our records come sorted by start, so once one starts at or after the end of
+  // region we have all of its reads.
+  const SamReader* sam_reader = static_cast<const SamReader*>(reader_);
+  while (!iter_done_ && last_start_ < region.end()) {
+    // Our filters are applied to a view of each record, so we only convert
+    // the reads we keep.
+    const bam1_t* record;
+    StatusOr<bool> more = records_.Next(&record);
+    TF_RETURN_IF_ERROR(more.status());
+    if (!more.ValueOrDie()) {
+      iter_done_ = true;
+      break;
+    }
+    last_start_ = record->core.pos;
+    const tf::int64 end = bam_endpos(record);
+    // Skip records that end before this region, because of the earlier
+    // regions of the run, before we spend any more time on them.
+    if (end <= region.start()) continue;
+    buffer_.emplace_back();
+    BufferedRead& buffered = buffer_.back();
+    TF_RETURN_IF_ERROR(
+        ConvertToPb(header_, record, sam_reader->options(), &buffered.read));
+    buffered.start = last_start_;
+    buffered.end = end;
+  }
+
+  out->clear();
+  for (const BufferedRead& buffered : buffer_) {
+    if (buffered.start < region.end() && buffered.end > region.start()) {
+      out->push_back(buffered.read);
+    }
+  }
+  return true;
+}
 
 }  // namespace core
 }  // namespace genomics
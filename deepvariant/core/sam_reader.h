@@ -32,14 +32,18 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_SAM_READER_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_CORE_SAM_READER_H_
 
+#include <set>
+#include <vector>
+
 #include "deepvariant/core/genomics/range.pb.h"
 #include "deepvariant/core/genomics/reads.pb.h"
 #include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/read_view.h"
 #include "deepvariant/core/reader_base.h"
-#include "deepvariant/core/samplers.h"
 #include "deepvariant/vendor/statusor.h"
 #include "htslib/hts.h"
 #include "htslib/sam.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace learning {
@@ -51,14 +55,30 @@ using tensorflow::string;
 // Alias for the abstract base class for SAM record iterables.
 using SamIterable = Iterable<learning::genomics::v1::Read>;
 
-// A SAM/BAM reader.
+// Alias for the abstract base class for iterables over views of SAM records.
+using SamViewIterable = Iterable<ReadView>;
+
+// Alias for the abstract base class for iterables giving the reads of each of
+// a series of regions in turn.
+using SamRegionsIterable =
+    Iterable<std::vector<learning::genomics::v1::Read>>;
+
+template <class Record>
+class SamQueryIterable;  // Forward declaration.
+class SamMultiQueryIterable;  // Forward declaration.
+class SamChunkIterable;  // Forward declaration.
+
+// A SAM/BAM/CRAM reader.
 //
-// SAM/BAM files store information about next-generation DNA sequencing info:
+// SAM/BAM/CRAM files store information about next-generation DNA sequencing
+// reads:
 //
 // https://samtools.github.io/hts-specs/SAMv1.pdf
+// https://samtools.github.io/hts-specs/CRAMv3.pdf
 //
-// These files are block-gzipped series of records. When aligned they are
-// frequently sorted and indexed:
+// BAM files are block-gzipped series of records, while CRAM files compress
+// the records by column and store their bases as differences from the
+// reference genome. When aligned they are frequently sorted and indexed:
 //
 // http://www.htslib.org/doc/samtools.html
 //
@@ -71,18 +91,25 @@ using SamIterable = Iterable<learning::genomics::v1::Read>;
 // https://github.com/samtools/htslib/tree/develop/htslib
 //
 // The objects returned by iterate() or query() are learning.genomics.v1.Read
-// objects parsed from the SAM/BAM records in the file. Currently all fields
-// except the extended key/value maps in each BAM fields are parsed.
+// objects parsed from the SAM/BAM records in the file. By default all fields
+// except the extended key/value maps in each BAM fields are parsed, but
+// options.desired_read_fields can exclude the fields a client doesn't use.
 //
 class SamReader : public Reader {
  public:
   // Creates a new SamReader reading reads from the SAM/BAM file reads_path.
   //
-  // reads_path must point to an existing SAM/BAM formatted file (text SAM or
-  // compressed or uncompressed BAM file).
+  // reads_path must point to an existing SAM/BAM/CRAM formatted file (text
+  // SAM, compressed or uncompressed BAM file, or CRAM file).
   //
   // If options.index_mode indicates we should load an index, this constructor
-  // will attempt to load a BAI index from file reads_path + '.bai'.
+  // will attempt to load a BAI index from file reads_path + '.bai', or a CRAI
+  // index from reads_path + '.crai' for a CRAM file.
+  //
+  // A CRAM file is decoded against options.reference_filename, if given. All
+  // of the handles we open on it share a single cache of the reference
+  // sequences they have loaded, and htslib only decodes the fields of each
+  // record that we parse, skipping aux fields unless options asks for them.
   //
   // Returns a StatusOr that is OK if the SamReader could be successfully
   // created or an error code indicating the error that occurred.
@@ -120,9 +147,73 @@ class SamReader : public Reader {
   //
   // If range isn't a valid interval in this BAM file a non-OK status value will
   // be returned.
+  //
+  // Unlike Iterate(), any number of query iterables can be live at once, and
+  // they may be used concurrently from different threads. Each reads through
+  // its own handle on our file, taken from a pool of handles that are returned
+  // for reuse when the iterable is destroyed, while sharing our parsed header
+  // and loaded index. So queries are cheap even when they don't overlap in
+  // time.
   StatusOr<std::shared_ptr<SamIterable>> Query(
       const learning::genomics::v1::Range& region) const;
 
+  // Gets views of all of the reads that overlap any bases in range.
+  //
+  // This is exactly like Query(), filtering and downsampling the same reads,
+  // but instead of converting each record into a Read proto the returned
+  // iterable gives a ReadView of its current record. This is much cheaper for
+  // native code that only needs to look at the bases and alignment of each
+  // read, such as the AlleleCounter. Each view is only valid until the next
+  // call to Next() on its iterable.
+  StatusOr<std::shared_ptr<SamViewIterable>> QueryViews(
+      const learning::genomics::v1::Range& region) const;
+
+  // Gets the reads that overlap each of regions, in turn.
+  //
+  // Each call to Next() on the returned iterable gives all of the reads
+  // overlapping the next region, in the same order as Query(). Rather than
+  // seeking to and decoding each region separately, a run of regions on the
+  // same contig that are adjacent or overlap is read with a single query over
+  // their span, so each BAM record in the span is decoded, filtered and
+  // converted to a Read once, and a read spanning the boundary of several
+  // regions is carried over to each of them. This makes it much cheaper than
+  // Query() for the many small adjacent regions processed by DeepVariant.
+  //
+  // regions must be sorted by start within each contig they cover, though
+  // different contigs may come in any order. Returns a non-OK status if they
+  // aren't, if there's no index, or if a region names an unknown contig. Like
+  // Query(), any number of these iterables may be used concurrently.
+  StatusOr<std::shared_ptr<SamRegionsIterable>> QueryMultiple(
+      const std::vector<learning::genomics::v1::Range>& regions) const;
+
+  // Splits the reads of this file into chunks for reading in parallel with
+  // IterateChunk(), returning a Range for each chunk.
+  //
+  // Each contig is split into chunks of equal width, sized with the counts of
+  // reads on the contig stored in our index so each chunk has about
+  // reads_per_chunk reads. Contigs without any reads have no chunks. If the
+  // file has unmapped reads that aren't placed on any contig, the last chunk
+  // is for them and has the reference_name "*". A contig is a single chunk if
+  // our index has no read counts.
+  //
+  // Requires an index: returns a non-OK status if there isn't one, or if
+  // reads_per_chunk isn't > 0.
+  StatusOr<std::vector<learning::genomics::v1::Range>> Chunks(
+      tensorflow::int64 reads_per_chunk) const;
+
+  // Gets the reads of chunk, one of the chunks of Chunks().
+  //
+  // These are the reads starting within chunk, or, if its reference_name is
+  // "*", the unmapped reads not placed on any contig. The reads of chunks
+  // don't overlap and, like Iterate(), aren't capped by max_depth, so reading
+  // each of the chunks in turn gives the same reads as Iterate() for a sorted
+  // file. Each chunk is read with the index, seeking to the first of the
+  // compressed blocks holding its reads, so different threads can decode
+  // different chunks at the same time. Like Query(), any number of these
+  // iterables may be used concurrently.
+  StatusOr<std::shared_ptr<SamIterable>> IterateChunk(
+      const learning::genomics::v1::Range& chunk) const;
+
   // Returns True if this SamReader loaded an index file.
   bool HasIndex() const { return idx_ != nullptr; }
 
@@ -137,7 +228,10 @@ class SamReader : public Reader {
   // not use it! Returns a Status indicating whether the enter was successful.
   tensorflow::Status PythonEnter() const { return tensorflow::Status::OK(); }
 
+  // Returns true if read should be returned to the client, applying our read
+  // requirements and downsampling.
   bool KeepRead(const learning::genomics::v1::Read& read) const;
+  bool KeepRead(const ReadView& read) const;
 
   const SamReaderOptions& options() const { return options_; }
 
@@ -145,11 +239,38 @@ class SamReader : public Reader {
   const std::set<string>& Samples() const { return samples_; }
 
  private:
+  template <class Record>
+  friend class SamQueryIterable;
+  friend class SamMultiQueryIterable;
+  friend class SamChunkIterable;
+
   // Private constructor; use FromFile to safely create a SamReader from a
   // file.
   SamReader(const string& reads_path, const SamReaderOptions& options,
             htsFile* fp, bam_hdr_t* header, hts_idx_t* idx);
 
+  // Gets an open handle on our file for a query iterable, reusing one that was
+  // previously released if possible.
+  StatusOr<htsFile*> AcquireHandle() const;
+
+  // Returns fp, acquired with AcquireHandle(), to the pool of free handles. fp
+  // is closed instead if this reader has been closed.
+  void ReleaseHandle(htsFile* fp) const;
+
+  // Starts a query of region, for Query() and QueryViews().
+  template <class Record>
+  StatusOr<std::shared_ptr<Iterable<Record>>> QueryRecords(
+      const learning::genomics::v1::Range& region) const;
+
+  // Returns true if we keep the read with these fields after downsampling.
+  bool KeepAfterDownsampling(tensorflow::StringPiece fragment_name,
+                             int read_number, bool secondary_alignment,
+                             bool supplementary_alignment,
+                             tensorflow::int64 position) const;
+
+  // The path to our SAM/BAM file.
+  const string reads_path_;
+
   // Our options that control the behavior of this class.
   const SamReaderOptions options_;
 
@@ -172,8 +293,11 @@ class SamReader : public Reader {
 
   void ParseSamplesFromHeader();
 
-  // For downsampling reads.
-  mutable core::PhiloxFractionalSampler sampler_;
+  // Open handles on our file that aren't used by any query iterable.
+  mutable std::vector<htsFile*> free_handles_;
+  // Mutex protecting free_handles_ and closing fp_.
+  mutable tensorflow::mutex handles_mutex_;
+
 };
 
 }  // namespace core
@@ -31,7 +31,12 @@
 
 #include "deepvariant/core/sam_reader.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
 #include <string>
+#include <thread>  // NOLINT
+#include <vector>
 
 #include "deepvariant/core/test_utils.h"
 #include "deepvariant/core/utils.h"
@@ -254,6 +259,290 @@ TEST_F(SamReaderQueryTest, ReadAfterClose) {
               IsNotOKWithMessage("Cannot Query a closed SamReader."));
 }
 
+TEST_F(SamReaderQueryTest, ConcurrentQueriesWork) {
+  const Range range1 = MakeRange("chr20", 9999999, 10000000);
+  const Range range2 = MakeRange("chr20", 9999999, 10000100);
+  const std::vector<Read> expected1 = as_vector(reader_->Query(range1));
+  const std::vector<Read> expected2 = as_vector(reader_->Query(range2));
+  ASSERT_THAT(expected1, SizeIs(45));
+  ASSERT_THAT(expected2, SizeIs(106));
+
+  // Interleave reading from two live query iterables, alongside a live full
+  // file iteration.
+  std::shared_ptr<SamIterable> full = reader_->Iterate().ValueOrDie();
+  ASSERT_NE(full, nullptr);
+  std::shared_ptr<SamIterable> it1 = reader_->Query(range1).ValueOrDie();
+  std::shared_ptr<SamIterable> it2 = reader_->Query(range2).ValueOrDie();
+  ASSERT_NE(it1, nullptr);
+  ASSERT_NE(it2, nullptr);
+  std::vector<Read> reads1, reads2;
+  Read read;
+  bool more1 = true, more2 = true;
+  while (more1 || more2) {
+    if (more1) {
+      more1 = it1->Next(&read).ValueOrDie();
+      if (more1) reads1.push_back(read);
+    }
+    if (more2) {
+      more2 = it2->Next(&read).ValueOrDie();
+      if (more2) reads2.push_back(read);
+    }
+  }
+  EXPECT_THAT(reads1, Pointwise(EqualsProto(), expected1));
+  EXPECT_THAT(reads2, Pointwise(EqualsProto(), expected2));
+  EXPECT_TRUE(full->Next(&read).ValueOrDie());
+}
+
+TEST_F(SamReaderQueryTest, QueriesFromManyThreads) {
+  const Range range = MakeRange("chr20", 9999999, 10000100);
+  const std::vector<Read> expected = as_vector(reader_->Query(range));
+  constexpr int kNumThreads = 8;
+  std::vector<std::vector<Read>> results(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([this, &range, &results, i]() {
+      for (int j = 0; j < 10; ++j) {
+        results[i] = as_vector(reader_->Query(range));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (const std::vector<Read>& result : results) {
+    EXPECT_THAT(result, Pointwise(EqualsProto(), expected));
+  }
+}
+
+TEST_F(SamReaderQueryTest, QueryOutlivesReader) {
+  std::shared_ptr<SamIterable> it =
+      reader_->Query(MakeRange("chr20", 9999999, 10000000)).ValueOrDie();
+  reader_.reset();
+  Read read;
+  EXPECT_THAT(it->Next(&read), IsNotOKWithMessage("Reader is not alive"));
+}
+
+TEST_F(SamReaderQueryTest, DecompressionThreadsGiveSameReads) {
+  const Range range = MakeRange("chr20", 9999999, 10000100);
+  const std::vector<Read> expected = as_vector(reader_->Query(range));
+  const std::vector<Read> expected_all = as_vector(reader_->Iterate());
+  options_.set_num_decompression_threads(2);
+  RecreateReader();
+  EXPECT_THAT(as_vector(reader_->Query(range)),
+              Pointwise(EqualsProto(), expected));
+  EXPECT_THAT(as_vector(reader_->Iterate()),
+              Pointwise(EqualsProto(), expected_all));
+}
+
+// Only CRAM files are decoded against a reference, so BAM files read the same
+// with or without one.
+TEST_F(SamReaderQueryTest, ReferenceIsIgnoredForBam) {
+  const Range range = MakeRange("chr20", 9999999, 10000100);
+  const std::vector<Read> expected = as_vector(reader_->Query(range));
+  options_.set_reference_filename(GetTestData("test.fasta"));
+  RecreateReader();
+  EXPECT_THAT(as_vector(reader_->Query(range)),
+              Pointwise(EqualsProto(), expected));
+}
+
+TEST_F(SamReaderQueryTest, DesiredReadFieldsAreExcluded) {
+  const Range range = MakeRange("chr20", 9999999, 10000100);
+  std::vector<Read> expected = as_vector(reader_->Query(range));
+  for (Read& read : expected) {
+    read.clear_fragment_length();
+    read.clear_aligned_quality();
+    read.clear_next_mate_position();
+  }
+  OptionalReadFieldsToParse* fields = options_.mutable_desired_read_fields();
+  fields->set_exclude_fragment_length(true);
+  fields->set_exclude_aligned_quality(true);
+  fields->set_exclude_next_mate_position(true);
+  RecreateReader();
+  EXPECT_THAT(as_vector(reader_->Query(range)),
+              Pointwise(EqualsProto(), expected));
+}
+
+// Returns the largest number of reads overlapping any one position.
+int MaxDepth(const std::vector<Read>& reads) {
+  std::map<tensorflow::int64, int> depth_changes;
+  for (const Read& read : reads) {
+    ++depth_changes[read.alignment().position().position()];
+    --depth_changes[ReadEnd(read)];
+  }
+  int depth = 0, max_depth = 0;
+  for (const auto& change : depth_changes) {
+    depth += change.second;
+    max_depth = std::max(max_depth, depth);
+  }
+  return max_depth;
+}
+
+TEST_F(SamReaderQueryTest, MaxDepthCapsTheDepthOfQueries) {
+  const Range range = MakeRange("chr20", 9999999, 10000100);
+  const std::vector<Read> all_reads = as_vector(reader_->Query(range));
+  ASSERT_GT(MaxDepth(all_reads), 10);
+
+  options_.set_max_depth(10);
+  RecreateReader();
+  const std::vector<Read> capped = as_vector(reader_->Query(range));
+  EXPECT_LE(MaxDepth(capped), 10);
+  EXPECT_LT(capped.size(), all_reads.size());
+  // The reads kept are a subsequence of all of the reads.
+  size_t next = 0;
+  for (const Read& read : capped) {
+    while (next < all_reads.size() &&
+           all_reads[next].SerializeAsString() != read.SerializeAsString()) {
+      ++next;
+    }
+    ASSERT_LT(next++, all_reads.size()) << read.ShortDebugString();
+  }
+  // Repeating the query gives the same reads.
+  EXPECT_THAT(as_vector(reader_->Query(range)),
+              Pointwise(EqualsProto(), capped));
+
+  const std::vector<std::vector<Read>> multiple =
+      as_vector(reader_->QueryMultiple({range}));
+  ASSERT_THAT(multiple, SizeIs(1));
+  EXPECT_THAT(multiple[0], Pointwise(EqualsProto(), capped));
+}
+
+TEST_F(SamReaderQueryTest, MaxDepthAboveTheDepthKeepsEveryRead) {
+  const Range range = MakeRange("chr20", 9999999, 10000100);
+  const std::vector<Read> all_reads = as_vector(reader_->Query(range));
+  options_.set_max_depth(MaxDepth(all_reads));
+  RecreateReader();
+  EXPECT_THAT(as_vector(reader_->Query(range)),
+              Pointwise(EqualsProto(), all_reads));
+}
+
+TEST_F(SamReaderQueryTest, ChunksGiveTheReadsOfIterate) {
+  std::vector<Read> reads;
+  for (const Range& chunk : reader_->Chunks(10).ValueOrDie()) {
+    for (const Read& read : as_vector(reader_->IterateChunk(chunk))) {
+      reads.push_back(read);
+    }
+  }
+  EXPECT_THAT(reads, Pointwise(EqualsProto(), as_vector(reader_->Iterate())));
+}
+
+TEST_F(SamReaderQueryTest, IterateChunkGivesTheReadsStartingInIt) {
+  // Many reads overlap 10000050, but each is only in the chunk it starts in.
+  const Range first = MakeRange("chr20", 0, 10000050);
+  const Range second = MakeRange("chr20", 10000050, 20000000);
+  std::vector<Read> reads = as_vector(reader_->IterateChunk(first));
+  for (const Read& read : as_vector(reader_->IterateChunk(second))) {
+    EXPECT_GE(read.alignment().position().position(), second.start());
+    reads.push_back(read);
+  }
+  EXPECT_THAT(reads,
+              Pointwise(EqualsProto(),
+                        as_vector(reader_->Query(MakeRange("chr20", 0,
+                                                           20000000)))));
+}
+
+TEST_F(SamReaderQueryTest, ChunksRejectsBadArguments) {
+  EXPECT_FALSE(reader_->Chunks(0).ok());
+  EXPECT_FALSE(reader_->IterateChunk(MakeRange("unknown", 0, 100)).ok());
+}
+
+// Checks that QueryMultiple(regions) gives the reads of Query() on each region.
+void ExpectQueryMultipleMatchesQueries(const SamReader& reader,
+                                       const std::vector<Range>& regions) {
+  const std::vector<std::vector<Read>> reads_per_region =
+      as_vector(reader.QueryMultiple(regions));
+  ASSERT_THAT(reads_per_region, SizeIs(regions.size()));
+  for (size_t i = 0; i < regions.size(); ++i) {
+    EXPECT_THAT(reads_per_region[i],
+                Pointwise(EqualsProto(), as_vector(reader.Query(regions[i]))))
+        << "region " << regions[i].ShortDebugString();
+  }
+}
+
+TEST_F(SamReaderQueryTest, QueryMultipleMatchesQueries) {
+  // Small adjacent regions across all of the reads in test.bam, which span
+  // chr20:10000000-10000100, so most reads overlap several of them.
+  std::vector<Range> adjacent;
+  for (int start = 9999950; start < 10000150; start += 10) {
+    adjacent.push_back(MakeRange("chr20", start, start + 10));
+  }
+  ExpectQueryMultipleMatchesQueries(*reader_, adjacent);
+
+  // Overlapping and nested regions, gaps between runs of regions, and regions
+  // without any reads on different contigs.
+  ExpectQueryMultipleMatchesQueries(
+      *reader_, {MakeRange("chr1", 0, 100),
+                 MakeRange("chr20", 9999999, 10000050),
+                 MakeRange("chr20", 10000000, 10000010),
+                 MakeRange("chr20", 10000020, 10000100),
+                 MakeRange("chr20", 10000070, 10000080),
+                 MakeRange("chr20", 20000000, 20000100),
+                 MakeRange("chr10", 9999999, 10000100),
+                 MakeRange("chr20", 9999999, 10000100)});
+
+  // The same reads are filtered out by our read requirements.
+  options_.mutable_read_requirements()->set_min_mapping_quality(38);
+  RecreateReader();
+  ExpectQueryMultipleMatchesQueries(*reader_, adjacent);
+}
+
+TEST_F(SamReaderQueryTest, DownsamplingKeepsTheSameReadsInEveryQuery) {
+  const Range range = MakeRange("chr20", 9999999, 10000100);
+  std::vector<Range> adjacent;
+  for (int start = 9999999; start < 10000100; start += 10) {
+    adjacent.push_back(MakeRange("chr20", start, start + 10));
+  }
+  const std::vector<Read> all_reads = as_vector(reader_->Query(range));
+  std::vector<std::vector<Read>> all_region_reads;
+  for (const Range& region : adjacent) {
+    all_region_reads.push_back(as_vector(reader_->Query(region)));
+  }
+
+  options_.set_downsample_fraction(0.5);
+  options_.set_random_seed(12345);
+  RecreateReader();
+  const std::vector<Read> kept = as_vector(reader_->Query(range));
+  EXPECT_GT(kept.size(), 0);
+  EXPECT_LT(kept.size(), all_reads.size());
+  std::set<string> kept_reads;
+  for (const Read& read : kept) kept_reads.insert(read.SerializeAsString());
+
+  // Each query of a smaller region keeps exactly the reads of kept that
+  // overlap it, even when the queries are read in another order than they are
+  // started in.
+  std::vector<std::shared_ptr<SamIterable>> queries;
+  for (const Range& region : adjacent) {
+    queries.push_back(reader_->Query(region).ValueOrDie());
+  }
+  for (int i = adjacent.size() - 1; i >= 0; --i) {
+    std::vector<Read> expected;
+    for (const Read& read : all_region_reads[i]) {
+      if (kept_reads.count(read.SerializeAsString())) expected.push_back(read);
+    }
+    EXPECT_THAT(as_vector(queries[i]), Pointwise(EqualsProto(), expected))
+        << "region " << adjacent[i].ShortDebugString();
+  }
+  ExpectQueryMultipleMatchesQueries(*reader_, adjacent);
+}
+
+TEST_F(SamReaderQueryTest, QueryMultipleWithoutRegions) {
+  std::shared_ptr<SamRegionsIterable> it =
+      reader_->QueryMultiple({}).ValueOrDie();
+  std::vector<Read> reads;
+  EXPECT_FALSE(it->Next(&reads).ValueOrDie());
+}
+
+TEST_F(SamReaderQueryTest, QueryMultipleRejectsBadRegions) {
+  EXPECT_THAT(reader_->QueryMultiple({MakeRange("chr20", 10000050, 10000100),
+                                      MakeRange("chr20", 10000000, 10000049)}),
+              IsNotOKWithMessage("regions must be sorted by start"));
+  EXPECT_THAT(reader_->QueryMultiple({MakeRange("chr20", 10000000, 10000049),
+                                      MakeRange("XXX", 1, 10)}),
+              IsNotOKWithMessage("Unknown reference_name"));
+  ASSERT_THAT(reader_->Close(), IsOK());
+  EXPECT_THAT(reader_->QueryMultiple({MakeRange("chr20", 9999999, 10000000)}),
+              IsNotOKWithMessage("Cannot Query a closed SamReader."));
+}
+
 TEST_F(SamReaderQueryTest, NextFailsOnReleasedIterable) {
   Read read;
   std::shared_ptr<SamIterable> it = reader_->Iterate().ValueOrDie();
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/stage_timer.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace {
+
+// The times of the stages of one thread, indexed by RuntimeStage.
+struct StageCounters {
+  tensorflow::int64 calls[RuntimeStage_ARRAYSIZE] = {};
+  std::chrono::steady_clock::duration time[RuntimeStage_ARRAYSIZE] = {};
+  // The number of running timers of each stage.
+  int depth[RuntimeStage_ARRAYSIZE] = {};
+};
+
+StageCounters& ThreadCounters() {
+  static thread_local StageCounters counters;
+  return counters;
+}
+
+std::atomic<bool> memory_tracking_enabled(false);
+
+// The live and peak bytes of each stage, indexed by RuntimeStage.
+std::atomic<tensorflow::int64> live_bytes[RuntimeStage_ARRAYSIZE];
+std::atomic<tensorflow::int64> peak_bytes[RuntimeStage_ARRAYSIZE];
+
+// Raises peak to at least bytes.
+void RaisePeak(std::atomic<tensorflow::int64>* peak, tensorflow::int64 bytes) {
+  tensorflow::int64 current = peak->load(std::memory_order_relaxed);
+  while (current < bytes &&
+         !peak->compare_exchange_weak(current, bytes,
+                                      std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+ScopedStageTimer::ScopedStageTimer(RuntimeStage stage)
+    : stage_(stage), outermost_(ThreadCounters().depth[stage]++ == 0) {
+  if (outermost_) start_ = std::chrono::steady_clock::now();
+}
+
+ScopedStageTimer::~ScopedStageTimer() {
+  StageCounters& counters = ThreadCounters();
+  --counters.depth[stage_];
+  if (outermost_) {
+    counters.time[stage_] += std::chrono::steady_clock::now() - start_;
+    ++counters.calls[stage_];
+  }
+}
+
+std::vector<RuntimeStageTime> TakeThreadStageTimes() {
+  StageCounters& counters = ThreadCounters();
+  std::vector<RuntimeStageTime> times;
+  for (int stage = 0; stage < RuntimeStage_ARRAYSIZE; ++stage) {
+    if (counters.calls[stage] == 0) continue;
+    RuntimeStageTime time;
+    time.set_stage(static_cast<RuntimeStage>(stage));
+    time.set_count(counters.calls[stage]);
+    time.set_wall_time_seconds(
+        std::chrono::duration<double>(counters.time[stage]).count());
+    times.push_back(time);
+    counters.calls[stage] = 0;
+    counters.time[stage] = std::chrono::steady_clock::duration::zero();
+  }
+  return times;
+}
+
+void SetStageMemoryTracking(bool enabled) {
+  memory_tracking_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool StageMemoryTrackingEnabled() {
+  return memory_tracking_enabled.load(std::memory_order_relaxed);
+}
+
+void AddStageMemory(RuntimeStage stage, tensorflow::int64 bytes) {
+  if (!StageMemoryTrackingEnabled()) return;
+  const tensorflow::int64 live =
+      live_bytes[stage].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  RaisePeak(&peak_bytes[stage], live);
+}
+
+std::vector<RuntimeStageMemory> TakeStageMemory() {
+  std::vector<RuntimeStageMemory> memory;
+  for (int stage = 0; stage < RuntimeStage_ARRAYSIZE; ++stage) {
+    const tensorflow::int64 live =
+        live_bytes[stage].load(std::memory_order_relaxed);
+    const tensorflow::int64 peak =
+        peak_bytes[stage].exchange(live, std::memory_order_relaxed);
+    if (peak == 0 && live == 0) continue;
+    RuntimeStageMemory stage_memory;
+    stage_memory.set_stage(static_cast<RuntimeStage>(stage));
+    stage_memory.set_live_bytes(live);
+    stage_memory.set_peak_bytes(std::max(peak, live));
+    memory.push_back(stage_memory);
+  }
+  return memory;
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
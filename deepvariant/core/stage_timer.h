@@ -0,0 +1,137 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Low-overhead timing of the stages of processing a region, so that slow
+// regions can be found in production without attaching a profiler.
+//
+// Each thread accumulates the time of its ScopedStageTimers in thread-local
+// counters, so a timer costs two reads of a monotonic clock and no
+// synchronization.  A region processed on one thread, like those of
+// make_examples, gets its per-stage times by taking the counters of its thread
+// before and after it.  Work a region hands off to other threads, like
+// encoding pileup images on a pool, is timed around the hand-off on the
+// calling thread.
+//
+// Optionally, the memory held by the main structures of each stage is
+// accounted with ScopedStageMemory, to find the stage responsible for the peak
+// memory use of a region.  The structures report their own sizes, from the
+// capacities of their buffers, rather than hooking the allocator, so this
+// costs a few atomic adds when enabled and a branch when not.  Unlike the
+// times, the bytes are counted process-wide, as the structures of a stage may
+// be freed on another thread than the one they were allocated on.
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_STAGE_TIMER_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_STAGE_TIMER_H_
+
+#include <chrono>  // NOLINT
+#include <vector>
+
+#include "deepvariant/core/protos/core.pb.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// Adds the wall time of its scope to the time of `stage` of this thread.
+// Timers of a stage nested in one of the same stage, like an Add() of a batch
+// of reads calling the Add() of each read, are only counted once, by the
+// outermost timer.
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(RuntimeStage stage);
+  ~ScopedStageTimer();
+
+  // Disallow copy and assignment.
+  ScopedStageTimer(const ScopedStageTimer&) = delete;
+  ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+ private:
+  const RuntimeStage stage_;
+  // Whether this is the outermost timer of stage_ on this thread.
+  const bool outermost_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Returns the time of each stage that ran on this thread since the last call,
+// in the order of RuntimeStage, and resets the times to zero.  The times of
+// the timers still running are counted once they finish.
+std::vector<RuntimeStageTime> TakeThreadStageTimes();
+
+// Enables or disables the accounting of stage memory, which is disabled by
+// default.  Should be called before any ScopedStageMemory is created.
+void SetStageMemoryTracking(bool enabled);
+
+// Returns whether stage memory is accounted.  Callers whose sizes take work to
+// compute check this first.
+bool StageMemoryTrackingEnabled();
+
+// Adds bytes, which may be negative to release them, to the live bytes of
+// stage, updating its peak.  Does nothing unless tracking is enabled.
+void AddStageMemory(RuntimeStage stage, tensorflow::int64 bytes);
+
+// Accounts the bytes held by a structure of `stage` for as long as it lives.
+// The owner calls Set() whenever its size changes by enough to matter.
+class ScopedStageMemory {
+ public:
+  explicit ScopedStageMemory(RuntimeStage stage) : stage_(stage), bytes_(0) {}
+  ~ScopedStageMemory() { Set(0); }
+
+  // Disallow copy and assignment.
+  ScopedStageMemory(const ScopedStageMemory&) = delete;
+  ScopedStageMemory& operator=(const ScopedStageMemory&) = delete;
+
+  // Sets the number of bytes held by the structure.
+  void Set(tensorflow::int64 bytes) {
+    if (bytes != bytes_ && StageMemoryTrackingEnabled()) {
+      AddStageMemory(stage_, bytes - bytes_);
+      bytes_ = bytes;
+    }
+  }
+
+  tensorflow::int64 bytes() const { return bytes_; }
+
+ private:
+  const RuntimeStage stage_;
+  tensorflow::int64 bytes_;
+};
+
+// Returns the live and peak bytes of each stage that held memory since the
+// last call, in the order of RuntimeStage, and resets the peaks to the live
+// bytes.  With regions processed one at a time this gives the peak of each
+// region; with several at once, the peak of all of them together.
+std::vector<RuntimeStageMemory> TakeStageMemory();
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_STAGE_TIMER_H_
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/stage_timer.h"
+
+#include <memory>
+#include <thread>  // NOLINT
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace {
+
+// Returns the stages of times, in order.
+std::vector<RuntimeStage> Stages(const std::vector<RuntimeStageTime>& times) {
+  std::vector<RuntimeStage> stages;
+  for (const RuntimeStageTime& time : times) stages.push_back(time.stage());
+  return stages;
+}
+
+// Returns the stages of memory, in order.
+std::vector<RuntimeStage> Stages(
+    const std::vector<RuntimeStageMemory>& memory) {
+  std::vector<RuntimeStage> stages;
+  for (const RuntimeStageMemory& stage : memory) stages.push_back(stage.stage());
+  return stages;
+}
+
+}  // namespace
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+TEST(StageTimerTest, AccumulatesTheTimersOfEachStage) {
+  TakeThreadStageTimes();
+  { ScopedStageTimer timer(PILEUP_ENCODING); }
+  { ScopedStageTimer timer(READ_DECODE); }
+  { ScopedStageTimer timer(PILEUP_ENCODING); }
+
+  const std::vector<RuntimeStageTime> times = TakeThreadStageTimes();
+  EXPECT_THAT(Stages(times), ElementsAre(READ_DECODE, PILEUP_ENCODING));
+  EXPECT_EQ(times[0].count(), 1);
+  EXPECT_EQ(times[1].count(), 2);
+  EXPECT_GE(times[1].wall_time_seconds(), 0);
+  EXPECT_THAT(TakeThreadStageTimes(), IsEmpty());
+}
+
+TEST(StageTimerTest, CountsNestedTimersOfAStageOnce) {
+  TakeThreadStageTimes();
+  {
+    ScopedStageTimer outer(ALLELE_COUNTING);
+    { ScopedStageTimer inner(ALLELE_COUNTING); }
+    { ScopedStageTimer other(REALIGNMENT); }
+  }
+  const std::vector<RuntimeStageTime> times = TakeThreadStageTimes();
+  EXPECT_THAT(Stages(times), ElementsAre(ALLELE_COUNTING, REALIGNMENT));
+  EXPECT_EQ(times[0].count(), 1);
+  EXPECT_GE(times[0].wall_time_seconds(), times[1].wall_time_seconds());
+}
+
+TEST(StageTimerTest, EachThreadHasItsOwnTimes) {
+  TakeThreadStageTimes();
+  { ScopedStageTimer timer(CANDIDATE_CALLING); }
+  std::vector<RuntimeStageTime> other_times;
+  std::thread other([&other_times]() {
+    { ScopedStageTimer timer(REALIGNMENT); }
+    other_times = TakeThreadStageTimes();
+  });
+  other.join();
+  EXPECT_THAT(Stages(other_times), ElementsAre(REALIGNMENT));
+  EXPECT_THAT(Stages(TakeThreadStageTimes()), ElementsAre(CANDIDATE_CALLING));
+}
+
+TEST(StageMemoryTest, IgnoresMemoryUnlessEnabled) {
+  SetStageMemoryTracking(false);
+  {
+    ScopedStageMemory memory(REALIGNMENT);
+    memory.Set(100);
+    EXPECT_EQ(memory.bytes(), 0);
+  }
+  EXPECT_THAT(TakeStageMemory(), IsEmpty());
+}
+
+TEST(StageMemoryTest, TracksLiveAndPeakBytesOfEachStage) {
+  SetStageMemoryTracking(true);
+  TakeStageMemory();
+  ScopedStageMemory reads(READ_DECODE);
+  reads.Set(1000);
+  {
+    ScopedStageMemory counts(ALLELE_COUNTING);
+    counts.Set(300);
+    counts.Set(500);
+    counts.Set(200);
+  }
+  std::vector<RuntimeStageMemory> memory = TakeStageMemory();
+  EXPECT_THAT(Stages(memory), ElementsAre(READ_DECODE, ALLELE_COUNTING));
+  EXPECT_EQ(memory[0].live_bytes(), 1000);
+  EXPECT_EQ(memory[0].peak_bytes(), 1000);
+  EXPECT_EQ(memory[1].live_bytes(), 0);
+  EXPECT_EQ(memory[1].peak_bytes(), 500);
+
+  // The peaks restart from the live bytes.
+  memory = TakeStageMemory();
+  EXPECT_THAT(Stages(memory), ElementsAre(READ_DECODE));
+  EXPECT_EQ(memory[0].peak_bytes(), 1000);
+  reads.Set(0);
+  memory = TakeStageMemory();
+  EXPECT_EQ(memory[0].live_bytes(), 0);
+  EXPECT_EQ(memory[0].peak_bytes(), 1000);
+  EXPECT_THAT(TakeStageMemory(), IsEmpty());
+  SetStageMemoryTracking(false);
+}
+
+TEST(StageMemoryTest, CountsMemoryFreedOnAnotherThread) {
+  SetStageMemoryTracking(true);
+  TakeStageMemory();
+  std::unique_ptr<ScopedStageMemory> image(
+      new ScopedStageMemory(PILEUP_ENCODING));
+  std::thread other([&image]() { image->Set(4096); });
+  other.join();
+  image.reset();
+  const std::vector<RuntimeStageMemory> memory = TakeStageMemory();
+  EXPECT_THAT(Stages(memory), ElementsAre(PILEUP_ENCODING));
+  EXPECT_EQ(memory[0].live_bytes(), 0);
+  EXPECT_EQ(memory[0].peak_bytes(), 4096);
+  SetStageMemoryTracking(false);
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
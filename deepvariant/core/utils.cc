@@ -36,6 +36,8 @@
 
 #include "deepvariant/core/utils.h"
 
+#include "deepvariant/core/base_mask.h"
+#include "deepvariant/core/cigar.h"
 #include "deepvariant/core/genomics/cigar.pb.h"
 
 #include "tensorflow/core/lib/core/stringpiece.h"
@@ -97,8 +99,15 @@ bool IsCanonicalBase(const char base, const CanonicalBases canon) {
 }
 
 size_t FindNonCanonicalBase(StringPiece bases, const CanonicalBases canon) {
+  // Most calls are for a few bases, which aren't worth setting up a BaseMask
+  // for, but whole reads or reference windows are scanned with SIMD.
+  if (bases.size() >= 64) {
+    BaseMask mask;
+    mask.Compute(bases, canon == CanonicalBases::ACGTN);
+    const size_t bad = mask.FindUnset(0);
+    return bad == bases.size() ? string::npos : bad;
+  }
   for (size_t i = 0; i < bases.size(); i++) {
-    // Meh.  This should be a static lookup table.
     if (!IsCanonicalBase(bases[i], canon)) {
       return i;
     }
@@ -182,23 +191,16 @@ int64 ReadStart(const Read& read) {
 }
 
 int64 ReadEnd(const Read& read) {
-  int64 position = ReadStart(read);
-  for (const auto& cigar : read.alignment().cigar()) {
-    switch (cigar.operation()) {
-      case CigarUnit::ALIGNMENT_MATCH:
-      case CigarUnit::SEQUENCE_MATCH:
-      case CigarUnit::DELETE:
-      case CigarUnit::SKIP:
-      case CigarUnit::SEQUENCE_MISMATCH:
-        position += cigar.operation_length();
-        break;
-      default:
-        // None of the other operations change the alignment offset
-        break;
+  int64 end = ReadStart(read);
+  WalkCigar(read, [&end](CigarUnit::Operation op, int op_len, int64 ref_pos,
+                         int) {
+    // Only operations consuming the reference change the alignment offset.
+    if (ConsumesReference(op)) {
+      end = ref_pos + op_len;
     }
-  }
-
-  return position;
+    return true;
+  });
+  return end;
 }
 
 int ComparePositions(const Position& pos1, const Position& pos2) {
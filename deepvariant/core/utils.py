@@ -35,6 +35,7 @@ import numpy as np
 
 from deepvariant.core import cigar
 from deepvariant.core import ranges
+from deepvariant.core.python import read_index
 
 
 def read_range(read):
@@ -111,6 +112,9 @@ class InMemorySamReader(object):
   def replace_reads(self, reads, is_sorted=False):
     self.reads = reads
     self.is_sorted = is_sorted
+    # A native index of where self.reads are aligned, built on the first
+    # query.
+    self._index = None
 
   def iterate(self):
     """Iterate over all records in the reads.
@@ -129,6 +133,8 @@ class InMemorySamReader(object):
     Returns:
       An iterator over learning.genomics.deepvariant.core.genomics.Read
     """
-    # redacted
-    return (read for read in self.reads
-            if ranges.ranges_overlap(region, read_range(read)))
+    # Rather than computing the range of every read for each query, we index
+    # the reads once and find the overlapping ones with a binary search.
+    if self._index is None:
+      self._index = read_index.ReadIndex(self.reads)
+    return (self.reads[i] for i in self._index.query(region))
@@ -71,6 +71,33 @@ class UtilsTest(parameterized.TestCase):
         ranges.make_range('chrX', start, start + 5 + 16),
         utils.read_range(read))
 
+  def test_in_memory_sam_reader_query(self):
+    reads = [
+        test_utils.make_read('ACG', chrom='chr1', start=10, cigar='3M'),
+        test_utils.make_read('ACG', chrom='chr1', start=3, cigar='1M5D2M'),
+        test_utils.make_read('ACG', chrom='chr2', start=5, cigar='3M'),
+        test_utils.make_read('ACG', chrom='chr1', start=1, cigar='3M'),
+    ]
+    reader = utils.InMemorySamReader(reads)
+    for region in [
+        ranges.make_range('chr1', 0, 100),
+        ranges.make_range('chr1', 4, 5),
+        ranges.make_range('chr1', 10, 11),
+        ranges.make_range('chr1', 13, 20),
+        ranges.make_range('chr2', 0, 6),
+        ranges.make_range('chr3', 0, 100),
+    ]:
+      # The reads overlapping region, in their input order.
+      expected = [
+          read for read in reads
+          if ranges.ranges_overlap(region, utils.read_range(read))
+      ]
+      self.assertEqual(list(reader.query(region)), expected)
+
+    reader.replace_reads(reads[:1])
+    self.assertEqual(
+        list(reader.query(ranges.make_range('chr1', 0, 100))), reads[:1])
+
   def test_reservoir_sample_length(self):
     """Tests samples have expected length."""
     first_ten_ints = range(10)
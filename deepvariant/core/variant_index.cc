@@ -0,0 +1,166 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Implementation of variant_index.h
+#include "deepvariant/core/variant_index.h"
+
+#include <algorithm>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+namespace tf = tensorflow;
+
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Variant;
+using tensorflow::int64;
+using tensorflow::string;
+using tensorflow::strings::StrCat;
+
+StatusOr<std::unique_ptr<VariantIndex>> VariantIndex::FromReader(
+    VcfReader* reader, const std::vector<Range>& regions) {
+  std::unique_ptr<VariantIndex> index(new VariantIndex());
+  Variant variant;
+  if (regions.empty()) {
+    auto iterable = reader->Iterate();
+    TF_RETURN_IF_ERROR(iterable.status());
+    while (true) {
+      auto more = iterable.ValueOrDie()->Next(&variant);
+      TF_RETURN_IF_ERROR(more.status());
+      if (!more.ValueOrDie()) break;
+      if (!index->contigs_[variant.reference_name()].entries.empty() &&
+          variant.start() <
+              index->contigs_[variant.reference_name()].entries.back().start)
+        return tf::errors::FailedPrecondition(
+            StrCat("Variants must be sorted, but ", variant.reference_name(),
+                   ":", variant.start() + 1, " is out of order"));
+      index->Add(variant);
+    }
+    return std::move(index);
+  }
+
+  // Query each of the merged regions in order, skipping the variants already
+  // loaded for the previous region of the contig, which are those starting
+  // before its end.
+  std::vector<Range> queries(regions.begin(), regions.end());
+  std::sort(queries.begin(), queries.end(),
+            [](const Range& a, const Range& b) {
+              if (a.reference_name() != b.reference_name())
+                return a.reference_name() < b.reference_name();
+              return a.start() < b.start();
+            });
+  string previous_name;
+  int64 previous_end = 0;
+  for (size_t i = 0; i < queries.size(); ++i) {
+    // Extend this query over the following regions it overlaps or touches.
+    Range query = queries[i];
+    while (i + 1 < queries.size() &&
+           queries[i + 1].reference_name() == query.reference_name() &&
+           queries[i + 1].start() <= query.end()) {
+      query.set_end(std::max(query.end(), queries[++i].end()));
+    }
+    if (query.end() <= query.start()) continue;
+    if (query.reference_name() != previous_name) {
+      previous_name = query.reference_name();
+      previous_end = -1;
+    }
+    auto iterable = reader->Query(query);
+    if (tf::errors::IsNotFound(iterable.status())) {
+      // Our VCF has no variants on contigs missing from its header.
+      continue;
+    }
+    TF_RETURN_IF_ERROR(iterable.status());
+    while (true) {
+      auto more = iterable.ValueOrDie()->Next(&variant);
+      TF_RETURN_IF_ERROR(more.status());
+      if (!more.ValueOrDie()) break;
+      if (variant.start() >= previous_end) index->Add(variant);
+    }
+    previous_end = query.end();
+  }
+  return std::move(index);
+}
+
+StatusOr<std::unique_ptr<VariantIndex>> VariantIndex::FromFile(
+    const string& variants_path, const VcfReaderOptions& options,
+    const std::vector<Range>& regions) {
+  auto reader = VcfReader::FromFile(variants_path, options);
+  TF_RETURN_IF_ERROR(reader.status());
+  return FromReader(reader.ValueOrDie().get(), regions);
+}
+
+void VariantIndex::Add(const Variant& variant) {
+  Contig& contig = contigs_[variant.reference_name()];
+  Entry entry;
+  entry.start = variant.start();
+  entry.end = variant.end();
+  entry.max_end = contig.entries.empty()
+                      ? entry.end
+                      : std::max(entry.end, contig.entries.back().max_end);
+  entry.offset = contig.buffer.size();
+  variant.AppendToString(&contig.buffer);
+  entry.size = contig.buffer.size() - entry.offset;
+  contig.entries.push_back(entry);
+  ++size_;
+}
+
+std::vector<Variant> VariantIndex::Query(const Range& region) const {
+  std::vector<Variant> variants;
+  const auto found = contigs_.find(region.reference_name());
+  if (found == contigs_.end()) return variants;
+  const Contig& contig = found->second;
+  // Entries before first all end at or before the start of region, since
+  // max_end never decreases, and those from last on start after it.
+  auto first = std::partition_point(
+      contig.entries.begin(), contig.entries.end(),
+      [&region](const Entry& entry) {
+        return entry.max_end <= region.start();
+      });
+  auto last = std::partition_point(
+      first, contig.entries.end(),
+      [&region](const Entry& entry) { return entry.start < region.end(); });
+  for (auto entry = first; entry != last; ++entry) {
+    if (entry->end <= region.start()) continue;
+    variants.emplace_back();
+    CHECK(variants.back().ParseFromArray(contig.buffer.data() + entry->offset,
+                                         entry->size));
+  }
+  return variants;
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// An in-memory index of the variants of a VCF file.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_VARIANT_INDEX_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_CORE_VARIANT_INDEX_H_
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/vcf_reader.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+// A VariantIndex holds the variants of a VCF file in memory, so that the
+// variants overlapping a region are found without seeking in and parsing the
+// file again, as VcfReader::Query does for each query.
+//
+// The variants of each contig are kept serialized in one buffer, sorted by
+// start, alongside the running maximum of their ends. Query(region) finds the
+// variants overlapping region by binary search on both, in O(log n + k) time
+// for the k variants starting between the first one that may overlap region
+// and the end of region. A VariantIndex is safe to query from many threads at
+// once.
+//
+// Usage:
+//
+//   auto index = VariantIndex::FromFile(truth_vcf, options, regions)
+//                    .ValueOrDie();
+//   for (const Variant& variant : index->Query(candidate_range)) { ... }
+class VariantIndex {
+ public:
+  // Loads the variants of reader overlapping any of regions, each only once,
+  // or every variant of reader if regions is empty. Loading only some regions
+  // requires that the reader has an index.
+  static StatusOr<std::unique_ptr<VariantIndex>> FromReader(
+      VcfReader* reader,
+      const std::vector<learning::genomics::v1::Range>& regions);
+
+  // Loads the variants of the VCF file at variants_path, read with options, as
+  // FromReader() does.
+  static StatusOr<std::unique_ptr<VariantIndex>> FromFile(
+      const tensorflow::string& variants_path, const VcfReaderOptions& options,
+      const std::vector<learning::genomics::v1::Range>& regions);
+
+  // Returns the variants overlapping region, in the order VcfReader::Query
+  // would return them.
+  std::vector<learning::genomics::v1::Variant> Query(
+      const learning::genomics::v1::Range& region) const;
+
+  // Returns the number of variants we hold.
+  tensorflow::int64 size() const { return size_; }
+
+ private:
+  struct Entry {
+    tensorflow::int64 start;
+    tensorflow::int64 end;
+    // The greatest end of this and all of the preceding entries.
+    tensorflow::int64 max_end;
+    // Where the serialized variant is in the buffer of the contig.
+    tensorflow::uint64 offset;
+    tensorflow::uint64 size;
+  };
+
+  struct Contig {
+    std::vector<Entry> entries;
+    tensorflow::string buffer;
+  };
+
+  VariantIndex() = default;
+
+  // Adds variant to its contig, which must be in order of start.
+  void Add(const learning::genomics::v1::Variant& variant);
+
+  std::unordered_map<tensorflow::string, Contig> contigs_;
+  tensorflow::int64 size_ = 0;
+};
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_CORE_VARIANT_INDEX_H_
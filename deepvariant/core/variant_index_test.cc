@@ -0,0 +1,123 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/core/variant_index.h"
+
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace core {
+
+using std::vector;
+
+using ::testing::IsEmpty;
+using ::testing::Pointwise;
+
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Variant;
+using tensorflow::int64;
+
+constexpr char kVcfIndexSamplesFilename[] = "test_samples.vcf.gz";
+
+class VariantIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    options_.set_index_mode(IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+    reader_ = std::move(
+        VcfReader::FromFile(GetTestData(kVcfIndexSamplesFilename), options_)
+            .ValueOrDie());
+  }
+
+  std::unique_ptr<VariantIndex> MakeIndex(const vector<Range>& regions) {
+    return std::move(VariantIndex::FromFile(
+                         GetTestData(kVcfIndexSamplesFilename), options_,
+                         regions)
+                         .ValueOrDie());
+  }
+
+  // Checks that index finds the same variants as our reader for each range.
+  void ExpectQueriesMatchReader(const VariantIndex& index,
+                                const vector<Range>& ranges) {
+    for (const Range& range : ranges) {
+      EXPECT_THAT(index.Query(range),
+                  Pointwise(EqualsProto(), as_vector(reader_->Query(range))))
+          << range.ShortDebugString();
+    }
+  }
+
+  VcfReaderOptions options_;
+  std::unique_ptr<VcfReader> reader_;
+};
+
+TEST_F(VariantIndexTest, HoldsAllVariantsWithoutRegions) {
+  auto index = MakeIndex({});
+  EXPECT_EQ(as_vector(reader_->Iterate()).size(), index->size());
+  ExpectQueriesMatchReader(
+      *index, {MakeRange("chr1", 0, 248956422), MakeRange("chr3", 14318, 14319),
+               MakeRange("chr3", 14317, 14318), MakeRange("chr3", 14319, 14320),
+               MakeRange("chr3", 14217, 14419), MakeRange("chr3", 14318, 60000),
+               MakeRange("chr3", 99999, 500000)});
+}
+
+TEST_F(VariantIndexTest, HoldsOnlyVariantsInRegions) {
+  const vector<Range> regions = {MakeRange("chr3", 14318, 60000),
+                                 MakeRange("chr1", 0, 1000000),
+                                 MakeRange("chr3", 10000, 15000)};
+  auto index = MakeIndex(regions);
+
+  // Overlapping regions don't load their shared variants twice.
+  int64 expected = as_vector(reader_->Query(regions[1])).size() +
+                   as_vector(reader_->Query(MakeRange("chr3", 10000, 60000)))
+                       .size();
+  EXPECT_EQ(expected, index->size());
+  ExpectQueriesMatchReader(*index, regions);
+  EXPECT_THAT(index->Query(MakeRange("chr2", 0, 1000000)), IsEmpty());
+}
+
+TEST_F(VariantIndexTest, SkipsContigsMissingFromHeader) {
+  auto index = MakeIndex({MakeRange("chrUn", 0, 1000)});
+  EXPECT_EQ(0, index->size());
+  EXPECT_THAT(index->Query(MakeRange("chrUn", 0, 1000)), IsEmpty());
+}
+
+}  // namespace core
+}  // namespace genomics
+}  // namespace learning
@@ -35,6 +35,7 @@
 #include "deepvariant/core/genomics/range.pb.h"
 #include "deepvariant/core/genomics/variants.pb.h"
 #include "deepvariant/core/hts_path.h"
+#include "deepvariant/core/hts_thread_pool.h"
 #include "deepvariant/core/math.h"
 #include "deepvariant/core/utils.h"
 #include "deepvariant/core/vcf_conversion.h"
@@ -126,6 +127,51 @@ std::vector<string> ReadFormatStrings(const bcf_hdr_t* h, const bcf1_t* v,
   return values;
 }
 
+// Parses only the reference_name, start and end of the text VCF record line
+// into variant_message, as vcf_parse1 would compute them.
+tf::Status ParsePositionOfLine(const kstring_t& line,
+                               Variant* variant_message) {
+  variant_message->Clear();
+
+  // The CHROM, POS, ID, REF, ALT, QUAL, FILTER and INFO columns.
+  const int kNumColumns = 8;
+  tf::StringPiece columns[kNumColumns];
+  const char* begin = line.s;
+  const char* const end = line.s + line.l;
+  int n_columns = 0;
+  while (n_columns < kNumColumns && begin <= end) {
+    const char* tab =
+        static_cast<const char*>(memchr(begin, '\t', end - begin));
+    if (tab == nullptr) tab = end;
+    columns[n_columns++] = tf::StringPiece(begin, tab - begin);
+    begin = tab + 1;
+  }
+  if (n_columns < kNumColumns - 1)
+    return tf::errors::DataLoss(StrCat("Failed to parse VCF record: ", line.s));
+
+  char* pos_end = nullptr;
+  const tf::int64 pos = strtoll(columns[1].data(), &pos_end, 10);
+  if (columns[1].empty() || pos_end != columns[1].data() + columns[1].size())
+    return tf::errors::DataLoss(StrCat("Failed to parse VCF record: ", line.s));
+
+  variant_message->set_reference_name(columns[0].data(), columns[0].size());
+  variant_message->set_start(pos - 1);
+  // As in vcf_parse1, the END in INFO takes precedence over the length of REF.
+  variant_message->set_end(pos - 1 + columns[3].size());
+  tf::StringPiece info = columns[7];
+  while (!info.empty()) {
+    const size_t semicolon = info.find(';');
+    tf::StringPiece entry = info.substr(0, semicolon);
+    if (entry.Consume("END=")) {
+      variant_message->set_end(strtoll(entry.data(), nullptr, 10));
+      break;
+    }
+    if (semicolon == tf::StringPiece::npos) break;
+    info.remove_prefix(semicolon + 1);
+  }
+  return tf::Status::OK();
+}
+
 // Parses the htslib VCF record v into Variant protobuf variant_message.
 tf::Status ConvertToPb(
     const bcf_hdr_t* h, bcf1_t* v,
@@ -137,12 +183,23 @@ tf::Status ConvertToPb(
 
   variant_message->Clear();
 
-  // Tell htslib to parse out all of the fields of the VCF record v.
-  bcf_unpack(v, BCF_UN_ALL);
-
   variant_message->set_reference_name(bcf_hdr_id2name(h, v->rid));
   variant_message->set_start(v->pos);
   variant_message->set_end(v->pos + v->rlen);
+  if (desired_format_entries.positions_only()) return tf::Status::OK();
+
+  bool want_gq = !desired_format_entries.exclude_genotype_quality();
+  bool want_ll = !desired_format_entries.exclude_genotype_likelihood();
+  bool want_gt = !desired_format_entries.exclude_genotype();
+  bool want_ad = !desired_format_entries.exclude_allele_depth();
+  bool want_dp = !desired_format_entries.exclude_read_depth();
+  bool want_ps = !desired_format_entries.exclude_phaseset();
+  bool want_format =
+      want_gq || want_ll || want_gt || want_ad || want_dp || want_ps;
+
+  // Tell htslib to parse out the ID, alleles and FILTER of the VCF record v,
+  // and its FORMAT fields only if we want any of them.
+  bcf_unpack(v, BCF_UN_STR | BCF_UN_FLT | (want_format ? BCF_UN_FMT : 0));
 
   // Parse the ID field of the Variant.
   if (v->d.id && strcmp(v->d.id, ".") != 0) {
@@ -168,42 +225,46 @@ tf::Status ConvertToPb(
     variant_message->add_filter(h->id[BCF_DT_ID][v->d.flt[i]].key);
   }
 
-  bool want_gq = !desired_format_entries.exclude_genotype_quality();
-  bool want_ll = !desired_format_entries.exclude_genotype_likelihood();
-  bool want_gt = !desired_format_entries.exclude_genotype();
-  bool want_ad = !desired_format_entries.exclude_allele_depth();
-  bool want_dp = !desired_format_entries.exclude_read_depth();
-
   // Parse the calls of the variant.
   if (v->n_sample > 0) {
-    int *gt_arr = nullptr;
-    int ploidy, n_gts = 0;
-    if (bcf_get_genotypes(h, v, &gt_arr, &n_gts) < 0) {
-      free(gt_arr);
-      return tf::errors::DataLoss("Couldn't parse genotypes");
-    }
-    ploidy = n_gts / v->n_sample;
-
     for (int i = 0; i < v->n_sample; i++) {
       VariantCall* call = variant_message->add_calls();
       call->set_call_set_name(h->samples[i]);
-      // Get the GT calls, if requested and available.
-      if (want_gt) {
+    }
+    if (!want_format) return tf::Status::OK();
+
+    // Get the GT calls, if requested and available.
+    if (want_gt) {
+      int *gt_arr = nullptr;
+      int ploidy, n_gts = 0;
+      if (bcf_get_genotypes(h, v, &gt_arr, &n_gts) < 0) {
+        free(gt_arr);
+        return tf::errors::DataLoss("Couldn't parse genotypes");
+      }
+      ploidy = n_gts / v->n_sample;
+      for (int i = 0; i < v->n_sample; i++) {
+        VariantCall* call = variant_message->mutable_calls(i);
         for (int j = 0; j < ploidy; j++) {
           int gt = bcf_gt_allele(gt_arr[i * ploidy + j]);
           call->add_genotype(gt);
         }
       }
+      free(gt_arr);
     }
-    free(gt_arr);
 
-    // Augment the calls with extra information described in FORMAT
-    vector<vector<int>> ad_values = ReadFormatValues<int>(h, v, "AD");
-    vector<vector<int>> dp_values = ReadFormatValues<int>(h, v, "DP");
-    vector<vector<int>> gq_values = ReadFormatValues<int>(h, v, "GQ");
-    vector<vector<int>> pl_values = ReadFormatValues<int>(h, v, "PL");
-    vector<vector<float>> gl_values = ReadFormatValues<float>(h, v, "GL");
-    vector<string> ps_values = ReadFormatStrings(h, v, "PS");
+    // Augment the calls with the extra information described in FORMAT that
+    // we want, decoding only those fields.
+    vector<vector<int>> ad_values, dp_values, gq_values, pl_values;
+    vector<vector<float>> gl_values;
+    vector<string> ps_values;
+    if (want_ad) ad_values = ReadFormatValues<int>(h, v, "AD");
+    if (want_dp) dp_values = ReadFormatValues<int>(h, v, "DP");
+    if (want_gq) gq_values = ReadFormatValues<int>(h, v, "GQ");
+    if (want_ll) {
+      pl_values = ReadFormatValues<int>(h, v, "PL");
+      gl_values = ReadFormatValues<float>(h, v, "GL");
+    }
+    if (want_ps) ps_values = ReadFormatStrings(h, v, "PS");
 
     // If GL and PL are *both* present, we could convert it to proto per
     // the variants.proto spec, but we'd rather fail---better not to allow
@@ -299,6 +360,8 @@ class VcfFullFileIterable : public VariantIterable {
   htsFile* fp_;
   bcf_hdr_t* header_;
   bcf1_t* bcf1_;
+  // The current line of a text VCF, when only parsing positions.
+  kstring_t str_;
 };
 
 StatusOr<std::unique_ptr<VcfReader>> VcfReader::FromFile(
@@ -307,6 +370,12 @@ StatusOr<std::unique_ptr<VcfReader>> VcfReader::FromFile(
   if (fp == nullptr) {
     return tf::errors::NotFound(StrCat("Could not open ", variants_path));
   }
+  const tf::Status status =
+      UseSharedHtsThreadPool(fp, options.num_decompression_threads());
+  if (!status.ok()) {
+    hts_close(fp);
+    return status;
+  }
 
   bcf_hdr_t* header = bcf_hdr_read(fp);
   if (header == nullptr)
@@ -464,10 +533,14 @@ tf::Status VcfReader::Close() {
 StatusOr<bool> VcfQueryIterable::Next(Variant* out) {
   TF_RETURN_IF_ERROR(CheckIsAlive());
   if (tbx_itr_next(fp_, idx_, iter_, &str_) < 0) return false;
+  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
+  if (reader->Options().desired_format_entries().positions_only()) {
+    TF_RETURN_IF_ERROR(ParsePositionOfLine(str_, out));
+    return true;
+  }
   if (vcf_parse1(&str_, header_, bcf1_) < 0) {
     return tf::errors::DataLoss(StrCat("Failed to parse VCF record: ", str_.s));
   }
-  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
   TF_RETURN_IF_ERROR(ConvertToPb(
       header_, bcf1_, reader->Options().desired_format_entries(), out));
   return true;
@@ -496,6 +569,16 @@ VcfQueryIterable::VcfQueryIterable(const VcfReader* reader,
 
 StatusOr<bool> VcfFullFileIterable::Next(Variant* out) {
   TF_RETURN_IF_ERROR(CheckIsAlive());
+  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
+  if (reader->Options().desired_format_entries().positions_only() &&
+      fp_->format.format == vcf) {
+    // Skip htslib's parse of each text record.
+    const int ret = hts_getline(fp_, '\n', &str_);
+    if (ret == -1) return false;
+    if (ret < 0) return tf::errors::DataLoss("Failed to read VCF record");
+    TF_RETURN_IF_ERROR(ParsePositionOfLine(str_, out));
+    return true;
+  }
   if (bcf_read(fp_, header_, bcf1_) < 0) {
     if (bcf1_->errcode) {
       return tf::errors::DataLoss(StrCat("Failed to parse VCF record"));
@@ -503,7 +586,6 @@ StatusOr<bool> VcfFullFileIterable::Next(Variant* out) {
       return false;
     }
   }
-  const VcfReader* reader = static_cast<const VcfReader*>(reader_);
   TF_RETURN_IF_ERROR(ConvertToPb(
       header_, bcf1_, reader->Options().desired_format_entries(), out));
   return true;
@@ -511,6 +593,7 @@ StatusOr<bool> VcfFullFileIterable::Next(Variant* out) {
 
 VcfFullFileIterable::~VcfFullFileIterable() {
   bcf_destroy(bcf1_);
+  if (str_.s != nullptr) { free(str_.s); }
 }
 
 VcfFullFileIterable::VcfFullFileIterable(const VcfReader* reader,
@@ -519,7 +602,8 @@ VcfFullFileIterable::VcfFullFileIterable(const VcfReader* reader,
     : Iterable(reader),
       fp_(fp),
       header_(header),
-      bcf1_(bcf_init())
+      bcf1_(bcf_init()),
+      str_({0, 0, nullptr})
 {}
 
 }  // namespace core
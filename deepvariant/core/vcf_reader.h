@@ -72,6 +72,8 @@ using VariantIterable = Iterable<learning::genomics::v1::Variant>;
 // The objects returned by iterate() or query() are learning.genomics.v1.Variant
 // objects parsed from the VCF records in the file. Currently all fields except
 // the INFO key/value maps in the VCF variant and genotype fields are parsed.
+// The options' desired_format_entries can skip decoding FORMAT fields, or all
+// but the position of each record.
 //
 class VcfReader : public Reader {
  public:
@@ -185,6 +185,25 @@ TEST_F(VcfWithSamplesReaderTest, WholeChromosomeQueries) {
               SizeIs(2));
 }
 
+TEST_F(VcfWithSamplesReaderTest, PositionsOnlyParsesJustPositions) {
+  vector<Variant> positions;
+  for (const Variant& variant : golden_) {
+    Variant position;
+    position.set_reference_name(variant.reference_name());
+    position.set_start(variant.start());
+    position.set_end(variant.end());
+    positions.push_back(position);
+  }
+  options_.mutable_desired_format_entries()->set_positions_only(true);
+  RecreateReader();
+  EXPECT_THAT(as_vector(reader_->Iterate()),
+              Pointwise(EqualsProto(), positions));
+  vector<Variant> chr3 = as_vector(reader_->Query(MakeRange("chr3", 0,
+                                                            CHR3_SIZE)));
+  ASSERT_THAT(chr3, SizeIs(6));
+  EXPECT_THAT(chr3[0], EqualsProto(positions[745]));
+}
+
 TEST(VcfReaderLikelihoodsTest, MatchesGolden) {
   std::unique_ptr<VcfReader> reader =
       std::move(VcfReader::FromFile(GetTestData(kVcfLikelihoodsFilename),
@@ -217,6 +236,26 @@ TEST(VcfReaderAlleleDepthTest, MatchesGolden) {
       GetTestData(kVcfAlleleDepthGoldenFilename));
   EXPECT_THAT(as_vector(reader->Iterate()), Pointwise(EqualsProto(), golden));
 }
+
+TEST(VcfReaderAlleleDepthTest, SkipsExcludedFormatFields) {
+  VcfReaderOptions options;
+  options.mutable_desired_format_entries()->set_exclude_allele_depth(true);
+  options.mutable_desired_format_entries()->set_exclude_read_depth(true);
+  std::unique_ptr<VcfReader> reader =
+      std::move(VcfReader::FromFile(GetTestData(kVcfAlleleDepthFilename),
+                                    options)
+                    .ValueOrDie());
+  vector<Variant> golden = ReadProtosFromTFRecord<Variant>(
+      GetTestData(kVcfAlleleDepthGoldenFilename));
+  for (Variant& variant : golden) {
+    for (auto& call : *variant.mutable_calls()) {
+      call.mutable_info()->erase("AD");
+      call.mutable_info()->erase("DP");
+    }
+  }
+  EXPECT_THAT(as_vector(reader->Iterate()), Pointwise(EqualsProto(), golden));
+}
+
 }  // namespace core
 }  // namespace genomics
 }  // namespace learning
@@ -34,10 +34,13 @@
 
 #include <algorithm>
 #include <cstring>
+#include <utility>
+#include <vector>
 
 #include "deepvariant/core/genomics/struct.pb.h"
 #include "deepvariant/core/genomics/variants.pb.h"
 #include "deepvariant/core/hts_path.h"
+#include "deepvariant/core/hts_thread_pool.h"
 #include "deepvariant/core/math.h"
 #include "deepvariant/core/utils.h"
 #include "deepvariant/core/vcf_conversion.h"
@@ -49,8 +52,10 @@
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/lib/strings/stringprintf.h"
 
+#include "htslib/bgzf.h"
 #include "htslib/hts.h"
 #include "htslib/sam.h"
+#include "htslib/tbx.h"
 #include "tensorflow/core/platform/logging.h"
 
 namespace learning {
@@ -65,15 +70,14 @@ using tensorflow::strings::StrCat;
 
 namespace {
 
-static const std::map<string, int>* FIELD_TYPE = new std::map<string, int>({
-    {"AD", BCF_HT_INT},
-    {"DP", BCF_HT_INT},
-    {"GQ", BCF_HT_INT},
-    {"VAF", BCF_HT_REAL},
-});
-
 const char kOpenModeCompressed[] = "wz";
 const char kOpenModeUncompressed[] = "w";
+const char kOpenModeBcf[] = "wb";
+
+// The index parameters used by tabix and by bcftools index for CSI indices.
+const int kTbiMinShift = 14;
+const int kTbiLevels = 5;
+const int kCsiMinShift = 14;
 
 const char kFormatHeaderGT[] =
     "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">";
@@ -113,173 +117,179 @@ int32_t vcfEncodeAllele(int pbAllele, bool isPhased) {
   }
 }
 
-// Write out one of the format tags to a VCF variant line.  The input encodes
-// the format field values for every sample.  The vector of vectors encodes
-// the field values as follows:
-//   - if vv is empty, it is taken to mean that there are no format values to be
-//     written, and this function call is effectively a no-op;
-//   - vv[i] represents the field values for sample at index i; if vv[i] is
-//     an empty vector, it means the values are MISSING for this sample.
-//   - the subvectors of vv should all be the same length, except for potential
-//     empty subvectors
+// Writes the values of the FORMAT field tag of every sample to a VCF variant
+// line. The values of sample s are the next counts[s] of values, and an empty
+// sample is written as missing. All other samples must have the same number of
+// values. flat is scratch space for padding the values of missing samples.
 // (This the inverse of the ReadFormatValues utility used by VcfReader)
 template <class ValueType>
-tf::Status EncodeFormatValues(const std::vector<std::vector<ValueType>>& values,
-                              const char* tag, const bcf_hdr_t* h, bcf1_t* v) {
+tf::Status EncodeFormatValues(const std::vector<ValueType>& values,
+                              const std::vector<int>& counts, const char* tag,
+                              const bcf_hdr_t* h, bcf1_t* v,
+                              std::vector<ValueType>* flat) {
   using VT = VcfType<ValueType>;
 
-  if (values.empty()) {
-    return tf::Status::OK();
-  }
-
-  if (values.size() != bcf_hdr_nsamples(h))
+  if (counts.size() != bcf_hdr_nsamples(h))
     return tf::errors::FailedPrecondition("Values.size() != nsamples");
-  size_t n_samples = values.size();
-
-  size_t values_per_sample = 0;
-  for (size_t s = 0; s < n_samples; s++) {
-    values_per_sample =
-        std::max(values_per_sample, values[s].size());
+  const size_t n_samples = counts.size();
+  const int values_per_sample = *std::max_element(counts.begin(), counts.end());
+  for (const int count : counts) {
+    if (count != 0 && count != values_per_sample)
+      return tf::errors::FailedPrecondition(
+          "values[s].size() != values_per_sample");
+  }
+  if (values.size() == n_samples * values_per_sample) {
+    // No sample is missing, so the values are already laid out as htslib
+    // expects.
+    return VT::PutFormatValues(tag, values.data(), values.size(), h, v);
   }
 
-  std::vector<ValueType> flat_values;  // Flat-encoded with missing/vector_ends
+  // Flat-encoded with missing/vector_ends
+  flat->resize(n_samples * values_per_sample);
+  auto next_value = values.begin();
   for (size_t s = 0; s < n_samples; s++) {
-    if (values[s].empty()) {
-      for (size_t j = 0; j < values_per_sample; j++) {
-        flat_values.push_back(ValueType());
+    ValueType* sample_values = flat->data() + s * values_per_sample;
+    if (counts[s] == 0) {
+      for (int j = 0; j < values_per_sample; j++) {
         if (j == 0) {
-          VT::SetMissing(&flat_values.back());
+          VT::SetMissing(&sample_values[j]);
         } else {
-          VT::SetVectorEnd(&flat_values.back());
+          VT::SetVectorEnd(&sample_values[j]);
         }
       }
     } else {
-      if (values[s].size() != values_per_sample)
-        return tf::errors::FailedPrecondition(
-            "values[s].size() != values_per_sample");
-      for (size_t j = 0; j < values_per_sample; j++) {
-        flat_values.push_back(values[s][j]);
-      }
+      std::copy(next_value, next_value + values_per_sample, sample_values);
+      next_value += values_per_sample;
     }
   }
-  if (flat_values.size() != n_samples * values_per_sample)
-    return tf::errors::FailedPrecondition(
-        "flat_values.size() != n_samples * values_per_sample");
-  return VT::PutFormatValues(tag, flat_values.data(), flat_values.size(), h, v);
+  return VT::PutFormatValues(tag, flat->data(), flat->size(), h, v);
 }
 
-// Private helper class for encoding VariantCall.info values in VCF FORMAT
-// field values.
-//
-// The standard was to interact with this class is:
-//
-// Create an adaptor for an .info map key "DP".
-// FormatFieldAdapter adapter("DP");
-//
-// For each variant, we check if we need to encode values.
-// if (adapter.IsPresentInAnyVariantCalls(variant)) {
-//   // And if so, encode them into our htslib bcf_record passing in the
-//   // required htslib header object as well.
-//   EncodeValues(variant, header, bcf_record);
-// }
+}  // namespace
+
+// Converts Variant protos to htslib VCF records for our header.
 //
-// redacted
-// code to other data types. This code isn't templated on purpose, because we
-// don't in fact know the proper types in C++ at compile time. We need to look
-// up the type in the VCF header, and handle the including datatype based on the
-// info in the header. We should look up information in the header when these
-// are constructed, and then go through our VariantCall fields to fetch the
-// appropriate data and get the appropriate values from our info fields here.
-class FormatFieldAdapter {
+// The FORMAT fields and filters of the header are resolved once, rather than
+// for each record, and the arrays handed to htslib are kept between records.
+class VcfWriter::RecordEncoder {
  public:
-  // Creates a new adapter for a field name field_name.
-  explicit FormatFieldAdapter(const string& field_name)
-      : field_name_(field_name) {}
-
-  // Returns true if the format field field_name occurs in any VariantCall.info
-  // maps present in Variant.
-  bool IsPresentInAnyVariantCalls(const Variant& variant) const {
-    for (const VariantCall& vc : variant.calls()) {
-      if (vc.info().find(field_name_) != vc.info().end()) return true;
+  explicit RecordEncoder(const bcf_hdr_t* h) : h_(*h) {
+    // The order of these fields here determines the order of the fields in
+    // the VCF.
+    for (const auto& name_and_type :
+         std::vector<std::pair<string, uint32_t>>{{"GQ", BCF_HT_INT},
+                                                  {"DP", BCF_HT_INT},
+                                                  {"AD", BCF_HT_INT},
+                                                  {"VAF", BCF_HT_REAL}}) {
+      FormatField field;
+      field.name = name_and_type.first;
+      field.header_type = name_and_type.second;
+      const int id = bcf_hdr_id2int(h, BCF_DT_ID, field.name.c_str());
+      if (id < 0) {
+        field.status = tf::errors::FailedPrecondition(
+            StrCat("Field ", field.name, " not in the VCF header"));
+      } else if (bcf_hdr_id2type(h, BCF_HL_FMT, id) != field.header_type) {
+        field.status = tf::errors::FailedPrecondition(StrCat(
+            "Field ", field.name,
+            " isn't the right type. Expected header_type: ",
+            field.header_type));
+      }
+      format_fields_.push_back(std::move(field));
     }
-    return false;
   }
 
-  // Adds the values for our field_name from variant's calls into our bcf1_t
-  // record bcf_record.
-  //
-  // This function supports both single value (DP) and multi-value (AD) info
-  // fields.
-  //
-  // This function only works if the values in the VariantCall info maps don't
-  // need to be modified in any way before adding them to the bcf_record. For
-  // example, if DP in the VariantCall.info["DP"] map is 10, then we will write
-  // a 10 in the bcf_record for the DP field. An example of a field that isn't
-  // support by this class is the repeated genotype_likelihood field in the
-  // VariantCall proto. These aren't stored in the info field, but are inlined
-  // directly in the proto, even though they are written to the FORMAT field
-  // in VCF.
+  // Parses the Variant protobuf variant_message into the htslib VCF record v.
+  tf::Status Encode(const Variant& variant_message, bcf1_t* v);
+
+ private:
+  // A FORMAT field whose values we write from VariantCall.info.
   //
   // WARNING: This code currently assumes that all field values are real
   // numbers for "VAF" field. For all other field, it assumes the field values
   // are integers.
+  struct FormatField {
+    // The name of our field, such as "DP", "AD", or "VAF".
+    string name;
+    // BCF_HT_INT or BCF_HT_REAL.
+    uint32_t header_type;
+    // Not OK if our header can't hold this field.
+    tf::Status status;
+  };
+
+  // Adds the values of field from variant's calls into our record v, if any
+  // call has the field.
+  //
+  // This function supports both single value (DP) and multi-value (AD) info
+  // fields, whose values in the VariantCall info maps are written unmodified.
   template <class T>
-  tf::Status EncodeValues(const Variant& variant, const bcf_hdr_t* header,
-                          uint32_t header_type, bcf1_t* bcf_record) const {
-    const int id = bcf_hdr_id2int(header, BCF_HL_FLT, field_name_.c_str());
-    if (id < 0)
-      return tf::errors::FailedPrecondition(
-          StrCat("Field ", field_name_, " not in the VCF header"));
-    if (bcf_hdr_id2type(header, BCF_HL_FMT, id) != header_type)
-      return tf::errors::FailedPrecondition(
-          StrCat("Field ", field_name_,
-                 " isn't the right type. Expected header_type: ", header_type));
-
-    const int n_calls = variant.calls().size();
-    std::vector<std::vector<T>> values(n_calls, std::vector<T>{});
-    for (int i = 0; i < n_calls; ++i) {
-      const VariantCall& vc = variant.calls(i);
-      auto found = vc.info().find(field_name_);
-      if (found != vc.info().end()) {
-        for (auto& list_value : (*found).second.values()) {
-          values[i].push_back(list_value.number_value());
-        }
+  tf::Status EncodeInfoValues(const Variant& variant, const FormatField& field,
+                              std::vector<T>* values, std::vector<T>* flat,
+                              bcf1_t* v) {
+    bool present = false;
+    values->clear();
+    counts_.clear();
+    for (const VariantCall& vc : variant.calls()) {
+      auto found = vc.info().find(field.name);
+      if (found == vc.info().end()) {
+        // Since we don't have this field in this sample, its values are
+        // missing.
+        counts_.push_back(0);
+        continue;
       }
-      // Since we don't have a field_name_ key/value pair in this sample, we
-      // just leave the values[i] empty.
+      present = true;
+      for (const auto& list_value : found->second.values()) {
+        values->push_back(list_value.number_value());
+      }
+      counts_.push_back(found->second.values_size());
     }
-
-    // Encode the values from our vector into the htslib bcf_t record.
-    return EncodeFormatValues(values, field_name_.c_str(), header, bcf_record);
+    if (!present) return tf::Status::OK();
+    TF_RETURN_IF_ERROR(field.status);
+    return EncodeFormatValues(*values, counts_, field.name.c_str(), &h_, v,
+                              flat);
   }
 
-  tf::Status EncodeValues(const Variant& variant, const bcf_hdr_t* header,
-                          bcf1_t* bcf_record) const {
-    if (FIELD_TYPE->count(field_name_) <= 0)
-      return tf::errors::FailedPrecondition(
-          StrCat("Field ", field_name_, " not in the FIELD_TYPE map."));
-    int header_type = FIELD_TYPE->find(field_name_)->second;
-    if (header_type == BCF_HT_REAL) {
-      return EncodeValues<float>(variant, header, header_type, bcf_record);
-    } else if (header_type == BCF_HT_INT) {
-      return EncodeValues<int>(variant, header, header_type, bcf_record);
-    } else {
-      return tf::errors::FailedPrecondition(
-          StrCat("Unrecognized type for field ", field_name_));
+  // Returns the header id of the filter filter_name, or -1 if it isn't in
+  // our header.
+  int FilterId(const string& filter_name) {
+    for (const auto& filter : filter_ids_) {
+      if (filter.first == filter_name) return filter.second;
     }
-    return tf::Status::OK();
+    const int id = bcf_hdr_id2int(&h_, BCF_DT_ID, filter_name.c_str());
+    if (id >= 0) filter_ids_.emplace_back(filter_name, id);
+    return id;
   }
 
-  // The name of our field, such as "DP", "AD", or "VAF".
-  const string field_name_;
+  const bcf_hdr_t& h_;
+  std::vector<FormatField> format_fields_;
+  // The header ids of the filters we have written so far.
+  std::vector<std::pair<string, int>> filter_ids_;
+  // The reference name and its header id of the previous record, which is
+  // usually the reference of the next one too.
+  string last_reference_name_;
+  int last_rid_ = -1;
+
+  // Scratch space for the arrays of each record.
+  std::vector<const char*> alleles_;
+  std::vector<int32_t> filters_;
+  std::vector<int32_t> genotypes_;
+  std::vector<int> counts_;
+  std::vector<int> int_values_;
+  std::vector<int> int_flat_;
+  std::vector<float> float_values_;
+  std::vector<float> float_flat_;
 };
 
-// Parses the Variant protobuf variant_message into an htslib VCF record
-tf::Status ConvertFromPb(const Variant& variant_message, const bcf_hdr_t& h,
-                         bcf1_t* v) {
+tf::Status VcfWriter::RecordEncoder::Encode(const Variant& variant_message,
+                                            bcf1_t* v) {
   CHECK(v != nullptr) << "bcf1_t record cannot be null";
+  const bcf_hdr_t& h = h_;
 
-  v->rid = bcf_hdr_name2id(&h, variant_message.reference_name().c_str());
+  if (last_rid_ < 0 ||
+      variant_message.reference_name() != last_reference_name_) {
+    last_rid_ = bcf_hdr_name2id(&h, variant_message.reference_name().c_str());
+    last_reference_name_ = variant_message.reference_name();
+  }
+  v->rid = last_rid_;
   if (v->rid < 0)
     return tf::errors::NotFound(
         "Record's reference name is not available in VCF header.");
@@ -314,26 +324,25 @@ tf::Status ConvertFromPb(const Variant& variant_message, const bcf_hdr_t& h,
 
   // Alleles
   int nAlleles = 1 + variant_message.alternate_bases_size();
-  auto alleles = absl::make_unique<const char*[]>(nAlleles);
-  alleles.get()[0] = variant_message.reference_bases().c_str();
+  alleles_.resize(nAlleles);
+  alleles_[0] = variant_message.reference_bases().c_str();
   for (int i = 1; i < nAlleles; i++) {
-    alleles.get()[i] = variant_message.alternate_bases(i - 1).c_str();
+    alleles_[i] = variant_message.alternate_bases(i - 1).c_str();
   }
-  bcf_update_alleles(&h, v, alleles.get(), nAlleles);
+  bcf_update_alleles(&h, v, alleles_.data(), nAlleles);
 
   // FILTER
   int nFilters = variant_message.filter_size();
   if (nFilters > 0) {
-    auto filterIds = absl::make_unique<int32_t[]>(nFilters);
+    filters_.resize(nFilters);
     for (int i = 0; i < nFilters; i++) {
-      const char* filterName = variant_message.filter(i).c_str();
-      int32_t filterId = bcf_hdr_id2int(&h, BCF_DT_ID, filterName);
+      int32_t filterId = FilterId(variant_message.filter(i));
       if (filterId < 0) {
         return tf::errors::NotFound("Filter must be found in header.");
       }
-      filterIds.get()[i] = filterId;
+      filters_[i] = filterId;
     }
-    bcf_update_filter(&h, v, filterIds.get(), nFilters);
+    bcf_update_filter(&h, v, filters_.data(), nFilters);
   }
 
   // Variant calls
@@ -352,7 +361,7 @@ tf::Status ConvertFromPb(const Variant& variant_message, const bcf_hdr_t& h,
 
   if (nCalls > 0) {
     // Write genotypes.
-    auto gts = absl::make_unique<int32_t[]>(nCalls * ploidy);
+    genotypes_.resize(nCalls * ploidy);
     for (int c = 0; c < nCalls; c++) {
       const VariantCall& vc = variant_message.calls(c);
 
@@ -367,15 +376,25 @@ tf::Status ConvertFromPb(const Variant& variant_message, const bcf_hdr_t& h,
       const bool isPhased = !vc.phaseset().empty();
       int a = 0;
       for (; a < vc.genotype_size(); a++) {
-        gts.get()[c * ploidy + a] = vcfEncodeAllele(vc.genotype(a), isPhased);
+        genotypes_[c * ploidy + a] = vcfEncodeAllele(vc.genotype(a), isPhased);
       }
       for (; a < ploidy; a++) {
-        gts.get()[c * ploidy + a] = bcf_int32_vector_end;
+        genotypes_[c * ploidy + a] = bcf_int32_vector_end;
       }
     }
-    bcf_update_genotypes(&h, v, gts.get(), nCalls * ploidy);
+    bcf_update_genotypes(&h, v, genotypes_.data(), nCalls * ploidy);
 
     // Write remaining FORMAT fields
+    for (const FormatField& field : format_fields_) {
+      if (field.header_type == BCF_HT_REAL) {
+        TF_RETURN_IF_ERROR(EncodeInfoValues(variant_message, field,
+                                            &float_values_, &float_flat_, v));
+      } else {
+        TF_RETURN_IF_ERROR(EncodeInfoValues(variant_message, field,
+                                            &int_values_, &int_flat_, v));
+      }
+    }
+
     bool has_ll = false;
     for (int c = 0; c < nCalls; c++) {
       const VariantCall& vc = variant_message.calls(c);
@@ -383,67 +402,71 @@ tf::Status ConvertFromPb(const Variant& variant_message, const bcf_hdr_t& h,
         has_ll = true;
       }
     }
-
-    // The order of adapter definitions here determines the order of the fields
-    // in the VCF.
-    std::vector<FormatFieldAdapter> format_field_adapters = {
-        FormatFieldAdapter("GQ"),
-        FormatFieldAdapter("DP"),
-        FormatFieldAdapter("AD"),
-        FormatFieldAdapter("VAF"),
-    };
-    for (const FormatFieldAdapter& field : format_field_adapters) {
-      if (field.IsPresentInAnyVariantCalls(variant_message)) {
-        TF_RETURN_IF_ERROR(field.EncodeValues(variant_message, &h, v));
-      }
-    }
-
-    std::vector<std::vector<int>> ll_values_phred;
-    for (int c = 0; c < nCalls; c++) {
-      const VariantCall& vc = variant_message.calls(c);
-      // loglikelihood
-      if (has_ll) {
-        bool ll_not_missing = vc.genotype_likelihood_size() > 0;
-        if (ll_not_missing) {
-          std::vector<double> lls_this_call;
-          for (double ll_val : vc.genotype_likelihood()) {
-            lls_this_call.push_back(ll_val);
-          }
-          // "Normalize" likelihoods...
-          std::vector<double> lls_this_call_normalized =
-              ZeroShiftLikelihoods(lls_this_call);
-
-          // Phred-transform them...
-          std::vector<int> phreds_this_call(lls_this_call.size());
-          std::transform(lls_this_call_normalized.cbegin(),
-                         lls_this_call_normalized.cend(),
-                         phreds_this_call.begin(), Log10PErrorToPhred);
-          ll_values_phred.push_back(phreds_this_call);
-        } else {
-          ll_values_phred.push_back({});
+    if (has_ll) {
+      int_values_.clear();
+      counts_.clear();
+      for (int c = 0; c < nCalls; c++) {
+        const auto& lls = variant_message.calls(c).genotype_likelihood();
+        counts_.push_back(lls.size());
+        if (lls.empty()) continue;
+        // "Normalize" likelihoods, as ZeroShiftLikelihoods does, and
+        // Phred-transform them...
+        const double max = *std::max_element(lls.begin(), lls.end());
+        for (double ll_val : lls) {
+          int_values_.push_back(Log10PErrorToPhred(ll_val - max));
         }
       }
+      TF_RETURN_IF_ERROR(
+          EncodeFormatValues(int_values_, counts_, "PL", &h, v, &int_flat_));
     }
-
-    TF_RETURN_IF_ERROR(EncodeFormatValues(ll_values_phred, "PL", &h, v));
   }
   return tf::Status::OK();
 }
 
-}  // namespace
-
 StatusOr<std::unique_ptr<VcfWriter>> VcfWriter::ToFile(
     const string& variants_path, const VcfWriterOptions& options) {
-  const char* const openMode = EndsWith(variants_path, ".gz")
-                                   ? kOpenModeCompressed
-                                   : kOpenModeUncompressed;
+  const bool is_bcf = EndsWith(variants_path, ".bcf");
+  const bool is_compressed = is_bcf || EndsWith(variants_path, ".gz");
+  const bool write_index =
+      options.index_mode() == IndexHandlingMode::INDEX_BASED_ON_FILENAME;
+  if (write_index && !is_compressed)
+    return tf::errors::InvalidArgument(
+        StrCat("Only .gz and .bcf outputs can be indexed, not ",
+               variants_path));
+  const char* openMode = kOpenModeUncompressed;
+  if (is_bcf) {
+    openMode = kOpenModeBcf;
+  } else if (is_compressed) {
+    openMode = kOpenModeCompressed;
+  }
   htsFile* fp = hts_open_x(variants_path.c_str(), openMode);
   if (fp == nullptr)
     return tf::errors::Unknown(
         StrCat("Could not open variants_path ", variants_path));
+  // The threaded BGZF writer of our htslib only advances the file offsets we
+  // index by as its threads finish blocks, so indexed outputs are compressed
+  // on the writing thread.
+  if (write_index && options.num_compression_threads() > 0) {
+    LOG(WARNING) << "Ignoring num_compression_threads when indexing "
+                 << variants_path;
+  } else {
+    tf::Status pool_status =
+        UseSharedHtsThreadPool(fp, options.num_compression_threads());
+    if (!pool_status.ok()) {
+      hts_close(fp);
+      return pool_status;
+    }
+  }
 
   auto writer = absl::WrapUnique(new VcfWriter(options, fp));
   TF_RETURN_IF_ERROR(writer->WriteHeader());
+  if (write_index) {
+    TF_RETURN_IF_ERROR(writer->InitIndex(variants_path, is_bcf));
+  }
+  if (options.write_queue_size() > 0) {
+    writer->thread_ = std::thread(&VcfWriter::WriteQueuedVariants,
+                                  writer.get());
+  }
   return std::move(writer);
 }
 
@@ -483,8 +506,94 @@ VcfWriter::VcfWriter(const VcfWriterOptions& options, htsFile* fp)
 tf::Status VcfWriter::WriteHeader() {
   if (bcf_hdr_write(fp_, header_) < 0)
     return tf::errors::Unknown("Failed to write header");
-  else
-    return tf::Status::OK();
+  encoder_.reset(new RecordEncoder(header_));
+  return tf::Status::OK();
+}
+
+tf::Status VcfWriter::InitIndex(const string& variants_path, bool is_bcf) {
+  BGZF* bgzf = fp_->fp.bgzf;
+  if (is_bcf) {
+    // As in bcf_index(), use enough levels for the longest contig.
+    int64 max_length = 0;
+    for (const ContigInfo& contig : options_.contigs()) {
+      max_length = std::max(max_length, contig.n_bases());
+    }
+    max_length += 256;
+    int n_levels = 0;
+    for (int64 size = 1LL << kCsiMinShift; max_length > size; size <<= 3) {
+      ++n_levels;
+    }
+    idx_format_ = HTS_FMT_CSI;
+    idx_ = hts_idx_init(header_->n[BCF_DT_CTG], idx_format_, bgzf_tell(bgzf),
+                        kCsiMinShift, n_levels);
+  } else {
+    idx_format_ = HTS_FMT_TBI;
+    idx_ = hts_idx_init(0, idx_format_, bgzf_tell(bgzf), kTbiMinShift,
+                        kTbiLevels);
+    tbi_ids_.assign(header_->n[BCF_DT_CTG], -1);
+  }
+  if (idx_ == nullptr)
+    return tf::errors::Unknown("hts_idx_init call failed");
+  variants_path_ = variants_path;
+  return tf::Status::OK();
+}
+
+tf::Status VcfWriter::AddToIndex(const bcf1_t& v) {
+  // A CSI index of BCF uses the contig ids of the header directly.
+  int id = v.rid;
+  if (idx_format_ == HTS_FMT_TBI) {
+    if (tbi_ids_[v.rid] < 0) {
+      tbi_ids_[v.rid] = tbi_names_.size();
+      tbi_names_.push_back(bcf_hdr_id2name(header_, v.rid));
+    }
+    id = tbi_ids_[v.rid];
+  }
+  if (hts_idx_push(idx_, id, v.pos, v.pos + v.rlen, bgzf_tell(fp_->fp.bgzf),
+                   1) < 0) {
+    // The index can't describe the file now, so we stop building it.
+    hts_idx_destroy(idx_);
+    idx_ = nullptr;
+    return tf::errors::FailedPrecondition(
+        StrCat("Variants must be written in sorted order to be indexed, but ",
+               bcf_hdr_id2name(header_, v.rid), ":", v.pos + 1,
+               " is out of order"));
+  }
+  return tf::Status::OK();
+}
+
+tf::Status VcfWriter::SaveIndex() {
+  BGZF* bgzf = fp_->fp.bgzf;
+  if (bgzf_flush(bgzf) < 0) {
+    hts_idx_destroy(idx_);
+    idx_ = nullptr;
+    return tf::errors::Unknown("bgzf_flush call failed");
+  }
+  hts_idx_finish(idx_, bgzf_tell(bgzf));
+  if (idx_format_ == HTS_FMT_TBI) {
+    // Tabix keeps its configuration and the contig names in the index, as
+    // tbx_index() does.
+    std::vector<int32_t> conf = {
+        tbx_conf_vcf.preset,     tbx_conf_vcf.sc,        tbx_conf_vcf.bc,
+        tbx_conf_vcf.ec,         tbx_conf_vcf.meta_char, tbx_conf_vcf.line_skip,
+        0};
+    string names;
+    for (const string& name : tbi_names_) {
+      names.append(name.c_str(), name.size() + 1);
+    }
+    conf.back() = names.size();
+    string meta(reinterpret_cast<const char*>(conf.data()),
+                conf.size() * sizeof(int32_t));
+    meta += names;
+    hts_idx_set_meta(idx_, meta.size(),
+                     reinterpret_cast<uint8_t*>(&meta[0]), 1);
+  }
+  tf::Status status;
+  if (hts_idx_save(idx_, variants_path_.c_str(), idx_format_) < 0)
+    status = tf::errors::Unknown(
+        StrCat("Could not write the index of ", variants_path_));
+  hts_idx_destroy(idx_);
+  idx_ = nullptr;
+  return status;
 }
 
 VcfWriter::~VcfWriter() {
@@ -495,16 +604,77 @@ VcfWriter::~VcfWriter() {
   }
 }
 
-tf::Status VcfWriter::Write(const Variant& variant_message) {
-  if (fp_ == nullptr)
-    return tf::errors::FailedPrecondition("Cannot write to closed VCF stream.");
+tf::Status VcfWriter::WriteRecord(const Variant& variant_message) {
   bcf1_t* v = bcf_init();
   if (v == nullptr)
     return tf::errors::Unknown("bcf_init call failed");
-  TF_RETURN_IF_ERROR(ConvertFromPb(variant_message, *header_, v));
-  if (bcf_write(fp_, header_, v) != 0)
-    return tf::errors::Unknown("bcf_write call failed");
+  tf::Status status = encoder_->Encode(variant_message, v);
+  if (status.ok() && bcf_write(fp_, header_, v) != 0)
+    status = tf::errors::Unknown("bcf_write call failed");
+  if (status.ok() && idx_ != nullptr) status = AddToIndex(*v);
   bcf_destroy(v);
+  return status;
+}
+
+void VcfWriter::WriteQueuedVariants() {
+  std::deque<Variant> batch;
+  while (true) {
+    {
+      tf::mutex_lock lock(mutex_);
+      while (queue_.empty() && !closing_) {
+        cond_.wait(lock);
+      }
+      if (queue_.empty()) return;
+      // Take the whole queue, so producers can refill it while we write.
+      batch.swap(queue_);
+    }
+    cond_.notify_all();
+    tf::Status status;
+    for (const Variant& variant : batch) {
+      status = WriteRecord(variant);
+      if (!status.ok()) break;
+    }
+    batch.clear();
+    if (!status.ok()) {
+      {
+        tf::mutex_lock lock(mutex_);
+        error_ = status;
+        queue_.clear();
+      }
+      cond_.notify_all();
+      return;
+    }
+  }
+}
+
+tf::Status VcfWriter::Enqueue(const Variant* variants, int num_variants) {
+  const size_t max_queued = options_.write_queue_size();
+  tf::mutex_lock lock(mutex_);
+  for (int i = 0; i < num_variants; ++i) {
+    while (error_.ok() && queue_.size() >= max_queued) {
+      cond_.wait(lock);
+    }
+    TF_RETURN_IF_ERROR(error_);
+    queue_.push_back(variants[i]);
+    cond_.notify_all();
+  }
+  return tf::Status::OK();
+}
+
+tf::Status VcfWriter::Write(const Variant& variant_message) {
+  if (fp_ == nullptr)
+    return tf::errors::FailedPrecondition("Cannot write to closed VCF stream.");
+  if (thread_.joinable()) return Enqueue(&variant_message, 1);
+  return WriteRecord(variant_message);
+}
+
+tf::Status VcfWriter::WriteBatch(const std::vector<Variant>& variants) {
+  if (fp_ == nullptr)
+    return tf::errors::FailedPrecondition("Cannot write to closed VCF stream.");
+  if (thread_.joinable()) return Enqueue(variants.data(), variants.size());
+  for (const Variant& variant : variants) {
+    TF_RETURN_IF_ERROR(WriteRecord(variant));
+  }
   return tf::Status::OK();
 }
 
@@ -512,12 +682,32 @@ tf::Status VcfWriter::Close() {
   if (fp_ == nullptr)
     return tf::errors::FailedPrecondition(
         "Cannot close an already closed VcfWriter");
-  if (hts_close(fp_) < 0)
-    return tf::errors::Unknown("hts_close call failed");
+  tf::Status status;
+  if (thread_.joinable()) {
+    {
+      tf::mutex_lock lock(mutex_);
+      closing_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+    status = error_;
+  }
+  if (idx_ != nullptr) {
+    // Without all of its variants, an index would only mislead readers.
+    if (status.ok()) {
+      status = SaveIndex();
+    } else {
+      hts_idx_destroy(idx_);
+      idx_ = nullptr;
+    }
+  }
+  if (hts_close(fp_) < 0 && status.ok())
+    status = tf::errors::Unknown("hts_close call failed");
   fp_ = nullptr;
+  encoder_.reset();
   bcf_hdr_destroy(header_);
   header_ = nullptr;
-  return tf::Status::OK();
+  return status;
 }
 
 }  // namespace core
@@ -32,6 +32,11 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_CORE_VCF_WRITER_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_CORE_VCF_WRITER_H_
 
+#include <deque>
+#include <memory>
+#include <thread>  // NOLINT
+#include <vector>
+
 #include "deepvariant/core/genomics/range.pb.h"
 #include "deepvariant/core/genomics/variants.pb.h"
 #include "deepvariant/core/protos/core.pb.h"
@@ -40,6 +45,7 @@
 #include "htslib/sam.h"
 #include "htslib/vcf.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace learning {
@@ -49,6 +55,17 @@ namespace core {
 using tensorflow::string;
 
 // A VCF writer, allowing us to write VCF files.
+//
+// Paths ending in .gz are written as bgzipped VCF, and paths ending in .bcf as
+// BCF. If options.index_mode() is INDEX_BASED_ON_FILENAME, these are indexed
+// as they are written, into a tabix index at <path>.tbi or a CSI index at
+// <path>.csi respectively, so the variants must be written in sorted order.
+// Writing a variant out of order fails, and no index is written.
+//
+// If options.write_queue_size() is positive, Write() only queues its variants,
+// and a background thread converts and writes them. An error writing one of
+// them is then returned by a later Write() or by Close(), and the variants
+// after it are dropped.
 class VcfWriter {
  public:
   // Creates a new VcfWriter writing to the file at variants_path, which is
@@ -69,9 +86,14 @@ class VcfWriter {
   tensorflow::Status Write(
       const learning::genomics::v1::Variant& variant_message);
 
-  // Close the underlying resource descriptors. Returns Status::OK() if the
-  // close was successful; otherwise the status provides information about what
-  // error occurred.
+  // Writes each of variants in order, as Write() does, queueing them together
+  // when writing in the background.
+  tensorflow::Status WriteBatch(
+      const std::vector<learning::genomics::v1::Variant>& variants);
+
+  // Close the underlying resource descriptors, after writing any queued
+  // variants. Returns Status::OK() if the close was successful; otherwise the
+  // status provides information about what error occurred.
   tensorflow::Status Close();
 
   // This no-op function is needed only for Python context manager support.  Do
@@ -79,10 +101,34 @@ class VcfWriter {
   void PythonEnter() const {}
 
  private:
+  class RecordEncoder;
+
   VcfWriter(const VcfWriterOptions& options, htsFile* fp);
 
   tensorflow::Status WriteHeader();
 
+  // Starts the index of our output at variants_path, written by Close().
+  tensorflow::Status InitIndex(const string& variants_path, bool is_bcf);
+
+  // Adds the record v, just written to fp_, to idx_.
+  tensorflow::Status AddToIndex(const bcf1_t& v);
+
+  // Completes idx_ and saves it next to our output.
+  tensorflow::Status SaveIndex();
+
+  // Converts variant_message to a VCF record with encoder_ and writes it to
+  // fp_.
+  tensorflow::Status WriteRecord(
+      const learning::genomics::v1::Variant& variant_message);
+
+  // Queues the num_variants variants for thread_, waiting for space in the
+  // queue as needed.
+  tensorflow::Status Enqueue(const learning::genomics::v1::Variant* variants,
+                             int num_variants);
+
+  // The body of our background thread, writing the queued variants in order.
+  void WriteQueuedVariants();
+
   // A pointer to the htslib file used to write the VCF data.
   htsFile* fp_;
 
@@ -91,6 +137,35 @@ class VcfWriter {
 
   // A pointer to the VCF header object.
   bcf_hdr_t* header_;
+
+  // Converts our variants to records of header_, once it is written.
+  std::unique_ptr<RecordEncoder> encoder_;
+
+  // The index we are building as we write, or nullptr if we aren't.
+  hts_idx_t* idx_ = nullptr;
+  // The HTS_FMT_TBI or HTS_FMT_CSI format of idx_.
+  int idx_format_ = 0;
+  // The path of our output, next to which idx_ is saved.
+  string variants_path_;
+  // For a tabix index, which numbers contigs in order of appearance, the index
+  // id of each contig header id, or -1 if not yet seen.
+  std::vector<int> tbi_ids_;
+  // The contig names of a tabix index, in order of their index id.
+  std::vector<string> tbi_names_;
+
+  // Guards the queue below, when writing in the background.
+  tensorflow::mutex mutex_;
+  // Notified whenever variants are added to or taken from queue_, or when
+  // closing.
+  tensorflow::condition_variable cond_;
+  // The variants waiting to be written by thread_, in order.
+  std::deque<learning::genomics::v1::Variant> queue_;
+  // The first error of thread_, which stops it writing.
+  tensorflow::Status error_;
+  // Set by Close() to stop thread_ once queue_ is empty.
+  bool closing_ = false;
+
+  std::thread thread_;
 };
 
 }  // namespace core
@@ -38,6 +38,7 @@
 #include "deepvariant/core/protos/core.pb.h"
 #include "deepvariant/core/test_utils.h"
 #include "deepvariant/core/utils.h"
+#include "deepvariant/core/vcf_reader.h"
 #include "deepvariant/vendor/status_matchers.h"
 
 #include "tensorflow/core/lib/core/status.h"
@@ -71,8 +72,11 @@ constexpr char kVcfLikelihoodsGoldenFilename[] = "test_likelihoods.vcf.golden.tf
 
 // Build the skeleton of a VCF file for some pretend variants.
 // This routine will populated headers but not any records.
-std::unique_ptr<VcfWriter> MakeDogVcfWriter(StringPiece fname) {
+VcfWriterOptions MakeDogVcfWriterOptions(int num_compression_threads = 0,
+                                         int write_queue_size = 0) {
   VcfWriterOptions writer_options;
+  writer_options.set_num_compression_threads(num_compression_threads);
+  writer_options.set_write_queue_size(write_queue_size);
   auto& contig1 = *writer_options.mutable_contigs()->Add();
   contig1.set_name("Chr1");
   contig1.set_description("Dog chromosome 1");
@@ -85,7 +89,21 @@ std::unique_ptr<VcfWriter> MakeDogVcfWriter(StringPiece fname) {
   contig2.set_pos_in_fasta(1);
   writer_options.mutable_sample_names()->Add("Fido");
   writer_options.mutable_sample_names()->Add("Spot");
+  return writer_options;
+}
+
+std::unique_ptr<VcfWriter> MakeDogVcfWriter(StringPiece fname,
+                                            int num_compression_threads = 0,
+                                            int write_queue_size = 0) {
+  VcfWriterOptions writer_options =
+      MakeDogVcfWriterOptions(num_compression_threads, write_queue_size);
+  return std::move(
+      VcfWriter::ToFile(fname.ToString(), writer_options).ValueOrDie());
+}
 
+std::unique_ptr<VcfWriter> MakeIndexedDogVcfWriter(StringPiece fname) {
+  VcfWriterOptions writer_options = MakeDogVcfWriterOptions();
+  writer_options.set_index_mode(IndexHandlingMode::INDEX_BASED_ON_FILENAME);
   return std::move(
       VcfWriter::ToFile(fname.ToString(), writer_options).ValueOrDie());
 }
@@ -238,6 +256,125 @@ TEST(VcfWriterTest, WritesGzippedVCF) {
               "VCF writer should be able to writed gzipped output");
 }
 
+// Compressing in threads and writing from a queue, in batches or not, give
+// the same file as writing each variant on the calling thread.
+TEST(VcfWriterTest, WritesTheSameVCFInTheBackground) {
+  std::vector<Variant> variants = ReadProtosFromTFRecord<Variant>(
+      GetTestData(kVcfLikelihoodsGoldenFilename));
+  string expected_fname = MakeTempFile("background_expected.vcf.gz");
+  auto expected_writer = MakeDogVcfWriter(expected_fname);
+  for (const auto& variant : variants) {
+    ASSERT_THAT(expected_writer->Write(variant), IsOK());
+  }
+  ASSERT_THAT(expected_writer->Close(), IsOK());
+  string expected_contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(
+      tensorflow::Env::Default(), expected_fname, &expected_contents));
+
+  for (const int num_compression_threads : {0, 2}) {
+    for (const int write_queue_size : {0, 1, 3}) {
+      string out_fname = MakeTempFile("background_out.vcf.gz");
+      auto writer = MakeDogVcfWriter(out_fname, num_compression_threads,
+                                     write_queue_size);
+      ASSERT_THAT(writer->Write(variants[0]), IsOK());
+      ASSERT_THAT(writer->WriteBatch(std::vector<Variant>(
+                      variants.begin() + 1, variants.end())),
+                  IsOK());
+      ASSERT_THAT(writer->Close(), IsOK());
+      string vcf_contents;
+      TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                               out_fname, &vcf_contents));
+      EXPECT_EQ(expected_contents, vcf_contents)
+          << "num_compression_threads=" << num_compression_threads
+          << " write_queue_size=" << write_queue_size;
+    }
+  }
+}
+
+// An error writing a queued variant is returned by a later call.
+TEST(VcfWriterTest, ReturnsErrorsOfQueuedVariants) {
+  string out_fname = MakeTempFile("background_error.vcf");
+  auto writer = MakeDogVcfWriter(out_fname, 0, 2);
+  Variant variant = MakeVariant({}, "Chr3", 20, 21, "A", {"T"});
+  *variant.add_calls() = MakeVariantCall("Fido", {0, 1});
+  *variant.add_calls() = MakeVariantCall("Spot", {0, 0});
+  ASSERT_THAT(writer->Write(variant), IsOK());
+  EXPECT_THAT(writer->Close(), IsNotOKWithCode(tensorflow::error::NOT_FOUND));
+}
+
+// Writes three sorted variants for Fido and Spot, on Chr1 and Chr2.
+void WriteSortedDogVariants(VcfWriter* writer) {
+  for (const auto& site : std::vector<std::pair<string, int>>{
+           {"Chr1", 10}, {"Chr1", 20}, {"Chr2", 5}}) {
+    Variant variant =
+        MakeVariant({}, site.first, site.second, site.second + 1, "A", {"T"});
+    *variant.add_calls() = MakeVariantCall("Fido", {0, 1});
+    *variant.add_calls() = MakeVariantCall("Spot", {0, 0});
+    ASSERT_THAT(writer->Write(variant), IsOK());
+  }
+}
+
+TEST(VcfWriterTest, WritesTabixIndexOfGzippedVCF) {
+  string out_fname = MakeTempFile("indexed.vcf.gz");
+  auto writer = MakeIndexedDogVcfWriter(out_fname);
+  WriteSortedDogVariants(writer.get());
+  ASSERT_THAT(writer->Close(), IsOK());
+  ASSERT_THAT(tensorflow::Env::Default()->FileExists(out_fname + ".tbi"),
+              IsOK());
+
+  VcfReaderOptions reader_options;
+  reader_options.set_index_mode(IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+  auto reader = std::move(
+      VcfReader::FromFile(out_fname, reader_options).ValueOrDie());
+  EXPECT_EQ(2, as_vector(reader->Query(MakeRange("Chr1", 0, 50))).size());
+  std::vector<Variant> chr2 =
+      as_vector(reader->Query(MakeRange("Chr2", 0, 25)));
+  ASSERT_EQ(1, chr2.size());
+  EXPECT_EQ(5, chr2[0].start());
+}
+
+TEST(VcfWriterTest, WritesBCFWithCsiIndex) {
+  string out_fname = MakeTempFile("indexed.bcf");
+  auto writer = MakeIndexedDogVcfWriter(out_fname);
+  WriteSortedDogVariants(writer.get());
+  ASSERT_THAT(writer->Close(), IsOK());
+  ASSERT_THAT(tensorflow::Env::Default()->FileExists(out_fname + ".csi"),
+              IsOK());
+
+  string bcf_contents;
+  TF_CHECK_OK(tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                           out_fname, &bcf_contents));
+  EXPECT_TRUE(IsGzipped(bcf_contents));
+  auto reader = std::move(
+      VcfReader::FromFile(out_fname, VcfReaderOptions()).ValueOrDie());
+  std::vector<Variant> variants = as_vector(reader->Iterate());
+  ASSERT_EQ(3, variants.size());
+  EXPECT_EQ("Chr2", variants[2].reference_name());
+}
+
+TEST(VcfWriterTest, RejectsIndexOfUncompressedVCF) {
+  VcfWriterOptions writer_options = MakeDogVcfWriterOptions();
+  writer_options.set_index_mode(IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+  EXPECT_THAT(
+      VcfWriter::ToFile(MakeTempFile("unindexable.vcf"), writer_options),
+      IsNotOKWithCode(tensorflow::error::INVALID_ARGUMENT));
+}
+
+TEST(VcfWriterTest, IndexingRequiresSortedVariants) {
+  string out_fname = MakeTempFile("unsorted.vcf.gz");
+  auto writer = MakeIndexedDogVcfWriter(out_fname);
+  Variant variant = MakeVariant({}, "Chr1", 20, 21, "A", {"T"});
+  *variant.add_calls() = MakeVariantCall("Fido", {0, 1});
+  *variant.add_calls() = MakeVariantCall("Spot", {0, 0});
+  ASSERT_THAT(writer->Write(variant), IsOK());
+  variant.set_start(10);
+  variant.set_end(11);
+  EXPECT_THAT(writer->Write(variant),
+              IsNotOKWithCode(tensorflow::error::FAILED_PRECONDITION));
+  ASSERT_THAT(writer->Close(), IsOK());
+  EXPECT_FALSE(
+      tensorflow::Env::Default()->FileExists(out_fname + ".tbi").ok());
+}
 
 }  // namespace core
 }  // namespace genomics
@@ -0,0 +1,328 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Streams calling examples from make_examples to call_variants over a socket.
+
+Normally make_examples writes all of its examples to disk and call_variants
+reads them back once make_examples has finished. When both run on the same
+machine they can instead be connected through a local (Unix domain) socket:
+call_variants listens on the socket and starts running inference as soon as
+the first examples arrive, while make_examples, possibly as several sharded
+tasks, sends its examples as it makes them. No intermediate file is written.
+
+Both sides name the socket with a 'unix:' path given to their --examples flag,
+sharded the same way as a file would be: run call_variants with
+--examples unix:/tmp/dv.sock@4 and each of the four make_examples tasks with
+--examples unix:/tmp/dv.sock@4 --task <i>. It doesn't matter which side is
+started first. call_variants finishes once every shard has sent all of its
+examples.
+
+Reading is bounded by a queue of buffered examples: when call_variants falls
+behind, the queue fills up, the socket buffers fill up behind it and
+make_examples blocks in write() until inference catches up.
+
+Each connection starts with a header naming the shard it carries, followed
+by one message per example: a header of five little-endian uint32 values
+(height, width, channels, variant length, alt allele indices length) followed
+by the raw image, the serialized Variant and the serialized AltAlleleIndices.
+A message with an all-zero header, followed by a uint64 count of the examples
+sent, ends the stream; a connection that closes without it is an error.
+"""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import os
+import Queue
+import re
+import socket
+import struct
+import threading
+import time
+
+
+
+import numpy as np
+
+from absl import logging
+
+from deepvariant import example_stream
+from deepvariant.core import io_utils
+
+PREFIX = 'unix:'
+
+# How long make_examples waits for call_variants to start listening.
+_CONNECT_TIMEOUT_SECONDS = 600
+_CONNECT_RETRY_SECONDS = 1
+
+_MAGIC = b'DVSTRM01'
+_CONNECTION_HEADER_FORMAT = '<8sII'
+_MESSAGE_HEADER_FORMAT = '<IIIII'
+_END_FORMAT = '<Q'
+_SHARD_PATTERN = re.compile(r'^(.*)-(\d+)-of-(\d+)(\.[^/]+)?$')
+
+
+def is_example_socket(path):
+  """Returns True if path names an example socket rather than a file."""
+  return bool(path) and path.startswith(PREFIX)
+
+
+def _parse_reader_spec(spec):
+  """Returns the (socket path, number of shards) of a reader spec."""
+  path = spec[len(PREFIX):]
+  if io_utils.IsShardedFileSpec(path):
+    basename, num_shards, suffix = io_utils.ParseShardedFileSpec(path)
+    if suffix:
+      basename += '.' + suffix
+    return basename, num_shards
+  return path, 1
+
+
+def _parse_writer_spec(spec):
+  """Returns the (socket path, shard, number of shards) of a writer spec."""
+  path = spec[len(PREFIX):]
+  m = _SHARD_PATTERN.match(path)
+  if m:
+    return m.group(1) + (m.group(4) or ''), int(m.group(2)), int(m.group(3))
+  return path, 0, 1
+
+
+def _recv_exactly(sock, n):
+  """Reads exactly n bytes from sock, or None if it is closed before any."""
+  chunks = []
+  remaining = n
+  while remaining:
+    chunk = sock.recv(min(remaining, 1 << 20))
+    if not chunk:
+      if remaining == n:
+        return None
+      raise IOError('Example socket closed in the middle of a message')
+    chunks.append(chunk)
+    remaining -= len(chunk)
+  return b''.join(chunks)
+
+
+class ExampleSocketWriter(object):
+  """Sends the examples of one make_examples shard to an ExampleSocketReader.
+
+  This has the write(proto) interface of the other make_examples outputs. The
+  connection is made when the writer is entered, retrying until the reader
+  starts listening.
+  """
+
+  def __init__(self, spec, connect_timeout=_CONNECT_TIMEOUT_SECONDS):
+    self.spec = spec
+    self._path, self._shard, self._num_shards = _parse_writer_spec(spec)
+    self._connect_timeout = connect_timeout
+    self._sock = None
+    self._n_written = 0
+
+  def __enter__(self):
+    self._connect()
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback):
+    # Without the end message, the reader reports the stream as truncated,
+    # which is what we want if make_examples failed.
+    if exc_type is None:
+      self.close()
+    elif self._sock is not None:
+      self._sock.close()
+      self._sock = None
+
+  def _connect(self):
+    deadline = time.time() + self._connect_timeout
+    while True:
+      sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+      try:
+        sock.connect(self._path)
+        break
+      except socket.error:
+        sock.close()
+        if time.time() > deadline:
+          raise
+        time.sleep(_CONNECT_RETRY_SECONDS)
+    logging.info('Connected to example socket %s as shard %d of %d',
+                 self._path, self._shard, self._num_shards)
+    sock.sendall(
+        struct.pack(_CONNECTION_HEADER_FORMAT, _MAGIC, self._shard,
+                    self._num_shards))
+    self._sock = sock
+
+  def write(self, example):
+    """Sends example, a tf.Example proto made by make_examples."""
+    if self._sock is None:
+      self._connect()
+    shape, image, variant, alt_allele_indices = (
+        example_stream.calling_example_fields(example))
+    header = struct.pack(_MESSAGE_HEADER_FORMAT, shape[0], shape[1], shape[2],
+                         len(variant), len(alt_allele_indices))
+    self._sock.sendall(b''.join([header, image, variant, alt_allele_indices]))
+    self._n_written += 1
+
+  def close(self):
+    """Tells the reader this shard is done, and closes the connection."""
+    if self._sock is None:
+      self._connect()
+    self._sock.sendall(
+        struct.pack(_MESSAGE_HEADER_FORMAT, 0, 0, 0, 0, 0) +
+        struct.pack(_END_FORMAT, self._n_written))
+    self._sock.close()
+    self._sock = None
+
+
+class _EndOfShard(object):
+  """Queue marker for a shard that sent all of its examples."""
+
+
+class ExampleSocketReader(object):
+  """Receives the examples sent by every shard of make_examples.
+
+  The socket is bound and listening as soon as the reader is created, and a
+  thread per connected shard decodes its messages into a queue of at most
+  queue_size examples. Iterating yields (image, encoded_variant,
+  encoded_alt_allele_indices) tuples, where image is a [height, width,
+  channels] uint8 array, in the order they arrive, until every shard has
+  finished.
+  """
+
+  def __init__(self, spec, queue_size=1024):
+    self.spec = spec
+    self._path, self._num_shards = _parse_reader_spec(spec)
+    self._queue = Queue.Queue(maxsize=queue_size)
+    self._shape = None
+    self._peeked = []
+    self._n_finished = 0
+
+    if os.path.exists(self._path):
+      os.unlink(self._path)
+    self._server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    self._server.bind(self._path)
+    self._server.listen(self._num_shards)
+    logging.info('Listening for %d shards of examples on %s', self._num_shards,
+                 self._path)
+    self._acceptor = threading.Thread(target=self._accept_all)
+    self._acceptor.daemon = True
+    self._acceptor.start()
+
+  def _accept_all(self):
+    try:
+      shards = set()
+      for _ in range(self._num_shards):
+        conn, _ = self._server.accept()
+        magic, shard, num_shards = struct.unpack(
+            _CONNECTION_HEADER_FORMAT,
+            _recv_exactly(conn, struct.calcsize(_CONNECTION_HEADER_FORMAT)))
+        if magic != _MAGIC:
+          raise IOError('Invalid example socket connection')
+        if num_shards != self._num_shards or shard in shards:
+          raise IOError(
+              'Got shard {} of {} on {} but expected {} distinct shards'.format(
+                  shard, num_shards, self._path, self._num_shards))
+        shards.add(shard)
+        receiver = threading.Thread(target=self._receive, args=(conn,))
+        receiver.daemon = True
+        receiver.start()
+    except Exception as e:  # pylint: disable=broad-except
+      self._queue.put(e)
+    finally:
+      self._server.close()
+      os.unlink(self._path)
+
+  def _receive(self, conn):
+    header_size = struct.calcsize(_MESSAGE_HEADER_FORMAT)
+    n_received = 0
+    try:
+      while True:
+        header = _recv_exactly(conn, header_size)
+        if header is None:
+          raise IOError('A shard closed its example socket without finishing')
+        height, width, channels, variant_len, alts_len = struct.unpack(
+            _MESSAGE_HEADER_FORMAT, header)
+        if not (height or width or channels or variant_len or alts_len):
+          (n_sent,) = struct.unpack(
+              _END_FORMAT, _recv_exactly(conn, struct.calcsize(_END_FORMAT)))
+          if n_sent != n_received:
+            raise IOError('Shard sent {} examples but we received {}'.format(
+                n_sent, n_received))
+          self._queue.put(_EndOfShard())
+          return
+        image_len = height * width * channels
+        body = _recv_exactly(conn, image_len + variant_len + alts_len)
+        if body is None:
+          raise IOError('Example socket closed in the middle of a message')
+        variant_end = image_len + variant_len
+        self._queue.put(((height, width, channels), body[:image_len],
+                         body[image_len:variant_end], body[variant_end:]))
+        n_received += 1
+    except Exception as e:  # pylint: disable=broad-except
+      self._queue.put(e)
+    finally:
+      conn.close()
+
+  def _next(self):
+    """Returns the next example off the queue, or None once all are done."""
+    while self._n_finished < self._num_shards:
+      item = self._queue.get()
+      if isinstance(item, Exception):
+        raise item
+      if isinstance(item, _EndOfShard):
+        self._n_finished += 1
+        continue
+      return item
+    return None
+
+  def shape(self):
+    """Returns the image shape, waiting for the first example if needed.
+
+    Returns:
+      A [height, width, channels] list, or None if make_examples finished
+      without sending any examples.
+    """
+    if self._shape is None and not self._peeked:
+      item = self._next()
+      if item is None:
+        return None
+      self._peeked.append(item)
+      self._shape = item[0]
+    return list(self._shape) if self._shape else None
+
+  def __iter__(self):
+    while True:
+      item = self._peeked.pop() if self._peeked else self._next()
+      if item is None:
+        return
+      shape = item[0]
+      if self._shape is None:
+        self._shape = shape
+      elif shape != self._shape:
+        raise ValueError('Got images of shape {} and {} on {}'.format(
+            self._shape, shape, self._path))
+      image = np.frombuffer(item[1], dtype=np.uint8).reshape(shape)
+      yield image, item[2], item[3]
@@ -0,0 +1,146 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Tests for deepvariant.example_socket."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import os
+import tempfile
+import threading
+
+
+
+from absl.testing import absltest
+from absl.testing import parameterized
+import numpy as np
+import numpy.testing as npt
+
+from deepvariant import example_socket
+from deepvariant import tf_utils
+from deepvariant.core import io_utils
+from deepvariant.core.genomics import variants_pb2
+
+_SHAPE = [3, 4, 2]
+
+
+def _make_example(start, image):
+  variant = variants_pb2.Variant(
+      reference_name='20',
+      start=start,
+      end=start + 1,
+      reference_bases='A',
+      alternate_bases=['C'])
+  return tf_utils.make_example(variant, ['C'], image.tobytes(),
+                               list(image.shape), 'raw')
+
+
+def _socket_spec(name):
+  # Unix socket paths are limited to about 100 characters, which the test
+  # tmpdir can exceed, so sockets go in a fresh directory of their own.
+  return 'unix:' + os.path.join(tempfile.mkdtemp(), name)
+
+
+def _send(spec, examples, fail=False):
+  """Sends examples to spec, failing before the end if fail is True."""
+  try:
+    with example_socket.ExampleSocketWriter(spec) as writer:
+      for example in examples:
+        writer.write(example)
+      if fail:
+        raise ValueError('make_examples failed')
+  except ValueError:
+    pass
+
+
+def _start_sending(spec, examples, fail=False):
+  thread = threading.Thread(target=_send, args=(spec, examples, fail))
+  thread.start()
+  return thread
+
+
+class ExampleSocketTest(parameterized.TestCase):
+
+  def setUp(self):
+    rng = np.random.RandomState(7)
+    self.images = [
+        rng.randint(0, 256, size=_SHAPE).astype(np.uint8) for _ in range(10)
+    ]
+    self.examples = [
+        _make_example(i, image) for i, image in enumerate(self.images)
+    ]
+
+  @parameterized.parameters(
+      ('unix:/tmp/dv.sock', False),
+      ('/tmp/dv.sock', True),
+      ('examples.dvex', True),
+  )
+  def test_is_example_socket(self, path, is_file):
+    self.assertEqual(example_socket.is_example_socket(path), not is_file)
+
+  @parameterized.parameters(1, 3)
+  def test_round_trip(self, num_shards):
+    spec = _socket_spec('round_trip.sock@{}'.format(num_shards))
+    reader = example_socket.ExampleSocketReader(spec, queue_size=2)
+    threads = [
+        _start_sending(shard_spec, self.examples[shard::num_shards])
+        for shard, shard_spec in enumerate(
+            io_utils.maybe_generate_sharded_filenames(spec))
+    ]
+    self.assertEqual(reader.shape(), _SHAPE)
+    records = list(reader)
+    for thread in threads:
+      thread.join()
+
+    self.assertLen(records, len(self.examples))
+    by_variant = {variant: image for image, variant, _ in records}
+    for example, image in zip(self.examples, self.images):
+      encoded = tf_utils.example_variant(example).SerializeToString()
+      npt.assert_array_equal(by_variant[encoded], image)
+
+  def test_no_examples(self):
+    spec = _socket_spec('empty.sock')
+    reader = example_socket.ExampleSocketReader(spec)
+    thread = _start_sending(spec, [])
+    self.assertIsNone(reader.shape())
+    self.assertEqual(list(reader), [])
+    thread.join()
+
+  def test_failed_writer_is_an_error(self):
+    spec = _socket_spec('failed.sock')
+    reader = example_socket.ExampleSocketReader(spec)
+    thread = _start_sending(spec, self.examples[:2], fail=True)
+    with self.assertRaisesRegexp(IOError, 'without finishing'):
+      list(reader)
+    thread.join()
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -0,0 +1,292 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""A compact, memory-mappable container for DeepVariant calling examples.
+
+make_examples normally writes its examples as tf.Example protos in (possibly
+gzipped) TFRecord files, and call_variants spends a noticeable part of its
+input pipeline inflating those files and parsing the protos back apart before
+it can hand the image bytes to the model. For calling we only ever need three
+things from each example: the raw uint8 image, the encoded Variant and the
+encoded alt allele indices. This module stores exactly those, with the images
+laid out back to back so a reader can memory-map the file and slice out
+batches of images without any decoding or per-record parsing.
+
+A file has the following layout. All integers are little-endian.
+
+  header (64 bytes): magic 'DVEXMPL1', then uint32 height, width, channels
+    and a reserved uint32, zero-padded to 64 bytes.
+  images: num_records images of height * width * channels uint8 values each,
+    row-major in [height, width, channels] order, with no padding or
+    separators between them.
+  metadata: num_records + 1 uint64 offsets into the payload that follows,
+    relative to its start, then one payload per record made of a uint32
+    length, that many bytes of serialized Variant, and the serialized
+    CallVariantsOutput.AltAlleleIndices in the remaining bytes.
+  footer (24 bytes): uint64 num_records, uint64 byte offset of the metadata
+    section, and the magic again.
+
+Files in this format use the '.dvex' extension, which is also how make_examples
+and call_variants decide to use it; sharded specs like 'examples.dvex@10' work
+as they do for TFRecords. Only the fields used by call_variants are kept, so
+this format can't hold training examples.
+"""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import re
+import struct
+
+
+
+import numpy as np
+import tensorflow as tf
+
+from deepvariant.core import io_utils
+
+EXTENSION = '.dvex'
+
+_MAGIC = b'DVEXMPL1'
+_HEADER_FORMAT = '<8sIIII'
+_HEADER_SIZE = 64
+_FOOTER_FORMAT = '<QQ8s'
+_FOOTER_SIZE = struct.calcsize(_FOOTER_FORMAT)
+_LENGTH_FORMAT = '<I'
+_LENGTH_SIZE = struct.calcsize(_LENGTH_FORMAT)
+_SHARD_SUFFIX = re.compile(r'-[0-9?]+-of-[0-9]+')
+
+
+def is_example_stream(path):
+  """Returns True if path, a filename or sharded spec, names .dvex files.
+
+  Both 'examples.dvex@10' and 'examples@10.dvex' count, as do the sharded
+  filenames and file patterns they expand to.
+  """
+  pattern = io_utils.NormalizeToShardedFilePattern(path)
+  return _SHARD_SUFFIX.sub('', pattern).endswith(EXTENSION)
+
+
+def _feature_bytes(example, name):
+  return example.features.feature[name].bytes_list.value[0]
+
+
+def calling_example_fields(example):
+  """Returns the fields of example that call_variants needs.
+
+  Args:
+    example: A tf.Example made by make_examples, with a raw-format
+      'image/encoded' and with 'variant/encoded' and
+      'alt_allele_indices/encoded' features.
+
+  Returns:
+    A (shape, image, encoded_variant, encoded_alt_allele_indices) tuple, where
+    shape is the (height, width, channels) tuple of the image bytes.
+
+  Raises:
+    ValueError: if the image of example isn't in raw format, or doesn't match
+      its image/shape.
+  """
+  features = example.features.feature
+  image_format = features['image/format'].bytes_list.value
+  if image_format and image_format[0] != b'raw':
+    raise ValueError('Example streams hold raw images but got format {}'
+                     .format(image_format[0]))
+  shape = tuple(features['image/shape'].int64_list.value)
+  if len(shape) != 3:
+    raise ValueError('Invalid image/shape {}'.format(shape))
+  image = _feature_bytes(example, 'image/encoded')
+  if len(image) != shape[0] * shape[1] * shape[2]:
+    raise ValueError('Image of {} bytes does not have shape {}'.format(
+        len(image), shape))
+  return (shape, image, _feature_bytes(example, 'variant/encoded'),
+          _feature_bytes(example, 'alt_allele_indices/encoded'))
+
+
+class ExampleStreamWriter(object):
+  """Writes calling examples to a single file in the example stream format.
+
+  The image shape is taken from the first example written, and every later
+  example must have the same shape. Images go straight to the file as they are
+  written; the variants and alt allele indices are buffered and written out
+  when the writer is closed, so the writer must be closed for the file to be
+  readable.
+  """
+
+  def __init__(self, path):
+    self.path = path
+    self._file = tf.gfile.GFile(path, 'wb')
+    self._shape = None
+    self._payloads = []
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback):
+    self.close()
+
+  def _write_header(self, shape):
+    self._shape = shape
+    header = struct.pack(_HEADER_FORMAT, _MAGIC, shape[0], shape[1], shape[2],
+                         0)
+    self._file.write(header.ljust(_HEADER_SIZE, b'\0'))
+
+  def write(self, example):
+    """Appends example, a tf.Example proto made by make_examples.
+
+    Args:
+      example: A tf.Example with a raw-format 'image/encoded' and with
+        'variant/encoded' and 'alt_allele_indices/encoded' features.
+
+    Raises:
+      ValueError: if the image of example isn't in raw format, or doesn't have
+        the same shape as the earlier examples.
+    """
+    shape, image, variant, alt_allele_indices = calling_example_fields(example)
+    if self._shape is None:
+      self._write_header(shape)
+    elif shape != self._shape:
+      raise ValueError('Example stream {} holds images of shape {} but got {}'
+                       .format(self.path, self._shape, shape))
+    self._file.write(image)
+    self._payloads.append(b''.join(
+        [struct.pack(_LENGTH_FORMAT, len(variant)), variant,
+         alt_allele_indices]))
+
+  def close(self):
+    """Writes the metadata and footer and closes the file."""
+    if self._file is None:
+      return
+    if self._shape is None:
+      self._write_header((0, 0, 0))
+    num_records = len(self._payloads)
+    metadata_offset = _HEADER_SIZE + num_records * int(np.prod(self._shape))
+    offsets = np.zeros(num_records + 1, dtype='<u8')
+    offsets[1:] = np.cumsum([len(p) for p in self._payloads])
+    self._file.write(offsets.tobytes())
+    self._file.write(b''.join(self._payloads))
+    self._file.write(
+        struct.pack(_FOOTER_FORMAT, num_records, metadata_offset, _MAGIC))
+    self._file.close()
+    self._file = None
+    self._payloads = []
+
+
+class ExampleStreamReader(object):
+  """Reads back a file written by ExampleStreamWriter.
+
+  Local files are memory-mapped, so images are paged in only as they are used;
+  other filesystems are read into memory in one go. The images property is a
+  [num_records, height, width, channels] uint8 array viewing the file contents
+  directly, so slicing it to make a batch doesn't copy anything.
+  """
+
+  def __init__(self, path):
+    self.path = path
+    if '://' not in path:
+      self._data = np.memmap(path, dtype=np.uint8, mode='r')
+    else:
+      with tf.gfile.GFile(path, 'rb') as f:
+        self._data = np.frombuffer(f.read(), dtype=np.uint8)
+    if len(self._data) < _HEADER_SIZE + _FOOTER_SIZE:
+      raise ValueError('{} is too short to be an example stream'.format(path))
+
+    magic, height, width, channels, _ = struct.unpack_from(
+        _HEADER_FORMAT, self._data, 0)
+    num_records, metadata_offset, footer_magic = struct.unpack_from(
+        _FOOTER_FORMAT, self._data, len(self._data) - _FOOTER_SIZE)
+    if magic != _MAGIC or footer_magic != _MAGIC:
+      raise ValueError('{} is not an example stream'.format(path))
+    self.shape = (height, width, channels)
+    self.num_records = num_records
+
+    image_bytes = num_records * height * width * channels
+    if _HEADER_SIZE + image_bytes != metadata_offset:
+      raise ValueError('Corrupted example stream {}'.format(path))
+    self.images = self._data[_HEADER_SIZE:metadata_offset].reshape(
+        (num_records,) + self.shape)
+    offsets_end = metadata_offset + 8 * (num_records + 1)
+    self._offsets = self._data[metadata_offset:offsets_end].view('<u8')
+    self._payload_start = offsets_end
+
+  def __len__(self):
+    return self.num_records
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, exc_type, exc_value, traceback):
+    self.close()
+
+  def close(self):
+    self.images = None
+    self._data = None
+
+  def _payload(self, i):
+    start = self._payload_start + int(self._offsets[i])
+    end = self._payload_start + int(self._offsets[i + 1])
+    return self._data[start:end].tobytes()
+
+  def encoded_variant_and_alt_allele_indices(self, i):
+    """Returns the serialized Variant and AltAlleleIndices of record i."""
+    payload = self._payload(i)
+    (length,) = struct.unpack_from(_LENGTH_FORMAT, payload, 0)
+    end = _LENGTH_SIZE + length
+    return payload[_LENGTH_SIZE:end], payload[end:]
+
+  def __iter__(self):
+    """Yields (image, encoded_variant, encoded_alt_allele_indices) tuples."""
+    for i in range(self.num_records):
+      variant, alt_allele_indices = (
+          self.encoded_variant_and_alt_allele_indices(i))
+      yield self.images[i], variant, alt_allele_indices
+
+
+def read_shape(path):
+  """Returns the image shape of the first non-empty example stream in path.
+
+  Args:
+    path: A filename, sharded spec or sharded file pattern of .dvex files.
+
+  Returns:
+    A [height, width, channels] list, or None if all of the files are empty.
+  """
+  for filename in tf.gfile.Glob(io_utils.NormalizeToShardedFilePattern(path)):
+    with ExampleStreamReader(filename) as reader:
+      if len(reader):
+        return list(reader.shape)
+  return None
+
+
+def iterate(path):
+  """Yields (image, variant, alt_allele_indices) from every file in path."""
+  for filename in tf.gfile.Glob(io_utils.NormalizeToShardedFilePattern(path)):
+    with ExampleStreamReader(filename) as reader:
+      for record in reader:
+        yield record
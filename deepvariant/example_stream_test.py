@@ -0,0 +1,152 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Tests for deepvariant.example_stream."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+
+
+from absl.testing import absltest
+from absl.testing import parameterized
+import numpy as np
+import numpy.testing as npt
+
+from deepvariant import example_stream
+from deepvariant import test_utils
+from deepvariant import tf_utils
+from deepvariant.core.genomics import variants_pb2
+from deepvariant.protos import deepvariant_pb2
+
+_SHAPE = [3, 4, 2]
+
+
+def _make_example(start, alts, image):
+  variant = variants_pb2.Variant(
+      reference_name='20',
+      start=start,
+      end=start + 1,
+      reference_bases='A',
+      alternate_bases=alts)
+  return tf_utils.make_example(variant, alts, image.tobytes(),
+                               list(image.shape), 'raw')
+
+
+def _random_image(rng, shape=None):
+  return rng.randint(0, 256, size=shape or _SHAPE).astype(np.uint8)
+
+
+class ExampleStreamTest(parameterized.TestCase):
+
+  @parameterized.parameters(0, 1, 5)
+  def test_round_trip(self, n_examples):
+    rng = np.random.RandomState(42)
+    images = [_random_image(rng) for _ in range(n_examples)]
+    examples = [
+        _make_example(10 * i, ['C', 'G'][:i % 2 + 1], image)
+        for i, image in enumerate(images)
+    ]
+    path = test_utils.test_tmpfile('round_trip_{}.dvex'.format(n_examples))
+    with example_stream.ExampleStreamWriter(path) as writer:
+      for example in examples:
+        writer.write(example)
+
+    with example_stream.ExampleStreamReader(path) as reader:
+      self.assertLen(reader, n_examples)
+      self.assertEqual(reader.images.shape[0], n_examples)
+      records = list(reader)
+    self.assertLen(records, n_examples)
+    for example, image, (actual, variant, alt_allele_indices) in zip(
+        examples, images, records):
+      npt.assert_array_equal(actual, image)
+      self.assertEqual(variant, tf_utils.example_variant(example)
+                       .SerializeToString())
+      self.assertEqual(
+          deepvariant_pb2.CallVariantsOutput.AltAlleleIndices.FromString(
+              alt_allele_indices).indices,
+          list(tf_utils.example_alt_alleles_indices(example)))
+
+    self.assertEqual(
+        example_stream.read_shape(path), _SHAPE if n_examples else None)
+
+  def test_sharded_paths(self):
+    rng = np.random.RandomState(1)
+    spec = test_utils.test_tmpfile('sharded@2.dvex')
+    self.assertTrue(example_stream.is_example_stream(spec))
+    filenames = ['sharded-0000{}-of-00002.dvex'.format(i) for i in range(2)]
+    expected = []
+    for i, filename in enumerate(filenames):
+      with example_stream.ExampleStreamWriter(
+          test_utils.test_tmpfile(filename)) as writer:
+        image = _random_image(rng)
+        writer.write(_make_example(i, ['C'], image))
+        expected.append(image)
+    images = [image for image, _, _ in example_stream.iterate(spec)]
+    self.assertLen(images, 2)
+    for actual, image in zip(images, expected):
+      npt.assert_array_equal(actual, image)
+    self.assertEqual(example_stream.read_shape(spec), _SHAPE)
+
+  @parameterized.parameters(
+      ('examples.dvex', True),
+      ('examples.dvex@10', True),
+      ('examples@10.dvex', True),
+      ('examples-?????-of-00010.dvex', True),
+      ('examples.dvex-00003-of-00010', True),
+      ('examples.tfrecord', False),
+      ('examples.tfrecord.gz@10', False),
+  )
+  def test_is_example_stream(self, path, expected):
+    self.assertEqual(example_stream.is_example_stream(path), expected)
+
+  def test_rejects_mismatched_shapes(self):
+    rng = np.random.RandomState(2)
+    path = test_utils.test_tmpfile('mismatched.dvex')
+    with example_stream.ExampleStreamWriter(path) as writer:
+      writer.write(_make_example(1, ['C'], _random_image(rng)))
+      with self.assertRaisesRegexp(ValueError, 'holds images of shape'):
+        writer.write(_make_example(2, ['C'], _random_image(rng, [3, 5, 2])))
+
+  def test_rejects_non_raw_images(self):
+    example = _make_example(1, ['C'], _random_image(np.random.RandomState(3)))
+    example.features.feature['image/format'].bytes_list.value[0] = b'png'
+    path = test_utils.test_tmpfile('png.dvex')
+    with example_stream.ExampleStreamWriter(path) as writer:
+      with self.assertRaisesRegexp(ValueError, 'raw images'):
+        writer.write(example)
+
+  def test_rejects_other_files(self):
+    path = test_utils.test_tmpfile('not_a_stream.dvex', 'x' * 200)
+    with self.assertRaisesRegexp(ValueError, 'not an example stream'):
+      example_stream.ExampleStreamReader(path)
+
+
+if __name__ == '__main__':
+  absltest.main()
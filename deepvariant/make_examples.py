@@ -32,6 +32,13 @@ from __future__ import absolute_import
 from __future__ import division
 from __future__ import print_function
 
+import bisect
+import heapq
+import itertools
+from multiprocessing import pool
+import os
+import threading
+
 
 
 import numpy as np
@@ -39,6 +46,8 @@ import tensorflow as tf
 
 from absl import logging
 
+from deepvariant import example_socket
+from deepvariant import example_stream
 from deepvariant import logging_level
 from deepvariant import pileup_image
 from deepvariant import tf_utils
@@ -54,8 +63,12 @@ from deepvariant.core import utils
 from deepvariant.core import variantutils
 from deepvariant.core.protos import core_pb2
 from deepvariant.core.python import hts_verbose
+from deepvariant.core.python import region_reads as region_reads_lib
+from deepvariant.core.python import region_reference
+from deepvariant.core.python import stage_timer
 from deepvariant.protos import deepvariant_pb2
 from deepvariant.python import allelecounter
+from deepvariant.python import pileup_examples_native
 from deepvariant.realigner import realigner
 from deepvariant.vendor import timer
 
@@ -71,12 +84,41 @@ NO_RANDOM_REF = 0.0
 # The name used for a sample if one is not specified or present in the reads.
 _UNKNOWN_SAMPLE = 'UNKNOWN'
 
+# The number of reference bases cached on either side of each region. The
+# realigner aligns reads extending past the region, and the pileup images of
+# candidates near its edges span bases outside of it, so we pad by more than a
+# read length plus half of an image. Lookups beyond the padding still work, but
+# go back to the reference file.
+_REGION_REFERENCE_PADDING = 1000
+
 # Use a default hts_block_size value of 128 MB (see b/69330994 for details) to
 # improve SAM/BAM reading throughput, particularly on remote filesystems. Do not
 # modify this default parameter without a systematic evaluation of the impact
 # across a variety of distributed filesystems!
 _DEFAULT_HTS_BLOCK_SIZE = 128 * (1024 * 1024)
 
+# A region costs about as much as this many bytes of reads to process even if
+# it has no reads, for its reference bases and bookkeeping.
+_REGION_BASE_COST_BYTES = 4096
+
+# The smallest piece, in basepairs, that a hot region is split into.
+_MIN_HOT_REGION_PIECE_SIZE = 100
+
+# The outputs whose records are counted in the checkpoint of a resumable task,
+# by their io_utils.OutputsWriter names, in the order of their counts.
+_CHECKPOINTED_OUTPUTS = ('candidates', 'examples', 'gvcfs', 'runtime_metrics')
+
+# Appended to the examples path of a resumable task to give its checkpoint,
+# and to the path of an output to give where it is moved on a restart.
+_CHECKPOINT_SUFFIX = '.checkpoint'
+_RESUME_SUFFIX = '.resume'
+
+# In a multi-sample run, replaced in the paths of our outputs by the index of
+# each sample in --reads.
+_SAMPLE_PLACEHOLDER = '{sample}'
+_SAMPLE_OUTPUTS = ('examples_filename', 'candidates_filename', 'gvcf_filename',
+                   'runtime_metrics_filename')
+
 tf.flags.DEFINE_string(
     'ref', None,
     'Required. Genome reference to use. Must have an associated FAI index as '
@@ -84,11 +126,18 @@ tf.flags.DEFINE_string(
     'used to align the BAM file provided to --reads.')
 tf.flags.DEFINE_string(
     'reads', None,
-    'Required. Aligned, sorted, indexed BAM file containing the reads we want '
-    'to call. Should be aligned to a reference genome compatible with --ref.')
+    'Required. Aligned, sorted, indexed BAM or CRAM file containing the reads '
+    'we want to call. Should be aligned to a reference genome compatible with '
+    '--ref. A CRAM file is decoded against --ref. A comma-separated list of '
+    'files, one per sample, processes the regions once for all of them in '
+    'calling mode, and each of our outputs must then contain {sample}, which '
+    'is replaced by the index of the sample in this list.')
 tf.flags.DEFINE_string(
     'examples', None,
-    'Required. Path to write tf.Example protos in TFRecord format.')
+    'Required. Path to write tf.Example protos in TFRecord format. In calling '
+    'mode, a path ending in .dvex writes the compact example stream format '
+    'read by call_variants instead, and unix:<socket path>[@<shards>] sends '
+    'the examples straight to a call_variants run with the same value.')
 tf.flags.DEFINE_string(
     'candidates', '',
     'Candidate DeepVariantCalls in tfrecord format. For DEBUGGING.')
@@ -102,6 +151,21 @@ tf.flags.DEFINE_string(
     'gvcf', '',
     'Optional. Path where we should write gVCF records in TFRecord of Variant '
     'proto format.')
+tf.flags.DEFINE_string(
+    'runtime_metrics', '',
+    'Optional. Path where we should write a RuntimeMetrics proto per region, '
+    'in TFRecord format, with the wall time of the region and of each stage of '
+    'its processing, to find slow regions.')
+tf.flags.DEFINE_integer(
+    'num_slowest_regions', 10,
+    'The number of slowest regions to log at the end, with their read, '
+    'candidate, assembly and alignment counts, to guide the tuning of the '
+    'realigner and of the region and shard sizes.')
+tf.flags.DEFINE_bool(
+    'track_stage_memory', False,
+    'If True, account the memory held by the allele counter, reads, De Bruijn '
+    'graphs and pileup images, add the peak of each stage in each region to '
+    'the --runtime_metrics and log the largest peaks at the end.')
 tf.flags.DEFINE_string(
     'confident_regions', '',
     'Regions that we are confident are hom-ref or a variant in BED format. In '
@@ -112,6 +176,60 @@ tf.flags.DEFINE_string(
     'Tabix-indexed VCF file containing the truth variant calls for this labels '
     'which we use to label our examples.')
 tf.flags.DEFINE_integer('task', 0, 'Task ID of this task')
+tf.flags.DEFINE_string(
+    'startup_metadata', '',
+    'Optional. Path to the startup metadata of this run: the sample name and '
+    'contigs of our inputs. If set, tasks read them from this file instead of '
+    'from the headers of the reference, reads and truth variants.')
+tf.flags.DEFINE_bool(
+    'build_startup_metadata', False,
+    'If True, build the --startup_metadata of our inputs once and exit, '
+    'without making any examples. Run this before the tasks that read it.')
+tf.flags.DEFINE_integer(
+    'n_cores', 1,
+    'The number of threads used to process regions in parallel within this '
+    'task. Outputs are written in the same order as with a single thread.')
+tf.flags.DEFINE_integer(
+    'prefetch_regions', 2,
+    'When processing regions with a single thread, the reads of up to this '
+    'many upcoming regions are decoded on a background thread while the '
+    'current region is processed. If 0, no reads are prefetched.')
+tf.flags.DEFINE_string(
+    'read_block_cache_dir', '',
+    'Optional. A local directory where the BGZF blocks of the --reads of the '
+    'regions of this task are fetched ahead of time, in a few large parallel '
+    'requests, which makes reading a BAM file on GCS much faster. The reads '
+    'are then decoded without background threads.')
+tf.flags.DEFINE_integer(
+    'read_block_prefetch_threads', 8,
+    'The number of requests for the blocks of our reads fetched at once into '
+    'the --read_block_cache_dir.')
+tf.flags.DEFINE_bool(
+    'shard_regions_by_cost', False,
+    'If True, the regions are divided among the --task shards by their '
+    'estimated cost, so that each task has about the same amount of work, '
+    'instead of round robin. Every task must use the same settings.')
+tf.flags.DEFINE_string(
+    'region_costs', '',
+    'Optional. The --runtime_metrics of a previous run over the same reads, '
+    'whose per-region wall times are used as the costs for '
+    '--shard_regions_by_cost. If empty, costs are estimated from the index of '
+    'the --reads.')
+tf.flags.DEFINE_float(
+    'hot_region_cost_factor', 8.0,
+    'With --shard_regions_by_cost, regions costing more than this many times '
+    'the mean region are split into smaller pieces. If <= 0, none are split.')
+tf.flags.DEFINE_bool(
+    'resumable', False,
+    'If True, each region whose outputs have been written is recorded in a '
+    'checkpoint alongside the --examples, and a restarted task copies the '
+    'outputs of its completed regions instead of making them again. The '
+    'examples must be written to a file.')
+tf.flags.DEFINE_integer(
+    'pileup_image_threads', 0,
+    'If > 0, the pileup images of all candidates in a region are encoded in '
+    'parallel by native code on this many threads. Candidates with more reads '
+    'than fit in an image are downsampled differently than when this is 0.')
 tf.flags.DEFINE_integer(
     'partition_size', 1000,
     'The maximum number of basepairs we will allow in a region before splitting'
@@ -143,6 +261,15 @@ tf.flags.DEFINE_integer(
     'Sets the htslib block size. Zero or negative uses default htslib setting; '
     'larger values (e.g. 1M) may be beneficial for using remote files. '
     'Currently only applies to SAM/BAM reading.')
+tf.flags.DEFINE_integer(
+    'hts_decompression_threads', 0,
+    'If > 0, BGZF blocks of the reads and truth variants are decompressed on a '
+    'pool of this many threads, shared by all of our readers.')
+tf.flags.DEFINE_integer(
+    'max_read_depth', 0,
+    'If > 0, at most this many reads overlapping any position are read from '
+    '--reads. Reads beyond this depth are dropped at random by the reader, '
+    'before they are parsed, which bounds the cost of very deep regions.')
 tf.flags.DEFINE_integer('vsc_min_count_snps', 2,
                         'SNP alleles occurring at least this many times in our '
                         'AlleleCount will be advanced as candidates.')
@@ -201,10 +328,16 @@ def default_options(add_flags=True, flags=None):
   allele_counter_options = deepvariant_pb2.AlleleCounterOptions(
       partition_size=flags.partition_size, read_requirements=read_reqs)
 
+  startup_metadata = None
+  if flags.startup_metadata and not flags.build_startup_metadata:
+    startup_metadata = read_startup_metadata(flags.startup_metadata)
+
   if flags.sample_name:
     sample_name = flags.sample_name
+  elif startup_metadata:
+    sample_name = startup_metadata.sample_name
   elif flags.reads:
-    sample_name = extract_sample_name_from_reads(flags.reads)
+    sample_name = extract_sample_name_from_reads(flags.reads.split(',')[0])
   else:
     sample_name = _UNKNOWN_SAMPLE
 
@@ -300,6 +433,8 @@ def default_options(add_flags=True, flags=None):
       variant_caller_options=variant_caller_options,
       pic_options=pic_options,
       n_cores=1,
+      prefetch_regions=0,
+      pileup_image_threads=0,
       task_id=0,
       num_shards=0,
       min_shared_contigs_basepairs=0.9,
@@ -316,7 +451,10 @@ def default_options(add_flags=True, flags=None):
     if flags.ref:
       options.reference_filename = flags.ref
     if flags.reads:
-      options.reads_filename = flags.reads
+      reads_filenames = flags.reads.split(',')
+      options.reads_filename = reads_filenames[0]
+      if len(reads_filenames) > 1:
+        options.sample_reads_filenames.extend(reads_filenames)
     if flags.confident_regions:
       options.confident_regions_filename = flags.confident_regions
     if flags.truth_variants:
@@ -339,12 +477,14 @@ def default_options(add_flags=True, flags=None):
     if flags.pileup_image_width:
       options.pic_options.width = flags.pileup_image_width
 
-    num_shards, examples, candidates, gvcf = io_utils.resolve_filespecs(
-        flags.task, flags.examples or '', flags.candidates or '', flags.gvcf or
-        '')
+    (num_shards, examples, candidates, gvcf,
+     runtime_metrics) = io_utils.resolve_filespecs(
+         flags.task, flags.examples or '', flags.candidates or '', flags.gvcf or
+         '', flags.runtime_metrics or '')
     options.examples_filename = examples
     options.candidates_filename = candidates
     options.gvcf_filename = gvcf
+    options.runtime_metrics_filename = runtime_metrics
 
     # redacted
     regions_flag = flags.regions
@@ -353,6 +493,18 @@ def default_options(add_flags=True, flags=None):
     options.calling_regions.extend(regions_flag)
 
     options.task_id = flags.task
+    options.startup_metadata_filename = flags.startup_metadata
+    options.read_block_cache_dir = flags.read_block_cache_dir
+    options.read_block_prefetch_threads = flags.read_block_prefetch_threads
+    options.shard_regions_by_cost = flags.shard_regions_by_cost
+    options.region_costs_filename = flags.region_costs
+    options.hot_region_cost_factor = flags.hot_region_cost_factor
+    options.resumable = flags.resumable
+    options.n_cores = flags.n_cores
+    options.prefetch_regions = flags.prefetch_regions
+    options.pileup_image_threads = flags.pileup_image_threads
+    options.num_slowest_regions = flags.num_slowest_regions
+    options.track_stage_memory = flags.track_stage_memory
     options.num_shards = 0 if num_shards is None else num_shards
 
     if flags.realign_reads:
@@ -400,7 +552,7 @@ def extract_sample_name_from_reads(reads_path):
   Raises:
     ValueError: There is not exactly one unique sample name in the SAM/BAM.
   """
-  with genomics_io.make_sam_reader(reads_path) as sam_reader:
+  with genomics_io.make_sam_reader(reads_path, use_index=False) as sam_reader:
     samples = sam_reader.samples
   if len(samples) != 1:
     raise ValueError('Expected a single sample, found {}'.format(samples))
@@ -410,6 +562,53 @@ def extract_sample_name_from_reads(reads_path):
   return sample
 
 
+def sample_options(options):
+  """Returns the options of each sample of a multi-sample run.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto with sample_reads_filenames.
+
+  Returns:
+    A list with a deepvariant.DeepVariantOptions proto per sample, in the order
+    of options.sample_reads_filenames. Each is a copy of options for a
+    single-sample run over the reads of that sample, whose sample name is read
+    from them and whose outputs have _SAMPLE_PLACEHOLDER replaced by the index
+    of the sample.
+  """
+  samples = []
+  for index, reads_filename in enumerate(options.sample_reads_filenames):
+    sample = deepvariant_pb2.DeepVariantOptions()
+    sample.CopyFrom(options)
+    del sample.sample_reads_filenames[:]
+    sample.reads_filename = reads_filename
+    sample.variant_caller_options.sample_name = extract_sample_name_from_reads(
+        reads_filename)
+    for field in _SAMPLE_OUTPUTS:
+      setattr(sample, field,
+              getattr(options, field).replace(_SAMPLE_PLACEHOLDER, str(index)))
+    samples.append(sample)
+  return samples
+
+
+def read_fields_to_parse(options):
+  """Returns the OptionalReadFieldsToParse of the reads we need for options.
+
+  Making examples only looks at the name, bases, qualities and alignment of
+  each read, so we skip parsing its fragment length and mate position, unless
+  the realigner writes out the reads themselves.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto.
+
+  Returns:
+    A learning.genomics.core.OptionalReadFieldsToParse proto.
+  """
+  if options.realigner_options.diagnostics.emit_realigned_reads:
+    return core_pb2.OptionalReadFieldsToParse()
+  return core_pb2.OptionalReadFieldsToParse(
+      exclude_fragment_length=True, exclude_next_mate_position=True)
+
+
 # ---------------------------------------------------------------------------
 # Region processing
 # ---------------------------------------------------------------------------
@@ -562,6 +761,141 @@ def regions_to_process(contigs,
     return partitioned
 
 
+def region_costs_from_runtime_metrics(metrics, regions):
+  """Gets the cost of each of regions from the metrics of a previous run.
+
+  The cost of a region is the wall time of the regions of metrics overlapping
+  it, each in proportion to how much of it overlaps. The earlier run may have
+  used different regions, but they must not overlap one another. Regions that
+  no metric overlaps cost the median cost of the others.
+
+  Args:
+    metrics: An iterable of core_pb2.RuntimeMetrics protos with a region and
+      wall_time_seconds, such as those of make_examples --runtime_metrics.
+    regions: A list of learning.genomics.v1.Range protos.
+
+  Returns:
+    A list with the float cost of each of regions, in order.
+  """
+  by_contig = {}
+  for m in metrics:
+    if m.region:
+      r = ranges.parse_literal(m.region)
+      by_contig.setdefault(r.reference_name, []).append(
+          (r.start, r.end, m.wall_time_seconds))
+  ends = {}
+  for name, spans in by_contig.items():
+    spans.sort()
+    ends[name] = [end for _, end, _ in spans]
+
+  costs = []
+  for region in regions:
+    spans = by_contig.get(region.reference_name, [])
+    cost = None
+    i = bisect.bisect_right(ends.get(region.reference_name, []), region.start)
+    while i < len(spans) and spans[i][0] < region.end:
+      start, end, seconds = spans[i]
+      overlap = min(end, region.end) - max(start, region.start)
+      cost = (cost or 0.0) + seconds * overlap / max(1, end - start)
+      i += 1
+    costs.append(cost)
+
+  known = sorted(cost for cost in costs if cost is not None)
+  default = known[len(known) // 2] if known else 1.0
+  return [default if cost is None else cost for cost in costs]
+
+
+def estimate_region_costs(options, regions):
+  """Estimates the cost of processing each of regions.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto. If region_costs_filename is
+      set, the costs are the wall times of that earlier run, otherwise they are
+      the bytes of the reads of each region by the index of reads_filename.
+    regions: A list of learning.genomics.v1.Range protos.
+
+  Returns:
+    A list with the cost of each of regions, in order, in arbitrary units.
+  """
+  if options.region_costs_filename:
+    return region_costs_from_runtime_metrics(
+        io_utils.read_tfrecords(
+            options.region_costs_filename, proto=core_pb2.RuntimeMetrics),
+        regions)
+  read_bytes = genomics_io.estimate_region_read_bytes(options.reads_filename,
+                                                      regions)
+  return [_REGION_BASE_COST_BYTES + b for b in read_bytes]
+
+
+def shard_regions_by_cost(regions,
+                          costs,
+                          task_id,
+                          num_shards,
+                          hot_region_cost_factor=0.0):
+  """Gets the regions of a task among num_shards tasks with balanced costs.
+
+  Regions costing more than hot_region_cost_factor times the mean are first
+  split into pieces of at most that cost each, assuming the cost of a region
+  is spread evenly across it, but no smaller than _MIN_HOT_REGION_PIECE_SIZE.
+  The regions are then cut, in order, into num_shards contiguous runs of about
+  equal total cost, each region going to the run holding the midpoint of its
+  cost. Like regions_to_process, every region is in exactly one task's regions
+  when this is called with task_ids 0 ... num_shards - 1, and each task's
+  regions stay in genomic order.
+
+  Args:
+    regions: A list of learning.genomics.v1.Range protos in genomic order, as
+      returned by regions_to_process without sharding.
+    costs: A list with the non-negative cost of each of regions.
+    task_id: int >= 0 and < num_shards. The task to get the regions of.
+    num_shards: int > 0. The number of tasks.
+    hot_region_cost_factor: float. If > 0, how many times the mean cost a
+      region may cost before it is split.
+
+  Returns:
+    A list of the learning.genomics.v1.Range protos of task_id.
+
+  Raises:
+    ValueError: if costs doesn't match regions, or task_id is out of range.
+  """
+  if len(regions) != len(costs):
+    raise ValueError('Got {} costs for {} regions'.format(
+        len(costs), len(regions)))
+  if task_id < 0 or task_id >= num_shards:
+    raise ValueError('task_id={} should be >= 0 and < num_shards={}'.format(
+        task_id, num_shards))
+  if not regions:
+    return []
+
+  total = float(sum(costs))
+  if hot_region_cost_factor > 0 and total > 0:
+    max_cost = hot_region_cost_factor * total / len(regions)
+    split_regions, split_costs = [], []
+    for region, cost in zip(regions, costs):
+      length = region.end - region.start
+      n_pieces = max(1, min(int(np.ceil(cost / max_cost)),
+                            length // _MIN_HOT_REGION_PIECE_SIZE))
+      for k in range(n_pieces):
+        split_regions.append(
+            ranges.make_range(region.reference_name,
+                              region.start + length * k // n_pieces,
+                              region.start + length * (k + 1) // n_pieces))
+        split_costs.append(cost / n_pieces)
+    regions, costs = split_regions, split_costs
+
+  task_regions = []
+  cumulative = 0.0
+  for i, (region, cost) in enumerate(zip(regions, costs)):
+    if total > 0:
+      shard = int((cumulative + cost / 2.0) * num_shards / total)
+    else:
+      shard = i * num_shards // len(regions)
+    cumulative += cost
+    if min(shard, num_shards - 1) == task_id:
+      task_regions.append(region)
+  return task_regions
+
+
 # ---------------------------------------------------------------------------
 # Variant labeler
 # ---------------------------------------------------------------------------
@@ -628,6 +962,326 @@ def read_confident_regions(options):
   return ranges.RangeSet.from_bed(options.confident_regions_filename)
 
 
+def make_variant_labeler(options, regions):
+  """Creates a NativeVariantLabeler for the candidates in regions.
+
+  The truth variants overlapping regions and the confident regions are loaded
+  into native in-memory indices once, so labeling a candidate doesn't seek in
+  and parse the truth VCF again, and the candidates of a region are matched to
+  them in one native call. The labeler only reads these indices, so it can be
+  shared by all of the RegionProcessors of a task.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto.
+    regions: list of learning.genomics.v1.Range protos. Only the truth variants
+      overlapping these are loaded, which bounds the memory we need by the size
+      of the task rather than that of the truth VCF.
+
+  Returns:
+    A variant_labeler.NativeVariantLabeler.
+  """
+  return variant_labeler.NativeVariantLabeler(
+      genomics_io.make_variant_index(
+          options.truth_variants_filename,
+          regions,
+          num_decompression_threads=FLAGS.hts_decompression_threads,
+          genotypes_only=True),
+      genomics_io.make_range_index(options.confident_regions_filename))
+
+
+def region_runtime_metrics(region, wall_time_seconds, costs=None):
+  """Returns the RuntimeMetrics of region, just processed on this thread.
+
+  The stage times are those the native code measured on this thread since the
+  last call to stage_timer.take_thread_stage_times(). Reads decoded ahead of
+  time on the prefetching thread aren't counted in the READ_DECODE stage. If
+  stage memory is tracked, the peaks of each stage since the last call to
+  stage_timer.take_stage_memory() are added too; these are process-wide, so
+  with several regions processed at once they cover all of them.
+
+  Args:
+    region: A learning.genomics.v1.Range proto. The region processed.
+    wall_time_seconds: float. The wall time of processing region.
+    costs: Optional core_pb2.RegionCosts proto of the work done in region.
+
+  Returns:
+    A learning.genomics.core.RuntimeMetrics proto.
+  """
+  metrics = core_pb2.RuntimeMetrics(
+      region=ranges.to_literal(region),
+      wall_time_seconds=wall_time_seconds,
+      region_costs=costs)
+  metrics.stage_times.extend(stage_timer.take_thread_stage_times())
+  if stage_timer.stage_memory_tracking_enabled():
+    metrics.stage_memory.extend(stage_timer.take_stage_memory())
+  return metrics
+
+
+class SlowestRegions(object):
+  """Keeps the RuntimeMetrics of the n slowest regions added to it."""
+
+  def __init__(self, n):
+    self.n = n
+    # A min-heap of (wall time, order added, metrics), so the fastest of the
+    # kept regions is the first to be replaced.
+    self._heap = []
+    self._n_added = 0
+
+  def add(self, metrics):
+    if self.n <= 0:
+      return
+    entry = (metrics.wall_time_seconds, self._n_added, metrics)
+    self._n_added += 1
+    if len(self._heap) < self.n:
+      heapq.heappush(self._heap, entry)
+    elif entry[0] > self._heap[0][0]:
+      heapq.heapreplace(self._heap, entry)
+
+  def slowest(self):
+    """Returns the kept RuntimeMetrics, slowest first."""
+    return [
+        metrics for _, _, metrics in sorted(
+            self._heap, key=lambda entry: entry[0], reverse=True)
+    ]
+
+  def log(self):
+    """Logs the slowest regions, with the time of each stage and its costs."""
+    slowest = self.slowest()
+    if not slowest:
+      return
+    logging.info('The %d slowest regions:', len(slowest))
+    for metrics in slowest:
+      costs = metrics.region_costs
+      stages = ', '.join(
+          '{}={:.2f}s'.format(
+              core_pb2.RuntimeStage.Name(time.stage).lower(),
+              time.wall_time_seconds) for time in metrics.stage_times)
+      logging.info(
+          '  %s: %.2fs [%s]: %d reads, %d candidates, %d examples, '
+          '%d/%d windows assembled, %d vertices, %d edges, max k %d, '
+          '%d haplotypes, %d reads aligned', metrics.region,
+          metrics.wall_time_seconds, stages, costs.num_reads,
+          costs.num_candidates, costs.num_examples,
+          costs.num_assembled_windows, costs.num_realigner_windows,
+          costs.num_graph_vertices, costs.num_graph_edges,
+          costs.max_kmer_size, costs.num_candidate_haplotypes,
+          costs.num_aligned_reads)
+
+
+class PeakStageMemory(object):
+  """Keeps the largest peak memory of each stage, and the region reaching it."""
+
+  def __init__(self):
+    # The (peak bytes, region) of each stage.
+    self._peaks = {}
+
+  def add(self, metrics):
+    for memory in metrics.stage_memory:
+      if memory.peak_bytes > self._peaks.get(memory.stage, (-1, None))[0]:
+        self._peaks[memory.stage] = (memory.peak_bytes, metrics.region)
+
+  def peaks(self):
+    """Returns a dict from each stage to its (peak bytes, region)."""
+    return dict(self._peaks)
+
+  def log(self):
+    """Logs the peak memory of each stage, in order of RuntimeStage."""
+    if not self._peaks:
+      return
+    logging.info('The peak memory of each stage:')
+    for stage in sorted(self._peaks):
+      peak_bytes, region = self._peaks[stage]
+      logging.info('  %s: %.1f MiB in %s',
+                   core_pb2.RuntimeStage.Name(stage).lower(),
+                   peak_bytes / (1024.0 * 1024.0), region)
+
+
+def checkpointed_output_paths(options):
+  """Returns a dict from the name of each output enabled in options to its path.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto.
+
+  Returns:
+    A dict from the names in _CHECKPOINTED_OUTPUTS, as used by
+    io_utils.OutputsWriter, to their paths, for the outputs that are written.
+  """
+  paths = {
+      'candidates': options.candidates_filename,
+      'examples': options.examples_filename,
+      'gvcfs': options.gvcf_filename,
+      'runtime_metrics': options.runtime_metrics_filename,
+  }
+  return {name: path for name, path in paths.iteritems() if path}
+
+
+def read_checkpoint(path):
+  """Reads the completed regions recorded in the checkpoint at path.
+
+  Args:
+    path: str. The path of a checkpoint written by RegionCheckpoint. It need
+      not exist.
+
+  Returns:
+    A list of the (region literal, counts) of each completed region, in order,
+    where counts is a tuple of the total number of records written to each of
+    _CHECKPOINTED_OUTPUTS up to and including the region. A line cut short by
+    the task being killed ends the list.
+  """
+  if not tf.gfile.Exists(path):
+    return []
+  entries = []
+  with tf.gfile.GFile(path) as f:
+    for line in f:
+      fields = line.rstrip('\n').split('\t')
+      if (not line.endswith('\n') or
+          len(fields) != 1 + len(_CHECKPOINTED_OUTPUTS)):
+        break
+      try:
+        counts = tuple(int(field) for field in fields[1:])
+      except ValueError:
+        break
+      entries.append((fields[0], counts))
+  return entries
+
+
+def count_intact_records(path, max_records):
+  """Returns how many of the first max_records records of path are readable.
+
+  Args:
+    path: str. The path of a TFRecord file, possibly cut short by its writer
+      being killed. It need not exist.
+    max_records: int. The most records to count.
+
+  Returns:
+    The number of records, up to max_records, that can be read from path
+    before its end or the first damaged record.
+  """
+  if max_records <= 0 or not tf.gfile.Exists(path):
+    return 0
+  n_records = 0
+  try:
+    for _ in tf.python_io.tf_record_iterator(
+        path, io_utils.make_tfrecord_options(path)):
+      n_records += 1
+      if n_records >= max_records:
+        break
+  except tf.errors.OpError:
+    # A truncated record, or the truncated end of a compressed file.
+    pass
+  return n_records
+
+
+class RegionCheckpoint(object):
+  """Records the regions whose outputs are written, so a task can resume.
+
+  The checkpoint of a task is a file alongside its examples with a line per
+  completed region, in the order the regions are processed: the region, then
+  the total number of records written to each of _CHECKPOINTED_OUTPUTS up to
+  and including it. TFRecord writers buffer their records and cannot reopen
+  a file, compressed or not, to append to it. So a restarted task resumes
+  after the last recorded region all of whose records can still be read: it
+  moves its old outputs aside, copies the records of the completed regions
+  into its new outputs, and then processes the rest of its regions.
+  """
+
+  def __init__(self, options, regions):
+    """Finds where a task processing regions with options can resume.
+
+    Args:
+      options: deepvariant.DeepVariantOptions proto.
+      regions: list of learning.genomics.v1.Range protos of the task, in the
+        order they are processed.
+    """
+    self.path = options.examples_filename + _CHECKPOINT_SUFFIX
+    self._output_paths = checkpointed_output_paths(options)
+    self._file = None
+    self._entries = read_checkpoint(self.path)
+    # A checkpoint of other regions, e.g. from other settings, is only used as
+    # far as it matches ours.
+    literals = [ranges.to_literal(region) for region in regions]
+    n_matching = 0
+    while (n_matching < min(len(self._entries), len(literals)) and
+           self._entries[n_matching][0] == literals[n_matching]):
+      n_matching += 1
+    del self._entries[n_matching:]
+    if self._entries:
+      intact = [
+          count_intact_records(self._source_path(name), count)
+          for name, count in zip(_CHECKPOINTED_OUTPUTS, self._entries[-1][1])
+      ]
+      while self._entries and any(
+          count > n_intact
+          for count, n_intact in zip(self._entries[-1][1], intact)):
+        self._entries.pop()
+    self._counts = list(self._entries[-1][1] if self._entries else
+                        [0] * len(_CHECKPOINTED_OUTPUTS))
+
+  @property
+  def n_completed_regions(self):
+    """The number of regions, from the first, that need not be processed."""
+    return len(self._entries)
+
+  def _source_path(self, name):
+    """Returns the path holding the records of name from before the restart."""
+    path = self._output_paths.get(name, '')
+    if path and tf.gfile.Exists(path + _RESUME_SUFFIX):
+      # A previous restart was killed while copying from here.
+      return path + _RESUME_SUFFIX
+    return path
+
+  def move_outputs_aside(self):
+    """Moves the old outputs aside, before the new ones are opened."""
+    if not self._entries:
+      return
+    for name, path in self._output_paths.iteritems():
+      if self._source_path(name) == path and tf.gfile.Exists(path):
+        tf.gfile.Rename(path, path + _RESUME_SUFFIX, overwrite=True)
+
+  def restore(self, writer):
+    """Copies the records of the completed regions, and starts the checkpoint.
+
+    Args:
+      writer: io_utils.OutputsWriter. The newly opened outputs of the task.
+    """
+    for name, count in zip(_CHECKPOINTED_OUTPUTS, self._counts):
+      if count and name in self._output_paths:
+        resume_path = self._output_paths[name] + _RESUME_SUFFIX
+        records = tf.python_io.tf_record_iterator(
+            resume_path, io_utils.make_tfrecord_options(resume_path))
+        for record in itertools.islice(records, count):
+          writer.write_serialized(name, record)
+    self._file = tf.gfile.GFile(self.path, 'w')
+    for literal, counts in self._entries:
+      self._write_entry(literal, counts)
+    self._file.flush()
+    for path in self._output_paths.itervalues():
+      if tf.gfile.Exists(path + _RESUME_SUFFIX):
+        tf.gfile.Remove(path + _RESUME_SUFFIX)
+
+  def _write_entry(self, literal, counts):
+    self._file.write('\t'.join([literal] + [str(count) for count in counts]) +
+                     '\n')
+
+  def add(self, region, **n_records):
+    """Records region as completed once its outputs have been written.
+
+    Args:
+      region: learning.genomics.v1.Range proto. The completed region.
+      **n_records: The number of records of the region written to each output,
+        by its name in _CHECKPOINTED_OUTPUTS.
+    """
+    for i, name in enumerate(_CHECKPOINTED_OUTPUTS):
+      self._counts[i] += n_records.get(name, 0)
+    self._write_entry(ranges.to_literal(region), self._counts)
+    self._file.flush()
+
+  def close(self):
+    if self._file:
+      self._file.close()
+      self._file = None
+
+
 class RegionProcessor(object):
   """Creates DeepVariant example protos for a single region on the genome.
 
@@ -649,21 +1303,38 @@ class RegionProcessor(object):
       tf.Example protos.
   """
 
-  def __init__(self, options):
+  def __init__(self, options, sam_reader=None, labeler=None, ref_reader=None):
     """Creates a new RegionProcess.
 
     Args:
       options: deepvariant.DeepVariantOptions proto used to specify our
         resources for calling (e.g., reference_filename).
+      sam_reader: Optional SamReader for options.reads_filename to use instead
+        of opening our own, e.g. one shared by several RegionProcessors.
+      labeler: Optional labeler with the label_calls() method of a
+        VariantLabeler to use in training mode instead of creating our own,
+        e.g. one from make_variant_labeler shared by several RegionProcessors.
+      ref_reader: Optional RegionReference to use instead of creating our own,
+        e.g. one shared by the RegionProcessors of several samples. Its owner
+        sets it to each region before we process it.
     """
     self.options = options
     self.initialized = False
-    self.ref_reader = None
-    self.sam_reader = None
+    # The RuntimeMetrics of the last region processed.
+    self.last_region_metrics = None
+    self.fasta_reader = None
+    self.ref_reader = ref_reader
+    self.owns_ref_reader = ref_reader is None
+    self.sam_reader = sam_reader
     self.in_memory_sam_reader = None
+    # With native examples, the reads of the region being processed are also
+    # handed to C++ once as a RegionReads, shared by allele counting and
+    # example creation instead of converting the reads for each of them.
+    self.native_region_reads = None
     self.realigner = None
     self.pic = None
-    self.labeler = None
+    self.native_examples_creator = None
+    self.labeler = labeler
     self.variant_caller = None
 
   def _make_allele_counter_for_region(self, region):
@@ -674,21 +1345,38 @@ class RegionProcessor(object):
     return image_tensor.tostring(), image_tensor.shape, 'raw'
 
   def _make_sam_reader(self):
+    # Decompression threads read ahead of our queries into the blocks a read
+    # block cache doesn't have.
+    num_decompression_threads = FLAGS.hts_decompression_threads
+    if self.options.read_block_cache_dir:
+      num_decompression_threads = 0
     return genomics_io.make_sam_reader(
         self.options.reads_filename,
         self.options.read_requirements,
         hts_block_size=FLAGS.hts_block_size,
         downsample_fraction=self.options.downsample_fraction,
-        random_seed=self.options.random_seed)
+        random_seed=self.options.random_seed,
+        num_decompression_threads=num_decompression_threads,
+        ref_path=self.options.reference_filename,
+        desired_read_fields=read_fields_to_parse(self.options),
+        max_depth=FLAGS.max_read_depth)
 
   def _initialize(self):
     """Initialize the resources needed for this work in the current env."""
     if self.initialized:
       raise ValueError('Cannot initialize this object twice')
 
-    self.ref_reader = genomics_io.make_ref_reader(
-        self.options.reference_filename)
-    self.sam_reader = self._make_sam_reader()
+    # The allele counter, realigner and pileup image creator all look up the
+    # reference bases of the region being processed, so they share a
+    # RegionReference that process() fills once per region. It doesn't own
+    # the reader it wraps, which we keep alive in self.fasta_reader.
+    if self.owns_ref_reader:
+      self.fasta_reader = genomics_io.make_ref_reader(
+          self.options.reference_filename)
+      self.ref_reader = region_reference.RegionReference(
+          self.fasta_reader, _REGION_REFERENCE_PADDING)
+    if self.sam_reader is None:
+      self.sam_reader = self._make_sam_reader()
     self.in_memory_sam_reader = utils.InMemorySamReader([])
 
     if self.options.realigner_enabled:
@@ -698,10 +1386,17 @@ class RegionProcessor(object):
         ref_reader=self.ref_reader,
         sam_reader=self.in_memory_sam_reader,
         options=self.options.pic_options)
+    if self.options.pileup_image_threads > 0:
+      self.native_examples_creator = (
+          pileup_examples_native.PileupExamplesCreatorNative(
+              self.options.pic_options, self.options.pileup_image_threads))
 
-    if in_training_mode(self.options):
+    if in_training_mode(self.options) and self.labeler is None:
       self.labeler = variant_labeler.VariantLabeler(
-          genomics_io.make_vcf_reader(self.options.truth_variants_filename),
+          genomics_io.make_vcf_reader(
+              self.options.truth_variants_filename,
+              num_decompression_threads=FLAGS.hts_decompression_threads,
+              genotypes_only=True),
           read_confident_regions(self.options))
 
     self.variant_caller = variant_caller.VariantCaller(
@@ -709,12 +1404,33 @@ class RegionProcessor(object):
     self.random = np.random.RandomState(self.options.random_seed)
     self.initialized = True
 
-  def process(self, region):
+  def reseed(self, random_seed):
+    """Resets the random number generators used to process regions.
+
+    Without reseeding, our random state carries over from one region to the
+    next, so the examples of a region would depend on the regions processed
+    before it. process_regions reseeds before each region with
+    region_random_seed, so the examples of a region only depend on the region
+    and its index, and not on n_cores, prefetching or resuming.
+
+    Args:
+      random_seed: int. The random seed to use for the next region.
+    """
+    if not self.initialized:
+      self._initialize()
+    self.random = np.random.RandomState(random_seed)
+    self.pic.reseed(random_seed)
+    self.variant_caller.reseed(random_seed)
+
+  def process(self, region, reads=None):
     """Finds candidates and creates corresponding examples in a region.
 
     Args:
       region: A learning.genomics.v1.Range proto. Specifies the region on the
         genome we should process.
+      reads: Optional list of the reads from self.sam_reader overlapping
+        region, such as those prefetched by genomics_io.prefetch_region_reads.
+        If None, they are queried from self.sam_reader.
 
     Returns:
       Three values. First is a list of the found candidates, which are
@@ -726,26 +1442,55 @@ class RegionProcessor(object):
       reference sites, if gvcf generation is enabled, otherwise returns [].
     """
     region_timer = timer.TimerStart()
+    # Drops the stage times of this thread's earlier work, so that those of
+    # this region are all that's left once it is processed.
+    stage_timer.take_thread_stage_times()
 
     # Print some basic information about what we are doing.
     if not self.initialized:
       self._initialize()
 
-    self.in_memory_sam_reader.replace_reads(self.region_reads(region))
+    costs = core_pb2.RegionCosts()
+    if self.owns_ref_reader:
+      self.ref_reader.set_region(region)
+    reads = self.region_reads(region, reads, costs)
+    # The reads of the region are held in Python, so we account them here.
+    reads_bytes = 0
+    if stage_timer.stage_memory_tracking_enabled():
+      reads_bytes = sum(read.ByteSize() for read in reads)
+      stage_timer.add_stage_memory(core_pb2.READ_DECODE, reads_bytes)
+    self.in_memory_sam_reader.replace_reads(reads)
+    if self.native_examples_creator:
+      self.native_region_reads = region_reads_lib.RegionReads(reads)
     candidates, gvcfs = self.candidates_in_region(region)
+    if self.native_examples_creator:
+      examples_per_candidate = self.create_pileup_examples_natively(candidates)
+      self.native_region_reads = None
+    else:
+      examples_per_candidate = (
+          self.create_pileup_examples(candidate) for candidate in candidates)
+    labels = None
+    if in_training_mode(self.options) and candidates:
+      # All of the candidates of the region are labeled at once.
+      labels = self.labeler.label_calls(candidates)
     examples = []
-    for candidate in candidates:
-      for example in self.create_pileup_examples(candidate):
-        if in_training_mode(self.options):
-          if self.label_variant(example, candidate.variant):
-            examples.append(example)
-        else:
+    for index, (candidate, candidate_examples) in enumerate(
+        zip(candidates, examples_per_candidate)):
+      for example in candidate_examples:
+        if labels is None:
           examples.append(example)
+        elif self.label_variant(example, candidate.variant, labels[index]):
+          examples.append(example)
+    elapsed = region_timer.Stop()
     logging.info('Found %s candidates in %s [%0.2fs elapsed]', len(examples),
-                 ranges.to_literal(region), region_timer.Stop())
+                 ranges.to_literal(region), elapsed)
+    costs.num_candidates = len(candidates)
+    costs.num_examples = len(examples)
+    stage_timer.add_stage_memory(core_pb2.READ_DECODE, -reads_bytes)
+    self.last_region_metrics = region_runtime_metrics(region, elapsed, costs)
     return candidates, examples, gvcfs
 
-  def region_reads(self, region):
+  def region_reads(self, region, reads=None, costs=None):
     """Update in_memory_sam_reader with read alignments overlapping the region.
 
     If self.realigner is set, uses realigned reads, otherwise original reads
@@ -754,17 +1499,24 @@ class RegionProcessor(object):
     Args:
       region: A learning.genomics.v1.Range object specifying the region we
         want to realign reads.
+      reads: Optional iterable of the reads overlapping region. If None, they
+        are queried from self.sam_reader.
+      costs: Optional core_pb2.RegionCosts proto, where the number of reads and
+        the costs of realigning them are recorded.
 
     Returns:
       [genomics.deepvariant.core.genomics.Read], reads overlapping the region.
     """
-    reads = self.sam_reader.query(region)
+    if reads is None:
+      reads = self.sam_reader.query(region)
     if self.options.max_reads_per_partition > 0:
       reads = utils.reservoir_sample(
           reads, self.options.max_reads_per_partition, self.random)
     reads = list(reads)
+    if costs is not None:
+      costs.num_reads = len(reads)
     if self.realigner:
-      _, reads = self.realigner.realign_reads(reads, region)
+      _, reads = self.realigner.realign_reads(reads, region, costs=costs)
     return reads
 
   def candidates_in_region(self, region):
@@ -780,15 +1532,22 @@ class RegionProcessor(object):
       learning.genomics.v1.Variant protos containing gVCF information for all
       reference sites, if gvcf generation is enabled, otherwise returns [].
     """
-    reads = self.in_memory_sam_reader.query(region)
+    if self.native_region_reads is not None:
+      reads = self.native_region_reads.query(region)
+    else:
+      reads = self.in_memory_sam_reader.query(region)
     if not reads and not gvcf_output_enabled(self.options):
       # If we are generating gVCF output we cannot safely abort early here as
       # we need to return the gVCF records calculated by the caller below.
       return [], []
 
     allele_counter = self._make_allele_counter_for_region(region)
-    for read in reads:
-      allele_counter.add(read)
+    if self.native_region_reads is not None:
+      # The reads are already native, so they are counted in one call.
+      allele_counter.add_overlapping(self.native_region_reads)
+    else:
+      for read in reads:
+        allele_counter.add(read)
 
     candidates, gvcfs = self.variant_caller.calls_from_allele_counter(
         allele_counter, gvcf_output_enabled(self.options))
@@ -827,55 +1586,85 @@ class RegionProcessor(object):
               image_format=tensor_format))
     return examples
 
-  def label_variant(self, example, variant):
+  def create_pileup_examples_natively(self, dv_calls):
+    """Creates the tf.Examples of all of dv_calls with one native call.
+
+    The images of different calls are encoded in parallel on the threads of
+    self.native_examples_creator, using the reads of native_region_reads.
+
+    Args:
+      dv_calls: A list of the DeepVariantCalls of the region being processed.
+
+    Returns:
+      A list with the list of tf.Example protos of each of dv_calls, in order,
+      as returned by create_pileup_examples.
+    """
+    serialized = (
+        self.native_examples_creator.create_examples_from_region_reads(
+            self.ref_reader, dv_calls, self.native_region_reads))
+    examples_per_call = []
+    for dv_call, call_examples in zip(dv_calls, serialized):
+      if not call_examples:
+        logging.warning('Could not create PileupImage for candidate at %s:%s',
+                        dv_call.variant.reference_name, dv_call.variant.start)
+      examples_per_call.append(
+          [tf.train.Example.FromString(example) for example in call_examples])
+    return examples_per_call
+
+  def label_variant(self, example, variant, variant_label):
     """Adds the truth variant and label for variant to example.
 
-    This function uses VariantLabeler to find a match for variant and writes
-    in the correspond truth variant and derived label to our example proto.
+    This function writes the truth variant that our labeler matched to variant
+    and the label derived from it into our example proto.
 
     Args:
       example: A tf.Example proto. We will write truth_variant and label into
         this proto.
-      variant: A learning.genomics.v1.Variant proto.
-        This is the variant we'll use
-        to call our VariantLabeler.match to get our truth variant.
+      variant: A learning.genomics.v1.Variant proto, the variant of the
+        candidate of example.
+      variant_label: The deepvariant.VariantLabel of variant, as returned by
+        the label_calls() method of our labeler.
 
     Returns:
       True if the variant was in the confident region (meaning that it could be
         given a label) and False otherwise.
     """
-    is_confident, truth_variant = self.labeler.match(variant)
-    if not is_confident:
+    if not variant_label.is_confident:
       return False
     alt_alleles = tf_utils.example_alt_alleles(example, variant=variant)
     if variantutils.is_ref(variant):
       label = 0
     else:
-      label = self.labeler.match_to_alt_count(variant, truth_variant,
-                                              alt_alleles)
+      label = variant_labeler.label_alt_alleles(variant_label, variant,
+                                                alt_alleles)
     tf_utils.example_set_label(example, label)
-    tf_utils.example_set_truth_variant(example, truth_variant)
+    tf_utils.example_set_truth_variant(example, variant_label.truth_variant)
     return True
 
 
-def processing_regions_from_options(options):
-  """Computes the calling regions from our options.
-
-  This function does all of the work needed to read our input files and region
-  specifications to determine the list of regions we should generate examples
-  over. It also computes the confident regions need to label variants.
+def contigs_from_inputs(options):
+  """Reads the contigs of our inputs and computes those we should process.
 
   Args:
     options: deepvariant.DeepVariantOptions proto containing information about
       our input data sources.
 
   Returns:
-    Two values. The first is a list of learning.genomics.v1.Range protos of the
-    regions we should process. The second is a RangeSet containing the confident
-    regions for labeling, or None if we are running in training mode.
+    Two lists of learning.genomics.core.ContigInfo protos. The first holds the
+    contigs of the reference. The second holds the contigs common to all of
+    our inputs, minus options.exclude_contigs, in the order of the reference.
+
+  Raises:
+    ValueError: if the common contigs don't cover enough of the reference.
   """
   ref_contigs = genomics_io.make_ref_reader(options.reference_filename).contigs
-  sam_contigs = genomics_io.make_sam_reader(options.reads_filename).contigs
+  # We only need the headers of our reads, so we don't load their indexes.
+  sam_contigs = []
+  for reads_filename in (options.sample_reads_filenames or
+                         [options.reads_filename]):
+    with genomics_io.make_sam_reader(
+        reads_filename, use_index=False) as sam_reader:
+      sam_contigs.append(sam_reader.contigs)
 
   # Add in confident regions and vcf_contigs if in training mode.
   vcf_contigs = None
@@ -886,68 +1675,553 @@ def processing_regions_from_options(options):
   # Compute the common contigs among our inputs, and check that the contigs are
   # sufficiently consistent among each other.
   contigs = common_contigs(
-      only_true(ref_contigs, sam_contigs, vcf_contigs),
+      only_true(ref_contigs, *(sam_contigs + [vcf_contigs])),
       exclude_contig_names=options.exclude_contigs)
   validate_reference_contig_coverage(ref_contigs, contigs,
                                      options.min_shared_contigs_basepairs)
+  return ref_contigs, contigs
+
+
+# ---------------------------------------------------------------------------
+# Startup metadata
+# ---------------------------------------------------------------------------
+
+
+def build_startup_metadata(options):
+  """Returns the StartupMetadata proto of the inputs of options.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto containing information about
+      our input data sources.
+
+  Returns:
+    A deepvariant.StartupMetadata proto, with the sample name of options and
+    the contigs of our inputs.
+  """
+  ref_contigs, contigs = contigs_from_inputs(options)
+  return deepvariant_pb2.StartupMetadata(
+      reference_filename=options.reference_filename,
+      reads_filename=options.reads_filename,
+      truth_variants_filename=options.truth_variants_filename,
+      sample_name=options.variant_caller_options.sample_name,
+      ref_contigs=ref_contigs,
+      contigs=contigs)
+
+
+def write_startup_metadata(metadata, path):
+  """Writes the StartupMetadata proto metadata to path."""
+  with tf.gfile.GFile(path, 'wb') as f:
+    f.write(metadata.SerializeToString())
+
+
+def read_startup_metadata(path):
+  """Returns the StartupMetadata proto written to path."""
+  with tf.gfile.GFile(path, 'rb') as f:
+    return deepvariant_pb2.StartupMetadata.FromString(f.read())
+
+
+def check_startup_metadata(metadata, options):
+  """Checks that metadata was built from the input files of options.
+
+  Args:
+    metadata: deepvariant.StartupMetadata proto.
+    options: deepvariant.DeepVariantOptions proto.
+
+  Raises:
+    ValueError: if an input file of options isn't the one metadata was built
+      from.
+  """
+  for field in [
+      'reference_filename', 'reads_filename', 'truth_variants_filename'
+  ]:
+    if getattr(metadata, field) != getattr(options, field):
+      raise ValueError(
+          'The startup metadata was built with {}={} but we have {}'.format(
+              field, getattr(metadata, field), getattr(options, field)))
+
+
+def processing_regions_from_options(options):
+  """Computes the calling regions from our options.
+
+  This function does all of the work needed to read our input files and region
+  specifications to determine the list of regions we should generate examples
+  over. It also computes the confident regions need to label variants. If
+  options.startup_metadata_filename is set, the contigs are read from that
+  StartupMetadata instead of from the headers of our inputs. If
+  options.shard_regions_by_cost is set, the regions of our task are chosen by
+  shard_regions_by_cost() rather than round robin.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto containing information about
+      our input data sources.
+
+  Returns:
+    Two values. The first is a list of learning.genomics.v1.Range protos of the
+    regions we should process. The second is a RangeSet containing the confident
+    regions for labeling, or None if we are running in training mode.
+  """
+  if options.startup_metadata_filename:
+    metadata = read_startup_metadata(options.startup_metadata_filename)
+    check_startup_metadata(metadata, options)
+    ref_contigs, contigs = list(metadata.ref_contigs), list(metadata.contigs)
+  else:
+    ref_contigs, contigs = contigs_from_inputs(options)
   logging.info('Common contigs are %s', [c.name for c in contigs])
 
+  calling_regions = ranges.RangeSet.from_regions(
+      options.calling_regions, ranges.contigs_dict(ref_contigs))
+  if options.shard_regions_by_cost and options.num_shards:
+    # Every task computes the costs of all of the regions, which takes an
+    # index lookup per region, so that they agree on how to divide them.
+    regions = list(
+        regions_to_process(
+            contigs,
+            partition_size=options.allele_counter_options.partition_size,
+            calling_regions=calling_regions))
+    return shard_regions_by_cost(
+        regions,
+        estimate_region_costs(options, regions),
+        task_id=options.task_id,
+        num_shards=options.num_shards,
+        hot_region_cost_factor=options.hot_region_cost_factor)
+
   regions = regions_to_process(
       contigs,
       partition_size=options.allele_counter_options.partition_size,
-      calling_regions=ranges.RangeSet.from_regions(
-          options.calling_regions, ranges.contigs_dict(ref_contigs)),
+      calling_regions=calling_regions,
       task_id=options.task_id,
       num_shards=options.num_shards)
 
   return regions
 
 
+def region_random_seed(options, index):
+  """Returns the random seed for processing the index-th region of a task."""
+  return (options.random_seed + index) % (2**32)
+
+
+class _ParallelRegionProcessor(object):
+  """Processes regions on a pool of threads, with a RegionProcessor per thread.
+
+  Most of our readers and the native objects behind them aren't safe to share
+  across threads, so each worker thread lazily creates its own
+  RegionProcessor. The exception is the SamReader, which supports concurrent
+  queries, so all workers share one reader with a single parsed header and
+  index. Idle workers pull the next region from the shared queue of the pool,
+  which balances the load when some regions are much more expensive than
+  others. Our native code releases the GIL, so the threads run concurrently
+  while reading, counting alleles, calling variants and encoding pileup images.
+
+  If read_blocks is given, the ReadBlockPrefetcher filling the cache that our
+  reads come from, each worker waits for the blocks of its region first.
+  """
+
+  def __init__(self, options, labeler=None, read_blocks=None,
+               first_region_index=0):
+    self.options = options
+    self.labeler = labeler
+    self.read_blocks = read_blocks
+    self.first_region_index = first_region_index
+    self._local = threading.local()
+    self._lock = threading.Lock()
+    self._sam_reader = None
+
+  def _shared_sam_reader(self):
+    with self._lock:
+      if self._sam_reader is None:
+        self._sam_reader = RegionProcessor(self.options)._make_sam_reader()
+      return self._sam_reader
+
+  def _processor(self):
+    processor = getattr(self._local, 'processor', None)
+    if processor is None:
+      processor = RegionProcessor(
+          self.options,
+          sam_reader=self._shared_sam_reader(),
+          labeler=self.labeler)
+      self._local.processor = processor
+    return processor
+
+  def __call__(self, indexed_region):
+    index, region = indexed_region
+    if self.read_blocks:
+      self.read_blocks.wait_for_region(index)
+    processor = self._processor()
+    # Each region gets its own seed, derived from its index in this task, so
+    # our outputs are deterministic regardless of which thread processes it.
+    processor.reseed(
+        region_random_seed(self.options, self.first_region_index + index))
+    return processor.process(region) + (processor.last_region_metrics,)
+
+
+class MultiSampleRegionProcessor(object):
+  """Processes each region for several samples, sharing its reference bases.
+
+  Each sample has its own RegionProcessor, with its own SamReader, allele
+  counter, realigner and variant caller, but all of them share one
+  RegionReference, which is filled with the reference bases of each region once
+  for the whole cohort. If n_threads is greater than 1, the samples of a region
+  are processed concurrently on up to that many threads. Our native code
+  releases the GIL, and the RegionReference supports concurrent queries.
+
+  Each sample is processed by a single RegionProcessor, reseeded for each
+  region as in process_regions, so the outputs of each sample are those of a
+  single-sample run, whatever n_threads is.
+  """
+
+  def __init__(self, samples_options, n_threads=1):
+    """Creates a new MultiSampleRegionProcessor.
+
+    Args:
+      samples_options: list of deepvariant.DeepVariantOptions protos, one per
+        sample as returned by sample_options, sharing a reference_filename.
+      n_threads: int. The number of samples processed at once.
+    """
+    self.fasta_reader = genomics_io.make_ref_reader(
+        samples_options[0].reference_filename)
+    self.ref_reader = region_reference.RegionReference(
+        self.fasta_reader, _REGION_REFERENCE_PADDING)
+    self.processors = [
+        RegionProcessor(options, ref_reader=self.ref_reader)
+        for options in samples_options
+    ]
+    self.thread_pool = None
+    if n_threads > 1 and len(self.processors) > 1:
+      self.thread_pool = pool.ThreadPool(min(n_threads, len(self.processors)))
+
+  def _process_sample(self, processor_and_region):
+    processor, region = processor_and_region
+    return processor.process(region) + (processor.last_region_metrics,)
+
+  def process(self, region, index):
+    """Processes region for each of our samples.
+
+    Args:
+      region: A learning.genomics.v1.Range proto.
+      index: int. The index of region among the regions of the task.
+
+    Returns:
+      A list with the (candidates, examples, gvcfs) tuple from
+      RegionProcessor.process of each sample, in the order of our samples,
+      followed by the RuntimeMetrics of the sample in the region.
+    """
+    self.ref_reader.set_region(region)
+    for processor in self.processors:
+      processor.reseed(region_random_seed(processor.options, index))
+    work = [(processor, region) for processor in self.processors]
+    if self.thread_pool:
+      return self.thread_pool.map(self._process_sample, work, chunksize=1)
+    return [self._process_sample(w) for w in work]
+
+  def close(self):
+    if self.thread_pool:
+      self.thread_pool.terminate()
+      self.thread_pool.join()
+      self.thread_pool = None
+
+
+def prefetch_read_blocks(options, regions):
+  """Starts fetching the blocks of the reads of regions into a local cache.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto, with a read_block_cache_dir.
+    regions: list of learning.genomics.v1.Range protos we will process.
+
+  Returns:
+    Two values. The first is the ReadBlockPrefetcher filling the cache. The
+    second is a copy of options whose reads_filename is the cache.
+  """
+  cache_path = os.path.join(options.read_block_cache_dir,
+                            'reads.task{}.bam'.format(options.task_id))
+  read_blocks = genomics_io.make_read_block_prefetcher(
+      options.reads_filename,
+      regions,
+      cache_path,
+      num_threads=options.read_block_prefetch_threads)
+  logging.info('Prefetching %d bytes of %s in %d requests into %s',
+               read_blocks.num_bytes_to_fetch(), options.reads_filename,
+               read_blocks.num_requests(), cache_path)
+  cache_options = deepvariant_pb2.DeepVariantOptions()
+  cache_options.CopyFrom(options)
+  cache_options.reads_filename = read_blocks.cache_path
+  return read_blocks, cache_options
+
+
+def process_regions(options, regions, first_region_index=0):
+  """Yields the outputs and runtime metrics of each of regions, in order.
+
+  Each region is processed with the random seed given by region_random_seed
+  for its index in the task, so the outputs of a region don't depend on how
+  the regions are processed.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto. If options.n_cores is
+      greater than 1, regions are processed concurrently by that many threads.
+      Otherwise, if options.prefetch_regions is greater than 0, the reads of
+      that many upcoming regions are decoded on a background thread. If
+      options.read_block_cache_dir is set, the blocks of the reads of regions
+      are fetched into it ahead of time instead, and each region is processed
+      once its blocks are there.
+    regions: iterable of learning.genomics.v1.Range protos to process.
+    first_region_index: int. The index in the task of the first of regions,
+      e.g. the number of regions a resumed task has already completed.
+
+  Yields:
+    The (candidates, examples, gvcfs) tuple from RegionProcessor.process for
+    each region, in the order of regions, followed by the RuntimeMetrics of
+    the region.
+  """
+  regions = list(regions)
+  labeler = None
+  if in_training_mode(options):
+    labeler = make_variant_labeler(options, regions)
+
+  read_blocks = None
+  if options.read_block_cache_dir:
+    read_blocks, options = prefetch_read_blocks(options, regions)
+
+  try:
+    if (options.n_cores <= 1 and options.prefetch_regions > 0 and
+        read_blocks is None):
+      sam_reader = RegionProcessor(options)._make_sam_reader()
+      region_processor = RegionProcessor(
+          options, sam_reader=sam_reader, labeler=labeler)
+      # The reads of the next regions are decoded in the background while we
+      # process the current one.
+      region_reads = genomics_io.prefetch_region_reads(
+          sam_reader, regions, options.prefetch_regions)
+      for index, (region, reads) in enumerate(zip(regions, region_reads)):
+        region_processor.reseed(
+            region_random_seed(options, first_region_index + index))
+        outputs = region_processor.process(region, reads)
+        yield outputs + (region_processor.last_region_metrics,)
+    elif options.n_cores <= 1:
+      region_processor = RegionProcessor(options, labeler=labeler)
+      for index, region in enumerate(regions):
+        if read_blocks:
+          read_blocks.wait_for_region(index)
+        region_processor.reseed(
+            region_random_seed(options, first_region_index + index))
+        outputs = region_processor.process(region)
+        yield outputs + (region_processor.last_region_metrics,)
+    else:
+      thread_pool = pool.ThreadPool(options.n_cores)
+      try:
+        # imap returns results in the order of regions, so our outputs are
+        # written out exactly as they would be by a single thread.
+        for result in thread_pool.imap(
+            _ParallelRegionProcessor(
+                options,
+                labeler=labeler,
+                read_blocks=read_blocks,
+                first_region_index=first_region_index),
+            enumerate(regions),
+            chunksize=1):
+          yield result
+      finally:
+        thread_pool.terminate()
+        thread_pool.join()
+  finally:
+    if read_blocks:
+      for path in [read_blocks.cache_path, read_blocks.cache_path + '.bai']:
+        if os.path.exists(path):
+          os.remove(path)
+
+
+def write_region_outputs(options, writer, counters, candidates, examples,
+                         gvcfs, metrics):
+  """Writes the outputs of a region processed by a RegionProcessor.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto the region was processed
+      with.
+    writer: io_utils.OutputsWriter for the outputs of options.
+    counters: VariantCounters updated with the truth variants of examples in
+      training mode.
+    candidates: list of the deepvariant.DeepVariantCall protos of the region.
+    examples: list of the tf.Example protos of the region.
+    gvcfs: list of the gVCF learning.genomics.v1.Variant protos of the region.
+    metrics: core.RuntimeMetrics proto of the region, to which the time taken
+      to write the outputs is added.
+  """
+  write_timer = timer.TimerStart()
+
+  writer.write('candidates', *candidates)
+
+  # If we have any gvcf records, write them out. This if also serves to protect
+  # us from trying to write to the gvcfs output of writer when gvcf generation
+  # is turned off. In that case, gvcfs will always be empty and we'll never
+  # execute the write.
+  if gvcfs:
+    writer.write('gvcfs', *gvcfs)
+
+  for example in examples:
+    if in_training_mode(options):
+      truth_variant = tf_utils.example_truth_variant(example)
+      counters.update(truth_variant)
+    writer.write('examples', example)
+
+  if options.runtime_metrics_filename:
+    metrics.stage_times.add(
+        stage=core_pb2.EXAMPLE_WRITING,
+        count=1,
+        wall_time_seconds=write_timer.Stop())
+    writer.write('runtime_metrics', metrics)
+
+
+def multi_sample_make_examples_runner(options):
+  """Runs examples creation for each of the samples of options at once.
+
+  Every region is processed once for all of the samples by a
+  MultiSampleRegionProcessor, and the outputs of each sample are written to
+  its own files as they would be by a single-sample run.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto with sample_reads_filenames.
+  """
+  samples = sample_options(options)
+  logging.info('Preparing inputs')
+  regions = processing_regions_from_options(options)
+  logging.info('Processing %d samples', len(samples))
+  if options.n_cores > 1:
+    logging.info('Processing samples with %d threads', options.n_cores)
+
+  counters = make_counters()
+  n_candidates = [0] * len(samples)
+  slowest_regions = SlowestRegions(options.num_slowest_regions)
+  peak_stage_memory = PeakStageMemory()
+  stage_timer.set_stage_memory_tracking(options.track_stage_memory)
+  processor = MultiSampleRegionProcessor(samples, options.n_cores)
+  writers = []
+  try:
+    for sample in samples:
+      logging.info('Writing the outputs of %s (%s)', sample.reads_filename,
+                   sample.variant_caller_options.sample_name)
+      writers.append(io_utils.OutputsWriter(sample).__enter__())
+    for region_index, region in enumerate(regions):
+      for index, (candidates, examples, gvcfs, metrics) in enumerate(
+          processor.process(region, region_index)):
+        n_candidates[index] += len(candidates)
+        write_region_outputs(samples[index], writers[index], counters,
+                             candidates, examples, gvcfs, metrics)
+        slowest_regions.add(metrics)
+        peak_stage_memory.add(metrics)
+  finally:
+    processor.close()
+    for writer in writers:
+      writer.__exit__(None, None, None)
+
+  for sample, n in zip(samples, n_candidates):
+    logging.info('Found %s candidate variants for %s', n,
+                 sample.variant_caller_options.sample_name)
+  slowest_regions.log()
+  peak_stage_memory.log()
+
+
 def make_examples_runner(options):
   """Runs examples creation stage of deepvariant."""
+  if options.sample_reads_filenames:
+    multi_sample_make_examples_runner(options)
+    return
+
   # Counting variants.
   counters = make_counters()
 
   logging.info('Preparing inputs')
   regions = processing_regions_from_options(options)
 
-  # Create a processor to create candidates and examples for each region.
-  region_processor = RegionProcessor(options)
-
   logging.info('Writing examples to %s', options.examples_filename)
   if options.candidates_filename:
     logging.info('Writing candidates to %s', options.candidates_filename)
   if options.gvcf_filename:
     logging.info('Writing gvcf records to %s', options.gvcf_filename)
+  if options.n_cores > 1:
+    logging.info('Processing regions with %d threads', options.n_cores)
+
+  examples_writer = None
+  if example_socket.is_example_socket(options.examples_filename):
+    examples_writer = example_socket.ExampleSocketWriter(
+        options.examples_filename)
+  elif example_stream.is_example_stream(options.examples_filename):
+    examples_writer = example_stream.ExampleStreamWriter(
+        options.examples_filename)
+
+  checkpoint = None
+  first_region_index = 0
+  if options.resumable:
+    regions = list(regions)
+    checkpoint = RegionCheckpoint(options, regions)
+    if checkpoint.n_completed_regions:
+      # The counts logged below are only of the regions processed now.
+      logging.info('Resuming after %d of %d regions completed in %s',
+                   checkpoint.n_completed_regions, len(regions),
+                   checkpoint.path)
+      first_region_index = checkpoint.n_completed_regions
+      regions = regions[first_region_index:]
+    checkpoint.move_outputs_aside()
 
   n_regions, n_candidates = 0, 0
-  with io_utils.OutputsWriter(options) as writer:
-    for region in regions:
-      candidates, examples, gvcfs = region_processor.process(region)
+  slowest_regions = SlowestRegions(options.num_slowest_regions)
+  peak_stage_memory = PeakStageMemory()
+  stage_timer.set_stage_memory_tracking(options.track_stage_memory)
+  with io_utils.OutputsWriter(options, examples_writer) as writer:
+    if checkpoint:
+      checkpoint.restore(writer)
+    for index, (candidates, examples, gvcfs, metrics) in enumerate(
+        process_regions(options, regions, first_region_index)):
       n_candidates += len(candidates)
       n_regions += 1
-
-      writer.write('candidates', *candidates)
-
-      # If we have any gvcf records, write them out. This if also serves to
-      # protect us from trying to write to the gvcfs output of writer when gvcf
-      # generation is turned off. In that case, gvcfs will always be empty and
-      # we'll never execute the write.
-      if gvcfs:
-        writer.write('gvcfs', *gvcfs)
-
-      for example in examples:
-        if in_training_mode(options):
-          truth_variant = tf_utils.example_truth_variant(example)
-          counters.update(truth_variant)
-        writer.write('examples', example)
+      write_region_outputs(options, writer, counters, candidates, examples,
+                           gvcfs, metrics)
+      slowest_regions.add(metrics)
+      peak_stage_memory.add(metrics)
+      if checkpoint:
+        checkpoint.add(
+            regions[index],
+            candidates=len(candidates),
+            examples=len(examples),
+            gvcfs=len(gvcfs),
+            runtime_metrics=1 if options.runtime_metrics_filename else 0)
+    if checkpoint:
+      checkpoint.close()
 
   logging.info('Found %s candidate variants', n_candidates)
+  slowest_regions.log()
+  peak_stage_memory.log()
   if in_training_mode(options):
     # This printout is misleading if we are in calling mode.
     counters.log()
 
 
+def check_multi_sample_options(options, flags):
+  """Raises a CommandLineError if options can't be used for several samples."""
+  if in_training_mode(options):
+    errors.log_and_raise('Multiple reads are only allowed in calling mode.',
+                         errors.CommandLineError)
+  if flags.sample_name:
+    errors.log_and_raise(
+        'sample_name is not allowed with multiple reads, whose sample names '
+        'are read from each of them.', errors.CommandLineError)
+  for flag, value in [('resumable', options.resumable),
+                      ('read_block_cache_dir', options.read_block_cache_dir),
+                      ('startup_metadata', options.startup_metadata_filename)]:
+    if value:
+      errors.log_and_raise(
+          '{} is not allowed with multiple reads.'.format(flag),
+          errors.CommandLineError)
+  if (example_socket.is_example_socket(options.examples_filename) or
+      example_stream.is_example_stream(options.examples_filename)):
+    errors.log_and_raise(
+        'Multiple reads require the examples to be written to files.',
+        errors.CommandLineError)
+  for field in _SAMPLE_OUTPUTS:
+    path = getattr(options, field)
+    if path and _SAMPLE_PLACEHOLDER not in path:
+      errors.log_and_raise(
+          'With multiple reads, {} must contain {} but got {}.'.format(
+              field, _SAMPLE_PLACEHOLDER, path), errors.CommandLineError)
+
+
 def main(argv=()):
   with errors.clean_commandline_error_exit():
     if len(argv) > 1:
@@ -977,10 +2251,28 @@ def main(argv=()):
     if not options.examples_filename:
       errors.log_and_raise('examples argument is required.',
                            errors.CommandLineError)
-    if options.n_cores != 1:
+    if options.n_cores < 1:
+      errors.log_and_raise(
+          'n_cores must be at least 1 but got {}.'.format(options.n_cores),
+          errors.CommandLineError)
+    if options.prefetch_regions < 0:
+      errors.log_and_raise(
+          'prefetch_regions must be non-negative but got {}.'.format(
+              options.prefetch_regions), errors.CommandLineError)
+    if options.read_block_cache_dir and options.read_block_prefetch_threads < 1:
+      errors.log_and_raise(
+          'read_block_prefetch_threads must be at least 1 but got {}.'.format(
+              options.read_block_prefetch_threads), errors.CommandLineError)
+    if options.resumable and (
+        example_socket.is_example_socket(options.examples_filename) or
+        example_stream.is_example_stream(options.examples_filename)):
+      errors.log_and_raise(
+          'resumable requires the examples to be written to a file.',
+          errors.CommandLineError)
+    if options.pileup_image_threads < 0:
       errors.log_and_raise(
-          'Currently only supports n_cores == 1 but got {}.'.format(
-              options.n_cores), errors.CommandLineError)
+          'pileup_image_threads must be non-negative but got {}.'.format(
+              options.pileup_image_threads), errors.CommandLineError)
 
     # Check for argument issues specific to train mode.
     if in_training_mode(options):
@@ -995,12 +2287,35 @@ def main(argv=()):
       if options.gvcf_filename:
         errors.log_and_raise('gvcf is not allowed in training mode.',
                              errors.CommandLineError)
+      if example_stream.is_example_stream(options.examples_filename):
+        errors.log_and_raise(
+            'Example streams ({} files) only hold calling examples and are '
+            'not allowed in training mode.'.format(example_stream.EXTENSION),
+            errors.CommandLineError)
+      if example_socket.is_example_socket(options.examples_filename):
+        errors.log_and_raise(
+            'Example sockets only carry calling examples and are not allowed '
+            'in training mode.', errors.CommandLineError)
     else:
       # Check for argument issues specific to calling mode.
       if options.variant_caller_options.sample_name == _UNKNOWN_SAMPLE:
         errors.log_and_raise('sample_name must be specified in calling mode.',
                              errors.CommandLineError)
 
+    if options.sample_reads_filenames:
+      check_multi_sample_options(options, FLAGS)
+
+    if FLAGS.build_startup_metadata:
+      if not options.startup_metadata_filename:
+        errors.log_and_raise(
+            'startup_metadata is required with build_startup_metadata.',
+            errors.CommandLineError)
+      logging.info('Writing startup metadata to %s',
+                   options.startup_metadata_filename)
+      write_startup_metadata(
+          build_startup_metadata(options), options.startup_metadata_filename)
+      return
+
     # Run!
     make_examples_runner(options)
 
@@ -0,0 +1,284 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Benchmarks the throughput of make_examples across depths and thread counts.
+
+Runs the calling pipeline of make_examples over fixed regions, with the reads
+downsampled to each of --depths, on each of --thread_counts threads, and with
+and without realignment. Each run writes one JSON record, with its throughput
+in reads, candidates and examples per second and its peak RSS, to
+--benchmark_output, or to stdout if that is unset. For example:
+
+  make_examples_benchmark \
+    --ref deepvariant/testdata/ucsc.hg19.chr20.unittest.fasta.gz \
+    --reads deepvariant/testdata/NA12878_S1.chr20.10_10p1mb.bam \
+    --regions chr20:10,000,000-10,010,000 \
+    --depths 10,20,30 --thread_counts 1,4
+
+The other flags of make_examples, such as --partition_size and the realigner
+flags, configure every run. Each run happens in a process of its own, so that
+its peak RSS is not inflated by the runs before it.
+"""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import json
+import multiprocessing
+import resource
+import time
+
+
+
+import tensorflow as tf
+
+from absl import logging
+
+from deepvariant import logging_level
+from deepvariant import make_examples
+from deepvariant.core import errors
+from deepvariant.core import genomics_io
+from deepvariant.core import proto_utils
+from deepvariant.core import ranges
+from deepvariant.core import utils
+from deepvariant.protos import deepvariant_pb2
+from deepvariant.realigner import realigner
+
+FLAGS = tf.flags.FLAGS
+
+tf.flags.DEFINE_string(
+    'depths', '10,20,30,50,100',
+    'Comma-separated list of the mean coverages to downsample the reads to. '
+    'Depths above the coverage of the reads in the regions are skipped.')
+tf.flags.DEFINE_string(
+    'thread_counts', '1',
+    'Comma-separated list of the values of --n_cores to benchmark.')
+tf.flags.DEFINE_string(
+    'realign_settings', 'false,true',
+    'Comma-separated list of whether to realign reads in each run.')
+tf.flags.DEFINE_string(
+    'benchmark_output', None,
+    'Path of the file to write the JSON record of each run to, one per line. '
+    'If not set, the records are printed to stdout.')
+
+# The regions benchmarked if --regions isn't set: covered by the testdata BAM
+# and made of ten regions of the default partition size.
+_DEFAULT_REGIONS = ['chr20:10,000,000-10,010,000']
+
+
+def _parse_list(value, parse):
+  return [parse(elt.strip()) for elt in value.split(',') if elt.strip()]
+
+
+def _parse_bool(value):
+  if value.lower() in ('true', '1'):
+    return True
+  elif value.lower() in ('false', '0'):
+    return False
+  raise ValueError('Expected a boolean but got', value)
+
+
+def mean_coverage(options, regions):
+  """Returns the mean coverage of regions by the reads of options.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto. The reads passing its
+      read_requirements are counted.
+    regions: list of learning.genomics.v1.Range protos.
+
+  Returns:
+    The number of aligned bases of the reads within regions, divided by the
+    number of bases of regions.
+  """
+  sam_reader = genomics_io.make_sam_reader(
+      options.reads_filename,
+      read_requirements=options.read_requirements,
+      ref_path=options.reference_filename)
+  n_bases, n_aligned_bases = 0, 0
+  for region in regions:
+    n_bases += region.end - region.start
+    for read in sam_reader.query(region):
+      n_aligned_bases += ranges.overlap_len(utils.read_range(read), region)
+  return n_aligned_bases / n_bases if n_bases else 0.0
+
+
+def benchmark_configuration(options, regions):
+  """Runs make_examples over regions, returning the throughput of the run.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto configuring the run.
+    regions: list of learning.genomics.v1.Range protos to process.
+
+  Returns:
+    A dict of the counts of reads, candidates and examples, their rates per
+    second of wall time, and the peak RSS of this process in kilobytes.
+  """
+  n_reads, n_candidates, n_examples = 0, 0, 0
+  start = time.time()
+  for candidates, examples, _, metrics in make_examples.process_regions(
+      options, regions):
+    n_reads += metrics.region_costs.num_reads
+    n_candidates += len(candidates)
+    n_examples += len(examples)
+  wall_time_seconds = time.time() - start
+
+  def rate(count):
+    return count / wall_time_seconds if wall_time_seconds > 0 else 0.0
+
+  return {
+      'wall_time_seconds': wall_time_seconds,
+      'num_reads': n_reads,
+      'num_candidates': n_candidates,
+      'num_examples': n_examples,
+      'reads_per_second': rate(n_reads),
+      'candidates_per_second': rate(n_candidates),
+      'examples_per_second': rate(n_examples),
+      # ru_maxrss is in kilobytes on Linux.
+      'peak_rss_kb': resource.getrusage(resource.RUSAGE_SELF).ru_maxrss,
+  }
+
+
+def _run_in_subprocess(fn, *args):
+  """Calls fn(*args) in a child process, returning its result."""
+  receiver, sender = multiprocessing.Pipe(duplex=False)
+
+  def target():
+    sender.send(fn(*args))
+    sender.close()
+
+  process = multiprocessing.Process(target=target)
+  process.start()
+  sender.close()
+  try:
+    result = receiver.recv()
+  except EOFError:
+    result = None
+  process.join()
+  if process.exitcode != 0 or result is None:
+    raise RuntimeError('Benchmark process failed with exit code {}'.format(
+        process.exitcode))
+  return result
+
+
+def benchmark_configurations(options, depths, thread_counts, realign_settings):
+  """Yields the JSON-able record of each benchmarked configuration.
+
+  Args:
+    options: deepvariant.DeepVariantOptions proto. The options shared by all of
+      the runs.
+    depths: list of floats. The mean coverages to downsample the reads to.
+    thread_counts: list of ints. The n_cores of the runs.
+    realign_settings: list of bools. Whether the runs realign reads.
+
+  Yields:
+    A dict describing each run: its configuration, as returned by
+    benchmark_configuration(), extended with that of the run.
+  """
+  regions = list(make_examples.processing_regions_from_options(options))
+  coverage = mean_coverage(options, regions)
+  logging.info('The reads cover %d regions at a mean depth of %.1f',
+               len(regions), coverage)
+  for depth in depths:
+    if depth > coverage:
+      logging.warning('Skipping depth %s, above the coverage %.1f of the reads',
+                      depth, coverage)
+      continue
+    for realign_reads in realign_settings:
+      for n_cores in thread_counts:
+        run_options = deepvariant_pb2.DeepVariantOptions()
+        run_options.CopyFrom(options)
+        run_options.n_cores = n_cores
+        run_options.downsample_fraction = depth / coverage
+        run_options.realigner_enabled = realign_reads
+        logging.info('Benchmarking depth %s, n_cores %d, realign_reads %s',
+                     depth, n_cores, realign_reads)
+        record = {
+            'regions': [ranges.to_literal(region) for region in regions],
+            'depth': depth,
+            'downsample_fraction': run_options.downsample_fraction,
+            'n_cores': n_cores,
+            'realign_reads': realign_reads,
+        }
+        record.update(
+            _run_in_subprocess(benchmark_configuration, run_options, regions))
+        yield record
+
+
+def main(argv=()):
+  with errors.clean_commandline_error_exit():
+    if len(argv) > 1:
+      errors.log_and_raise(
+          'Command line parsing failure: make_examples_benchmark does not '
+          'accept positional arguments but some are present on the command '
+          'line: "{}".'.format(str(argv)), errors.CommandLineError)
+    del argv  # Unused.
+
+    proto_utils.uses_fast_cpp_protos_or_die()
+    logging_level.set_from_flag()
+
+    FLAGS.mode = 'calling'
+    options = make_examples.default_options(add_flags=True, flags=FLAGS)
+    if not options.calling_regions:
+      options.calling_regions.extend(_DEFAULT_REGIONS)
+    options.realigner_options.CopyFrom(realigner.realigner_config(FLAGS))
+    if not options.reference_filename:
+      errors.log_and_raise('ref argument is required.', errors.CommandLineError)
+    if not options.reads_filename:
+      errors.log_and_raise('reads argument is required.',
+                           errors.CommandLineError)
+
+    try:
+      depths = _parse_list(FLAGS.depths, float)
+      thread_counts = _parse_list(FLAGS.thread_counts, int)
+      realign_settings = _parse_list(FLAGS.realign_settings, _parse_bool)
+    except ValueError as e:
+      errors.log_and_raise(
+          'Invalid benchmark configuration: {}'.format(e),
+          errors.CommandLineError)
+    if any(n_cores < 1 for n_cores in thread_counts):
+      errors.log_and_raise('thread_counts must all be at least 1.',
+                           errors.CommandLineError)
+
+    records = benchmark_configurations(options, depths, thread_counts,
+                                       realign_settings)
+    if FLAGS.benchmark_output:
+      with tf.gfile.GFile(FLAGS.benchmark_output, 'w') as f:
+        for record in records:
+          f.write(json.dumps(record, sort_keys=True) + '\n')
+    else:
+      for record in records:
+        print(json.dumps(record, sort_keys=True))
+
+
+if __name__ == '__main__':
+  tf.flags.mark_flags_as_required([
+      'reads',
+      'ref',
+  ])
+  tf.app.run()
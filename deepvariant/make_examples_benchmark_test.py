@@ -0,0 +1,95 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Tests for deepvariant.make_examples_benchmark."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+
+
+from absl.testing import absltest
+import tensorflow as tf
+
+from deepvariant import make_examples
+from deepvariant import make_examples_benchmark
+from deepvariant import test_utils
+from deepvariant.testing import flagsaver
+
+FLAGS = tf.flags.FLAGS
+
+
+def setUpModule():
+  test_utils.init()
+
+
+class MakeExamplesBenchmarkTest(absltest.TestCase):
+
+  def _options(self):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,002,000']
+    FLAGS.mode = 'calling'
+    return make_examples.default_options(add_flags=True)
+
+  @flagsaver.FlagSaver
+  def test_mean_coverage(self):
+    options = self._options()
+    regions = list(make_examples.processing_regions_from_options(options))
+    coverage = make_examples_benchmark.mean_coverage(options, regions)
+    self.assertGreater(coverage, 10)
+    # Requiring a mapping quality above any read's leaves nothing.
+    options.read_requirements.min_mapping_quality = 1000
+    self.assertEqual(
+        make_examples_benchmark.mean_coverage(options, regions), 0.0)
+
+  @flagsaver.FlagSaver
+  def test_benchmark_configurations(self):
+    options = self._options()
+    records = list(
+        make_examples_benchmark.benchmark_configurations(
+            options,
+            depths=[5.0, 1e6],
+            thread_counts=[1, 2],
+            realign_settings=[False, True]))
+    # The depth above the coverage of the reads is skipped.
+    self.assertEqual([(5.0, False, 1), (5.0, False, 2), (5.0, True, 1),
+                      (5.0, True, 2)],
+                     [(record['depth'], record['realign_reads'],
+                       record['n_cores']) for record in records])
+    for record in records:
+      self.assertLess(record['downsample_fraction'], 1.0)
+      self.assertGreater(record['num_reads'], 0)
+      self.assertGreater(record['reads_per_second'], 0)
+      self.assertGreater(record['peak_rss_kb'], 0)
+      self.assertGreaterEqual(record['num_examples'], 0)
+
+
+if __name__ == '__main__':
+  absltest.main()
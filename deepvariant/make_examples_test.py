@@ -358,6 +358,300 @@ class MakeExamplesEnd2EndTest(parameterized.TestCase):
     return examples
 
 
+class MakeExamplesParallelTest(parameterized.TestCase):
+
+  @parameterized.parameters('calling', 'training')
+  @flagsaver.FlagSaver
+  def test_parallel_regions_match_serial(self, mode):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,004,000']
+    FLAGS.partition_size = 500
+    FLAGS.mode = mode
+    # Downsampling and emitting random reference sites draw random numbers in
+    # every region.
+    FLAGS.downsample_fraction = 0.5
+    if mode == 'training':
+      FLAGS.truth_variants = test_utils.TRUTH_VARIANTS_VCF
+      FLAGS.confident_regions = test_utils.CONFIDENT_REGIONS_BED
+      FLAGS.training_random_emit_ref_sites = 0.01
+
+    outputs = {}
+    for n_cores in [1, 3]:
+      FLAGS.n_cores = n_cores
+      FLAGS.examples = test_utils.test_tmpfile(
+          'examples_{}_{}.tfrecord'.format(mode, n_cores))
+      FLAGS.candidates = test_utils.test_tmpfile(
+          'vsc_{}_{}.tfrecord'.format(mode, n_cores))
+      options = make_examples.default_options(add_flags=True)
+      self.assertEqual(options.n_cores, n_cores)
+      make_examples.make_examples_runner(options)
+      outputs[n_cores] = (
+          list(io_utils.read_tfrecords(FLAGS.examples)),
+          list(
+              io_utils.read_tfrecords(
+                  FLAGS.candidates, proto=deepvariant_pb2.DeepVariantCall)))
+
+    # The outputs, including their order, don't depend on the number of
+    # threads.
+    self.assertNotEmpty(outputs[1][0])
+    self.assertEqual(outputs[1], outputs[3])
+
+  @parameterized.parameters('calling', 'training')
+  @flagsaver.FlagSaver
+  def test_prefetched_reads_match_queried_reads(self, mode):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,004,000']
+    FLAGS.partition_size = 500
+    FLAGS.mode = mode
+    FLAGS.n_cores = 1
+    if mode == 'training':
+      FLAGS.truth_variants = test_utils.TRUTH_VARIANTS_VCF
+      FLAGS.confident_regions = test_utils.CONFIDENT_REGIONS_BED
+
+    outputs = {}
+    for prefetch_regions in [0, 2]:
+      FLAGS.prefetch_regions = prefetch_regions
+      FLAGS.examples = test_utils.test_tmpfile(
+          'prefetch_examples_{}_{}.tfrecord'.format(mode, prefetch_regions))
+      options = make_examples.default_options(add_flags=True)
+      self.assertEqual(options.prefetch_regions, prefetch_regions)
+      make_examples.make_examples_runner(options)
+      outputs[prefetch_regions] = list(io_utils.read_tfrecords(FLAGS.examples))
+
+    self.assertNotEmpty(outputs[0])
+    self.assertEqual(outputs[0], outputs[2])
+
+  @parameterized.parameters(1, 3)
+  @flagsaver.FlagSaver
+  def test_read_block_cache_matches_reads(self, n_cores):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,004,000']
+    FLAGS.partition_size = 500
+    FLAGS.mode = 'calling'
+    FLAGS.n_cores = n_cores
+
+    outputs = {}
+    for cache_dir in ['', test_utils.test_tmpfile('block_cache')]:
+      if cache_dir:
+        tf.gfile.MakeDirs(cache_dir)
+      FLAGS.read_block_cache_dir = cache_dir
+      FLAGS.examples = test_utils.test_tmpfile(
+          'block_cache_examples_{}_{}.tfrecord'.format(n_cores,
+                                                       bool(cache_dir)))
+      options = make_examples.default_options(add_flags=True)
+      make_examples.make_examples_runner(options)
+      outputs[bool(cache_dir)] = list(io_utils.read_tfrecords(FLAGS.examples))
+      # The cache is removed once the regions are processed.
+      if cache_dir:
+        self.assertEmpty(tf.gfile.ListDirectory(cache_dir))
+
+    self.assertNotEmpty(outputs[False])
+    self.assertEqual(outputs[False], outputs[True])
+
+  @parameterized.parameters('calling', 'training')
+  @flagsaver.FlagSaver
+  def test_native_pileup_examples_match_python(self, mode):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,004,000']
+    FLAGS.partition_size = 500
+    FLAGS.mode = mode
+    if mode == 'training':
+      FLAGS.truth_variants = test_utils.TRUTH_VARIANTS_VCF
+      FLAGS.confident_regions = test_utils.CONFIDENT_REGIONS_BED
+
+    # None of the candidates here have more reads than fit in an image, so the
+    # native examples are exactly those made one candidate at a time.
+    outputs = {}
+    for threads in [0, 1, 4]:
+      FLAGS.pileup_image_threads = threads
+      FLAGS.examples = test_utils.test_tmpfile(
+          'pileup_threads_examples_{}_{}.tfrecord'.format(mode, threads))
+      options = make_examples.default_options(add_flags=True)
+      self.assertEqual(options.pileup_image_threads, threads)
+      make_examples.make_examples_runner(options)
+      outputs[threads] = list(io_utils.read_tfrecords(FLAGS.examples))
+
+    self.assertNotEmpty(outputs[0])
+    self.assertEqual(outputs[0], outputs[1])
+    self.assertEqual(outputs[0], outputs[4])
+
+  @parameterized.parameters(1, 3)
+  @flagsaver.FlagSaver
+  def test_runtime_metrics_per_region(self, n_cores):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,004,000']
+    FLAGS.partition_size = 500
+    FLAGS.mode = 'calling'
+    FLAGS.n_cores = n_cores
+    # Reads prefetched on another thread aren't timed in their region.
+    FLAGS.prefetch_regions = 0
+    FLAGS.examples = test_utils.test_tmpfile(
+        'runtime_metrics_examples_{}.tfrecord'.format(n_cores))
+    FLAGS.runtime_metrics = test_utils.test_tmpfile(
+        'runtime_metrics_{}.tfrecord'.format(n_cores))
+    options = make_examples.default_options(add_flags=True)
+    make_examples.make_examples_runner(options)
+
+    metrics = list(
+        io_utils.read_tfrecords(
+            FLAGS.runtime_metrics, proto=core_pb2.RuntimeMetrics))
+    self.assertEqual([
+        ranges.to_literal(region)
+        for region in make_examples.processing_regions_from_options(options)
+    ], [region_metrics.region for region_metrics in metrics])
+    all_stages = set()
+    for region_metrics in metrics:
+      self.assertGreater(region_metrics.wall_time_seconds, 0)
+      stages = {time.stage for time in region_metrics.stage_times}
+      self.assertContainsSubset({
+          core_pb2.READ_DECODE, core_pb2.ALLELE_COUNTING,
+          core_pb2.CANDIDATE_CALLING, core_pb2.EXAMPLE_WRITING
+      }, stages)
+      self.assertGreater(region_metrics.region_costs.num_reads, 0)
+      for time in region_metrics.stage_times:
+        self.assertGreater(time.count, 0)
+        self.assertGreaterEqual(time.wall_time_seconds, 0)
+      all_stages |= stages
+    self.assertIn(core_pb2.PILEUP_ENCODING, all_stages)
+
+
+  @flagsaver.FlagSaver
+  def test_runtime_metrics_stage_memory(self):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,004,000']
+    FLAGS.partition_size = 1000
+    FLAGS.mode = 'calling'
+    FLAGS.track_stage_memory = True
+    FLAGS.examples = test_utils.test_tmpfile('stage_memory_examples.tfrecord')
+    FLAGS.runtime_metrics = test_utils.test_tmpfile(
+        'stage_memory_metrics.tfrecord')
+    options = make_examples.default_options(add_flags=True)
+    make_examples.make_examples_runner(options)
+
+    metrics = list(
+        io_utils.read_tfrecords(
+            FLAGS.runtime_metrics, proto=core_pb2.RuntimeMetrics))
+    self.assertEqual(4, len(metrics))
+    peaks = {}
+    for region_metrics in metrics:
+      for memory in region_metrics.stage_memory:
+        self.assertGreaterEqual(memory.peak_bytes, memory.live_bytes)
+        peaks[memory.stage] = max(
+            peaks.get(memory.stage, 0), memory.peak_bytes)
+        # The reads of each region are released once it is processed.
+        if memory.stage == core_pb2.READ_DECODE:
+          self.assertEqual(0, memory.live_bytes)
+    self.assertGreater(peaks[core_pb2.READ_DECODE], 0)
+    self.assertGreater(peaks[core_pb2.ALLELE_COUNTING], 0)
+    self.assertGreater(peaks[core_pb2.PILEUP_ENCODING], 0)
+
+  @flagsaver.FlagSaver
+  def test_resumable_task_matches_uninterrupted_task(self):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,004,000']
+    FLAGS.partition_size = 500
+    FLAGS.mode = 'calling'
+    FLAGS.resumable = True
+    FLAGS.examples = test_utils.test_tmpfile('resumable_examples.tfrecord')
+    FLAGS.candidates = test_utils.test_tmpfile('resumable_vsc.tfrecord')
+    options = make_examples.default_options(add_flags=True)
+    make_examples.make_examples_runner(options)
+
+    def read_outputs():
+      return (list(io_utils.read_tfrecords(FLAGS.examples)),
+              list(
+                  io_utils.read_tfrecords(
+                      FLAGS.candidates, proto=deepvariant_pb2.DeepVariantCall)))
+
+    expected = read_outputs()
+    checkpoint_path = FLAGS.examples + '.checkpoint'
+    entries = make_examples.read_checkpoint(checkpoint_path)
+    regions = list(make_examples.processing_regions_from_options(options))
+    self.assertEqual([ranges.to_literal(region) for region in regions],
+                     [literal for literal, _ in entries])
+    self.assertEqual(len(expected[0]), entries[-1][1][1])
+
+    # Simulate the task being killed partway through its fourth region, with
+    # one more example and a partial record written past the third, and the
+    # fourth region's checkpoint line cut short.
+    n_candidates, n_examples = entries[2][1][:2]
+    for path, records in [(FLAGS.examples, expected[0][:n_examples + 1]),
+                          (FLAGS.candidates, expected[1][:n_candidates])]:
+      with tf.python_io.TFRecordWriter(path) as writer:
+        for record in records:
+          writer.write(record.SerializeToString())
+      with open(path, 'ab') as f:
+        f.write(b'\x10\x00')
+    with tf.gfile.GFile(checkpoint_path, 'w') as f:
+      for literal, counts in entries[:3]:
+        f.write('\t'.join([literal] + [str(count) for count in counts]) + '\n')
+      f.write(ranges.to_literal(regions[3]))
+    self.assertEqual(
+        n_examples + 1, make_examples.count_intact_records(FLAGS.examples, 100))
+
+    with mock.patch.object(
+        make_examples, 'process_regions',
+        wraps=make_examples.process_regions) as mock_process_regions:
+      make_examples.make_examples_runner(options)
+    self.assertEqual(regions[3:], list(mock_process_regions.call_args[0][1]))
+    self.assertEqual(expected, read_outputs())
+    self.assertEqual(entries, make_examples.read_checkpoint(checkpoint_path))
+    self.assertFalse(tf.gfile.Exists(FLAGS.examples + '.resume'))
+
+  @parameterized.parameters(1, 2)
+  @flagsaver.FlagSaver
+  def test_multi_sample_run_matches_single_sample_runs(self, n_cores):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.regions = ['chr20:10,000,000-10,004,000']
+    FLAGS.partition_size = 500
+    FLAGS.mode = 'calling'
+
+    def read_outputs(examples, candidates):
+      return (list(io_utils.read_tfrecords(examples)),
+              list(
+                  io_utils.read_tfrecords(
+                      candidates, proto=deepvariant_pb2.DeepVariantCall)))
+
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.examples = test_utils.test_tmpfile('single_sample_examples.tfrecord')
+    FLAGS.candidates = test_utils.test_tmpfile('single_sample_vsc.tfrecord')
+    make_examples.make_examples_runner(
+        make_examples.default_options(add_flags=True))
+    expected = read_outputs(FLAGS.examples, FLAGS.candidates)
+    self.assertNotEmpty(expected[0])
+
+    # The same reads twice make a cohort whose samples have the same outputs.
+    FLAGS.reads = ','.join([test_utils.CHR20_BAM] * 2)
+    FLAGS.n_cores = n_cores
+    FLAGS.examples = test_utils.test_tmpfile(
+        'multi_sample_examples_{}.{{sample}}.tfrecord'.format(n_cores))
+    FLAGS.candidates = test_utils.test_tmpfile(
+        'multi_sample_vsc_{}.{{sample}}.tfrecord'.format(n_cores))
+    options = make_examples.default_options(add_flags=True)
+    self.assertEqual([test_utils.CHR20_BAM] * 2,
+                     list(options.sample_reads_filenames))
+    self.assertEqual(test_utils.CHR20_BAM, options.reads_filename)
+    samples = make_examples.sample_options(options)
+    self.assertEqual(
+        [FLAGS.examples.format(sample=i) for i in range(2)],
+        [sample.examples_filename for sample in samples])
+    self.assertEqual(['NA12878'] * 2,
+                     [s.variant_caller_options.sample_name for s in samples])
+
+    make_examples.make_examples_runner(options)
+    for sample in samples:
+      self.assertEqual(
+          expected,
+          read_outputs(sample.examples_filename, sample.candidates_filename))
+
+
 class MakeExamplesUnitTest(parameterized.TestCase):
 
   @flagsaver.FlagSaver
@@ -390,6 +684,36 @@ class MakeExamplesUnitTest(parameterized.TestCase):
     self.assertEqual(
         options.variant_caller_options.fraction_reference_sites_to_emit, 0.0)
 
+  @flagsaver.FlagSaver
+  def test_startup_metadata(self):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,010,000']
+    FLAGS.mode = 'calling'
+    FLAGS.examples = ''
+    options = make_examples.default_options(add_flags=True)
+    metadata = make_examples.build_startup_metadata(options)
+    self.assertEqual('NA12878', metadata.sample_name)
+    self.assertEqual(['chr20'], [c.name for c in metadata.contigs])
+
+    FLAGS.startup_metadata = test_utils.test_tmpfile('startup_metadata.pb')
+    make_examples.write_startup_metadata(metadata, FLAGS.startup_metadata)
+    self.assertEqual(metadata,
+                     make_examples.read_startup_metadata(
+                         FLAGS.startup_metadata))
+
+    # A task reading the metadata processes the same regions.
+    cached_options = make_examples.default_options(add_flags=True)
+    self.assertEqual('NA12878',
+                     cached_options.variant_caller_options.sample_name)
+    self.assertEqual(
+        list(make_examples.processing_regions_from_options(options)),
+        list(make_examples.processing_regions_from_options(cached_options)))
+
+    cached_options.reads_filename = 'other.bam'
+    with self.assertRaisesRegexp(ValueError, 'reads_filename'):
+      make_examples.processing_regions_from_options(cached_options)
+
   @flagsaver.FlagSaver
   def test_confident_regions(self):
     FLAGS.ref = test_utils.CHR20_FASTA
@@ -662,6 +986,143 @@ class MakeExamplesUnitTest(parameterized.TestCase):
           task_id=task,
           num_shards=num_shards)
 
+  def test_shard_regions_by_cost_balances_costs(self):
+    regions = [
+        ranges.make_range('chr1', i * 10, i * 10 + 10) for i in range(10)
+    ]
+    costs = [1] * 9 + [9]
+    self.assertEqual(
+        regions[:9],
+        make_examples.shard_regions_by_cost(regions, costs, 0, num_shards=2))
+    self.assertEqual(
+        regions[9:],
+        make_examples.shard_regions_by_cost(regions, costs, 1, num_shards=2))
+
+  def test_shard_regions_by_cost_splits_hot_regions(self):
+    regions = [
+        ranges.make_range('chr1', i * 1000, i * 1000 + 1000) for i in range(4)
+    ]
+    costs = [1, 1, 1, 13]
+    # The last region costs more than the mean of 4, so it is split into 4
+    # pieces, of which the first two balance the other regions.
+    task_regions = [
+        make_examples.shard_regions_by_cost(
+            regions, costs, task_id, num_shards=2, hot_region_cost_factor=1.0)
+        for task_id in range(2)
+    ]
+    self.assertEqual(regions[:3] + [
+        ranges.make_range('chr1', 3000, 3250),
+        ranges.make_range('chr1', 3250, 3500)
+    ], task_regions[0])
+    self.assertEqual([
+        ranges.make_range('chr1', 3500, 3750),
+        ranges.make_range('chr1', 3750, 4000)
+    ], task_regions[1])
+
+  def test_shard_regions_by_cost_fails_with_bad_args(self):
+    regions = [ranges.make_range('chr1', 0, 10)]
+    with self.assertRaises(ValueError):
+      make_examples.shard_regions_by_cost(regions, [1, 2], 0, num_shards=1)
+    with self.assertRaises(ValueError):
+      make_examples.shard_regions_by_cost(regions, [1], 2, num_shards=2)
+
+  def test_region_costs_from_runtime_metrics(self):
+    metrics = [
+        core_pb2.RuntimeMetrics(
+            region=ranges.to_literal(ranges.make_range('chr1', 0, 100)),
+            wall_time_seconds=10),
+        core_pb2.RuntimeMetrics(
+            region=ranges.to_literal(ranges.make_range('chr1', 100, 200)),
+            wall_time_seconds=20),
+    ]
+    regions = [
+        ranges.make_range('chr1', 0, 50),
+        ranges.make_range('chr1', 50, 150),
+        ranges.make_range('chr1', 150, 200),
+        # Not in the metrics, so it gets the median cost.
+        ranges.make_range('chr2', 0, 10),
+    ]
+    self.assertEqual([5, 15, 10, 10],
+                     make_examples.region_costs_from_runtime_metrics(
+                         metrics, regions))
+
+  @flagsaver.FlagSaver
+  def test_shard_regions_by_cost_covers_all_regions(self):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = test_utils.CHR20_BAM
+    FLAGS.regions = ['chr20:10,000,000-10,010,000']
+    FLAGS.partition_size = 1000
+    FLAGS.mode = 'calling'
+    FLAGS.shard_regions_by_cost = True
+    FLAGS.examples = 'examples.tfrecord'
+    unsharded = list(
+        make_examples.processing_regions_from_options(
+            make_examples.default_options(add_flags=True)))
+    FLAGS.examples = 'examples.tfrecord@3'
+    sharded = []
+    for task in range(3):
+      FLAGS.task = task
+      task_regions = make_examples.processing_regions_from_options(
+          make_examples.default_options(add_flags=True))
+      self.assertNotEmpty(task_regions)
+      sharded.extend(task_regions)
+
+    # The tasks cover all of the regions exactly once, in possibly smaller
+    # pieces.
+    def length(regions):
+      return sum(r.end - r.start for r in regions)
+
+    self.assertEqual(length(unsharded), length(sharded))
+    self.assertCountEqual(
+        list(ranges.RangeSet(unsharded)), list(ranges.RangeSet(sharded)))
+
+  @parameterized.parameters((3, [9, 6, 5]), (10, [9, 6, 5, 4, 3, 2, 1, 1]),
+                            (0, []))
+  def test_slowest_regions(self, n, expected_times):
+    slowest_regions = make_examples.SlowestRegions(n)
+    for i, wall_time in enumerate([3, 1, 4, 1, 5, 9, 2, 6]):
+      slowest_regions.add(
+          core_pb2.RuntimeMetrics(
+              region='chr1:{}-{}'.format(i + 1, i + 10),
+              wall_time_seconds=wall_time))
+    slowest = slowest_regions.slowest()
+    self.assertEqual(expected_times,
+                     [metrics.wall_time_seconds for metrics in slowest])
+    if slowest:
+      self.assertEqual('chr1:6-15', slowest[0].region)
+    slowest_regions.log()
+
+  def test_peak_stage_memory(self):
+    peak_stage_memory = make_examples.PeakStageMemory()
+    for region, peaks in [('chr1:1-10', [(core_pb2.READ_DECODE, 100),
+                                         (core_pb2.REALIGNMENT, 20)]),
+                          ('chr1:11-20', [(core_pb2.READ_DECODE, 50),
+                                          (core_pb2.REALIGNMENT, 80)])]:
+      metrics = core_pb2.RuntimeMetrics(region=region)
+      for stage, peak_bytes in peaks:
+        metrics.stage_memory.add(stage=stage, peak_bytes=peak_bytes)
+      peak_stage_memory.add(metrics)
+    self.assertEqual({
+        core_pb2.READ_DECODE: (100, 'chr1:1-10'),
+        core_pb2.REALIGNMENT: (80, 'chr1:11-20'),
+    }, peak_stage_memory.peaks())
+    peak_stage_memory.log()
+
+  @parameterized.parameters(True, False)
+  def test_read_fields_to_parse(self, emit_realigned_reads):
+    options = deepvariant_pb2.DeepVariantOptions()
+    options.realigner_options.diagnostics.emit_realigned_reads = (
+        emit_realigned_reads)
+    fields = make_examples.read_fields_to_parse(options)
+    # The reads we write out keep all of their fields.
+    self.assertEqual(fields.exclude_next_mate_position,
+                     not emit_realigned_reads)
+    self.assertEqual(fields.exclude_fragment_length, not emit_realigned_reads)
+    self.assertFalse(fields.exclude_fragment_name)
+    self.assertFalse(fields.exclude_aligned_sequence)
+    self.assertFalse(fields.exclude_aligned_quality)
+    self.assertFalse(fields.exclude_cigar)
+
   def test_catches_bad_argv(self):
     with mock.patch.object(logging, 'error') as mock_logging,\
         mock.patch.object(sys, 'exit') as mock_exit:
@@ -694,6 +1155,23 @@ class MakeExamplesUnitTest(parameterized.TestCase):
         'confident_regions is required when in training mode.')
     mock_exit.assert_called_once_with(errno.ENOENT)
 
+  @flagsaver.FlagSaver
+  def test_catches_multi_sample_outputs_without_placeholder(self):
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.reads = ','.join([test_utils.CHR20_BAM] * 2)
+    FLAGS.examples = test_utils.test_tmpfile('examples.{sample}.tfrecord')
+    # This is the bad flag.
+    FLAGS.candidates = test_utils.test_tmpfile('vsc.tfrecord')
+    FLAGS.mode = 'calling'
+
+    with mock.patch.object(logging, 'error') as mock_logging,\
+        mock.patch.object(sys, 'exit') as mock_exit:
+      make_examples.main(['make_examples.py'])
+    mock_logging.assert_called_once_with(
+        'With multiple reads, candidates_filename must contain {{sample}} but '
+        'got {}.'.format(FLAGS.candidates))
+    mock_exit.assert_called_once_with(errno.ENOENT)
+
 
 class RegionProcessorTest(parameterized.TestCase):
 
@@ -708,6 +1186,7 @@ class RegionProcessorTest(parameterized.TestCase):
     self.options.mode = deepvariant_pb2.DeepVariantOptions.TRAINING
 
     self.processor = make_examples.RegionProcessor(self.options)
+    self.processor.ref_reader = mock.Mock()
     self.mock_init = self.add_mock('_initialize')
     self.default_shape = [5, 5, 7]
     self.default_format = 'raw'
@@ -777,6 +1256,9 @@ class RegionProcessorTest(parameterized.TestCase):
         'candidates_in_region', retval=([mock_candidate], []))
     mock_cpe = self.add_mock('create_pileup_examples', retval=[mock_example])
     mock_lv = self.add_mock('label_variant')
+    mock_label = mock.Mock()
+    self.processor.labeler = mock.Mock()
+    self.processor.labeler.label_calls.return_value = [mock_label]
     self.assertEqual(([mock_candidate], [mock_example], []),
                      self.processor.process(self.region))
     mock_rr.assert_called_once_with(self.region)
@@ -788,8 +1270,12 @@ class RegionProcessorTest(parameterized.TestCase):
     if mode == deepvariant_pb2.DeepVariantOptions.CALLING:
       # In calling mode, we never try to label.
       test_utils.assert_not_called_workaround(mock_lv)
+      self.processor.labeler.label_calls.assert_not_called()
     else:
-      mock_lv.assert_called_once_with(mock_example, mock_candidate.variant)
+      self.processor.labeler.label_calls.assert_called_once_with(
+          [mock_candidate])
+      mock_lv.assert_called_once_with(mock_example, mock_candidate.variant,
+                                      mock_label)
 
   @parameterized.parameters([
       deepvariant_pb2.DeepVariantOptions.TRAINING,
@@ -807,6 +1293,9 @@ class RegionProcessorTest(parameterized.TestCase):
     mock_cpe = self.add_mock(
         'create_pileup_examples', side_effect=[[e1], [e2, e3]])
     mock_lv = self.add_mock('label_variant')
+    l1, l2 = mock.Mock(), mock.Mock()
+    self.processor.labeler = mock.Mock()
+    self.processor.labeler.label_calls.return_value = [l1, l2]
     self.assertEqual(([c1, c2], [e1, e2, e3], []),
                      self.processor.process(self.region))
     self.processor.in_memory_sam_reader.replace_reads.assert_called_once_with(
@@ -819,9 +1308,9 @@ class RegionProcessorTest(parameterized.TestCase):
       test_utils.assert_not_called_workaround(mock_lv)
     else:
       self.assertEqual([
-          mock.call(e1, c1.variant),
-          mock.call(e2, c2.variant),
-          mock.call(e3, c2.variant)
+          mock.call(e1, c1.variant, l1),
+          mock.call(e2, c2.variant, l2),
+          mock.call(e3, c2.variant, l2)
       ], mock_lv.call_args_list)
 
   def test_process_with_realigner(self):
@@ -845,12 +1334,15 @@ class RegionProcessorTest(parameterized.TestCase):
     self.assertEqual(([c1, c2], [e1, e2, e3], []),
                      self.processor.process(self.region))
     self.processor.sam_reader.query.assert_called_once_with(self.region)
-    self.processor.realigner.realign_reads.assert_called_once_with([],
-                                                                   self.region)
+    self.processor.realigner.realign_reads.assert_called_once_with(
+        [], self.region, costs=mock.ANY)
     self.processor.in_memory_sam_reader.replace_reads.assert_called_once_with(
         [])
     self.assertEqual([mock.call(c1), mock.call(c2)], mock_cpe.call_args_list)
     test_utils.assert_not_called_workaround(mock_lv)
+    self.assertEqual(
+        core_pb2.RegionCosts(num_reads=0, num_candidates=2, num_examples=3),
+        self.processor.last_region_metrics.region_costs)
 
   def test_candidates_in_region_no_reads(self):
     self.processor.in_memory_sam_reader = mock.Mock()
@@ -937,17 +1429,12 @@ class RegionProcessorTest(parameterized.TestCase):
     tvariant = test_utils.make_variant(start=10, alleles=['A', 'C'], gt=[0, 1])
     example = tf_utils.make_example(variant, ['C'], 'foo', self.default_shape,
                                     self.default_format)
-    labeler = mock.Mock()
-    labeler.match = mock.Mock(return_value=[True, tvariant])
-    labeler.match_to_alt_count = mock.Mock(return_value=1)
-    self.processor.labeler = labeler
+    label = deepvariant_pb2.VariantLabel(
+        is_confident=True, truth_variant=tvariant, alt_allele_counts=[1])
 
     labeled = example_pb2.Example()
     labeled.CopyFrom(example)
-    self.processor.label_variant(labeled, variant)
-
-    labeler.match.assert_called_once_with(variant)
-    labeler.match_to_alt_count.assert_called_once_with(variant, tvariant, ['C'])
+    self.assertTrue(self.processor.label_variant(labeled, variant, label))
 
     for key, value in example.features.feature.iteritems():
       self.assertEqual(value, labeled.features.feature[key])
@@ -959,17 +1446,13 @@ class RegionProcessorTest(parameterized.TestCase):
     tvariant = test_utils.make_variant(start=10, alleles=['A', '.'], gt=[0, 0])
     example = tf_utils.make_example(variant, ['.'], 'foo', self.default_shape,
                                     self.default_format)
-
-    labeler = mock.Mock()
-    labeler.match = mock.Mock(return_value=[True, tvariant])
-    self.processor.labeler = labeler
+    # Reference candidates have no alt_allele_counts.
+    label = deepvariant_pb2.VariantLabel(
+        is_confident=True, truth_variant=tvariant)
 
     labeled = example_pb2.Example()
     labeled.CopyFrom(example)
-    self.processor.label_variant(labeled, variant)
-
-    labeler.match.assert_called_once_with(variant)
-    labeler.match_to_alt_count.assert_not_called()
+    self.assertTrue(self.processor.label_variant(labeled, variant, label))
 
     for key, value in example.features.feature.iteritems():
       self.assertEqual(value, labeled.features.feature[key])
@@ -978,11 +1461,11 @@ class RegionProcessorTest(parameterized.TestCase):
 
   def test_label_variant_raises_for_non_confident_variant(self):
     variant = test_utils.make_variant(start=10, alleles=['A', 'C'], gt=[0, 1])
-    self.processor.labeler = mock.Mock()
-    self.processor.labeler.match = mock.Mock(return_value=[False, variant])
+    label = deepvariant_pb2.VariantLabel(
+        is_confident=False, truth_variant=variant)
     example = tf_utils.make_example(variant, ['C'], 'foo', self.default_shape,
                                     self.default_format)
-    self.assertFalse(self.processor.label_variant(example, variant))
+    self.assertFalse(self.processor.label_variant(example, variant, label))
 
 
 if __name__ == '__main__':
@@ -0,0 +1,430 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Microbenchmarks of the native hot paths of make_examples, call_variants and
+// postprocess_variants. The fixtures are built from the testdata BAM and FASTA,
+// with the reads of each region replicated to a synthetic depth given by the
+// argument of the benchmark. Run them with:
+//
+//   bazel run -c opt //deepvariant:native_benchmarks -- --benchmarks=all
+//
+// or select some of them with a regex such as --benchmarks=BM_AlleleCounter.*.
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "deepvariant/allelecounter.h"
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/reference_fai.h"
+#include "deepvariant/core/sam_reader.h"
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/core/vcf_writer.h"
+#include "deepvariant/pileup_image_native.h"
+#include "deepvariant/postprocess_variants.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/realigner/debruijn_graph.h"
+#include "deepvariant/realigner/ssw.h"
+#include "deepvariant/variant_calling.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+namespace {
+
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+using learning::genomics::v1::Variant;
+using learning::genomics::v1::VariantCall;
+using tensorflow::strings::StrCat;
+namespace testing = tensorflow::testing;
+
+constexpr char kTestDataDir[] = "deepvariant/testdata";
+constexpr char kFastaFilename[] = "ucsc.hg19.chr20.unittest.fasta.gz";
+constexpr char kBamFilename[] = "NA12878_S1.chr20.10_10p1mb.bam";
+constexpr char kChrom[] = "chr20";
+
+// A region of the default make_examples partition size with ordinary coverage.
+constexpr int64 kRegionStart = 10000000;
+constexpr int64 kRegionEnd = 10001000;
+
+// The complex region assembled by the realigner tests.
+constexpr int64 kAssemblyStart = 10095379;
+constexpr int64 kAssemblyEnd = 10095500;
+
+const core::GenomeReference& Reference() {
+  static const core::GenomeReference* ref = [] {
+    const string fasta = core::GetTestData(kFastaFilename, kTestDataDir);
+    return core::GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"))
+        .ValueOrDie()
+        .release();
+  }();
+  return *ref;
+}
+
+std::unique_ptr<core::SamReader> OpenReads() {
+  core::SamReaderOptions options;
+  options.set_index_mode(core::IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+  const string bam = core::GetTestData(kBamFilename, kTestDataDir);
+  return std::move(core::SamReader::FromFile(bam, options).ValueOrDie());
+}
+
+// Returns the reads overlapping region at depth times their coverage in the
+// BAM: each read is followed by depth - 1 copies of it under new fragment
+// names, so the reads stay sorted by start.
+std::vector<Read> ReadsAtDepth(const Range& region, int depth) {
+  std::vector<Read> reads;
+  std::shared_ptr<core::SamIterable> query =
+      OpenReads()->Query(region).ValueOrDie();
+  for (const StatusOr<Read*> maybe_read : query) {
+    const Read& read = *maybe_read.ValueOrDie();
+    reads.push_back(read);
+    for (int copy = 1; copy < depth; ++copy) {
+      reads.push_back(read);
+      reads.back().set_fragment_name(StrCat(read.fragment_name(), "_", copy));
+    }
+  }
+  return reads;
+}
+
+// The options make_examples uses by default.
+AlleleCounterOptions MakeAlleleCounterOptions() {
+  AlleleCounterOptions options;
+  options.set_partition_size(kRegionEnd - kRegionStart);
+  options.mutable_read_requirements()->set_min_base_quality(10);
+  options.mutable_read_requirements()->set_min_mapping_quality(10);
+  return options;
+}
+
+VariantCallerOptions MakeVariantCallerOptions() {
+  VariantCallerOptions options;
+  options.set_min_count_snps(2);
+  options.set_min_count_indels(2);
+  options.set_min_fraction_snps(0.12);
+  options.set_min_fraction_indels(0.12);
+  options.set_sample_name("NA12878");
+  options.set_p_error(0.001);
+  options.set_max_gq(50);
+  options.set_gq_resolution(1);
+  options.set_ploidy(2);
+  return options;
+}
+
+// The options of pileup_image.default_options().
+PileupImageOptions MakePileupImageOptions() {
+  PileupImageOptions options;
+  options.set_reference_band_height(5);
+  options.set_base_color_offset_a_and_g(40);
+  options.set_base_color_offset_t_and_c(30);
+  options.set_base_color_stride(70);
+  options.set_allele_supporting_read_alpha(1.0);
+  options.set_allele_unsupporting_read_alpha(0.6);
+  options.set_reference_matching_read_alpha(0.2);
+  options.set_reference_mismatching_read_alpha(1.0);
+  options.set_indel_anchoring_base_char("*");
+  options.set_reference_alpha(0.4);
+  options.set_reference_base_quality(60);
+  options.set_positive_strand_color(70);
+  options.set_negative_strand_color(240);
+  options.set_base_quality_cap(40);
+  options.set_mapping_quality_cap(60);
+  options.set_height(100);
+  options.set_width(221);
+  options.set_read_overlap_buffer_bp(5);
+  options.mutable_read_requirements()->set_min_base_quality(10);
+  options.mutable_read_requirements()->set_min_mapping_quality(10);
+  options.mutable_read_requirements()->set_min_base_quality_mode(
+      core::ReadRequirements::ENFORCED_BY_CLIENT);
+  options.set_multi_allelic_mode(PileupImageOptions::ADD_HET_ALT_IMAGES);
+  options.set_random_seed(2101079370);
+  return options;
+}
+
+// The options of the realigner flags' defaults.
+DeBruijnGraph::Options MakeDeBruijnGraphOptions() {
+  DeBruijnGraph::Options options;
+  options.set_min_k(10);
+  options.set_max_k(100);
+  options.set_step_k(1);
+  options.set_min_mapq(14);
+  options.set_min_base_quality(17);
+  options.set_min_edge_weight(2);
+  options.set_max_num_paths(256);
+  return options;
+}
+
+std::unique_ptr<AlleleCounter> CountAlleles(const Range& region,
+                                            const std::vector<Read>& reads) {
+  std::unique_ptr<AlleleCounter> counter(
+      new AlleleCounter(&Reference(), region, MakeAlleleCounterOptions()));
+  for (const Read& read : reads) counter->Add(read);
+  return counter;
+}
+
+void BM_AlleleCounterAdd(int iters, int depth) {
+  testing::StopTiming();
+  const Range region = core::MakeRange(kChrom, kRegionStart, kRegionEnd);
+  const std::vector<Read> reads = ReadsAtDepth(region, depth);
+  const AlleleCounterOptions options = MakeAlleleCounterOptions();
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    AlleleCounter counter(&Reference(), region, options);
+    for (const Read& read : reads) counter.Add(read);
+  }
+  testing::ItemsProcessed(static_cast<int64>(iters) * reads.size());
+}
+BENCHMARK(BM_AlleleCounterAdd)->Arg(1)->Arg(4)->Arg(16);
+
+void BM_CallsFromAlleleCounter(int iters, int depth) {
+  testing::StopTiming();
+  const Range region = core::MakeRange(kChrom, kRegionStart, kRegionEnd);
+  const std::unique_ptr<AlleleCounter> counter =
+      CountAlleles(region, ReadsAtDepth(region, depth));
+  const VariantCaller caller(MakeVariantCallerOptions());
+  int64 n_calls = 0;
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    n_calls += caller.CallsFromAlleleCounter(*counter).size();
+  }
+  testing::StopTiming();
+  testing::SetLabel(StrCat(n_calls / iters, " candidates"));
+  testing::ItemsProcessed(static_cast<int64>(iters) *
+                          counter->IntervalLength());
+}
+BENCHMARK(BM_CallsFromAlleleCounter)->Arg(1)->Arg(4)->Arg(16);
+
+void BM_EncodeRead(int iters, int depth) {
+  testing::StopTiming();
+  const Range region = core::MakeRange(kChrom, kRegionStart, kRegionEnd);
+  const std::vector<Read> reads = ReadsAtDepth(region, depth);
+  const std::vector<DeepVariantCall> calls =
+      VariantCaller(MakeVariantCallerOptions())
+          .CallsFromAlleleCounter(*CountAlleles(region, reads));
+  const PileupImageOptions options = MakePileupImageOptions();
+  PileupImageEncoderNative encoder(options);
+
+  // The inputs of each image: its reference window and the reads under it.
+  struct Image {
+    const DeepVariantCall* call;
+    int start;
+    string ref_bases;
+    std::vector<const Read*> reads;
+    std::vector<string> alts;
+  };
+  const int half_width = (options.width() - 1) / 2;
+  std::vector<Image> images;
+  int64 n_reads = 0;
+  for (const DeepVariantCall& call : calls) {
+    Image image;
+    image.call = &call;
+    image.start = call.variant().start() - half_width;
+    image.ref_bases =
+        Reference()
+            .GetBases(core::MakeRange(kChrom, image.start,
+                                      image.start + options.width()))
+            .ValueOrDie();
+    for (const Read& read : reads) {
+      if (core::ReadStart(read) < image.start + options.width() &&
+          core::ReadEnd(read) > image.start) {
+        image.reads.push_back(&read);
+      }
+    }
+    image.alts.push_back(call.variant().alternate_bases(0));
+    n_reads += image.reads.size();
+    images.push_back(std::move(image));
+  }
+  int64 n_rows = 0;
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    for (const Image& image : images) {
+      for (const Read* read : image.reads) {
+        n_rows += encoder.EncodeRead(*image.call, image.ref_bases, *read,
+                                     image.start, image.alts) != nullptr;
+      }
+    }
+  }
+  testing::StopTiming();
+  testing::SetLabel(StrCat(images.size(), " candidates, ", n_rows / iters,
+                           " rows"));
+  testing::ItemsProcessed(iters * n_reads);
+}
+BENCHMARK(BM_EncodeRead)->Arg(1)->Arg(4)->Arg(16);
+
+void BM_DeBruijnGraphBuild(int iters, int depth) {
+  testing::StopTiming();
+  const Range region = core::MakeRange(kChrom, kAssemblyStart, kAssemblyEnd);
+  const std::vector<Read> reads = ReadsAtDepth(region, depth);
+  const string ref = Reference().GetBases(region).ValueOrDie();
+  const DeBruijnGraph::Options options = MakeDeBruijnGraphOptions();
+  int64 n_graphs = 0;
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    n_graphs += DeBruijnGraph::Build(ref, reads, options) != nullptr;
+  }
+  testing::StopTiming();
+  testing::SetLabel(n_graphs > 0 ? "assembled" : "no graph");
+  testing::ItemsProcessed(static_cast<int64>(iters) * reads.size());
+}
+BENCHMARK(BM_DeBruijnGraphBuild)->Arg(1)->Arg(4)->Arg(16);
+
+// Aligns the reads of the assembly region to its reference, with the
+// realigner's default scores.
+void BM_SswAlign(int iters, int depth) {
+  testing::StopTiming();
+  const Range region =
+      core::MakeRange(kChrom, kAssemblyStart - 100, kAssemblyEnd + 100);
+  const std::vector<Read> reads = ReadsAtDepth(region, depth);
+  Aligner aligner(4, 6, 8, 1);
+  aligner.SetReferenceSequence(Reference().GetBases(region).ValueOrDie());
+  const Filter filter;
+  Alignment alignment;
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    for (const Read& read : reads) {
+      aligner.Align(read.aligned_sequence(), filter, &alignment);
+    }
+  }
+  testing::ItemsProcessed(static_cast<int64>(iters) * reads.size());
+}
+BENCHMARK(BM_SswAlign)->Arg(1)->Arg(4)->Arg(16);
+
+// Iterates over the reads of a query of kilobases kb long.
+void BM_SamReaderQuery(int iters, int kb) {
+  testing::StopTiming();
+  const std::unique_ptr<core::SamReader> reader = OpenReads();
+  const Range region =
+      core::MakeRange(kChrom, kRegionStart, kRegionStart + kb * 1000);
+  int64 n_reads = 0;
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    std::shared_ptr<core::SamIterable> query =
+        reader->Query(region).ValueOrDie();
+    for (const StatusOr<Read*> maybe_read : query) {
+      TF_CHECK_OK(maybe_read.status());
+      ++n_reads;
+    }
+  }
+  testing::ItemsProcessed(n_reads);
+}
+BENCHMARK(BM_SamReaderQuery)->Arg(1)->Arg(10)->Arg(100);
+
+// Returns n diploid SNP calls of NA12878, one every 10 bases of kChrom.
+std::vector<Variant> MakeVariants(int n) {
+  std::vector<Variant> variants(n);
+  for (int i = 0; i < n; ++i) {
+    Variant& variant = variants[i];
+    variant.set_reference_name(kChrom);
+    variant.set_start(kRegionStart + 10 * i);
+    variant.set_end(variant.start() + 1);
+    variant.set_reference_bases("A");
+    variant.add_alternate_bases("C");
+    variant.set_quality(30.5);
+    variant.add_filter("PASS");
+    VariantCall* call = variant.add_calls();
+    call->set_call_set_name("NA12878");
+    call->add_genotype(0);
+    call->add_genotype(1);
+    for (const double likelihood : {-3.1, -0.01, -4.2}) {
+      call->add_genotype_likelihood(likelihood);
+    }
+  }
+  return variants;
+}
+
+// Writes 10000 variants to a VCF, bgzipped if compressed is 1.
+void BM_VcfWriterWrite(int iters, int compressed) {
+  testing::StopTiming();
+  const std::vector<Variant> variants = MakeVariants(10000);
+  core::VcfWriterOptions options;
+  for (const core::ContigInfo& contig : Reference().Contigs()) {
+    *options.add_contigs() = contig;
+  }
+  options.add_sample_names("NA12878");
+  const string path = core::MakeTempFile(
+      compressed ? "native_benchmarks.vcf.gz" : "native_benchmarks.vcf");
+  for (int i = 0; i < iters; ++i) {
+    std::unique_ptr<core::VcfWriter> writer =
+        std::move(core::VcfWriter::ToFile(path, options).ValueOrDie());
+    testing::StartTiming();
+    for (const Variant& variant : variants) {
+      TF_CHECK_OK(writer->Write(variant));
+    }
+    TF_CHECK_OK(writer->Close());
+    testing::StopTiming();
+  }
+  testing::ItemsProcessed(static_cast<int64>(iters) * variants.size());
+}
+BENCHMARK(BM_VcfWriterWrite)->Arg(0)->Arg(1);
+
+// Sorts thousands * 1000 shuffled single site calls of a TFRecord.
+void BM_ProcessSingleSiteCallTfRecords(int iters, int thousands) {
+  testing::StopTiming();
+  std::vector<CallVariantsOutput> outputs;
+  for (const Variant& variant : MakeVariants(thousands * 1000)) {
+    CallVariantsOutput output;
+    *output.mutable_variant() = variant;
+    output.mutable_alt_allele_indices()->add_indices(0);
+    for (const double probability : {0.01, 0.98, 0.01}) {
+      output.add_genotype_probabilities(probability);
+    }
+    outputs.push_back(output);
+  }
+  std::mt19937 random(2101079370);
+  std::shuffle(outputs.begin(), outputs.end(), random);
+  const string input_path = core::MakeTempFile("native_benchmarks.cvo");
+  const string output_path = core::MakeTempFile("native_benchmarks.sorted");
+  core::WriteProtosToTFRecord(outputs, input_path);
+  const std::vector<core::ContigInfo>& contigs = Reference().Contigs();
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    ProcessSingleSiteCallTfRecords(contigs, {input_path}, output_path,
+                                   /*max_calls_in_memory=*/0,
+                                   /*num_reader_threads=*/1);
+  }
+  testing::ItemsProcessed(static_cast<int64>(iters) * outputs.size());
+}
+BENCHMARK(BM_ProcessSingleSiteCallTfRecords)->Arg(1)->Arg(10)->Arg(100);
+
+}  // namespace
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
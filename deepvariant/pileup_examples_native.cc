@@ -0,0 +1,282 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/pileup_examples_native.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/stage_timer.h"
+#include "deepvariant/core/utils.h"
+#include "tensorflow/core/example/example.pb.h"
+#include "tensorflow/core/example/feature.pb.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/lib/random/philox_random.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+using learning::genomics::v1::Variant;
+using tensorflow::int64;
+using tensorflow::strings::StrCat;
+
+namespace {
+
+// Everything needed to make the examples of one call, gathered on the calling
+// thread so that the tasks encoding images share no mutable state.
+struct CallTask {
+  const DeepVariantCall* dv_call = nullptr;
+  string ref_bases;
+  std::vector<const Read*> reads;
+  std::vector<std::vector<string>> alt_combinations;
+};
+
+// Gets the sets of alt alleles we make an image for, as
+// PileupImageCreator._alt_allele_combinations does. Each set is sorted and
+// without duplicates.
+StatusOr<std::vector<std::vector<string>>> AltAlleleCombinations(
+    const Variant& variant, const PileupImageOptions::MultiAllelicMode mode) {
+  std::vector<std::vector<string>> combinations;
+  switch (mode) {
+    case PileupImageOptions::NO_HET_ALT_IMAGES:
+      for (const string& alt : variant.alternate_bases()) {
+        combinations.push_back({alt});
+      }
+      break;
+    case PileupImageOptions::ADD_HET_ALT_IMAGES: {
+      // All pairs of alleles, without the reference allele.
+      std::vector<string> alleles = {variant.reference_bases()};
+      alleles.insert(alleles.end(), variant.alternate_bases().begin(),
+                     variant.alternate_bases().end());
+      for (size_t i = 0; i < alleles.size(); ++i) {
+        for (size_t j = i + 1; j < alleles.size(); ++j) {
+          std::vector<string> alts;
+          for (const string* allele : {&alleles[i], &alleles[j]}) {
+            if (*allele != variant.reference_bases()) alts.push_back(*allele);
+          }
+          std::sort(alts.begin(), alts.end());
+          alts.erase(std::unique(alts.begin(), alts.end()), alts.end());
+          if (alts.empty()) {
+            return tensorflow::errors::InvalidArgument(
+                "alt_alleles cannot be empty for ", variant.ShortDebugString());
+          }
+          combinations.push_back(std::move(alts));
+        }
+      }
+      break;
+    }
+    default:
+      return tensorflow::errors::InvalidArgument(
+          "multi_allelic_mode cannot be UNSPECIFIED");
+  }
+  return combinations;
+}
+
+// Serializes a tf.Example with the features of tf_utils.make_example.
+string MakeExample(const Variant& variant, const std::vector<string>& alts,
+                   const PileupImage& image) {
+  tensorflow::Example example;
+  auto& features = *example.mutable_features()->mutable_feature();
+  features["locus"].mutable_bytes_list()->add_value(
+      StrCat(variant.reference_name(), ":", variant.start() + 1, "-",
+             variant.end()));
+  features["variant/encoded"].mutable_bytes_list()->add_value(
+      variant.SerializeAsString());
+
+  // The index of each alt is that of its first occurrence in the variant.
+  CallVariantsOutput::AltAlleleIndices alt_indices;
+  const auto& all_alts = variant.alternate_bases();
+  std::vector<int> indices;
+  for (const string& alt : alts) {
+    indices.push_back(std::find(all_alts.begin(), all_alts.end(), alt) -
+                      all_alts.begin());
+  }
+  std::sort(indices.begin(), indices.end());
+  for (const int index : indices) {
+    alt_indices.add_indices(index);
+  }
+  features["alt_allele_indices/encoded"].mutable_bytes_list()->add_value(
+      alt_indices.SerializeAsString());
+
+  features["image/encoded"].mutable_bytes_list()->add_value(
+      string(image.data.begin(), image.data.end()));
+  features["image/format"].mutable_bytes_list()->add_value("raw");
+  auto* shape = features["image/shape"].mutable_int64_list();
+  if (image.planar) {
+    shape->add_value(kNumChannels);
+    shape->add_value(image.height);
+    shape->add_value(image.width);
+  } else {
+    shape->add_value(image.height);
+    shape->add_value(image.width);
+    shape->add_value(kNumChannels);
+  }
+  return example.SerializeAsString();
+}
+
+}  // namespace
+
+PileupExamplesCreatorNative::PileupExamplesCreatorNative(
+    const PileupImageOptions& options, const int num_threads)
+    : options_(options), encoder_(options) {
+  if (num_threads > 1) {
+    pool_.reset(new tensorflow::thread::ThreadPool(
+        tensorflow::Env::Default(), "pileup_examples", num_threads));
+  }
+}
+
+StatusOr<std::vector<std::vector<string>>>
+PileupExamplesCreatorNative::CreateExamples(
+    const core::GenomeReference* ref,
+    const std::vector<DeepVariantCall>& dv_calls,
+    const std::vector<Read>& reads) const {
+  return CreateExamplesWithIndex(ref, dv_calls, reads, core::ReadIndex(reads));
+}
+
+StatusOr<std::vector<std::vector<string>>>
+PileupExamplesCreatorNative::CreateExamples(
+    const core::GenomeReference* ref,
+    const std::vector<DeepVariantCall>& dv_calls,
+    const core::RegionReads& reads) const {
+  return CreateExamplesWithIndex(ref, dv_calls, reads.reads(), reads.index());
+}
+
+StatusOr<std::vector<std::vector<string>>>
+PileupExamplesCreatorNative::CreateExamplesWithIndex(
+    const core::GenomeReference* ref,
+    const std::vector<DeepVariantCall>& dv_calls,
+    const std::vector<Read>& reads, const core::ReadIndex& read_index) const {
+  core::ScopedStageTimer timer(core::PILEUP_ENCODING);
+  if (options_.height() < options_.reference_band_height()) {
+    return tensorflow::errors::InvalidArgument(
+        "Image height must be at least the reference band height");
+  }
+  const int half_width = (options_.width() - 1) / 2;
+  const int64 buffer = options_.read_overlap_buffer_bp();
+
+  std::vector<CallTask> tasks(dv_calls.size());
+  for (size_t i = 0; i < dv_calls.size(); ++i) {
+    const Variant& variant = dv_calls[i].variant();
+    const Range window =
+        core::MakeRange(variant.reference_name(), variant.start() - half_width,
+                        variant.start() - half_width + options_.width());
+    if (!ref->IsValidInterval(window)) continue;
+
+    CallTask& task = tasks[i];
+    TF_RETURN_IF_ERROR(ref->GetBasesInto(window, &task.ref_bases));
+    if (task.ref_bases.empty()) continue;
+    if (variant.reference_bases().size() == 1 &&
+        task.ref_bases[half_width] != variant.reference_bases()[0]) {
+      return tensorflow::errors::InvalidArgument(
+          "center of refbases doesnt match variant.refbases ",
+          variant.ShortDebugString());
+    }
+    StatusOr<std::vector<std::vector<string>>> combinations =
+        AltAlleleCombinations(variant, options_.multi_allelic_mode());
+    TF_RETURN_IF_ERROR(combinations.status());
+    task.alt_combinations = std::move(combinations.ValueOrDie());
+    task.dv_call = &dv_calls[i];
+
+    // The reads overlapping the call padded by read_overlap_buffer_bp, in
+    // their input order, as from PileupImageCreator.get_reads.
+    for (const int r : read_index.Query(
+             core::MakeRange(variant.reference_name(), variant.start() - buffer,
+                             variant.end() + buffer))) {
+      task.reads.push_back(&reads[r]);
+    }
+  }
+
+  std::vector<std::vector<string>> examples(dv_calls.size());
+  auto encode = [this, &tasks, &examples](const int i) {
+    const CallTask& task = tasks[i];
+    const Variant& variant = task.dv_call->variant();
+    tensorflow::random::PhiloxRandom philox(
+        options_.random_seed(),
+        tensorflow::Hash64Combine(tensorflow::Hash64(variant.reference_name()),
+                                  variant.start()));
+    tensorflow::random::SimplePhilox random(&philox);
+    for (const std::vector<string>& alts : task.alt_combinations) {
+      const std::unique_ptr<PileupImage> image = encoder_.EncodePileup(
+          *task.dv_call, task.ref_bases, task.reads, alts, &random);
+      examples[i].push_back(MakeExample(variant, alts, *image));
+      core::AddStageMemory(core::PILEUP_ENCODING, examples[i].back().size());
+    }
+  };
+
+  // The cost of a call grows with its reads, so we start the calls with the
+  // most reads first to keep a single large call from finishing last.
+  std::vector<int> order;
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    if (tasks[i].dv_call != nullptr) order.push_back(i);
+  }
+  if (pool_ == nullptr) {
+    for (const int i : order) encode(i);
+  } else {
+    std::stable_sort(order.begin(), order.end(), [&tasks](int a, int b) {
+      return tasks[a].reads.size() > tasks[b].reads.size();
+    });
+    tensorflow::BlockingCounter pending(order.size());
+    for (const int i : order) {
+      pool_->Schedule([&encode, &pending, i] {
+        encode(i);
+        pending.DecrementCount();
+      });
+    }
+    pending.Wait();
+  }
+  // The examples are owned by our caller from here on.
+  if (core::StageMemoryTrackingEnabled()) {
+    int64 example_bytes = 0;
+    for (const std::vector<string>& call_examples : examples) {
+      for (const string& example : call_examples) {
+        example_bytes += example.size();
+      }
+    }
+    core::AddStageMemory(core::PILEUP_ENCODING, -example_bytes);
+  }
+  return examples;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
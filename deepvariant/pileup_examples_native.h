@@ -0,0 +1,117 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Creates the pileup image tf.Examples of all of the candidates of a region in
+// one native call.
+//
+// make_examples.RegionProcessor.create_pileup_examples builds the examples of
+// one candidate at a time, so a region with many candidates (e.g. HLA or
+// pericentromeric sequence) is encoded serially and becomes the long tail of
+// a task. PileupExamplesCreatorNative takes all of the candidates of a region
+// and its reads, and encodes the images of different candidates in parallel
+// on a thread pool, returning serialized tf.Examples with the same features
+// as tf_utils.make_example.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_PILEUP_EXAMPLES_NATIVE_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_PILEUP_EXAMPLES_NATIVE_H_
+
+#include <memory>
+#include <vector>
+
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/read_index.h"
+#include "deepvariant/core/reference.h"
+#include "deepvariant/core/region_reads.h"
+#include "deepvariant/pileup_image_native.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using tensorflow::string;
+
+class PileupExamplesCreatorNative {
+ public:
+  // Creates examples with the pileup images described by options, encoding
+  // them on num_threads threads. If num_threads <= 1 the images are encoded on
+  // the calling thread.
+  PileupExamplesCreatorNative(const PileupImageOptions& options,
+                              int num_threads);
+
+  // Creates the examples of each of dv_calls, whose pileup images are made
+  // from the reads of reads overlapping the call and from the bases of ref.
+  // The result has one element per call, in order, holding the serialized
+  // tf.Example of each of its alt allele combinations in the order of
+  // PileupImageCreator._alt_allele_combinations. The element is empty if the
+  // image window of the call is off the edge of its contig.
+  //
+  // The images are those of PileupImageCreator.create_pileup_images, except
+  // that when a call has more reads than fit in its images they are
+  // downsampled with a generator seeded from options.random_seed and the
+  // position of the call, so the examples don't depend on the number of
+  // threads or on the other calls of the region. Returns a non-ok status if
+  // the options or one of dv_calls is invalid.
+  StatusOr<std::vector<std::vector<string>>> CreateExamples(
+      const core::GenomeReference* ref,
+      const std::vector<DeepVariantCall>& dv_calls,
+      const std::vector<learning::genomics::v1::Read>& reads) const;
+
+  // Same as CreateExamples() above, with the reads of reads, whose index is
+  // reused rather than built again for each call.
+  StatusOr<std::vector<std::vector<string>>> CreateExamples(
+      const core::GenomeReference* ref,
+      const std::vector<DeepVariantCall>& dv_calls,
+      const core::RegionReads& reads) const;
+
+ private:
+  // The body of both CreateExamples() methods, where index is a ReadIndex of
+  // reads.
+  StatusOr<std::vector<std::vector<string>>> CreateExamplesWithIndex(
+      const core::GenomeReference* ref,
+      const std::vector<DeepVariantCall>& dv_calls,
+      const std::vector<learning::genomics::v1::Read>& reads,
+      const core::ReadIndex& index) const;
+
+  const PileupImageOptions options_;
+  const PileupImageEncoderNative encoder_;
+
+  // nullptr if we encode on the calling thread.
+  std::unique_ptr<tensorflow::thread::ThreadPool> pool_;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_PILEUP_EXAMPLES_NATIVE_H_
@@ -159,6 +159,13 @@ class PileupImageCreator(object):
     self._ref_reader = ref_reader
     self._sam_reader = sam_reader
     self._random = np.random.RandomState(self._options.random_seed)
+    # If True, build_pileup encodes whole images with a single native call
+    # whenever no reads need to be downsampled.
+    self._use_native_pileup = True
+
+  def reseed(self, random_seed):
+    """Resets the random state used to downsample reads to random_seed."""
+    self._random = np.random.RandomState(random_seed)
 
   def __getattr__(self, attr):
     """Gets attributes from self._options as though they are our attributes."""
@@ -283,6 +290,16 @@ class PileupImageCreator(object):
                        self.half_width, refbases[self.half_width],
                        dv_call.variant)
 
+    # If all of the reads fit in the image, no sampling is needed and the
+    # native encoder can produce the entire image in one call. Otherwise we
+    # assemble the image row by row below, so that reads are downsampled with
+    # our RandomState.
+    if self._use_native_pileup:
+      reads = list(reads)
+      if len(reads) <= self.max_reads:
+        return self._encoder.encode_pileup(dv_call, refbases, reads,
+                                           alt_alleles)
+
     # We start with n copies of our encoded reference bases.
     rows = (
         [self._encoder.encode_reference(refbases)] * self.reference_band_height)
@@ -315,7 +332,10 @@ class PileupImageCreator(object):
 
     # Vertically stack the image rows to create a single
     # h x w x DEFAULT_NUM_CHANNEL image.
-    return np.vstack(rows)
+    image = np.vstack(rows)
+    if self._options.layout == deepvariant_pb2.PileupImageOptions.CHW:
+      image = np.ascontiguousarray(np.transpose(image, (2, 0, 1)))
+    return image
 
   def create_pileup_images(self, dv_call):
     """Creates a DeepVariant TF.Example for the DeepVariant call dv_call.
@@ -330,7 +350,7 @@ class PileupImageCreator(object):
       A list of tuples. The first element of the tuple is a set of alternate
       alleles used as 'alt' when encoding this image. The second element is a
       [w, h, DEFAULT_NUM_CHANNEL] uint8 Tensor of the pileup image for those
-      alt alleles.
+      alt alleles, or [DEFAULT_NUM_CHANNEL, h, w] if options.layout is CHW.
     """
     variant = dv_call.variant
     ref = self.get_reference_bases(variant)
@@ -32,16 +32,23 @@
 #include "deepvariant/pileup_image_native.h"
 
 #include <algorithm>
+#include <array>
+#include <cstring>
 #include <iterator>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <vector>
 
+#include "deepvariant/core/cigar.h"
 #include "deepvariant/core/genomics/cigar.pb.h"
 #include "deepvariant/core/genomics/position.pb.h"
 #include "deepvariant/core/genomics/reads.pb.h"
 #include "deepvariant/core/genomics/variants.pb.h"
 #include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/read_view.h"
+#include "deepvariant/core/stage_timer.h"
+#include "deepvariant/utils.h"
 #include "tensorflow/core/platform/logging.h"
 
 using learning::genomics::v1::Read;
@@ -58,19 +65,31 @@ using tensorflow::uint8;
 
 namespace {
 
+// Returns pointers to each of reads, in order.
+std::vector<const Read*> ReadPointers(const std::vector<Read>& reads) {
+  std::vector<const Read*> pointers;
+  pointers.reserve(reads.size());
+  for (const Read& read : reads) {
+    pointers.push_back(&read);
+  }
+  return pointers;
+}
+
 // Does this read support one of the alternative alleles?
+//
+// This is the slow path for encoding a single read, which has to look at every
+// supporting read name of dv_call. EncodeReads() instead interns its reads and
+// uses integer lookups. read is a Read proto or ReadView.
+template <typename ReadT>
 inline bool ReadSupportsAlt(const DeepVariantCall& dv_call,
-                            const Read& read,
+                            const ReadT& read,
                             const std::vector<string>& alt_alleles) {
-  string key = (read.fragment_name() + "/" +
-                std::to_string(read.read_number()));
+  const string key = ReadKey(read);
+  const auto& allele_support = dv_call.allele_support();
   for (const string& alt_allele : alt_alleles) {
-    const auto& allele_support = dv_call.allele_support();
-    const bool alt_allele_present_in_call =
-        allele_support.find(alt_allele) != allele_support.cend();
-    if (alt_allele_present_in_call) {
-      const auto& supp_read_names = allele_support.at(alt_allele).read_names();
-      for (const string& read_name : supp_read_names) {
+    const auto it = allele_support.find(alt_allele);
+    if (it != allele_support.cend()) {
+      for (const string& read_name : it->second.read_names()) {
         if (read_name == key) return true;
       }
     }
@@ -108,11 +127,73 @@ int ImageRow::Width() const {
   return base.size();
 }
 
+PileupImage::PileupImage(int height, int width)
+    : height(height), width(width), data(height * width * kNumChannels, 0) {
+  memory.Set(data.capacity());
+}
+
+void PileupImage::ToPlanar() {
+  if (planar) return;
+  const int plane_size = height * width;
+  std::vector<unsigned char> planes(data.size());
+  // Each plane is written sequentially, reading its channel of every pixel
+  // with a constant stride, which the compiler vectorizes.
+  for (int channel = 0; channel < kNumChannels; ++channel) {
+    const unsigned char* in = data.data() + channel;
+    unsigned char* out = planes.data() + channel * plane_size;
+    for (int i = 0; i < plane_size; ++i) {
+      out[i] = in[i * kNumChannels];
+    }
+  }
+  data.swap(planes);
+  planar = true;
+}
+
+namespace {
+
+// Gets the color of value from lut, clamping value into its indices.
+inline uint8 LookupColor(const std::array<uint8, 256>& lut, int value) {
+  return lut[std::max(0, std::min(value, 255))];
+}
+
+// Copies the interleaved pixel values of one row into an ImageRow.
+std::unique_ptr<ImageRow> ImageRowFromPixels(
+    const std::vector<unsigned char>& pixels) {
+  const int width = pixels.size() / kNumChannels;
+  std::unique_ptr<ImageRow> img_row(new ImageRow(width));
+  const unsigned char* cur = pixels.data();
+  for (int i = 0; i < width; ++i) {
+    img_row->base[i]               = *cur++;
+    img_row->base_quality[i]       = *cur++;
+    img_row->mapping_quality[i]    = *cur++;
+    img_row->on_positive_strand[i] = *cur++;
+    img_row->supports_alt[i]       = *cur++;
+    img_row->matches_ref[i]        = *cur++;
+    img_row->op_len[i]             = *cur++;
+  }
+  return img_row;
+}
+
+}  // namespace
+
 PileupImageEncoderNative::PileupImageEncoderNative(
     const PileupImageOptions& options)
-    : options_(options) {
+    : options_(options), philox_(options.random_seed()), random_(&philox_) {
     CHECK((options_.width() % 2 == 1) && options_.width() >= 3)
         << "Width must be odd; found " << options_.width();
+
+    // Precompute the colors of every possible pixel value once, so encoding a
+    // read is just table lookups.
+    for (int i = 0; i < 256; ++i) {
+      base_colors_[i] = BaseColor(static_cast<char>(i));
+      base_quality_colors_[i] = BaseQualityColor(i);
+      mapping_quality_colors_[i] = MappingQualityColor(i);
+    }
+    for (const bool b : {false, true}) {
+      strand_colors_[b] = StrandColor(b);
+      supports_alt_colors_[b] = SupportsAltColor(b);
+      matches_ref_colors_[b] = MatchesRefColor(b);
+    }
 }
 
 // Gets the pixel color (int) for a base.
@@ -176,149 +257,317 @@ PileupImageEncoderNative::EncodeRead(const DeepVariantCall& dv_call,
                                      const Read& read,
                                      int image_start_pos,
                                      const vector<string>& alt_alleles) {
-  ImageRow img_row(ref_bases.size());
-  const bool supports_alt = ReadSupportsAlt(dv_call, read, alt_alleles);
-  const int mapping_quality = read.alignment().mapping_quality();
-  const bool is_forward_strand = !read.alignment().position().reverse_strand();
-  const uint8 alt_color = SupportsAltColor(supports_alt);
-  const uint8 mapping_color = MappingQualityColor(mapping_quality);
-  const uint8 strand_color = StrandColor(is_forward_strand);
+  core::ScopedStageTimer timer(core::PILEUP_ENCODING);
+  return EncodeReadWithSupport(dv_call, ref_bases, read, image_start_pos,
+                               ReadSupportsAlt(dv_call, read, alt_alleles));
+}
+
+std::unique_ptr<ImageRow>
+PileupImageEncoderNative::EncodeRead(const DeepVariantCall& dv_call,
+                                     const string& ref_bases,
+                                     const core::ReadView& read,
+                                     int image_start_pos,
+                                     const vector<string>& alt_alleles) {
+  return EncodeReadWithSupport(dv_call, ref_bases, read, image_start_pos,
+                               ReadSupportsAlt(dv_call, read, alt_alleles));
+}
+
+std::vector<bool> PileupImageEncoderNative::ReadsSupportingAlt(
+    const DeepVariantCall& dv_call, const std::vector<const Read*>& reads,
+    const vector<string>& alt_alleles) const {
+  // Each read gets an id once, after which checking if it supports our alt
+  // alleles is a binary search over the sorted ids of the supporting reads.
+  ReadIdInterner read_ids;
+  std::vector<int> ids;
+  ids.reserve(reads.size());
+  for (const Read* read : reads) {
+    ids.push_back(read_ids.Intern(*read));
+  }
+  const std::vector<int> supporting =
+      SupportingReadIds(dv_call, alt_alleles, read_ids);
+
+  std::vector<bool> supports_alt(reads.size());
+  for (size_t i = 0; i < reads.size(); ++i) {
+    supports_alt[i] =
+        std::binary_search(supporting.begin(), supporting.end(), ids[i]);
+  }
+  return supports_alt;
+}
+
+std::vector<std::unique_ptr<ImageRow>>
+PileupImageEncoderNative::EncodeReads(const DeepVariantCall& dv_call,
+                                      const string& ref_bases,
+                                      const std::vector<Read>& reads,
+                                      int image_start_pos,
+                                      const vector<string>& alt_alleles) {
+  const std::vector<bool> supports_alt =
+      ReadsSupportingAlt(dv_call, ReadPointers(reads), alt_alleles);
+  std::vector<std::unique_ptr<ImageRow>> rows;
+  rows.reserve(reads.size());
+  for (size_t i = 0; i < reads.size(); ++i) {
+    rows.push_back(EncodeReadWithSupport(dv_call, ref_bases, reads[i],
+                                         image_start_pos, supports_alt[i]));
+  }
+  return rows;
+}
+
+std::unique_ptr<PileupImage>
+PileupImageEncoderNative::EncodePileup(const DeepVariantCall& dv_call,
+                                       const string& ref_bases,
+                                       const std::vector<Read>& reads,
+                                       const vector<string>& alt_alleles) {
+  return EncodePileup(dv_call, ref_bases, ReadPointers(reads), alt_alleles,
+                      &random_);
+}
+
+std::unique_ptr<PileupImage> PileupImageEncoderNative::EncodePileup(
+    const DeepVariantCall& dv_call, const string& ref_bases,
+    const std::vector<const Read*>& reads, const vector<string>& alt_alleles,
+    tensorflow::random::SimplePhilox* random) const {
+  CHECK_EQ(static_cast<int>(ref_bases.size()), options_.width())
+      << "ref_bases must be options.width bases long";
+  CHECK_GE(options_.height(), options_.reference_band_height())
+      << "Image height must be at least the reference band height";
+  // Images of the default width, which are almost all of the images we make,
+  // are drawn by code where the width is a constant.
+  if (options_.width() == kDefaultPileupWidth) {
+    return EncodePileupOfWidth<kDefaultPileupWidth>(dv_call, ref_bases, reads,
+                                                    alt_alleles, random);
+  }
+  return EncodePileupOfWidth<0>(dv_call, ref_bases, reads, alt_alleles,
+                                random);
+}
+
+template <int kWidth>
+std::unique_ptr<PileupImage> PileupImageEncoderNative::EncodePileupOfWidth(
+    const DeepVariantCall& dv_call, const string& ref_bases,
+    const std::vector<const Read*>& reads, const vector<string>& alt_alleles,
+    tensorflow::random::SimplePhilox* random) const {
+  const int width = kWidth > 0 ? kWidth : ref_bases.size();
+  const int row_size = width * kNumChannels;
+  const int ref_band_height = options_.reference_band_height();
+  const int max_reads = options_.height() - ref_band_height;
+  const int image_start_pos =
+      dv_call.variant().start() - (options_.width() - 1) / 2;
+
+  std::unique_ptr<PileupImage> image(
+      new PileupImage(options_.height(), width));
+
+  // The reference band is a single encoded row copied ref_band_height times.
+  if (ref_band_height > 0) {
+    EncodeReferencePixels<kWidth>(ref_bases, image->Row(0));
+    for (int row = 1; row < ref_band_height; ++row) {
+      std::memcpy(image->Row(row), image->Row(0), row_size);
+    }
+  }
+
+  // Visit the reads sorted by their alignment start. The sort is stable so
+  // reads starting at the same position keep their input order.
+  std::vector<int> order(reads.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&reads](int a, int b) {
+    return reads[a]->alignment().position().position() <
+           reads[b]->alignment().position().position();
+  });
+  const std::vector<bool> supports_alt =
+      ReadsSupportingAlt(dv_call, reads, alt_alleles);
+
+  // Encoded reads fill the rows below the reference band in order. Once all
+  // max_reads rows are used, each further read is drawn into scratch and
+  // replaces a random row with the probability of reservoir sampling. The
+  // read index drawn into each row is kept so the rows can be put back in
+  // alignment order afterwards.
+  std::vector<unsigned char> scratch;
+  std::vector<int> row_reads;
+  row_reads.reserve(std::min<size_t>(max_reads, reads.size()));
+  int n_encoded = 0;
+  for (const int i : order) {
+    const bool have_free_row = n_encoded < max_reads;
+    if (!have_free_row) scratch.assign(row_size, 0);
+    unsigned char* pixels = have_free_row
+                                ? image->Row(ref_band_height + n_encoded)
+                                : scratch.data();
+    if (!EncodeReadPixels<kWidth>(dv_call, ref_bases, *reads[i],
+                                  image_start_pos, supports_alt[i], pixels)) {
+      std::memset(pixels, 0, row_size);
+      continue;
+    }
+    if (have_free_row) {
+      row_reads.push_back(i);
+    } else {
+      const int j = random->Uniform(n_encoded + 1);
+      if (j < max_reads) {
+        std::memcpy(image->Row(ref_band_height + j), scratch.data(),
+                    row_size);
+        row_reads[j] = i;
+      }
+    }
+    ++n_encoded;
+  }
+
+  // Replaced rows are out of order, so sort them by the position of their
+  // reads. Only needed when we downsampled.
+  if (n_encoded > max_reads) {
+    std::vector<int> rows(row_reads.size());
+    std::iota(rows.begin(), rows.end(), 0);
+    std::stable_sort(rows.begin(), rows.end(), [&](int a, int b) {
+      return reads[row_reads[a]]->alignment().position().position() <
+             reads[row_reads[b]]->alignment().position().position();
+    });
+    const std::vector<unsigned char> sampled(
+        image->Row(ref_band_height), image->Row(ref_band_height) +
+                                         rows.size() * row_size);
+    for (size_t row = 0; row < rows.size(); ++row) {
+      std::memcpy(image->Row(ref_band_height + row),
+                  &sampled[rows[row] * row_size], row_size);
+    }
+  }
+
+  if (options_.layout() == PileupImageOptions::CHW) image->ToPlanar();
+  return image;
+}
+
+template <typename ReadT>
+std::unique_ptr<ImageRow>
+PileupImageEncoderNative::EncodeReadWithSupport(const DeepVariantCall& dv_call,
+                                                const string& ref_bases,
+                                                const ReadT& read,
+                                                int image_start_pos,
+                                                bool supports_alt) {
+  std::vector<unsigned char> pixels(ref_bases.size() * kNumChannels, 0);
+  if (!EncodeReadPixels<0>(dv_call, ref_bases, read, image_start_pos,
+                           supports_alt, pixels.data())) {
+    return nullptr;
+  }
+  return ImageRowFromPixels(pixels);
+}
+
+template <int kWidth, typename ReadT>
+bool PileupImageEncoderNative::EncodeReadPixels(const DeepVariantCall& dv_call,
+                                                const string& ref_bases,
+                                                const ReadT& read,
+                                                int image_start_pos,
+                                                bool supports_alt,
+                                                unsigned char* pixels) const {
+  // With a constant width the bounds check of each pixel is against a
+  // constant.
+  const size_t width = kWidth > 0 ? kWidth : ref_bases.size();
+  const int mapping_quality = core::ReadMappingQuality(read);
+  const bool is_forward_strand = !core::ReadIsReverseStrand(read);
+  const uint8 alt_color = supports_alt_colors_[supports_alt];
+  const uint8 mapping_color = LookupColor(mapping_quality_colors_,
+                                          mapping_quality);
+  const uint8 strand_color = strand_colors_[is_forward_strand];
   const int min_base_quality = options_.read_requirements().min_base_quality();
+  const int64 call_start = dv_call.variant().start();
+  const char anchor_base = options_.indel_anchoring_base_char()[0];
 
-  // Handler for each component of the CIGAR string, as subdivided
-  // according the rules below.
-  // Side effect: draws in img_row
+  // Draws read_base, at ref_i on the genome and read_i in the read, into our
+  // row of pixels if it falls within the image.
   // Return value: true on normal exit; false if we determine that we
   // have a low quality base at the call position (in which case we
   // should return null) from EncodeRead.
-  std::function<bool(int, int, const CigarUnit::Operation&, int)>
-  action_per_cigar_unit = [&](int ref_i,
-                              int read_i,
-                              const CigarUnit::Operation& cigar_op,
-                              int cigar_op_len) {
-    char read_base = 0;
-    if (cigar_op == CigarUnit::INSERT) {
-      // redacted
-      read_base = options_.indel_anchoring_base_char()[0];
-    } else if (cigar_op == CigarUnit::DELETE) {
-      ref_i -= 1;  // Adjust anchor base on reference
-      read_base = options_.indel_anchoring_base_char()[0];
-    } else if (cigar_op == CigarUnit::ALIGNMENT_MATCH ||
-               cigar_op == CigarUnit::SEQUENCE_MATCH  ||
-               cigar_op == CigarUnit::SEQUENCE_MISMATCH) {
-      read_base = read.aligned_sequence()[read_i];
-    }
-
+  const auto draw = [&](int64 ref_i, int read_i, char read_base,
+                        int cigar_op_len) {
     size_t col = ref_i - image_start_pos;
-    if (read_base && 0 <= col && col < ref_bases.size()) {
-      int base_quality = read.aligned_quality(read_i);
+    if (read_base && 0 <= col && col < width) {
+      int base_quality = core::ReadQualityAt(read, read_i);
       int qual = std::min(base_quality, mapping_quality);
-      if (ref_i == dv_call.variant().start() && qual < min_base_quality) {
+      if (ref_i == call_start && qual < min_base_quality) {
         return false;
       }
       bool matches_ref = (read_base == ref_bases[col]);
 
       // Draw the pixel
-      img_row.base[col]               = BaseColor(read_base);
-      img_row.base_quality[col]       = BaseQualityColor(base_quality);
-      img_row.mapping_quality[col]    = mapping_color;
-      img_row.on_positive_strand[col] = strand_color;
-      img_row.supports_alt[col]       = alt_color;
-      img_row.matches_ref[col]        = MatchesRefColor(matches_ref);
-      img_row.op_len[col]             = cigar_op_len;
+      unsigned char* pixel = pixels + col * kNumChannels;
+      pixel[0] = base_colors_[static_cast<unsigned char>(read_base)];
+      pixel[1] = LookupColor(base_quality_colors_, base_quality);
+      pixel[2] = mapping_color;
+      pixel[3] = strand_color;
+      pixel[4] = alt_color;
+      pixel[5] = matches_ref_colors_[matches_ref];
+      pixel[6] = cigar_op_len;
     }
     return true;
   };
 
   // In the following, we iterate over alignment information for each
-  // base of read, invoking action_per_cigar_unit for every segment of
-  // the alignment.
+  // base of read, drawing every segment of the alignment.
   //
   // The handling of each cigar element type is given below, assuming
   // it has length n.
   //
   // ALIGNMENT_MATCH, SEQUENCE_MATCH, SEQUENCE_MISMATCH:
-  //   Provide a segment ref_i, read_i for each of the n bases in the
-  //   operator, where ref_i is the position on the genome where this
-  //   base aligns.
+  //   Draws each of the n bases in the operator at ref_i, read_i, where
+  //   ref_i is the position on the genome where this base aligns.
   //
-  // INSERT, CLIP_SOFT:
-  //   Provides a single ref_i, read_i segment regardless of n. ref_i
-  //   is set to the preceding base of the insertion; i.e., the anchor
-  //   base. Beware that ref_i could be -1 if the insertion is aligned
-  //   to the first base of a contig.  read_i points to the first base
-  //   of the insertion. So if our cigar is 1M2I1M for a read starting
-  //   at S, we'd see first (S, 0, '1M'), followed by one (S, 1,
-  //   '2I'), and then (S + 1, 3, '1M').
+  // INSERT:
+  //   Draws a single indel anchoring base regardless of n. ref_i is set to
+  //   the preceding base of the insertion; i.e., the anchor base. Beware that
+  //   ref_i could be -1 if the insertion is aligned to the first base of a
+  //   contig. read_i points to the first base of the insertion. So if our
+  //   cigar is 1M2I1M for a read starting at S, we'd draw first (S, 0, '1M'),
+  //   followed by one (S, 1, '2I'), and then (S + 1, 3, '1M').
   //
-  // DELETE, SKIP:
-  //   Provides a single ref_i, read_i segment regardless of n. ref_i
-  //   is set to the first base of the deletion, just like in an
-  //   ALIGNMENT_MATCH. read_i points to the previous base in the
-  //   read, as there's no actual read sequence associated with a
-  //   deletion. Beware that read_i could be -1 if the deletion is the
-  //   first cigar of the read. So if our cigar is 1M2D1M for a read
-  //   starting at S, we'd see first (S, 0, '1M'), followed by one (S
-  //   + 1, 0, '2D'), and then (S + 3, 1, '1M').
+  // DELETE:
+  //   Draws a single indel anchoring base regardless of n. ref_i is set to
+  //   the base preceding the deletion and read_i points to the previous base
+  //   in the read, as there's no actual read sequence associated with a
+  //   deletion. Beware that read_i could be -1 if the deletion is the first
+  //   cigar of the read. So if our cigar is 1M2D1M for a read starting at S,
+  //   we'd draw first (S, 0, '1M'), followed by one (S, 0, '2D'), and then
+  //   (S + 3, 1, '1M').
   //
-  // CLIP_HARD, PAD:
-  //   These operators are ignored by as they don't impact the
-  //   alignment of the read w.r.t. the reference.
+  // CLIP_SOFT, SKIP, CLIP_HARD, PAD:
+  //   Nothing is drawn for these operators.
   //
   // Any other CIGAR op:
   //   Fatal error, at present; later we should fail with a status encoding.
-  int ref_i = read.alignment().position().position();
-  int read_i = 0;
-  bool ok = true;
-
-  for (const auto& cigar_elt : read.alignment().cigar()) {
-    const CigarUnit::Operation& op = cigar_elt.operation();
-    int op_len = cigar_elt.operation_length();
-
+  //
+  // We bail out as soon as we find this read has a low-quality base at the
+  // call site.
+  return core::WalkCigar(read, [&](const CigarUnit::Operation op,
+                                   const int op_len, const int64 ref_pos,
+                                   const int read_offset) {
     switch (op) {
       case CigarUnit::ALIGNMENT_MATCH:
       case CigarUnit::SEQUENCE_MATCH:
       case CigarUnit::SEQUENCE_MISMATCH:
-        // Alignment op.
-        for (int i = 0; i < op_len; i++) {
-          ok = ok && action_per_cigar_unit(ref_i, read_i, op, op_len);
-          ref_i++;
-          read_i++;
+        for (int i = 0; i < op_len; ++i) {
+          if (!draw(ref_pos + i, read_offset + i,
+                    core::ReadBaseAt(read, read_offset + i), op_len)) {
+            return false;
+          }
         }
-        break;
+        return true;
       case CigarUnit::INSERT:
-      case CigarUnit::CLIP_SOFT:
-        // Insert op.
-        ok = action_per_cigar_unit(ref_i - 1, read_i, op, op_len);
-        read_i += op_len;
-        break;
+        return draw(ref_pos - 1, read_offset, anchor_base, op_len);
       case CigarUnit::DELETE:
+        return draw(ref_pos - 1, read_offset - 1, anchor_base, op_len);
+      case CigarUnit::CLIP_SOFT:
       case CigarUnit::SKIP:
-        // Delete op.
-        ok = action_per_cigar_unit(ref_i, read_i - 1, op, op_len);
-        ref_i += op_len;
-        break;
       case CigarUnit::CLIP_HARD:
       case CigarUnit::PAD:
-        // Ignored ops.  Do nothing.
-        break;
+        return true;
       default:
         LOG(FATAL) << "Unrecognized CIGAR op";
+        return false;
     }
-
-    // Bail out if we found this read had a low-quality base at the
-    // call site.
-    if (!ok) {
-      return nullptr;
-    }
-  }
-
-  return std::unique_ptr<ImageRow>(new ImageRow(img_row));
+  });
 }
 
-
 std::unique_ptr<ImageRow>
 PileupImageEncoderNative::EncodeReference(const string& ref_bases) {
+  core::ScopedStageTimer timer(core::PILEUP_ENCODING);
+  std::vector<unsigned char> pixels(ref_bases.size() * kNumChannels);
+  EncodeReferencePixels<0>(ref_bases, pixels.data());
+  return ImageRowFromPixels(pixels);
+}
+
+template <int kWidth>
+void PileupImageEncoderNative::EncodeReferencePixels(
+    const string& ref_bases, unsigned char* pixels) const {
+  const size_t width = kWidth > 0 ? kWidth : ref_bases.size();
   int ref_qual = options_.reference_base_quality();
   uint8 base_quality_color = BaseQualityColor(ref_qual);
   uint8 mapping_quality_color = MappingQualityColor(ref_qual);
@@ -327,18 +576,16 @@ PileupImageEncoderNative::EncodeReference(const string& ref_bases) {
   uint8 alt_color = SupportsAltColor(false);
   uint8 ref_color = MatchesRefColor(true);
 
-  ImageRow img_row(ref_bases.size());
-  for (size_t i = 0; i < ref_bases.size(); ++i) {
-    img_row.base[i]               = BaseColor(ref_bases[i]);
-    img_row.base_quality[i]       = base_quality_color;
-    img_row.mapping_quality[i]    = mapping_quality_color;
-    img_row.on_positive_strand[i] = strand_color;
-    img_row.supports_alt[i]       = alt_color;
-    img_row.matches_ref[i]        = ref_color;
-    img_row.op_len[i]             = 0;
+  unsigned char* cur = pixels;
+  for (size_t i = 0; i < width; ++i) {
+    *cur++ = base_colors_[static_cast<unsigned char>(ref_bases[i])];
+    *cur++ = base_quality_color;
+    *cur++ = mapping_quality_color;
+    *cur++ = strand_color;
+    *cur++ = alt_color;
+    *cur++ = ref_color;
+    *cur++ = 0;
   }
-
-  return std::unique_ptr<ImageRow>(new ImageRow(img_row));
 }
 
 
@@ -32,11 +32,15 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_PILEUP_IMAGE_NATIVE_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_PILEUP_IMAGE_NATIVE_H_
 
+#include <array>
 #include <memory>
 #include <vector>
 
 #include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/read_view.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace learning {
@@ -45,6 +49,16 @@ namespace deepvariant {
 
 using tensorflow::string;
 
+// The number of channels of each pixel in our pileup images, in the order:
+// base, base_quality, mapping_quality, on_positive_strand, supports_alt,
+// matches_ref, op_len.
+constexpr int kNumChannels = 7;
+
+// The width of the pileup images of our default options. EncodePileup() has
+// code compiled for images of this width, where the sizes of the rows and the
+// bounds of every pixel are constants.
+constexpr int kDefaultPileupWidth = 221;
+
 struct ImageRow {
   std::vector<unsigned char> base;
   std::vector<unsigned char> base_quality;
@@ -58,6 +72,32 @@ struct ImageRow {
   explicit ImageRow(int width);
 };
 
+// A whole pileup image, stored as one contiguous buffer of height x width x
+// kNumChannels pixel values in row-major (HWC) order. This is the layout of
+// the image/encoded tensor in our TF examples. Images encoded with the CHW
+// layout are planar instead: kNumChannels planes of height x width values,
+// and Row() must not be used on them.
+struct PileupImage {
+  int height;
+  int width;
+  bool planar = false;
+  std::vector<unsigned char> data;
+  // Accounts the bytes of data while the image lives.
+  core::ScopedStageMemory memory{core::PILEUP_ENCODING};
+
+  // Gets a pointer to the first pixel value of row.
+  unsigned char* Row(int row) { return &data[row * width * kNumChannels]; }
+  const unsigned char* Row(int row) const {
+    return &data[row * width * kNumChannels];
+  }
+
+  // Creates an all-zero image of height x width pixels.
+  PileupImage(int height, int width);
+
+  // Rewrites data from HWC into CHW order, in a single pass over the image.
+  void ToPlanar();
+};
+
 class PileupImageEncoderNative {
  public:
   // Essential API methods.
@@ -69,9 +109,55 @@ class PileupImageEncoderNative {
       const string& ref_bases, const learning::genomics::v1::Read& read,
       int image_start_pos, const std::vector<string>& alt_alleles);
 
+  // Encode the read viewed by read into a row of pixels, exactly as the
+  // EncodeRead() above does for the Read proto of the same record.
+  std::unique_ptr<ImageRow> EncodeRead(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases, const core::ReadView& read,
+      int image_start_pos, const std::vector<string>& alt_alleles);
+
+  // Encode each of reads into a row of pixels for our image. The result has
+  // one element per read, in order, which is nullptr if the read could not be
+  // encoded (as in EncodeRead). This is much faster than calling EncodeRead()
+  // on each read as the alt allele support of the reads is resolved once, by
+  // integer read id, instead of by comparing read names for every read.
+  std::vector<std::unique_ptr<ImageRow>> EncodeReads(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases,
+      const std::vector<learning::genomics::v1::Read>& reads,
+      int image_start_pos, const std::vector<string>& alt_alleles);
+
   // Encode the reference bases into a single row of pixels.
   std::unique_ptr<ImageRow> EncodeReference(const string& ref_bases);
 
+  // Encode a whole pileup image for dv_call, with the same layout as the image
+  // assembled row by row in pileup_image.py: reference_band_height rows of
+  // ref_bases, followed by one row for each read that can be encoded, sorted
+  // by alignment start, followed by empty rows up to the image height. If more
+  // than height - reference_band_height reads can be encoded the rows are
+  // reservoir sampled down using an RNG seeded with options.random_seed.
+  //
+  // ref_bases must be options.width bases long and centered on the start of
+  // dv_call.variant. All pixels are written directly into the returned image,
+  // so there are no per-read allocations. If options.layout is CHW the image
+  // is returned planar.
+  std::unique_ptr<PileupImage> EncodePileup(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases,
+      const std::vector<learning::genomics::v1::Read>& reads,
+      const std::vector<string>& alt_alleles);
+
+  // Encodes the same image as EncodePileup() above from pointers to the reads,
+  // drawing the random numbers used to downsample them from random instead of
+  // from our own generator. This doesn't modify the encoder, so several threads
+  // can encode images with one encoder at once, each with its own random.
+  std::unique_ptr<PileupImage> EncodePileup(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases,
+      const std::vector<const learning::genomics::v1::Read*>& reads,
+      const std::vector<string>& alt_alleles,
+      tensorflow::random::SimplePhilox* random) const;
+
  public:
   // Get the pixel color (int) for a base.
   int BaseColor(char base) const;
@@ -89,7 +175,64 @@ class PileupImageEncoderNative {
   int MappingQualityColor(int mapping_qual) const;
 
  private:
+  // Returns, for each of reads, whether it supports one of our alt alleles.
+  std::vector<bool> ReadsSupportingAlt(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const std::vector<const learning::genomics::v1::Read*>& reads,
+      const std::vector<string>& alt_alleles) const;
+
+  // The body of EncodePileup(), specialized for images kWidth pixels wide, or
+  // for images of any width if kWidth is 0.
+  template <int kWidth>
+  std::unique_ptr<PileupImage> EncodePileupOfWidth(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases,
+      const std::vector<const learning::genomics::v1::Read*>& reads,
+      const std::vector<string>& alt_alleles,
+      tensorflow::random::SimplePhilox* random) const;
+
+  // Draws read, a Read proto or ReadView, into pixels, a row of
+  // ref_bases.size() * kNumChannels values that must be all zero on entry,
+  // given whether the read supports our alt alleles. Returns false if the read
+  // has a low quality base at the call, in which case pixels may have been
+  // partially written. If kWidth isn't 0, ref_bases must be kWidth bases long.
+  template <int kWidth, typename ReadT>
+  bool EncodeReadPixels(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases, const ReadT& read, int image_start_pos,
+      bool supports_alt, unsigned char* pixels) const;
+
+  // Draws ref_bases into pixels, a row of ref_bases.size() * kNumChannels
+  // values. If kWidth isn't 0, ref_bases must be kWidth bases long.
+  template <int kWidth>
+  void EncodeReferencePixels(const string& ref_bases,
+                             unsigned char* pixels) const;
+
+  // Encodes read into a row of pixels, given whether the read supports our alt
+  // alleles. Returns nullptr if the read has a low quality base at the call.
+  template <typename ReadT>
+  std::unique_ptr<ImageRow> EncodeReadWithSupport(
+      const learning::genomics::deepvariant::DeepVariantCall& dv_call,
+      const string& ref_bases, const ReadT& read, int image_start_pos,
+      bool supports_alt);
+
   const PileupImageOptions options_;
+
+  // Lookup tables of the pixel colors produced by BaseColor(),
+  // BaseQualityColor() and MappingQualityColor() for every char or quality
+  // value up to 255, and by the color functions taking a bool indexed by it.
+  std::array<tensorflow::uint8, 256> base_colors_;
+  std::array<tensorflow::uint8, 256> base_quality_colors_;
+  std::array<tensorflow::uint8, 256> mapping_quality_colors_;
+  std::array<tensorflow::uint8, 2> strand_colors_;
+  std::array<tensorflow::uint8, 2> supports_alt_colors_;
+  std::array<tensorflow::uint8, 2> matches_ref_colors_;
+
+  // Used by EncodePileup() to downsample reads. Like the RandomState of
+  // PileupImageCreator, this is seeded once so successive images get
+  // different samples.
+  tensorflow::random::PhiloxRandom philox_;
+  tensorflow::random::SimplePhilox random_;
 };
 
 
@@ -417,6 +417,8 @@ class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
     self.mock_enc_read = mock_encoder.encode_read
 
     self.pic._encoder = mock_encoder
+    # These tests check the row by row assembly of the image.
+    self.pic._use_native_pileup = False
 
   def assertImageMatches(self, actual_image, *row_names):
     """Checks that actual_image matches an image from constructed row_names."""
@@ -489,6 +491,91 @@ class PileupImageCreatorEncodePileupTest(parameterized.TestCase):
     self.assertImageMatches(image, 'ref', 'ref', 'read1', 'read4')
 
 
+class PileupImageNativeEncodePileupTest(parameterized.TestCase):
+  """Tests that the native encode_pileup matches build_pileup."""
+
+  def setUp(self):
+    self.dv_call = _make_dv_call(ref_bases='A', alt_bases='C')
+    self.ref = 'GGACT'
+
+    def _read(bases, start, cigar, name, quals=None):
+      return test_utils.make_read(
+          bases, start=start, cigar=cigar, name=name,
+          quals=quals or [30] * len(bases))
+
+    self.reads = [
+        _read('GGACT', 8, '5M', 'read2'),
+        _read('GACT', 9, '4M', 'read3'),
+        _read('GCACT', 8, '5M', 'read1'),
+        _read('GGACT', 8, '5M', 'lowq', quals=[30, 30, 1, 30, 30]),
+        _read('GAGCT', 9, '2M2I1M', 'read4'),
+    ]
+
+  def _make_creator(self, use_native_pileup, width=5, **kwargs):
+    pic = _make_image_creator(None, None, width=width, **kwargs)
+    pic._use_native_pileup = use_native_pileup
+    return pic
+
+  @parameterized.parameters(
+      dict(height=10, reference_band_height=5),
+      dict(height=6, reference_band_height=2),
+      dict(height=5, reference_band_height=1),
+  )
+  def test_native_image_matches_rows(self, **kwargs):
+    for alts in [{'C'}, {'G'}]:
+      self.dv_call.variant.alternate_bases[:] = list(alts)
+      expected = self._make_creator(False, **kwargs).build_pileup(
+          self.dv_call, self.ref, self.reads, alts)
+      actual = self._make_creator(False, **kwargs)._encoder.encode_pileup(
+          self.dv_call, self.ref, self.reads, alts)
+      self.assertEqual(actual.dtype, np.uint8)
+      npt.assert_equal(actual, expected)
+      npt.assert_equal(
+          self._make_creator(True, **kwargs).build_pileup(
+              self.dv_call, self.ref, self.reads, alts), expected)
+
+  def test_native_image_of_default_width_matches_rows(self):
+    # Images of the default width are drawn by code specialized for it.
+    width = pileup_image.default_options().width
+    flank = 'C' * ((width - len(self.ref)) // 2)
+    ref = flank + self.ref + flank
+    expected = self._make_creator(False, width=width).build_pileup(
+        self.dv_call, ref, self.reads, {'C'})
+    actual = self._make_creator(False, width=width)._encoder.encode_pileup(
+        self.dv_call, ref, self.reads, {'C'})
+    self.assertEqual(actual.shape[1], width)
+    npt.assert_equal(actual, expected)
+
+  def test_native_image_of_chw_layout_is_planar(self):
+    chw = deepvariant_pb2.PileupImageOptions.CHW
+    hwc_image = self._make_creator(False, height=10).build_pileup(
+        self.dv_call, self.ref, self.reads, {'C'})
+    for use_native_pileup in [True, False]:
+      chw_image = self._make_creator(
+          use_native_pileup, height=10, layout=chw).build_pileup(
+              self.dv_call, self.ref, self.reads, {'C'})
+      self.assertEqual(chw_image.shape,
+                       (pileup_image.DEFAULT_NUM_CHANNEL, 10, 5))
+      self.assertTrue(chw_image.flags['C_CONTIGUOUS'])
+      npt.assert_equal(chw_image, np.transpose(hwc_image, (2, 0, 1)))
+
+  def test_native_image_downsamples_reads(self):
+    pic = self._make_creator(True, height=4, reference_band_height=1)
+    image = pic._encoder.encode_pileup(self.dv_call, self.ref, self.reads,
+                                       {'C'})
+    self.assertEqual(image.shape, (4, 5, pileup_image.DEFAULT_NUM_CHANNEL))
+    npt.assert_equal(image[0:1], pic._encoder.encode_reference(self.ref))
+    # All rows are filled, each with a read that could be encoded.
+    encodable = [
+        pic._encoder.encode_read(self.dv_call, self.ref, read, 8, {'C'})
+        for read in self.reads
+    ]
+    encodable = [row for row in encodable if row is not None]
+    for row in range(1, 4):
+      self.assertTrue(
+          any(np.array_equal(image[row:row + 1], r) for r in encodable))
+
+
 class PileupImageCreatorTest(parameterized.TestCase):
 
   def setUp(self):
@@ -31,37 +31,445 @@
 
 #include "deepvariant/postprocess_variants.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <queue>
+#include <set>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "deepvariant/call_variants_output.h"
+#include "deepvariant/core/contig_ids.h"
 #include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/math.h"
 #include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/reference.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/core/utils.h"
+#include "deepvariant/core/vcf_writer.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "google/protobuf/util/message_differencer.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/io/compression.h"
 #include "tensorflow/core/lib/io/record_reader.h"
 #include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/logging.h"
 
 namespace learning {
 namespace genomics {
 namespace deepvariant {
 
+namespace tf = tensorflow;
+
+using learning::genomics::v1::ListValue;
+using learning::genomics::v1::Variant;
+using learning::genomics::v1::VariantCall;
+
+const char* const kRefCallFilter = "RefCall";
+const char* const kLowQualFilter = "LowQual";
+const char* const kPassFilter = "PASS";
+
 namespace {
 
-void SortSingleSiteCalls(const std::vector<core::ContigInfo>& contigs,
-                         std::vector<CallVariantsOutput>* calls) {
-  std::vector<CallVariantsOutput> output;
-  if (calls->empty()) {
-    return;
+// The bits of a sort key holding the variant's start; those above hold its
+// contig's pos_in_fasta.
+constexpr int kStartBits = 40;
+
+// A serialized CallVariantsOutput with the fields of its variant that
+// CompareVariants orders by, its contig and start packed into one key, so
+// sorting touches neither protos nor strings.
+struct SortableCall {
+  uint64 key;
+  int64 end;
+  string data;
+};
+
+// Accounts the memory of a vector of calls, whose data holds data_bytes.
+void AccountCalls(const std::vector<SortableCall>& calls, int64 data_bytes,
+                  core::ScopedStageMemory* memory) {
+  memory->Set(calls.capacity() * sizeof(SortableCall) + data_bytes);
+}
+
+// Finds the pos_in_fasta of the contigs of a run by name. It takes no lock,
+// so the threads of the run share one built up front.
+class ContigPositions {
+ public:
+  explicit ContigPositions(const std::vector<core::ContigInfo>& contigs)
+      : ids_(contigs),
+        contig_id_to_pos_in_fasta_(core::MapContigIdToPosInFasta(contigs)) {}
+
+  // Returns the pos_in_fasta of the contig name, or -1 if it isn't one of the
+  // contigs of the run.
+  int Find(StringPiece name) const {
+    const int contig_id = ids_.Find(name);
+    return contig_id < 0 ? -1 : contig_id_to_pos_in_fasta_[contig_id];
+  }
+
+ private:
+  const core::ContigIdMap ids_;
+  const std::vector<int> contig_id_to_pos_in_fasta_;
+};
+
+bool CallPrecedes(const SortableCall& a, const SortableCall& b) {
+  return a.key != b.key ? a.key < b.key : a.end < b.end;
+}
+
+// Reads the key fields of the variant of a serialized record, as
+// ScanCallVariantsOutputKey and ScanVariantKey do.
+typedef bool (*VariantKeyScanner)(StringPiece data,
+                                  CallVariantsOutputKey* key);
+
+// Sets *call from the serialized record data, whose variant's key is read by
+// scan_key, keeping data as is for the output.
+void ParseCall(const ContigPositions& contig_positions,
+               VariantKeyScanner scan_key, string data, SortableCall* call) {
+  CallVariantsOutputKey variant;
+  QCHECK(scan_key(data, &variant)) << "Failed to parse the variant of a record";
+  // Here we assume each variant has only 1 call.
+  QCHECK_EQ(variant.num_calls, 1);
+  const int pos_in_fasta = contig_positions.Find(variant.reference_name);
+  QCHECK(pos_in_fasta >= 0)
+      << "Reference name " << variant.reference_name
+      << " not in contig info.";
+  QCHECK(pos_in_fasta < (1 << (64 - kStartBits)))
+      << "Too many contigs to sort by";
+  QCHECK(variant.start >= 0 && variant.start < (int64{1} << kStartBits))
+      << "Variant start out of range: " << variant.start;
+  call->key = static_cast<uint64>(pos_in_fasta) << kStartBits |
+              static_cast<uint64>(variant.start);
+  call->end = variant.end;
+  call->data = std::move(data);
+}
+
+// The records of a TFRecord file, read in order.
+class TfRecordSource {
+ public:
+  explicit TfRecordSource(const string& path) {
+    TF_CHECK_OK(tensorflow::Env::Default()->NewRandomAccessFile(path, &file_));
+    const char* const option = core::EndsWith(path, ".gz")
+                                   ? tensorflow::io::compression::kGzip
+                                   : tensorflow::io::compression::kNone;
+    reader_.reset(new tensorflow::io::RecordReader(
+        file_.get(),
+        tensorflow::io::RecordReaderOptions::CreateRecordReaderOptions(
+            option)));
+  }
+
+  // Sets *data to the next record, returning false at the end of the file.
+  bool Next(string* data) { return reader_->ReadRecord(&offset_, data).ok(); }
+
+ private:
+  std::unique_ptr<tensorflow::RandomAccessFile> file_;
+  std::unique_ptr<tensorflow::io::RecordReader> reader_;
+  uint64 offset_ = 0;
+};
+
+// A TFRecord file being written, compressed if its path ends in .gz.
+class TfRecordSink {
+ public:
+  explicit TfRecordSink(const string& path) {
+    TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(path, &file_));
+    const char* const option = core::EndsWith(path, ".gz")
+                                   ? tensorflow::io::compression::kGzip
+                                   : tensorflow::io::compression::kNone;
+    writer_.reset(new tensorflow::io::RecordWriter(
+        file_.get(),
+        tensorflow::io::RecordWriterOptions::CreateRecordWriterOptions(
+            option)));
+  }
+
+  ~TfRecordSink() {
+    TF_CHECK_OK(writer_->Flush()) << "Failed to flush the output writer.";
+    TF_CHECK_OK(file_->Close()) << "Failed to close the output file.";
+  }
+
+  void Write(StringPiece data) {
+    tensorflow::Status writer_status = writer_->WriteRecord(data);
+    QCHECK(writer_status.ok())
+        << "Failed to write serialized proto to output_writer. "
+        << "Status = " << writer_status.error_message();
+  }
+
+ private:
+  std::unique_ptr<tensorflow::WritableFile> file_;
+  std::unique_ptr<tensorflow::io::RecordWriter> writer_;
+};
+
+// Spilled runs store each call as its sort key followed by its data, so
+// merging them doesn't parse the calls again.
+constexpr size_t kRunKeySize = sizeof(uint64) + sizeof(int64);
+
+void EncodeRunRecord(const SortableCall& call, string* record) {
+  record->resize(kRunKeySize + call.data.size());
+  char* key = &(*record)[0];
+  std::memcpy(key, &call.key, sizeof(uint64));
+  std::memcpy(key + sizeof(uint64), &call.end, sizeof(int64));
+  record->replace(kRunKeySize, string::npos, call.data);
+}
+
+void DecodeRunRecord(const string& record, SortableCall* call) {
+  QCHECK_GE(record.size(), kRunKeySize) << "Corrupt sorted run record";
+  const char* key = record.data();
+  std::memcpy(&call->key, key, sizeof(uint64));
+  std::memcpy(&call->end, key + sizeof(uint64), sizeof(int64));
+  call->data.assign(record, kRunKeySize, string::npos);
+}
+
+// Sorted runs of calls spilled to local temporary files.
+class SortedRuns {
+ public:
+  SortedRuns() = default;
+  SortedRuns(const SortedRuns&) = delete;
+  SortedRuns& operator=(const SortedRuns&) = delete;
+
+  ~SortedRuns() {
+    run_.reset();
+    for (const string& path : paths_) {
+      tensorflow::Env::Default()->DeleteFile(path).IgnoreError();
+    }
+  }
+
+  bool empty() const { return paths_.empty(); }
+
+  // Takes over the runs of other, after those of this.
+  void Append(SortedRuns* other) {
+    other->run_.reset();
+    run_.reset();
+    paths_.insert(paths_.end(), other->paths_.begin(), other->paths_.end());
+    other->paths_.clear();
   }
+
+  // Spills the sorted calls, appending them to the last run if they follow
+  // it, as they do when the input is already sorted.
+  void Spill(const std::vector<SortableCall>& calls) {
+    if (calls.empty()) {
+      return;
+    }
+    if (run_ == nullptr || CallPrecedes(calls.front(), last_)) {
+      run_.reset();
+      string path;
+      QCHECK(tensorflow::Env::Default()->LocalTempFilename(&path))
+          << "Failed to create a temporary file for sorting calls";
+      paths_.push_back(path);
+      run_.reset(new TfRecordSink(path));
+    }
+    string record;
+    for (const SortableCall& call : calls) {
+      EncodeRunRecord(call, &record);
+      run_->Write(record);
+    }
+    last_.key = calls.back().key;
+    last_.end = calls.back().end;
+  }
+
+  // Merges the runs into output, equal calls keeping their input order.
+  void MergeInto(TfRecordSink* output) {
+    run_.reset();
+    LOG(INFO) << "Merging " << paths_.size() << " sorted runs";
+    std::vector<std::unique_ptr<TfRecordSource>> sources;
+    std::vector<SortableCall> heads(paths_.size());
+    // The runs with calls left, as a min-heap of their heads, earlier runs
+    // first among equal calls.
+    auto later = [&heads](int a, int b) {
+      if (CallPrecedes(heads[a], heads[b])) return false;
+      if (CallPrecedes(heads[b], heads[a])) return true;
+      return a > b;
+    };
+    std::priority_queue<int, std::vector<int>, decltype(later)> heap(later);
+    string record;
+    for (size_t i = 0; i < paths_.size(); ++i) {
+      sources.emplace_back(new TfRecordSource(paths_[i]));
+      if (sources[i]->Next(&record)) {
+        DecodeRunRecord(record, &heads[i]);
+        heap.push(i);
+      }
+    }
+    while (!heap.empty()) {
+      const int i = heap.top();
+      heap.pop();
+      output->Write(heads[i].data);
+      if (sources[i]->Next(&record)) {
+        DecodeRunRecord(record, &heads[i]);
+        heap.push(i);
+      }
+    }
+  }
+
+ private:
+  std::vector<string> paths_;
+  // The run being written, and its last call's key.
+  std::unique_ptr<TfRecordSink> run_;
+  SortableCall last_;
+};
+
+// Sorts calls, stably.  The calls of each call_variants output come in runs
+// that are already sorted, one per contig of each make_examples shard, so
+// rather than sorting them from scratch we find those runs and merge them,
+// which takes one pass when the calls are all sorted already.
+void SortSingleSiteCalls(std::vector<SortableCall>* calls) {
+  // The start of each run, and the end of the last one.
+  std::vector<size_t> bounds = {0};
+  for (size_t i = 1; i < calls->size(); ++i) {
+    if (CallPrecedes((*calls)[i], (*calls)[i - 1])) bounds.push_back(i);
+  }
+  bounds.push_back(calls->size());
+  // Merges adjacent pairs of runs until one is left; inplace_merge is stable
+  // and the earlier run comes first, so equal calls keep their input order.
+  while (bounds.size() > 2) {
+    std::vector<size_t> merged = {0};
+    for (size_t i = 2; i < bounds.size(); i += 2) {
+      std::inplace_merge(calls->begin() + bounds[i - 2],
+                         calls->begin() + bounds[i - 1],
+                         calls->begin() + bounds[i], CallPrecedes);
+      merged.push_back(bounds[i]);
+    }
+    if (merged.back() != calls->size()) merged.push_back(calls->size());
+    bounds.swap(merged);
+  }
+}
+
+// The number of calls read between the updates of their memory.
+constexpr int kCallsPerMemoryUpdate = 4096;
+
+// The body of ProcessSingleSiteCallTfRecords and
+// ProcessNonVariantSiteTfRecords, sorting records whose variants are read by
+// scan_key.
+void SortVariantTfRecords(const std::vector<core::ContigInfo>& contigs,
+                          const std::vector<string>& tfrecord_paths,
+                          const string& output_tfrecord_path,
+                          int64 max_calls_in_memory, int num_reader_threads,
+                          VariantKeyScanner scan_key) {
   //   Create the mapping from from contig to pos_in_fasta.
-  std::map<string, int> contig_name_to_pos_in_fasta =
-      core::MapContigNameToPosInFasta(contigs);
-  std::sort(calls->begin(), calls->end(),
-            [&contig_name_to_pos_in_fasta](const CallVariantsOutput& a,
-                                           const CallVariantsOutput& b) {
-              return core::CompareVariants(a.variant(), b.variant(),
-                                           contig_name_to_pos_in_fasta);
-            });
+  const ContigPositions contig_positions(contigs);
+  const int num_shards = tfrecord_paths.size();
+  const int num_threads =
+      std::max(1, std::min(num_reader_threads, num_shards));
+  // Each reader holds at most its share of max_calls_in_memory.
+  const int64 max_calls_per_reader =
+      max_calls_in_memory > 0
+          ? std::max<int64>(1, max_calls_in_memory / num_threads)
+          : 0;
+
+  core::ScopedStageTimer timer(core::CALL_SORTING);
+  // The calls of each shard still in memory, and those spilled.
+  std::vector<std::vector<SortableCall>> shard_calls(num_shards);
+  std::vector<SortedRuns> shard_runs(num_shards);
+  std::vector<int64> shard_num_calls(num_shards, 0);
+  // The memory held by the calls of each shard, and their data.
+  std::vector<std::unique_ptr<core::ScopedStageMemory>> shard_memory;
+  std::vector<int64> shard_data_bytes(num_shards, 0);
+  for (int shard = 0; shard < num_shards; ++shard) {
+    shard_memory.emplace_back(new core::ScopedStageMemory(core::CALL_SORTING));
+  }
+  std::atomic<int> next_shard(0);
+  // The calls of finished shards still in memory.
+  std::atomic<int64> calls_held(0);
+  auto read_shards = [&]() {
+    for (int shard = next_shard++; shard < num_shards; shard = next_shard++) {
+      const string& tfrecord_path = tfrecord_paths[shard];
+      std::vector<SortableCall>& calls = shard_calls[shard];
+      int64& data_bytes = shard_data_bytes[shard];
+      TfRecordSource reader(tfrecord_path);
+      string data;
+      LOG(INFO) << "Read from: " << tfrecord_path;
+      while (reader.Next(&data)) {
+        calls.emplace_back();
+        ParseCall(contig_positions, scan_key, std::move(data),
+                  &calls.back());
+        data_bytes += calls.back().data.capacity();
+        ++shard_num_calls[shard];
+        if (max_calls_per_reader > 0 &&
+            static_cast<int64>(calls.size()) >= max_calls_per_reader) {
+          AccountCalls(calls, data_bytes, shard_memory[shard].get());
+          SortSingleSiteCalls(&calls);
+          shard_runs[shard].Spill(calls);
+          calls.clear();
+          data_bytes = 0;
+        } else if (calls.size() % kCallsPerMemoryUpdate == 0) {
+          AccountCalls(calls, data_bytes, shard_memory[shard].get());
+        }
+      }
+      // Keep the shard's remaining calls only while they fit in what is left.
+      const int64 remaining = calls.size();
+      if (max_calls_in_memory > 0 &&
+          calls_held.fetch_add(remaining) + remaining > max_calls_in_memory) {
+        calls_held -= remaining;
+        SortSingleSiteCalls(&calls);
+        shard_runs[shard].Spill(calls);
+        std::vector<SortableCall>().swap(calls);
+        data_bytes = 0;
+      }
+      AccountCalls(calls, data_bytes, shard_memory[shard].get());
+      LOG(INFO) << "Done reading: " << tfrecord_path
+                << ". #entries in single_site_calls = "
+                << shard_num_calls[shard];
+    }
+  };
+  std::vector<std::thread> readers;
+  for (int i = 1; i < num_threads; ++i) {
+    readers.emplace_back(read_shards);
+  }
+  read_shards();
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+
+  int64 num_calls = 0;
+  bool spilled = false;
+  for (int shard = 0; shard < num_shards; ++shard) {
+    num_calls += shard_num_calls[shard];
+    spilled |= !shard_runs[shard].empty();
+  }
+  LOG(INFO) << "Total #entries in single_site_calls = " << num_calls;
+
+  // Write sorted calls to output_tfrecord_path.
+  TfRecordSink output(output_tfrecord_path);
+  if (!spilled) {
+    // Concatenating the shards in order keeps equal calls in input order.
+    std::vector<SortableCall> single_site_calls;
+    single_site_calls.reserve(num_calls);
+    core::ScopedStageMemory memory(core::CALL_SORTING);
+    int64 data_bytes = 0;
+    for (int shard = 0; shard < num_shards; ++shard) {
+      std::vector<SortableCall>& calls = shard_calls[shard];
+      std::move(calls.begin(), calls.end(),
+                std::back_inserter(single_site_calls));
+      std::vector<SortableCall>().swap(calls);
+      data_bytes += shard_data_bytes[shard];
+      AccountCalls(single_site_calls, data_bytes, &memory);
+      shard_memory[shard]->Set(0);
+    }
+    LOG(INFO) << "Start SortSingleSiteCalls";
+    SortSingleSiteCalls(&single_site_calls);
+    LOG(INFO) << "Done SortSingleSiteCalls";
+    for (const SortableCall& single_site_call : single_site_calls) {
+      output.Write(single_site_call.data);
+    }
+  } else {
+    // Runs of earlier shards come first, which the merge keeps first among
+    // equal calls.
+    SortedRuns runs;
+    for (int shard = 0; shard < num_shards; ++shard) {
+      SortSingleSiteCalls(&shard_calls[shard]);
+      shard_runs[shard].Spill(shard_calls[shard]);
+      std::vector<SortableCall>().swap(shard_calls[shard]);
+      shard_memory[shard]->Set(0);
+      runs.Append(&shard_runs[shard]);
+    }
+    runs.MergeInto(&output);
+  }
 }
 
 }  // namespace
@@ -69,53 +477,830 @@ void SortSingleSiteCalls(const std::vector<core::ContigInfo>& contigs,
 void ProcessSingleSiteCallTfRecords(
     const std::vector<core::ContigInfo>& contigs,
     const std::vector<string>& tfrecord_paths,
-    const string& output_tfrecord_path) {
-  std::vector<CallVariantsOutput> single_site_calls;
-  tensorflow::Env* env = tensorflow::Env::Default();
-  for (const string& tfrecord_path : tfrecord_paths) {
-    std::unique_ptr<tensorflow::RandomAccessFile> read_file;
-    TF_CHECK_OK(env->NewRandomAccessFile(tfrecord_path, &read_file));
-    const char* const option = core::EndsWith(tfrecord_path, ".gz")
-                                   ? tensorflow::io::compression::kGzip
-                                   : tensorflow::io::compression::kNone;
-    tensorflow::io::RecordReader reader(
-        read_file.get(),
-        tensorflow::io::RecordReaderOptions::CreateRecordReaderOptions(option));
+    const string& output_tfrecord_path, int64 max_calls_in_memory,
+    int num_reader_threads) {
+  SortVariantTfRecords(contigs, tfrecord_paths, output_tfrecord_path,
+                       max_calls_in_memory, num_reader_threads,
+                       ScanCallVariantsOutputKey);
+}
+
+void ProcessNonVariantSiteTfRecords(
+    const std::vector<core::ContigInfo>& contigs,
+    const std::vector<string>& tfrecord_paths,
+    const string& output_tfrecord_path, int64 max_records_in_memory,
+    int num_reader_threads) {
+  SortVariantTfRecords(contigs, tfrecord_paths, output_tfrecord_path,
+                       max_records_in_memory, num_reader_threads,
+                       ScanVariantKey);
+}
+
+namespace {
+
+// The number of places past the decimal point to round QUAL estimates to.
+constexpr int kQualPrecision = 7;
+
+// The largest probability that phred-scaled qualities are bounded by.
+constexpr double kMaxConfidence = 1.0 - 1e-15;
+
+// The VCF format field of the genotype quality of calls.
+const char* const kGQFormatField = "GQ";
+
+// The VCF format fields indexed by allele, which are cleaned up when alt
+// alleles are removed, and whether their index 0 is the reference allele.
+const std::pair<const char*, bool> kAltAlleleIndexedFormatFields[] = {
+    {"AD", true}, {"VAF", false}};
+
+// Sets *phred to the phred-scaled confidence of the probability ptrue, capped
+// by kMaxConfidence.
+tf::Status PTrueToBoundedPhred(double ptrue, double* phred) {
+  if (!(0 <= ptrue && ptrue <= 1)) {
+    return tf::errors::InvalidArgument(
+        "ptrue must be between zero and one: ", ptrue);
+  }
+  *phred = core::PErrorToPhred(1.0 - std::min(ptrue, kMaxConfidence));
+  return tf::Status::OK();
+}
+
+// Sets *log10_perror to the log10 of the probability perror, which is bounded
+// below by 1 - kMaxConfidence.
+tf::Status PErrorToBoundedLog10PError(double perror, double* log10_perror) {
+  if (!(0 <= perror && perror <= 1)) {
+    return tf::errors::InvalidArgument(
+        "perror must be between zero and one: ", perror);
+  }
+  *log10_perror =
+      core::PErrorToLog10PError(std::max(perror, 1.0 - kMaxConfidence));
+  return tf::Status::OK();
+}
+
+// Rounds value to kQualPrecision places past the decimal point as Python's
+// round() does: correctly, with exact halfway cases rounded away from zero.
+double RoundQual(double value) {
+  if (!std::isfinite(value) || value == 0) {
+    return value;
+  }
+  char digits[512];
+  // The halfway cases are the odd multiples of 2^-(kQualPrecision + 1).
+  if (std::abs(std::fmod(std::ldexp(value, kQualPrecision + 1), 2.0)) == 1.0) {
+    const double scaled =
+        std::ceil(std::abs(value) * std::pow(10.0, kQualPrecision));
+    snprintf(digits, sizeof(digits), "%s%.0fe-%d", value < 0 ? "-" : "",
+             scaled, kQualPrecision);
+  } else {
+    snprintf(digits, sizeof(digits), "%.*f", kQualPrecision, value);
+  }
+  return std::strtod(digits, nullptr);
+}
+
+// Strips the longest common suffix of the alleles that leaves each of them
+// with at least one base.
+void SimplifyAlleles(std::vector<string>* alleles) {
+  size_t shortest_allele_len = string::npos;
+  for (const string& allele : *alleles) {
+    shortest_allele_len = std::min(shortest_allele_len, allele.size());
+  }
+  size_t common_postfix_len = 0;
+  for (size_t i = 1; i < shortest_allele_len; ++i) {
+    const char base = alleles->front()[alleles->front().size() - i];
+    bool all_the_same = true;
+    for (const string& allele : *alleles) {
+      all_the_same &= allele[allele.size() - i] == base;
+    }
+    if (!all_the_same) break;
+    common_postfix_len = i;
+  }
+  for (string& allele : *alleles) {
+    allele.resize(allele.size() - common_postfix_len);
+  }
+}
+
+// Returns true if the alt_allele_indices of call_variants_outputs are each set
+// of one or two alt alleles of their variant, and their variants are equal.
+bool IsValidCallVariantsOutputs(
+    const std::vector<CallVariantsOutput>& call_variants_outputs) {
+  const Variant& variant = call_variants_outputs.front().variant();
+  std::vector<std::vector<int>> expected_alt_allele_indices;
+  for (int i = 0; i < variant.alternate_bases_size(); ++i) {
+    expected_alt_allele_indices.push_back({i});
+    for (int j = i + 1; j < variant.alternate_bases_size(); ++j) {
+      expected_alt_allele_indices.push_back({i, j});
+    }
+  }
+  std::vector<std::vector<int>> all_alt_allele_indices;
+  for (const CallVariantsOutput& output : call_variants_outputs) {
+    const auto& indices = output.alt_allele_indices().indices();
+    all_alt_allele_indices.emplace_back(indices.begin(), indices.end());
+  }
+  std::sort(all_alt_allele_indices.begin(), all_alt_allele_indices.end());
+  if (all_alt_allele_indices != expected_alt_allele_indices) {
+    return false;
+  }
+  for (const CallVariantsOutput& output : call_variants_outputs) {
+    if (!google::protobuf::util::MessageDifferencer::Equals(
+            variant, output.variant())) {
+      LOG(WARNING) << "Expected all inputs to merge_predictions to have the "
+                   << "same `variant`, but getting " << variant.DebugString()
+                   << " and " << output.variant().DebugString();
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sets *alt_alleles_to_remove to the alt alleles whose quality, from the
+// outputs for them alone, is below qual_filter, keeping the one with the
+// highest quality if that is all of them.
+tf::Status GetAltAllelesToRemove(
+    const std::vector<CallVariantsOutput>& call_variants_outputs,
+    double qual_filter, std::set<string>* alt_alleles_to_remove) {
+  alt_alleles_to_remove->clear();
+  if (qual_filter == 0) {
+    return tf::Status::OK();
+  }
+  const Variant& variant = call_variants_outputs.front().variant();
+  bool has_max_qual = false;
+  double max_qual = 0;
+  string max_qual_allele;
+  for (const CallVariantsOutput& output : call_variants_outputs) {
+    if (output.alt_allele_indices().indices_size() != 1) continue;
+    const std::vector<double> probabilities(
+        output.genotype_probabilities().begin(),
+        output.genotype_probabilities().end());
+    double gq, qual;
+    TF_RETURN_IF_ERROR(ComputeQuals(probabilities, 0, &gq, &qual));
+    const string& alt =
+        variant.alternate_bases(output.alt_allele_indices().indices(0));
+    if (!has_max_qual || max_qual < qual) {
+      has_max_qual = true;
+      max_qual = qual;
+      max_qual_allele = alt;
+    }
+    if (qual < qual_filter) {
+      alt_alleles_to_remove->insert(alt);
+    }
+  }
+  if (static_cast<int>(alt_alleles_to_remove->size()) ==
+          variant.alternate_bases_size() &&
+      has_max_qual) {
+    alt_alleles_to_remove->erase(max_qual_allele);
+  }
+  return tf::Status::OK();
+}
 
-    uint64 offset = 0;
+// Removes the alt_alleles_to_remove from the alternate_bases of *variant, and
+// their values from the allele-indexed format fields of its calls.
+tf::Status PruneAlleles(const std::set<string>& alt_alleles_to_remove,
+                        Variant* variant) {
+  if (alt_alleles_to_remove.empty()) {
+    return tf::Status::OK();
+  }
+  const std::vector<string> original_alts(variant->alternate_bases().begin(),
+                                          variant->alternate_bases().end());
+  for (VariantCall& call : *variant->mutable_calls()) {
+    for (const auto& field : kAltAlleleIndexedFormatFields) {
+      auto entry = call.mutable_info()->find(field.first);
+      if (entry == call.mutable_info()->end()) continue;
+      ListValue updated;
+      for (int i = 0; i < entry->second.values_size(); ++i) {
+        const int alt_index = field.second ? i - 1 : i;
+        if (alt_index >= static_cast<int>(original_alts.size())) {
+          return tf::errors::InvalidArgument(
+              "Too many values of ", field.first, " for the alt alleles");
+        }
+        if (alt_index < 0 ||
+            !alt_alleles_to_remove.count(original_alts[alt_index])) {
+          *updated.add_values() = entry->second.values(i);
+        }
+      }
+      entry->second.Swap(&updated);
+    }
+  }
+  variant->clear_alternate_bases();
+  for (const string& alt : original_alts) {
+    if (!alt_alleles_to_remove.count(alt)) {
+      variant->add_alternate_bases(alt);
+    }
+  }
+  return tf::Status::OK();
+}
+
+// Returns the filter value of variant, whose call has been set, given the
+// minimum quality min_quality of non-reference calls.
+const char* FilterField(const Variant& variant, double min_quality) {
+  const auto& genotype = variant.calls(0).genotype();
+  if (!genotype.empty() &&
+      std::all_of(genotype.begin(), genotype.end(),
+                  [](int allele) { return allele == 0; })) {
+    return kRefCallFilter;
+  } else if (variant.quality() < min_quality) {
+    return kLowQualFilter;
+  } else {
+    return kPassFilter;
+  }
+}
+
+// The number of CallVariantsOutput protos after which a chunk of sites ends.
+// Chunks only end between sites, and also end wherever the contig changes.
+constexpr int kSitesPerChunk = 4096;
+
+// The serialized CallVariantsOutput protos of a run of whole sites of one
+// contig, and the variants called from them.
+struct SiteChunk {
+  std::vector<string> data;
+  std::vector<Variant> variants;
+  tf::Status status;
+  // Notified once the variants and status are set.
+  tf::Notification done;
+};
+
+// Splits the sorted records of a TfRecordSource into SiteChunks, reading only
+// the keys of the records.
+class SiteChunkReader {
+ public:
+  explicit SiteChunkReader(TfRecordSource* source) : source_(source) {
+    has_next_ = Advance();
+  }
+
+  // Sets chunk->data to the records of the next chunk, returning false at the
+  // end of the input or on a record that can't be read.
+  bool Next(SiteChunk* chunk) {
+    chunk->data.clear();
+    chunk->variants.clear();
+    if (!has_next_) return false;
+    const CallVariantsOutputKey first = next_key_;
+    CallVariantsOutputKey site = next_key_;
+    do {
+      chunk->data.push_back(std::move(next_));
+      has_next_ = Advance();
+      if (!has_next_ || next_key_.reference_name != first.reference_name) {
+        break;
+      }
+      if (next_key_.start != site.start || next_key_.end != site.end) {
+        if (chunk->data.size() >= kSitesPerChunk) break;
+        site = next_key_;
+      }
+    } while (true);
+    return true;
+  }
+
+  const tf::Status& status() const { return status_; }
+
+ private:
+  bool Advance() {
+    if (!source_->Next(&next_)) return false;
+    if (!ScanCallVariantsOutputKey(next_, &next_key_)) {
+      status_ = tf::errors::DataLoss("Failed to parse CallVariantsOutput");
+      return false;
+    }
+    return true;
+  }
+
+  TfRecordSource* const source_;
+  string next_;
+  CallVariantsOutputKey next_key_;
+  bool has_next_ = false;
+  tf::Status status_;
+};
+
+// The written variants, as VCF records or serialized protos.
+class VariantSink {
+ public:
+  static tf::Status Open(const std::vector<core::ContigInfo>& contigs,
+                         const string& path, const string& sample_name,
+                         int num_threads, std::unique_ptr<VariantSink>* sink) {
+    sink->reset(new VariantSink());
+    const bool is_compressed =
+        core::EndsWith(path, ".vcf.gz") || core::EndsWith(path, ".bcf");
+    if (is_compressed || core::EndsWith(path, ".vcf")) {
+      core::VcfWriterOptions options;
+      // Our variants are sorted, so compressed outputs are indexed as they are
+      // written rather than by a later pass over the file.
+      if (is_compressed) {
+        options.set_index_mode(
+            core::IndexHandlingMode::INDEX_BASED_ON_FILENAME);
+      }
+      // With several threads calling the sites, formatting the records would
+      // be the serial bottleneck, so it moves off the writing thread too.
+      // Indexed outputs are compressed on the thread writing the records, as
+      // the VcfWriter doesn't index the blocks of compression threads.
+      if (num_threads > 1) {
+        options.set_write_queue_size(kSitesPerChunk);
+      }
+      *options.mutable_contigs() = {contigs.begin(), contigs.end()};
+      options.add_sample_names(sample_name);
+      core::VcfFilterInfo* ref_call = options.add_filters();
+      ref_call->set_id(kRefCallFilter);
+      ref_call->set_description(
+          "Genotyping model thinks this site is reference.");
+      core::VcfFilterInfo* low_qual = options.add_filters();
+      low_qual->set_id(kLowQualFilter);
+      low_qual->set_description(
+          "Confidence in this variant being real is below calling threshold.");
+      auto writer = core::VcfWriter::ToFile(path, options);
+      TF_RETURN_IF_ERROR(writer.status());
+      (*sink)->vcf_writer_ = std::move(writer.ValueOrDie());
+    } else {
+      (*sink)->tfrecord_.reset(new TfRecordSink(path));
+    }
+    return tf::Status::OK();
+  }
+
+  tf::Status Write(const Variant& variant) {
+    if (vcf_writer_ != nullptr) {
+      return vcf_writer_->Write(variant);
+    }
+    tfrecord_->Write(variant.SerializeAsString());
+    return tf::Status::OK();
+  }
+
+  tf::Status Close() {
+    tfrecord_.reset();
+    return vcf_writer_ != nullptr ? vcf_writer_->Close() : tf::Status::OK();
+  }
+
+ private:
+  VariantSink() = default;
+
+  std::unique_ptr<core::VcfWriter> vcf_writer_;
+  std::unique_ptr<TfRecordSink> tfrecord_;
+};
+
+// The alternate allele of gVCF records standing for any other allele, as
+// make_examples writes the non-variant records.
+const char* const kGvcfAnyAltAllele = "<*>";
+
+// The log10 genotype likelihood of the genotypes that the kGvcfAnyAltAllele
+// adds to the called variants.
+constexpr double kGvcfAnyAltAlleleGl = -99;
+
+// Returns variant as a gVCF record: with the kGvcfAnyAltAllele alt appended
+// and the likelihoods and allele-indexed format values it adds to its calls,
+// unless it has that alt already.
+Variant ToGvcfRecord(const Variant& variant) {
+  if (std::find(variant.alternate_bases().begin(),
+                variant.alternate_bases().end(),
+                kGvcfAnyAltAllele) != variant.alternate_bases().end()) {
+    return variant;
+  }
+  Variant record = variant;
+  record.add_alternate_bases(kGvcfAnyAltAllele);
+  // The diploid genotypes that include the new allele, the last one.
+  const int num_added_genotypes = record.alternate_bases_size() + 1;
+  for (VariantCall& call : *record.mutable_calls()) {
+    for (int i = 0; i < num_added_genotypes; ++i) {
+      call.add_genotype_likelihood(kGvcfAnyAltAlleleGl);
+    }
+    for (const auto& field : kAltAlleleIndexedFormatFields) {
+      auto entry = call.mutable_info()->find(field.first);
+      if (entry != call.mutable_info()->end()) {
+        entry->second.add_values()->set_number_value(0);
+      }
+    }
+  }
+  return record;
+}
+
+// Writes the called variants, which come sorted, to a gVCF interleaved with
+// the sorted non-variant records of a TfRecordSource.  Non-variant records
+// overlapping a variant are trimmed on the fly to their parts before and after
+// it, so only the next non-variant record is held in memory.
+class GvcfMerger {
+ public:
+  GvcfMerger(const ContigPositions* contig_positions,
+             const core::GenomeReference* reference, TfRecordSource* source,
+             VariantSink* sink)
+      : contig_positions_(contig_positions),
+        reference_(reference),
+        source_(source),
+        sink_(sink) {}
+
+  // Writes the non-variant records, or parts of them, that come before the
+  // end of variant, and then the gVCF record of variant.
+  tf::Status Add(const Variant& variant) {
+    TF_RETURN_IF_ERROR(Start());
+    int pos_in_fasta;
+    TF_RETURN_IF_ERROR(PosInFasta(variant.reference_name(), &pos_in_fasta));
+    while (has_next_ &&
+           (next_pos_in_fasta_ < pos_in_fasta ||
+            (next_pos_in_fasta_ == pos_in_fasta &&
+             next_.start() < variant.end()))) {
+      if (next_pos_in_fasta_ < pos_in_fasta ||
+          next_.end() <= variant.start()) {
+        TF_RETURN_IF_ERROR(sink_->Write(next_));
+        TF_RETURN_IF_ERROR(Advance());
+        continue;
+      }
+      // next_ overlaps the variant.
+      if (next_.start() < variant.start()) {
+        const int64 end = next_.end();
+        next_.set_end(variant.start());
+        TF_RETURN_IF_ERROR(sink_->Write(next_));
+        next_.set_end(end);
+      }
+      if (next_.end() <= variant.end()) {
+        TF_RETURN_IF_ERROR(Advance());
+      } else {
+        TF_RETURN_IF_ERROR(TrimStart(variant.end()));
+      }
+    }
+    return sink_->Write(ToGvcfRecord(variant));
+  }
+
+  // Writes the remaining non-variant records.
+  tf::Status Finish() {
+    TF_RETURN_IF_ERROR(Start());
+    while (has_next_) {
+      TF_RETURN_IF_ERROR(sink_->Write(next_));
+      TF_RETURN_IF_ERROR(Advance());
+    }
+    return tf::Status::OK();
+  }
+
+ private:
+  // Reads the first non-variant record, once.
+  tf::Status Start() {
+    if (started_) return tf::Status::OK();
+    started_ = true;
+    return Advance();
+  }
+
+  // Sets next_ to the next non-variant record, or clears has_next_ at the end
+  // of the input.
+  tf::Status Advance() {
     string data;
-    LOG(INFO) << "Read from: " << tfrecord_path;
-    while (reader.ReadRecord(&offset, &data).ok()) {
-      CallVariantsOutput single_site_call;
-      QCHECK(single_site_call.ParseFromString(data))
-          << "Failed to parse CallVariantsOutput";
-      // Here we assume each variant has only 1 call.
-      QCHECK_EQ(single_site_call.variant().calls_size(), 1);
-      single_site_calls.push_back(single_site_call);
-    }
-    LOG(INFO) << "Done reading: " << tfrecord_path
-              << ". #entries in single_site_calls = "
-              << single_site_calls.size();
-  }
-  LOG(INFO) << "Total #entries in single_site_calls = "
-            << single_site_calls.size();
-  LOG(INFO) << "Start SortSingleSiteCalls";
-  SortSingleSiteCalls(contigs, &single_site_calls);
-  LOG(INFO) << "Done SortSingleSiteCalls";
+    has_next_ = source_->Next(&data);
+    if (!has_next_) return tf::Status::OK();
+    if (!next_.ParseFromString(data)) {
+      return tf::errors::DataLoss("Failed to parse non-variant Variant");
+    }
+    return PosInFasta(next_.reference_name(), &next_pos_in_fasta_);
+  }
 
-  // Write sorted calls to output_tfrecord_path.
-  std::unique_ptr<tensorflow::WritableFile> output_file;
-  TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(output_tfrecord_path,
-                                                          &output_file));
-  tensorflow::io::RecordWriter output_writer(output_file.get());
-  for (const auto& single_site_call : single_site_calls) {
-    tensorflow::Status writer_status =
-        output_writer.WriteRecord(single_site_call.SerializeAsString());
-    QCHECK(writer_status.ok())
-        << "Failed to write serialized proto to output_writer. "
-        << "Status = " << writer_status.error_message();
+  // Moves the start of next_ to start, along with its reference base.
+  tf::Status TrimStart(int64 start) {
+    auto bases = reference_->GetBases(
+        core::MakeRange(next_.reference_name(), start, start + 1));
+    TF_RETURN_IF_ERROR(bases.status());
+    next_.set_start(start);
+    next_.set_reference_bases(bases.ValueOrDie());
+    return tf::Status::OK();
+  }
+
+  tf::Status PosInFasta(const string& reference_name,
+                        int* pos_in_fasta) const {
+    *pos_in_fasta = contig_positions_->Find(reference_name);
+    if (*pos_in_fasta < 0) {
+      return tf::errors::InvalidArgument("Reference name ", reference_name,
+                                         " not in contig info.");
+    }
+    return tf::Status::OK();
+  }
+
+  const ContigPositions* const contig_positions_;
+  const core::GenomeReference* const reference_;
+  TfRecordSource* const source_;
+  VariantSink* const sink_;
+  bool started_ = false;
+  // The next non-variant record, if has_next_, and its contig's pos_in_fasta.
+  Variant next_;
+  int next_pos_in_fasta_ = 0;
+  bool has_next_ = false;
+};
+
+}  // namespace
+
+tf::Status MostLikelyGenotype(const std::vector<double>& predictions,
+                              int n_alleles, int* index,
+                              std::vector<int>* genotype) {
+  if (n_alleles < 2) {
+    return tf::errors::InvalidArgument("n_alleles must be >= 2 but got ",
+                                       n_alleles);
+  }
+  if (predictions.empty()) {
+    return tf::errors::InvalidArgument("No predictions to choose from");
+  }
+  // The first of the most likely genotypes, as numpy's argmax picks.
+  int index_of_max = 0;
+  for (size_t i = 0; i < predictions.size(); ++i) {
+    if (std::isnan(predictions[i])) {
+      index_of_max = i;
+      break;
+    }
+    if (predictions[i] > predictions[index_of_max]) {
+      index_of_max = i;
+    }
+  }
+  // Genotype a/b, with a <= b, is at index b(b + 1)/2 + a.
+  int i = 0;
+  for (int h1 = 0; h1 <= n_alleles; ++h1) {
+    for (int h2 = 0; h2 <= h1; ++h2) {
+      if (i == index_of_max) {
+        *index = i;
+        *genotype = {h2, h1};
+        return tf::Status::OK();
+      }
+      ++i;
+    }
+  }
+  return tf::errors::InvalidArgument(
+      "No corresponding GenotypeType for prediction ", index_of_max);
+}
+
+tf::Status ComputeQuals(const std::vector<double>& predictions,
+                        int prediction_index, double* gq, double* qual) {
+  if (prediction_index < 0 ||
+      prediction_index >= static_cast<int>(predictions.size())) {
+    return tf::errors::InvalidArgument("No prediction at index ",
+                                       prediction_index);
+  }
+  // GQ is prob(genotype) / prob(all genotypes), rounded to the nearest integer
+  // to comply with the VCF spec.
+  TF_RETURN_IF_ERROR(PTrueToBoundedPhred(predictions[prediction_index], gq));
+  *gq = std::nearbyint(*gq);
+  // QUAL is prob(variant genotype) / prob(all genotypes), taking the min to
+  // avoid minor numerical issues that can push the sum above 1.0.
+  double non_ref = 0;
+  for (size_t i = 1; i < predictions.size(); ++i) {
+    non_ref += predictions[i];
+  }
+  TF_RETURN_IF_ERROR(PTrueToBoundedPhred(std::min(non_ref, 1.0), qual));
+  *qual = RoundQual(*qual);
+  return tf::Status::OK();
+}
+
+tf::Status MergePredictions(
+    const std::vector<CallVariantsOutput>& call_variants_outputs,
+    double multi_allelic_qual_filter, Variant* variant,
+    std::vector<double>* predictions) {
+  if (call_variants_outputs.empty()) {
+    return tf::errors::InvalidArgument(
+        "Expected 1 or more call_variants_outputs.");
+  }
+  if (!IsValidCallVariantsOutputs(call_variants_outputs)) {
+    return tf::errors::InvalidArgument(
+        "`call_variants_outputs` did not pass sanity check.");
   }
-  TF_CHECK_OK(output_writer.Flush()) << "Failed to flush the output writer.";
+  const CallVariantsOutput& first_call = call_variants_outputs.front();
+  *variant = first_call.variant();
+  if (call_variants_outputs.size() == 1) {
+    predictions->assign(first_call.genotype_probabilities().begin(),
+                        first_call.genotype_probabilities().end());
+    return tf::Status::OK();
+  }
+
+  std::set<string> alt_alleles_to_remove;
+  TF_RETURN_IF_ERROR(GetAltAllelesToRemove(
+      call_variants_outputs, multi_allelic_qual_filter,
+      &alt_alleles_to_remove));
+  // The smallest probability of each unordered pair of alleles, over the
+  // outputs not involving removed alleles.
+  std::map<std::pair<string, string>, double> min_probs;
+  for (const CallVariantsOutput& output : call_variants_outputs) {
+    const std::set<string> ref_alleles = {variant->reference_bases()};
+    std::set<string> alt_alleles;
+    for (const int index : output.alt_allele_indices().indices()) {
+      alt_alleles.insert(variant->alternate_bases(index));
+    }
+    if (std::any_of(alt_alleles.begin(), alt_alleles.end(),
+                    [&alt_alleles_to_remove](const string& alt) {
+                      return alt_alleles_to_remove.count(alt) > 0;
+                    })) {
+      continue;
+    }
+    if (output.genotype_probabilities_size() != 3) {
+      return tf::errors::InvalidArgument(
+          "Expected 3 genotype probabilities but got ",
+          output.genotype_probabilities_size());
+    }
+    const std::set<string>* const allele_sets[][2] = {
+        {&ref_alleles, &ref_alleles},
+        {&ref_alleles, &alt_alleles},
+        {&alt_alleles, &alt_alleles}};
+    for (int g = 0; g < 3; ++g) {
+      const double p = output.genotype_probabilities(g);
+      for (const string& allele1 : *allele_sets[g][0]) {
+        for (const string& allele2 : *allele_sets[g][1]) {
+          auto inserted =
+              min_probs.emplace(std::make_pair(allele1, allele2), p);
+          if (!inserted.second && p < inserted.first->second) {
+            inserted.first->second = p;
+          }
+        }
+      }
+    }
+  }
+
+  TF_RETURN_IF_ERROR(PruneAlleles(alt_alleles_to_remove, variant));
+  std::vector<string> alleles = {variant->reference_bases()};
+  alleles.insert(alleles.end(), variant->alternate_bases().begin(),
+                 variant->alternate_bases().end());
+  predictions->clear();
+  double denominator = 0;
+  for (size_t j = 0; j < alleles.size(); ++j) {
+    for (size_t i = 0; i <= j; ++i) {
+      const auto p = min_probs.find(std::make_pair(alleles[i], alleles[j]));
+      if (p == min_probs.end()) {
+        return tf::errors::InvalidArgument("No probability of genotype ",
+                                           alleles[i], "/", alleles[j]);
+      }
+      predictions->push_back(p->second);
+      denominator += p->second;
+    }
+  }
+  // Simplifying must come after the predictions, which are looked up by the
+  // unsimplified alleles.
+  SimplifyAlleles(&alleles);
+  variant->set_reference_bases(alleles[0]);
+  for (size_t i = 1; i < alleles.size(); ++i) {
+    variant->set_alternate_bases(i - 1, alleles[i]);
+  }
+  for (double& prediction : *predictions) {
+    prediction /= denominator;
+  }
+  return tf::Status::OK();
+}
+
+tf::Status AddCallToVariant(const std::vector<double>& predictions,
+                            double qual_filter, const string& sample_name,
+                            Variant* variant) {
+  if (variant->calls_size() != 1) {
+    return tf::errors::InvalidArgument(
+        "Variant must have exactly one VariantCall record");
+  }
+  int index;
+  std::vector<int> genotype;
+  TF_RETURN_IF_ERROR(MostLikelyGenotype(
+      predictions, variant->alternate_bases_size() + 1, &index, &genotype));
+  double gq, qual;
+  TF_RETURN_IF_ERROR(ComputeQuals(predictions, index, &gq, &qual));
+  variant->set_quality(qual);
+  VariantCall* call = variant->mutable_calls(0);
+  call->set_call_set_name(sample_name);
+  call->clear_genotype();
+  for (const int allele : genotype) {
+    call->add_genotype(allele);
+  }
+  core::SetInfoField(kGQFormatField, gq, call);
+  call->clear_genotype_likelihood();
+  for (const double prediction : predictions) {
+    double log10_perror;
+    TF_RETURN_IF_ERROR(PErrorToBoundedLog10PError(prediction, &log10_perror));
+    call->add_genotype_likelihood(log10_perror);
+  }
+  variant->clear_filter();
+  variant->add_filter(FilterField(*variant, qual_filter));
+  return tf::Status::OK();
+}
+
+namespace {
+
+// Parses the serialized CallVariantsOutput protos `data`, sorted and of whole
+// sites, and appends the variant called at each site to *variants.
+tf::Status CallSites(const std::vector<string>& data, double qual_filter,
+                     double multi_allelic_qual_filter,
+                     const string& sample_name,
+                     std::vector<Variant>* variants) {
+  // Merges the outputs of one site into a variant.
+  auto call_site =
+      [&](const std::vector<CallVariantsOutput>& outputs) -> tf::Status {
+    Variant variant;
+    std::vector<double> predictions;
+    TF_RETURN_IF_ERROR(MergePredictions(outputs, multi_allelic_qual_filter,
+                                        &variant, &predictions));
+    TF_RETURN_IF_ERROR(
+        AddCallToVariant(predictions, qual_filter, sample_name, &variant));
+    variants->push_back(std::move(variant));
+    return tf::Status::OK();
+  };
+  std::vector<CallVariantsOutput> site;
+  CallVariantsOutput output;
+  for (const string& record : data) {
+    if (!output.ParseFromString(record)) {
+      return tf::errors::DataLoss("Failed to parse CallVariantsOutput");
+    }
+    if (!site.empty()) {
+      const Variant& site_variant = site.front().variant();
+      if (output.variant().reference_name() != site_variant.reference_name() ||
+          output.variant().start() != site_variant.start() ||
+          output.variant().end() != site_variant.end()) {
+        TF_RETURN_IF_ERROR(call_site(site));
+        site.clear();
+      }
+    }
+    site.push_back(std::move(output));
+  }
+  if (!site.empty()) {
+    TF_RETURN_IF_ERROR(call_site(site));
+  }
+  return tf::Status::OK();
+}
+
+// Reads the sorted CallVariantsOutput protos at input_sorted_tfrecord_path,
+// calls their sites as WriteCallVariantsOutputToVcf does and writes the
+// variants to sink, and to gvcf too if it isn't null.
+tf::Status WriteCalls(const string& input_sorted_tfrecord_path,
+                      double qual_filter, double multi_allelic_qual_filter,
+                      const string& sample_name, int num_threads,
+                      VariantSink* sink, GvcfMerger* gvcf) {
+  auto call_chunk = [&](SiteChunk* chunk) {
+    chunk->status = CallSites(chunk->data, qual_filter,
+                              multi_allelic_qual_filter, sample_name,
+                              &chunk->variants);
+    chunk->data.clear();
+  };
+  auto write_chunk = [&](const SiteChunk& chunk) -> tf::Status {
+    TF_RETURN_IF_ERROR(chunk.status);
+    for (const Variant& variant : chunk.variants) {
+      TF_RETURN_IF_ERROR(sink->Write(variant));
+      if (gvcf != nullptr) {
+        TF_RETURN_IF_ERROR(gvcf->Add(variant));
+      }
+    }
+    return tf::Status::OK();
+  };
+  TfRecordSource reader(input_sorted_tfrecord_path);
+  SiteChunkReader chunks(&reader);
+  if (num_threads <= 1) {
+    SiteChunk chunk;
+    while (chunks.Next(&chunk)) {
+      call_chunk(&chunk);
+      TF_RETURN_IF_ERROR(write_chunk(chunk));
+    }
+    return chunks.status();
+  }
+
+  // The chunks are called by the pool in any order and written in the order
+  // they were read.  Declared before the pool so that its destructor, which
+  // waits for the scheduled chunks, runs first on early returns.
+  std::deque<std::unique_ptr<SiteChunk>> in_flight;
+  tf::thread::ThreadPool pool(tf::Env::Default(), "postprocess_variants",
+                              num_threads);
+  const size_t max_in_flight = 2 * num_threads;
+  bool more = true;
+  while (more || !in_flight.empty()) {
+    while (more && in_flight.size() < max_in_flight) {
+      std::unique_ptr<SiteChunk> chunk(new SiteChunk());
+      more = chunks.Next(chunk.get());
+      if (more) {
+        SiteChunk* const scheduled = chunk.get();
+        pool.Schedule([&call_chunk, scheduled]() {
+          call_chunk(scheduled);
+          scheduled->done.Notify();
+        });
+        in_flight.push_back(std::move(chunk));
+      }
+    }
+    if (!in_flight.empty()) {
+      in_flight.front()->done.WaitForNotification();
+      TF_RETURN_IF_ERROR(write_chunk(*in_flight.front()));
+      in_flight.pop_front();
+    }
+  }
+  return chunks.status();
+}
+
+}  // namespace
+
+tf::Status WriteCallVariantsOutputToVcf(
+    const std::vector<core::ContigInfo>& contigs,
+    const string& input_sorted_tfrecord_path, const string& output_vcf_path,
+    double qual_filter, double multi_allelic_qual_filter,
+    const string& sample_name, int num_threads) {
+  LOG(INFO) << "Writing calls to VCF file: " << output_vcf_path;
+  std::unique_ptr<VariantSink> sink;
+  TF_RETURN_IF_ERROR(VariantSink::Open(contigs, output_vcf_path, sample_name,
+                                       num_threads, &sink));
+  TF_RETURN_IF_ERROR(WriteCalls(input_sorted_tfrecord_path, qual_filter,
+                                multi_allelic_qual_filter, sample_name,
+                                num_threads, sink.get(), nullptr));
+  return sink->Close();
+}
+
+tf::Status WriteCallVariantsOutputToVcfAndGvcf(
+    const std::vector<core::ContigInfo>& contigs,
+    const core::GenomeReference& reference,
+    const string& input_sorted_tfrecord_path,
+    const string& input_sorted_nonvariant_tfrecord_path,
+    const string& output_vcf_path, const string& output_gvcf_path,
+    double qual_filter, double multi_allelic_qual_filter,
+    const string& sample_name, int num_threads) {
+  LOG(INFO) << "Writing calls to VCF file: " << output_vcf_path
+            << " and gVCF file: " << output_gvcf_path;
+  std::unique_ptr<VariantSink> sink, gvcf_sink;
+  TF_RETURN_IF_ERROR(VariantSink::Open(contigs, output_vcf_path, sample_name,
+                                       num_threads, &sink));
+  TF_RETURN_IF_ERROR(VariantSink::Open(contigs, output_gvcf_path, sample_name,
+                                       num_threads, &gvcf_sink));
+  const ContigPositions contig_positions(contigs);
+  TfRecordSource nonvariants(input_sorted_nonvariant_tfrecord_path);
+  GvcfMerger gvcf(&contig_positions, &reference, &nonvariants,
+                  gvcf_sink.get());
+  TF_RETURN_IF_ERROR(WriteCalls(input_sorted_tfrecord_path, qual_filter,
+                                multi_allelic_qual_filter, sample_name,
+                                num_threads, sink.get(), &gvcf));
+  TF_RETURN_IF_ERROR(gvcf.Finish());
+  TF_RETURN_IF_ERROR(sink->Close());
+  return gvcf_sink->Close();
 }
 
 }  // namespace deepvariant
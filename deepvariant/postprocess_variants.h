@@ -35,14 +35,19 @@
 #include <string>
 #include <vector>
 
+#include "deepvariant/core/genomics/variants.pb.h"
 #include "deepvariant/core/protos/core.pb.h"
+#include "deepvariant/core/reference.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/platform/types.h"
 
 namespace learning {
 namespace genomics {
 namespace deepvariant {
 
+using tensorflow::int64;
 using tensorflow::uint64;
 using tensorflow::string;
 using tensorflow::StringPiece;
@@ -50,11 +55,104 @@ using tensorflow::StringPiece;
 // Reads TFRecord of CallVariantsOutput protos, sort them based
 // on the mapping of chromosome names to positions in FASTA in `contigs`,
 // and then outputs the sorted TFRecord of CallVariantsOutput protos to
-// `output_tfrecord_path`.
+// `output_tfrecord_path`.  Calls at the same position keep their input order.
+// Only the variant's position is read from each record, straight from its
+// wire format, and the records are copied to the output unchanged.
+//
+// The shards are read and parsed by up to `num_reader_threads` threads.
+//
+// If `max_calls_in_memory` is positive, about that many calls are held in
+// memory at most: they are sorted in runs, which are spilled to local
+// temporary files and merged into the output.  Runs that continue the
+// previous one, as in shards that are already sorted, are appended to it.
+// Otherwise all the calls are sorted in memory.
 void ProcessSingleSiteCallTfRecords(
     const std::vector<core::ContigInfo>& contigs,
     const std::vector<string>& tfrecord_paths,
-    const string& output_tfrecord_path);
+    const string& output_tfrecord_path, int64 max_calls_in_memory,
+    int num_reader_threads);
+
+// Sorts the TFRecords of gVCF Variant protos of the non-variant sites at
+// `tfrecord_paths`, as make_examples writes them, into `output_tfrecord_path`
+// just as ProcessSingleSiteCallTfRecords sorts calls, holding about
+// `max_records_in_memory` of them in memory at most if that is positive.
+void ProcessNonVariantSiteTfRecords(
+    const std::vector<core::ContigInfo>& contigs,
+    const std::vector<string>& tfrecord_paths,
+    const string& output_tfrecord_path, int64 max_records_in_memory,
+    int num_reader_threads);
+
+// The filter values of the variants written by WriteCallVariantsOutputToVcf.
+extern const char* const kRefCallFilter;
+extern const char* const kLowQualFilter;
+extern const char* const kPassFilter;
+
+// Sets *index to the index of the most likely genotype in `predictions`, the
+// real-space probabilities of each diploid genotype of `n_alleles` alleles in
+// VCF order, and *genotype to its VCF-style allele indices.
+tensorflow::Status MostLikelyGenotype(const std::vector<double>& predictions,
+                                      int n_alleles, int* index,
+                                      std::vector<int>* genotype);
+
+// Sets *gq to the rounded phred-scaled confidence in the genotype at
+// `prediction_index` of `predictions`, and *qual to the phred-scaled
+// confidence in the variant being non-reference, both capped.
+tensorflow::Status ComputeQuals(const std::vector<double>& predictions,
+                                int prediction_index, double* gq,
+                                double* qual);
+
+// Merges the CallVariantsOutput protos of one site, one per set of its alt
+// alleles, into the canonical *variant and the probabilities of its genotypes.
+// Alt alleles whose quality is below `multi_allelic_qual_filter` are removed,
+// unless all are, and the remaining alleles are simplified.
+tensorflow::Status MergePredictions(
+    const std::vector<CallVariantsOutput>& call_variants_outputs,
+    double multi_allelic_qual_filter, learning::genomics::v1::Variant* variant,
+    std::vector<double>* predictions);
+
+// Fills in the genotype, GQ, genotype likelihoods, quality, and filter of the
+// single call of *variant, of `sample_name`, from the genotype probabilities
+// `predictions`.  Non-reference calls with a quality below `qual_filter` are
+// filtered.
+tensorflow::Status AddCallToVariant(const std::vector<double>& predictions,
+                                    double qual_filter,
+                                    const string& sample_name,
+                                    learning::genomics::v1::Variant* variant);
+
+// Reads the sorted CallVariantsOutput protos at `input_sorted_tfrecord_path`,
+// merges those of each site, and writes the called variants to
+// `output_vcf_path`, as VCF if it ends in .vcf or .vcf.gz and as a TFRecord
+// of Variant protos otherwise.
+//
+// If `num_threads` is above 1, runs of sites, which never span contigs, are
+// merged and called by that many threads while the variants are written in
+// their input order, and the VCF records are formatted and written off the
+// calling thread too.  The output is the same as with one thread.
+tensorflow::Status WriteCallVariantsOutputToVcf(
+    const std::vector<core::ContigInfo>& contigs,
+    const string& input_sorted_tfrecord_path, const string& output_vcf_path,
+    double qual_filter, double multi_allelic_qual_filter,
+    const string& sample_name, int num_threads);
+
+// Writes the called variants to `output_vcf_path` as
+// WriteCallVariantsOutputToVcf does, and also writes the gVCF of the sample
+// to `output_gvcf_path`: the called variants, each with the "<*>" alt allele
+// added, merged in order with the sorted non-variant Variant protos at
+// `input_sorted_nonvariant_tfrecord_path`.  The non-variant records
+// overlapping a variant are trimmed to their parts before and after it, the
+// part after it starting with its base in `reference`.
+//
+// Both outputs are written as the sites are called and only the next
+// non-variant record is held in memory, so the memory used doesn't grow with
+// the size of the genome.
+tensorflow::Status WriteCallVariantsOutputToVcfAndGvcf(
+    const std::vector<core::ContigInfo>& contigs,
+    const core::GenomeReference& reference,
+    const string& input_sorted_tfrecord_path,
+    const string& input_sorted_nonvariant_tfrecord_path,
+    const string& output_vcf_path, const string& output_gvcf_path,
+    double qual_filter, double multi_allelic_qual_filter,
+    const string& sample_name, int num_threads);
 
 }  // namespace deepvariant
 }  // namespace genomics
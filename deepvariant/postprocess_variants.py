@@ -51,8 +51,10 @@ from deepvariant.core import proto_utils
 from deepvariant.core import variantutils
 from deepvariant.core.genomics import variants_pb2
 from deepvariant.core.protos import core_pb2
+from deepvariant.core.python import stage_timer
 from deepvariant.protos import deepvariant_pb2
 from deepvariant.python import postprocess_variants as postprocess_variants_lib
+from deepvariant.vendor import timer
 
 FLAGS = tf.flags.FLAGS
 
@@ -64,7 +66,8 @@ tf.flags.DEFINE_string(
 tf.flags.DEFINE_string(
     'outfile', None,
     'Required. Destination path where we will write output variant calls in '
-    'VCF format.')
+    'VCF format. Paths ending in .vcf.gz or .bcf are written bgzipped or as '
+    'BCF, with a tabix or CSI index alongside.')
 tf.flags.DEFINE_string(
     'ref', None,
     'Required. Genome reference in FAI-indexed FASTA format. Used to determine '
@@ -75,6 +78,37 @@ tf.flags.DEFINE_float(
 tf.flags.DEFINE_float(
     'multi_allelic_qual_filter', 1.0,
     'The qual value below which to filter multi-allelic variants.')
+tf.flags.DEFINE_integer(
+    'max_calls_in_memory', 1000000,
+    'The maximum number of CallVariantsOutput protos to hold in memory while '
+    'sorting them. Larger inputs are sorted in runs spilled to temporary '
+    'files. If 0, all the calls are sorted in memory.')
+tf.flags.DEFINE_integer(
+    'num_reader_threads', 4,
+    'The number of threads reading and parsing the sharded infile.')
+tf.flags.DEFINE_integer(
+    'num_calling_threads', 4,
+    'The number of threads merging and calling the sorted sites, in runs that '
+    'never span contigs, alongside a thread formatting the VCF records. The '
+    'output is the same for any value; 1 does all of this on the writing '
+    'thread.')
+tf.flags.DEFINE_string(
+    'nonvariant_site_tfrecord_path', None,
+    'Optional. Path(s) to the gVCF records of the non-variant sites, as '
+    'Variant protos in TFRecord format, that make_examples wrote with --gvcf. '
+    'Requires --gvcf_outfile.')
+tf.flags.DEFINE_string(
+    'gvcf_outfile', None,
+    'Optional. Destination path where we will write the gVCF of the sample: '
+    'the variant calls merged in order with the records of '
+    '--nonvariant_site_tfrecord_path, trimmed around the variants they '
+    'overlap. The records are sorted in bounded memory as the calls are, and '
+    'written as the sites are called.')
+tf.flags.DEFINE_string(
+    'runtime_metrics', '',
+    'Optional. Path where we should write a RuntimeMetrics proto, in TFRecord '
+    'format, with the wall time of postprocessing, the time of sorting the '
+    'calls and the peak memory they held.')
 
 # The filter field strings to add to variants created by this method.
 DEEP_VARIANT_REF_FILTER = 'RefCall'
@@ -83,16 +117,6 @@ DEEP_VARIANT_PASS = 'PASS'
 DEEP_VARIANT_ALL_FILTER_VALUES = frozenset(
     [DEEP_VARIANT_REF_FILTER, DEEP_VARIANT_QUAL_FILTER, DEEP_VARIANT_PASS])
 
-FILTERS = [
-    core_pb2.VcfFilterInfo(
-        id=DEEP_VARIANT_REF_FILTER,
-        description='Genotyping model thinks this site is reference.'),
-    core_pb2.VcfFilterInfo(
-        id=DEEP_VARIANT_QUAL_FILTER,
-        description=
-        'Confidence in this variant being real is below calling threshold.'),
-]
-
 # Some format fields are indexed by alt allele, such as AD (depth by allele).
 # These need to be cleaned up if we remove any alt alleles. Any info field
 # listed here will be have its values cleaned up if we've removed any alt
@@ -581,14 +605,16 @@ def merge_predictions(call_variants_outputs, qual_filter=None):
 
 def write_call_variants_output_to_vcf(contigs, input_sorted_tfrecord_path,
                                       output_vcf_path, qual_filter,
-                                      multi_allelic_qual_filter, sample_name):
+                                      multi_allelic_qual_filter, sample_name,
+                                      num_threads=1):
   """Reads CallVariantsOutput protos and writes to a VCF file.
 
   Variants present in the input TFRecord are converted to VCF format, with the
   following filters applied: 1) variants are omitted if their quality is lower
   than the `qual_filter` threshold. 2) multi-allelic variants omit individual
   alleles whose qualities are lower than the `multi_allelic_qual_filter`
-  threshold.
+  threshold. The conversion runs in C++, with the same logic as
+  merge_predictions and add_call_to_variant.
 
   Args:
     contigs: list(ContigInfo). A list of the reference genome contigs for
@@ -600,25 +626,57 @@ def write_call_variants_output_to_vcf(contigs, input_sorted_tfrecord_path,
     multi_allelic_qual_filter: double. The qual value below which to filter
       multi-allelic variants.
     sample_name: str. Sample name to write to VCF file.
+    num_threads: int. The number of threads calling the sites. The output is
+      the same for any value.
   """
-  logging.info('Writing calls to VCF file: %s', output_vcf_path)
-  sync_writer, writer_fn = genomics_io.make_variant_writer(
-      output_vcf_path, contigs, samples=[sample_name], filters=FILTERS)
-  with sync_writer, io_utils.AsyncWriter(writer_fn) as writer:
-    for _, group in itertools.groupby(
-        io_utils.read_tfrecords(
-            input_sorted_tfrecord_path,
-            proto=deepvariant_pb2.CallVariantsOutput),
-        lambda x: variantutils.variant_range(x.variant)):
-      outputs = list(group)
-      canonical_variant, predictions = merge_predictions(
-          outputs, multi_allelic_qual_filter)
-      variant = add_call_to_variant(
-          canonical_variant,
-          predictions,
-          qual_filter=qual_filter,
-          sample_name=sample_name)
-      writer.write(variant)
+  postprocess_variants_lib.write_call_variants_output_to_vcf(
+      contigs, input_sorted_tfrecord_path, output_vcf_path, qual_filter,
+      multi_allelic_qual_filter, sample_name, num_threads)
+
+
+def write_call_variants_output_to_vcf_and_gvcf(
+    contigs, ref_reader, input_sorted_tfrecord_path, nonvariant_tfrecord_paths,
+    output_vcf_path, output_gvcf_path, qual_filter, multi_allelic_qual_filter,
+    sample_name, max_records_in_memory=0, num_reader_threads=1,
+    num_threads=1):
+  """Writes the calls to a VCF file, and with the non-variant sites to a gVCF.
+
+  The VCF is the one write_call_variants_output_to_vcf writes. The non-variant
+  gVCF records are sorted like the calls, and then merged with the variants
+  into the gVCF as they are called, each variant with the <*> allele added and
+  the records overlapping it trimmed around it. Only one non-variant record is
+  held in memory during the merge.
+
+  Args:
+    contigs: list(ContigInfo). A list of the reference genome contigs for
+      writers that need contig information.
+    ref_reader: GenomeReference. The reference genome, for the first base of
+      the non-variant records trimmed after a variant.
+    input_sorted_tfrecord_path: str. TFRecord format file containing sorted
+      CallVariantsOutput protos.
+    nonvariant_tfrecord_paths: list(str). TFRecord format files containing the
+      gVCF Variant protos of the non-variant sites, in any order.
+    output_vcf_path: str. Output file in VCF format.
+    output_gvcf_path: str. Output file in gVCF format.
+    qual_filter: double. The qual value below which to filter variants.
+    multi_allelic_qual_filter: double. The qual value below which to filter
+      multi-allelic variants.
+    sample_name: str. Sample name to write to the VCF and gVCF files.
+    max_records_in_memory: int. The maximum number of non-variant records to
+      hold in memory while sorting them, or 0 to sort them all in memory.
+    num_reader_threads: int. The number of threads reading the non-variant
+      records.
+    num_threads: int. The number of threads calling the sites. The outputs are
+      the same for any value.
+  """
+  with tempfile.NamedTemporaryFile() as nonvariant_temp:
+    postprocess_variants_lib.process_nonvariant_sites_tfrecords(
+        contigs, nonvariant_tfrecord_paths, nonvariant_temp.name,
+        max_records_in_memory, num_reader_threads)
+    postprocess_variants_lib.write_call_variants_output_to_vcf_and_gvcf(
+        contigs, ref_reader, input_sorted_tfrecord_path, nonvariant_temp.name,
+        output_vcf_path, output_gvcf_path, qual_filter,
+        multi_allelic_qual_filter, sample_name, num_threads)
 
 
 def main(argv=()):
@@ -629,6 +687,10 @@ def main(argv=()):
           'positional arguments but some are present on the command line: '
           '"{}".'.format(str(argv)), errors.CommandLineError)
     del argv  # Unused.
+    if bool(FLAGS.nonvariant_site_tfrecord_path) != bool(FLAGS.gvcf_outfile):
+      errors.log_and_raise(
+          'Both --nonvariant_site_tfrecord_path and --gvcf_outfile must be set '
+          'to write a gVCF, or neither.', errors.CommandLineError)
     proto_utils.uses_fast_cpp_protos_or_die()
 
     logging_level.set_from_flag()
@@ -636,9 +698,13 @@ def main(argv=()):
     with genomics_io.make_ref_reader(FLAGS.ref) as reader:
       contigs = reader.contigs
     paths = io_utils.maybe_generate_sharded_filenames(FLAGS.infile)
+    if FLAGS.runtime_metrics:
+      stage_timer.set_stage_memory_tracking(True)
+    postprocess_timer = timer.TimerStart()
     with tempfile.NamedTemporaryFile() as temp:
       postprocess_variants_lib.process_single_sites_tfrecords(
-          contigs, paths, temp.name)
+          contigs, paths, temp.name, FLAGS.max_calls_in_memory,
+          FLAGS.num_reader_threads)
       # Read one CallVariantsOutput record and extract the sample name from it.
       # Note that this assumes that all CallVariantsOutput protos in the infile
       # contain a single VariantCall within their constituent Variant proto, and
@@ -648,13 +714,38 @@ def main(argv=()):
               paths[0], proto=deepvariant_pb2.CallVariantsOutput,
               max_records=1))
       sample_name = _extract_single_sample_name(record)
-      write_call_variants_output_to_vcf(
-          contigs=contigs,
-          input_sorted_tfrecord_path=temp.name,
-          output_vcf_path=FLAGS.outfile,
-          qual_filter=FLAGS.qual_filter,
-          multi_allelic_qual_filter=FLAGS.multi_allelic_qual_filter,
-          sample_name=sample_name)
+      if FLAGS.gvcf_outfile:
+        with genomics_io.make_ref_reader(FLAGS.ref) as ref_reader:
+          write_call_variants_output_to_vcf_and_gvcf(
+              contigs=contigs,
+              ref_reader=ref_reader,
+              input_sorted_tfrecord_path=temp.name,
+              nonvariant_tfrecord_paths=(
+                  io_utils.maybe_generate_sharded_filenames(
+                      FLAGS.nonvariant_site_tfrecord_path)),
+              output_vcf_path=FLAGS.outfile,
+              output_gvcf_path=FLAGS.gvcf_outfile,
+              qual_filter=FLAGS.qual_filter,
+              multi_allelic_qual_filter=FLAGS.multi_allelic_qual_filter,
+              sample_name=sample_name,
+              max_records_in_memory=FLAGS.max_calls_in_memory,
+              num_reader_threads=FLAGS.num_reader_threads,
+              num_threads=FLAGS.num_calling_threads)
+      else:
+        write_call_variants_output_to_vcf(
+            contigs=contigs,
+            input_sorted_tfrecord_path=temp.name,
+            output_vcf_path=FLAGS.outfile,
+            qual_filter=FLAGS.qual_filter,
+            multi_allelic_qual_filter=FLAGS.multi_allelic_qual_filter,
+            sample_name=sample_name,
+            num_threads=FLAGS.num_calling_threads)
+    if FLAGS.runtime_metrics:
+      metrics = core_pb2.RuntimeMetrics(
+          wall_time_seconds=postprocess_timer.Stop())
+      metrics.stage_times.extend(stage_timer.take_thread_stage_times())
+      metrics.stage_memory.extend(stage_timer.take_stage_memory())
+      io_utils.write_tfrecords([metrics], FLAGS.runtime_metrics)
 
 
 if __name__ == '__main__':
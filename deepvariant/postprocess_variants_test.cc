@@ -31,9 +31,22 @@
 
 #include "deepvariant/postprocess_variants.h"
 
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+
 #include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/reference_fai.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+#include "deepvariant/vendor/status_matchers.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
 
 #include <gmock/gmock-generated-matchers.h>
 #include <gmock/gmock-matchers.h>
@@ -45,7 +58,11 @@ namespace learning {
 namespace genomics {
 namespace deepvariant {
 
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Variant;
+using learning::genomics::v1::VariantCall;
 using tensorflow::StringPiece;
+using ::testing::ElementsAre;
 
 namespace {
 
@@ -61,6 +78,53 @@ CallVariantsOutput CreateSingleSiteCalls(StringPiece reference_name, int start,
   return single_site_call;
 }
 
+// Returns a CallVariantsOutput of a variant of ref and alts, with one call,
+// for the alt alleles at indices.
+CallVariantsOutput CreateCallVariantsOutput(
+    const std::vector<int>& indices, const std::vector<double>& probabilities,
+    const string& ref, const std::vector<string>& alts) {
+  CallVariantsOutput output = CreateSingleSiteCalls("chr1", 10, 13);
+  output.mutable_variant()->mutable_calls(0)->set_call_set_name("NA12878");
+  output.mutable_variant()->set_reference_bases(ref);
+  for (const string& alt : alts) {
+    output.mutable_variant()->add_alternate_bases(alt);
+  }
+  for (const int index : indices) {
+    output.mutable_alt_allele_indices()->add_indices(index);
+  }
+  for (const double probability : probabilities) {
+    output.add_genotype_probabilities(probability);
+  }
+  return output;
+}
+
+// Returns a gVCF reference block of reference_name from start to end, with
+// one 0/0 call, as make_examples writes them.
+Variant CreateNonVariantBlock(const string& reference_name, int64 start,
+                              int64 end, const string& reference_base) {
+  Variant block;
+  block.set_reference_name(reference_name);
+  block.set_start(start);
+  block.set_end(end);
+  block.set_reference_bases(reference_base);
+  block.add_alternate_bases("<*>");
+  VariantCall* call = block.add_calls();
+  call->set_call_set_name("NA12878");
+  call->add_genotype(0);
+  call->add_genotype(0);
+  return block;
+}
+
+// Returns the serialized protos, to compare them in order.
+template <typename Proto>
+std::vector<string> Serialized(const std::vector<Proto>& protos) {
+  std::vector<string> serialized;
+  for (const Proto& proto : protos) {
+    serialized.push_back(proto.SerializeAsString());
+  }
+  return serialized;
+}
+
 }  // namespace
 
 TEST(ProcessSingleSiteCallTfRecords, BasicCase) {
@@ -78,7 +142,7 @@ TEST(ProcessSingleSiteCallTfRecords, BasicCase) {
   core::WriteProtosToTFRecord(single_site_calls, input_tfrecord_path);
 
   ProcessSingleSiteCallTfRecords(contigs, {input_tfrecord_path},
-                                 output_tfrecord_path);
+                                 output_tfrecord_path, 0, 1);
   std::vector<CallVariantsOutput> output =
       core::ReadProtosFromTFRecord<CallVariantsOutput>(output_tfrecord_path);
 
@@ -97,6 +161,457 @@ TEST(ProcessSingleSiteCallTfRecords, BasicCase) {
   EXPECT_EQ(output[3].variant().end(), 2002);
 }
 
+// Sorting in spilled runs, and reading the shards in parallel, give the same
+// calls, in the same order, as sorting in memory, including for calls at the
+// same site.
+TEST(ProcessSingleSiteCallTfRecords, SortsInBoundedMemory) {
+  std::vector<core::ContigInfo> contigs =
+      core::CreateContigInfos({"chr1", "chr2", "chr10"}, {0, 1, 2});
+  std::mt19937 random(42);
+  std::vector<CallVariantsOutput> all_calls;
+  std::vector<string> input_paths;
+  for (int shard = 0; shard < 3; ++shard) {
+    std::vector<CallVariantsOutput> shard_calls;
+    for (int i = 0; i < 50; ++i) {
+      const int start = random() % 40;
+      CallVariantsOutput call = CreateSingleSiteCalls(
+          contigs[random() % contigs.size()].name(), start,
+          start + 1 + random() % 2);
+      // Tells apart the calls at the same site.
+      call.mutable_variant()->add_names(std::to_string(shard * 100 + i));
+      shard_calls.push_back(call);
+    }
+    // Like the shards of call_variants, the last one is already sorted.
+    if (shard == 2) {
+      std::stable_sort(shard_calls.begin(), shard_calls.end(),
+                       [&contigs](const CallVariantsOutput& a,
+                                  const CallVariantsOutput& b) {
+                         return core::CompareVariants(
+                             a.variant(), b.variant(),
+                             core::MapContigNameToPosInFasta(contigs));
+                       });
+    }
+    input_paths.push_back(core::MakeTempFile(
+        "SortsInBoundedMemory.in" + std::to_string(shard) + ".tfrecord"));
+    core::WriteProtosToTFRecord(shard_calls, input_paths.back());
+    all_calls.insert(all_calls.end(), shard_calls.begin(), shard_calls.end());
+  }
+  const std::map<string, int> contig_name_to_pos_in_fasta =
+      core::MapContigNameToPosInFasta(contigs);
+  std::stable_sort(all_calls.begin(), all_calls.end(),
+                   [&contig_name_to_pos_in_fasta](const CallVariantsOutput& a,
+                                                  const CallVariantsOutput& b) {
+                     return core::CompareVariants(a.variant(), b.variant(),
+                                                  contig_name_to_pos_in_fasta);
+                   });
+
+  for (const int max_calls_in_memory : {0, 1, 7, 50, 1000}) {
+    for (const int num_reader_threads : {1, 2, 8}) {
+      const string output_path =
+          core::MakeTempFile("SortsInBoundedMemory.out.tfrecord");
+      ProcessSingleSiteCallTfRecords(contigs, input_paths, output_path,
+                                     max_calls_in_memory, num_reader_threads);
+      EXPECT_EQ(Serialized(all_calls),
+                Serialized(core::ReadProtosFromTFRecord<CallVariantsOutput>(
+                    output_path)))
+          << "max_calls_in_memory=" << max_calls_in_memory
+          << " num_reader_threads=" << num_reader_threads;
+    }
+  }
+}
+
+TEST(ProcessSingleSiteCallTfRecords, TracksTheMemoryOfTheCalls) {
+  std::vector<core::ContigInfo> contigs =
+      core::CreateContigInfos({"chr1"}, {0});
+  std::vector<CallVariantsOutput> calls;
+  int64 data_bytes = 0;
+  for (int i = 0; i < 1000; ++i) {
+    calls.push_back(CreateSingleSiteCalls("chr1", 1000 - i, 1001 - i));
+    data_bytes += calls.back().ByteSizeLong();
+  }
+  const string input_path =
+      core::MakeTempFile("TracksTheMemoryOfTheCalls.in.tfrecord");
+  const string output_path =
+      core::MakeTempFile("TracksTheMemoryOfTheCalls.out.tfrecord");
+  core::WriteProtosToTFRecord(calls, input_path);
+
+  core::SetStageMemoryTracking(true);
+  std::vector<int64> peaks;
+  for (const int max_calls_in_memory : {0, 10}) {
+    core::TakeStageMemory();
+    ProcessSingleSiteCallTfRecords(contigs, {input_path}, output_path,
+                                   max_calls_in_memory, 1);
+    const std::vector<core::RuntimeStageMemory> memory =
+        core::TakeStageMemory();
+    ASSERT_EQ(memory.size(), 1);
+    EXPECT_EQ(memory[0].stage(), core::CALL_SORTING);
+    EXPECT_EQ(memory[0].live_bytes(), 0);
+    peaks.push_back(memory[0].peak_bytes());
+  }
+  core::SetStageMemoryTracking(false);
+  // All the calls are held at once, unless spilled in runs of 10.
+  EXPECT_GE(peaks[0], data_bytes);
+  EXPECT_LT(peaks[1], data_bytes / 10);
+}
+
+// Calls are sorted by the fields read from their wire format, which skips the
+// others and merges repeated occurrences of the variant as parsing does.
+TEST(ProcessSingleSiteCallTfRecords, SortsByWireFormatFields) {
+  std::vector<core::ContigInfo> contigs =
+      core::CreateContigInfos({"chr1", "chr2"}, {0, 1});
+  CallVariantsOutput full = CreateSingleSiteCalls("chr2", 10, 11);
+  full.mutable_variant()->add_names("full");
+  full.mutable_variant()->set_reference_bases("A");
+  full.mutable_variant()->add_alternate_bases("C");
+  full.mutable_variant()->mutable_calls(0)->add_genotype(1);
+  full.add_genotype_probabilities(0.5);
+  full.mutable_debug_info()->set_is_snp(true);
+  // The reference name, start and end of split come in separate variants.
+  CallVariantsOutput split_name;
+  split_name.mutable_variant()->set_reference_name("chr1");
+  split_name.mutable_variant()->add_calls();
+  CallVariantsOutput split_position;
+  split_position.mutable_variant()->set_start(20);
+  split_position.mutable_variant()->set_end(21);
+  const string split =
+      split_name.SerializeAsString() + split_position.SerializeAsString();
+
+  const string input_path =
+      core::MakeTempFile("SortsByWireFormatFields.in.tfrecord");
+  {
+    std::unique_ptr<tensorflow::WritableFile> file;
+    TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(input_path, &file));
+    tensorflow::io::RecordWriter record_writer(file.get());
+    TF_CHECK_OK(record_writer.WriteRecord(full.SerializeAsString()));
+    TF_CHECK_OK(record_writer.WriteRecord(split));
+  }
+
+  const string output_path =
+      core::MakeTempFile("SortsByWireFormatFields.out.tfrecord");
+  ProcessSingleSiteCallTfRecords(contigs, {input_path}, output_path, 0, 1);
+  CallVariantsOutput merged;
+  ASSERT_TRUE(merged.ParseFromString(split));
+  EXPECT_EQ(Serialized<CallVariantsOutput>({merged, full}),
+            Serialized(core::ReadProtosFromTFRecord<CallVariantsOutput>(
+                output_path)));
+}
+
+TEST(ProcessNonVariantSiteTfRecords, SortsTheBlocks) {
+  std::vector<core::ContigInfo> contigs =
+      core::CreateContigInfos({"chr1", "chr2"}, {0, 1000});
+  const std::vector<Variant> blocks = {
+      CreateNonVariantBlock("chr2", 5, 10, "A"),
+      CreateNonVariantBlock("chr1", 20, 30, "C"),
+      CreateNonVariantBlock("chr1", 0, 20, "G")};
+  const string input_path = core::MakeTempFile("SortsTheBlocks.in.tfrecord");
+  const string output_path = core::MakeTempFile("SortsTheBlocks.out.tfrecord");
+  core::WriteProtosToTFRecord(blocks, input_path);
+
+  ProcessNonVariantSiteTfRecords(contigs, {input_path}, output_path, 0, 1);
+  EXPECT_EQ(Serialized(std::vector<Variant>{blocks[2], blocks[1], blocks[0]}),
+            Serialized(core::ReadProtosFromTFRecord<Variant>(output_path)));
+}
+
+TEST(MostLikelyGenotype, FollowsTheVcfOrdering) {
+  const std::vector<std::vector<int>> expected_genotypes = {
+      {0, 0}, {0, 1}, {1, 1}, {0, 2}, {1, 2}, {2, 2}};
+  for (int best = 0; best < 6; ++best) {
+    std::vector<double> predictions(6, 0.001);
+    predictions[best] = 0.995;
+    int index;
+    std::vector<int> genotype;
+    ASSERT_THAT(MostLikelyGenotype(predictions, 3, &index, &genotype), IsOK());
+    EXPECT_EQ(index, best);
+    EXPECT_EQ(genotype, expected_genotypes[best]);
+  }
+  int index;
+  std::vector<int> genotype;
+  EXPECT_THAT(MostLikelyGenotype({1, 0, 0}, 1, &index, &genotype),
+              IsNotOKWithCode(tensorflow::error::INVALID_ARGUMENT));
+}
+
+TEST(ComputeQuals, CapsAndRoundsQualities) {
+  double gq, qual;
+  ASSERT_THAT(ComputeQuals({0.001, 0.0, 0.999}, 2, &gq, &qual), IsOK());
+  EXPECT_EQ(gq, 30);
+  EXPECT_NEAR(qual, 30, 1e-6);
+  ASSERT_THAT(ComputeQuals({0.001, 0.0, 0.999}, 0, &gq, &qual), IsOK());
+  EXPECT_EQ(gq, 0);
+  // The probabilities sum to more than 1, which is capped.
+  double max_qual;
+  ASSERT_THAT(ComputeQuals({0.0, 0.0, 1.0}, 2, &gq, &max_qual), IsOK());
+  ASSERT_THAT(ComputeQuals({0.0, 0.00011, 0.9999}, 2, &gq, &qual), IsOK());
+  EXPECT_EQ(gq, 40);
+  EXPECT_EQ(qual, max_qual);
+  EXPECT_THAT(ComputeQuals({1.5, 0.0, 0.0}, 0, &gq, &qual),
+              IsNotOKWithCode(tensorflow::error::INVALID_ARGUMENT));
+}
+
+TEST(MergePredictions, TakesTheMinimumProbabilityOfEachGenotype) {
+  const std::vector<string> alts = {"C", "G", "T"};
+  std::vector<CallVariantsOutput> inputs = {
+      CreateCallVariantsOutput({0}, {0.999, 0.001, 0}, "A", alts),
+      CreateCallVariantsOutput({0, 1}, {0, 1, 0}, "A", alts),
+      CreateCallVariantsOutput({0, 2}, {0.0001, 0.9996, 0.0003}, "A", alts),
+      CreateCallVariantsOutput({1}, {0, 1, 0}, "A", alts),
+      CreateCallVariantsOutput({1, 2}, {0.0001, 0.0002, 0.9997}, "A", alts),
+      CreateCallVariantsOutput({2}, {0.00004, 0.9999, 0.00006}, "A", alts)};
+  const std::vector<double> unnormalized = {
+      0, 0.001, 0, 0.0002, 0, 0, 0.0002, 0.0003, 0.9997, 0.00006};
+  double denominator = 0;
+  for (const double p : unnormalized) denominator += p;
+  std::sort(inputs.begin(), inputs.end(),
+            [](const CallVariantsOutput& a, const CallVariantsOutput& b) {
+              return a.genotype_probabilities(0) < b.genotype_probabilities(0);
+            });
+  do {
+    Variant variant;
+    std::vector<double> predictions;
+    ASSERT_THAT(MergePredictions(inputs, 0, &variant, &predictions), IsOK());
+    EXPECT_THAT(variant, EqualsProto(inputs[0].variant()));
+    ASSERT_EQ(predictions.size(), unnormalized.size());
+    for (size_t i = 0; i < predictions.size(); ++i) {
+      EXPECT_NEAR(predictions[i], unnormalized[i] / denominator, 1e-7);
+    }
+  } while (std::next_permutation(
+      inputs.begin(), inputs.end(),
+      [](const CallVariantsOutput& a, const CallVariantsOutput& b) {
+        return a.genotype_probabilities(0) < b.genotype_probabilities(0);
+      }));
+}
+
+TEST(MergePredictions, RemovesLowQualityAllelesAndSimplifies) {
+  const std::vector<string> alts = {"CA", "C"};
+  std::vector<CallVariantsOutput> inputs = {
+      CreateCallVariantsOutput({0}, {0.0, 1.0, 0.0}, "CCA", alts),
+      CreateCallVariantsOutput({1}, {1.0, 0.0, 0.0}, "CCA", alts),
+      CreateCallVariantsOutput({0, 1}, {0.0, 1.0, 0.0}, "CCA", alts)};
+  Variant variant;
+  std::vector<double> predictions;
+  ASSERT_THAT(MergePredictions(inputs, 2, &variant, &predictions), IsOK());
+  EXPECT_EQ(variant.reference_bases(), "CC");
+  EXPECT_THAT(variant.alternate_bases(), ElementsAre("C"));
+  EXPECT_THAT(predictions, ElementsAre(0.0, 1.0, 0.0));
+}
+
+TEST(MergePredictions, RejectsInconsistentOutputs) {
+  Variant variant;
+  std::vector<double> predictions;
+  EXPECT_THAT(MergePredictions({}, 0, &variant, &predictions),
+              IsNotOKWithCode(tensorflow::error::INVALID_ARGUMENT));
+  // Missing the outputs for T and for both alts.
+  EXPECT_THAT(
+      MergePredictions(
+          {CreateCallVariantsOutput({0}, {0.19, 0.75, 0.06}, "A", {"G", "T"})},
+          0, &variant, &predictions),
+      IsNotOKWithCode(tensorflow::error::INVALID_ARGUMENT));
+  // The alts of the variants differ in order.
+  EXPECT_THAT(
+      MergePredictions(
+          {CreateCallVariantsOutput({0}, {0.999, 0.001, 0}, "A", {"T", "C"}),
+           CreateCallVariantsOutput({1}, {0.2, 0.8, 0}, "A", {"T", "C"}),
+           CreateCallVariantsOutput({0, 1}, {0.2, 0.8, 0}, "A", {"C", "T"})},
+          0, &variant, &predictions),
+      IsNotOKWithCode(tensorflow::error::INVALID_ARGUMENT));
+}
+
+TEST(AddCallToVariant, SetsTheCallAndFilter) {
+  Variant variant =
+      CreateCallVariantsOutput({0}, {}, "C", {"CT"}).variant();
+  ASSERT_THAT(AddCallToVariant({0.001, 0.999, 0.0}, 0, "NA12878", &variant),
+              IsOK());
+  EXPECT_NEAR(variant.quality(), 30, 1e-6);
+  EXPECT_THAT(variant.filter(), ElementsAre(kPassFilter));
+  const VariantCall& call = variant.calls(0);
+  EXPECT_EQ(call.call_set_name(), "NA12878");
+  EXPECT_THAT(call.genotype(), ElementsAre(0, 1));
+  EXPECT_EQ(call.info().at("GQ").values(0).number_value(), 30);
+  ASSERT_EQ(call.genotype_likelihood_size(), 3);
+  EXPECT_NEAR(call.genotype_likelihood(0), -3.0, 1e-6);
+  EXPECT_NEAR(call.genotype_likelihood(1), -0.00043451177, 1e-6);
+  EXPECT_NEAR(call.genotype_likelihood(2), -15.0003472607, 1e-6);
+
+  ASSERT_THAT(AddCallToVariant({0.99, 0.005, 0.005}, 0, "NA12878", &variant),
+              IsOK());
+  EXPECT_THAT(variant.filter(), ElementsAre(kRefCallFilter));
+  EXPECT_THAT(variant.calls(0).genotype(), ElementsAre(0, 0));
+  ASSERT_THAT(AddCallToVariant({0.3, 0.7, 0.0}, 10, "NA12878", &variant),
+              IsOK());
+  EXPECT_THAT(variant.filter(), ElementsAre(kLowQualFilter));
+}
+
+TEST(WriteCallVariantsOutputToVcf, MergesTheOutputsOfEachSite) {
+  std::vector<core::ContigInfo> contigs =
+      core::CreateContigInfos({"chr1"}, {0});
+  std::vector<CallVariantsOutput> inputs = {
+      CreateCallVariantsOutput({0}, {0.19, 0.75, 0.06}, "A", {"C", "T"}),
+      CreateCallVariantsOutput({1}, {0.03, 0.93, 0.04}, "A", {"C", "T"}),
+      CreateCallVariantsOutput({0, 1}, {0.03, 0.92, 0.05}, "A", {"C", "T"}),
+      CreateCallVariantsOutput({0}, {0.01, 0.0, 0.99}, "G", {"A"})};
+  inputs[3].mutable_variant()->set_start(20);
+  inputs[3].mutable_variant()->set_end(21);
+  const string input_path =
+      core::MakeTempFile("MergesTheOutputsOfEachSite.in.tfrecord");
+  core::WriteProtosToTFRecord(inputs, input_path);
+
+  std::vector<Variant> expected(2);
+  std::vector<double> predictions;
+  ASSERT_THAT(MergePredictions({inputs.begin(), inputs.begin() + 3}, 1,
+                               &expected[0], &predictions),
+              IsOK());
+  ASSERT_THAT(AddCallToVariant(predictions, 1, "NA12878", &expected[0]),
+              IsOK());
+  expected[1] = inputs[3].variant();
+  ASSERT_THAT(AddCallToVariant({0.01, 0.0, 0.99}, 1, "NA12878", &expected[1]),
+              IsOK());
+
+  const string output_path =
+      core::MakeTempFile("MergesTheOutputsOfEachSite.out.tfrecord");
+  ASSERT_THAT(WriteCallVariantsOutputToVcf(contigs, input_path, output_path, 1,
+                                           1, "NA12878", 1),
+              IsOK());
+  const std::vector<Variant> output =
+      core::ReadProtosFromTFRecord<Variant>(output_path);
+  ASSERT_EQ(output.size(), 2);
+  EXPECT_THAT(output[0], EqualsProto(expected[0]));
+  EXPECT_THAT(output[1], EqualsProto(expected[1]));
+}
+
+TEST(WriteCallVariantsOutputToVcf, ThreadsWriteTheSameVariants) {
+  std::vector<core::ContigInfo> contigs =
+      core::CreateContigInfos({"chr1", "chr2", "chr3"}, {0, 1000, 2000});
+  // Enough sites on chr1 to make several chunks, and sites with one or all of
+  // their alt alleles.
+  std::mt19937 generator(17);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::vector<CallVariantsOutput> inputs;
+  for (const auto& contig_sites : std::vector<std::pair<string, int>>{
+           {"chr1", 5000}, {"chr2", 10}, {"chr3", 1000}}) {
+    for (int start = 0; start < contig_sites.second; ++start) {
+      const bool multi_allelic = start % 3 == 0;
+      const std::vector<std::vector<int>> site_indices =
+          multi_allelic ? std::vector<std::vector<int>>{{0}, {1}, {0, 1}}
+                        : std::vector<std::vector<int>>{{0}};
+      for (const std::vector<int>& indices : site_indices) {
+        const double ref = uniform(generator);
+        const double het = (1 - ref) * uniform(generator);
+        inputs.push_back(CreateCallVariantsOutput(
+            indices, {ref, het, 1 - ref - het}, "A",
+            multi_allelic ? std::vector<string>{"C", "T"}
+                          : std::vector<string>{"C"}));
+        Variant* variant = inputs.back().mutable_variant();
+        variant->set_reference_name(contig_sites.first);
+        variant->set_start(start);
+        variant->set_end(start + 1);
+      }
+    }
+  }
+  const string input_path =
+      core::MakeTempFile("ThreadsWriteTheSameVariants.in.tfrecord");
+  core::WriteProtosToTFRecord(inputs, input_path);
+
+  const string expected_path =
+      core::MakeTempFile("ThreadsWriteTheSameVariants.1.tfrecord");
+  ASSERT_THAT(WriteCallVariantsOutputToVcf(contigs, input_path, expected_path,
+                                           1, 1, "NA12878", 1),
+              IsOK());
+  const std::vector<Variant> expected =
+      core::ReadProtosFromTFRecord<Variant>(expected_path);
+  EXPECT_EQ(expected.size(), 6010);
+  for (const int num_threads : {2, 4}) {
+    const string output_path = core::MakeTempFile(
+        "ThreadsWriteTheSameVariants." + std::to_string(num_threads) +
+        ".tfrecord");
+    ASSERT_THAT(WriteCallVariantsOutputToVcf(contigs, input_path, output_path,
+                                             1, 1, "NA12878", num_threads),
+                IsOK());
+    EXPECT_EQ(Serialized(expected),
+              Serialized(core::ReadProtosFromTFRecord<Variant>(output_path)))
+        << num_threads;
+  }
+}
+
+TEST(WriteCallVariantsOutputToVcfAndGvcf, TrimsTheBlocksAroundTheVariants) {
+  const string fasta = core::GetTestData("ucsc.hg19.chr20.unittest.fasta.gz",
+                                         "deepvariant/testdata");
+  std::unique_ptr<core::GenomeReferenceFai> reference =
+      std::move(core::GenomeReferenceFai::FromFile(fasta, fasta + ".fai")
+                    .ValueOrDie());
+  const std::vector<core::ContigInfo> contigs = reference->Contigs();
+  // A SNP at 10000010 and a deletion of 10000025 to 10000027.
+  std::vector<CallVariantsOutput> inputs = {
+      CreateCallVariantsOutput({0}, {0.01, 0.98, 0.01}, "A", {"C"}),
+      CreateCallVariantsOutput({0}, {0.01, 0.01, 0.98}, "ATT", {"A"})};
+  Variant* snp = inputs[0].mutable_variant();
+  snp->set_reference_name("chr20");
+  snp->set_start(10000010);
+  snp->set_end(10000011);
+  Variant* deletion = inputs[1].mutable_variant();
+  deletion->set_reference_name("chr20");
+  deletion->set_start(10000025);
+  deletion->set_end(10000028);
+  const string input_path =
+      core::MakeTempFile("TrimsTheBlocksAroundTheVariants.in.tfrecord");
+  core::WriteProtosToTFRecord(inputs, input_path);
+  // Blocks before, around, and after the SNP, the last one ending in the
+  // deletion, and a block after the deletion.
+  const std::vector<Variant> blocks = {
+      CreateNonVariantBlock("chr20", 9999990, 10000000, "C"),
+      CreateNonVariantBlock("chr20", 10000000, 10000020, "G"),
+      CreateNonVariantBlock("chr20", 10000020, 10000026, "T"),
+      CreateNonVariantBlock("chr20", 10000030, 10000040, "A")};
+  const string nonvariant_path =
+      core::MakeTempFile("TrimsTheBlocksAroundTheVariants.nonvariant.tfrecord");
+  core::WriteProtosToTFRecord(blocks, nonvariant_path);
+
+  const string expected_vcf_path =
+      core::MakeTempFile("TrimsTheBlocksAroundTheVariants.expected.tfrecord");
+  ASSERT_THAT(WriteCallVariantsOutputToVcf(contigs, input_path,
+                                           expected_vcf_path, 1, 1, "NA12878",
+                                           1),
+              IsOK());
+  const std::vector<Variant> variants =
+      core::ReadProtosFromTFRecord<Variant>(expected_vcf_path);
+  ASSERT_EQ(variants.size(), 2);
+  for (const int num_threads : {1, 2}) {
+    const string vcf_path = core::MakeTempFile(
+        "TrimsTheBlocksAroundTheVariants.vcf." + std::to_string(num_threads));
+    const string gvcf_path = core::MakeTempFile(
+        "TrimsTheBlocksAroundTheVariants.gvcf." + std::to_string(num_threads));
+    ASSERT_THAT(WriteCallVariantsOutputToVcfAndGvcf(
+                    contigs, *reference, input_path, nonvariant_path, vcf_path,
+                    gvcf_path, 1, 1, "NA12878", num_threads),
+                IsOK());
+    EXPECT_EQ(Serialized(variants),
+              Serialized(core::ReadProtosFromTFRecord<Variant>(vcf_path)));
+
+    const std::vector<Variant> gvcf =
+        core::ReadProtosFromTFRecord<Variant>(gvcf_path);
+    ASSERT_EQ(gvcf.size(), 7);
+    EXPECT_THAT(gvcf[0], EqualsProto(blocks[0]));
+    Variant before_snp = blocks[1];
+    before_snp.set_end(10000010);
+    EXPECT_THAT(gvcf[1], EqualsProto(before_snp));
+    EXPECT_THAT(gvcf[2].alternate_bases(), ElementsAre("C", "<*>"));
+    EXPECT_THAT(gvcf[2].calls(0).genotype_likelihood(),
+                ElementsAre(variants[0].calls(0).genotype_likelihood(0),
+                            variants[0].calls(0).genotype_likelihood(1),
+                            variants[0].calls(0).genotype_likelihood(2), -99,
+                            -99, -99));
+    Variant after_snp = blocks[1];
+    after_snp.set_start(10000011);
+    after_snp.set_reference_bases(
+        reference->GetBases(core::MakeRange("chr20", 10000011, 10000012))
+            .ValueOrDie());
+    EXPECT_THAT(gvcf[3], EqualsProto(after_snp));
+    Variant before_deletion = blocks[2];
+    before_deletion.set_end(10000025);
+    EXPECT_THAT(gvcf[4], EqualsProto(before_deletion));
+    EXPECT_THAT(gvcf[5].alternate_bases(), ElementsAre("A", "<*>"));
+    EXPECT_THAT(gvcf[6], EqualsProto(blocks[3]));
+  }
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
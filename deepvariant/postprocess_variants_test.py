@@ -46,8 +46,10 @@ import tensorflow as tf
 from absl import logging
 from deepvariant import postprocess_variants
 from deepvariant import test_utils
+from deepvariant.core import genomics_io
 from deepvariant.core import io_utils
 from deepvariant.core import math
+from deepvariant.core import variantutils
 from deepvariant.core.genomics import variants_pb2
 from deepvariant.protos import deepvariant_pb2
 from deepvariant.testing import flagsaver
@@ -181,6 +183,66 @@ class PostprocessVariantsTest(parameterized.TestCase):
         tf.gfile.FastGFile(FLAGS.outfile).readlines(),
         tf.gfile.FastGFile(test_utils.GOLDEN_POSTPROCESS_OUTPUT).readlines())
 
+  @parameterized.parameters(0, 50)
+  @flagsaver.FlagSaver
+  def test_call_end2end_with_gvcf(self, max_calls_in_memory):
+    FLAGS.infile = make_golden_dataset()
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.outfile = test_utils.test_tmpfile('gvcf_calls.vcf')
+    FLAGS.nonvariant_site_tfrecord_path = (
+        test_utils.GOLDEN_POSTPROCESS_GVCF_INPUT)
+    # Written as Variant protos, which keep the end of each record.
+    FLAGS.gvcf_outfile = test_utils.test_tmpfile('gvcf_calls.g.tfrecord')
+    FLAGS.max_calls_in_memory = max_calls_in_memory
+
+    postprocess_variants.main(['postprocess_variants.py'])
+
+    # The VCF is the same as without the gVCF.
+    self.assertEqual(
+        tf.gfile.FastGFile(FLAGS.outfile).readlines(),
+        tf.gfile.FastGFile(test_utils.GOLDEN_POSTPROCESS_OUTPUT).readlines())
+
+    # The gVCF holds the variants, with the <*> allele, in order among the
+    # non-variant records, which are trimmed to the positions outside them.
+    gvcf = list(
+        io_utils.read_tfrecords(FLAGS.gvcf_outfile, proto=variants_pb2.Variant))
+    self.assertEqual(sorted(gvcf, key=lambda record: record.start), gvcf)
+    for record in gvcf:
+      self.assertIn(variantutils.GVCF_ALT_ALLELE, record.alternate_bases)
+    blocks = [record for record in gvcf if variantutils.is_gvcf(record)]
+    variants = [record for record in gvcf if not variantutils.is_gvcf(record)]
+    with genomics_io.make_vcf_reader(
+        FLAGS.outfile, use_index=False) as vcf_reader:
+      self.assertEqual(
+          [(v.start, list(v.alternate_bases) + [variantutils.GVCF_ALT_ALLELE])
+           for v in vcf_reader.iterate()],
+          [(v.start, list(v.alternate_bases)) for v in variants])
+
+    def positions(records):
+      return {pos for record in records for pos in range(record.start,
+                                                         record.end)}
+
+    nonvariants = io_utils.read_tfrecords(
+        test_utils.GOLDEN_POSTPROCESS_GVCF_INPUT, proto=variants_pb2.Variant)
+    self.assertFalse(positions(blocks) & positions(variants))
+    self.assertEqual(
+        positions(blocks) | positions(variants),
+        positions(nonvariants) | positions(variants))
+
+  @flagsaver.FlagSaver
+  def test_catches_gvcf_outfile_without_nonvariant_sites(self):
+    FLAGS.infile = make_golden_dataset()
+    FLAGS.ref = test_utils.CHR20_FASTA
+    FLAGS.outfile = test_utils.test_tmpfile('no_nonvariant_sites.vcf')
+    FLAGS.gvcf_outfile = test_utils.test_tmpfile('no_nonvariant_sites.g.vcf')
+    with mock.patch.object(logging, 'error') as mock_logging,\
+        mock.patch.object(sys, 'exit') as mock_exit:
+      postprocess_variants.main(['postprocess_variants.py'])
+    mock_logging.assert_called_once_with(
+        'Both --nonvariant_site_tfrecord_path and --gvcf_outfile must be set '
+        'to write a gVCF, or neither.')
+    mock_exit.assert_called_once_with(errno.ENOENT)
+
   def test_extract_single_variant_name(self):
     record = _create_call_variants_output(
         indices=[0], probabilities=[0.19, 0.75, 0.06], ref='A', alts=['C', 'T'])
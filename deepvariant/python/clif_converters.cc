@@ -31,6 +31,7 @@
 
 #include "deepvariant/python/clif_converters.h"
 
+#include <cstring>
 #include <memory>
 #include <mutex>
 
@@ -47,6 +48,8 @@
 namespace clif {
 
 using learning::genomics::deepvariant::ImageRow;
+using learning::genomics::deepvariant::PileupImage;
+using learning::genomics::deepvariant::kNumChannels;
 using tensorflow::string;
 
 // We need to initialize the numpy C ARRAY API via a call to import_array():
@@ -84,4 +87,21 @@ PyObject* Clif_PyObjFrom(std::unique_ptr<ImageRow> upr,
   return PyArray_Return(res);
 }
 
+PyObject* Clif_PyObjFrom(std::unique_ptr<PileupImage> image,
+                         clif::py::PostConv unused) {
+  // Initialize numpy C array API if needed.
+  std::call_once(import_array_flag, call_import_array);
+  if (!image) { Py_RETURN_NONE; }
+
+  // PileupImage is already laid out as a C-contiguous HWC or CHW array, so
+  // this is a single copy.
+  npy_intp hwc_dims[] { image->height, image->width, kNumChannels };
+  npy_intp chw_dims[] { kNumChannels, image->height, image->width };
+  PyArrayObject* res = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(
+      3, image->planar ? chw_dims : hwc_dims, PyArray_UBYTE));
+  CHECK(res != nullptr);
+  std::memcpy(PyArray_DATA(res), image->data.data(), image->data.size());
+  return PyArray_Return(res);
+}
+
 }  // namespace clif
@@ -41,12 +41,19 @@ namespace clif {
 
 // Note: comment below is an instruction to CLIF.
 // CLIF use `learning::genomics::deepvariant::ImageRow` as ImageRow
+// CLIF use `learning::genomics::deepvariant::PileupImage` as PileupImage
 
 // Convert an ImageRow to a numpy 3D array (adds a leading dimension 1).
 PyObject* Clif_PyObjFrom(
     std::unique_ptr<learning::genomics::deepvariant::ImageRow> img_row,
     clif::py::PostConv pc);
 
+// Convert a PileupImage to a numpy 3D array of shape (height, width, 7), or
+// (7, height, width) if the image is planar.
+PyObject* Clif_PyObjFrom(
+    std::unique_ptr<learning::genomics::deepvariant::PileupImage> image,
+    clif::py::PostConv pc);
+
 }  // namespace clif
 
 #endif  // LEARNING_GENOMICS_DEEPVARIANT_PYTHON_CLIF_CONVERTERS_H_
@@ -36,6 +36,7 @@ from __future__ import print_function
 from absl.testing import absltest
 
 from deepvariant import test_utils
+from deepvariant import variant_caller
 
 from deepvariant.core import genomics_io
 from deepvariant.core import ranges
@@ -85,6 +86,78 @@ class WrapVariantCallingTest(absltest.TestCase):
     for candidate in candidates:
       self.assertIsInstance(candidate, deepvariant_pb2.DeepVariantCall)
 
+  def test_make_gvcfs_matches_python(self):
+    ref = genomics_io.make_ref_reader(test_utils.CHR20_FASTA)
+    sam_reader = genomics_io.make_sam_reader(test_utils.CHR20_BAM)
+    size = 1000
+    region = ranges.make_range('chr20', 10000000, 10000000 + size)
+    allele_counter = _allelecounter.AlleleCounter(
+        ref, region, deepvariant_pb2.AlleleCounterOptions(partition_size=size))
+    for read in sam_reader.query(region):
+      allele_counter.add(read)
+    options = deepvariant_pb2.VariantCallerOptions(
+        sample_name='sample_name',
+        p_error=0.001,
+        max_gq=50,
+        gq_resolution=1,
+        ploidy=2)
+    caller = variant_calling.VariantCaller(options)
+
+    # Our native gVCF records are those variant_caller computes in Python,
+    # with and without rescaling the counts of deep positions.
+    for max_coverage in [0, 20]:
+      python_caller = variant_caller.VariantCaller(
+          options,
+          use_cache_table=max_coverage > 0,
+          max_cache_coverage=max_coverage)
+      expected = list(
+          python_caller.make_gvcfs(allele_counter.summary_counts()))
+      actual = caller.make_gvcfs(allele_counter, max_coverage)
+      self.assertNotEmpty(actual)
+      self.assertEqual(len(expected), len(actual))
+      for expected_gvcf, actual_gvcf in zip(expected, actual):
+        self.assertEqual(expected_gvcf.start, actual_gvcf.start)
+        self.assertEqual(expected_gvcf.end, actual_gvcf.end)
+        self.assertEqual(expected_gvcf.reference_bases,
+                         actual_gvcf.reference_bases)
+        self.assertEqual(expected_gvcf.calls[0].info['GQ'],
+                         actual_gvcf.calls[0].info['GQ'])
+        for expected_gl, actual_gl in zip(
+            expected_gvcf.calls[0].genotype_likelihood,
+            actual_gvcf.calls[0].genotype_likelihood):
+          self.assertAlmostEqual(expected_gl, actual_gl, places=6)
+
+  def test_make_gvcfs_banding(self):
+    # With a gq_resolution of 1000 every GQ is in the same band, so the whole
+    # region is one block with the smallest GQ of its positions.
+    ref = genomics_io.make_ref_reader(test_utils.CHR20_FASTA)
+    region = ranges.make_range('chr20', 10000000, 10000100)
+    allele_counter = _allelecounter.AlleleCounter(
+        ref, region, deepvariant_pb2.AlleleCounterOptions(partition_size=100))
+    caller = variant_calling.VariantCaller(
+        deepvariant_pb2.VariantCallerOptions(
+            sample_name='sample_name',
+            p_error=0.001,
+            max_gq=50,
+            gq_resolution=1000,
+            ploidy=2))
+    gvcfs = caller.make_gvcfs(allele_counter, 100)
+    self.assertLen(gvcfs, 1)
+    self.assertEqual(gvcfs[0].start, region.start)
+    self.assertEqual(gvcfs[0].end, region.end)
+    self.assertEqual(gvcfs[0].alternate_bases, ['<*>'])
+    self.assertEqual(list(gvcfs[0].calls[0].genotype), [0, 0])
+
+  def test_make_gvcfs_raises_with_bad_ploidy(self):
+    ref = genomics_io.make_ref_reader(test_utils.CHR20_FASTA)
+    region = ranges.make_range('chr20', 10000000, 10000100)
+    allele_counter = _allelecounter.AlleleCounter(
+        ref, region, deepvariant_pb2.AlleleCounterOptions(partition_size=100))
+    caller = variant_calling.VariantCaller(
+        deepvariant_pb2.VariantCallerOptions(ploidy=3))
+    with self.assertRaisesRegexp(ValueError, 'we only support ploidy=2'):
+      caller.make_gvcfs(allele_counter, 100)
+
 
 if __name__ == '__main__':
   absltest.main()
@@ -0,0 +1,92 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Tests for VariantLabelerNative CLIF python wrappers."""
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+
+
+from absl.testing import absltest
+
+from deepvariant import test_utils
+from deepvariant import variant_labeler
+from deepvariant.core import genomics_io
+from deepvariant.core import ranges
+from deepvariant.protos import deepvariant_pb2
+from deepvariant.python import variant_labeler_native
+
+
+def setUpModule():
+  test_utils.init()
+
+
+class WrapVariantLabelerNativeTest(absltest.TestCase):
+
+  def test_label_calls_matches_python(self):
+    region = ranges.parse_literal('chr20:10,000,000-10,010,000')
+    with genomics_io.make_vcf_reader(
+        test_utils.TRUTH_VARIANTS_VCF, genotypes_only=True) as vcf_reader:
+      truth_variants = list(vcf_reader.query(region))
+    self.assertNotEmpty(truth_variants)
+
+    # Candidates with the alleles of each truth variant and with other ones,
+    # at the start of the truth variant and right after it.
+    candidates = []
+    for truth_variant in truth_variants:
+      for start in [truth_variant.start, truth_variant.start + 1]:
+        for alleles in [[truth_variant.reference_bases] +
+                        list(truth_variant.alternate_bases),
+                        [truth_variant.reference_bases, 'N'],
+                        [truth_variant.reference_bases]]:
+          candidates.append(
+              deepvariant_pb2.DeepVariantCall(
+                  variant=test_utils.make_variant(
+                      chrom=truth_variant.reference_name,
+                      start=start,
+                      alleles=alleles)))
+
+    variant_index = genomics_io.make_variant_index(
+        test_utils.TRUTH_VARIANTS_VCF, [region], genotypes_only=True)
+    range_index = genomics_io.make_range_index(test_utils.CONFIDENT_REGIONS_BED)
+    native_labeler = variant_labeler_native.VariantLabelerNative(
+        variant_index, range_index)
+    python_labeler = variant_labeler.VariantLabeler(
+        genomics_io.make_vcf_reader(
+            test_utils.TRUTH_VARIANTS_VCF, genotypes_only=True),
+        ranges.RangeSet.from_bed(test_utils.CONFIDENT_REGIONS_BED))
+
+    labels = native_labeler.label_calls(candidates)
+    self.assertEqual(python_labeler.label_calls(candidates), labels)
+    self.assertTrue(any(label.alt_allele_counts for label in labels))
+    self.assertTrue(any(not label.is_confident for label in labels))
+
+
+if __name__ == '__main__':
+  absltest.main()
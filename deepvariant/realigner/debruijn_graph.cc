@@ -32,22 +32,20 @@
 #include "deepvariant/realigner/debruijn_graph.h"
 
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <queue>
 #include <sstream>
-#include <tuple>
+#include <utility>
 #include <vector>
 
 #include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/core/utils.h"
 #include "deepvariant/protos/realigner.pb.h"
-#include "boost/graph/adjacency_list.hpp"
-#include "boost/graph/depth_first_search.hpp"
-#include "boost/graph/graph_traits.hpp"
-#include "boost/graph/graphviz.hpp"
-#include "boost/graph/reverse_graph.hpp"
 #include "tensorflow/core/platform/logging.h"
-#include "tensorflow/core/lib/strings/str_util.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
 
 namespace learning {
@@ -55,166 +53,467 @@ namespace genomics {
 namespace deepvariant {
 
 using Vertex = DeBruijnGraph::Vertex;
-using VertexIndexMap = DeBruijnGraph::VertexIndexMap;
-using Edge = DeBruijnGraph::Edge;
-using Path = DeBruijnGraph::Path;
 
 using Read = learning::genomics::v1::Read;
 
 using tensorflow::string;
 using tensorflow::StringPiece;
 
-namespace {
-
-// Visitor classes we will use to run boost algorithms.  N.B.: these classes
-// operate by side effect, modifying pointers that are passed in.  This is not
-// an optimal design, rather it is to work around the copying done by
-// boost::visitor which makes it difficult for our code to retain a pointer to
-// the visitor object that is actually used.
+constexpr Vertex DeBruijnGraph::kNoVertex;
+constexpr int DeBruijnGraph::kNoEdge;
 
-class CycleDetector : public boost::dfs_visitor<> {
- public:
-  explicit CycleDetector(bool* has_cycle) : has_cycle(has_cycle) {}
+namespace {
 
-  template <class Edge, class Graph>
-  void back_edge(Edge, const Graph&) {
-    *has_cycle = true;
+// Returns the 2-bit code of base.  Non-ACGT bases share the code of A; kmers
+// containing them are distinguished by label comparison in the kmer table.
+inline tensorflow::uint64 BaseCode(char base) {
+  switch (base) {
+    case 'C': case 'c': return 1;
+    case 'G': case 'g': return 2;
+    case 'T': case 't': return 3;
+    default: return 0;
   }
+}
 
- private:
-  bool* has_cycle;
-};
+constexpr tensorflow::uint64 kFibonacciMultiplier = 0x9E3779B97F4A7C15ULL;
 
-template <class BoostGraph>
-class EdgeLabelWriter {
- public:
-  explicit EdgeLabelWriter(const BoostGraph& g) : g_(g) {}
+// The kmer table starts with 2^kMinKmerSlotBits slots.
+constexpr int kMinKmerSlotBits = 8;
 
-  void operator()(std::ostream& out, const Edge e) const {
-    EdgeInfo ei = g_[e];
-    out << "[label=" << ei.weight << (ei.is_ref ? " color=red" : "") << "]";
+// Returns id as a GraphViz ID: verbatim if it is alphanumeric, and otherwise
+// as a quoted string.
+string DotId(StringPiece id) {
+  bool is_plain =
+      !id.empty() && !std::isdigit(static_cast<unsigned char>(id[0]));
+  for (char c : id) {
+    is_plain &= std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+  }
+  if (is_plain) {
+    return string(id.data(), id.size());
   }
+  string quoted = "\"";
+  for (char c : id) {
+    if (c == '"') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
 
- private:
-  const BoostGraph& g_;
-};
+// Marks all the vertices reachable from start in visited, following the edges
+// for which keep_edge is true.  first_edge and next_edge are the heads and
+// links of the adjacency lists to follow, and endpoint maps an edge to its
+// vertex at the far end of the list's direction.
+template <class Endpoint>
+void MarkReachable(Vertex start, const std::vector<int>& first_edge,
+                   const std::vector<int>& next_edge,
+                   const std::vector<bool>& keep_edge, Endpoint endpoint,
+                   std::vector<bool>* visited) {
+  std::vector<Vertex> stack = {start};
+  (*visited)[start] = true;
+  while (!stack.empty()) {
+    Vertex v = stack.back();
+    stack.pop_back();
+    for (int e = first_edge[v]; e != -1; e = next_edge[e]) {
+      Vertex w = endpoint(e);
+      if (keep_edge[e] && !(*visited)[w]) {
+        (*visited)[w] = true;
+        stack.push_back(w);
+      }
+    }
+  }
+}
 
-class ReachableVertexVisitor : public boost::dfs_visitor<> {
- public:
-  explicit ReachableVertexVisitor(std::set<Vertex>* reachable_vertices)
-      : reachable_vertices(reachable_vertices) {}
+}  // namespace
 
-  template <class Edge, class Graph>
-  void tree_edge(Edge e, const Graph& g) {
-    Vertex from = boost::source(e, g);
-    if (reachable_vertices->find(from) != reachable_vertices->end()) {
-      Vertex to = boost::target(e, g);
-      reachable_vertices->insert(to);
-    }
+tensorflow::uint64 DeBruijnGraph::HashKmer(StringPiece kmer) const {
+  tensorflow::uint64 hash = 0;
+  for (char base : kmer) {
+    hash = RollKmerHash(hash, base);
   }
+  return hash;
+}
 
- private:
-  std::set<Vertex>* reachable_vertices;
-};
+tensorflow::uint64 DeBruijnGraph::RollKmerHash(tensorflow::uint64 hash,
+                                               char base) const {
+  return ((hash << 2) | BaseCode(base)) & kmer_hash_mask_;
+}
 
-template <class BoostGraphT, class VertexIndexMapT>
-std::set<Vertex> VerticesReachableFrom(
-    Vertex v, const BoostGraphT& g, const VertexIndexMapT& vertex_index_map) {
-  std::set<Vertex> reachable_vertices{v};
-  ReachableVertexVisitor vis(&reachable_vertices);
-  boost::depth_first_search(
-      g, boost::visitor(vis).root_vertex(v).vertex_index_map(vertex_index_map));
-  return reachable_vertices;
+size_t DeBruijnGraph::FindKmerSlot(StringPiece kmer,
+                                   tensorflow::uint64 hash) const {
+  const size_t mask = kmer_slots_.size() - 1;
+  // Fibonacci hashing spreads the low-entropy 2-bit hashes over the table.
+  size_t i = (hash * kFibonacciMultiplier) >> (64 - kmer_slot_bits_);
+  while (true) {
+    const KmerSlot& slot = kmer_slots_[i];
+    if (slot.vertex == kNoVertex ||
+        (slot.hash == hash && Kmer(slot.vertex) == kmer)) {
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
 }
 
-}  // namespace
+void DeBruijnGraph::RebuildKmerTable(int num_slot_bits) {
+  kmer_slot_bits_ = num_slot_bits;
+  kmer_slots_.assign(size_t{1} << num_slot_bits, KmerSlot{0, kNoVertex});
+  for (Vertex v = 0; v < NumVertices(); ++v) {
+    const tensorflow::uint64 hash = HashKmer(Kmer(v));
+    kmer_slots_[FindKmerSlot(Kmer(v), hash)] = KmerSlot{hash, v};
+  }
+}
 
-Vertex DeBruijnGraph::EnsureVertex(StringPiece kmer) {
-  Vertex v;
-  auto vertex_find = kmer_to_vertex_.find(kmer);
-  if (vertex_find != kmer_to_vertex_.end()) {
-    v = (*vertex_find).second;
-  } else {
-    // N.B. TensorFlow StringPiece lacks explicit string conversion func.
-    string kmer_copy = string(kmer.data(), kmer.size());
-    v = boost::add_vertex(VertexInfo{kmer_copy}, g_);
-    // N.B.: must use the long-lived string in the map key as the referent of
-    // the StringPiece key.
-    kmer_to_vertex_[StringPiece(g_[v].kmer)] = v;
+Vertex DeBruijnGraph::EnsureVertex(StringPiece kmer, tensorflow::uint64 hash) {
+  size_t i = FindKmerSlot(kmer, hash);
+  if (kmer_slots_[i].vertex != kNoVertex) {
+    return kmer_slots_[i].vertex;
+  }
+  if (static_cast<size_t>(2 * (NumVertices() + 1)) > kmer_slots_.size()) {
+    RebuildKmerTable(kmer_slot_bits_ + 1);
+    i = FindKmerSlot(kmer, hash);
   }
+  const Vertex v = NumVertices();
+  kmers_.append(kmer.data(), kmer.size());
+  first_out_edge_.push_back(kNoEdge);
+  first_in_edge_.push_back(kNoEdge);
+  // A new vertex has no edges, so it can go last in the topological order.
+  topological_order_.push_back(v);
+  visit_marks_.push_back(0);
+  kmer_slots_[i] = KmerSlot{hash, v};
   return v;
 }
 
 Vertex DeBruijnGraph::VertexForKmer(StringPiece kmer) const {
-  return kmer_to_vertex_.at(kmer);
+  Vertex v = kmer_slots_[FindKmerSlot(kmer, HashKmer(kmer))].vertex;
+  CHECK(v != kNoVertex) << "No vertex for kmer " << kmer;
+  return v;
 }
 
-void DeBruijnGraph::RebuildIndexMap() {
-  std::map<Vertex, int> table;
-  VertexIterator vi, vend;
-  std::tie(vi, vend) = boost::vertices(g_);
-  int index = 0;
-  for (; vi != vend; ++vi) {
-    table[*vi] = index;
-    ++index;
+void DeBruijnGraph::UpdateTopologicalOrder(Vertex from, Vertex to) {
+  if (from == to) {
+    has_cycle_ = true;
+    return;
+  }
+  const int lower = topological_order_[to];
+  const int upper = topological_order_[from];
+  if (upper < lower) {
+    // from already precedes to.
+    return;
   }
-  vertex_index_map_ = table;
-}
 
-VertexIndexMap DeBruijnGraph::IndexMap() const {
-  boost::const_associative_property_map<RawVertexIndexMap> vmap(
-      vertex_index_map_);
-  return vmap;
-}
+  // Find the vertices reachable from to that precede from in the order.  If
+  // from itself is reachable, the new edge closes a cycle.
+  ++visit_epoch_;
+  forward_visited_.clear();
+  visit_stack_.assign(1, to);
+  visit_marks_[to] = visit_epoch_;
+  while (!visit_stack_.empty()) {
+    Vertex v = visit_stack_.back();
+    visit_stack_.pop_back();
+    forward_visited_.push_back(v);
+    for (int e = first_out_edge_[v]; e != kNoEdge; e = next_out_edge_[e]) {
+      Vertex w = edges_[e].to;
+      if (w == from) {
+        has_cycle_ = true;
+        return;
+      }
+      if (visit_marks_[w] != visit_epoch_ && topological_order_[w] < upper) {
+        visit_marks_[w] = visit_epoch_;
+        visit_stack_.push_back(w);
+      }
+    }
+  }
+
+  // Find the vertices reaching from that follow to in the order.
+  backward_visited_.clear();
+  visit_stack_.assign(1, from);
+  visit_marks_[from] = visit_epoch_;
+  while (!visit_stack_.empty()) {
+    Vertex v = visit_stack_.back();
+    visit_stack_.pop_back();
+    backward_visited_.push_back(v);
+    for (int e = first_in_edge_[v]; e != kNoEdge; e = next_in_edge_[e]) {
+      Vertex w = edges_[e].from;
+      if (visit_marks_[w] != visit_epoch_ && topological_order_[w] > lower) {
+        visit_marks_[w] = visit_epoch_;
+        visit_stack_.push_back(w);
+      }
+    }
+  }
 
-bool DeBruijnGraph::HasCycle() const {
-  bool has_cycle = false;
-  CycleDetector cycle_detector(&has_cycle);
-  boost::depth_first_search(
-      g_, boost::visitor(cycle_detector).vertex_index_map(IndexMap()));
-  return has_cycle;
+  // Reassign the positions held by the visited vertices so that all those
+  // reaching from come before all those reachable from to, each group keeping
+  // its relative order.
+  auto by_order = [this](Vertex a, Vertex b) {
+    return topological_order_[a] < topological_order_[b];
+  };
+  std::sort(forward_visited_.begin(), forward_visited_.end(), by_order);
+  std::sort(backward_visited_.begin(), backward_visited_.end(), by_order);
+  reordered_positions_.clear();
+  for (Vertex v : backward_visited_) {
+    reordered_positions_.push_back(topological_order_[v]);
+  }
+  for (Vertex v : forward_visited_) {
+    reordered_positions_.push_back(topological_order_[v]);
+  }
+  std::sort(reordered_positions_.begin(), reordered_positions_.end());
+  int i = 0;
+  for (Vertex v : backward_visited_) {
+    topological_order_[v] = reordered_positions_[i++];
+  }
+  for (Vertex v : forward_visited_) {
+    topological_order_[v] = reordered_positions_[i++];
+  }
 }
 
 DeBruijnGraph::DeBruijnGraph(const string& ref,
-                             const std::vector<Read>& reads,
+                             const std::vector<PreparedRead>& reads,
                              const Options& options,
                              int k)
-    : options_(options), k_(k)
+    : options_(options), k_(k), has_cycle_(false), visit_epoch_(0)
 {
   CHECK_GT(k, 0);  // k should always be a positive integer.
   CHECK(static_cast<uint32_t>(k) < ref.size());
+  kmer_hash_mask_ = k >= 32 ? ~tensorflow::uint64{0}
+                            : (tensorflow::uint64{1} << (2 * k)) - 1;
+  // Size the kmer table for the reference kmers; it grows for read kmers.
+  int num_slot_bits = kMinKmerSlotBits;
+  while ((size_t{1} << num_slot_bits) < 2 * ref.size()) {
+    ++num_slot_bits;
+  }
+  RebuildKmerTable(num_slot_bits);
+
   AddEdgesForReference(ref);
-  source_ = VertexForKmer(ref.substr(0, k_));
-  sink_ = VertexForKmer(ref.substr(ref.size() - k_, k_));
+  source_ = VertexForKmer(StringPiece(ref).substr(0, k_));
+  sink_ = VertexForKmer(StringPiece(ref).substr(ref.size() - k_, k_));
+  // If we can't get an acyclic graph from just the reference, the reads won't
+  // help.
+  for (const PreparedRead& read : reads) {
+    if (has_cycle_) {
+      break;
+    }
+    AddEdgesForRead(read);
+  }
+  AccountMemory();
+}
+
+void DeBruijnGraph::AccountMemory() {
+  if (!core::StageMemoryTrackingEnabled()) return;
+  const size_t int_capacity =
+      out_offsets_.capacity() + out_edges_.capacity() +
+      first_out_edge_.capacity() + first_in_edge_.capacity() +
+      next_out_edge_.capacity() + next_in_edge_.capacity() +
+      topological_order_.capacity() + visit_marks_.capacity() +
+      forward_visited_.capacity() + backward_visited_.capacity() +
+      visit_stack_.capacity() + reordered_positions_.capacity();
+  memory_.Set(kmers_.capacity() + edges_.capacity() * sizeof(EdgeInfo) +
+              int_capacity * sizeof(int) +
+              kmer_slots_.capacity() * sizeof(KmerSlot));
+}
+
+std::vector<DeBruijnGraph::PreparedRead> DeBruijnGraph::PrepareReads(
+    const std::vector<Read>& reads, const Options& options) {
+  std::vector<PreparedRead> prepared_reads;
   for (const Read& read : reads) {
-    if (read.alignment().mapping_quality() >= options.min_mapq()) {
-      AddEdgesForRead(read);
+    if (read.alignment().mapping_quality() < options.min_mapq()) {
+      continue;
     }
+    prepared_reads.emplace_back();
+    PreparedRead& prepared = prepared_reads.back();
+    prepared.bases = read.aligned_sequence();
+    const auto& qual = read.aligned_quality();
+    CHECK(qual.size() == static_cast<int>(prepared.bases.size()));
+
+    for (char& base : prepared.bases) {
+      base = std::toupper(static_cast<unsigned char>(base));
+    }
+    prepared.passes_qc.Compute(prepared.bases, qual.data(),
+                               options.min_base_quality(),
+                               /*allow_n=*/false);
   }
-  RebuildIndexMap();
+  return prepared_reads;
+}
+
+bool DeBruijnGraph::HasRepeatedKmer(StringPiece ref, int k) {
+  // Sort the kmer hashes (exact for k <= 32) with their positions, so that
+  // only kmers sharing a hash need to be compared.
+  const tensorflow::uint64 mask = k >= 32
+      ? ~tensorflow::uint64{0}
+      : (tensorflow::uint64{1} << (2 * k)) - 1;
+  std::vector<std::pair<tensorflow::uint64, int>> hashes;
+  hashes.reserve(ref.size());
+  tensorflow::uint64 hash = 0;
+  for (int i = 0; i < static_cast<int>(ref.size()); ++i) {
+    hash = ((hash << 2) | BaseCode(ref[i])) & mask;
+    if (i + 1 >= k) {
+      hashes.emplace_back(hash, i + 1 - k);
+    }
+  }
+  std::sort(hashes.begin(), hashes.end());
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    for (size_t j = i + 1;
+         j < hashes.size() && hashes[j].first == hashes[i].first; ++j) {
+      if (ref.substr(hashes[i].second, k) == ref.substr(hashes[j].second, k)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+int DeBruijnGraph::MaxKmerSize(StringPiece ref, const Options& options) {
+  return std::min(options.max_k(), static_cast<int>(ref.size()) - 1);
+}
+
+int DeBruijnGraph::FirstKmerSize(StringPiece ref, const Options& options) {
+  const int max_k = MaxKmerSize(ref, options);
+  if (options.min_k() > max_k) {
+    return max_k + 1;
+  }
+  CHECK_GT(options.step_k(), 0);
+
+  // The path of the reference through its graph revisits a vertex, closing a
+  // cycle, iff the reference repeats a kmer.  A repeated kmer implies
+  // repeated shorter kmers, so we can search the kmer sizes we would try for
+  // the first one at which the reference graph is acyclic: usually min_k,
+  // and otherwise found by a galloping and then a binary search.
+  auto kmer_size = [&options](int step) {
+    return options.min_k() + step * options.step_k();
+  };
+  const int num_steps = (max_k - options.min_k()) / options.step_k() + 1;
+  // Gallop until last_step does not repeat a kmer (or is past the last size),
+  // keeping all the steps before first_step repeating.
+  int first_step = 0;
+  int last_step = 0;
+  for (int stride = 1;
+       last_step < num_steps && HasRepeatedKmer(ref, kmer_size(last_step));
+       stride *= 2) {
+    first_step = last_step + 1;
+    last_step = std::min(last_step + stride, num_steps);
+  }
+  while (first_step < last_step) {
+    const int step = first_step + (last_step - first_step) / 2;
+    if (HasRepeatedKmer(ref, kmer_size(step))) {
+      first_step = step + 1;
+    } else {
+      last_step = step;
+    }
+  }
+  return first_step < num_steps ? kmer_size(first_step) : max_k + 1;
+}
+
+bool DeBruijnGraph::HasNonRefKmers(const string& ref,
+                                   const std::vector<Read>& reads,
+                                   const Options& options) {
+  core::ScopedStageTimer timer(core::REALIGNMENT);
+
+  const int k = FirstKmerSize(ref, options);
+  if (k > MaxKmerSize(ref, options)) {
+    // Build() returns no graph, and the window only the reference.
+    return false;
+  }
+  // An edge of the graph of size k is labeled by the k + 1 bases it spans.
+  // We hash these by their last (up to) 32 bases, as in HasRepeatedKmer.
+  const int n = k + 1;
+  const tensorflow::uint64 mask = n >= 32
+      ? ~tensorflow::uint64{0}
+      : (tensorflow::uint64{1} << (2 * n)) - 1;
+
+  StringPiece ref_view(ref);
+  std::vector<std::pair<tensorflow::uint64, int>> ref_edges;
+  ref_edges.reserve(ref.size());
+  tensorflow::uint64 hash = 0;
+  for (int i = 0; i < static_cast<int>(ref.size()); ++i) {
+    hash = ((hash << 2) | BaseCode(ref[i])) & mask;
+    if (i + 1 >= n) {
+      ref_edges.emplace_back(hash, i + 1 - n);
+    }
+  }
+  std::sort(ref_edges.begin(), ref_edges.end());
+  auto is_ref_edge = [&](tensorflow::uint64 edge_hash, StringPiece edge) {
+    for (auto it = std::lower_bound(
+             ref_edges.begin(), ref_edges.end(),
+             std::make_pair(edge_hash, std::numeric_limits<int>::min()));
+         it != ref_edges.end() && it->first == edge_hash; ++it) {
+      if (ref_view.substr(it->second, n) == edge) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // The non-reference edges the reads would add to the graph, with the same
+  // quality filtering as AddEdgesForRead, as their hashes and labels.
+  const std::vector<PreparedRead> prepared_reads =
+      PrepareReads(reads, options);
+  std::vector<std::pair<tensorflow::uint64, StringPiece>> read_edges;
+  for (const PreparedRead& read : prepared_reads) {
+    StringPiece bases_view(read.bases);
+    const int read_length = read.bases.size();
+    hash = 0;
+    for (int i = 0; i < read_length; ++i) {
+      hash = ((hash << 2) | BaseCode(read.bases[i])) & mask;
+      const int start = i + 1 - n;
+      if (start < 0 || !read.passes_qc.AllSet(std::max(start, k), i + 1)) {
+        continue;
+      }
+      const StringPiece edge = bases_view.substr(start, n);
+      if (!is_ref_edge(hash, edge)) {
+        read_edges.emplace_back(hash, edge);
+      }
+    }
+  }
+
+  // Runs of equal labels in sorted order give the weight of each edge, which
+  // pruning keeps iff it is at least min_edge_weight.
+  std::sort(read_edges.begin(), read_edges.end());
+  int weight = 0;
+  for (size_t i = 0; i < read_edges.size(); ++i) {
+    weight = i > 0 && read_edges[i] == read_edges[i - 1] ? weight + 1 : 1;
+    if (weight >= options.min_edge_weight()) {
+      return true;
+    }
+  }
+  if (read_edges.empty()) {
+    // The graph of size k is the acyclic graph of ref.
+    return false;
+  }
+  // Pruning would remove the light non-reference edges, but only after the
+  // cycle check: if they close a cycle, Build() goes on to larger kmer sizes,
+  // whose graphs QC the reads from a later position and can keep
+  // non-reference paths, so the window has to be assembled.
+  const DeBruijnGraph graph(ref, prepared_reads, options, k);
+  return graph.has_cycle_;
 }
 
 std::unique_ptr<DeBruijnGraph> DeBruijnGraph::Build(
     const string& ref, const std::vector<Read>& reads,
     const DeBruijnGraph::Options& options) {
+  core::ScopedStageTimer timer(core::REALIGNMENT);
 
-  std::unique_ptr<DeBruijnGraph> graph, trial_graph;
-  int max_k  = std::min(options.max_k(), static_cast<int>(ref.size()) - 1);
+  const int max_k = MaxKmerSize(ref, options);
+  const int first_k = FirstKmerSize(ref, options);
+  if (first_k > max_k) {
+    return nullptr;
+  }
 
-  for (int k = options.min_k(); k <= max_k; k += options.step_k()) {
-    // If we can't get an acyclic graph from just the reference, we should go on
-    // to the next k -- an optimization.
-    // N.B.: MakeUnique doesn't work with private constructors.
-    trial_graph = std::unique_ptr<DeBruijnGraph>(
-        new DeBruijnGraph(ref, {}, options, k));
-    if (trial_graph->HasCycle()) {
-      continue;
+  const std::vector<PreparedRead> prepared_reads =
+      PrepareReads(reads, options);
+  core::ScopedStageMemory prepared_memory(core::REALIGNMENT);
+  if (core::StageMemoryTrackingEnabled()) {
+    tensorflow::int64 bytes = prepared_reads.capacity() * sizeof(PreparedRead);
+    for (const PreparedRead& read : prepared_reads) {
+      // The mask holds a bit per base, in 64 bit words.
+      bytes += read.bases.capacity() + (read.bases.size() + 63) / 64 * 8;
     }
-    graph = std::unique_ptr<DeBruijnGraph>(
-        new DeBruijnGraph(ref, reads, options, k));
-    if (graph->HasCycle()) {
-      continue;
-    } else {
+    prepared_memory.Set(bytes);
+  }
+  for (int k = first_k; k <= max_k; k += options.step_k()) {
+    // N.B.: MakeUnique doesn't work with private constructors.
+    std::unique_ptr<DeBruijnGraph> graph(
+        new DeBruijnGraph(ref, prepared_reads, options, k));
+    if (!graph->has_cycle_) {
       graph->Prune();
       return graph;
     }
@@ -222,110 +521,257 @@ std::unique_ptr<DeBruijnGraph> DeBruijnGraph::Build(
   return nullptr;
 }
 
-Edge DeBruijnGraph::AddEdge(StringPiece from, StringPiece to, bool is_ref) {
-  Vertex from_vertex = EnsureVertex(from);
-  Vertex to_vertex = EnsureVertex(to);
-  bool was_present;
-  Edge edge;
-  std::tie(edge, was_present) = boost::edge(from_vertex, to_vertex, g_);
-  if (!was_present) {
-    std::tie(edge, std::ignore) = boost::add_edge(from_vertex, to_vertex,
-                                                  EdgeInfo{0, false}, g_);
-  }
-  EdgeInfo& ei = g_[edge];
+void DeBruijnGraph::AddEdge(Vertex from_vertex, Vertex to_vertex,
+                            bool is_ref) {
+  int edge = first_out_edge_[from_vertex];
+  while (edge != kNoEdge && edges_[edge].to != to_vertex) {
+    edge = next_out_edge_[edge];
+  }
+  if (edge == kNoEdge) {
+    UpdateTopologicalOrder(from_vertex, to_vertex);
+    edge = edges_.size();
+    edges_.push_back(EdgeInfo{from_vertex, to_vertex, 0, false});
+    next_out_edge_.push_back(first_out_edge_[from_vertex]);
+    first_out_edge_[from_vertex] = edge;
+    next_in_edge_.push_back(first_in_edge_[to_vertex]);
+    first_in_edge_[to_vertex] = edge;
+  }
+  EdgeInfo& ei = edges_[edge];
   ei.weight++;
   ei.is_ref |= is_ref;
-  return edge;
 }
 
 void DeBruijnGraph::AddEdgesForReference(StringPiece ref) {
-  StringPiece kmer_prev, kmer_cur;
   const signed int ref_length = ref.size();
-  for (int i = 0; i < ref_length - k_ + 1; i++) {
-    kmer_prev = kmer_cur;
-    kmer_cur = ref.substr(i, k_);
-    if (i > 0) {
-      AddEdge(kmer_prev, kmer_cur, true);
-    }
+  if (ref_length <= k_) {
+    return;
+  }
+  tensorflow::uint64 hash = HashKmer(ref.substr(0, k_));
+  Vertex prev_vertex = EnsureVertex(ref.substr(0, k_), hash);
+  for (int i = 1; i < ref_length - k_ + 1; i++) {
+    hash = RollKmerHash(hash, ref[i + k_ - 1]);
+    Vertex cur_vertex = EnsureVertex(ref.substr(i, k_), hash);
+    AddEdge(prev_vertex, cur_vertex, true);
+    prev_vertex = cur_vertex;
   }
 }
 
-void DeBruijnGraph::AddEdgesForRead(const learning::genomics::v1::Read& read) {
-  string bases = tensorflow::str_util::Uppercase(read.aligned_sequence());
-  StringPiece bases_view(bases);
-  std::vector<int> qual(read.aligned_quality().begin(),
-                        read.aligned_quality().end());
-  CHECK(qual.size() == bases.size());
-
-  const signed int read_length = bases.size();
+void DeBruijnGraph::AddEdgesForRead(const PreparedRead& read) {
+  StringPiece bases_view(read.bases);
+  const signed int read_length = read.bases.size();
+  if (read_length <= k_) {
+    return;
+  }
 
-  // This set maintains the QC-failing positions among [i..i+k].
-  std::set<int> recent_qc_fail_positions;
+  // The hash of the kmer starting at i.
+  tensorflow::uint64 hash = HashKmer(bases_view.substr(0, k_));
+  // True if the previous iteration added an edge, in which case
+  // next_from_vertex is the vertex for the kmer starting at i.
+  bool have_from_vertex = false;
+  Vertex next_from_vertex = kNoVertex;
+
+  for (int i = 0; i < read_length - k_ && !has_cycle_; ++i) {
+    const tensorflow::uint64 next_hash = RollKmerHash(hash, read.bases[i + k_]);
+    // Positions are QC-checked from k onward, so the edge between the kmers at
+    // i and i+1 is added iff no position in [max(i, k)..i+k] fails QC.
+    if (read.passes_qc.AllSet(std::max(i, k_), i + k_ + 1)) {
+      Vertex from_vertex = have_from_vertex
+          ? next_from_vertex
+          : EnsureVertex(bases_view.substr(i, k_), hash);
+      Vertex to_vertex = EnsureVertex(bases_view.substr(i + 1, k_), next_hash);
+      AddEdge(from_vertex, to_vertex, false);
+      next_from_vertex = to_vertex;
+      have_from_vertex = true;
+    } else {
+      have_from_vertex = false;
+    }
+    hash = next_hash;
+  }
+}
 
-  for (int i = 0; i < read_length - k_; ++i) {
-    // Update QC fail set: remove (i-1), add (i+k) if it fails QC.
-    recent_qc_fail_positions.erase(i - 1);
-    if (!IsCanonicalBase(bases[i + k_], core::CanonicalBases::ACGT)
-        || qual[i + k_] < options_.min_base_quality()) {
-      recent_qc_fail_positions.insert(i + k_);
+std::vector<Vertex> DeBruijnGraph::TopologicalOrder() const {
+  std::vector<int> in_degree(NumVertices(), 0);
+  for (const EdgeInfo& ei : edges_) {
+    ++in_degree[ei.to];
+  }
+  std::vector<Vertex> order;
+  order.reserve(NumVertices());
+  for (Vertex v = 0; v < NumVertices(); ++v) {
+    if (in_degree[v] == 0) {
+      order.push_back(v);
     }
-    if (recent_qc_fail_positions.empty()) {
-      AddEdge(bases_view.substr(i, k_), bases_view.substr(i + 1, k_), false);
+  }
+  for (size_t i = 0; i < order.size(); ++i) {
+    const Vertex v = order[i];
+    for (int j = out_offsets_[v]; j < out_offsets_[v + 1]; ++j) {
+      const Vertex to = edges_[out_edges_[j]].to;
+      if (--in_degree[to] == 0) {
+        order.push_back(to);
+      }
     }
   }
+  CHECK_EQ(static_cast<int>(order.size()), NumVertices());
+  return order;
 }
 
-std::vector<Path> DeBruijnGraph::CandidatePaths() const {
-  std::vector<Path> terminated_paths;
-  std::queue<Path> extendable_paths;
-
-  CHECK_GT(boost::out_degree(source_, g_), 0);
-  extendable_paths.push({source_});
-
-  // Inefficient.
-  while (!extendable_paths.empty()) {
-    // Some windows can have an extremely branchy graph.  Ideally windows would
-    // be chosen to avoid this.  We give up if we encounter too many paths.
-    int n_total_paths = terminated_paths.size() + extendable_paths.size();
-    if (n_total_paths > options_.max_num_paths()) {
-      return {};
+DeBruijnGraph::PathTree DeBruijnGraph::CandidatePaths() const {
+  PathTree paths;
+
+  CHECK_GT(OutDegree(source_), 0);
+  // Some windows can have an extremely branchy graph.  Ideally windows would
+  // be chosen to avoid this.  We count the paths ending at each vertex's
+  // successors, saturating past max_num_paths, before enumerating any: if
+  // there are too many, we keep only the most likely ones, or give up.
+  const std::vector<Vertex> order = TopologicalOrder();
+  const tensorflow::int64 max_paths = options_.max_num_paths();
+  std::vector<tensorflow::int64> num_paths(NumVertices(), 0);
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    const Vertex v = *it;
+    if (IsPathEnd(v)) {
+      num_paths[v] = 1;
+      continue;
+    }
+    for (int i = out_offsets_[v]; i < out_offsets_[v + 1]; ++i) {
+      const Vertex next_v = edges_[out_edges_[i]].to;
+      num_paths[v] = std::min(num_paths[v] + num_paths[next_v], max_paths + 1);
     }
+  }
+  if (num_paths[source_] > max_paths) {
+    return options_.keep_best_paths() ? BestPaths(order) : paths;
+  }
 
-    Path path = extendable_paths.front();
+  std::queue<int> extendable_paths;
+  paths.nodes.push_back(PathNode{source_, -1});
+  extendable_paths.push(0);
+  while (!extendable_paths.empty()) {
+    const int path = extendable_paths.front();
     extendable_paths.pop();
-    Vertex last_v = path.back();
-    // For each successor of last_v, add path::successor to the
-    // appropriate queue.
-    AdjacencyIterator vi, vend;
-    std::tie(vi, vend) = boost::adjacent_vertices(last_v, g_);
-    for (; vi != vend; ++vi) {
-      Path extended_path(path);
-      extended_path.push_back(*vi);
-      if (*vi == sink_ || boost::out_degree(*vi, g_) == 0) {
-        terminated_paths.push_back(extended_path);
+    const Vertex last_v = paths.nodes[path].vertex;
+    // For each successor of last_v, extend the path by it and add the
+    // extension to the appropriate queue.
+    for (int i = out_offsets_[last_v]; i < out_offsets_[last_v + 1]; ++i) {
+      const Vertex next_v = edges_[out_edges_[i]].to;
+      const int extended_path = paths.nodes.size();
+      paths.nodes.push_back(PathNode{next_v, path});
+      if (IsPathEnd(next_v)) {
+        paths.leaves.push_back(extended_path);
       } else {
         extendable_paths.push(extended_path);
       }
     }
   }
-  return terminated_paths;
+  return paths;
 }
 
-string DeBruijnGraph::HaplotypeForPath(const Path& path) const {
-  std::stringstream haplotype;
-  for (Vertex v : path) {
-    haplotype << g_[v].kmer[0];
+DeBruijnGraph::PathTree DeBruijnGraph::BestPaths(
+    const std::vector<Vertex>& order) const {
+  // A path from a vertex to a path end, as its log likelihood, its first
+  // edge (or kNoEdge for the empty path), and its rank among the paths from
+  // that edge's target.
+  struct RankedPath {
+    double score;
+    int edge;
+    int rank;
+  };
+  auto better = [](const RankedPath& a, const RankedPath& b) {
+    if (a.score != b.score) return a.score > b.score;
+    return a.edge != b.edge ? a.edge < b.edge : a.rank < b.rank;
+  };
+
+  // Each edge is taken with probability proportional to its weight among the
+  // out-edges of its source.  A path's prefix doesn't affect the ranking of
+  // its suffixes, so the best paths from a vertex extend the best paths from
+  // its successors: in reverse topological order, we keep the
+  // max_num_paths best from each vertex.  This costs O(max_num_paths) per
+  // edge however many paths there are.
+  const size_t max_paths = options_.max_num_paths();
+  std::vector<std::vector<RankedPath>> best(NumVertices());
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    const Vertex v = *it;
+    std::vector<RankedPath>& ranked = best[v];
+    if (IsPathEnd(v)) {
+      ranked.push_back(RankedPath{0.0, kNoEdge, 0});
+      continue;
+    }
+    double out_weight = 0;
+    for (int i = out_offsets_[v]; i < out_offsets_[v + 1]; ++i) {
+      out_weight += edges_[out_edges_[i]].weight;
+    }
+    for (int i = out_offsets_[v]; i < out_offsets_[v + 1]; ++i) {
+      const int e = out_edges_[i];
+      const double edge_score = std::log(edges_[e].weight / out_weight);
+      const std::vector<RankedPath>& suffixes = best[edges_[e].to];
+      for (size_t rank = 0; rank < suffixes.size(); ++rank) {
+        ranked.push_back(RankedPath{edge_score + suffixes[rank].score, e,
+                                    static_cast<int>(rank)});
+      }
+    }
+    const size_t kept = std::min(ranked.size(), max_paths);
+    std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(),
+                      better);
+    ranked.resize(kept);
   }
-  if (!path.empty()) {
-    haplotype << g_[path.back()].kmer.substr(1, k_ - 1);
+
+  PathTree paths;
+  bool has_ref_path = false;
+  for (const RankedPath& path : best[source_]) {
+    int node = paths.nodes.size();
+    paths.nodes.push_back(PathNode{source_, -1});
+    bool is_ref = true;
+    for (const RankedPath* step = &path; step->edge != kNoEdge;) {
+      const EdgeInfo& ei = edges_[step->edge];
+      is_ref = is_ref && ei.is_ref;
+      paths.nodes.push_back(PathNode{ei.to, node});
+      node = paths.nodes.size() - 1;
+      step = &best[ei.to][step->rank];
+    }
+    paths.leaves.push_back(node);
+    has_ref_path = has_ref_path || is_ref;
   }
-  return haplotype.str();
+
+  // Reads matching the reference need a haplotype to align to, so the
+  // reference path displaces the least likely path if it isn't among them.
+  if (!has_ref_path && !paths.leaves.empty()) {
+    paths.leaves.pop_back();
+    int node = paths.nodes.size();
+    paths.nodes.push_back(PathNode{source_, -1});
+    for (Vertex v = source_; !IsPathEnd(v);) {
+      Vertex next_v = kNoVertex;
+      for (int i = out_offsets_[v]; i < out_offsets_[v + 1]; ++i) {
+        if (edges_[out_edges_[i]].is_ref) {
+          next_v = edges_[out_edges_[i]].to;
+          break;
+        }
+      }
+      CHECK_NE(next_v, kNoVertex);
+      paths.nodes.push_back(PathNode{next_v, node});
+      node = paths.nodes.size() - 1;
+      v = next_v;
+    }
+    paths.leaves.push_back(node);
+  }
+  return paths;
+}
+
+string DeBruijnGraph::HaplotypeForPath(const PathTree& paths, int leaf) const {
+  // Walking from the leaf back to the source yields the haplotype reversed.
+  string haplotype;
+  StringPiece last_kmer = Kmer(paths.nodes[leaf].vertex);
+  for (int i = last_kmer.size() - 1; i > 0; --i) {
+    haplotype += last_kmer[i];
+  }
+  for (int node = leaf; node != -1; node = paths.nodes[node].parent) {
+    haplotype += Kmer(paths.nodes[node].vertex)[0];
+  }
+  std::reverse(haplotype.begin(), haplotype.end());
+  return haplotype;
 }
 
 std::vector<string> DeBruijnGraph::CandidateHaplotypes() const {
+  const PathTree paths = CandidatePaths();
   std::vector<string> haplotypes;
-  for (const Path& path : CandidatePaths()) {
-    haplotypes.push_back(HaplotypeForPath(path));
+  for (int leaf : paths.leaves) {
+    haplotypes.push_back(HaplotypeForPath(paths, leaf));
   }
   std::sort(haplotypes.begin(), haplotypes.end());
   return haplotypes;
@@ -333,50 +779,82 @@ std::vector<string> DeBruijnGraph::CandidateHaplotypes() const {
 
 string DeBruijnGraph::GraphViz() const {
   std::stringstream graphviz;
-  auto vertex_label_writer = boost::make_label_writer(
-      boost::get(&VertexInfo::kmer, g_));
-  boost::write_graphviz(
-      graphviz,
-      g_,
-      vertex_label_writer,
-      EdgeLabelWriter<BoostGraph>(g_),
-      boost::default_writer(),
-      IndexMap());
+  graphviz << "digraph G {\n";
+  for (Vertex v = 0; v < NumVertices(); ++v) {
+    graphviz << v << "[label=" << DotId(Kmer(v)) << "];\n";
+  }
+  for (const EdgeInfo& ei : edges_) {
+    graphviz << ei.from << "->" << ei.to << " [label=" << ei.weight
+             << (ei.is_ref ? " color=red" : "") << "];\n";
+  }
+  graphviz << "}\n";
   return graphviz.str();
 }
 
 void DeBruijnGraph::Prune() {
   // Remove low-weight edges not in the reference.
-  boost::remove_edge_if(
-      [this](const Edge& e) {
-        return !g_[e].is_ref && g_[e].weight < options_.min_edge_weight();
-      },
-      g_);
+  std::vector<bool> keep_edge(edges_.size());
+  for (size_t e = 0; e < edges_.size(); ++e) {
+    keep_edge[e] =
+        edges_[e].is_ref || edges_[e].weight >= options_.min_edge_weight();
+  }
 
   // Remove vertices not reachable forward from src or backward from sink.
-  VertexIterator vbegin, vend;
-  std::tie(vbegin, vend) = boost::vertices(g_);
-  std::unordered_set<Vertex> all_vertices(vbegin, vend);
-
-  std::set<Vertex> fwd_reachable_vertices, rev_reachable_vertices;
-  fwd_reachable_vertices = VerticesReachableFrom(
-      source_, g_, IndexMap());
-  rev_reachable_vertices = VerticesReachableFrom(
-      sink_, boost::make_reverse_graph(g_), IndexMap());
-
-  std::unordered_set<Vertex> reachable_vertices;
-  std::set_intersection(
-      fwd_reachable_vertices.begin(), fwd_reachable_vertices.end(),
-      rev_reachable_vertices.begin(), rev_reachable_vertices.end(),
-      std::inserter(reachable_vertices, reachable_vertices.end()));
-  for (Vertex v : all_vertices) {
-    if (reachable_vertices.find(v) == reachable_vertices.end()) {
-      kmer_to_vertex_.erase(g_[v].kmer);
-      boost::clear_vertex(v, g_);
-      boost::remove_vertex(v, g_);
+  std::vector<bool> fwd_reachable(NumVertices()), rev_reachable(NumVertices());
+  MarkReachable(source_, first_out_edge_, next_out_edge_, keep_edge,
+                [this](int e) { return edges_[e].to; }, &fwd_reachable);
+  MarkReachable(sink_, first_in_edge_, next_in_edge_, keep_edge,
+                [this](int e) { return edges_[e].from; }, &rev_reachable);
+
+  // Renumber the remaining vertices, preserving their order.
+  std::vector<Vertex> new_vertex(NumVertices(), kNoVertex);
+  string kept_kmers;
+  int num_kept_vertices = 0;
+  for (Vertex v = 0; v < NumVertices(); ++v) {
+    if (fwd_reachable[v] && rev_reachable[v]) {
+      new_vertex[v] = num_kept_vertices++;
+      StringPiece kmer = Kmer(v);
+      kept_kmers.append(kmer.data(), kmer.size());
+    }
+  }
+  // Edges keep their order of insertion, which GraphViz() reflects.
+  std::vector<EdgeInfo> kept_edges;
+  for (size_t e = 0; e < edges_.size(); ++e) {
+    const EdgeInfo& ei = edges_[e];
+    if (keep_edge[e] && new_vertex[ei.from] != kNoVertex &&
+        new_vertex[ei.to] != kNoVertex) {
+      kept_edges.push_back(EdgeInfo{new_vertex[ei.from], new_vertex[ei.to],
+                                    ei.weight, ei.is_ref});
     }
   }
-  RebuildIndexMap();
+
+  source_ = new_vertex[source_];
+  sink_ = new_vertex[sink_];
+  kmers_.swap(kept_kmers);
+  edges_.swap(kept_edges);
+  out_offsets_.assign(num_kept_vertices + 1, 0);
+  for (const EdgeInfo& ei : edges_) {
+    ++out_offsets_[ei.from + 1];
+  }
+  for (Vertex v = 0; v < num_kept_vertices; ++v) {
+    out_offsets_[v + 1] += out_offsets_[v];
+  }
+  out_edges_.resize(edges_.size());
+  std::vector<int> next_out_position(out_offsets_.begin(),
+                                     out_offsets_.end() - 1);
+  for (size_t e = 0; e < edges_.size(); ++e) {
+    out_edges_[next_out_position[edges_[e].from]++] = e;
+  }
+
+  // The construction-time state is no longer needed.
+  first_out_edge_ = {};
+  first_in_edge_ = {};
+  next_out_edge_ = {};
+  next_in_edge_ = {};
+  topological_order_ = {};
+  visit_marks_ = {};
+  RebuildKmerTable(kmer_slot_bits_);
+  AccountMemory();
 }
 
 }  // namespace deepvariant
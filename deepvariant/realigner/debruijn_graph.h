@@ -32,14 +32,13 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_DEBRUIJN_GRAPH_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_DEBRUIJN_GRAPH_H_
 
-#include <map>
 #include <memory>
 #include <vector>
 
+#include "deepvariant/core/base_mask.h"
 #include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/protos/realigner.pb.h"
-#include "boost/graph/adjacency_list.hpp"
-#include "boost/graph/graph_traits.hpp"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
 
@@ -49,87 +48,156 @@ namespace deepvariant {
 
 using tensorflow::string;
 using tensorflow::StringPiece;
-using tensorflow::StringPieceHasher;
-
-struct VertexInfo {
-  string kmer;
-};
 
 struct EdgeInfo {
+  int from;     // The source vertex.
+  int to;       // The target vertex.
   int weight;   // The # of multiedges this edge represents.
   bool is_ref;  // True iff this edge is reflected by the reference sequence.
 };
 
-
+// A DeBruijn graph over the kmers of a reference window and the reads aligned
+// to it.  Vertices are numbered densely in order of insertion and their kmers
+// are stored back to back in a single string; edges live in a flat array.
+// While the graph is built, each vertex threads singly-linked lists of its
+// out- and in-edges through that array, and a topological order of the
+// vertices is maintained incrementally so that a cycle is detected by the
+// edge that closes it.  Pruning compacts the graph into CSR form, indexing
+// the out-edges of each vertex contiguously.
 class DeBruijnGraph {
- private:
-  using BoostGraph = boost::adjacency_list<
-    boost::setS,            // Out edge list type.
-    boost::listS,           // Vertex list type.
-    boost::bidirectionalS,  // Directed graph.
-    VertexInfo,             // Vertex label.
-    EdgeInfo>;              // Edge label.
-
-  using VertexIterator = boost::graph_traits<BoostGraph>::vertex_iterator;
-  using EdgeIterator = boost::graph_traits<BoostGraph>::edge_iterator;
-  using AdjacencyIterator = boost::graph_traits<BoostGraph>::adjacency_iterator;
-
  public:
-  using Vertex = boost::graph_traits<BoostGraph>::vertex_descriptor;
-  using Edge = boost::graph_traits<BoostGraph>::edge_descriptor;
-  using Path = std::vector<Vertex>;
-
-  using RawVertexIndexMap = std::map<Vertex, int>;
-  using VertexIndexMap =
-      boost::const_associative_property_map<RawVertexIndexMap>;
-
+  using Vertex = int;
   using Options = RealignerOptions::DeBruijnGraphOptions;
 
  private:
-  // Convenience method for rebuilding a table usable as the vertex_index_t
-  // property that algorithms require.
-  void RebuildIndexMap();
-
-  // Accessor for the vertex index table.
-  VertexIndexMap IndexMap() const;
-
-  // Ensure a vertex with label kmer is present--adding if necessary.
-  Vertex EnsureVertex(StringPiece kmer);
+  // An entry of our open-addressing kmer table.  Empty slots have a vertex of
+  // kNoVertex.
+  struct KmerSlot {
+    tensorflow::uint64 hash;
+    Vertex vertex;
+  };
+
+  // A node of the tree of paths explored by CandidatePaths().  Each path is
+  // represented by its last node, and followed back to the source through the
+  // parent links.
+  struct PathNode {
+    Vertex vertex;
+    int parent;  // Index of the parent node, or -1 for the source.
+  };
+
+  // The paths found by CandidatePaths(): all the nodes of the path tree,
+  // and the indices of the nodes terminating complete paths.
+  struct PathTree {
+    std::vector<PathNode> nodes;
+    std::vector<int> leaves;
+  };
+
+  // A read passing the mapping quality filter, prepared once for the graphs
+  // of all the kmer sizes Build() tries.
+  struct PreparedRead {
+    // The uppercased bases of the read.
+    string bases;
+    // Set at each position whose base is ACGT and whose quality is at least
+    // options.min_base_quality.
+    core::BaseMask passes_qc;
+  };
+
+  static constexpr Vertex kNoVertex = -1;
+  static constexpr int kNoEdge = -1;
+
+  // Computes the hash of kmer: its last (up to) 32 bases, two bits per base.
+  // This is exact for kmers of ACGT with k <= 32; other kmers with the same
+  // hash are told apart by comparing their labels on lookup.
+  tensorflow::uint64 HashKmer(StringPiece kmer) const;
+
+  // Given the hash of the kmer s[i, i+k), returns the hash of s[i+1, i+k+1),
+  // where base is s[i+k].
+  tensorflow::uint64 RollKmerHash(tensorflow::uint64 hash, char base) const;
+
+  // Returns the index of the slot holding kmer in the kmer table, or of the
+  // empty slot where it would be inserted.
+  size_t FindKmerSlot(StringPiece kmer, tensorflow::uint64 hash) const;
+
+  // Resizes the kmer table to 2^num_slot_bits slots and reinserts the vertices
+  // of the graph.
+  void RebuildKmerTable(int num_slot_bits);
+
+  // The kmer labeling vertex v.
+  StringPiece Kmer(Vertex v) const {
+    return StringPiece(kmers_.data() + static_cast<size_t>(v) * k_, k_);
+  }
+
+  // The out-degree of v.  Only valid once the graph is in CSR form.
+  int OutDegree(Vertex v) const {
+    return out_offsets_[v + 1] - out_offsets_[v];
+  }
+
+  // Ensure a vertex with label kmer, whose hash is given, is present--adding
+  // if necessary.
+  Vertex EnsureVertex(StringPiece kmer, tensorflow::uint64 hash);
 
   // Look up the vertex with this kmer label.
   Vertex VertexForKmer(StringPiece kmer) const;
 
-  // Is this graph cyclic?
-  bool HasCycle() const;
+  // Updates memory_ with the bytes held by our buffers, if stage memory is
+  // tracked.
+  void AccountMemory();
+
+  // Updates the topological order of the vertices for the new edge
+  // from -> to, setting has_cycle_ if the edge closes a cycle.  This is the
+  // dynamic topological sort of Pearce and Kelly: only the vertices whose
+  // order lies between those of the edge's endpoints are visited.
+  void UpdateTopologicalOrder(Vertex from, Vertex to);
 
   // Private constructor.  Public interface via factory only allows access to
   // acyclic DeBruijn graphs.  Argument `k` is used to construct the graph;
-  // filtering settings are taken from options.
+  // edge filtering settings are taken from options.  Construction stops early
+  // if the graph turns out to be cyclic.
   DeBruijnGraph(const string& ref,
-                const std::vector<learning::genomics::v1::Read>& reads,
+                const std::vector<PreparedRead>& reads,
                 const Options& options,
                 int k);
 
-  // Add edge, implicitly adding the vertices if needed.  If such an edge is
-  // already present, we merely increment its weight to reflect its "multiedge"
-  // degree.
-  Edge AddEdge(StringPiece from, StringPiece to, bool is_ref);
+  // Returns the reads passing options.min_mapq, prepared for AddEdgesForRead.
+  static std::vector<PreparedRead> PrepareReads(
+      const std::vector<learning::genomics::v1::Read>& reads,
+      const Options& options);
+
+  // Add edge between two existing vertices.  If such an edge is already
+  // present, we merely increment its weight to reflect its "multiedge" degree.
+  void AddEdge(Vertex from_vertex, Vertex to_vertex, bool is_ref);
 
   // Add all the edges implied by the given reference string.
   void AddEdgesForReference(StringPiece ref);
 
   // Add all the edges implied by the given read (and according to our edge
   // filtering criteria).
-  void AddEdgesForRead(const learning::genomics::v1::Read& read);
+  void AddEdgesForRead(const PreparedRead& read);
+
+  // True iff paths through the graph end at v: the sink, or a vertex without
+  // successors.
+  bool IsPathEnd(Vertex v) const { return v == sink_ || OutDegree(v) == 0; }
+
+  // Returns the vertices in a topological order.  Only valid once the graph
+  // is in CSR form.
+  std::vector<Vertex> TopologicalOrder() const;
+
+  // Returns the tree of candidate haplotype paths through the graph.  If there
+  // are more than options.max_num_paths paths, the tree holds BestPaths() if
+  // options.keep_best_paths, and otherwise has no leaves.
+  PathTree CandidatePaths() const;
 
-  // Returns candidate haplotype paths through the graph.  If more that
-  // options.max_num_paths paths are found, this will return an empty vector.
-  std::vector<Path> CandidatePaths() const;
+  // Returns the tree of the options.max_num_paths most likely paths through
+  // the graph, where each edge is taken with probability proportional to its
+  // weight among the out-edges of its source.  The reference path is always
+  // among them.  The vertices are in the given topological order.
+  PathTree BestPaths(const std::vector<Vertex>& order) const;
 
-  // Returns the string traced by a path through the graph.
-  string HaplotypeForPath(const Path& path) const;
+  // Returns the string traced by the path ending at node leaf of paths.
+  string HaplotypeForPath(const PathTree& paths, int leaf) const;
 
-  // Removes low weight non-ref edges from the graph.
+  // Removes low weight non-ref edges from the graph, and then the vertices not
+  // on a path from source to sink, leaving the graph in CSR form.
   void Prune();
 
  public:
@@ -137,15 +205,41 @@ class DeBruijnGraph {
   // achieve an acyclic graph---kmer size starts with options.min_k and goes
   // linearly up to options.max_k, stepping by options.step_k.  If we are able
   // to construct an acyclic DeBruijn graph in this manner, it is returned;
-  // otherwise we return nullptr.
+  // otherwise we return nullptr.  Kmer sizes at which the reference alone
+  // repeats a kmer are skipped without building a graph, and the reads are
+  // filtered and QC-scanned once for all the kmer sizes tried.
   static std::unique_ptr<DeBruijnGraph> Build(
       const string& ref,
       const std::vector<learning::genomics::v1::Read>& reads,
       const Options& options);
 
+  // A cheap check to run before Build(): returns true iff some edge that the
+  // reads would add to the graph of the first kmer size Build() tries is not
+  // on the reference and has at least options.min_edge_weight, or the lighter
+  // such edges make that graph cyclic, so that Build() would try larger kmer
+  // sizes.  If it is false, Build() settles on that first size and pruning
+  // leaves only the reference path, so the window's candidate haplotypes are
+  // just ref and need not be assembled.
+  static bool HasNonRefKmers(
+      const string& ref,
+      const std::vector<learning::genomics::v1::Read>& reads,
+      const Options& options);
+
+  // Returns true iff some kmer of size k occurs more than once in ref, which
+  // is exactly when the graph of ref alone has a cycle.
+  static bool HasRepeatedKmer(StringPiece ref, int k);
+
+  // The largest kmer size Build() tries for ref.
+  static int MaxKmerSize(StringPiece ref, const Options& options);
+
+  // Returns the first kmer size Build() tries for ref: the smallest at which
+  // ref repeats no kmer, or MaxKmerSize() + 1 if there is none.
+  static int FirstKmerSize(StringPiece ref, const Options& options);
+
   // Gets all the candidate haplotypes defined by paths through the graph.  If
-  // more than options.max_num_paths() haplotypes are identified, returns an
-  // empty vector, to preempt excessive computation.
+  // more than options.max_num_paths() haplotypes are identified, returns just
+  // the most likely ones if options.keep_best_paths(), and otherwise an empty
+  // vector, to preempt excessive computation.
   std::vector<string> CandidateHaplotypes() const;
 
   // Gets a GraphViz representation of the graph.
@@ -154,17 +248,48 @@ class DeBruijnGraph {
   // Gets the kmer size used in this graph.
   int KmerSize() const { return k_; }
 
+  // The number of vertices in the graph.
+  int NumVertices() const { return kmers_.size() / k_; }
+
+  // The number of edges in the graph.
+  int NumEdges() const { return edges_.size(); }
+
  private:
-  BoostGraph g_;
   Options options_;
   int k_;
   Vertex source_;
   Vertex sink_;
-  // N.B.: kmer strings are owned by VertexInfo objects;
-  // map keys are merely pointers.
-  std::unordered_map<StringPiece, Vertex, StringPieceHasher>
-      kmer_to_vertex_;
-  RawVertexIndexMap vertex_index_map_;
+  bool has_cycle_;
+  // The kmer of vertex v is kmers_[v * k_, (v + 1) * k_).
+  string kmers_;
+  // The edges of the graph, in order of insertion.  Once in CSR form, the
+  // out-edges of v are edges_[out_edges_[i]] for i in
+  // [out_offsets_[v], out_offsets_[v + 1]).
+  std::vector<EdgeInfo> edges_;
+  std::vector<int> out_offsets_;
+  std::vector<int> out_edges_;
+  // During construction, the heads of the out- and in-edge lists of each
+  // vertex and the links of those lists through edges_; kNoEdge ends a list.
+  std::vector<int> first_out_edge_;
+  std::vector<int> first_in_edge_;
+  std::vector<int> next_out_edge_;
+  std::vector<int> next_in_edge_;
+  // During construction, the position of each vertex in a topological order,
+  // and scratch state for its updates.
+  std::vector<int> topological_order_;
+  std::vector<int> visit_marks_;
+  int visit_epoch_;
+  std::vector<Vertex> forward_visited_;
+  std::vector<Vertex> backward_visited_;
+  std::vector<Vertex> visit_stack_;
+  std::vector<int> reordered_positions_;
+  // Open-addressing (linear probing) table from kmer to vertex, with
+  // 2^kmer_slot_bits_ slots.  The table is kept at most half full.
+  std::vector<KmerSlot> kmer_slots_;
+  int kmer_slot_bits_;
+  tensorflow::uint64 kmer_hash_mask_;
+  // The memory held by the buffers above.
+  core::ScopedStageMemory memory_{core::REALIGNMENT};
 };
 
 
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/debruijn_graph.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "deepvariant/core/test_utils.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using core::MakeRead;
+using learning::genomics::v1::Read;
+using ::testing::ElementsAre;
+
+// Options trying just kmer size k, with the read and edge filters of
+// debruijn_graph_wrap_test.dbg_options.
+DeBruijnGraph::Options SingleKOptions(int k) {
+  DeBruijnGraph::Options options;
+  options.set_min_k(k);
+  options.set_max_k(k);
+  options.set_step_k(1);
+  options.set_min_mapq(20);
+  options.set_min_base_quality(20);
+  options.set_min_edge_weight(2);
+  options.set_max_num_paths(10);
+  return options;
+}
+
+// Options trying the kmer sizes [min_k, max_k] in steps of step_k.
+DeBruijnGraph::Options KmerSizeOptions(int min_k, int max_k, int step_k) {
+  DeBruijnGraph::Options options = SingleKOptions(min_k);
+  options.set_max_k(max_k);
+  options.set_step_k(step_k);
+  return options;
+}
+
+// The first kmer size Build() tries, found by trying each size in turn.
+int FirstKmerSizeByScan(const string& ref,
+                        const DeBruijnGraph::Options& options) {
+  const int max_k = DeBruijnGraph::MaxKmerSize(ref, options);
+  for (int k = options.min_k(); k <= max_k; k += options.step_k()) {
+    if (!DeBruijnGraph::HasRepeatedKmer(ref, k)) {
+      return k;
+    }
+  }
+  return max_k + 1;
+}
+
+// Returns copies reads aligned to the start of ref, with the given bases.
+std::vector<Read> MakeReads(const string& bases, int copies) {
+  return std::vector<Read>(copies, MakeRead("chr1", 0, bases, {}));
+}
+
+// Returns true iff the graph of all the kmer edges of ref and reads of size k,
+// before any pruning, has a cycle.  This is the plain depth-first search that
+// the incremental topological order of DeBruijnGraph replaces.
+bool HasCycleByDfs(const string& ref, const std::vector<Read>& reads, int k) {
+  std::map<string, std::vector<string>> successors;
+  std::vector<string> sequences = {ref};
+  for (const Read& read : reads) {
+    sequences.push_back(read.aligned_sequence());
+  }
+  for (const string& sequence : sequences) {
+    for (int i = 0; i + k < static_cast<int>(sequence.size()); ++i) {
+      successors[sequence.substr(i, k)].push_back(sequence.substr(i + 1, k));
+    }
+  }
+  // 1 while the kmer is on the search stack, 2 once all its successors are
+  // done.
+  std::map<string, int> state;
+  std::function<bool(const string&)> closes_cycle = [&](const string& kmer) {
+    state[kmer] = 1;
+    for (const string& next : successors[kmer]) {
+      if (state[next] == 1 || (state[next] == 0 && closes_cycle(next))) {
+        return true;
+      }
+    }
+    state[kmer] = 2;
+    return false;
+  };
+  for (const auto& entry : successors) {
+    if (state[entry.first] == 0 && closes_cycle(entry.first)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Checks that Build() finds a cycle at exactly the kmer sizes where
+// HasCycleByDfs() does, and settles on the first size where neither does.
+void ExpectCyclesAsByDfs(const string& ref, const std::vector<Read>& reads,
+                         int min_k, int max_k) {
+  int expected_k = -1;
+  for (int k = min_k; k <= max_k; ++k) {
+    const bool has_cycle = HasCycleByDfs(ref, reads, k);
+    EXPECT_EQ(DeBruijnGraph::Build(ref, reads, SingleKOptions(k)) == nullptr,
+              has_cycle)
+        << "k = " << k;
+    if (!has_cycle && expected_k < 0) {
+      expected_k = k;
+    }
+  }
+  ASSERT_GE(expected_k, 0);
+  DeBruijnGraph::Options options = SingleKOptions(min_k);
+  options.set_max_k(max_k);
+  std::unique_ptr<DeBruijnGraph> graph =
+      DeBruijnGraph::Build(ref, reads, options);
+  ASSERT_NE(graph, nullptr);
+  EXPECT_EQ(graph->KmerSize(), expected_k);
+}
+
+// Kmers longer than 32 bases share a table hash when their last 32 bases
+// agree, so a SNP within the first k - 32 bases of a kmer must still give it
+// its own vertex.
+TEST(DeBruijnGraphTest, KmersDifferingBeforeTheirLast32BasesAreDistinct) {
+  const int k = 36;
+  const string ref =
+      "GGCCCCCCACGATCAGCAGTTCGGCTTGTGAGGTCTTCGCCGGGTGGTCTCCCGCATTTATACCTT"
+      "GCTGGCGCCTCAAG";
+  string alt = ref;
+  alt[40] = 'A';
+  std::unique_ptr<DeBruijnGraph> graph =
+      DeBruijnGraph::Build(ref, MakeReads(alt, 2), SingleKOptions(k));
+  ASSERT_NE(graph, nullptr);
+  EXPECT_EQ(graph->KmerSize(), k);
+  // The 36 kmers of alt covering the SNP, among them the 4 matching a kmer of
+  // ref on their last 32 bases, are all new vertices.
+  const int num_ref_kmers = ref.size() - k + 1;
+  EXPECT_EQ(graph->NumVertices(), num_ref_kmers + k);
+  EXPECT_EQ(graph->NumEdges(), num_ref_kmers - 1 + k + 1);
+  EXPECT_THAT(graph->CandidateHaplotypes(), ElementsAre(alt, ref));
+}
+
+// A read duplicating GATTACA adds an edge from a kmer of the duplication back
+// to a reference kmer ordered before it, closing a cycle for the kmer sizes at
+// which dup repeats a kmer.
+TEST(DeBruijnGraphTest, ReadEdgeClosingACycle) {
+  const string ref = "ACGGGATGTTTAGCGGGGCCGATTACAGCAAAGAAGCTTTAAGCATC";
+  const string dup = "ACGGGATGTTTAGCGGGGCCGATTACAGATTACAGCAAAGAAGCTTTAAGCATC";
+  const std::vector<Read> reads = MakeReads(dup, 2);
+  // GATTACAG occurs twice in dup, but no 9-mer does.
+  EXPECT_TRUE(HasCycleByDfs(ref, reads, 8));
+  EXPECT_FALSE(HasCycleByDfs(ref, reads, 9));
+  ExpectCyclesAsByDfs(ref, reads, 4, 12);
+  std::unique_ptr<DeBruijnGraph> graph =
+      DeBruijnGraph::Build(ref, reads, SingleKOptions(9));
+  ASSERT_NE(graph, nullptr);
+  EXPECT_THAT(graph->CandidateHaplotypes(), ElementsAre(dup, ref));
+}
+
+// The vertices of a SNP read come after those of ref in the topological order,
+// so the edge on which the read rejoins ref runs backwards in that order and
+// reorders the vertices, without closing a cycle.  The reordered graph must
+// still tell the edges of a later deletion read apart from a cycle.
+TEST(DeBruijnGraphTest, BackwardEdgeNotClosingACycle) {
+  const string ref = "ACGGGATGTTTAGCGGGGCCGATTACAGCAAAGAAGCTTTAAGCATC";
+  string snp = ref;
+  snp[20] = 'T';
+  // del drops AA from the run of AAA at offset 29 of ref.
+  const string del = ref.substr(0, 30) + ref.substr(32);
+  const string snp_del = snp.substr(0, 30) + snp.substr(32);
+  std::vector<Read> reads = MakeReads(snp, 2);
+  const std::vector<Read> del_reads = MakeReads(del, 2);
+  reads.insert(reads.end(), del_reads.begin(), del_reads.end());
+  ExpectCyclesAsByDfs(ref, reads, 4, 12);
+  const int k = 8;
+  std::unique_ptr<DeBruijnGraph> graph =
+      DeBruijnGraph::Build(ref, reads, SingleKOptions(k));
+  ASSERT_NE(graph, nullptr);
+  // Pruning keeps the k kmers of snp covering the SNP and the k - 2 kmers of
+  // del spanning the deletion, and the CSR form joins the two bubbles.
+  const int num_ref_kmers = ref.size() - k + 1;
+  EXPECT_EQ(graph->NumVertices(), num_ref_kmers + k + (k - 2));
+  EXPECT_THAT(graph->CandidateHaplotypes(),
+              ElementsAre(ref, del, snp, snp_del));
+}
+
+// A window without any repeated kmer: the reference is acyclic at min_k.
+TEST(DeBruijnGraphTest, FirstKmerSizeIsMinKWithoutRepeats) {
+  const string ref = "ATGTCCGACGGCGTTGTAGTCATTTAGAGAATAGCTTTAA";
+  const DeBruijnGraph::Options options = KmerSizeOptions(6, 50, 2);
+  EXPECT_EQ(FirstKmerSizeByScan(ref, options), 6);
+  EXPECT_EQ(DeBruijnGraph::FirstKmerSize(ref, options), 6);
+}
+
+// ref repeats CCGGCGTCTTTATGT, so its first acyclic size of 4, 6, ... is 16, at
+// step 6.  The gallop tries steps 0, 1, 3 and 7, and the binary search has to
+// find step 6 within the last stride [4, 7].
+TEST(DeBruijnGraphTest, FirstKmerSizeWithinAGallopStride) {
+  const string ref =
+      "CAACCAACGCAGTGGTGGCCGGCGTCTTTATGTGTTATACCCAGTCCGGCGTCTTTATGTCAATA";
+  const DeBruijnGraph::Options options = KmerSizeOptions(4, 50, 2);
+  EXPECT_TRUE(DeBruijnGraph::HasRepeatedKmer(ref, 15));
+  EXPECT_FALSE(DeBruijnGraph::HasRepeatedKmer(ref, 16));
+  EXPECT_EQ(FirstKmerSizeByScan(ref, options), 16);
+  EXPECT_EQ(DeBruijnGraph::FirstKmerSize(ref, options), 16);
+}
+
+// Without a kmer size to try, or when ref repeats a kmer at each of them,
+// FirstKmerSize() is one past the largest size tried.
+TEST(DeBruijnGraphTest, FirstKmerSizeWithoutAnAcyclicSize) {
+  const string ref =
+      "CAACCAACGCAGTGGTGGCCGGCGTCTTTATGTGTTATACCCAGTCCGGCGTCTTTATGTCAATA";
+  // min_k > max_k.
+  EXPECT_EQ(DeBruijnGraph::FirstKmerSize(ref, KmerSizeOptions(12, 10, 2)), 11);
+  // min_k is past the largest kmer of a short ref.
+  EXPECT_EQ(
+      DeBruijnGraph::FirstKmerSize("ACGTTGCAA", KmerSizeOptions(12, 50, 2)), 9);
+  // Every size of 4, 6, ..., 14 repeats a kmer.
+  EXPECT_EQ(DeBruijnGraph::FirstKmerSize(ref, KmerSizeOptions(4, 15, 2)), 16);
+  // Every size repeats a kmer, and the steps of 3 from 4 skip past
+  // MaxKmerSize() = 29.
+  const string poly_a(30, 'A');
+  const DeBruijnGraph::Options options = KmerSizeOptions(4, 50, 3);
+  EXPECT_EQ(FirstKmerSizeByScan(poly_a, options), 30);
+  EXPECT_EQ(DeBruijnGraph::FirstKmerSize(poly_a, options), 30);
+}
+
+TEST(DeBruijnGraphTest, FirstKmerSizeAgreesWithLinearScan) {
+  const string ref =
+      "CAACCAACGCAGTGGTGGCCGGCGTCTTTATGTGTTATACCCAGTCCGGCGTCTTTATGTCAATA";
+  for (int min_k = 1; min_k <= 20; ++min_k) {
+    for (const int max_k : {10, 15, 16, 17, 30, 100}) {
+      for (int step_k = 1; step_k <= 5; ++step_k) {
+        const DeBruijnGraph::Options options =
+            KmerSizeOptions(min_k, max_k, step_k);
+        EXPECT_EQ(DeBruijnGraph::FirstKmerSize(ref, options),
+                  FirstKmerSizeByScan(ref, options))
+            << "min_k = " << min_k << ", max_k = " << max_k
+            << ", step_k = " << step_k;
+      }
+    }
+  }
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
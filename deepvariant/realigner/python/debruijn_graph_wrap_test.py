@@ -117,6 +117,9 @@ class DeBruijnGraphWrapTest(absltest.TestCase):
           7->4 [label=2];
           }
           """, dbg)
+    self.assertEqual(3, dbg.kmer_size)
+    self.assertEqual(8, dbg.num_vertices)
+    self.assertEqual(8, dbg.num_edges)
 
   def test_pruning_1(self):
     """Test that pruning removes a path traced by only one read."""
@@ -287,6 +290,125 @@ class DeBruijnGraphWrapTest(absltest.TestCase):
                                self.single_k_dbg_options(8))
     self.assertIsNotNone(dbg)
 
+  def test_too_many_paths(self):
+    """Tests keeping the most likely paths of a graph with too many."""
+    ref_str = 'ACGTTGCAAGCTTAGGCATCGATCCGTAAGCTGACCTAGTCA'
+    reads = []
+    # Independent SNPs, supported by more reads further along the reference,
+    # give 2^4 paths.
+    snps = {}
+    for i, pos in enumerate([8, 16, 24, 32]):
+      snps[pos] = ref_str[:pos] + ('C' if ref_str[pos] == 'A' else 'A') + (
+          ref_str[pos + 1:])
+      read_str = snps[pos]
+      reads.extend(
+          test_utils.make_read(
+              read_str,
+              chrom='chr20',
+              start=1,
+              cigar=[(len(read_str), 'M')],
+              quals=[30] * len(read_str),
+              name='read_{}_{}'.format(pos, j)) for j in range(2 + i))
+    options = self.single_k_dbg_options(6)
+    options.max_num_paths = 100
+    dbg = debruijn_graph.build(ref_str, reads, options)
+    self.assertLen(dbg.candidate_haplotypes(), 16)
+
+    options.max_num_paths = 3
+    dbg = debruijn_graph.build(ref_str, reads, options)
+    self.assertEqual([], dbg.candidate_haplotypes())
+
+    # The most likely paths have the best supported SNPs, and the reference
+    # path is always kept.
+    options.keep_best_paths = True
+    dbg = debruijn_graph.build(ref_str, reads, options)
+    self.assertItemsEqual([ref_str, snps[24], snps[32]],
+                          dbg.candidate_haplotypes())
+
+  def test_has_non_ref_kmers(self):
+    """Tests the precheck of whether reads would add a non-reference path."""
+    ref_str = 'GATTACA'
+    read_str = 'GATGACA'
+    read = test_utils.make_read(
+        read_str,
+        chrom='chr20',
+        start=1,
+        cigar=[(len(read_str), 'M')],
+        quals=[30] * len(read_str),
+        name='read')
+    ref_read = test_utils.make_read(
+        ref_str,
+        chrom='chr20',
+        start=1,
+        cigar=[(len(ref_str), 'M')],
+        quals=[30] * len(ref_str),
+        name='ref_read')
+    options = self.single_k_dbg_options(3)
+
+    # The read's path is pruned unless it has min_edge_weight = 2 reads.
+    self.assertTrue(
+        debruijn_graph.has_non_ref_kmers(ref_str, [read, read], options))
+    self.assertFalse(debruijn_graph.has_non_ref_kmers(ref_str, [read], options))
+    self.assertFalse(
+        debruijn_graph.has_non_ref_kmers(ref_str, [ref_read] * 5, options))
+    self.assertFalse(debruijn_graph.has_non_ref_kmers(ref_str, [], options))
+
+    # Low quality bases don't support edges.
+    read.aligned_quality[3] = 1
+    self.assertFalse(
+        debruijn_graph.has_non_ref_kmers(ref_str, [read, read], options))
+
+    # Without a graph of ref, there is nothing to assemble.
+    self.assertFalse(
+        debruijn_graph.has_non_ref_kmers(ref_str, [read, read],
+                                         self.single_k_dbg_options(7)))
+
+  def test_has_non_ref_kmers_when_light_edges_close_a_cycle(self):
+    """Tests the precheck where Build() goes past the first kmer size."""
+    # The reference repeats CGTAC, so the first kmer size it allows is 8.
+    ref_str = 'TCGTCCGTACGTACGAACAAAAAGACGTACCCACAGTAAG'
+    # Two reads with a SNP at position 8, at which k = 8 QCs them but k = 10
+    # doesn't, and so only adds edges through at k = 10.
+    snp_str = 'TCGTCCGTCCGTACGAACAAAAAGACGTACCCACAGTAAG'
+    snp_quals = [30] * len(snp_str)
+    snp_quals[8] = 1
+    snp_reads = [
+        test_utils.make_read(
+            snp_str,
+            chrom='chr20',
+            start=1,
+            cigar=[(len(snp_str), 'M')],
+            quals=snp_quals,
+            name='snp_read_{}'.format(i)) for i in range(2)
+    ]
+    # A read stitching the repeat to an earlier part of the reference, whose
+    # single edges close a cycle at k = 8 but not at k = 10.
+    stitched_str = 'CGTACGTACGAACAAAAAGACGTACCCACAGTAACAAAAAG'
+    stitched_read = test_utils.make_read(
+        stitched_str,
+        chrom='chr20',
+        start=1,
+        cigar=[(len(stitched_str), 'M')],
+        quals=[30] * len(stitched_str),
+        name='stitched_read')
+    options = self.dbg_options()
+    options.min_k = 4
+
+    # Alone, the SNP reads add no edge at k = 8, which Build() settles on.
+    self.assertFalse(
+        debruijn_graph.has_non_ref_kmers(ref_str, snp_reads, options))
+    dbg = debruijn_graph.build(ref_str, snp_reads, options)
+    self.assertEqual(8, dbg.kmer_size)
+    self.assertEqual([ref_str], dbg.candidate_haplotypes())
+
+    # With the stitched read, Build() assembles an alt haplotype at k = 10.
+    reads = snp_reads + [stitched_read]
+    self.assertTrue(debruijn_graph.has_non_ref_kmers(ref_str, reads, options))
+    dbg = debruijn_graph.build(ref_str, reads, options)
+    self.assertEqual(10, dbg.kmer_size)
+    self.assertItemsEqual([ref_str, 'TCGTCCGTACGAACAAAAAGACGTACCCACAGTAAG'],
+                          dbg.candidate_haplotypes())
+
   def test_k_exceeds_ref_length(self):
     """This is a regression test for b/64564513."""
     # We don't allow a k >= ref length.  This crashed prior to the bugfix.
@@ -0,0 +1,88 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+"""Tests for the wrapped native AlignReads."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+
+
+from absl.testing import absltest
+from absl.testing import parameterized
+
+from deepvariant import test_utils
+from deepvariant.core import ranges
+from deepvariant.protos import realigner_pb2
+from deepvariant.realigner import aligner
+from deepvariant.realigner.python import read_aligner
+
+_REF_SEQ = 'AAAAAAAAAAAAATGCATGGGGGATTTTTTTTTTT'
+_ALT_SEQ = 'AAAAAAAAAAAAATAAGCAGGGGGATTTTTTTTTTT'
+
+
+class ReadAlignerWrapTest(parameterized.TestCase):
+  """The native AlignReads should realign reads exactly like aligner.py."""
+
+  def setUp(self):
+    self.config = realigner_pb2.RealignerOptions.AlignerOptions(
+        match=1, mismatch=1, gap_open=2, gap_extend=1, k=3, error_rate=.02)
+    self.region = ranges.make_range('ref', 10, 10 + len(_REF_SEQ))
+
+  def make_reads(self, seqs):
+    return [
+        test_utils.make_read(
+            seq,
+            chrom='ref',
+            start=0,
+            cigar=[(2, 'H'), (len(seq), 'M')],
+            quals=[64] * len(seq),
+            name='read_{}'.format(i)) for i, seq in enumerate(seqs)
+    ]
+
+  @parameterized.parameters(
+      ([_REF_SEQ, _ALT_SEQ],),
+      ([_ALT_SEQ, _REF_SEQ, _ALT_SEQ],),
+      ([_REF_SEQ],),
+      ([],),
+  )
+  def test_matches_python_aligner(self, haplotypes):
+    reads = self.make_reads([
+        'TGCATGG', 'TAAGCAGGAGG', 'AATAAAGCGGGGGA', 'TTTAAGCAGGGGGC',
+        'AAAGCAGGGGGC', 'GGGGG', 'CCCCCCCCC'
+    ])
+    expected = aligner.Aligner(self.config, self.region,
+                               _REF_SEQ).align_reads(haplotypes, reads)
+    actual = read_aligner.align_reads(self.config, self.region, _REF_SEQ,
+                                      haplotypes, reads)
+    self.assertEqual(expected, actual)
+
+
+if __name__ == '__main__':
+  absltest.main()
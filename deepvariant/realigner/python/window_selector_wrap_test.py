@@ -0,0 +1,83 @@
+# Copyright 2017 Google Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+"""Tests for the wrapped native SelectWindows."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+
+
+from absl.testing import absltest
+
+from deepvariant import test_utils
+from deepvariant.protos import realigner_pb2
+from deepvariant.realigner import window_selector
+from deepvariant.realigner.python import window_selector as native_selector
+
+
+class WindowSelectorWrapTest(absltest.TestCase):
+  """The native SelectWindows should agree with window_selector.py."""
+
+  def test_matches_python_window_selector(self):
+    config = realigner_pb2.RealignerOptions.WindowSelectorOptions(
+        min_num_supporting_reads=2,
+        max_num_supporting_reads=10,
+        min_mapq=20,
+        min_base_quality=20,
+        min_windows_distance=4)
+    ref = 'A' * 50 + 'acgt' * 10 + 'A' * 50
+    reads = [
+        test_utils.make_read(
+            'AAGA', start=1010, cigar='4M', quals=[64] * 4, name='read_1'),
+        test_utils.make_read(
+            'AAGTA', start=1010, cigar='2M2I1M', quals=[64] * 5,
+            name='read_2'),
+        test_utils.make_read(
+            'AAA', start=1010, cigar='2M2D1M', quals=[64] * 3, name='read_3'),
+        test_utils.make_read(
+            'TGATAC', start=1010, cigar='2S3M1S', quals=[64] * 6,
+            name='read_4'),
+        test_utils.make_read(
+            'AAGA', start=1010, cigar='2M1X1M', quals=[64, 64, 30, 10],
+            name='read_5'),
+        test_utils.make_read(
+            'ACGTAAAA', start=1046, cigar='8M', quals=[64] * 8, name='read_6'),
+        test_utils.make_read(
+            'ACGTAAAA', start=1046, cigar='8M', quals=[64] * 8, name='read_7'),
+    ]
+    expected = list(
+        window_selector.WindowSelector(config).process_reads(
+            ref, reads, 'chr1', 1000))
+    actual = native_selector.select_windows(config, ref, reads, 'chr1', 1000)
+    self.assertEqual(expected, actual)
+    self.assertNotEmpty(actual)
+
+
+if __name__ == '__main__':
+  absltest.main()
@@ -0,0 +1,646 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/read_aligner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "deepvariant/core/genomics/cigar.pb.h"
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/stage_timer.h"
+#include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/realigner/ssw.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+namespace tf = tensorflow;
+
+using learning::genomics::v1::CigarUnit;
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+using tensorflow::int64;
+using tensorflow::StringPiece;
+
+namespace {
+
+// A cigar as a sequence of (operation, length) pairs.
+using Cigar = std::vector<std::pair<CigarUnit::Operation, int>>;
+
+bool IsAlignOp(CigarUnit::Operation op) {
+  return op == CigarUnit::ALIGNMENT_MATCH ||
+         op == CigarUnit::SEQUENCE_MATCH || op == CigarUnit::SEQUENCE_MISMATCH;
+}
+
+bool IsInsertOp(CigarUnit::Operation op) {
+  return op == CigarUnit::INSERT || op == CigarUnit::CLIP_SOFT;
+}
+
+bool IsDeleteOp(CigarUnit::Operation op) {
+  return op == CigarUnit::DELETE || op == CigarUnit::SKIP;
+}
+
+// An alignment operation of a single base: an inserted base at pos of the
+// query, or a deleted base just before it.
+struct SingleAlnOp {
+  int pos;
+  CigarUnit::Operation op;
+
+  // The offset just past this operation in the query.
+  int EndPos() const {
+    return IsAlignOp(op) || IsInsertOp(op) ? pos + 1 : pos;
+  }
+
+  // The change this operation makes to the offset between the query and the
+  // sequence it is aligned to.
+  int OffsetAdjustment() const { return IsDeleteOp(op) ? -1 : 1; }
+};
+
+// The parts of an SSW alignment we use.  Its cigar is simplified to
+// ALIGNMENT_MATCH, INSERT and DELETE operations, with soft clips elided.
+struct PairwiseAlignment {
+  int query_begin;
+  int query_end;  // Inclusive.
+  int target_begin;
+  int target_end;  // Inclusive.
+  int score;
+  Cigar cigar;
+};
+
+// Returns the SmithWatermanKernel named by the sw_kernel option.
+SmithWatermanKernel ToKernel(
+    RealignerOptions::AlignerOptions::SmithWatermanKernel kernel) {
+  switch (kernel) {
+    case RealignerOptions::AlignerOptions::AUTO:
+      return SmithWatermanKernel::kAuto;
+    case RealignerOptions::AlignerOptions::SSE2:
+      return SmithWatermanKernel::kSse2;
+    case RealignerOptions::AlignerOptions::AVX2:
+      return SmithWatermanKernel::kAvx2;
+    case RealignerOptions::AlignerOptions::AVX512BW:
+      return SmithWatermanKernel::kAvx512bw;
+    default:
+      return SmithWatermanKernel::kLibssw;
+  }
+}
+
+// Aligns a fixed query against successive targets with SSW, building the
+// query profile only once.
+class PairwiseAligner {
+ public:
+  PairwiseAligner(const string& query,
+                  const RealignerOptions::AlignerOptions& options)
+      : aligner_(static_cast<uint8_t>(options.match()),
+                 static_cast<uint8_t>(options.mismatch()),
+                 static_cast<uint8_t>(options.gap_open()),
+                 static_cast<uint8_t>(options.gap_extend()),
+                 ToKernel(options.sw_kernel())) {
+    aligner_.SetQuery(query);
+  }
+
+  tf::Status Align(StringPiece target, PairwiseAlignment* result) {
+    if (!aligner_.Align(target, &alignment_)) {
+      return tf::errors::Internal("SSW failed to align to ", target);
+    }
+    return ConvertAlignment(result);
+  }
+
+  // As Align, but only within band_width of the diagonal on which query
+  // offset i aligns to target offset i + diagonal.
+  tf::Status AlignBanded(StringPiece target, int diagonal, int band_width,
+                         PairwiseAlignment* result) {
+    if (!aligner_.AlignBanded(target, diagonal, band_width, &alignment_)) {
+      return tf::errors::Internal("Banded SW failed to align to ", target);
+    }
+    return ConvertAlignment(result);
+  }
+
+ private:
+  // Sets *result from alignment_.
+  tf::Status ConvertAlignment(PairwiseAlignment* result) const {
+    result->query_begin = alignment_.query_begin;
+    result->query_end = alignment_.query_end;
+    result->target_begin = alignment_.ref_begin;
+    result->target_end = alignment_.ref_end;
+    result->score = alignment_.sw_score;
+    result->cigar.clear();
+    for (const uint32_t unit : alignment_.cigar) {
+      CigarUnit::Operation op;
+      // SSW encodes operations by their index in "MIDNSHP=X".
+      switch (unit & 0xf) {
+        case 0:
+          op = CigarUnit::ALIGNMENT_MATCH;
+          break;
+        case 1:
+          op = CigarUnit::INSERT;
+          break;
+        case 2:
+          op = CigarUnit::DELETE;
+          break;
+        default:
+          return tf::errors::Internal("Unexpected SSW cigar operation ",
+                                      unit & 0xf);
+      }
+      const int length = unit >> 4;
+      if (!result->cigar.empty() && result->cigar.back().first == op) {
+        result->cigar.back().second += length;
+      } else {
+        result->cigar.emplace_back(op, length);
+      }
+    }
+    return tf::Status::OK();
+  }
+
+  QueryAligner aligner_;
+  // Reused across alignments to avoid reallocating its cigar.
+  CompactAlignment alignment_;
+};
+
+// A haplotype we align reads to.
+struct Target {
+  // The uppercased haplotype.
+  string sequence;
+  // The offsets of each kmer of sequence.
+  std::unordered_map<StringPiece, std::vector<int>, tf::StringPieceHasher>
+      kmer_index;
+  // The gaps of sequence with respect to the reference.
+  std::vector<SingleAlnOp> gaps;
+  // The reference position of each offset of sequence.
+  std::vector<int64> ref_pos_mapping;
+};
+
+// The best alignment of a read found so far.
+struct BestAlignment {
+  const Target* target = nullptr;
+  int target_offset = 0;
+  PairwiseAlignment alignment;
+};
+
+// Appends (op, length) to cigar, merging it into the last unit if that has
+// the same operation.  Does nothing if length is not positive.
+void AddCigarUnit(CigarUnit::Operation op, int length, Cigar* cigar) {
+  if (length <= 0) {
+    return;
+  }
+  if (!cigar->empty() && cigar->back().first == op) {
+    cigar->back().second += length;
+  } else {
+    cigar->emplace_back(op, length);
+  }
+}
+
+// Returns the single-base gaps of a simplified cigar, with positions counted
+// from query_offset.  Deletions of several bases yield several gaps at the
+// same position.
+std::vector<SingleAlnOp> CigarToGaps(const Cigar& cigar, int query_offset) {
+  std::vector<SingleAlnOp> gaps;
+  int query_pos = query_offset;
+  for (const auto& unit : cigar) {
+    if (unit.first == CigarUnit::INSERT) {
+      for (int i = 0; i < unit.second; ++i) {
+        gaps.push_back(SingleAlnOp{query_pos + i, unit.first});
+      }
+      query_pos += unit.second;
+    } else if (unit.first == CigarUnit::DELETE) {
+      for (int i = 0; i < unit.second; ++i) {
+        gaps.push_back(SingleAlnOp{query_pos, unit.first});
+      }
+    } else {
+      query_pos += unit.second;
+    }
+  }
+  return gaps;
+}
+
+// Returns a cigar for the query range [start, end) with the given gaps.
+Cigar GapsToCigar(const std::vector<SingleAlnOp>& gaps, int start, int end) {
+  Cigar cigar;
+  if (gaps.empty()) {
+    AddCigarUnit(CigarUnit::ALIGNMENT_MATCH, end - start, &cigar);
+    return cigar;
+  }
+  AddCigarUnit(CigarUnit::ALIGNMENT_MATCH, gaps[0].pos - start, &cigar);
+  for (size_t i = 0; i < gaps.size(); ++i) {
+    AddCigarUnit(gaps[i].op, 1, &cigar);
+    const int next_gap_pos = i + 1 < gaps.size() ? gaps[i + 1].pos : end;
+    AddCigarUnit(CigarUnit::ALIGNMENT_MATCH, next_gap_pos - gaps[i].EndPos(),
+                 &cigar);
+  }
+  return cigar;
+}
+
+// Returns the number of leading units of the cigar in [begin, end) before its
+// first alignment match, and the number of read bases they consume; these
+// become soft clips.
+template <class Iterator>
+std::pair<int, int> CandidateClippedBases(Iterator begin, Iterator end) {
+  int index = 0;
+  int read_offset = 0;
+  for (Iterator it = begin; it != end && !IsAlignOp(it->first); ++it) {
+    if (IsInsertOp(it->first)) {
+      read_offset += it->second;
+    }
+    ++index;
+  }
+  return {index, read_offset};
+}
+
+// Sets the gaps and reference position mapping of target from its alignment
+// to the reference bases of ref_region.  Returns false if target does not
+// align end-to-end.
+bool SetTargetAlignmentInfo(const PairwiseAlignment& alignment,
+                            const Range& ref_region, Target* target) {
+  const int target_length = target->sequence.size();
+  if (alignment.query_begin != 0 ||
+      alignment.query_end != target_length - 1) {
+    LOG(WARNING) << "aligner: Target alignment should be end-to-end.";
+    return false;
+  }
+  target->gaps = CigarToGaps(alignment.cigar, 0);
+
+  target->ref_pos_mapping.resize(target_length);
+  int64 ref_pos = ref_region.start();
+  int target_pos = 0;
+  for (const SingleAlnOp& gap : target->gaps) {
+    for (; target_pos < gap.pos; ++target_pos) {
+      target->ref_pos_mapping[target_pos] = ref_pos++;
+    }
+    if (gap.op == CigarUnit::INSERT) {
+      target->ref_pos_mapping[target_pos++] = ref_pos;
+    } else {
+      ++ref_pos;
+    }
+  }
+  for (; target_pos < target_length; ++target_pos) {
+    target->ref_pos_mapping[target_pos] = ref_pos++;
+  }
+  CHECK_GE(target->ref_pos_mapping.front(), ref_region.start());
+  CHECK_LE(target->ref_pos_mapping.back(), ref_region.end());
+  return true;
+}
+
+// Returns the sorted, distinct offsets of target at which the read, given by
+// its uppercased bases, shares a kmer of size k.
+std::vector<int> SwStartOffsets(const Target& target, StringPiece bases,
+                                int k) {
+  std::vector<int> offsets;
+  for (int i = 0; i + k <= static_cast<int>(bases.size()); ++i) {
+    auto found = target.kmer_index.find(bases.substr(i, k));
+    if (found != target.kmer_index.end()) {
+      for (int s : found->second) {
+        offsets.push_back(s - i);
+      }
+    }
+  }
+  std::sort(offsets.begin(), offsets.end());
+  offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+  return offsets;
+}
+
+// Aligns the read to the window of target around target_offset, widening the
+// window until the alignment touches neither of its ends.  Sets *found to
+// whether such a window fits in target, and if so sets *window_start and
+// *alignment.  With a positive band_width in options, the alignment is first
+// restricted to the band around the seed diagonal, and only redone over the
+// whole window if that scores too low.
+tf::Status SswAlignment(PairwiseAligner* aligner, int read_length,
+                        const Target& target, int target_offset,
+                        const RealignerOptions::AlignerOptions& options,
+                        bool* found, int* window_start,
+                        PairwiseAlignment* alignment) {
+  const int target_length = target.sequence.size();
+  const double min_banded_score =
+      options.band_min_score_fraction() * options.match() * read_length;
+  const double error_rate = options.error_rate();
+  int terminal_seq_len = std::ceil(read_length * error_rate);
+  while (true) {
+    const int start = target_offset - terminal_seq_len;
+    const int end = target_offset + read_length + terminal_seq_len;
+    if (end > target_length || start < 0) {
+      *found = false;
+      return tf::Status::OK();
+    }
+    const StringPiece window =
+        StringPiece(target.sequence).substr(start, end - start);
+    bool aligned = false;
+    if (options.band_width() > 0) {
+      // The seed places read offset i at window offset i + terminal_seq_len.
+      TF_RETURN_IF_ERROR(aligner->AlignBanded(window, terminal_seq_len,
+                                              options.band_width(), alignment));
+      aligned = alignment->score >= min_banded_score;
+    }
+    if (!aligned) {
+      TF_RETURN_IF_ERROR(aligner->Align(window, alignment));
+    }
+    if (alignment->target_end == end - start - 1 ||
+        alignment->target_begin == 0) {
+      terminal_seq_len = std::max(1, 2 * terminal_seq_len);
+    } else {
+      *found = true;
+      *window_start = start;
+      return tf::Status::OK();
+    }
+  }
+}
+
+// Composes the read -> target and target -> reference gaps of the best
+// alignment of a read into its gaps with respect to the reference.
+std::vector<SingleAlnOp> ReadGaps(const BestAlignment& best) {
+  const PairwiseAlignment& aln = best.alignment;
+  const std::vector<SingleAlnOp> read_gaps =
+      CigarToGaps(aln.cigar, aln.query_begin);
+  const std::vector<SingleAlnOp>& target_gaps = best.target->gaps;
+  const int target_begin = aln.target_begin + best.target_offset;
+  const int target_end = aln.target_end + best.target_offset;
+  int target_offset = aln.query_begin - target_begin;
+
+  std::vector<SingleAlnOp> gaps;
+  size_t read_i = 0;
+  size_t target_i = 0;
+  while (read_i < read_gaps.size() || target_i < target_gaps.size()) {
+    if (target_i == target_gaps.size()) {
+      gaps.push_back(read_gaps[read_i]);
+      target_offset += read_gaps[read_i++].OffsetAdjustment();
+      continue;
+    }
+    const SingleAlnOp& target_gap = target_gaps[target_i];
+    const SingleAlnOp shifted_target_gap{target_gap.pos + target_offset,
+                                         target_gap.op};
+    if (target_gap.pos < target_begin) {
+      ++target_i;
+    } else if (target_gap.pos > target_end) {
+      target_i = target_gaps.size();
+    } else if (read_i == read_gaps.size()) {
+      gaps.push_back(shifted_target_gap);
+      ++target_i;
+    } else {
+      const SingleAlnOp& read_gap = read_gaps[read_i];
+      if (read_gap.pos < shifted_target_gap.pos) {
+        gaps.push_back(read_gap);
+        target_offset += read_gap.OffsetAdjustment();
+        ++read_i;
+      } else if (shifted_target_gap.pos < read_gap.pos) {
+        gaps.push_back(shifted_target_gap);
+        ++target_i;
+      } else if (read_gap.op != target_gap.op) {
+        // An insertion and a deletion at the same place cancel out.
+        target_offset += read_gap.OffsetAdjustment();
+        ++read_i;
+        ++target_i;
+      } else if (target_gap.op == CigarUnit::DELETE) {
+        gaps.push_back(shifted_target_gap);
+        ++target_i;
+      } else {
+        gaps.push_back(read_gap);
+        target_offset += read_gap.OffsetAdjustment();
+        ++read_i;
+      }
+    }
+  }
+  return gaps;
+}
+
+// Sets the cigar of realigned from the best alignment of the original read,
+// keeping the hard clips of the original.
+void SetReadCigar(const Read& original, const BestAlignment& best,
+                  Read* realigned) {
+  const PairwiseAlignment& aln = best.alignment;
+  const Cigar cigar =
+      GapsToCigar(ReadGaps(best), aln.query_begin, aln.query_end + 1);
+
+  // Leading and trailing indels become soft clips.
+  int cigar_start_i, start_read_clipped_bases;
+  std::tie(cigar_start_i, start_read_clipped_bases) =
+      CandidateClippedBases(cigar.begin(), cigar.end());
+  int cigar_end_i = cigar.size();
+  int end_read_clipped_bases = 0;
+  if (cigar_start_i < static_cast<int>(cigar.size())) {
+    int trailing_units;
+    std::tie(trailing_units, end_read_clipped_bases) =
+        CandidateClippedBases(cigar.rbegin(), cigar.rend());
+    cigar_end_i -= trailing_units;
+    CHECK_LT(cigar_start_i, cigar_end_i);
+  }
+
+  const auto& original_cigar = original.alignment().cigar();
+  Cigar new_cigar;
+  if (!original_cigar.empty() &&
+      original_cigar.Get(0).operation() == CigarUnit::CLIP_HARD) {
+    AddCigarUnit(CigarUnit::CLIP_HARD, original_cigar.Get(0).operation_length(),
+                 &new_cigar);
+  }
+  AddCigarUnit(CigarUnit::CLIP_SOFT, aln.query_begin, &new_cigar);
+  AddCigarUnit(CigarUnit::CLIP_SOFT, start_read_clipped_bases, &new_cigar);
+  new_cigar.insert(new_cigar.end(), cigar.begin() + cigar_start_i,
+                   cigar.begin() + cigar_end_i);
+  AddCigarUnit(CigarUnit::CLIP_SOFT, end_read_clipped_bases, &new_cigar);
+  AddCigarUnit(
+      CigarUnit::CLIP_SOFT,
+      static_cast<int>(original.aligned_sequence().size()) - aln.query_end - 1,
+      &new_cigar);
+  if (!original_cigar.empty() &&
+      original_cigar.Get(original_cigar.size() - 1).operation() ==
+          CigarUnit::CLIP_HARD) {
+    AddCigarUnit(
+        CigarUnit::CLIP_HARD,
+        original_cigar.Get(original_cigar.size() - 1).operation_length(),
+        &new_cigar);
+  }
+
+  auto* read_cigar = realigned->mutable_alignment()->mutable_cigar();
+  read_cigar->Clear();
+  for (const auto& unit : new_cigar) {
+    CigarUnit* cigar_unit = read_cigar->Add();
+    cigar_unit->set_operation(unit.first);
+    cigar_unit->set_operation_length(unit.second);
+  }
+}
+
+// Checks that the alignment of read lies within ref_region and is consistent
+// with the length of the read.
+tf::Status SanityCheckReadAlignment(const Read& read, const Range& ref_region) {
+  if (!read.has_alignment()) {
+    return tf::Status::OK();
+  }
+  const auto& position = read.alignment().position();
+  if (position.reference_name() != ref_region.reference_name()) {
+    return tf::errors::InvalidArgument(
+        "readalignment validation: read reference name is inconsistent with "
+        "reference information.");
+  }
+  if (position.position() < ref_region.start()) {
+    return tf::errors::InvalidArgument(
+        "readalignment validation: read start position is out of reference "
+        "genomic range.");
+  }
+
+  int64 query_len = 0;
+  int64 ref_len = 0;
+  for (const CigarUnit& unit : read.alignment().cigar()) {
+    if (IsAlignOp(unit.operation())) {
+      ref_len += unit.operation_length();
+      query_len += unit.operation_length();
+    } else if (IsInsertOp(unit.operation())) {
+      query_len += unit.operation_length();
+    } else if (IsDeleteOp(unit.operation())) {
+      ref_len += unit.operation_length();
+    } else if (unit.operation() != CigarUnit::CLIP_HARD) {
+      return tf::errors::InvalidArgument(
+          "readalignment validation: Unexpected cigar_op ", unit.operation());
+    }
+  }
+  if (query_len != static_cast<int64>(read.aligned_sequence().size())) {
+    return tf::errors::InvalidArgument(
+        "readalignment validation: cigar is inconsistent with the read "
+        "length.");
+  }
+  if (position.position() + ref_len > ref_region.end()) {
+    return tf::errors::InvalidArgument(
+        "readalignment validation: read end position is out of reference "
+        "genomic range.");
+  }
+  return tf::Status::OK();
+}
+
+}  // namespace
+
+StatusOr<std::vector<Read>> AlignReads(
+    const RealignerOptions::AlignerOptions& options, const Range& ref_region,
+    const string& ref_seq, const std::vector<string>& haplotypes,
+    const std::vector<Read>& reads) {
+  core::ScopedStageTimer timer(core::REALIGNMENT);
+  const string upper_ref_seq = tf::str_util::Uppercase(ref_seq);
+
+  // Remove any duplicates but make sure it's sorted.
+  std::vector<string> target_seqs = haplotypes;
+  std::sort(target_seqs.begin(), target_seqs.end());
+  target_seqs.erase(std::unique(target_seqs.begin(), target_seqs.end()),
+                    target_seqs.end());
+  if (target_seqs.empty() ||
+      (target_seqs.size() == 1 && target_seqs[0] == upper_ref_seq)) {
+    return reads;
+  }
+  // The best alignment is the first one found with the best score, and the
+  // reference should have the lowest priority, since it is among the
+  // candidate haplotypes even when no read supports it.
+  auto ref_target = std::find(target_seqs.begin(), target_seqs.end(),
+                              upper_ref_seq);
+  if (ref_target != target_seqs.end()) {
+    std::rotate(ref_target, ref_target + 1, target_seqs.end());
+  }
+
+  // N.B.: the kmer indices point into the target sequences, so targets must
+  // not be reallocated once built.
+  std::vector<Target> targets;
+  targets.reserve(target_seqs.size());
+  const int k = options.k();
+  for (const string& target_seq : target_seqs) {
+    if (k > static_cast<int>(target_seq.size())) {
+      continue;
+    }
+    targets.emplace_back();
+    Target& target = targets.back();
+    target.sequence = tf::str_util::Uppercase(target_seq);
+    const StringPiece sequence(target.sequence);
+    for (int i = 0; i + k <= static_cast<int>(sequence.size()); ++i) {
+      target.kmer_index[sequence.substr(i, k)].push_back(i);
+    }
+    PairwiseAlignment alignment;
+    TF_RETURN_IF_ERROR(PairwiseAligner(target.sequence, options)
+                           .Align(upper_ref_seq, &alignment));
+    if (!SetTargetAlignmentInfo(alignment, ref_region, &target)) {
+      targets.pop_back();
+    }
+  }
+
+  std::vector<Read> realigned_reads;
+  realigned_reads.reserve(reads.size());
+  for (const Read& read : reads) {
+    const string& read_seq = read.aligned_sequence();
+    const string upper_read_seq = tf::str_util::Uppercase(read_seq);
+    PairwiseAligner aligner(read_seq, options);
+    BestAlignment best;
+    for (const Target& target : targets) {
+      for (int target_offset : SwStartOffsets(target, upper_read_seq, k)) {
+        bool found;
+        int window_start;
+        PairwiseAlignment alignment;
+        TF_RETURN_IF_ERROR(SswAlignment(&aligner, read_seq.size(), target,
+                                        target_offset, options, &found,
+                                        &window_start, &alignment));
+        if (found && (best.target == nullptr ||
+                      alignment.score > best.alignment.score)) {
+          best.target = &target;
+          best.target_offset = window_start;
+          best.alignment = std::move(alignment);
+        }
+      }
+    }
+    if (best.target == nullptr) {
+      realigned_reads.push_back(read);
+      continue;
+    }
+
+    Read realigned = read;
+    realigned.mutable_alignment()->mutable_position()->set_position(
+        best.target->ref_pos_mapping[best.target_offset +
+                                     best.alignment.target_begin]);
+    SetReadCigar(read, best, &realigned);
+    TF_RETURN_IF_ERROR(SanityCheckReadAlignment(realigned, ref_region));
+
+    // If the whole read sequence is clipped, keep the original alignment.
+    const auto& cigar = realigned.alignment().cigar();
+    const bool all_clipped =
+        std::all_of(cigar.begin(), cigar.end(), [](const CigarUnit& unit) {
+          return unit.operation() == CigarUnit::CLIP_SOFT ||
+                 unit.operation() == CigarUnit::CLIP_HARD;
+        });
+    realigned_reads.push_back(all_clipped ? read : std::move(realigned));
+  }
+  return realigned_reads;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
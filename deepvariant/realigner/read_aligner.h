@@ -0,0 +1,77 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_READ_ALIGNER_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_READ_ALIGNER_H_
+
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using tensorflow::string;
+
+// Realigns reads to the candidate haplotypes of a region and re-projects
+// their alignments onto the reference.  This is the native equivalent of
+//
+//   aligner.Aligner(options, ref_region, ref_seq).align_reads(haplotypes,
+//                                                             reads)
+//
+// Each haplotype is first aligned to ref_seq, which spans ref_region; those
+// not aligning end-to-end are dropped.  Each read is then aligned with
+// Smith-Waterman against every haplotype, at the offsets implied by the kmers
+// of size options.k the two share, and keeps its best-scoring alignment.  On
+// ties, the earliest haplotype in sorted order wins, but the reference is
+// always tried last.  The new position and cigar of the read compose its
+// alignment to the haplotype with the haplotype's alignment to the reference.
+//
+// Reads that don't align anywhere, or whose new alignment is entirely
+// clipped, are returned unchanged, as are all the reads when haplotypes holds
+// nothing but ref_seq.  The reads are returned in their input order.  Returns
+// InvalidArgument if a realigned read falls outside ref_region.
+StatusOr<std::vector<learning::genomics::v1::Read>> AlignReads(
+    const RealignerOptions::AlignerOptions& options,
+    const learning::genomics::v1::Range& ref_region, const string& ref_seq,
+    const std::vector<string>& haplotypes,
+    const std::vector<learning::genomics::v1::Read>& reads);
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_READ_ALIGNER_H_
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/read_aligner.h"
+
+#include <vector>
+
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+#include "deepvariant/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using core::MakeRange;
+using core::MakeRead;
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::Read;
+using ::testing::Pointwise;
+
+// The reference and haplotypes of aligner_test.test_align_reads_simple: the
+// second haplotype has an AA insertion at offset 14 and a T deletion at
+// offset 19 of the reference.
+constexpr char kRefSeq[] = "AAAAAAAAAAAAATGCATGGGGGATTTTTTTTTTT";
+constexpr char kAltSeq[] = "AAAAAAAAAAAAATAAGCAGGGGGATTTTTTTTTTT";
+
+RealignerOptions::AlignerOptions TestOptions() {
+  RealignerOptions::AlignerOptions options;
+  options.set_match(1);
+  options.set_mismatch(1);
+  options.set_gap_open(2);
+  options.set_gap_extend(1);
+  options.set_k(3);
+  options.set_error_rate(.02);
+  return options;
+}
+
+struct AlignReadsTestCase {
+  string read_seq;
+  int expected_position;
+  std::vector<string> expected_cigar;
+  string comment;
+};
+
+class AlignReadsTest : public ::testing::TestWithParam<AlignReadsTestCase> {};
+
+TEST_P(AlignReadsTest, RealignsToBestHaplotype) {
+  const AlignReadsTestCase& param = GetParam();
+  const string ref_seq = kRefSeq;
+  const auto region = MakeRange("ref", 10, 10 + ref_seq.size());
+  const int read_length = param.read_seq.size();
+
+  for (const bool hard_clipped : {false, true}) {
+    std::vector<string> cigar = {std::to_string(read_length) + "M"};
+    std::vector<string> expected_cigar = param.expected_cigar;
+    if (hard_clipped) {
+      cigar.insert(cigar.begin(), "2H");
+      cigar.push_back("1H");
+      expected_cigar.insert(expected_cigar.begin(), "2H");
+      expected_cigar.push_back("1H");
+    }
+    const Read read = MakeRead("ref", 0, param.read_seq, cigar);
+    const Read expected = MakeRead("ref", param.expected_position,
+                                   param.read_seq, expected_cigar);
+
+    const auto realigned = AlignReads(TestOptions(), region, ref_seq,
+                                      {ref_seq, kAltSeq}, {read});
+    ASSERT_THAT(realigned, IsOK());
+    ASSERT_EQ(1, realigned.ValueOrDie().size());
+    const Read& realigned_read = realigned.ValueOrDie()[0];
+    EXPECT_EQ(param.expected_position,
+              realigned_read.alignment().position().position())
+        << param.comment;
+    EXPECT_THAT(realigned_read.alignment().cigar(),
+                Pointwise(EqualsProto(), expected.alignment().cigar()))
+        << param.comment;
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    AlignReadsTests, AlignReadsTest,
+    ::testing::Values(
+        AlignReadsTestCase{"TGCATGG", 23, {"7M"},
+                           "Read is a perfect match to the reference."},
+        AlignReadsTestCase{"TGCAAGG", 23, {"7M"},
+                           "Read has one mismatch w.r.t. the reference."},
+        AlignReadsTestCase{"TAAGCAGGG", 23, {"1M", "2I", "3M", "1D", "3M"},
+                           "Read is a perfect match to the 2nd target."},
+        AlignReadsTestCase{"CAGGGGG", 25, {"2M", "1D", "5M"},
+                           "Read is a perfect match to the 2nd target."},
+        AlignReadsTestCase{"TAAGCAGGAGG", 23, {"1M", "2I", "3M", "1D", "5M"},
+                           "Read has one mismatch w.r.t. the 2nd target."},
+        AlignReadsTestCase{"AATAAAGCAGGG", 21, {"3M", "3I", "3M", "1D", "3M"},
+                           "Read has one insertion w.r.t. the 2nd target."},
+        AlignReadsTestCase{"AATAGCAGGG", 21, {"3M", "1I", "3M", "1D", "3M"},
+                           "Read has one deletion w.r.t. the 2nd target."},
+        AlignReadsTestCase{"AATAAAGCGGGGGA", 21,
+                           {"3M", "3I", "2M", "2D", "6M"},
+                           "Read has one insertion and one deletion w.r.t. "
+                           "the 2nd target."},
+        AlignReadsTestCase{"GCAAGGGGGA", 24, {"10M"},
+                           "Read insertion overlaps with the deletion in the "
+                           "2nd target."},
+        AlignReadsTestCase{"TTTAAGCAGGGGGC", 23,
+                           {"2S", "1M", "2I", "3M", "1D", "5M", "1S"},
+                           "Read has clipped bases w.r.t. the 2nd target."},
+        AlignReadsTestCase{"AAGCAGGGGGC", 24, {"2S", "3M", "1D", "5M", "1S"},
+                           "Read starts in an insertion within the 2nd "
+                           "target."},
+        AlignReadsTestCase{"AAAGCAGGGGGC", 24, {"3S", "3M", "1D", "5M", "1S"},
+                           "Read starts in an insertion within the 2nd "
+                           "target, followed by an insertion in read to "
+                           "target alignment."},
+        AlignReadsTestCase{"GGGGG", 28, {"5M"},
+                           "Read starts after a deletion within the 2nd "
+                           "target."}));
+
+TEST(AlignReadsTest, KeepsReadsWhenOnlyTheReferenceIsAHaplotype) {
+  const string ref_seq = kRefSeq;
+  const std::vector<Read> reads = {
+      MakeRead("ref", 12, "TAAGCAGGG", {"9M"}),
+      MakeRead("ref", 20, "TGCATGG", {"7M"})};
+  const auto realigned =
+      AlignReads(TestOptions(), MakeRange("ref", 10, 10 + ref_seq.size()),
+                 ref_seq, {ref_seq, ref_seq}, reads);
+  ASSERT_THAT(realigned, IsOK());
+  EXPECT_THAT(realigned.ValueOrDie(), Pointwise(EqualsProto(), reads));
+}
+
+TEST(AlignReadsTest, KeepsReadsWhoseRealignmentIsAllClipped) {
+  const string ref_seq =
+      "TTTGTTTGTTTGTGTTTGTGTTTTTGTTTGTTTGTGTTTGTGTTTGTTTGTGGTTTGTGT"
+      "GTTTGTGTTTGTGTTGGTTTG";
+  const string target_ins = "AAAAAGTGGGGGGGAAGTGGGGAAAAA";
+  const int half = ref_seq.size() / 2;
+  const string alt_seq =
+      ref_seq.substr(0, half) + target_ins + ref_seq.substr(half);
+  const string read_seq = "CCC" + target_ins + "CCC";
+  const std::vector<Read> reads = {MakeRead(
+      "ref", 10, read_seq, {std::to_string(read_seq.size()) + "M"})};
+  const auto realigned =
+      AlignReads(TestOptions(), MakeRange("ref", 10, 10 + ref_seq.size()),
+                 ref_seq, {ref_seq, alt_seq}, reads);
+  ASSERT_THAT(realigned, IsOK());
+  EXPECT_THAT(realigned.ValueOrDie(), Pointwise(EqualsProto(), reads));
+}
+
+TEST(AlignReadsTest, KeepsReadOrder) {
+  const string ref_seq = kRefSeq;
+  const std::vector<Read> reads = {
+      MakeRead("ref", 0, "GGGGG", {"5M"}),
+      MakeRead("ref", 0, "CCCCCCCCC", {"9M"}),
+      MakeRead("ref", 0, "TGCATGG", {"7M"})};
+  const auto realigned =
+      AlignReads(TestOptions(), MakeRange("ref", 10, 10 + ref_seq.size()),
+                 ref_seq, {kAltSeq, ref_seq}, reads);
+  ASSERT_THAT(realigned, IsOK());
+  const std::vector<Read>& realigned_reads = realigned.ValueOrDie();
+  ASSERT_EQ(3, realigned_reads.size());
+  EXPECT_EQ(28, realigned_reads[0].alignment().position().position());
+  // The second read shares no kmer with any haplotype, so it is unchanged.
+  EXPECT_THAT(realigned_reads[1], EqualsProto(reads[1]));
+  EXPECT_EQ(23, realigned_reads[2].alignment().position().position());
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -37,6 +37,7 @@ from __future__ import absolute_import
 from __future__ import division
 from __future__ import print_function
 
+import collections
 import csv
 import os
 import os.path
@@ -48,9 +49,9 @@ from deepvariant.core import genomics_io
 from deepvariant.core import ranges
 from deepvariant.core import utils
 from deepvariant.protos import realigner_pb2
-from deepvariant.realigner import aligner
-from deepvariant.realigner import window_selector
 from deepvariant.realigner.python import debruijn_graph
+from deepvariant.realigner.python import read_aligner
+from deepvariant.realigner.python import window_selector
 from deepvariant.vendor import timer
 
 tf.flags.DEFINE_integer(
@@ -96,6 +97,11 @@ tf.flags.DEFINE_integer(
     'dbg_max_num_paths', 256,
     'Maximum number of paths within a graph to consider for realignment. '
     'Set max_num_paths to 0 to have unlimited number of paths.')
+tf.flags.DEFINE_bool(
+    'dbg_keep_best_paths', True,
+    'If True, graphs with more than max_num_paths paths are realigned to the '
+    'max_num_paths most likely paths, ranked by edge weight, rather than '
+    'skipped.')
 tf.flags.DEFINE_integer('aln_match', 4,
                         'Match score (expected to be a non-negative score).')
 tf.flags.DEFINE_integer('aln_mismatch', 6,
@@ -110,6 +116,20 @@ tf.flags.DEFINE_integer(
 tf.flags.DEFINE_integer('aln_k', 23,
                         'k-mer size used to index target sequence.')
 tf.flags.DEFINE_float('aln_error_rate', .01, 'Estimated sequencing error rate.')
+tf.flags.DEFINE_string(
+    'aln_sw_kernel', 'libssw',
+    'Smith-Waterman implementation used to align reads to haplotypes: one of '
+    'libssw, auto, sse2, avx2 or avx512bw. The SIMD kernels find equally good '
+    'alignments, but may break ties differently.')
+tf.flags.DEFINE_integer(
+    'aln_band_width', 0,
+    'If positive, first align reads to haplotypes only within this many bases '
+    'of their kmer seed diagonal, which is much cheaper than aligning over the '
+    'whole window. 0 disables banded alignment.')
+tf.flags.DEFINE_float(
+    'aln_band_min_score_fraction', .8,
+    'Banded alignments scoring below this fraction of a perfect match of the '
+    'whole read are redone without the band.')
 tf.flags.DEFINE_string(
     'realigner_diagnostics', '',
     'Root directory where the realigner should place diagnostic output (such as'
@@ -124,6 +144,10 @@ tf.flags.DEFINE_bool(
 # Margin added to the reference sequence for the aligner module.
 _REF_ALIGN_MARGIN = 20
 
+# The number of windows whose candidate haplotypes a Realigner remembers, so
+# that windows assembled again from the same reads needn't be reassembled.
+_MAX_CACHED_WINDOWS = 1024
+
 # ---------------------------------------------------------------------------
 # Set configuration settings.
 # ---------------------------------------------------------------------------
@@ -156,7 +180,8 @@ def realigner_config(flags):
       min_mapq=flags.dbg_min_mapq,
       min_base_quality=flags.dbg_min_base_quality,
       min_edge_weight=flags.dbg_min_edge_weight,
-      max_num_paths=flags.dbg_max_num_paths)
+      max_num_paths=flags.dbg_max_num_paths,
+      keep_best_paths=flags.dbg_keep_best_paths)
 
   aln_config = realigner_pb2.RealignerOptions.AlignerOptions(
       match=flags.aln_match,
@@ -164,7 +189,10 @@ def realigner_config(flags):
       gap_open=flags.aln_gap_open,
       gap_extend=flags.aln_gap_extend,
       k=flags.aln_k,
-      error_rate=flags.aln_error_rate)
+      error_rate=flags.aln_error_rate,
+      sw_kernel=flags.aln_sw_kernel.upper(),
+      band_width=flags.aln_band_width,
+      band_min_score_fraction=flags.aln_band_min_score_fraction)
 
   diagnostics = realigner_pb2.RealignerOptions.Diagnostics(
       enabled=bool(flags.realigner_diagnostics),
@@ -245,6 +273,32 @@ class DiagnosticLogger(object):
           len(candidate_haplotypes), graph_building_time)
 
 
+def _window_cache_key(window, reads):
+  """Returns the key of the candidate haplotypes of window in reads.
+
+  A read is identified by its name, read number, whether it is a secondary or
+  supplementary alignment, and its alignment's position, mapping quality and
+  CIGAR. The set of these is part of the key, rather than its hash, so that
+  read sets whose hashes collide don't share haplotypes.
+
+  Args:
+    window: range_pb2.Range. The window to assemble.
+    reads: list[reads_pb2.Read]. The reads overlapping window that are given
+      to the assembler.
+
+  Returns:
+    A hashable key for the window and the set of reads.
+  """
+  return (ranges.as_tuple(window),
+          frozenset((read.fragment_name, read.read_number,
+                     read.secondary_alignment, read.supplementary_alignment,
+                     read.alignment.position.position,
+                     read.alignment.mapping_quality,
+                     tuple((cigar.operation, cigar.operation_length)
+                           for cigar in read.alignment.cigar))
+                    for read in reads))
+
+
 class AssemblyRegion(object):
   """A region to assemble, holding the region Range and the reads.
 
@@ -350,19 +404,31 @@ class Realigner(object):
     """
     self.config = config
     self.ref_reader = ref_reader
-    self.window_sel = window_selector.WindowSelector(self.config.ws_config)
     self.diagnostic_logger = DiagnosticLogger(self.config.diagnostics)
+    # The candidate haplotypes of recently assembled windows, keyed by
+    # _window_cache_key, oldest first.
+    self._haplotypes_cache = collections.OrderedDict()
 
   def call_window_selector(self, region, reads):
     """Helper function to call window_selector module."""
     return sorted(
-        self.window_sel.process_reads(
-            self.ref_reader.bases(region), reads, region.reference_name,
-            region.start),
+        window_selector.select_windows(self.config.ws_config,
+                                       self.ref_reader.bases(region), reads,
+                                       region.reference_name, region.start),
         key=ranges.as_tuple)
 
-  def call_debruijn_graph(self, windows, reads):
-    """Helper function to call debruijn_graph module."""
+  def call_debruijn_graph(self, windows, reads, costs=None):
+    """Helper function to call debruijn_graph module.
+
+    Args:
+      windows: list[Range]. The windows to assemble.
+      reads: list[Read]. The reads of the windows.
+      costs: Optional core_pb2.RegionCosts proto, to which the sizes of the
+        graphs and haplotypes are added.
+
+    Returns:
+      list[realigner_pb2.CandidateHaplotypes], of the windows to realign.
+    """
     windows_haplotypes = []
     # Build and process de-Bruijn graph for each window.
     for window in windows:
@@ -377,24 +443,47 @@ class Realigner(object):
           if ranges.ranges_overlap(window, utils.read_range(read))
       ]
 
+      cache_key = _window_cache_key(window, dbg_reads)
+      graph = None
       with timer.Timer() as t:
-        graph = debruijn_graph.build(ref, dbg_reads, self.config.dbg_config)
+        candidate_haplotypes = self._haplotypes_cache.get(cache_key)
+        if candidate_haplotypes is None:
+          # Only assemble windows whose reads would survive pruning with some
+          # path off the reference.
+          if debruijn_graph.has_non_ref_kmers(ref, dbg_reads,
+                                              self.config.dbg_config):
+            graph = debruijn_graph.build(ref, dbg_reads,
+                                         self.config.dbg_config)
+          if not graph:
+            candidate_haplotypes = [ref]
+          else:
+            candidate_haplotypes = graph.candidate_haplotypes()
+          self._cache_haplotypes(cache_key, candidate_haplotypes)
       graph_building_time = t.GetDuration()
 
-      if not graph:
-        candidate_haplotypes = [ref]
-      else:
-        candidate_haplotypes = graph.candidate_haplotypes()
       if candidate_haplotypes and candidate_haplotypes != [ref]:
         candidate_haplotypes_info = realigner_pb2.CandidateHaplotypes(
             span=window, haplotypes=candidate_haplotypes)
         windows_haplotypes.append(candidate_haplotypes_info)
+        if costs is not None:
+          costs.num_candidate_haplotypes += len(candidate_haplotypes)
+      if costs is not None and graph:
+        costs.num_assembled_windows += 1
+        costs.num_graph_vertices += graph.num_vertices
+        costs.num_graph_edges += graph.num_edges
+        costs.max_kmer_size = max(costs.max_kmer_size, graph.kmer_size)
 
       self.diagnostic_logger.log_graph_metrics(
           window, graph, candidate_haplotypes, graph_building_time)
 
     return windows_haplotypes
 
+  def _cache_haplotypes(self, cache_key, candidate_haplotypes):
+    """Remembers the candidate haplotypes of a window, evicting the oldest."""
+    self._haplotypes_cache[cache_key] = candidate_haplotypes
+    if len(self._haplotypes_cache) > _MAX_CACHED_WINDOWS:
+      self._haplotypes_cache.popitem(last=False)
+
   def call_aligner(self, assembled_region):
     """Helper function to call aligner module."""
     if not assembled_region.reads:
@@ -423,13 +512,14 @@ class Realigner(object):
 
     ref_region = ranges.make_range(contig, ref_start, ref_end)
     ref_seq = ref_prefix + ref + ref_suffix
-    reads_aligner = aligner.Aligner(self.config.aln_config, ref_region, ref_seq)
-    return reads_aligner.align_reads([
+    haplotypes = [
         ref_prefix + target + ref_suffix
         for target in assembled_region.haplotypes
-    ], assembled_region.reads)
+    ]
+    return read_aligner.align_reads(self.config.aln_config, ref_region, ref_seq,
+                                    haplotypes, assembled_region.reads)
 
-  def realign_reads(self, reads, region):
+  def realign_reads(self, reads, region, costs=None):
     """Run realigner.
 
     This is the main function that
@@ -439,8 +529,9 @@ class Realigner(object):
         - Windows larger than max_window_size are skipped.
       - build pruned De-Bruijn graph for each candidate window (DeBruijnGraph
         (dbg) module).
-        - Graphs with more than max_num_paths candidate haplotypes or
-          with reference sequence as the only candidate are skipped.
+        - Graphs with more than max_num_paths candidate haplotypes keep
+          only the most likely ones, or are skipped if not keep_best_paths.
+        - Graphs with reference sequence as the only candidate are skipped.
       - Align reads based on candidate haplotypes (Aligner (aln) module).
       - Output all input reads (whether they required realignment or not).
 
@@ -449,6 +540,8 @@ class Realigner(object):
         list of input reads to realign.
       region: A `learning.genomics.deepvariant.core.genomics.Range` proto.
         Specifies the region on the genome we should process.
+      costs: Optional core_pb2.RegionCosts proto, to which the numbers of
+        windows, graph sizes, haplotypes and aligned reads are added.
 
     Returns:
       [realigner_pb2.CandidateHaplotypes]. Information on the list of candidate
@@ -459,8 +552,11 @@ class Realigner(object):
     """
     # Compute the windows where we need to assemble in the region.
     candidate_windows = self.call_window_selector(region, reads)
+    if costs is not None:
+      costs.num_realigner_windows += len(candidate_windows)
     # Assemble each of those regions.
-    candidate_haplotypes = self.call_debruijn_graph(candidate_windows, reads)
+    candidate_haplotypes = self.call_debruijn_graph(candidate_windows, reads,
+                                                    costs)
     # Create our simple container to store candidate / read mappings.
     assembled_regions = [AssemblyRegion(ch) for ch in candidate_haplotypes]
 
@@ -472,6 +568,8 @@ class Realigner(object):
     # our realigned_reads.
     for assembled_region in assembled_regions:
       realigned_reads.extend(self.call_aligner(assembled_region))
+      if costs is not None:
+        costs.num_aligned_reads += len(assembled_region.reads)
 
     self.diagnostic_logger.log_realigned_reads(region, realigned_reads)
 
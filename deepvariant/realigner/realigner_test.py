@@ -39,6 +39,7 @@ import os
 
 from absl.testing import absltest
 from absl.testing import parameterized
+import mock
 import tensorflow as tf
 
 from deepvariant import test_utils
@@ -50,6 +51,7 @@ from deepvariant.core.protos import core_pb2
 from deepvariant.protos import realigner_pb2
 from deepvariant.realigner import realigner
 from deepvariant.realigner import utils
+from deepvariant.realigner.python import debruijn_graph
 
 FLAGS = tf.flags.FLAGS
 
@@ -218,6 +220,76 @@ class RealignerTest(parameterized.TestCase):
     self.assertEqual(expected_haplotypes, set(windows_haplotypes[0].haplotypes),
                      comment)
 
+  def test_realign_reads_records_costs(self):
+    region = ranges.parse_literal('chr20:10,046,080-10,046,307')
+    reads = _get_reads(region)
+    costs = core_pb2.RegionCosts()
+    windows_haplotypes, _ = self.reads_realigner.realign_reads(
+        reads, region, costs=costs)
+
+    self.assertNotEmpty(windows_haplotypes)
+    self.assertGreaterEqual(costs.num_realigner_windows,
+                            costs.num_assembled_windows)
+    self.assertGreaterEqual(costs.num_assembled_windows,
+                            len(windows_haplotypes))
+    self.assertGreaterEqual(costs.num_graph_edges, costs.num_graph_vertices - 1)
+    self.assertGreaterEqual(costs.max_kmer_size,
+                            self.reads_realigner.config.dbg_config.min_k)
+    self.assertEqual(
+        sum(len(wh.haplotypes) for wh in windows_haplotypes),
+        costs.num_candidate_haplotypes)
+    self.assertGreater(costs.num_aligned_reads, 0)
+    self.assertLessEqual(costs.num_aligned_reads, len(reads))
+
+  def test_realign_reads_reuses_window_haplotypes(self):
+    region = ranges.parse_literal('chr20:10,046,080-10,046,307')
+    reads = _get_reads(region)
+    expected, _ = self.reads_realigner.realign_reads(reads, region)
+
+    with mock.patch.object(
+        debruijn_graph, 'build', wraps=debruijn_graph.build) as mock_build:
+      windows_haplotypes, _ = self.reads_realigner.realign_reads(reads, region)
+      mock_build.assert_not_called()
+      self.assertEqual(expected, windows_haplotypes)
+
+      # With a different set of reads the windows are assembled again.
+      self.reads_realigner.realign_reads(reads[1:], region)
+      mock_build.assert_called()
+
+  def test_window_cache_key_tells_alignments_apart(self):
+    window = ranges.make_range('chr20', 10, 20)
+    read = test_utils.make_read(
+        'ACGTACGT', start=10, cigar='8M', quals=[30] * 8, name='read')
+    deletion = test_utils.make_read(
+        'ACGTACGT', start=10, cigar='4M2D4M', quals=[30] * 8, name='read')
+    secondary = test_utils.make_read(
+        'ACGTACGT', start=10, cigar='8M', quals=[30] * 8, name='read')
+    secondary.secondary_alignment = True
+    supplementary = test_utils.make_read(
+        'ACGTACGT', start=10, cigar='8M', quals=[30] * 8, name='read')
+    supplementary.supplementary_alignment = True
+
+    key = realigner._window_cache_key(window, [read])
+    self.assertEqual(key, realigner._window_cache_key(window, [read, read]))
+    for other in [deletion, secondary, supplementary]:
+      self.assertNotEqual(key, realigner._window_cache_key(window, [other]))
+
+  def test_reference_only_windows_are_not_assembled(self):
+    region = ranges.parse_literal('chr20:10,046,080-10,046,307')
+    ref = self.ref_reader.bases(region)
+    read = test_utils.make_read(
+        ref,
+        start=region.start,
+        cigar='{}M'.format(len(ref)),
+        quals=[30] * len(ref),
+        name='read')
+    with mock.patch.object(
+        debruijn_graph, 'build', wraps=debruijn_graph.build) as mock_build:
+      windows_haplotypes = self.reads_realigner.call_debruijn_graph(
+          [region], [read] * 10)
+      mock_build.assert_not_called()
+      self.assertEmpty(windows_haplotypes)
+
   @parameterized.parameters(('chr20:10,046,080-10,046,307',
                              'chr20:10,046,179-10,046,188'))
   def test_realigner_example_variant(self, region_literal, variant_literal):
@@ -0,0 +1,480 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/smith_waterman.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "deepvariant/realigner/smith_waterman_kernels.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using internal::kNumBaseCodes;
+using internal::PassResult;
+using internal::StripedPass;
+
+namespace {
+
+// The score of unreachable cells in the 32 bit recurrences, low enough that
+// adding penalties to it can't overflow.
+constexpr int kNegInf = INT32_MIN / 4;
+
+// Cigar operations, by their index in SSW's "MIDNSHP=X".
+constexpr uint32_t kMatch = 0;
+constexpr uint32_t kInsert = 1;
+constexpr uint32_t kDelete = 2;
+
+// The trace of a cell: its best last operation in bits 0-1, and whether its
+// best insertion and deletion extend those of the previous cell in bits 2 and
+// 3.  kStart marks the first cell of a local alignment.
+constexpr uint8_t kStart = 3;
+constexpr uint8_t kExtendsInsert = 4;
+constexpr uint8_t kExtendsDelete = 8;
+
+// The 32 bit counterpart of RunStripedPass, with the same results, for the
+// queries whose scores could overflow the 16 bit kernels.
+PassResult ScalarPass(const int8_t* query, int query_length, const int8_t* ref,
+                      int ref_length, const std::vector<int8_t>& score_matrix,
+                      int gap_open, int gap_extend, bool local,
+                      int terminate) {
+  const int h_init = local ? 0 : kNegInf;
+  std::vector<int> h(query_length, h_init);
+  std::vector<int> e(query_length, kNegInf);
+  std::vector<int> best_column(query_length);
+  PassResult result = {local ? 0 : INT32_MIN, -1, -1};
+  for (int j = 0; j < ref_length; ++j) {
+    const int8_t* scores = score_matrix.data() + ref[j] * kNumBaseCodes;
+    int diagonal = local || j == 0 ? 0 : kNegInf;
+    int f = kNegInf;
+    int column_best = kNegInf;
+    for (int i = 0; i < query_length; ++i) {
+      int cell = std::max({diagonal + scores[query[i]], e[i], f});
+      if (local) {
+        cell = std::max(cell, 0);
+      }
+      diagonal = h[i];
+      h[i] = cell;
+      column_best = std::max(column_best, cell);
+      e[i] = std::max(e[i] - gap_extend, cell - gap_open);
+      f = std::max(f - gap_extend, cell - gap_open);
+    }
+    if (column_best > result.score) {
+      result.score = column_best;
+      result.ref_end = j;
+      best_column = h;
+    }
+    if (terminate > 0 && result.score >= terminate) {
+      break;
+    }
+  }
+  if (result.ref_end >= 0) {
+    result.query_end =
+        std::find(best_column.begin(), best_column.end(), result.score) -
+        best_column.begin();
+  }
+  return result;
+}
+
+// Adds n operations op to the front of the reversed cigar *cigar.
+void PrependCigarOps(uint32_t op, uint32_t n, std::vector<uint32_t>* cigar) {
+  if (!cigar->empty() && (cigar->back() & 0xf) == op) {
+    cigar->back() += n << 4;
+  } else {
+    cigar->push_back(n << 4 | op);
+  }
+}
+
+}  // namespace
+
+bool CpuSupportsKernel(SmithWatermanKernel kernel) {
+  switch (kernel) {
+    case SmithWatermanKernel::kAvx2:
+      return __builtin_cpu_supports("avx2");
+    case SmithWatermanKernel::kAvx512bw:
+      return __builtin_cpu_supports("avx512bw");
+    default:
+      // Every x86-64 CPU has SSE2.
+      return true;
+  }
+}
+
+SmithWatermanKernel ResolveKernel(SmithWatermanKernel kernel) {
+  if (kernel != SmithWatermanKernel::kAuto && CpuSupportsKernel(kernel)) {
+    return kernel;
+  }
+  for (const SmithWatermanKernel widest :
+       {SmithWatermanKernel::kAvx512bw, SmithWatermanKernel::kAvx2}) {
+    if (CpuSupportsKernel(widest)) {
+      return widest;
+    }
+  }
+  return SmithWatermanKernel::kSse2;
+}
+
+SimdSmithWaterman::SimdSmithWaterman(SmithWatermanKernel kernel,
+                                     const std::vector<int8_t>& score_matrix,
+                                     int gap_open, int gap_extend)
+    : kernel_(ResolveKernel(kernel)),
+      score_matrix_(score_matrix),
+      gap_open_(gap_open),
+      gap_extend_(gap_extend) {
+  CHECK(kernel != SmithWatermanKernel::kLibssw);
+  CHECK_EQ(kNumBaseCodes * kNumBaseCodes, score_matrix.size());
+  if (kernel != SmithWatermanKernel::kAuto && kernel_ != kernel) {
+    LOG(WARNING) << "This CPU can't run the requested Smith-Waterman kernel; "
+                 << "using a narrower one";
+  }
+  switch (kernel_) {
+    case SmithWatermanKernel::kAvx512bw:
+      lanes_ = internal::kAvx512bwLanes;
+      break;
+    case SmithWatermanKernel::kAvx2:
+      lanes_ = internal::kAvx2Lanes;
+      break;
+    default:
+      lanes_ = internal::kSse2Lanes;
+  }
+}
+
+void SimdSmithWaterman::SetQuery(const std::vector<int8_t>& query) {
+  query_ = &query;
+  const int max_score =
+      *std::max_element(score_matrix_.begin(), score_matrix_.end());
+  use_scalar_ = max_score * static_cast<int64_t>(query.size()) >=
+                    internal::kMaxStripedScore ||
+                gap_open_ < gap_extend_ || gap_open_ >= INT16_MAX;
+  if (!use_scalar_) {
+    BuildProfile(query, &profile_);
+  }
+}
+
+void SimdSmithWaterman::BuildProfile(const std::vector<int8_t>& query,
+                                     std::vector<int16_t>* profile) const {
+  const int query_length = query.size();
+  const int seg_len = std::max(1, (query_length + lanes_ - 1) / lanes_);
+  profile->resize(kNumBaseCodes * seg_len * lanes_);
+  int16_t* striped = profile->data();
+  for (int c = 0; c < kNumBaseCodes; ++c) {
+    const int8_t* scores = score_matrix_.data() + c * kNumBaseCodes;
+    for (int s = 0; s < seg_len; ++s) {
+      for (int lane = 0; lane < lanes_; ++lane) {
+        const int i = s + lane * seg_len;
+        *striped++ =
+            i < query_length ? scores[query[i]] : internal::kStripedNegInf;
+      }
+    }
+  }
+}
+
+bool SimdSmithWaterman::Align(const std::vector<int8_t>& ref,
+                              CompactAlignment* alignment) {
+  if (query_ == nullptr || query_->empty() || ref.empty()) {
+    return false;
+  }
+  const std::vector<int8_t>& query = *query_;
+
+  // Runs a pass of seq, whose profile is profile, against ref.
+  auto run_pass = [this](const std::vector<int16_t>& profile,
+                         const std::vector<int8_t>& seq, const int8_t* ref,
+                         int ref_length, bool local, int terminate) {
+    if (use_scalar_) {
+      return ScalarPass(seq.data(), seq.size(), ref, ref_length,
+                        score_matrix_, gap_open_, gap_extend_, local,
+                        terminate);
+    }
+    StripedPass pass;
+    pass.profile = profile.data();
+    pass.query_length = seq.size();
+    pass.seg_len = profile.size() / (kNumBaseCodes * lanes_);
+    pass.ref = ref;
+    pass.ref_length = ref_length;
+    pass.gap_open = gap_open_;
+    pass.gap_extend = gap_extend_;
+    pass.local = local;
+    pass.terminate = terminate;
+    scratch_.resize(4 * pass.seg_len * lanes_);
+    pass.scratch = scratch_.data();
+    switch (kernel_) {
+      case SmithWatermanKernel::kAvx512bw:
+        return internal::StripedPassAvx512bw(pass);
+      case SmithWatermanKernel::kAvx2:
+        return internal::StripedPassAvx2(pass);
+      default:
+        return internal::StripedPassSse2(pass);
+    }
+  };
+
+  // Find where the best alignment ends...
+  const PassResult end =
+      run_pass(profile_, query, ref.data(), ref.size(), true, 0);
+  alignment->sw_score = end.score;
+  alignment->cigar.clear();
+  if (end.score <= 0) {
+    alignment->query_begin = alignment->ref_begin = 0;
+    alignment->query_end = alignment->ref_end = -1;
+    return true;
+  }
+  alignment->query_end = end.query_end;
+  alignment->ref_end = end.ref_end;
+
+  // ... then where it starts, as the end of the first alignment of the
+  // reversed sequences up to there that is anchored at their starts and
+  // reaches the best score ...
+  reversed_query_.assign(query.rend() - end.query_end - 1, query.rend());
+  reversed_ref_.assign(ref.rend() - end.ref_end - 1, ref.rend());
+  if (!use_scalar_) {
+    BuildProfile(reversed_query_, &reversed_profile_);
+  }
+  const PassResult begin =
+      run_pass(reversed_profile_, reversed_query_, reversed_ref_.data(),
+               reversed_ref_.size(), false, end.score);
+  alignment->query_begin = end.query_end - begin.query_end;
+  alignment->ref_begin = end.ref_end - begin.ref_end;
+
+  // ... and finally how it gets from one to the other.
+  GlobalCigar(query.data() + alignment->query_begin,
+              alignment->query_end - alignment->query_begin + 1,
+              ref.data() + alignment->ref_begin,
+              alignment->ref_end - alignment->ref_begin + 1, end.score,
+              &alignment->cigar);
+  return true;
+}
+
+void SimdSmithWaterman::GlobalCigar(const int8_t* query, int query_length,
+                                    const int8_t* ref, int ref_length,
+                                    int score, std::vector<uint32_t>* cigar) {
+  // Aligns within a band of cells (i, j) with |i - j| <= band, which contains
+  // the last cell, widening it until the best alignment fits.
+  const int max_band = std::max(query_length, ref_length);
+  int band = std::min(std::abs(query_length - ref_length) + 1, max_band);
+  int width;
+  while (true) {
+    width = 2 * band + 1;
+    // H, E (deletions) and F (insertions) of each cell of the band.
+    band_scores_.assign(3 * query_length * width, kNegInf);
+    band_trace_.assign(query_length * width, 0);
+    auto score_at = [&](int i, int j, int state) {
+      if (i < 0 && j < 0) {
+        return state == 0 ? 0 : kNegInf;
+      }
+      if (i < 0 || j < 0 || j >= ref_length || std::abs(i - j) > band) {
+        return kNegInf;
+      }
+      return band_scores_[3 * (i * width + j - i + band) + state];
+    };
+    for (int i = 0; i < query_length; ++i) {
+      const int j_end = std::min(ref_length, i + band + 1);
+      for (int j = std::max(0, i - band); j < j_end; ++j) {
+        const int cell = i * width + j - i + band;
+        uint8_t trace = kMatch;
+        int h = score_at(i - 1, j - 1, 0) +
+                score_matrix_[ref[j] * kNumBaseCodes + query[i]];
+        const int e_open = score_at(i, j - 1, 0) - gap_open_;
+        const int e_extend = score_at(i, j - 1, 1) - gap_extend_;
+        const int e = std::max(e_open, e_extend);
+        if (e_extend >= e_open) trace |= kExtendsDelete;
+        const int f_open = score_at(i - 1, j, 0) - gap_open_;
+        const int f_extend = score_at(i - 1, j, 2) - gap_extend_;
+        const int f = std::max(f_open, f_extend);
+        if (f_extend >= f_open) trace |= kExtendsInsert;
+        if (f > h) {
+          h = f;
+          trace = (trace & ~3) | kInsert;
+        }
+        if (e > h) {
+          h = e;
+          trace = (trace & ~3) | kDelete;
+        }
+        band_scores_[3 * cell] = h;
+        band_scores_[3 * cell + 1] = e;
+        band_scores_[3 * cell + 2] = f;
+        band_trace_[cell] = trace;
+      }
+    }
+    if (score_at(query_length - 1, ref_length - 1, 0) >= score ||
+        band >= max_band) {
+      break;
+    }
+    band = std::min(2 * band, max_band);
+  }
+
+  std::vector<uint32_t> reversed;
+  int i = query_length - 1;
+  int j = ref_length - 1;
+  uint32_t state = kMatch;  // Where kMatch stands for any last operation.
+  while (i >= 0 && j >= 0) {
+    const uint8_t trace = band_trace_[i * width + j - i + band];
+    if (state == kMatch) {
+      state = trace & 3;
+      if (state == kMatch) {
+        PrependCigarOps(kMatch, 1, &reversed);
+        --i;
+        --j;
+      }
+    } else if (state == kInsert) {
+      PrependCigarOps(kInsert, 1, &reversed);
+      state = trace & kExtendsInsert ? kInsert : kMatch;
+      --i;
+    } else {
+      PrependCigarOps(kDelete, 1, &reversed);
+      state = trace & kExtendsDelete ? kDelete : kMatch;
+      --j;
+    }
+  }
+  cigar->assign(reversed.rbegin(), reversed.rend());
+}
+
+BandedSmithWaterman::BandedSmithWaterman(
+    const std::vector<int8_t>& score_matrix, int gap_open, int gap_extend)
+    : score_matrix_(score_matrix),
+      gap_open_(gap_open),
+      gap_extend_(gap_extend) {
+  CHECK_EQ(kNumBaseCodes * kNumBaseCodes, score_matrix.size());
+}
+
+bool BandedSmithWaterman::Align(const std::vector<int8_t>& query,
+                                const std::vector<int8_t>& ref, int diagonal,
+                                int band_width, CompactAlignment* alignment) {
+  if (query.empty() || ref.empty() || band_width < 0) {
+    return false;
+  }
+  const int query_length = query.size();
+  const int ref_length = ref.size();
+  const int width = 2 * band_width + 1;
+  // Cell (i, j) is at column j - i - diagonal + band_width of row i.
+  band_scores_.assign(3 * query_length * width, kNegInf);
+  band_trace_.assign(query_length * width, kStart);
+  auto score_at = [&](int i, int j, int state) {
+    const int column = j - i - diagonal + band_width;
+    if (i < 0 || j < 0 || j >= ref_length || column < 0 || column >= width) {
+      // Local alignments can start anywhere, including outside the band.
+      return state == 0 ? 0 : kNegInf;
+    }
+    return band_scores_[3 * (i * width + column) + state];
+  };
+
+  int best_score = 0;
+  int best_i = -1;
+  int best_j = -1;
+  for (int i = 0; i < query_length; ++i) {
+    const int j_begin = std::max(0, i + diagonal - band_width);
+    const int j_end = std::min(ref_length, i + diagonal + band_width + 1);
+    for (int j = j_begin; j < j_end; ++j) {
+      const int cell = i * width + j - i - diagonal + band_width;
+      uint8_t trace = kMatch;
+      int h = score_at(i - 1, j - 1, 0) +
+              score_matrix_[ref[j] * kNumBaseCodes + query[i]];
+      const int e_open = score_at(i, j - 1, 0) - gap_open_;
+      const int e_extend = score_at(i, j - 1, 1) - gap_extend_;
+      const int e = std::max(e_open, e_extend);
+      if (e_extend >= e_open) trace |= kExtendsDelete;
+      const int f_open = score_at(i - 1, j, 0) - gap_open_;
+      const int f_extend = score_at(i - 1, j, 2) - gap_extend_;
+      const int f = std::max(f_open, f_extend);
+      if (f_extend >= f_open) trace |= kExtendsInsert;
+      if (f > h) {
+        h = f;
+        trace = (trace & ~3) | kInsert;
+      }
+      if (e > h) {
+        h = e;
+        trace = (trace & ~3) | kDelete;
+      }
+      if (h <= 0) {
+        h = 0;
+        trace |= kStart;
+      }
+      band_scores_[3 * cell] = h;
+      band_scores_[3 * cell + 1] = e;
+      band_scores_[3 * cell + 2] = f;
+      band_trace_[cell] = trace;
+      if (h > best_score) {
+        best_score = h;
+        best_i = i;
+        best_j = j;
+      }
+    }
+  }
+
+  alignment->sw_score = best_score;
+  alignment->cigar.clear();
+  if (best_score <= 0) {
+    alignment->query_begin = alignment->ref_begin = 0;
+    alignment->query_end = alignment->ref_end = -1;
+    return true;
+  }
+  alignment->query_end = best_i;
+  alignment->ref_end = best_j;
+
+  std::vector<uint32_t> reversed;
+  int i = best_i;
+  int j = best_j;
+  uint32_t state = kMatch;  // Where kMatch stands for any last operation.
+  while (true) {
+    const uint8_t trace =
+        band_trace_[i * width + j - i - diagonal + band_width];
+    if (state == kMatch) {
+      if ((trace & 3) == kStart) {
+        break;
+      }
+      state = trace & 3;
+      if (state == kMatch) {
+        PrependCigarOps(kMatch, 1, &reversed);
+        if (score_at(i - 1, j - 1, 0) == 0) {
+          // The alignment starts with this match.
+          break;
+        }
+        --i;
+        --j;
+      }
+    } else if (state == kInsert) {
+      PrependCigarOps(kInsert, 1, &reversed);
+      state = trace & kExtendsInsert ? kInsert : kMatch;
+      --i;
+    } else {
+      PrependCigarOps(kDelete, 1, &reversed);
+      state = trace & kExtendsDelete ? kDelete : kMatch;
+      --j;
+    }
+  }
+  alignment->query_begin = i;
+  alignment->ref_begin = j;
+  alignment->cigar.assign(reversed.rbegin(), reversed.rend());
+  return true;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
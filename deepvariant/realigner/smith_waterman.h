@@ -0,0 +1,171 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_SMITH_WATERMAN_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_SMITH_WATERMAN_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+// The essentials of an SSW alignment, as produced by QueryAligner.  Begin and
+// end offsets are 0-based and inclusive, as in Alignment.  cigar uses SSW's
+// packed (length << 4 | index into "MIDNSHP=X") units but, unlike Alignment,
+// covers only the aligned part of the query (no soft clips) and reports
+// matches and mismatches alike as M.
+struct CompactAlignment {
+  uint16_t sw_score = 0;
+  int32_t query_begin = 0;
+  int32_t query_end = 0;
+  int32_t ref_begin = 0;
+  int32_t ref_end = 0;
+  std::vector<uint32_t> cigar;
+};
+
+// The Smith-Waterman implementations QueryAligner can use.
+enum class SmithWatermanKernel {
+  // libssw's 8 lane SSE2 implementation.
+  kLibssw,
+  // Our striped 16 bit kernels, for 8, 16 and 32 lanes.
+  kSse2,
+  kAvx2,
+  kAvx512bw,
+  // The widest of our kernels this CPU supports.
+  kAuto,
+};
+
+// Returns whether this CPU can run kernel.
+bool CpuSupportsKernel(SmithWatermanKernel kernel);
+
+// Returns kernel if this CPU can run it, and otherwise the widest of our
+// kernels it can run.  Never returns kAuto.
+SmithWatermanKernel ResolveKernel(SmithWatermanKernel kernel);
+
+// A Smith-Waterman aligner of one query against many references, with the
+// striped SIMD kernels of smith_waterman_<isa>.cc.  Its scores are the
+// optimal affine-gap local alignment scores, which libssw also finds for any
+// realistic read, but it chooses among equally good alignments in its own
+// way: the alignment ending first in the reference and then in the query,
+// with the latest start, and with matches, then insertions, then deletions
+// preferred when tracing it back.  This choice is the same for every
+// instruction set.
+//
+// Sequences are given as SSW base codes: 0 to 3 for A, C, G and T and 4 for
+// anything else.
+class SimdSmithWaterman {
+ public:
+  // score_matrix is the 5x5 row-major matrix of the scores of pairs of base
+  // codes.  kernel must not be kLibssw.
+  SimdSmithWaterman(SmithWatermanKernel kernel,
+                    const std::vector<int8_t>& score_matrix, int gap_open,
+                    int gap_extend);
+
+  // Builds the query profile of query, which must outlive this object or the
+  // next call to SetQuery.
+  void SetQuery(const std::vector<int8_t>& query);
+
+  // Aligns the query to ref.  Returns false if either of them is empty.
+  bool Align(const std::vector<int8_t>& ref, CompactAlignment* alignment);
+
+  // The kernel actually used, after ResolveKernel.
+  SmithWatermanKernel kernel() const { return kernel_; }
+
+ private:
+  // Builds the striped profile of query into *profile.
+  void BuildProfile(const std::vector<int8_t>& query,
+                    std::vector<int16_t>* profile) const;
+
+  // Sets *cigar to that of a best global alignment of query to ref, which
+  // should score score.
+  void GlobalCigar(const int8_t* query, int query_length, const int8_t* ref,
+                   int ref_length, int score, std::vector<uint32_t>* cigar);
+
+  SmithWatermanKernel kernel_;
+  int lanes_;
+  std::vector<int8_t> score_matrix_;
+  int gap_open_;
+  int gap_extend_;
+  // Whether to use the 32 bit scalar pass since the 16 bit kernels could
+  // overflow or the gap penalties break their assumptions.
+  bool use_scalar_ = false;
+
+  const std::vector<int8_t>* query_ = nullptr;
+  std::vector<int16_t> profile_;
+
+  // Buffers reused across alignments.
+  std::vector<int16_t> scratch_;
+  std::vector<int8_t> reversed_query_;
+  std::vector<int8_t> reversed_ref_;
+  std::vector<int16_t> reversed_profile_;
+  std::vector<int> band_scores_;
+  std::vector<uint8_t> band_trace_;
+};
+
+// A local Smith-Waterman aligner that only considers the cells (i, j), for
+// query offset i and reference offset j, with |j - i - diagonal| <= band_width.
+// When the query is known to align near a seed diagonal, as reads do in the
+// realigner, this costs O(query length * band_width) rather than the
+// O(query length * reference length) of a full alignment, but misses any
+// better alignment that leaves the band.  Of equally good alignments it
+// reports the one ending first in the query and then in the reference,
+// preferring matches, then insertions, then deletions when tracing it back.
+//
+// Sequences and scores are given as for SimdSmithWaterman.
+class BandedSmithWaterman {
+ public:
+  BandedSmithWaterman(const std::vector<int8_t>& score_matrix, int gap_open,
+                      int gap_extend);
+
+  // Aligns query to ref within the band.  Returns false if either of them is
+  // empty or band_width is negative.
+  bool Align(const std::vector<int8_t>& query, const std::vector<int8_t>& ref,
+             int diagonal, int band_width, CompactAlignment* alignment);
+
+ private:
+  std::vector<int8_t> score_matrix_;
+  int gap_open_;
+  int gap_extend_;
+
+  // H, E (deletions) and F (insertions) of each cell of the band, and the
+  // traces of the cells, reused across alignments.
+  std::vector<int> band_scores_;
+  std::vector<uint8_t> band_trace_;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_SMITH_WATERMAN_H_
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The AVX2 instantiation of the striped Smith-Waterman pass.  This file must
+// be compiled with -mavx2.
+
+#include <immintrin.h>
+
+#include "deepvariant/realigner/smith_waterman_kernels.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+namespace internal {
+
+namespace {
+
+// kStripedNegInf in the first kAvx2Lanes lanes, for ShiftLanes.
+const int16_t kNegInfLanes[2 * kAvx2Lanes] = {
+    kStripedNegInf, kStripedNegInf, kStripedNegInf, kStripedNegInf,
+    kStripedNegInf, kStripedNegInf, kStripedNegInf, kStripedNegInf,
+    kStripedNegInf, kStripedNegInf, kStripedNegInf, kStripedNegInf,
+    kStripedNegInf, kStripedNegInf, kStripedNegInf, kStripedNegInf};
+
+struct Avx2 {
+  typedef __m256i Vector;
+  static constexpr int kLanes = kAvx2Lanes;
+
+  static Vector Load(const int16_t* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  }
+  static void Store(int16_t* p, Vector v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+  }
+  static Vector Set1(int16_t x) { return _mm256_set1_epi16(x); }
+  static Vector Adds(Vector a, Vector b) { return _mm256_adds_epi16(a, b); }
+  static Vector Subs(Vector a, Vector b) { return _mm256_subs_epi16(a, b); }
+  static Vector Max(Vector a, Vector b) { return _mm256_max_epi16(a, b); }
+  static Vector ShiftIn(Vector v, int16_t x) {
+    // Shifts by two bytes across the 128 bit halves: the low half of
+    // carry is zero and its high half is the low half of v.
+    const __m256i carry = _mm256_permute2x128_si256(v, v, 0x08);
+    return _mm256_insert_epi16(_mm256_alignr_epi8(v, carry, 14), x, 0);
+  }
+  template <int kShift>
+  static Vector ShiftLanes(Vector v) {
+    // As in ShiftIn, but shifts of 8 lanes or more only need carry.
+    const __m256i carry = _mm256_permute2x128_si256(v, v, 0x08);
+    const __m256i shifted =
+        kShift < 8
+            ? _mm256_alignr_epi8(v, carry, kShift < 8 ? 16 - 2 * kShift : 0)
+            : _mm256_slli_si256(carry, kShift < 8 ? 0 : 2 * (kShift - 8));
+    // The bits of kStripedNegInf are 0x8000, so or-ing them into the zeroed
+    // lanes sets those to it.
+    return _mm256_or_si256(
+        shifted, Load(kNegInfLanes + kAvx2Lanes - kShift));
+  }
+  static int HorizontalMax(Vector v) {
+    __m128i m = _mm_max_epi16(_mm256_castsi256_si128(v),
+                              _mm256_extracti128_si256(v, 1));
+    m = _mm_max_epi16(m, _mm_srli_si128(m, 8));
+    m = _mm_max_epi16(m, _mm_srli_si128(m, 4));
+    m = _mm_max_epi16(m, _mm_srli_si128(m, 2));
+    return static_cast<int16_t>(_mm_extract_epi16(m, 0));
+  }
+};
+
+}  // namespace
+
+PassResult StripedPassAvx2(const StripedPass& pass) {
+  return RunStripedPass<Avx2>(pass);
+}
+
+}  // namespace internal
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
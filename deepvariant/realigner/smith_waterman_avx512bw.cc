@@ -0,0 +1,99 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The AVX-512BW instantiation of the striped Smith-Waterman pass.  This file
+// must be compiled with -mavx512bw.
+
+#include <immintrin.h>
+
+#include "deepvariant/realigner/smith_waterman_kernels.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+namespace internal {
+
+namespace {
+
+// The lane permutations of ShiftLanes<n>, from kShiftedLanes + 32 - n: lane i
+// of the result is lane i - n of its input, and lanes below n are overwritten.
+const int16_t kShiftedLanes[2 * kAvx512bwLanes] = {
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31};
+
+struct Avx512bw {
+  typedef __m512i Vector;
+  static constexpr int kLanes = kAvx512bwLanes;
+
+  static Vector Load(const int16_t* p) { return _mm512_loadu_si512(p); }
+  static void Store(int16_t* p, Vector v) { _mm512_storeu_si512(p, v); }
+  static Vector Set1(int16_t x) { return _mm512_set1_epi16(x); }
+  // Moves lane i of v to lane i + kShift, leaving junk in the lanes below.
+  template <int kShift>
+  static Vector Permute(Vector v) {
+    return _mm512_permutexvar_epi16(
+        Load(kShiftedLanes + kAvx512bwLanes - kShift), v);
+  }
+  static Vector Adds(Vector a, Vector b) { return _mm512_adds_epi16(a, b); }
+  static Vector Subs(Vector a, Vector b) { return _mm512_subs_epi16(a, b); }
+  static Vector Max(Vector a, Vector b) { return _mm512_max_epi16(a, b); }
+  static Vector ShiftIn(Vector v, int16_t x) {
+    return _mm512_mask_set1_epi16(Permute<1>(v), 1, x);
+  }
+  template <int kShift>
+  static Vector ShiftLanes(Vector v) {
+    return _mm512_mask_set1_epi16(Permute<kShift>(v), (1u << kShift) - 1,
+                                  kStripedNegInf);
+  }
+  static int HorizontalMax(Vector v) {
+    const __m256i half = _mm256_max_epi16(_mm512_castsi512_si256(v),
+                                          _mm512_extracti64x4_epi64(v, 1));
+    __m128i m = _mm_max_epi16(_mm256_castsi256_si128(half),
+                              _mm256_extracti128_si256(half, 1));
+    m = _mm_max_epi16(m, _mm_srli_si128(m, 8));
+    m = _mm_max_epi16(m, _mm_srli_si128(m, 4));
+    m = _mm_max_epi16(m, _mm_srli_si128(m, 2));
+    return static_cast<int16_t>(_mm_extract_epi16(m, 0));
+  }
+};
+
+}  // namespace
+
+PassResult StripedPassAvx512bw(const StripedPass& pass) {
+  return RunStripedPass<Avx512bw>(pass);
+}
+
+}  // namespace internal
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
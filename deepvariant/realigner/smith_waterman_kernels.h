@@ -0,0 +1,242 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The striped Smith-Waterman pass shared by our SIMD kernels.  It follows
+// Farrar (Bioinformatics 2007), except that the vertical gaps crossing lanes
+// are found by a scan over the lanes rather than by Farrar's "lazy F" loop,
+// which degrades to a scalar walk down the column when high scores meet
+// cheap gap extensions, as with our default scoring.
+//
+// Each smith_waterman_<isa>.cc instantiates RunStripedPass with a vector type
+// of its instruction set, and is compiled with the flags enabling it, so this
+// header must only be included by those files and by smith_waterman.cc, which
+// dispatches to them at runtime.
+//
+// N.B.: nothing here may instantiate templates from the standard library:
+// the copies of them emitted in a file compiled for AVX-512 could be picked
+// by the linker for code running on any CPU.
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_SMITH_WATERMAN_KERNELS_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_SMITH_WATERMAN_KERNELS_H_
+
+#include <stdint.h>
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+namespace internal {
+
+// The number of base codes our score matrices have: A, C, G, T and N.
+constexpr int kNumBaseCodes = 5;
+
+// The score of the cells the DP recurrences can't reach.  No real score gets
+// close to it, as the kernels are only used if the best possible score is
+// below kMaxStripedScore.
+constexpr int16_t kStripedNegInf = INT16_MIN;
+constexpr int kMaxStripedScore = 16384;
+
+// The inputs of one pass of Smith-Waterman of a query against a reference.
+struct StripedPass {
+  // For each base code c, the striped scores of query base i against c:
+  // profile[(c * seg_len + i % seg_len) * lanes + i / seg_len], where lanes
+  // is the vector width of the kernel and padding bases score kStripedNegInf.
+  const int16_t* profile;
+  int query_length;
+  int seg_len;
+  // The base codes of the reference.
+  const int8_t* ref;
+  int ref_length;
+  int16_t gap_open;
+  int16_t gap_extend;
+  // If false, alignments must start at the first bases of query and ref.
+  bool local;
+  // If positive, the pass stops at the first reference base at which an
+  // alignment scores at least terminate.
+  int terminate;
+  // Room for 4 * lanes * seg_len scores.
+  int16_t* scratch;
+};
+
+// The best alignment a pass found: its score and the offsets of its last
+// query and reference bases, or -1 if no local alignment scores above 0.
+// If several alignments have the best score, the one ending at the first
+// reference base wins, and among those the one ending at the first query base.
+struct PassResult {
+  int score;
+  int query_end;
+  int ref_end;
+};
+
+// The most steps of a LaneScan, for 32 lanes.
+constexpr int kMaxScanSteps = 5;
+
+// Sets lane i of v to the max over lanes k <= i of v[k] - (i - k) * step,
+// given that v already holds the max over k > i - kShift, and penalties[n]
+// is 2^n * kShift * step.  This is the usual parallel prefix scan, in
+// log2(Simd::kLanes) steps.
+template <class Simd, int kShift, bool kDone = (kShift >= Simd::kLanes)>
+struct LaneScan {
+  typedef typename Simd::Vector Vector;
+  static Vector Run(Vector v, const Vector* penalties) {
+    v = Simd::Max(v, Simd::Subs(Simd::template ShiftLanes<kShift>(v),
+                                *penalties));
+    return LaneScan<Simd, 2 * kShift>::Run(v, penalties + 1);
+  }
+};
+
+template <class Simd, int kShift>
+struct LaneScan<Simd, kShift, true> {
+  typedef typename Simd::Vector Vector;
+  static Vector Run(Vector v, const Vector* /* penalties */) { return v; }
+};
+
+// Runs a pass with the vector operations of Simd, which provides:
+//   Vector, kLanes          the vector type and its number of int16 lanes.
+//   Load, Store             unaligned loads and stores.
+//   Set1, Adds, Subs, Max   broadcast and saturating signed arithmetic.
+//   ShiftIn(v, x)           lane i of v moved to lane i + 1, x in lane 0.
+//   ShiftLanes<n>(v)        lane i of v moved to lane i + n, and
+//                           kStripedNegInf in lanes 0 to n - 1.
+//   HorizontalMax(v)        the largest lane of v.
+template <class Simd>
+PassResult RunStripedPass(const StripedPass& pass) {
+  typedef typename Simd::Vector Vector;
+  const int lanes = Simd::kLanes;
+  const int seg_len = pass.seg_len;
+  const int column_size = seg_len * lanes;
+  // The scores of columns rotate through three buffers, so that neither the
+  // previous column nor the best one so far gets overwritten.
+  int16_t* const columns[3] = {pass.scratch, pass.scratch + column_size,
+                               pass.scratch + 2 * column_size};
+  int16_t* h_load = columns[0];
+  int16_t* best_column = nullptr;
+  int16_t* e = pass.scratch + 3 * column_size;
+  for (int i = 0; i < column_size; ++i) {
+    h_load[i] = pass.local ? 0 : kStripedNegInf;
+    e[i] = kStripedNegInf;
+  }
+
+  const Vector zero = Simd::Set1(0);
+  const Vector neg_inf = Simd::Set1(kStripedNegInf);
+  const Vector gap_open = Simd::Set1(pass.gap_open);
+  const Vector gap_extend = Simd::Set1(pass.gap_extend);
+  // The penalties of extending a vertical gap across 1, 2, 4, ... lanes.
+  Vector scan_penalties[kMaxScanSteps];
+  for (int n = 0, penalty = seg_len * pass.gap_extend; n < kMaxScanSteps;
+       ++n, penalty = penalty < INT16_MAX ? 2 * penalty : INT16_MAX) {
+    scan_penalties[n] = Simd::Set1(penalty < INT16_MAX ? penalty : INT16_MAX);
+  }
+  PassResult result = {pass.local ? 0 : INT32_MIN, -1, -1};
+  for (int j = 0; j < pass.ref_length; ++j) {
+    const int16_t* profile = pass.profile + pass.ref[j] * column_size;
+    // The diagonal neighbour of the first query base: H(-1, j - 1).
+    const int16_t corner = pass.local || j == 0 ? 0 : kStripedNegInf;
+    Vector h = Simd::ShiftIn(
+        Simd::Load(h_load + (seg_len - 1) * lanes), corner);
+    int16_t* h_store = columns[0];
+    for (int16_t* column : columns) {
+      if (column != h_load && column != best_column) {
+        h_store = column;
+        break;
+      }
+    }
+
+    // The scores of the column without vertical gaps, and the best vertical
+    // gap each lane alone opens into the next one.
+    Vector f = neg_inf;
+    for (int s = 0; s < seg_len; ++s) {
+      h = Simd::Adds(h, Simd::Load(profile + s * lanes));
+      h = Simd::Max(h, Simd::Load(e + s * lanes));
+      if (pass.local) {
+        h = Simd::Max(h, zero);
+      }
+      Simd::Store(h_store + s * lanes, h);
+      f = Simd::Max(Simd::Subs(f, gap_extend), Simd::Subs(h, gap_open));
+      h = Simd::Load(h_load + s * lanes);
+    }
+
+    // The vertical gaps entering each lane, which can extend across several
+    // lanes.  With gap_open >= gap_extend, a vertical gap never opens after
+    // another one, so the gaps of the first pass are all we need.
+    f = LaneScan<Simd, 1>::Run(Simd::ShiftIn(f, kStripedNegInf),
+                               scan_penalties);
+
+    // The final scores, with the vertical gaps.
+    Vector column_max = neg_inf;
+    for (int s = 0; s < seg_len; ++s) {
+      h = Simd::Max(Simd::Load(h_store + s * lanes), f);
+      Simd::Store(h_store + s * lanes, h);
+      column_max = Simd::Max(column_max, h);
+      const Vector h_open = Simd::Subs(h, gap_open);
+      Simd::Store(e + s * lanes,
+                  Simd::Max(Simd::Subs(Simd::Load(e + s * lanes), gap_extend),
+                            h_open));
+      f = Simd::Max(Simd::Subs(f, gap_extend), h_open);
+    }
+
+    const int column_best = Simd::HorizontalMax(column_max);
+    if (column_best > result.score) {
+      result.score = column_best;
+      result.ref_end = j;
+      best_column = h_store;
+    }
+    h_load = h_store;
+    if (pass.terminate > 0 && result.score >= pass.terminate) {
+      break;
+    }
+  }
+
+  if (result.ref_end >= 0) {
+    for (int i = 0; i < pass.query_length; ++i) {
+      if (best_column[(i % seg_len) * lanes + i / seg_len] == result.score) {
+        result.query_end = i;
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+// The passes of each instruction set and their vector widths, in int16
+// lanes.  The caller must check that the CPU supports the instruction set.
+PassResult StripedPassSse2(const StripedPass& pass);
+PassResult StripedPassAvx2(const StripedPass& pass);
+PassResult StripedPassAvx512bw(const StripedPass& pass);
+constexpr int kSse2Lanes = 8;
+constexpr int kAvx2Lanes = 16;
+constexpr int kAvx512bwLanes = 32;
+
+}  // namespace internal
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_SMITH_WATERMAN_KERNELS_H_
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The SSE2 instantiation of the striped Smith-Waterman pass.
+
+#include <emmintrin.h>
+
+#include "deepvariant/realigner/smith_waterman_kernels.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+namespace internal {
+
+namespace {
+
+struct Sse2 {
+  typedef __m128i Vector;
+  static constexpr int kLanes = kSse2Lanes;
+
+  static Vector Load(const int16_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+  static void Store(int16_t* p, Vector v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+  }
+  static Vector Set1(int16_t x) { return _mm_set1_epi16(x); }
+  static Vector Adds(Vector a, Vector b) { return _mm_adds_epi16(a, b); }
+  static Vector Subs(Vector a, Vector b) { return _mm_subs_epi16(a, b); }
+  static Vector Max(Vector a, Vector b) { return _mm_max_epi16(a, b); }
+  static Vector ShiftIn(Vector v, int16_t x) {
+    return _mm_insert_epi16(_mm_slli_si128(v, 2), x, 0);
+  }
+  template <int kShift>
+  static Vector ShiftLanes(Vector v) {
+    // The bits of kStripedNegInf are 0x8000, so or-ing them into the zeroed
+    // lanes sets those to it.
+    return _mm_or_si128(
+        _mm_slli_si128(v, 2 * kShift),
+        _mm_srli_si128(_mm_set1_epi16(kStripedNegInf), 16 - 2 * kShift));
+  }
+  static int HorizontalMax(Vector v) {
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 2));
+    return static_cast<int16_t>(_mm_extract_epi16(v, 0));
+  }
+};
+
+}  // namespace
+
+PassResult StripedPassSse2(const StripedPass& pass) {
+  return RunStripedPass<Sse2>(pass);
+}
+
+}  // namespace internal
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,302 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/smith_waterman.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using ::testing::ElementsAre;
+
+// The score matrix of QueryAligner for these match and mismatch scores.
+std::vector<int8_t> ScoreMatrix(int match, int mismatch) {
+  std::vector<int8_t> matrix(25, 0);
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      matrix[i * 5 + j] = i == j ? match : -mismatch;
+    }
+  }
+  return matrix;
+}
+
+// The best local alignment score of query to ref, by brute force.
+int BestScore(const std::vector<int8_t>& query, const std::vector<int8_t>& ref,
+              const std::vector<int8_t>& matrix, int gap_open,
+              int gap_extend) {
+  const int m = query.size();
+  const int n = ref.size();
+  const int neg_inf = -1000000;
+  std::vector<std::vector<int>> h(m + 1, std::vector<int>(n + 1, 0));
+  auto e = std::vector<std::vector<int>>(m + 1,
+                                         std::vector<int>(n + 1, neg_inf));
+  auto f = e;
+  int best = 0;
+  for (int i = 1; i <= m; ++i) {
+    for (int j = 1; j <= n; ++j) {
+      e[i][j] = std::max(h[i][j - 1] - gap_open, e[i][j - 1] - gap_extend);
+      f[i][j] = std::max(h[i - 1][j] - gap_open, f[i - 1][j] - gap_extend);
+      h[i][j] = std::max({0, e[i][j], f[i][j],
+                          h[i - 1][j - 1] + matrix[ref[j - 1] * 5 +
+                                                   query[i - 1]]});
+      best = std::max(best, h[i][j]);
+    }
+  }
+  return best;
+}
+
+// Checks that alignment is consistent: its cigar spans its begin and end and
+// scores sw_score.
+void ExpectConsistent(const std::vector<int8_t>& query,
+                      const std::vector<int8_t>& ref,
+                      const std::vector<int8_t>& matrix, int gap_open,
+                      int gap_extend, const CompactAlignment& alignment) {
+  int i = alignment.query_begin;
+  int j = alignment.ref_begin;
+  int score = 0;
+  for (const uint32_t unit : alignment.cigar) {
+    const int length = unit >> 4;
+    switch (unit & 0xf) {
+      case 0:
+        for (int k = 0; k < length; ++k, ++i, ++j) {
+          score += matrix[ref[j] * 5 + query[i]];
+        }
+        break;
+      case 1:
+        score -= gap_open + (length - 1) * gap_extend;
+        i += length;
+        break;
+      case 2:
+        score -= gap_open + (length - 1) * gap_extend;
+        j += length;
+        break;
+      default:
+        FAIL() << "Unexpected cigar operation " << (unit & 0xf);
+    }
+  }
+  EXPECT_EQ(alignment.query_end + 1, i);
+  EXPECT_EQ(alignment.ref_end + 1, j);
+  EXPECT_EQ(alignment.sw_score, score);
+}
+
+std::vector<int8_t> RandomBases(std::mt19937* random, int length) {
+  std::uniform_int_distribution<int> base(0, 3);
+  std::vector<int8_t> bases(length);
+  for (int8_t& b : bases) {
+    b = base(*random);
+  }
+  return bases;
+}
+
+// Introduces a few random substitutions, insertions and deletions in bases.
+std::vector<int8_t> Mutate(std::mt19937* random, std::vector<int8_t> bases) {
+  std::uniform_int_distribution<int> kind(0, 2);
+  for (int n = 0; n < 3 && bases.size() > 4; ++n) {
+    const int pos = (*random)() % bases.size();
+    switch (kind(*random)) {
+      case 0:
+        bases[pos] = (bases[pos] + 1) % 4;
+        break;
+      case 1:
+        bases.insert(bases.begin() + pos, (*random)() % 4);
+        break;
+      default:
+        bases.erase(bases.begin() + pos);
+    }
+  }
+  return bases;
+}
+
+class SimdSmithWatermanTest
+    : public ::testing::TestWithParam<SmithWatermanKernel> {};
+
+TEST_P(SimdSmithWatermanTest, AlignsWithAnInsertion) {
+  // The gcc 5.4 test case of ssw_test: ttAtt against tttt.
+  const std::vector<int8_t> query = {3, 3, 0, 3, 3};
+  SimdSmithWaterman aligner(GetParam(), ScoreMatrix(4, 2), 4, 2);
+  aligner.SetQuery(query);
+  CompactAlignment alignment;
+  ASSERT_TRUE(aligner.Align({3, 3, 3, 3}, &alignment));
+  EXPECT_EQ(12, alignment.sw_score);
+  EXPECT_EQ(0, alignment.query_begin);
+  EXPECT_EQ(4, alignment.query_end);
+  EXPECT_EQ(0, alignment.ref_begin);
+  EXPECT_EQ(3, alignment.ref_end);
+  EXPECT_THAT(alignment.cigar, ElementsAre(2 << 4, 1 << 4 | 1, 2 << 4));
+}
+
+TEST_P(SimdSmithWatermanTest, RejectsEmptySequences) {
+  const std::vector<int8_t> query = {0, 1};
+  const std::vector<int8_t> empty;
+  SimdSmithWaterman aligner(GetParam(), ScoreMatrix(1, 1), 2, 1);
+  CompactAlignment alignment;
+  aligner.SetQuery(query);
+  EXPECT_FALSE(aligner.Align(empty, &alignment));
+  aligner.SetQuery(empty);
+  EXPECT_FALSE(aligner.Align(query, &alignment));
+}
+
+TEST_P(SimdSmithWatermanTest, ReportsNoAlignmentWithoutMatches) {
+  const std::vector<int8_t> query = {0, 0, 0};
+  SimdSmithWaterman aligner(GetParam(), ScoreMatrix(1, 1), 2, 1);
+  aligner.SetQuery(query);
+  CompactAlignment alignment;
+  ASSERT_TRUE(aligner.Align({1, 2, 4, 3}, &alignment));
+  EXPECT_EQ(0, alignment.sw_score);
+  EXPECT_TRUE(alignment.cigar.empty());
+}
+
+// Every kernel must find the best score and agree with SSE2 on the alignment,
+// including for queries long enough to need the 32 bit fallback.
+TEST_P(SimdSmithWatermanTest, MatchesBruteForceAndSse2) {
+  std::mt19937 random(42);
+  for (const int match : {1, 2, 60}) {
+    const std::vector<int8_t> matrix = ScoreMatrix(match, 2);
+    SimdSmithWaterman aligner(GetParam(), matrix, 3, 1);
+    SimdSmithWaterman sse2(SmithWatermanKernel::kSse2, matrix, 3, 1);
+    for (int n = 0; n < 100; ++n) {
+      const std::vector<int8_t> ref = RandomBases(&random, 20 + n * 3);
+      const int start = random() % (ref.size() / 2);
+      std::vector<int8_t> query =
+          Mutate(&random, std::vector<int8_t>(ref.begin() + start, ref.end()));
+      if (n % 10 == 0) {
+        query = RandomBases(&random, query.size());
+      }
+      aligner.SetQuery(query);
+      sse2.SetQuery(query);
+      CompactAlignment alignment;
+      CompactAlignment expected;
+      ASSERT_TRUE(aligner.Align(ref, &alignment));
+      ASSERT_TRUE(sse2.Align(ref, &expected));
+      EXPECT_EQ(BestScore(query, ref, matrix, 3, 1), alignment.sw_score);
+      ExpectConsistent(query, ref, matrix, 3, 1, alignment);
+      EXPECT_EQ(expected.query_begin, alignment.query_begin);
+      EXPECT_EQ(expected.query_end, alignment.query_end);
+      EXPECT_EQ(expected.ref_begin, alignment.ref_begin);
+      EXPECT_EQ(expected.ref_end, alignment.ref_end);
+      EXPECT_EQ(expected.cigar, alignment.cigar);
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(Kernels, SimdSmithWatermanTest,
+                        ::testing::Values(SmithWatermanKernel::kSse2,
+                                          SmithWatermanKernel::kAvx2,
+                                          SmithWatermanKernel::kAvx512bw,
+                                          SmithWatermanKernel::kAuto));
+
+TEST(ResolveKernelTest, ResolvesToASupportedKernel) {
+  for (const SmithWatermanKernel kernel :
+       {SmithWatermanKernel::kSse2, SmithWatermanKernel::kAvx2,
+        SmithWatermanKernel::kAvx512bw, SmithWatermanKernel::kAuto}) {
+    const SmithWatermanKernel resolved = ResolveKernel(kernel);
+    EXPECT_NE(SmithWatermanKernel::kAuto, resolved);
+    EXPECT_TRUE(CpuSupportsKernel(resolved));
+  }
+  EXPECT_EQ(SmithWatermanKernel::kSse2,
+            ResolveKernel(SmithWatermanKernel::kSse2));
+}
+
+TEST(BandedSmithWatermanTest, RejectsEmptySequencesAndNegativeBands) {
+  const std::vector<int8_t> query = {0, 1};
+  BandedSmithWaterman aligner(ScoreMatrix(1, 1), 2, 1);
+  CompactAlignment alignment;
+  EXPECT_FALSE(aligner.Align(query, {}, 0, 2, &alignment));
+  EXPECT_FALSE(aligner.Align({}, query, 0, 2, &alignment));
+  EXPECT_FALSE(aligner.Align(query, query, 0, -1, &alignment));
+}
+
+TEST(BandedSmithWatermanTest, AlignsWithinTheBand) {
+  // ttAtt against tttt, as for SimdSmithWaterman.
+  const std::vector<int8_t> query = {3, 3, 0, 3, 3};
+  BandedSmithWaterman aligner(ScoreMatrix(4, 2), 4, 2);
+  CompactAlignment alignment;
+  ASSERT_TRUE(aligner.Align(query, {3, 3, 3, 3}, 0, 1, &alignment));
+  EXPECT_EQ(12, alignment.sw_score);
+  EXPECT_EQ(0, alignment.query_begin);
+  EXPECT_EQ(4, alignment.query_end);
+  EXPECT_EQ(0, alignment.ref_begin);
+  EXPECT_EQ(3, alignment.ref_end);
+  EXPECT_THAT(alignment.cigar, ElementsAre(2 << 4, 1 << 4 | 1, 2 << 4));
+}
+
+TEST(BandedSmithWatermanTest, MissesAlignmentsOutsideTheBand) {
+  // The query matches ref at offset 4, far from the diagonal through 0.
+  const std::vector<int8_t> query = {0, 1, 2, 3};
+  const std::vector<int8_t> ref = {3, 3, 3, 3, 0, 1, 2, 3};
+  BandedSmithWaterman aligner(ScoreMatrix(1, 1), 2, 1);
+  CompactAlignment alignment;
+  ASSERT_TRUE(aligner.Align(query, ref, 0, 1, &alignment));
+  EXPECT_EQ(1, alignment.sw_score);
+  ASSERT_TRUE(aligner.Align(query, ref, 4, 1, &alignment));
+  EXPECT_EQ(4, alignment.sw_score);
+  EXPECT_EQ(0, alignment.query_begin);
+  EXPECT_EQ(4, alignment.ref_begin);
+  EXPECT_THAT(alignment.cigar, ElementsAre(4 << 4));
+}
+
+// A band covering every cell finds the best score of a full alignment.
+TEST(BandedSmithWatermanTest, MatchesBruteForceWithAWideBand) {
+  std::mt19937 random(42);
+  const std::vector<int8_t> matrix = ScoreMatrix(2, 2);
+  BandedSmithWaterman aligner(matrix, 3, 1);
+  for (int n = 0; n < 100; ++n) {
+    const std::vector<int8_t> ref = RandomBases(&random, 20 + n);
+    const int start = random() % (ref.size() / 2);
+    const std::vector<int8_t> query =
+        Mutate(&random, std::vector<int8_t>(ref.begin() + start, ref.end()));
+    const int band_width = query.size() + ref.size();
+    CompactAlignment alignment;
+    ASSERT_TRUE(aligner.Align(query, ref, start, band_width, &alignment));
+    const int best_score = BestScore(query, ref, matrix, 3, 1);
+    EXPECT_EQ(best_score, alignment.sw_score);
+    ExpectConsistent(query, ref, matrix, 3, 1, alignment);
+
+    // Narrower bands give consistent, possibly worse alignments.
+    ASSERT_TRUE(aligner.Align(query, ref, start, 2, &alignment));
+    EXPECT_LE(alignment.sw_score, best_score);
+    ExpectConsistent(query, ref, matrix, 3, 1, alignment);
+  }
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -30,6 +30,10 @@
  */
 
 #include "deepvariant/realigner/ssw.h"
+
+#include <algorithm>
+
+#include "src/ssw.h"
 #include "src/ssw_cpp.h"
 #include "tensorflow/core/platform/types.h"
 
@@ -38,6 +42,56 @@ namespace genomics {
 namespace deepvariant {
 
 using tensorflow::string;
+using tensorflow::StringPiece;
+
+namespace {
+
+// The number of base codes in the SSW score matrix: A, C, G, T and N.
+constexpr int kNumBaseCodes = 5;
+
+// Translates bases into SSW's base codes, as StripedSmithWaterman::Aligner
+// does: A, C, G and T in either case become 0 to 3, anything else 4.
+void TranslateBases(StringPiece bases, std::vector<int8_t>* translated) {
+  translated->resize(bases.size());
+  for (size_t i = 0; i < bases.size(); ++i) {
+    switch (bases[i]) {
+      case 'A':
+      case 'a':
+        (*translated)[i] = 0;
+        break;
+      case 'C':
+      case 'c':
+        (*translated)[i] = 1;
+        break;
+      case 'G':
+      case 'g':
+        (*translated)[i] = 2;
+        break;
+      case 'T':
+      case 't':
+        (*translated)[i] = 3;
+        break;
+      default:
+        (*translated)[i] = 4;
+    }
+  }
+}
+
+// Returns the 5x5 matrix of the scores of pairs of base codes, the same as
+// StripedSmithWaterman::Aligner's: N scores 0 against everything.
+std::vector<int8_t> MakeScoreMatrix(uint8_t match_score,
+                                    uint8_t mismatch_penalty) {
+  std::vector<int8_t> score_matrix(kNumBaseCodes * kNumBaseCodes, 0);
+  for (int i = 0; i < kNumBaseCodes - 1; ++i) {
+    for (int j = 0; j < kNumBaseCodes - 1; ++j) {
+      score_matrix[i * kNumBaseCodes + j] =
+          i == j ? match_score : -static_cast<int8_t>(mismatch_penalty);
+    }
+  }
+  return score_matrix;
+}
+
+}  // namespace
 
 Filter::Filter()
     : StripedSmithWaterman::Filter()
@@ -73,6 +127,89 @@ bool Aligner::Align(const string& query, const Filter& filter,
       query.c_str(), filter, alignment);
 }
 
+QueryAligner::QueryAligner(uint8_t match_score, uint8_t mismatch_penalty,
+                           uint8_t gap_opening_penalty,
+                           uint8_t gap_extending_penalty,
+                           SmithWatermanKernel kernel)
+    : gap_opening_penalty_(gap_opening_penalty),
+      gap_extending_penalty_(gap_extending_penalty),
+      score_matrix_(MakeScoreMatrix(match_score, mismatch_penalty)),
+      banded_(score_matrix_, gap_opening_penalty, gap_extending_penalty) {
+  if (kernel != SmithWatermanKernel::kLibssw) {
+    simd_.reset(new SimdSmithWaterman(kernel, score_matrix_,
+                                      gap_opening_penalty,
+                                      gap_extending_penalty));
+  }
+}
+
+QueryAligner::~QueryAligner() {
+  if (profile_ != nullptr) {
+    init_destroy(profile_);
+  }
+}
+
+void QueryAligner::SetQuery(StringPiece query) {
+  if (profile_ != nullptr) {
+    init_destroy(profile_);
+    profile_ = nullptr;
+  }
+  TranslateBases(query, &translated_query_);
+  if (simd_) {
+    simd_->SetQuery(translated_query_);
+  } else if (!translated_query_.empty()) {
+    // A score size of 2 lets SSW fall back from 8 to 16 bit scores.
+    profile_ = ssw_init(translated_query_.data(), translated_query_.size(),
+                        score_matrix_.data(), kNumBaseCodes, 2);
+  }
+}
+
+bool QueryAligner::Align(StringPiece reference, CompactAlignment* alignment) {
+  if (simd_) {
+    TranslateBases(reference, &translated_reference_);
+    return simd_->Align(translated_reference_, alignment);
+  }
+  if (profile_ == nullptr || reference.empty()) {
+    return false;
+  }
+  TranslateBases(reference, &translated_reference_);
+  // The flag and filters StripedSmithWaterman::Aligner uses for a default
+  // Filter, which reports begin positions and cigars.  The mask length only
+  // affects the suboptimal alignment, which we don't report.
+  const int32_t mask_len = std::max<int32_t>(translated_query_.size() / 2, 15);
+  s_align* result = ssw_align(profile_, translated_reference_.data(),
+                              translated_reference_.size(),
+                              gap_opening_penalty_, gap_extending_penalty_,
+                              0x0f, 0, 32767, mask_len);
+  if (result == nullptr) {
+    return false;
+  }
+  alignment->sw_score = result->score1;
+  alignment->query_begin = result->read_begin1;
+  alignment->query_end = result->read_end1;
+  alignment->ref_begin = result->ref_begin1;
+  alignment->ref_end = result->ref_end1;
+  alignment->cigar.assign(result->cigar, result->cigar + result->cigarLen);
+  align_destroy(result);
+  return true;
+}
+
+bool QueryAligner::AlignBanded(StringPiece reference, int diagonal,
+                               int band_width, CompactAlignment* alignment) {
+  TranslateBases(reference, &translated_reference_);
+  return banded_.Align(translated_query_, translated_reference_, diagonal,
+                       band_width, alignment);
+}
+
+bool QueryAligner::AlignAll(const std::vector<StringPiece>& references,
+                            std::vector<CompactAlignment>* alignments) {
+  alignments->resize(references.size());
+  bool ok = true;
+  for (size_t i = 0; i < references.size(); ++i) {
+    ok &= Align(references[i], &(*alignments)[i]);
+  }
+  return ok;
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
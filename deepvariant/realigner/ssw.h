@@ -32,7 +32,13 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_SSW_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_SSW_H_
 
+#include <memory>
+#include <vector>
+
+#include "deepvariant/realigner/smith_waterman.h"
+#include "src/ssw.h"
 #include "src/ssw_cpp.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace learning {
@@ -70,6 +76,55 @@ class Aligner : public StripedSmithWaterman::Aligner {
       const;
 };
 
+// Aligns one query against many reference sequences.  Aligner::Align builds
+// SSW's striped query profile anew on every call; QueryAligner builds it once
+// in SetQuery and reuses it for every reference.  With the kLibssw kernel it
+// gives the same alignments as Aligner with a default Filter; the other
+// kernels are those of SimdSmithWaterman, with the same scores.
+class QueryAligner {
+ public:
+  QueryAligner(uint8_t match_score, uint8_t mismatch_penalty,
+               uint8_t gap_opening_penalty, uint8_t gap_extending_penalty,
+               SmithWatermanKernel kernel = SmithWatermanKernel::kLibssw);
+  ~QueryAligner();
+
+  QueryAligner(const QueryAligner&) = delete;
+  QueryAligner& operator=(const QueryAligner&) = delete;
+
+  // Builds the query profile of query, replacing that of any previous query.
+  void SetQuery(tensorflow::StringPiece query);
+
+  // Aligns the query to reference.  Returns false, leaving *alignment
+  // untouched, if the query or reference is empty.
+  bool Align(tensorflow::StringPiece reference, CompactAlignment* alignment);
+
+  // Aligns the query to reference with BandedSmithWaterman, only considering
+  // the cells within band_width of the diagonal on which query offset i
+  // aligns to reference offset i + diagonal.  The kernel is not used.
+  // Returns false, leaving *alignment untouched, if the query or reference is
+  // empty or band_width is negative.
+  bool AlignBanded(tensorflow::StringPiece reference, int diagonal,
+                   int band_width, CompactAlignment* alignment);
+
+  // Aligns the query to each of references, into the same position of
+  // *alignments.  *alignments is resized to match references, reusing the
+  // storage of its existing elements.  Returns false if any alignment fails.
+  bool AlignAll(const std::vector<tensorflow::StringPiece>& references,
+                std::vector<CompactAlignment>* alignments);
+
+ private:
+  uint8_t gap_opening_penalty_;
+  uint8_t gap_extending_penalty_;
+  std::vector<int8_t> score_matrix_;
+  BandedSmithWaterman banded_;
+  // The profile keeps pointers into score_matrix_ and translated_query_.
+  std::vector<int8_t> translated_query_;
+  s_profile* profile_ = nullptr;
+  std::vector<int8_t> translated_reference_;
+  // Set unless the kernel is kLibssw, in which case profile_ is used.
+  std::unique_ptr<SimdSmithWaterman> simd_;
+};
+
 
 }  // namespace deepvariant
 }  // namespace genomics
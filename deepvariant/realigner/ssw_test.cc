@@ -32,7 +32,10 @@
 #include "deepvariant/realigner/ssw.h"
 #include <stdio.h>
 
+#include <vector>
+
 #include "src/ssw_cpp.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace learning {
@@ -40,6 +43,7 @@ namespace genomics {
 namespace deepvariant {
 
 using tensorflow::string;
+using tensorflow::StringPiece;
 
 // This exercises a bug in gcc 5.4.  b/68725977
 // Building libssw with -fno-inline should work around it.
@@ -55,8 +59,63 @@ int Gcc54Bug() {
   return 0;
 }
 
+// QueryAligner should find the same alignments as Aligner, with the soft
+// clips dropped and =/X reported as M.
+int QueryAlignerMatchesAligner() {
+  const string query = "ACGTTAGGCAnTTAC";
+  const std::vector<string> references = {
+      "ACGTTAGGCATTAC", "GGACGTTAGCATTACGG", "ttacgttaaaaaggcattac",
+      "CCCCC"};
+  QueryAligner query_aligner(1, 1, 2, 1);
+  query_aligner.SetQuery(query);
+  std::vector<CompactAlignment> compact;
+  if (!query_aligner.AlignAll(
+          std::vector<StringPiece>(references.begin(), references.end()),
+          &compact)) {
+    return 1;
+  }
+  if (compact.size() != references.size()) return 1;
+
+  Aligner aligner(1, 1, 2, 1);
+  Filter filter;
+  for (size_t i = 0; i < references.size(); ++i) {
+    Alignment expected;
+    aligner.SetReferenceSequence(references[i]);
+    if (!aligner.Align(query, filter, &expected)) return 1;
+    const CompactAlignment& actual = compact[i];
+    if (actual.sw_score != expected.sw_score ||
+        actual.query_begin != expected.query_begin ||
+        actual.query_end != expected.query_end ||
+        actual.ref_begin != expected.ref_begin ||
+        actual.ref_end != expected.ref_end) {
+      return 1;
+    }
+    // Merges runs of =, X and M in the cigar of Aligner, skipping soft clips.
+    std::vector<uint32_t> expected_cigar;
+    for (uint32_t unit : expected.cigar) {
+      uint32_t op = unit & 0xf;
+      if (op == 4) continue;
+      if (op == 7 || op == 8) op = 0;
+      if (!expected_cigar.empty() && (expected_cigar.back() & 0xf) == op) {
+        expected_cigar.back() += unit & ~0xfu;
+      } else {
+        expected_cigar.push_back((unit & ~0xfu) | op);
+      }
+    }
+    if (actual.cigar != expected_cigar) return 1;
+  }
+
+  // An empty reference cannot be aligned.
+  CompactAlignment empty;
+  if (query_aligner.Align("", &empty)) return 1;
+  return 0;
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
 
-int main() { return learning::genomics::deepvariant::Gcc54Bug(); }
+int main() {
+  return learning::genomics::deepvariant::Gcc54Bug() ||
+         learning::genomics::deepvariant::QueryAlignerMatchesAligner();
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/window_selector.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "deepvariant/core/genomics/cigar.pb.h"
+#include "deepvariant/core/stage_timer.h"
+#include "deepvariant/core/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+namespace tf = tensorflow;
+
+using learning::genomics::v1::CigarUnit;
+using learning::genomics::v1::Range;
+using learning::genomics::v1::Read;
+
+namespace {
+
+// Calls add(pos) for each candidate position of read, as an offset within
+// ref, in cigar order and possibly repeatedly; see ReadCandidatePositions.
+template <class AddPosition>
+tf::Status ForEachCandidate(
+    const RealignerOptions::WindowSelectorOptions& options, const string& ref,
+    const Read& read, int64 ref_offset, AddPosition&& add_position) {
+  if (read.alignment().mapping_quality() < options.min_mapq()) {
+    return tf::Status::OK();
+  }
+  const int64 ref_length = ref.size();
+  const string& bases = read.aligned_sequence();
+  const auto& quals = read.aligned_quality();
+  const int read_length = std::min<int>(bases.size(), quals.size());
+  const int min_base_quality = options.min_base_quality();
+  auto add = [&](int64 pos) {
+    if (pos >= 0 && pos < ref_length) {
+      add_position(pos);
+    }
+  };
+
+  const int64 read_start = read.alignment().position().position();
+  int64 ref_pos = read_start - ref_offset;
+  int read_pos = 0;
+  for (const CigarUnit& cigar : read.alignment().cigar()) {
+    // Stop once the read is past the end of the reference.
+    if (ref_pos >= ref_length) {
+      break;
+    }
+    const int length = cigar.operation_length();
+    switch (cigar.operation()) {
+      case CigarUnit::ALIGNMENT_MATCH:
+      case CigarUnit::SEQUENCE_MISMATCH:
+      case CigarUnit::INSERT:
+      case CigarUnit::CLIP_SOFT:
+        if (read_pos + length > read_length) {
+          return tf::errors::InvalidArgument(
+              "Cigar consumes more bases than the read has: ",
+              read.ShortDebugString());
+        }
+        break;
+      default:
+        break;
+    }
+    switch (cigar.operation()) {
+      case CigarUnit::ALIGNMENT_MATCH:
+        for (int i = 0; i < length && ref_pos + i < ref_length; ++i) {
+          if (ref_pos + i >= 0 && ref[ref_pos + i] != bases[read_pos + i] &&
+              quals.Get(read_pos + i) >= min_base_quality) {
+            add(ref_pos + i);
+          }
+        }
+        read_pos += length;
+        ref_pos += length;
+        break;
+      case CigarUnit::SEQUENCE_MISMATCH:
+        for (int i = 0; i < length; ++i) {
+          if (quals.Get(read_pos + i) >= min_base_quality) {
+            add(ref_pos + i);
+          }
+        }
+        read_pos += length;
+        ref_pos += length;
+        break;
+      case CigarUnit::INSERT:
+        // Insertions extend their candidates back by their length.
+        for (int i = 0; i < length; ++i) {
+          if (quals.Get(read_pos + i) >= min_base_quality) {
+            add(ref_pos + i);
+            add(ref_pos - length + i);
+          }
+        }
+        read_pos += length;
+        break;
+      case CigarUnit::CLIP_SOFT: {
+        // As in window_selector.py, a leading clip only extends the read
+        // backwards when its offset position equals its absolute one.
+        const int64 offset = ref_pos == read_start ? -length : 0;
+        for (int i = 0; i < length; ++i) {
+          if (quals.Get(read_pos + i) >= min_base_quality) {
+            add(ref_pos + offset + i);
+          }
+        }
+        read_pos += length;
+        break;
+      }
+      case CigarUnit::DELETE:
+      case CigarUnit::SKIP:
+        for (int i = 0; i < length; ++i) {
+          add(ref_pos + i);
+        }
+        ref_pos += length;
+        break;
+      case CigarUnit::SEQUENCE_MATCH:
+        read_pos += length;
+        ref_pos += length;
+        break;
+      case CigarUnit::CLIP_HARD:
+        break;
+      default:
+        return tf::errors::InvalidArgument("Unexpected CIGAR operation ",
+                                           cigar.ShortDebugString(), " in ",
+                                           read.ShortDebugString());
+    }
+  }
+  return tf::Status::OK();
+}
+
+}  // namespace
+
+StatusOr<std::vector<int64>> ReadCandidatePositions(
+    const RealignerOptions::WindowSelectorOptions& options, const string& ref,
+    const Read& read, int64 ref_offset) {
+  std::vector<int64> positions;
+  TF_RETURN_IF_ERROR(
+      ForEachCandidate(options, ref, read, ref_offset,
+                       [&positions](int64 pos) { positions.push_back(pos); }));
+  std::sort(positions.begin(), positions.end());
+  positions.erase(std::unique(positions.begin(), positions.end()),
+                  positions.end());
+  return positions;
+}
+
+StatusOr<std::vector<Range>> SelectWindows(
+    const RealignerOptions::WindowSelectorOptions& options, const string& ref,
+    const std::vector<Read>& reads, const string& ref_name, int64 ref_offset) {
+  core::ScopedStageTimer timer(core::REALIGNMENT);
+  // The number of reads with a candidate at each position of ref, and the
+  // last read counted there, so each read counts at most once.
+  std::vector<int> num_reads(ref.size(), 0);
+  std::vector<int> last_read(ref.size(), -1);
+  for (int r = 0; r < static_cast<int>(reads.size()); ++r) {
+    TF_RETURN_IF_ERROR(ForEachCandidate(options, ref, reads[r], ref_offset,
+                                        [&, r](int64 pos) {
+                                          if (last_read[pos] != r) {
+                                            last_read[pos] = r;
+                                            ++num_reads[pos];
+                                          }
+                                        }));
+  }
+
+  const int distance = options.min_windows_distance();
+  std::vector<Range> windows;
+  int64 start_pos = -1;
+  int64 end_pos = -1;
+  for (int64 pos = 0; pos < static_cast<int64>(ref.size()); ++pos) {
+    const int count = num_reads[pos];
+    if (count == 0 || count < options.min_num_supporting_reads() ||
+        count > options.max_num_supporting_reads()) {
+      continue;
+    }
+    if (start_pos == -1) {
+      start_pos = end_pos = pos;
+    } else if (pos > end_pos + distance) {
+      windows.push_back(core::MakeRange(ref_name,
+                                        start_pos + ref_offset - distance,
+                                        end_pos + ref_offset + distance));
+      start_pos = end_pos = pos;
+    } else {
+      end_pos = pos;
+    }
+  }
+  if (start_pos != -1) {
+    windows.push_back(core::MakeRange(ref_name,
+                                      start_pos + ref_offset - distance,
+                                      end_pos + ref_offset + distance));
+  }
+  return windows;
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
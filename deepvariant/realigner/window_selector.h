@@ -0,0 +1,90 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_WINDOW_SELECTOR_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_WINDOW_SELECTOR_H_
+
+#include <vector>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/protos/realigner.pb.h"
+#include "deepvariant/vendor/statusor.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using tensorflow::int64;
+using tensorflow::string;
+
+// Returns the sorted, distinct offsets within ref of the positions at which
+// read shows evidence of variation, where ref starts at ref_offset.  This is
+// the native equivalent of
+//
+//   window_selector.WindowSelector(options).process_read(ref, read,
+//                                                        ref_offset)
+//
+// and, like it, yields mismatching well-qualified bases of ALIGNMENT_MATCH
+// operations, well-qualified bases of SEQUENCE_MISMATCH, INSERT (extended
+// back by the insertion's length) and CLIP_SOFT operations, and the deleted
+// bases of DELETE and SKIP operations.  Reads whose mapping quality is below
+// options.min_mapq yield nothing.  Returns InvalidArgument for the cigar
+// operations the realigner doesn't support (PAD and unspecified ones) and for
+// cigars consuming more bases than the read has.
+StatusOr<std::vector<int64>> ReadCandidatePositions(
+    const RealignerOptions::WindowSelectorOptions& options, const string& ref,
+    const learning::genomics::v1::Read& read, int64 ref_offset);
+
+// Returns the windows for local assembly around the positions of ref that
+// have between options.min_num_supporting_reads and
+// options.max_num_supporting_reads candidate reads, merging positions within
+// options.min_windows_distance of each other and padding each window by that
+// distance.  This is the native equivalent of
+//
+//   window_selector.WindowSelector(options).process_reads(ref, reads,
+//                                                         ref_name,
+//                                                         ref_offset)
+//
+// but counts the candidates of all the reads in a single pass over them.  The
+// windows are returned in increasing order, with only their reference_name,
+// start and end set.
+StatusOr<std::vector<learning::genomics::v1::Range>> SelectWindows(
+    const RealignerOptions::WindowSelectorOptions& options, const string& ref,
+    const std::vector<learning::genomics::v1::Read>& reads,
+    const string& ref_name, int64 ref_offset);
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_REALIGNER_WINDOW_SELECTOR_H_
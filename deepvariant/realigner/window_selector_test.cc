@@ -0,0 +1,181 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/realigner/window_selector.h"
+
+#include <vector>
+
+#include "deepvariant/core/test_utils.h"
+#include "deepvariant/core/utils.h"
+#include "deepvariant/testing/protocol-buffer-matchers.h"
+#include "deepvariant/vendor/status_matchers.h"
+
+#include <gmock/gmock-generated-matchers.h>
+#include <gmock/gmock-matchers.h>
+#include <gmock/gmock-more-matchers.h>
+
+#include "tensorflow/core/platform/test.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using core::MakeRange;
+using core::MakeRead;
+using learning::genomics::testing::EqualsProto;
+using learning::genomics::v1::CigarUnit;
+using learning::genomics::v1::Read;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+// The options of window_selector_test.py.
+RealignerOptions::WindowSelectorOptions TestOptions() {
+  RealignerOptions::WindowSelectorOptions options;
+  options.set_min_num_supporting_reads(2);
+  options.set_max_num_supporting_reads(10);
+  options.set_min_mapq(20);
+  options.set_min_base_quality(20);
+  options.set_min_windows_distance(4);
+  return options;
+}
+
+Read MakeReadWithQuals(int start, const string& bases,
+                       const std::vector<string>& cigar,
+                       const std::vector<int>& quals) {
+  Read read = MakeRead("ref", start, bases, cigar);
+  read.clear_aligned_quality();
+  for (const int qual : quals) {
+    read.add_aligned_quality(qual);
+  }
+  return read;
+}
+
+std::vector<int64> Candidates(const Read& read, int64 ref_offset = 0) {
+  const auto positions = ReadCandidatePositions(
+      TestOptions(), string(100, 'A'), read, ref_offset);
+  EXPECT_THAT(positions, IsOK());
+  return positions.ValueOrDie();
+}
+
+TEST(ReadCandidatePositionsTest, FindsEachKindOfCandidate) {
+  EXPECT_THAT(Candidates(MakeRead("ref", 10, "AAGA", {"4M"})),
+              ElementsAre(12));
+  EXPECT_THAT(Candidates(MakeRead("ref", 10, "AAGTA", {"2M", "2I", "1M"})),
+              ElementsAre(10, 11, 12, 13));
+  EXPECT_THAT(Candidates(MakeRead("ref", 10, "AAA", {"2M", "2D", "1M"})),
+              ElementsAre(12, 13));
+  EXPECT_THAT(
+      Candidates(MakeRead("ref", 10, "TGATAC", {"2S", "3M", "1S"})),
+      ElementsAre(8, 9, 11, 13));
+  EXPECT_THAT(Candidates(MakeRead("ref", 10, "AAGA", {"2M", "1X", "1M"})),
+              ElementsAre(12));
+}
+
+TEST(ReadCandidatePositionsTest, SkipsLowQualityBases) {
+  EXPECT_THAT(
+      Candidates(MakeReadWithQuals(10, "AAGA", {"4M"}, {64, 64, 10, 30})),
+      IsEmpty());
+  EXPECT_THAT(Candidates(MakeReadWithQuals(10, "AAGTA", {"2M", "2I", "1M"},
+                                           {64, 64, 10, 30, 64})),
+              ElementsAre(11, 13));
+  EXPECT_THAT(Candidates(MakeReadWithQuals(10, "TGATAC", {"2S", "3M", "1S"},
+                                           {64, 10, 64, 64, 64, 64})),
+              ElementsAre(8, 11, 13));
+  EXPECT_THAT(Candidates(MakeReadWithQuals(10, "AAGA", {"2M", "1X", "1M"},
+                                           {64, 64, 30, 10})),
+              ElementsAre(12));
+}
+
+TEST(ReadCandidatePositionsTest, SkipsPoorlyMappedReads) {
+  Read read = MakeRead("ref", 10, "AAGA", {"4M"});
+  read.mutable_alignment()->set_mapping_quality(19);
+  EXPECT_THAT(Candidates(read), IsEmpty());
+}
+
+TEST(ReadCandidatePositionsTest, CountsFromTheReferenceOffset) {
+  EXPECT_THAT(Candidates(MakeRead("ref", 1010, "AAGA", {"4M"}), 1000),
+              ElementsAre(12));
+  // Candidates outside the reference are dropped.
+  EXPECT_THAT(Candidates(MakeRead("ref", 996, "GAAAAG", {"6M"}), 1000),
+              ElementsAre(1));
+}
+
+TEST(ReadCandidatePositionsTest, RejectsUnsupportedReads) {
+  Read padded = MakeRead("ref", 10, "AAAA", {"2M", "1P", "2M"});
+  EXPECT_THAT(ReadCandidatePositions(TestOptions(), string(100, 'A'), padded,
+                                     0),
+              IsNotOKWithCode(tensorflow::error::INVALID_ARGUMENT));
+  Read truncated = MakeRead("ref", 10, "AAAA", {"5M"});
+  EXPECT_THAT(ReadCandidatePositions(TestOptions(), string(100, 'A'),
+                                     truncated, 0),
+              IsNotOKWithCode(tensorflow::error::INVALID_ARGUMENT));
+}
+
+TEST(SelectWindowsTest, MergesSupportedCandidatesIntoWindows) {
+  // Each read has a single candidate, two bases after its start.
+  std::vector<Read> reads;
+  auto add_reads = [&reads](int start, int n) {
+    for (int i = 0; i < n; ++i) {
+      reads.push_back(MakeRead("ref", 100 + start, "AAGA", {"4M"}));
+    }
+  };
+  add_reads(10, 2);
+  add_reads(13, 2);   // Within min_windows_distance of 12, so merged.
+  add_reads(28, 1);   // Too few reads.
+  add_reads(48, 2);
+  add_reads(68, 11);  // Too many reads.
+
+  const auto windows =
+      SelectWindows(TestOptions(), string(100, 'A'), reads, "ref", 100);
+  ASSERT_THAT(windows, IsOK());
+  EXPECT_THAT(windows.ValueOrDie(),
+              ElementsAre(EqualsProto(MakeRange("ref", 108, 119)),
+                          EqualsProto(MakeRange("ref", 146, 154))));
+}
+
+TEST(SelectWindowsTest, CountsEachReadOncePerPosition) {
+  // Both the insertion and the mismatch make this read a candidate at 12.
+  const std::vector<Read> reads = {
+      MakeRead("ref", 10, "AAGAGA", {"1M", "2I", "3M"}),
+  };
+  RealignerOptions::WindowSelectorOptions options = TestOptions();
+  options.set_min_num_supporting_reads(1);
+  options.set_max_num_supporting_reads(1);
+  const auto windows =
+      SelectWindows(options, string(100, 'A'), reads, "ref", 0);
+  ASSERT_THAT(windows, IsOK());
+  EXPECT_THAT(windows.ValueOrDie(),
+              ElementsAre(EqualsProto(MakeRange("ref", 5, 16))));
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -42,6 +42,7 @@ import tensorflow as tf
 
 from tensorflow.core.example import example_pb2
 
+from deepvariant import example_stream
 from deepvariant.core import io_utils
 from deepvariant.core import ranges
 from deepvariant.core.genomics import variants_pb2
@@ -167,6 +168,8 @@ def _get_one_example_from_examples_path(source):
 
 def get_shape_from_examples_path(source):
   """Reads one record from source to determine the tensor shape for all."""
+  if example_stream.is_example_stream(source):
+    return example_stream.read_shape(source)
   one_example = _get_one_example_from_examples_path(source)
   if one_example:
     return example_image_shape(one_example)
@@ -175,6 +178,9 @@ def get_shape_from_examples_path(source):
 
 def get_format_from_examples_path(source):
   """Reads one record from source to determine the format for all."""
+  if example_stream.is_example_stream(source):
+    # Example streams only ever hold raw images.
+    return 'raw' if example_stream.read_shape(source) else None
   one_example = _get_one_example_from_examples_path(source)
   if one_example:
     return example_image_format(one_example)
@@ -31,7 +31,10 @@
 
 #include "deepvariant/utils.h"
 
+#include <algorithm>
+
 #include "deepvariant/core/utils.h"
+#include "tensorflow/core/lib/strings/strcat.h"
 
 
 namespace learning {
@@ -53,6 +56,105 @@ Allele MakeAllele(const string& bases,
   return allele;
 }
 
+// Separator string that will appear between the fragment name and read number
+// the string key constructed from a Read with ReadKey().
+static constexpr char kFragmentNameReadNumberSeparator[] = "/";
+
+constexpr int ReadIdInterner::kUnknownReadId;
+
+string ReadKey(const learning::genomics::v1::Read& read) {
+  return tensorflow::strings::StrCat(read.fragment_name(),
+                                     kFragmentNameReadNumberSeparator,
+                                     read.read_number());
+}
+
+string ReadKey(const core::ReadView& read) {
+  return tensorflow::strings::StrCat(read.FragmentName(),
+                                     kFragmentNameReadNumberSeparator,
+                                     read.ReadNumber());
+}
+
+const string& ReadIdInterner::BufferKey(
+    const learning::genomics::v1::Read& read) const {
+  key_buffer_.assign(read.fragment_name());
+  tensorflow::strings::StrAppend(&key_buffer_, kFragmentNameReadNumberSeparator,
+                                 read.read_number());
+  return key_buffer_;
+}
+
+const string& ReadIdInterner::BufferKey(const core::ReadView& read) const {
+  key_buffer_.assign(read.FragmentName().data(), read.FragmentName().size());
+  tensorflow::strings::StrAppend(&key_buffer_, kFragmentNameReadNumberSeparator,
+                                 read.ReadNumber());
+  return key_buffer_;
+}
+
+int ReadIdInterner::Intern(const learning::genomics::v1::Read& read,
+                           bool* seen_before) {
+  return InternKey(BufferKey(read), seen_before);
+}
+
+int ReadIdInterner::Intern(const core::ReadView& read, bool* seen_before) {
+  return InternKey(BufferKey(read), seen_before);
+}
+
+int ReadIdInterner::InternKey(const string& key, bool* seen_before) {
+  const auto inserted = ids_.emplace(key, keys_.size());
+  if (inserted.second) {
+    keys_.push_back(&inserted.first->first);
+    key_bytes_ += inserted.first->first.capacity();
+  }
+  if (seen_before != nullptr) *seen_before = !inserted.second;
+  return inserted.first->second;
+}
+
+int ReadIdInterner::Find(const learning::genomics::v1::Read& read) const {
+  return Find(BufferKey(read));
+}
+
+int ReadIdInterner::Find(const core::ReadView& read) const {
+  return Find(BufferKey(read));
+}
+
+int ReadIdInterner::Find(const string& read_key) const {
+  const auto found = ids_.find(read_key);
+  return found == ids_.end() ? kUnknownReadId : found->second;
+}
+
+void ReadIdInterner::Clear() {
+  keys_.clear();
+  ids_.clear();
+  key_bytes_ = 0;
+}
+
+tensorflow::int64 ReadIdInterner::MemoryUsage() const {
+  // Each entry of ids_ is a node holding the key and id, and a next pointer.
+  constexpr tensorflow::int64 kNodeBytes =
+      sizeof(std::pair<const string, int>) + sizeof(void*);
+  return key_bytes_ + ids_.size() * kNodeBytes +
+         ids_.bucket_count() * sizeof(void*) +
+         keys_.capacity() * sizeof(const string*) + key_buffer_.capacity();
+}
+
+std::vector<int> SupportingReadIds(const DeepVariantCall& dv_call,
+                                   const std::vector<string>& alt_alleles,
+                                   const ReadIdInterner& read_ids) {
+  std::vector<int> supporting;
+  const auto& allele_support = dv_call.allele_support();
+  for (const string& alt_allele : alt_alleles) {
+    const auto it = allele_support.find(alt_allele);
+    if (it == allele_support.end()) continue;
+    for (const string& read_name : it->second.read_names()) {
+      const int id = read_ids.Find(read_name);
+      if (id != ReadIdInterner::kUnknownReadId) supporting.push_back(id);
+    }
+  }
+  std::sort(supporting.begin(), supporting.end());
+  supporting.erase(std::unique(supporting.begin(), supporting.end()),
+                   supporting.end());
+  return supporting;
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
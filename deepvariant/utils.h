@@ -33,8 +33,14 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_UTILS_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_UTILS_H_
 
+#include <unordered_map>
+#include <vector>
+
+#include "deepvariant/core/genomics/reads.pb.h"
+#include "deepvariant/core/read_view.h"
 #include "deepvariant/core/genomics/variants.pb.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
 #include "tensorflow/core/platform/types.h"
 
 namespace learning {
@@ -54,6 +60,77 @@ Allele MakeAllele(const string& bases,
                   const AlleleType type,
                   const int count);
 
+// Constructs the unique string key for read used throughout DeepVariant, such
+// as in AlleleCount.read_alleles and DeepVariantCall.allele_support. The key is
+// the concatenation of fragment_name, "/", and read_number.
+string ReadKey(const learning::genomics::v1::Read& read);
+string ReadKey(const core::ReadView& read);
+
+// Assigns dense integer ids to the reads of a region.
+//
+// Reads are identified across DeepVariant by their ReadKey() string, which is
+// expensive to build, hash, and compare on hot paths. A ReadIdInterner assigns
+// each distinct read key an integer id, in order starting from 0, the first
+// time the read is seen. Later lookups can then work on these ids, so checking
+// whether a read is in some set of supporting reads becomes an integer search.
+//
+// Ids are only meaningful relative to the interner that assigned them. This
+// class is not thread-safe.
+class ReadIdInterner {
+ public:
+  // Returned by Find() for reads that haven't been interned.
+  static constexpr int kUnknownReadId = -1;
+
+  ReadIdInterner() = default;
+
+  // Returns the id of read, assigning it the next id if this is the first time
+  // it has been seen. If seen_before is not nullptr, it is set to true if read
+  // already had an id.
+  int Intern(const learning::genomics::v1::Read& read,
+             bool* seen_before = nullptr);
+  int Intern(const core::ReadView& read, bool* seen_before = nullptr);
+
+  // Returns the id of read or the read key, or kUnknownReadId if it hasn't been
+  // interned.
+  int Find(const learning::genomics::v1::Read& read) const;
+  int Find(const core::ReadView& read) const;
+  int Find(const string& read_key) const;
+
+  // Gets the ReadKey() of the read with id, which must be >= 0 and < size().
+  const string& Key(int id) const { return *keys_[id]; }
+
+  // The number of distinct reads interned so far.
+  int size() const { return keys_.size(); }
+
+  // Forgets all interned reads, so ids start again from 0.
+  void Clear();
+
+  // Estimates the bytes of memory held by our keys and their index.
+  tensorflow::int64 MemoryUsage() const;
+
+ private:
+  // Fills in key_buffer_ with ReadKey(read), reusing its storage.
+  const string& BufferKey(const learning::genomics::v1::Read& read) const;
+  const string& BufferKey(const core::ReadView& read) const;
+
+  // Interns key, the ReadKey() of a read.
+  int InternKey(const string& key, bool* seen_before);
+
+  // Our keys, indexed by id. These point into ids_, whose keys are stable.
+  std::vector<const string*> keys_;
+  std::unordered_map<string, int> ids_;
+  mutable string key_buffer_;
+  // The total capacity of the keys in ids_.
+  tensorflow::int64 key_bytes_ = 0;
+};
+
+// Gets the sorted ids in read_ids of the reads supporting any of alt_alleles
+// in the allele_support of dv_call. Supporting reads without an id in read_ids
+// are ignored. The result is suitable for std::binary_search.
+std::vector<int> SupportingReadIds(const DeepVariantCall& dv_call,
+                                   const std::vector<string>& alt_alleles,
+                                   const ReadIdInterner& read_ids);
+
 
 }  // namespace deepvariant
 }  // namespace genomics
@@ -53,6 +53,71 @@ TEST(UtilsTest, TestMakeAllele) {
               EqualsProto("bases: \"AC\" type: INSERTION count: 10"));
 }
 
+TEST(UtilsTest, TestReadKey) {
+  learning::genomics::v1::Read read =
+      core::MakeRead("chr1", 10, "ACGT", {"4M"});
+  read.set_fragment_name("fragment");
+  read.set_read_number(1);
+  EXPECT_EQ(ReadKey(read), "fragment/1");
+}
+
+TEST(ReadIdInternerTest, TestInternAssignsDenseIds) {
+  learning::genomics::v1::Read read1 =
+      core::MakeRead("chr1", 10, "ACGT", {"4M"});
+  read1.set_fragment_name("fragment");
+  read1.set_read_number(0);
+  learning::genomics::v1::Read read2 = read1;
+  read2.set_read_number(1);
+
+  ReadIdInterner read_ids;
+  EXPECT_EQ(read_ids.Find(read1), ReadIdInterner::kUnknownReadId);
+
+  bool seen_before = true;
+  EXPECT_EQ(read_ids.Intern(read1, &seen_before), 0);
+  EXPECT_FALSE(seen_before);
+  EXPECT_EQ(read_ids.Intern(read2, &seen_before), 1);
+  EXPECT_FALSE(seen_before);
+  EXPECT_EQ(read_ids.Intern(read1, &seen_before), 0);
+  EXPECT_TRUE(seen_before);
+
+  EXPECT_EQ(read_ids.size(), 2);
+  EXPECT_EQ(read_ids.Key(0), "fragment/0");
+  EXPECT_EQ(read_ids.Key(1), "fragment/1");
+  EXPECT_EQ(read_ids.Find(read2), 1);
+  EXPECT_EQ(read_ids.Find("fragment/1"), 1);
+  EXPECT_EQ(read_ids.Find("fragment/2"), ReadIdInterner::kUnknownReadId);
+
+  read_ids.Clear();
+  EXPECT_EQ(read_ids.size(), 0);
+  EXPECT_EQ(read_ids.Find(read1), ReadIdInterner::kUnknownReadId);
+}
+
+TEST(ReadIdInternerTest, TestSupportingReadIds) {
+  ReadIdInterner read_ids;
+  for (const string& name : {"a", "b", "c", "d"}) {
+    learning::genomics::v1::Read read =
+        core::MakeRead("chr1", 10, "ACGT", {"4M"});
+    read.set_fragment_name(name);
+    read_ids.Intern(read);
+  }
+
+  DeepVariantCall dv_call;
+  auto& support = *dv_call.mutable_allele_support();
+  support["C"].add_read_names("d/0");
+  support["C"].add_read_names("b/0");
+  // Reads without an id are ignored.
+  support["C"].add_read_names("unknown/0");
+  support["G"].add_read_names("a/0");
+  support["G"].add_read_names("b/0");
+
+  EXPECT_THAT(SupportingReadIds(dv_call, {"C"}, read_ids),
+              ::testing::ElementsAre(1, 3));
+  EXPECT_THAT(SupportingReadIds(dv_call, {"C", "G"}, read_ids),
+              ::testing::ElementsAre(0, 1, 3));
+  EXPECT_THAT(SupportingReadIds(dv_call, {"T"}, read_ids),
+              ::testing::IsEmpty());
+}
+
 }  // namespace deepvariant
 }  // namespace genomics
 }  // namespace learning
@@ -100,6 +100,13 @@ class VariantCaller(object):
     else:
       self.table = None
 
+  def reseed(self, random_seed):
+    """Resets the random state used to emit reference sites to random_seed."""
+    options = type(self.options)()
+    options.CopyFrom(self.options)
+    options.random_seed = random_seed
+    self.cpp_variant_caller = variant_calling.VariantCaller(options)
+
   def reference_confidence(self, n_ref, n_total):
     """Computes the confidence that a site in the genome has no variation.
 
@@ -290,5 +297,10 @@ class VariantCaller(object):
 
     gvcfs = []
     if include_gvcfs:
-      gvcfs = list(self.make_gvcfs(allele_counter.summary_counts()))
+      # Computed natively from the counts of allele_counter, exactly as
+      # make_gvcfs does from its summary_counts(), but without creating a
+      # proto for each position.
+      gvcfs = self.cpp_variant_caller.make_gvcfs(
+          allele_counter,
+          self.max_cache_coverage if self.table is not None else 0)
     return candidates, gvcfs
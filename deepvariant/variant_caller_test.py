@@ -282,11 +282,20 @@ class VariantCallerTests(parameterized.TestCase):
     caller = self.make_test_caller(0.01, 100)
     with mock.patch.object(caller, 'cpp_variant_caller') as mock_cpp:
       mock_cpp.calls_from_allele_counter.return_value = fake_candidates
+      # The native gVCF records are those of make_gvcfs, which is checked in
+      # variant_calling_wrap_test.
+      mock_cpp.make_gvcfs.side_effect = (
+          lambda counter, _: list(caller.make_gvcfs(counter.summary_counts())))
       candidates, gvcfs = caller.calls_from_allele_counter(
           allele_counter, include_gvcfs)
 
     mock_cpp.calls_from_allele_counter.assert_called_once_with(allele_counter)
     self.assertEqual(candidates, fake_candidates)
+    if include_gvcfs:
+      # We don't use a cache table, so the counts aren't rescaled.
+      mock_cpp.make_gvcfs.assert_called_once_with(allele_counter, 0)
+    else:
+      mock_cpp.make_gvcfs.assert_not_called()
 
     # We expect our gvcfs to occur at the 10 position and that 12 and 13 have
     # been merged into a 2 bp block, if enabled. Otherwise should be empty.
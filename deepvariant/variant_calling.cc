@@ -32,15 +32,22 @@
 #include "deepvariant/variant_calling.h"
 
 #include <algorithm>
+#include <cmath>
+#include <map>
 #include <numeric>
+#include <tuple>
+#include <utility>
 
 #include "deepvariant/core/genomics/variants.pb.h"
 #include "deepvariant/core/math.h"
+#include "deepvariant/core/stage_timer.h"
 #include "deepvariant/core/utils.h"
 #include "deepvariant/allelecounter.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
 
 namespace {
 // Used for sorting RepeatedPtrField below.
@@ -55,8 +62,10 @@ namespace learning {
 namespace genomics {
 namespace deepvariant {
 
+using learning::genomics::v1::Range;
 using learning::genomics::v1::Variant;
 using learning::genomics::v1::VariantCall;
+using tensorflow::int64;
 using tensorflow::gtl::nullopt;
 using tensorflow::gtl::optional;
 using tensorflow::gtl::make_optional;
@@ -68,6 +77,7 @@ const char* const kSupportingUncalledAllele = "UNCALLED_ALLELE";
 const char *const kDPFormatField = "DP";
 const char *const kADFormatField = "AD";
 const char *const kVAFFormatField = "VAF";
+const char *const kGQFormatField = "GQ";
 
 // The VCF/Variant allele string to use when you don't have any alt alleles.
 const char* const kNoAltAllele = ".";
@@ -168,14 +178,13 @@ bool VariantCaller::IsGoodAltAllele(const Allele& allele,
          (1.0 * allele.count()) / total_count >= min_fraction(allele);
 }
 
-// Select the subset of GoodAltAlleles from the alleles of allele_count.
+// Select the subset of GoodAltAlleles from the summed alleles of a site with
+// total_count reads.
 //
-// Returns the vector of allele objects from allele_count that satisfy
+// Returns the vector of allele objects from alleles that satisfy
 // IsGoodAltAllele().
 std::vector<Allele> VariantCaller::SelectAltAlleles(
-    const AlleleCount& allele_count) const {
-  const std::vector<Allele> alleles = SumAlleleCounts(allele_count);
-  const int total_count = TotalAlleleCounts(allele_count);
+    const std::vector<Allele>& alleles, const int total_count) const {
   std::vector<Allele> alt_alleles;
   for (const auto& allele : alleles) {
     if (IsGoodAltAllele(allele, total_count)) {
@@ -212,8 +221,7 @@ struct OrderAllele {
 };
 using AlleleMap = std::map<Allele, string, OrderAllele>;
 
-AlleleMap BuildAlleleMap(const AlleleCount& allele_count,
-                         const std::vector<Allele>& alt_alleles,
+AlleleMap BuildAlleleMap(const std::vector<Allele>& alt_alleles,
                          const string& ref_bases) {
   AlleleMap allele_map;
 
@@ -254,14 +262,15 @@ AlleleMap BuildAlleleMap(const AlleleCount& allele_count,
 // DP: the total number of observed reads at the site.
 // AD: the number of reads supporting each of our ref and alt alleles.
 // VAF: the allele fraction of the variants (only including alt alleles).
-// These are calculated from the provided allele_count information. The
+// These are calculated from the total_count reads at the site, ref_count of
+// which support the reference, and the counts of the alt alleles. The
 // allele_map is needed to map between the Variant reference and alternate_bases
-// and the Alleles used in allele_count.
-void AddReadDepths(const AlleleCount& allele_count, const AlleleMap& allele_map,
-                   Variant* variant) {
+// and the Alleles counted at the site.
+void AddReadDepths(const int total_count, const int ref_count,
+                   const AlleleMap& allele_map, Variant* variant) {
   // Set the DP to the total good reads seen at this position.
   VariantCall* call = variant->mutable_calls(0);
-  core::SetInfoField(kDPFormatField, TotalAlleleCounts(allele_count), call);
+  core::SetInfoField(kDPFormatField, total_count, call);
 
   if (variant->alternate_bases_size() == 1 &&
       (variant->alternate_bases(0) == kNoAltAllele ||
@@ -269,11 +278,11 @@ void AddReadDepths(const AlleleCount& allele_count, const AlleleMap& allele_map,
     // Variant has no alts or is a a gVCF record so only DP is meaningful.
     return;
   } else {
-    int dp = TotalAlleleCounts(allele_count);
+    int dp = total_count;
     // Build up AD and VAF.
     std::vector<int> ad;
     std::vector<double> vaf;
-    ad.push_back(allele_count.ref_supporting_read_count());
+    ad.push_back(ref_count);
 
     std::map<tensorflow::StringPiece, const Allele*> alt_to_alleles;
     for (const auto& entry : allele_map) {
@@ -300,66 +309,158 @@ bool VariantCaller::KeepReferenceSite() const {
   return options_.fraction_reference_sites_to_emit() > 0.0 && sampler_.Keep();
 }
 
+// Creates a non-reference Variant proto in variant, which must be empty, for
+// the site at position on reference_name with ref_base, alt_alleles and
+// total_count reads, ref_count of which support the reference. The
+// reference_bases are calculated based on the alt_alleles, which are also set
+// appropriately for the variant. For convenience, the alt_alleles are sorted.
+// Also adds a single VariantCall to the Variant, with sample_name, uncalled
+// diploid genotypes and the read depths of the site. Returns the map from each
+// of alt_alleles to its allele in the Variant.
+AlleleMap MakeCandidateVariant(const string& sample_name,
+                               const string& reference_name,
+                               const int64 position, const string& ref_base,
+                               const std::vector<Allele>& alt_alleles,
+                               const int total_count, const int ref_count,
+                               Variant* variant) {
+  variant->set_reference_name(reference_name);
+  variant->set_start(position);
+  const string refbases = CalcRefBases(ref_base, alt_alleles);
+  variant->set_reference_bases(refbases);
+  variant->set_end(variant->start() + refbases.size());
+  AddGenotypes(sample_name, {-1, -1}, variant);
+
+  // Compute the map from read alleles to the alleles we'll use in our Variant.
+  // Add the alternate alleles from our allele_map to the variant.
+  AlleleMap allele_map = BuildAlleleMap(alt_alleles, refbases);
+  for (const auto& elt : allele_map) {
+    variant->add_alternate_bases(elt.second);
+  }
+  // If we don't have any alt_alleles, we are generating a reference site so
+  // add in the kNoAltAllele.
+  if (alt_alleles.empty()) variant->add_alternate_bases(kNoAltAllele);
+  std::sort(variant->mutable_alternate_bases()->pointer_begin(),
+            variant->mutable_alternate_bases()->pointer_end(),
+            StringPtrLessThan());
+
+  AddReadDepths(total_count, ref_count, allele_map, variant);
+  return allele_map;
+}
+
 std::vector<DeepVariantCall> VariantCaller::CallsFromAlleleCounter(
     const AlleleCounter& allele_counter) const {
-  return CallsFromAlleleCounts(allele_counter.Counts());
+  std::vector<DeepVariantCall> variants;
+  for (CompactCall& compact : CompactCallsFromAlleleCounter(allele_counter)) {
+    variants.push_back(
+        ExpandAlleleSupport(std::move(compact), allele_counter.ReadIds()));
+  }
+  return variants;
 }
 
 std::vector<DeepVariantCall> VariantCaller::CallsFromAlleleCounts(
     const std::vector<AlleleCount>& allele_counts) const {
+  core::ScopedStageTimer timer(core::CANDIDATE_CALLING);
+  const bool screen_sites = CanScreenSites();
   std::vector<DeepVariantCall> variants;
   for (const AlleleCount& allele_count : allele_counts) {
-    optional<DeepVariantCall> call = CallVariant(allele_count);
-    if (call) {
-      variants.push_back(*call);
+    if (screen_sites &&
+        !MayHaveGoodAltAllele(allele_count.read_alleles_size(),
+                              TotalAlleleCounts(allele_count))) {
+      continue;
+    }
+    // Builds each call in place, dropping it again if the site isn't a
+    // candidate, rather than copying it into variants.
+    variants.emplace_back();
+    if (!CallVariant(allele_count, &variants.back())) {
+      variants.pop_back();
     }
   }
 
   return variants;
 }
 
+std::vector<int64> VariantCaller::CandidateOffsets(
+    const AlleleCounter& allele_counter) const {
+  // Finds the positions that may be candidates from just their read counts,
+  // with one pass over the whole interval.
+  const int64 length = allele_counter.IntervalLength();
+  std::vector<int64> survivors;
+  if (CanScreenSites()) {
+    for (int64 i = 0; i < length; ++i) {
+      if (MayHaveGoodAltAllele(allele_counter.NReadAlleles(i),
+                               allele_counter.TotalReadCount(i))) {
+        survivors.push_back(i);
+      }
+    }
+  } else {
+    survivors.resize(length);
+    std::iota(survivors.begin(), survivors.end(), 0);
+  }
+  return survivors;
+}
+
+std::vector<CompactCall> VariantCaller::CompactCallsFromAlleleCounter(
+    const AlleleCounter& allele_counter) const {
+  core::ScopedStageTimer timer(core::CANDIDATE_CALLING);
+  std::vector<CompactCall> variants;
+  for (const int64 i : CandidateOffsets(allele_counter)) {
+    variants.emplace_back();
+    CompactCall& compact = variants.back();
+    if (!CallVariant(allele_counter, i, &compact.call,
+                     &compact.allele_support)) {
+      variants.pop_back();
+    }
+  }
+  return variants;
+}
+
+void AddAlleleSupport(const CompactAlleleSupport& allele_support,
+                      const ReadIdInterner& read_ids, DeepVariantCall* call) {
+  auto* supports = call->mutable_allele_support();
+  for (const auto& entry : allele_support) {
+    auto* read_names = (*supports)[entry.first].mutable_read_names();
+    read_names->Reserve(entry.second.size());
+    for (const int read_id : entry.second) {
+      read_names->Add()->assign(read_ids.Key(read_id));
+    }
+  }
+}
+
+DeepVariantCall ExpandAlleleSupport(CompactCall&& compact,
+                                    const ReadIdInterner& read_ids) {
+  DeepVariantCall call = std::move(compact.call);
+  AddAlleleSupport(compact.allele_support, read_ids, &call);
+  return call;
+}
+
 optional<DeepVariantCall> VariantCaller::CallVariant(
     const AlleleCount& allele_count) const {
+  DeepVariantCall call;
+  if (!CallVariant(allele_count, &call)) {
+    return nullopt;
+  }
+  return make_optional(std::move(call));
+}
+
+bool VariantCaller::CallVariant(const AlleleCount& allele_count,
+                                DeepVariantCall* call) const {
   if (!core::AreCanonicalBases(allele_count.ref_base())) {
     // We don't emit calls at any site in the genome that isn't one of the
     // canonical DNA bases (one of A, C, G, or T).
-    return nullopt;
+    return false;
   }
 
-  const std::vector<Allele>& alt_alleles = SelectAltAlleles(allele_count);
+  const int total_count = TotalAlleleCounts(allele_count);
+  const std::vector<Allele> alt_alleles =
+      SelectAltAlleles(SumAlleleCounts(allele_count), total_count);
   if (alt_alleles.empty() && !KeepReferenceSite()) {
-    return nullopt;
-  }
-  // Creates a non-reference Variant proto based on the information in
-  // allele_count and alt_alleles. This variant starts at the position of
-  // allele_count with the same reference_name. The reference_bases are
-  // calculated based on the alt_alleles, which are also set appropriately for
-  // the variant. For convenience, the alt_alleles are sorted. Also adds a
-  // single VariantCall to the Variant, with sample_name and uncalled diploid
-  // genotypes.
-  DeepVariantCall call;
-  Variant* variant = call.mutable_variant();
-  variant->set_reference_name(allele_count.position().reference_name());
-  variant->set_start(allele_count.position().position());
-  const string refbases = CalcRefBases(allele_count.ref_base(), alt_alleles);
-  variant->set_reference_bases(refbases);
-  variant->set_end(variant->start() + refbases.size());
-  AddGenotypes(options_.sample_name(), {-1, -1}, variant);
-
-  // Compute the map from read alleles to the alleles we'll use in our Variant.
-  // Add the alternate alleles from our allele_map to the variant.
-  AlleleMap allele_map = BuildAlleleMap(allele_count, alt_alleles, refbases);
-  for (const auto& elt : allele_map) {
-    variant->add_alternate_bases(elt.second);
+    return false;
   }
-  // If we don't have any alt_alleles, we are generating a reference site so
-  // add in the kNoAltAllele.
-  if (alt_alleles.empty()) variant->add_alternate_bases(kNoAltAllele);
-  std::sort(variant->mutable_alternate_bases()->pointer_begin(),
-            variant->mutable_alternate_bases()->pointer_end(),
-            StringPtrLessThan());
-
-  AddReadDepths(allele_count, allele_map, variant);
+  const AlleleMap allele_map = MakeCandidateVariant(
+      options_.sample_name(), allele_count.position().reference_name(),
+      allele_count.position().position(), allele_count.ref_base(),
+      alt_alleles, total_count, allele_count.ref_supporting_read_count(),
+      call->mutable_variant());
 
   // Iterate over each read in the allele_count, and add its name to the
   // supporting reads of for the Variant allele it supports.
@@ -374,12 +475,239 @@ optional<DeepVariantCall> VariantCaller::CallVariant(
       auto it = allele_map.find(allele);
       const string& supported_allele =
           it == allele_map.end() ? unknown_allele : it->second;
-      auto& supports = (*call.mutable_allele_support())[supported_allele];
+      auto& supports = (*call->mutable_allele_support())[supported_allele];
       supports.add_read_names(read_name);
     }
   }
 
-  return make_optional(call);
+  return true;
+}
+
+bool VariantCaller::CallVariant(const AlleleCounter& allele_counter,
+                                const int64 offset, DeepVariantCall* call,
+                                CompactAlleleSupport* allele_support) const {
+  const string ref_base(1, allele_counter.RefBaseAt(offset));
+  if (!core::AreCanonicalBases(ref_base)) {
+    return false;
+  }
+
+  const ReadAlleleRecord* begin;
+  const ReadAlleleRecord* end;
+  allele_counter.ReadAllelesAt(offset, &begin, &end);
+
+  // Sums up the reads of each allele at offset straight from the records of
+  // allele_counter, in the order of SumAlleleCounts().
+  std::map<std::pair<tensorflow::StringPiece, AlleleType>, int> allele_sums;
+  for (const ReadAlleleRecord* record = begin; record != end; ++record) {
+    ++allele_sums[{allele_counter.AlleleBases(record->allele_id),
+                   allele_counter.AlleleTypeOf(record->allele_id)}];
+  }
+  std::vector<Allele> alleles;
+  alleles.reserve(allele_sums.size() + 1);
+  for (const auto& entry : allele_sums) {
+    alleles.push_back(MakeAllele(entry.first.first.ToString(),
+                                 entry.first.second, entry.second));
+  }
+  const int ref_count = allele_counter.RefSupportingReadCount(offset);
+  if (ref_count > 0) {
+    alleles.push_back(MakeAllele(ref_base, AlleleType::REFERENCE, ref_count));
+  }
+
+  const int total_count = allele_counter.TotalReadCount(offset);
+  const std::vector<Allele> alt_alleles =
+      SelectAltAlleles(alleles, total_count);
+  if (alt_alleles.empty() && !KeepReferenceSite()) {
+    return false;
+  }
+  const Range& interval = allele_counter.Interval();
+  const AlleleMap allele_map = MakeCandidateVariant(
+      options_.sample_name(), interval.reference_name(),
+      interval.start() + offset, ref_base, alt_alleles, total_count, ref_count,
+      call->mutable_variant());
+
+  // Resolves the Variant allele supported by each allele id at offset just
+  // once, and then refers to the supporting reads by their ids.
+  std::map<int, std::vector<int>*> supports_by_allele_id;
+  for (const ReadAlleleRecord* record = begin; record != end; ++record) {
+    const AlleleType type = allele_counter.AlleleTypeOf(record->allele_id);
+    if (type == AlleleType::REFERENCE) continue;
+    std::vector<int>*& supports = supports_by_allele_id[record->allele_id];
+    if (supports == nullptr) {
+      const auto it = allele_map.find(
+          MakeAllele(allele_counter.AlleleBases(record->allele_id), type, 1));
+      supports = &(*allele_support)[it == allele_map.end()
+                                        ? kSupportingUncalledAllele
+                                        : it->second];
+    }
+    supports->push_back(record->read_id);
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Code for creating gVCF reference blocks.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// The reference bases we compute reference confidence for.
+bool IsCanonicalBase(const char base) {
+  return base == 'A' || base == 'C' || base == 'G' || base == 'T';
+}
+
+// The ambiguous reference bases we don't emit gVCF records for.
+bool IsIupacCode(const char base) {
+  return IsCanonicalBase(base) ||
+         tensorflow::StringPiece("RYSWKMBDHVN").find(base) !=
+             tensorflow::StringPiece::npos;
+}
+
+}  // namespace
+
+int ComputeReferenceConfidence(const int n_ref, const int n_total,
+                               const VariantCallerOptions& options,
+                               double* likelihoods) {
+  CHECK_GE(n_ref, 0) << "n_ref must be >= 0";
+  CHECK_GE(n_total, n_ref) << "n_total must be >= n_ref";
+  std::vector<double> log10_probs;
+  if (n_total == 0) {
+    // No coverage case - all likelihoods are log10 of 1/3, 1/3, 1/3.
+    log10_probs = core::Log10Normalize({-1.0, -1.0, -1.0});
+  } else {
+    const double p_error = options.p_error();
+    log10_probs = core::Log10Normalize(
+        {core::Log10Binomial(n_total - n_ref, n_total, p_error),
+         core::Log10Binomial(n_ref, n_total, 1.0 / options.ploidy()),
+         core::Log10Binomial(n_ref, n_total, p_error)});
+  }
+  std::copy(log10_probs.begin(), log10_probs.end(), likelihoods);
+  const double gq = core::Log10PTrueToPhred(log10_probs[0], options.max_gq());
+  return static_cast<int>(
+      std::min(std::floor(gq), static_cast<double>(options.max_gq())));
+}
+
+constexpr int ReferenceConfidenceTable::kMaxCoverage;
+
+ReferenceConfidenceTable::ReferenceConfidenceTable(
+    const VariantCallerOptions& options)
+    : entries_((kMaxCoverage + 1) * (kMaxCoverage + 2) / 2) {
+  for (int n_total = 0; n_total <= kMaxCoverage; ++n_total) {
+    for (int n_ref = 0; n_ref <= n_total; ++n_ref) {
+      Entry& entry = entries_[n_total * (n_total + 1) / 2 + n_ref];
+      entry.gq = ComputeReferenceConfidence(n_ref, n_total, options,
+                                            entry.likelihoods);
+    }
+  }
+}
+
+std::shared_ptr<const ReferenceConfidenceTable>
+ReferenceConfidenceTable::ForOptions(const VariantCallerOptions& options) {
+  CHECK_GE(options.ploidy(), 1) << "ploidy must be >= 1";
+  using Key = std::tuple<float, int, int>;
+  static tensorflow::mutex* mu = new tensorflow::mutex;
+  static auto* tables =
+      new std::map<Key, std::shared_ptr<const ReferenceConfidenceTable>>;
+  const Key key(options.p_error(), options.ploidy(), options.max_gq());
+  // Tables are computed under the lock, so concurrent callers with the same
+  // options wait for the first one's table rather than computing their own.
+  tensorflow::mutex_lock lock(*mu);
+  auto& table = (*tables)[key];
+  if (table == nullptr) table.reset(new ReferenceConfidenceTable(options));
+  return table;
+}
+
+int VariantCaller::ReferenceConfidence(const int n_ref, const int n_total,
+                                       double* scratch,
+                                       const double** likelihoods) const {
+  if (n_total <= ReferenceConfidenceTable::kMaxCoverage) {
+    const ReferenceConfidenceTable::Entry& entry =
+        ref_confidences_->Get(n_ref, n_total);
+    *likelihoods = entry.likelihoods;
+    return entry.gq;
+  }
+  *likelihoods = scratch;
+  return ComputeReferenceConfidence(n_ref, n_total, options_, scratch);
+}
+
+StatusOr<std::vector<Variant>> VariantCaller::MakeGVCFs(
+    const AlleleCounter& allele_counter, const int max_coverage) const {
+  core::ScopedStageTimer timer(core::CANDIDATE_CALLING);
+  if (options_.ploidy() != 2) {
+    return tensorflow::errors::InvalidArgument(
+        StrCat("ploidy=", options_.ploidy(), " but we only support ploidy=2"));
+  }
+  const int gq_resolution = std::max(options_.gq_resolution(), 1);
+  const v1::Range& interval = allele_counter.Interval();
+
+  std::vector<Variant> gvcfs;
+  // The GQ band and GQ of the block in gvcfs.back(). block_band is -1 if that
+  // block is complete.
+  int block_band = -1;
+  int block_gq = 0;
+  double scratch[3];
+  for (int64 i = 0; i < allele_counter.IntervalLength(); ++i) {
+    const char ref_base = allele_counter.RefBaseAt(i);
+    if (!IsCanonicalBase(ref_base)) {
+      if (!IsIupacCode(ref_base)) {
+        return tensorflow::errors::InvalidArgument(
+            StrCat("Invalid reference base=", string(1, ref_base),
+                   " found during gvcf calculation"));
+      }
+      block_band = -1;
+      continue;
+    }
+
+    int n_ref = allele_counter.RefSupportingReadCount(i);
+    int n_total = allele_counter.TotalReadCount(i);
+    if (max_coverage > 0 && n_total > max_coverage) {
+      n_ref =
+          static_cast<int>(std::ceil(n_ref / (1.0 * n_total) * max_coverage));
+      n_total = max_coverage;
+    }
+    const double* position_likelihoods;
+    const int gq =
+        ReferenceConfidence(n_ref, n_total, scratch, &position_likelihoods);
+
+    const int band = gq / gq_resolution;
+    if (band == block_band) {
+      // Extends the current block, keeping the smallest GQ of its positions.
+      Variant& block = gvcfs.back();
+      block.set_end(interval.start() + i + 1);
+      VariantCall* call = block.mutable_calls(0);
+      if (gq < block_gq) {
+        block_gq = gq;
+        core::SetInfoField(kGQFormatField, gq, call);
+        call->mutable_genotype_likelihood()->Clear();
+        for (int j = 0; j < 3; ++j) {
+          call->add_genotype_likelihood(position_likelihoods[j]);
+        }
+      }
+      continue;
+    }
+
+    // Starts a new block at this position.
+    gvcfs.emplace_back();
+    Variant& block = gvcfs.back();
+    block.set_reference_name(interval.reference_name());
+    block.set_start(interval.start() + i);
+    block.set_end(interval.start() + i + 1);
+    block.set_reference_bases(string(1, ref_base));
+    block.add_alternate_bases(kGVCFAltAllele);
+    VariantCall* call = block.add_calls();
+    call->set_call_set_name(options_.sample_name());
+    call->add_genotype(0);
+    call->add_genotype(0);
+    for (int j = 0; j < 3; ++j) {
+      call->add_genotype_likelihood(position_likelihoods[j]);
+    }
+    core::SetInfoField(kGQFormatField, gq, call);
+    block_band = band;
+    block_gq = gq;
+  }
+  return gvcfs;
 }
 
 }  // namespace deepvariant
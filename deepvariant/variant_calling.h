@@ -34,12 +34,16 @@
 #ifndef LEARNING_GENOMICS_DEEPVARIANT_VARIANT_CALLING_H_
 #define LEARNING_GENOMICS_DEEPVARIANT_VARIANT_CALLING_H_
 
+#include <algorithm>
+#include <map>
+#include <memory>
 #include <vector>
 
 #include "deepvariant/core/genomics/variants.pb.h"
 #include "deepvariant/core/samplers.h"
 #include "deepvariant/allelecounter.h"
 #include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/vendor/statusor.h"
 #include "tensorflow/core/lib/gtl/optional.h"
 
 namespace learning {
@@ -62,6 +66,84 @@ extern const char *const kDPFormatField;
 extern const char *const kADFormatField;
 extern const char *const kVAFFormatField;
 
+// The GQ (genotype quality) format field of our gVCF records.
+extern const char *const kGQFormatField;
+
+// Computes the confidence that a site where n_total reads were counted, n_ref
+// of which support the reference, is homozygous reference, with the p_error,
+// ploidy and max_gq of options.
+//
+// The log10 likelihoods of the hom-ref, het and hom-alt genotypes against any
+// alternative allele are binomial densities: of the n_total - n_ref
+// non-reference reads at p_error, and of the n_ref reference reads at
+// 1 / ploidy and at p_error, respectively, normalized to sum to 1 in real
+// space. They are -log10(3) each if n_total is 0. The GQ is the Phred-scaled
+// probability that the site isn't hom-ref, floored and capped at max_gq. The
+// GQ is returned and the likelihoods written to likelihoods, which must have
+// room for 3 values.
+int ComputeReferenceConfidence(int n_ref, int n_total,
+                               const VariantCallerOptions& options,
+                               double* likelihoods);
+
+// A table of ComputeReferenceConfidence() for every n_ref <= n_total <=
+// kMaxCoverage, for one p_error, ploidy and max_gq.
+//
+// Tables are computed once per set of options and process, on first use, and
+// are then shared and read concurrently by all the VariantCallers using those
+// options, so reference confidence costs a lookup rather than several
+// transcendental function calls.
+class ReferenceConfidenceTable {
+ public:
+  // The greatest n_total in our tables.
+  static constexpr int kMaxCoverage = 255;
+
+  // The reference confidence of one pair of counts.
+  struct Entry {
+    int gq;
+    double likelihoods[3];
+  };
+
+  // Returns the table for the p_error, ploidy and max_gq of options.
+  static std::shared_ptr<const ReferenceConfidenceTable> ForOptions(
+      const VariantCallerOptions& options);
+
+  // Returns the reference confidence of n_ref of n_total reads, where
+  // n_ref <= n_total <= kMaxCoverage.
+  const Entry& Get(int n_ref, int n_total) const {
+    return entries_[n_total * (n_total + 1) / 2 + n_ref];
+  }
+
+ private:
+  explicit ReferenceConfidenceTable(const VariantCallerOptions& options);
+
+  // The Entry of n_ref of n_total reads, at n_total * (n_total + 1) / 2 +
+  // n_ref.
+  std::vector<Entry> entries_;
+};
+
+// The reads supporting each allele of a candidate, keyed like the
+// allele_support of a DeepVariantCall, by their ids in the ReadIds() of the
+// AlleleCounter the candidate was called from rather than by their names.
+using CompactAlleleSupport = std::map<string, std::vector<int>>;
+
+// A candidate variant with its allele_support in compact form, so that calling
+// it doesn't copy the name of every supporting read. The allele_support of
+// call is empty.
+struct CompactCall {
+  DeepVariantCall call;
+  CompactAlleleSupport allele_support;
+};
+
+// Adds the reads of allele_support to the allele_support of call, by their
+// names in read_ids.
+void AddAlleleSupport(const CompactAlleleSupport& allele_support,
+                      const ReadIdInterner& read_ids, DeepVariantCall* call);
+
+// Returns the call of compact, moved out of it, with its allele_support set
+// from that of compact, naming the reads by their keys in read_ids.
+DeepVariantCall ExpandAlleleSupport(CompactCall&& compact,
+                                    const ReadIdInterner& read_ids);
+
 // A very simple but highly sensitive variant caller.
 //
 // This class implements a very simple variant caller using the data
@@ -97,6 +179,11 @@ class VariantCaller {
  public:
   explicit VariantCaller(const VariantCallerOptions& options)
       : options_(options),
+        ref_confidences_(ReferenceConfidenceTable::ForOptions(options)),
+        min_alt_count_(
+            std::min(options.min_count_snps(), options.min_count_indels())),
+        min_alt_fraction_(std::min(options.min_fraction_snps(),
+                                   options.min_fraction_indels())),
         sampler_(options.fraction_reference_sites_to_emit(),
                  options.random_seed()) {
     CHECK_GE(options_.min_count_snps(), 0) << "min_count_snps must be >= 0";
@@ -120,16 +207,29 @@ class VariantCaller {
   // High-level API for calling variants in a region.
   //
   // These functions invokes the CallVariant methods on each AlleleCount in
-  // either the AlleleCounter object itself (via a call to Counts()) or on a
-  // vector of AlleleCounts directly. This code processes each AlleleCount in
-  // order, collecting up the DeepVariantCall protos at each site that
-  // CallVariant says is a candidate variant. These DeepVariantCall protos are
-  // returned in order.
+  // either the AlleleCounter object itself (via a call to CountAt() for each
+  // position) or on a vector of AlleleCounts directly. This code processes
+  // each AlleleCount in order, collecting up the DeepVariantCall protos at each
+  // site that CallVariant says is a candidate variant. These DeepVariantCall
+  // protos are returned in order.
+  //
+  // Unless we emit reference sites, both first screen out the positions whose
+  // non-reference reads are too few to support any good alt allele, from just
+  // the read counts at each position, so that the alleles are only summarized
+  // at the few positions that survive.
   std::vector<DeepVariantCall> CallsFromAlleleCounter(
       const AlleleCounter& allele_counter) const;
   std::vector<DeepVariantCall> CallsFromAlleleCounts(
     const std::vector<AlleleCount>& allele_counts) const;
 
+  // Same as CallsFromAlleleCounter() above, but gives the reads supporting
+  // each candidate in its compact allele_support, by their ids in the
+  // ReadIds() of allele_counter, and doesn't materialize any AlleleCounts.
+  // Expand the calls with ExpandAlleleSupport() to get the same
+  // DeepVariantCalls as CallsFromAlleleCounter(), which builds them this way.
+  std::vector<CompactCall> CompactCallsFromAlleleCounter(
+      const AlleleCounter& allele_counter) const;
+
   // Primary interface function for calling variants.
   //
   // Looks at the alleles in the provided AlleleCount proto and returns
@@ -143,6 +243,33 @@ class VariantCaller {
   tensorflow::gtl::optional<DeepVariantCall> CallVariant(
       const AlleleCount& allele_count) const;
 
+  // Computes the gVCF reference blocks over the interval of allele_counter.
+  //
+  // Computes the GQ and genotype likelihoods of each position being homozygous
+  // reference with ReferenceConfidence(), from the counts of its reference
+  // supporting and total reads, and merges runs of adjacent positions whose
+  // GQs fall in the same band of gq_resolution units into single Variants.
+  // Each has the reference base of its first position, the kGVCFAltAllele
+  // alt and a 0/0 VariantCall for our sample, with the smallest GQ of its
+  // positions and the genotype likelihoods of the first position with that GQ.
+  // Positions whose reference base is an ambiguous IUPAC code end the current
+  // block and are not covered by any. Returns an InvalidArgument error if a
+  // reference base isn't an IUPAC code or ploidy isn't 2.
+  //
+  // If max_coverage > 0, the counts of positions with more than max_coverage
+  // reads are scaled down to max_coverage reads, keeping their fraction of
+  // reference reads.
+  StatusOr<std::vector<learning::genomics::v1::Variant>> MakeGVCFs(
+      const AlleleCounter& allele_counter, int max_coverage) const;
+
+  // Returns the ComputeReferenceConfidence() of n_ref of n_total reads with
+  // our options. Looks it up in our ReferenceConfidenceTable if n_total is at
+  // most ReferenceConfidenceTable::kMaxCoverage, and otherwise computes it
+  // into scratch, which must have room for 3 values. Returns the GQ and sets
+  // *likelihoods to the genotype likelihoods.
+  int ReferenceConfidence(int n_ref, int n_total, double* scratch,
+                          const double** likelihoods) const;
+
  private:
   int min_count(const Allele& allele) const {
     return allele.type() == AlleleType::SUBSTITUTION
@@ -155,12 +282,57 @@ class VariantCaller {
                : options_.min_fraction_indels();
   }
 
-  std::vector<Allele> SelectAltAlleles(const AlleleCount& allele_count) const;
+  // Returns false if none of the alleles of the n_alt_reads non-reference
+  // reads at a site with total_count reads can be a good alt allele, which is
+  // so if n_alt_reads is below the smaller of our min counts, or is below the
+  // smaller of our min fractions of total_count, since no allele can have more
+  // reads than n_alt_reads. May return true for sites without any good alt
+  // allele, which SelectAltAlleles() then discards.
+  bool MayHaveGoodAltAllele(int n_alt_reads, int total_count) const {
+    return n_alt_reads > 0 && n_alt_reads >= min_alt_count_ &&
+           (1.0 * n_alt_reads) / total_count >= min_alt_fraction_;
+  }
+
+  // Returns true if we may skip the sites that MayHaveGoodAltAllele() rejects
+  // without calling CallVariant() on them, which we can unless we are sampling
+  // reference sites, where skipping them would change our draws.
+  bool CanScreenSites() const {
+    return options_.fraction_reference_sites_to_emit() <= 0.0;
+  }
+
+  // Implementation of CallVariant(), filling in call, which must be empty,
+  // and returning true if allele_count is a candidate. Leaves call empty
+  // otherwise.
+  bool CallVariant(const AlleleCount& allele_count,
+                   DeepVariantCall* call) const;
+
+  // Same as CallVariant() above for the site at offset of allele_counter, but
+  // reads the counts of the site straight from allele_counter and adds its
+  // supporting reads to allele_support rather than to call.
+  bool CallVariant(const AlleleCounter& allele_counter, int64 offset,
+                   DeepVariantCall* call,
+                   CompactAlleleSupport* allele_support) const;
+
+  // Returns the offsets in allele_counter that may be candidates, which are
+  // all of them unless we CanScreenSites().
+  std::vector<int64> CandidateOffsets(
+      const AlleleCounter& allele_counter) const;
+
+  std::vector<Allele> SelectAltAlleles(const std::vector<Allele>& alleles,
+                                       int total_count) const;
   bool IsGoodAltAllele(const Allele& allele, const int total_count) const;
   bool KeepReferenceSite() const;
 
   const VariantCallerOptions options_;
 
+  // The shared table of reference confidences for our options.
+  const std::shared_ptr<const ReferenceConfidenceTable> ref_confidences_;
+
+  // The smallest count and fraction any good alt allele can have, whatever
+  // its type.
+  const int min_alt_count_;
+  const double min_alt_fraction_;
+
   // Fraction of non-variant sites to emit as DeepVariantCalls.
   mutable core::PhiloxFractionalSampler sampler_;
 };
@@ -32,6 +32,8 @@
 #include "deepvariant/variant_calling.h"
 
 #include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/reference_fai.h"
+#include "deepvariant/core/reference_test.h"
 #include "deepvariant/core/test_utils.h"
 #include "deepvariant/core/utils.h"
 #include "deepvariant/protos/deepvariant.pb.h"
@@ -51,15 +53,18 @@ namespace learning {
 namespace genomics {
 namespace deepvariant {
 
+using learning::genomics::v1::Read;
 using learning::genomics::v1::Variant;
 using learning::genomics::v1::VariantCall;
 using core::IsFinite;
 using core::MakePosition;
 using ::testing::DoubleNear;
 using ::testing::Eq;
+using ::testing::IsEmpty;
 using learning::genomics::testing::EqualsProto;
 using ::testing::Pointwise;
 using ::testing::UnorderedElementsAre;
+using ::testing::UnorderedElementsAreArray;
 using tensorflow::gtl::optional;
 using tensorflow::strings::StrCat;
 
@@ -809,6 +814,128 @@ TEST_F(VariantCallingTest, TestCallsFromAlleleCounts) {
   EXPECT_THAT(candidates[1].variant(), EqualsProto(variant5));
 }
 
+// Expected values are from the R code in variant_caller_test.py.
+TEST_F(VariantCallingTest, TestReferenceConfidence) {
+  struct {
+    int n_total, n_alt;
+    double p_error;
+    std::vector<double> likelihoods;
+    int gq;
+  } const kTests[] = {
+    {0, 0, 0.01, {-0.477121, -0.477121, -0.477121}, 1},
+    {10, 0, 0.01, {-0.000469, -2.967121, -19.956821}, 29},
+    {10, 1, 0.01, {-0.044109, -1.015126, -16.009190}, 10},
+    {10, 5, 0.01, {-7.011524, -0.000000, -7.011524}, 0},
+    {10, 1, 0.001, {-0.297847, -0.304236, -24.294371}, 3},
+    {40, 0, 0.01, {-0.000000, -11.866608, -79.825408}, 100},
+  };
+  for (const auto& test : kTests) {
+    VariantCallerOptions options = MakeOptions();
+    options.set_p_error(test.p_error);
+    options.set_max_gq(100);
+    options.set_ploidy(2);
+    double likelihoods[3];
+    EXPECT_THAT(ComputeReferenceConfidence(test.n_total - test.n_alt,
+                                           test.n_total, options, likelihoods),
+                Eq(test.gq));
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_THAT(likelihoods[i], DoubleNear(test.likelihoods[i], 1e-5));
+    }
+  }
+}
+
+TEST_F(VariantCallingTest, TestReferenceConfidenceTableMatchesComputation) {
+  VariantCallerOptions options = MakeOptions();
+  options.set_p_error(0.001);
+  options.set_max_gq(50);
+  options.set_ploidy(2);
+  const VariantCaller caller(options);
+  // The table is shared by every caller with the same options.
+  EXPECT_THAT(ReferenceConfidenceTable::ForOptions(options).get(),
+              Eq(ReferenceConfidenceTable::ForOptions(options).get()));
+
+  const int kMaxCoverage = ReferenceConfidenceTable::kMaxCoverage;
+  for (const int n_total : {0, 1, 30, kMaxCoverage, kMaxCoverage + 1, 1000}) {
+    for (const int n_ref : {0, n_total / 2, n_total}) {
+      double expected[3], scratch[3];
+      const double* likelihoods;
+      EXPECT_THAT(
+          caller.ReferenceConfidence(n_ref, n_total, scratch, &likelihoods),
+          Eq(ComputeReferenceConfidence(n_ref, n_total, options, expected)));
+      for (int i = 0; i < 3; ++i) {
+        EXPECT_THAT(likelihoods[i], Eq(expected[i]));
+      }
+    }
+  }
+}
+
+TEST_F(VariantCallingTest, TestCallsFromAlleleCountsScreensSites) {
+  // Only the second site has enough alt reads for min_count = 3 and only the
+  // third enough of them for min_fraction = 0.5.
+  std::vector<AlleleCount> allele_counts = {
+    MakeTestAlleleCount(10, 2, "A", 10),
+    MakeTestAlleleCount(10, 3, "G", 11),
+    MakeTestAlleleCount(4, 2, "G", 12),
+  };
+
+  EXPECT_THAT(VariantCaller(MakeOptions(3)).CallsFromAlleleCounts(
+                  allele_counts).size(), Eq(1));
+  EXPECT_THAT(VariantCaller(MakeOptions(0, 0.5)).CallsFromAlleleCounts(
+                  allele_counts).size(), Eq(1));
+  // We don't screen sites when emitting reference sites, which all are here.
+  EXPECT_THAT(VariantCaller(MakeOptions(3, 0.9, kSampleName, 1.0))
+                  .CallsFromAlleleCounts(allele_counts).size(),
+              Eq(3));
+}
+
+
+TEST_F(VariantCallingTest, TestCompactCallsFromAlleleCounter) {
+  const string& fasta = core::TestFastaPath();
+  std::unique_ptr<const core::GenomeReference> ref =
+      std::move(core::GenomeReferenceFai::FromFile(fasta, StrCat(fasta, ".fai"))
+                    .ValueOrDie());
+  // The reference is TCCGT at chr1:10-15. Three reads carry a G (one of them
+  // also an A) at 11 and one read supports the reference.
+  AlleleCounterOptions options;
+  AlleleCounter allele_counter(ref.get(), core::MakeRange("chr1", 10, 15),
+                               options);
+  const std::vector<string> bases = {"TGCGT", "TGCGT", "TGAGT", "TCCGT"};
+  for (size_t i = 0; i < bases.size(); ++i) {
+    Read read = core::MakeRead("chr1", 10, bases[i], {"5M"});
+    read.set_fragment_name(StrCat("read_", i));
+    allele_counter.Add(read);
+  }
+
+  const VariantCaller caller(MakeOptions(2));
+  std::vector<CompactCall> compact =
+      caller.CompactCallsFromAlleleCounter(allele_counter);
+  ASSERT_THAT(compact.size(), Eq(1));
+  EXPECT_THAT(compact[0].call.allele_support(), IsEmpty());
+  ASSERT_THAT(compact[0].allele_support.size(), Eq(1));
+  const std::vector<int>& g_reads = compact[0].allele_support["G"];
+  ASSERT_THAT(g_reads.size(), Eq(3));
+  std::vector<string> g_names;
+  for (const int read_id : g_reads) {
+    g_names.push_back(allele_counter.ReadKeyOf(read_id));
+  }
+  EXPECT_THAT(g_names, UnorderedElementsAre("read_0/0", "read_1/0",
+                                            "read_2/0"));
+
+  // The expanded calls are those called from the materialized AlleleCounts,
+  // up to the order of the supporting reads.
+  const std::vector<DeepVariantCall> expected =
+      caller.CallsFromAlleleCounts(allele_counter.Counts());
+  ASSERT_THAT(expected.size(), Eq(1));
+  const DeepVariantCall call =
+      ExpandAlleleSupport(std::move(compact[0]), allele_counter.ReadIds());
+  EXPECT_THAT(call.variant(), EqualsProto(expected[0].variant()));
+  EXPECT_THAT(call.allele_support().at("G").read_names(),
+              UnorderedElementsAreArray(
+                  expected[0].allele_support().at("G").read_names()));
+  EXPECT_THAT(caller.CallsFromAlleleCounter(allele_counter)[0].variant(),
+              EqualsProto(expected[0].variant()));
+}
+
 
 }  // namespace deepvariant
 }  // namespace genomics
@@ -38,6 +38,8 @@ from absl import logging
 
 from deepvariant.core import variantutils
 from deepvariant.core.genomics import variants_pb2
+from deepvariant.protos import deepvariant_pb2
+from deepvariant.python import variant_labeler_native
 
 
 class VariantLabeler(object):
@@ -62,10 +64,11 @@ class VariantLabeler(object):
     """Creates a new VariantLabeler.
 
     Args:
-      vcf_reader: a VcfReader object that points to our truth variant set.
-      confident_regions: A RangeSet containing all of the confidently called
-        regions. A variant that falls outside of one of these regions will be
-        receive a special not-confident marker.
+      vcf_reader: a VcfReader object that points to our truth variant set, or
+        a VariantIndex of it.
+      confident_regions: A RangeSet or RangeIndex containing all of the
+        confidently called regions. A variant that falls outside of one of
+        these regions will be receive a special not-confident marker.
 
     Raises:
       ValueError: if vcf_reader is None.
@@ -75,6 +78,32 @@ class VariantLabeler(object):
     self._vcf_reader = vcf_reader
     self._confident_regions = confident_regions
 
+  def label_calls(self, dv_calls):
+    """Labels the variant of each of dv_calls.
+
+    Args:
+      dv_calls: list of deepvariant.DeepVariantCall protos, such as the
+        candidates of a region.
+
+    Returns:
+      A list with the deepvariant.VariantLabel of each of dv_calls, in order,
+      holding the results of match() for its variant and, if it is confident
+      and has alternate alleles, the match_to_alt_count() of each of them.
+    """
+    labels = []
+    for dv_call in dv_calls:
+      variant = dv_call.variant
+      is_confident, truth_variant = self.match(variant)
+      label = deepvariant_pb2.VariantLabel(is_confident=is_confident)
+      if truth_variant is not None:
+        label.truth_variant.CopyFrom(truth_variant)
+      if is_confident and not variantutils.is_ref(variant):
+        label.alt_allele_counts.extend(
+            self.match_to_alt_count(variant, truth_variant, [alt])
+            for alt in variant.alternate_bases)
+      labels.append(label)
+    return labels
+
   def match(self, variant):
     """Get a truth variant matching variant.
 
@@ -111,8 +140,8 @@ class VariantLabeler(object):
     if self._confident_regions is None:
       confident = matched_variant is not None
     else:
-      confident = self._confident_regions.variant_overlaps(
-          variant, empty_set_return_value=False)
+      confident = self._confident_regions.overlaps(variant.reference_name,
+                                                   variant.start)
       if matched_variant is None and confident:
         matched_variant = self._make_synthetic_hom_ref(variant)
     return confident, matched_variant
@@ -228,3 +257,57 @@ class VariantLabeler(object):
         true_alt in simplified_alt_alleles
         for true_alt in _simplify_alleles(
             truth_variant, variantutils.genotype_as_alleles(truth_variant)))
+
+
+class NativeVariantLabeler(object):
+  """Labels the candidates of a region with a single native call.
+
+  A NativeVariantLabeler has the label_calls() method of a VariantLabeler,
+  returning the same labels, but gets the truth variants of all of the calls at
+  once and matches them natively rather than querying and comparing the alleles
+  of each call in Python. It only reads its indices, so it is safe to share
+  across threads.
+  """
+
+  def __init__(self, variant_index, range_index):
+    """Creates a new NativeVariantLabeler.
+
+    Args:
+      variant_index: a VariantIndex of our truth variants.
+      range_index: a RangeIndex of the confident regions.
+    """
+    # The native labeler doesn't own the indices, so we keep them alive.
+    self._variant_index = variant_index
+    self._range_index = range_index
+    self._labeler = variant_labeler_native.VariantLabelerNative(
+        variant_index, range_index)
+
+  def label_calls(self, dv_calls):
+    """Labels the variant of each of dv_calls, as VariantLabeler.label_calls."""
+    return self._labeler.label_calls(dv_calls)
+
+
+def label_alt_alleles(label, variant, alt_alleles):
+  """Returns the number of copies of alt_alleles in the truth of variant.
+
+  This is the match_to_alt_count() of variant for alt_alleles, computed from
+  the alt_allele_counts of its label.
+
+  Args:
+    label: deepvariant.VariantLabel of variant from label_calls(), which must
+      be confident.
+    variant: learning.genomics.v1.Variant labeled by label.
+    alt_alleles: An iterable of strings, each an alternate allele of variant.
+
+  Returns:
+    Number of copies of alt_alleles in the true genotype.
+
+  Raises:
+    ValueError: If any of alt_alleles aren't found in variant.
+  """
+  alternate_bases = list(variant.alternate_bases)
+  if any(alt not in alternate_bases for alt in alt_alleles):
+    raise ValueError('All alt_alleles must be present in variant', alt_alleles,
+                     variant)
+  return sum(label.alt_allele_counts[alternate_bases.index(alt)]
+             for alt in alt_alleles)
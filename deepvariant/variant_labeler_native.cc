@@ -0,0 +1,232 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "deepvariant/variant_labeler_native.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "deepvariant/core/genomics/range.pb.h"
+#include "deepvariant/core/stage_timer.h"
+#include "deepvariant/core/utils.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+using learning::genomics::v1::Variant;
+using tensorflow::int64;
+using tensorflow::string;
+
+namespace {
+
+// The no-call allele of genotype_as_alleles.
+constexpr char kNoCallAllele[] = ".";
+
+// Returns true if variant has a non-PASS filter, as variantutils.is_filtered.
+bool IsFiltered(const Variant& variant) {
+  for (const string& filter : variant.filter()) {
+    if (filter != "PASS" && filter != ".") return true;
+  }
+  return false;
+}
+
+// Returns true if variant has no alternate alleles, as variantutils.is_ref.
+bool IsRef(const Variant& variant) {
+  return variant.alternate_bases_size() == 0 ||
+         (variant.alternate_bases_size() == 1 &&
+          variant.alternate_bases(0) == kNoCallAllele);
+}
+
+// The ref and alt alleles of a variant with their common postfix stripped, as
+// variantutils.simplify_alleles(ref, alt) would return them.
+std::pair<string, string> SimplifyAlleles(const string& ref,
+                                          const string& alt) {
+  const size_t shortest = std::min(ref.size(), alt.size());
+  size_t postfix = 0;
+  // Every allele keeps at least one base.
+  while (postfix + 1 < shortest &&
+         ref[ref.size() - postfix - 1] == alt[alt.size() - postfix - 1]) {
+    ++postfix;
+  }
+  return {ref.substr(0, ref.size() - postfix),
+          alt.substr(0, alt.size() - postfix)};
+}
+
+// Returns a variant with the position and alleles of candidate and a hom-ref
+// genotype, as VariantLabeler._make_synthetic_hom_ref.
+Variant SyntheticHomRef(const Variant& candidate) {
+  Variant variant;
+  variant.set_reference_name(candidate.reference_name());
+  variant.set_start(candidate.start());
+  variant.set_end(candidate.end());
+  variant.set_reference_bases(candidate.reference_bases());
+  *variant.mutable_alternate_bases() = candidate.alternate_bases();
+  auto* call = variant.add_calls();
+  call->add_genotype(0);
+  call->add_genotype(0);
+  return variant;
+}
+
+bool StartsBefore(const Variant& variant, int64 start) {
+  return variant.start() < start;
+}
+
+}  // namespace
+
+VariantLabelerNative::VariantLabelerNative(
+    const core::VariantIndex* truth_variants,
+    const core::RangeIndex* confident_regions)
+    : truth_variants_(truth_variants), confident_regions_(confident_regions) {
+  CHECK(truth_variants != nullptr);
+}
+
+StatusOr<std::vector<VariantLabel>> VariantLabelerNative::LabelCalls(
+    const std::vector<DeepVariantCall>& dv_calls) const {
+  core::ScopedStageTimer timer(core::VARIANT_LABELING);
+
+  // The first and last starts of the candidates on each of their contigs.
+  std::map<string, std::pair<int64, int64>> spans;
+  for (const DeepVariantCall& dv_call : dv_calls) {
+    const Variant& candidate = dv_call.variant();
+    const auto inserted = spans.emplace(
+        candidate.reference_name(),
+        std::make_pair(candidate.start(), candidate.start()));
+    std::pair<int64, int64>& span = inserted.first->second;
+    span.first = std::min(span.first, candidate.start());
+    span.second = std::max(span.second, candidate.start());
+  }
+
+  // The unfiltered truth variants of each contig overlapping their start,
+  // which could match a candidate. They are in the order of the index, so
+  // sorted by start and, among those with the same start, in the order a
+  // query at that start returns them.
+  std::unordered_map<string, std::vector<Variant>> truth;
+  for (const auto& span : spans) {
+    std::vector<Variant>& usable = truth[span.first];
+    for (Variant& variant : truth_variants_->Query(core::MakeRange(
+             span.first, span.second.first, span.second.second + 1))) {
+      if (variant.end() > variant.start() && !IsFiltered(variant)) {
+        usable.push_back(std::move(variant));
+      }
+    }
+  }
+
+  std::vector<VariantLabel> labels(dv_calls.size());
+  for (size_t i = 0; i < dv_calls.size(); ++i) {
+    const Variant& candidate = dv_calls[i].variant();
+    VariantLabel& label = labels[i];
+
+    const std::vector<Variant>& contig_truth =
+        truth.find(candidate.reference_name())->second;
+    auto match = std::lower_bound(contig_truth.begin(), contig_truth.end(),
+                                  candidate.start(), StartsBefore);
+    const bool matched =
+        match != contig_truth.end() && match->start() == candidate.start();
+    if (matched && std::next(match) != contig_truth.end() &&
+        std::next(match)->start() == candidate.start()) {
+      LOG(WARNING) << "Multiple matches detected, keeping first, for variant "
+                   << candidate.reference_name() << ":" << candidate.start();
+    }
+
+    if (confident_regions_ == nullptr) {
+      label.set_is_confident(matched);
+    } else {
+      label.set_is_confident(confident_regions_->Overlaps(
+          candidate.reference_name(), candidate.start()));
+    }
+    if (matched) {
+      *label.mutable_truth_variant() = *match;
+    } else if (label.is_confident()) {
+      *label.mutable_truth_variant() = SyntheticHomRef(candidate);
+    }
+
+    if (label.is_confident() && !IsRef(candidate)) {
+      TF_RETURN_IF_ERROR(CountAltAlleles(candidate, &label));
+    }
+  }
+  return labels;
+}
+
+tensorflow::Status VariantLabelerNative::CountAltAlleles(
+    const Variant& candidate, VariantLabel* label) {
+  const Variant& truth = label->truth_variant();
+  if (truth.calls_size() != 1) {
+    return tensorflow::errors::InvalidArgument(
+        "truth_variant needs exactly one genotype call to be used for "
+        "labeling but has ", truth.calls_size(), " at ",
+        truth.reference_name(), ":", truth.start());
+  }
+
+  // The simplified alleles of the truth genotype, skipping the ref ones.
+  std::vector<std::pair<string, string>> true_alts;
+  for (const int allele_index : truth.calls(0).genotype()) {
+    string allele;
+    if (allele_index == -1) {
+      allele = kNoCallAllele;
+    } else if (allele_index == 0) {
+      allele = truth.reference_bases();
+    } else if (allele_index > 0 &&
+               allele_index <= truth.alternate_bases_size()) {
+      allele = truth.alternate_bases(allele_index - 1);
+    } else {
+      return tensorflow::errors::InvalidArgument(
+          "Invalid genotype ", allele_index, " of truth_variant at ",
+          truth.reference_name(), ":", truth.start());
+    }
+    if (allele != truth.reference_bases()) {
+      true_alts.push_back(SimplifyAlleles(truth.reference_bases(), allele));
+    }
+  }
+
+  // Two different alts of the candidate simplify differently, so each true
+  // alt is a copy of at most one of them, and the label of a set of alts is
+  // the sum of their counts.
+  for (const string& alt : candidate.alternate_bases()) {
+    int count = 0;
+    if (alt != candidate.reference_bases()) {
+      const std::pair<string, string> simplified =
+          SimplifyAlleles(candidate.reference_bases(), alt);
+      count = std::count(true_alts.begin(), true_alts.end(), simplified);
+    }
+    label->add_alt_allele_counts(count);
+  }
+  return tensorflow::Status::OK();
+}
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 Google Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Labels the candidates of a region with the truth variants in one native call.
+//
+// variant_labeler.VariantLabeler matches one candidate at a time, making a
+// truth variant query and converting its results to Python protos for each,
+// and compares the alleles of every candidate and truth variant in Python.
+// VariantLabelerNative instead takes all of the candidates of a region, gets
+// the truth variants of each of its contigs with a single query, sorted by
+// start, and matches and counts alleles here.
+#ifndef LEARNING_GENOMICS_DEEPVARIANT_VARIANT_LABELER_NATIVE_H_
+#define LEARNING_GENOMICS_DEEPVARIANT_VARIANT_LABELER_NATIVE_H_
+
+#include <vector>
+
+#include "deepvariant/core/genomics/variants.pb.h"
+#include "deepvariant/core/range_index.h"
+#include "deepvariant/core/variant_index.h"
+#include "deepvariant/protos/deepvariant.pb.h"
+#include "deepvariant/vendor/statusor.h"
+
+namespace learning {
+namespace genomics {
+namespace deepvariant {
+
+class VariantLabelerNative {
+ public:
+  // Creates a labeler matching candidates to the variants in truth_variants,
+  // which are confident if they overlap confident_regions. If
+  // confident_regions is nullptr, a candidate is confident exactly when it
+  // has a matching truth variant. Neither is owned, and both must outlive us.
+  VariantLabelerNative(const core::VariantIndex* truth_variants,
+                       const core::RangeIndex* confident_regions);
+
+  // Returns the label of the variant of each of dv_calls, in order, with the
+  // same values as VariantLabeler.match and match_to_alt_count. Returns a
+  // non-ok status if a confident candidate with alternate alleles is matched
+  // to a truth variant without exactly one genotype call.
+  StatusOr<std::vector<VariantLabel>> LabelCalls(
+      const std::vector<DeepVariantCall>& dv_calls) const;
+
+ private:
+  // Sets the alt_allele_counts of label for candidate.
+  static tensorflow::Status CountAltAlleles(
+      const learning::genomics::v1::Variant& candidate, VariantLabel* label);
+
+  const core::VariantIndex* const truth_variants_;
+  const core::RangeIndex* const confident_regions_;
+};
+
+}  // namespace deepvariant
+}  // namespace genomics
+}  // namespace learning
+
+#endif  // LEARNING_GENOMICS_DEEPVARIANT_VARIANT_LABELER_NATIVE_H_
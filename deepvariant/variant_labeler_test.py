@@ -42,6 +42,7 @@ from deepvariant import test_utils
 from deepvariant import variant_labeler
 from deepvariant.core import ranges
 from deepvariant.core import variantutils
+from deepvariant.protos import deepvariant_pb2
 
 
 def setUpModule():
@@ -142,7 +143,9 @@ class VariantLabelerTest(parameterized.TestCase):
     candidate = test_utils.make_variant(start=21, alleles=['CC', 'A'])
     self.assertEqual(self.labeler.match(candidate)[1], overlapping[1])
 
-  @parameterized.parameters(
+  # The alleles of a candidate, the alt alleles we label and the alleles and
+  # genotype of its truth variant, with the expected number of alt copies.
+  alt_count_cases = (
       # Make sure we get the right alt counts for all diploid genotypes.
       (['A', 'C'], ['C'], ['A', 'C'], [0, 0], 0),
       (['A', 'C'], ['C'], ['A', 'C'], [0, 1], 1),
@@ -254,6 +257,8 @@ class VariantLabelerTest(parameterized.TestCase):
       (['AT', 'A', 'GT'], ['A'], ['A', 'G'], [0, 1], 0),
       (['AT', 'A', 'GT'], ['GT'], ['A', 'G'], [0, 1], 1),
   )
+
+  @parameterized.parameters(*alt_count_cases)
   def test_match_to_genotype_label(self, variant_alleles, alt_alleles,
                                    truth_alleles, truth_gt, expected_n_alts):
     variant = test_utils.make_variant(start=10, alleles=variant_alleles)
@@ -263,6 +268,39 @@ class VariantLabelerTest(parameterized.TestCase):
                      self.labeler.match_to_alt_count(variant, truth_variant,
                                                      alt_alleles))
 
+  @parameterized.parameters(*alt_count_cases)
+  def test_label_calls_match_to_genotype_label(self, variant_alleles,
+                                               alt_alleles, truth_alleles,
+                                               truth_gt, expected_n_alts):
+    variant = test_utils.make_variant(start=10, alleles=variant_alleles)
+    truth_variant = test_utils.make_variant(
+        start=10, alleles=truth_alleles, gt=truth_gt)
+    labeler = variant_labeler.VariantLabeler(
+        vcf_reader=mock_vcf_reader([truth_variant]))
+    label = labeler.label_calls([deepvariant_pb2.DeepVariantCall(
+        variant=variant)])[0]
+    self.assertTrue(label.is_confident)
+    self.assertEqual(truth_variant, label.truth_variant)
+    self.assertEqual(expected_n_alts,
+                     variant_labeler.label_alt_alleles(label, variant,
+                                                       alt_alleles))
+
+  def test_label_calls(self):
+    calls = [
+        deepvariant_pb2.DeepVariantCall(variant=variant)
+        for variant in [self.snp, self.non_confident, self.filtered]
+    ]
+    self.assertEqual([
+        deepvariant_pb2.VariantLabel(
+            is_confident=True, truth_variant=self.snp, alt_allele_counts=[1]),
+        deepvariant_pb2.VariantLabel(
+            is_confident=False, truth_variant=self.non_confident),
+        deepvariant_pb2.VariantLabel(
+            is_confident=True,
+            truth_variant=self.filtered_match,
+            alt_allele_counts=[0]),
+    ], self.labeler.label_calls(calls))
+
   def test_match_to_genotype_label_none_truth_variant_raises(self):
     with self.assertRaisesRegexp(ValueError, 'truth_variant cannot be None'):
       self.labeler.match_to_alt_count(self.snp, None, self.snp.alternate_bases)